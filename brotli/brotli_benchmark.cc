@@ -0,0 +1,184 @@
+#include <cstdint>
+#include <vector>
+
+#include "absl/types/span.h"
+#include "benchmark/benchmark.h"
+#include "brotli/brotli_font_diff.h"
+#include "brotli/brotli_stream.h"
+#include "common/font_data.h"
+#include "common/hb_set_unique_ptr.h"
+#include "hb-subset.h"
+#include "hb.h"
+
+using brotli::BrotliFontDiff;
+using brotli::BrotliStream;
+using common::FontData;
+using common::hb_face_unique_ptr;
+using common::hb_set_unique_ptr;
+using common::make_hb_blob;
+using common::make_hb_face;
+using common::make_hb_set;
+
+namespace {
+
+hb_face_unique_ptr LoadFace(const char* path) {
+  hb_blob_t* blob = hb_blob_create_from_file_or_fail(path);
+  hb_face_unique_ptr face = make_hb_face(hb_face_create(blob, 0));
+  hb_blob_destroy(blob);
+  return face;
+}
+
+/*
+ * A pair of Noto Sans JP subsets, each cut by a plan, where derived adds a
+ * few ranges of glyphs to base. Tables are sorted into the order expected by
+ * BrotliFontDiff.
+ */
+class SubsetPair {
+ public:
+  explicit SubsetPair(const hb_set_t* custom_tables)
+      : font_(LoadFace("common/testdata/NotoSansJP-Regular.ttf")) {
+    hb_subset_input_t* input = hb_subset_input_create_or_fail();
+    hb_set_t* gids = hb_subset_input_glyph_set(input);
+    hb_set_add_range(gids, 1000, 5000);
+    hb_set_add_range(gids, 8000, 10000);
+    base_plan_ = hb_subset_plan_create_or_fail(font_.get(), input);
+    base_ = Execute(base_plan_, custom_tables);
+
+    hb_set_add_range(gids, 500, 750);
+    hb_set_add_range(gids, 11000, 11100);
+    derived_plan_ = hb_subset_plan_create_or_fail(font_.get(), input);
+    derived_ = Execute(derived_plan_, custom_tables);
+    hb_subset_input_destroy(input);
+  }
+
+  ~SubsetPair() {
+    hb_blob_destroy(base_);
+    hb_blob_destroy(derived_);
+    hb_subset_plan_destroy(base_plan_);
+    hb_subset_plan_destroy(derived_plan_);
+  }
+
+  hb_subset_plan_t* base_plan() const { return base_plan_; }
+  hb_blob_t* base() const { return base_; }
+  hb_subset_plan_t* derived_plan() const { return derived_plan_; }
+  hb_blob_t* derived() const { return derived_; }
+
+ private:
+  hb_blob_t* Execute(hb_subset_plan_t* plan, const hb_set_t* custom_tables) {
+    hb_face_t* subset = hb_subset_plan_execute_or_fail(plan);
+    hb_set_unique_ptr immutable_tables = make_hb_set();
+    BrotliFontDiff::SortForDiff(immutable_tables.get(), custom_tables,
+                                font_.get(), subset);
+    hb_blob_t* blob = hb_face_reference_blob(subset);
+    hb_face_destroy(subset);
+    return blob;
+  }
+
+  hb_face_unique_ptr font_;
+  hb_subset_plan_t* base_plan_;
+  hb_blob_t* base_;
+  hb_subset_plan_t* derived_plan_;
+  hb_blob_t* derived_;
+};
+
+/*
+ * Diffs the subset pair. state.range(0) is a bit mask selecting the custom
+ * differs: 1 = glyf/loca, 2 = hmtx/vmtx. Tables without a custom differ are
+ * compressed with the base as a dictionary.
+ */
+void BM_BrotliFontDiff(benchmark::State& state) {
+  hb_set_unique_ptr custom_tables = make_hb_set();
+  if (state.range(0) & 1) {
+    hb_set_add(custom_tables.get(), HB_TAG('g', 'l', 'y', 'f'));
+    hb_set_add(custom_tables.get(), HB_TAG('l', 'o', 'c', 'a'));
+  }
+  if (state.range(0) & 2) {
+    hb_set_add(custom_tables.get(), HB_TAG('h', 'm', 't', 'x'));
+    hb_set_add(custom_tables.get(), HB_TAG('v', 'm', 't', 'x'));
+  }
+  hb_set_unique_ptr immutable_tables = make_hb_set();
+
+  SubsetPair fonts(custom_tables.get());
+  BrotliFontDiff differ(immutable_tables.get(), custom_tables.get());
+  FontData patch;
+  for (auto _ : state) {
+    auto sc = differ.Diff(fonts.base_plan(), fonts.base(), fonts.derived_plan(),
+                          fonts.derived(), &patch);
+    if (!sc.ok()) {
+      state.SkipWithError(sc.ToString().c_str());
+      return;
+    }
+  }
+
+  uint32_t derived_size = hb_blob_get_length(fonts.derived());
+  state.SetBytesProcessed(state.iterations() * derived_size);
+  state.counters["ratio"] = (double)patch.size() / derived_size;
+}
+BENCHMARK(BM_BrotliFontDiff)
+    ->ArgName("custom_differs")
+    ->DenseRange(0, 3)
+    ->Unit(benchmark::kMillisecond);
+
+/*
+ * Diffs the subset pair with all custom differs, referencing retained runs
+ * from the base only if they're at least state.range(0) bytes long.
+ */
+void BM_BrotliFontDiffMinRetainedLength(benchmark::State& state) {
+  hb_set_unique_ptr custom_tables =
+      make_hb_set(4, HB_TAG('g', 'l', 'y', 'f'), HB_TAG('l', 'o', 'c', 'a'),
+                  HB_TAG('h', 'm', 't', 'x'), HB_TAG('v', 'm', 't', 'x'));
+  hb_set_unique_ptr immutable_tables = make_hb_set();
+
+  SubsetPair fonts(custom_tables.get());
+  BrotliFontDiff differ(immutable_tables.get(), custom_tables.get());
+  differ.SetMinRetainedLength(state.range(0));
+  FontData patch;
+  for (auto _ : state) {
+    auto sc = differ.Diff(fonts.base_plan(), fonts.base(), fonts.derived_plan(),
+                          fonts.derived(), &patch);
+    if (!sc.ok()) {
+      state.SkipWithError(sc.ToString().c_str());
+      return;
+    }
+  }
+
+  uint32_t derived_size = hb_blob_get_length(fonts.derived());
+  state.SetBytesProcessed(state.iterations() * derived_size);
+  state.counters["ratio"] = (double)patch.size() / derived_size;
+  state.counters["patch_size"] = patch.size();
+}
+BENCHMARK(BM_BrotliFontDiffMinRetainedLength)
+    ->ArgName("min_retained_length")
+    ->Arg(0)
+    ->Arg(8)
+    ->Arg(16)
+    ->Arg(32)
+    ->Arg(64)
+    ->Arg(256)
+    ->Unit(benchmark::kMillisecond);
+
+// Compresses a glyf table into a stream with no dictionary.
+void BM_BrotliStreamInsertCompressed(benchmark::State& state) {
+  hb_face_unique_ptr face = LoadFace("common/testdata/Roboto-Regular.ttf");
+  FontData glyf(make_hb_blob(
+      hb_face_reference_table(face.get(), HB_TAG('g', 'l', 'y', 'f'))));
+  absl::Span<const uint8_t> data((const uint8_t*)glyf.data(), glyf.size());
+
+  uint64_t compressed_size = 0;
+  for (auto _ : state) {
+    BrotliStream stream(BrotliStream::WindowBitsFor(0, data.size()));
+    auto sc = stream.insert_compressed(data);
+    if (!sc.ok()) {
+      state.SkipWithError(sc.ToString().c_str());
+      return;
+    }
+    stream.end_stream();
+    compressed_size = stream.compressed_data().size();
+  }
+
+  state.SetBytesProcessed(state.iterations() * data.size());
+  state.counters["ratio"] = (double)compressed_size / data.size();
+}
+BENCHMARK(BM_BrotliStreamInsertCompressed)->Unit(benchmark::kMillisecond);
+
+}  // namespace
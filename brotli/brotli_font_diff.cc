@@ -2,7 +2,11 @@
 
 #include "absl/types/span.h"
 #include "brotli/brotli_stream.h"
+#include "brotli/cff_differ.h"
 #include "brotli/glyf_differ.h"
+#include "brotli/glyph_data_differ.h"
+#include "brotli/glyph_data_region.h"
+#include "brotli/gvar_differ.h"
 #include "brotli/hmtx_differ.h"
 #include "brotli/loca_differ.h"
 #include "brotli/table_range.h"
@@ -12,8 +16,10 @@ namespace brotli {
 
 using absl::Span;
 using absl::Status;
+using absl::StatusOr;
 using common::FontData;
 using common::hb_set_unique_ptr;
+using common::ThreadPool;
 
 static bool HasTable(hb_face_t* face, hb_tag_t tag) {
   hb_blob_t* table = hb_face_reference_table(face, tag);
@@ -42,40 +48,23 @@ class DiffDriver {
                    const BrotliStream& base_stream, TableDiffer* differ_)
         : range(base_face, derived_face, tag, base_stream), differ(differ_) {}
 
+    RangeAndDiffer(TableRange range_, TableDiffer* differ_)
+        : range(std::move(range_)), differ(differ_) {}
+
     TableRange range;
     std::unique_ptr<TableDiffer> differ;
+    // False for all but the last region of a table split into regions.
+    bool ends_table = true;
   };
 
  public:
-  DiffDriver(hb_subset_plan_t* base_plan, hb_face_t* base_face,
-             hb_subset_plan_t* derived_plan, hb_face_t* derived_face,
+  DiffDriver(const hb_map_t* base_new_to_old_, hb_face_t* base_face,
+             const hb_map_t* derived_old_to_new_, hb_face_t* derived_face,
              const hb_set_t* custom_diff_tables, BrotliStream& stream)
       : out(stream),
-        base_new_to_old(hb_subset_plan_new_to_old_glyph_mapping(base_plan)),
-        derived_old_to_new(
-            hb_subset_plan_old_to_new_glyph_mapping(derived_plan)) {
-    hb_blob_t* head =
-        hb_face_reference_table(derived_face, HB_TAG('h', 'e', 'a', 'd'));
-    const char* head_data = hb_blob_get_data(head, nullptr);
-    unsigned is_derived_short_loca = !head_data[51];
-    hb_blob_destroy(head);
-
-    head = hb_face_reference_table(base_face, HB_TAG('h', 'e', 'a', 'd'));
-    head_data = hb_blob_get_data(head, nullptr);
-    unsigned is_base_short_loca = !head_data[51];
-    hb_blob_destroy(head);
-
-    base_glyph_count = hb_face_get_glyph_count(base_face);
-    derived_glyph_count = hb_face_get_glyph_count(derived_face);
-
-    retain_gids = base_glyph_count > hb_map_get_population(base_new_to_old);
-
-    constexpr hb_tag_t HMTX = HB_TAG('h', 'm', 't', 'x');
-    constexpr hb_tag_t VMTX = HB_TAG('v', 'm', 't', 'x');
-    constexpr hb_tag_t HHEA = HB_TAG('h', 'h', 'e', 'a');
-    constexpr hb_tag_t VHEA = HB_TAG('v', 'h', 'e', 'a');
-    constexpr hb_tag_t LOCA = HB_TAG('l', 'o', 'c', 'a');
-    constexpr hb_tag_t GLYF = HB_TAG('g', 'l', 'y', 'f');
+        base_new_to_old(base_new_to_old_),
+        derived_old_to_new(derived_old_to_new_) {
+    Init(base_face, derived_face);
 
     hb_tag_t tag = HB_SET_VALUE_INVALID;
     while (hb_set_next(custom_diff_tables, &tag)) {
@@ -118,18 +107,199 @@ class DiffDriver {
                                is_base_short_loca, is_derived_short_loca)));
           }
           break;
+
+        case CFF:
+        case CFF2:
+          if (HasTable(base_face, derived_face, tag)) {
+            differs.push_back(RangeAndDiffer(
+                base_face, derived_face, tag, stream,
+                new CffDiffer(TableRange::to_span(base_face, tag),
+                              TableRange::to_span(derived_face, tag),
+                              tag == CFF2)));
+          }
+          break;
+
+        case GVAR:
+          if (HasTable(base_face, derived_face, GVAR)) {
+            differs.push_back(RangeAndDiffer(
+                base_face, derived_face, GVAR, stream,
+                new GvarDiffer(TableRange::to_span(base_face, GVAR),
+                               TableRange::to_span(derived_face, GVAR))));
+          }
+          break;
+
+        case SBIX:
+        case CBDT:
+          if (HasTable(base_face, derived_face, tag) &&
+              (tag == SBIX || HasTable(base_face, derived_face, CBLC))) {
+            AddRegionDiffers(base_face, derived_face, tag,
+                             TableRange::table_offset(base_face, tag),
+                             TableRange::table_offset(derived_face, tag),
+                             stream);
+          }
+          break;
+
+        case CBLC:
+          // The index subtables hold offsets into CBDT which shift whenever
+          // glyphs are added, so little of CBLC is retained byte for byte.
+          // It's emitted as new data.
+          if (HasTable(base_face, derived_face, CBLC)) {
+            differs.push_back(RangeAndDiffer(
+                base_face, derived_face, CBLC, stream,
+                new GlyphDataDiffer(
+                    TableRange::to_span(base_face, CBLC),
+                    TableRange::to_span(derived_face, CBLC),
+                    absl::UnimplementedError("CBLC is not diffed."),
+                    absl::UnimplementedError("CBLC is not diffed."))));
+          }
+          break;
       }
     }
   }
 
+  // Diffs only the table 'tag', which must be one of the tables supported by
+  // BrotliFontDiff::DiffTable(). The table is produced on its own rather than
+  // as part of the whole font.
+  DiffDriver(const hb_map_t* base_new_to_old_, hb_face_t* base_face,
+             const hb_map_t* derived_old_to_new_, hb_face_t* derived_face,
+             hb_tag_t tag, BrotliStream& stream)
+      : out(stream),
+        base_new_to_old(base_new_to_old_),
+        derived_old_to_new(derived_old_to_new_),
+        pad_tables(false) {
+    Init(base_face, derived_face);
+
+    if (tag == SBIX || tag == CBDT) {
+      AddRegionDiffers(base_face, derived_face, tag, 0, 0, stream);
+      return;
+    }
+
+    TableDiffer* differ;
+    switch (tag) {
+      case GLYF:
+        differ = new GlyfDataDiffer(
+            TableRange::to_span(base_face, GLYF),
+            TableRange::to_span(base_face, LOCA), is_base_short_loca,
+            TableRange::to_span(derived_face, GLYF),
+            TableRange::to_span(derived_face, LOCA), is_derived_short_loca);
+        break;
+      case CFF:
+      case CFF2:
+        differ = new CffDiffer(TableRange::to_span(base_face, tag),
+                               TableRange::to_span(derived_face, tag),
+                               tag == CFF2);
+        break;
+      default:
+        differ = new GvarDiffer(TableRange::to_span(base_face, tag),
+                                TableRange::to_span(derived_face, tag));
+        break;
+    }
+    differs.push_back(RangeAndDiffer(
+        TableRange(TableRange::to_span(derived_face, tag), tag, stream),
+        differ));
+  }
+
+  static constexpr hb_tag_t HMTX = HB_TAG('h', 'm', 't', 'x');
+  static constexpr hb_tag_t VMTX = HB_TAG('v', 'm', 't', 'x');
+  static constexpr hb_tag_t HHEA = HB_TAG('h', 'h', 'e', 'a');
+  static constexpr hb_tag_t VHEA = HB_TAG('v', 'h', 'e', 'a');
+  static constexpr hb_tag_t LOCA = HB_TAG('l', 'o', 'c', 'a');
+  static constexpr hb_tag_t GLYF = HB_TAG('g', 'l', 'y', 'f');
+  static constexpr hb_tag_t CFF = HB_TAG('C', 'F', 'F', ' ');
+  static constexpr hb_tag_t CFF2 = HB_TAG('C', 'F', 'F', '2');
+  static constexpr hb_tag_t GVAR = HB_TAG('g', 'v', 'a', 'r');
+  static constexpr hb_tag_t SBIX = HB_TAG('s', 'b', 'i', 'x');
+  static constexpr hb_tag_t CBDT = HB_TAG('C', 'B', 'D', 'T');
+  static constexpr hb_tag_t CBLC = HB_TAG('C', 'B', 'L', 'C');
+
+  // See TableRange::set_min_existing_length().
+  void SetMinRetainedLength(unsigned length) {
+    for (auto& range_and_differ : differs) {
+      range_and_differ.range.set_min_existing_length(length);
+    }
+  }
+
  public:
   std::vector<RangeAndDiffer> differs;
 
  private:
-  BrotliStream& out;
+  void Init(hb_face_t* base_face, hb_face_t* derived_face) {
+    is_derived_short_loca = IsShortLoca(derived_face);
+    is_base_short_loca = IsShortLoca(base_face);
+
+    base_glyph_count = hb_face_get_glyph_count(base_face);
+    derived_glyph_count = hb_face_get_glyph_count(derived_face);
+
+    retain_gids = base_glyph_count > hb_map_get_population(base_new_to_old);
+  }
+
+  /*
+   * Adds a GlyphDataDiffer for each strike of a bitmap table (sbix or CBDT).
+   * The table starts at base_offset in the dictionary and at derived_offset
+   * in the uncompressed stream. If the strikes can't be located, or don't
+   * match up, the whole table is new data.
+   */
+  void AddRegionDiffers(hb_face_t* base_face, hb_face_t* derived_face,
+                        hb_tag_t tag, unsigned base_offset,
+                        unsigned derived_offset, const BrotliStream& stream) {
+    Span<const uint8_t> base_table = TableRange::to_span(base_face, tag);
+    Span<const uint8_t> derived_table = TableRange::to_span(derived_face, tag);
+    StatusOr<std::vector<GlyphDataRegion>> base_regions =
+        RegionsFor(base_face, tag, base_glyph_count);
+    StatusOr<std::vector<GlyphDataRegion>> derived_regions =
+        RegionsFor(derived_face, tag, derived_glyph_count);
+
+    if (!base_regions.ok() || !derived_regions.ok() ||
+        base_regions->size() != derived_regions->size()) {
+      Status error = !base_regions.ok()      ? base_regions.status()
+                     : !derived_regions.ok() ? derived_regions.status()
+                                             : absl::InvalidArgumentError(
+                                                   "Strike counts differ.");
+      differs.push_back(RangeAndDiffer(
+          TableRange(derived_table, base_offset, derived_offset, tag, stream),
+          new GlyphDataDiffer(base_table, derived_table, error, error)));
+      return;
+    }
+
+    for (unsigned i = 0; i < derived_regions->size(); i++) {
+      GlyphDataRegion& base_region = (*base_regions)[i];
+      GlyphDataRegion& derived_region = (*derived_regions)[i];
+      differs.push_back(RangeAndDiffer(
+          TableRange(derived_table.subspan(derived_region.offset,
+                                           derived_region.length),
+                     base_offset + base_region.offset,
+                     derived_offset + derived_region.offset, tag, stream),
+          new GlyphDataDiffer(
+              base_table.subspan(base_region.offset, base_region.length),
+              derived_table.subspan(derived_region.offset,
+                                    derived_region.length),
+              std::move(base_region.starts),
+              std::move(derived_region.starts))));
+      differs.back().ends_table = i + 1 == derived_regions->size();
+    }
+  }
+
+  static StatusOr<std::vector<GlyphDataRegion>> RegionsFor(
+      hb_face_t* face, hb_tag_t tag, unsigned glyph_count) {
+    if (tag == SBIX) {
+      return GlyphDataRegion::ForSbix(TableRange::to_span(face, SBIX),
+                                      glyph_count);
+    }
+    return GlyphDataRegion::ForCbdt(TableRange::to_span(face, CBLC),
+                                    TableRange::to_span(face, CBDT),
+                                    glyph_count);
+  }
 
-  unsigned base_gid = 0;
-  unsigned derived_gid = 0;
+  static bool IsShortLoca(hb_face_t* face) {
+    hb_blob_t* head = hb_face_reference_table(face, HB_TAG('h', 'e', 'a', 'd'));
+    unsigned length = 0;
+    const char* head_data = hb_blob_get_data(head, &length);
+    bool is_short_loca = length > 51 && !head_data[51];
+    hb_blob_destroy(head);
+    return is_short_loca;
+  }
+
+  BrotliStream& out;
 
   const hb_map_t* base_new_to_old;
   const hb_map_t* derived_old_to_new;
@@ -139,14 +309,63 @@ class DiffDriver {
 
   bool retain_gids;
 
+  bool is_base_short_loca;
+  bool is_derived_short_loca;
+
+  // If set each table is padded to a multiple of four bytes, as it would be in
+  // a font file.
+  bool pad_tables = true;
+
+  // The base glyph matched up with a derived glyph, see MakeDiff().
+  struct GlyphStep {
+    unsigned base_gid;
+    unsigned base_derived_gid;
+    bool is_base_empty;
+  };
+
  public:
+  /*
+   * Diffs each table then appends them to the output stream in order.
+   *
+   * Every table has its own stream starting at the table's offset, so tables
+   * are independent of each other. If the output stream has a thread pool the
+   * tables are diffed concurrently on it, the result is the same either way.
+   */
   Status MakeDiff() {
+    std::vector<GlyphStep> steps = GlyphSteps();
+    std::vector<Status> results(differs.size());
+    auto diff_one = [this, &steps, &results](uint32_t i) {
+      results[i] = DiffRange(steps, differs[i]);
+    };
+    if (out.thread_pool() && differs.size() > 1) {
+      out.thread_pool()->ParallelFor(differs.size(), diff_one);
+    } else {
+      for (uint32_t i = 0; i < differs.size(); i++) {
+        diff_one(i);
+      }
+    }
+
+    for (uint32_t i = 0; i < differs.size(); i++) {
+      if (!results[i].ok()) {
+        return results[i];
+      }
+      out.append(differs[i].range.stream());
+    }
+    return absl::OkStatus();
+  }
+
+ private:
+  // Matches up the base glyph for each derived glyph.
+  std::vector<GlyphStep> GlyphSteps() const {
     // Notation:
     // base_gid:      glyph id in the base subset glyph space.
     // *_derived_gid: glyph id in the derived subset glyph space.
     // *_old_gid:     glyph id in the original font glyph space.
-
-    while (derived_gid < derived_glyph_count) {
+    std::vector<GlyphStep> steps;
+    steps.reserve(derived_glyph_count);
+    unsigned base_gid = 0;
+    for (unsigned derived_gid = 0; derived_gid < derived_glyph_count;
+         derived_gid++) {
       bool is_base_empty = false;
       unsigned base_derived_gid = BaseToDerivedGid(base_gid, &is_base_empty);
       if (is_base_empty && derived_gid == base_derived_gid &&
@@ -157,63 +376,73 @@ class DiffDriver {
         // the diff to treat this as new data.
         base_derived_gid = HB_MAP_VALUE_INVALID;
       }
-
-      for (auto& range_and_differ : differs) {
-        TableDiffer* differ = range_and_differ.differ.get();
-        TableRange& range = range_and_differ.range;
-
-        bool was_new_data = differ->IsNewData();
-        unsigned base_length = 0;
-        unsigned derived_length = 0;
-        differ->Process(derived_gid, base_gid, base_derived_gid, is_base_empty,
-                        &base_length, &derived_length);
-
-        if (derived_gid > 0 && was_new_data != differ->IsNewData()) {
-          if (was_new_data) {
-            Status s = range.CommitNew();
-            if (!s.ok()) {
-              return s;
-            }
-          } else {
-            range.CommitExisting();
-          }
-        }
-
-        range.Extend(base_length, derived_length);
-      }
+      steps.push_back(GlyphStep{base_gid, base_derived_gid, is_base_empty});
 
       if (base_derived_gid == derived_gid ||
           (base_gid == derived_gid && is_base_empty)) {
         base_gid++;
       }
-      derived_gid++;
     }
+    return steps;
+  }
 
-    // Finalize and commit any outstanding changes.
-    for (auto& range_and_differ : differs) {
-      TableDiffer* differ = range_and_differ.differ.get();
-      TableRange& range = range_and_differ.range;
+  // Runs one table's differ over every glyph and writes the result to the
+  // table's stream.
+  Status DiffRange(const std::vector<GlyphStep>& steps,
+                   RangeAndDiffer& range_and_differ) const {
+    TableDiffer* differ = range_and_differ.differ.get();
+    TableRange& range = range_and_differ.range;
+
+    for (unsigned derived_gid = 0; derived_gid < steps.size(); derived_gid++) {
+      const GlyphStep& step = steps[derived_gid];
+      bool was_new_data = differ->IsNewData();
       unsigned base_length = 0;
       unsigned derived_length = 0;
-      differ->Finalize(&base_length, &derived_length);
-      range.Extend(base_length, derived_length);
-      if (differ->IsNewData()) {
-        Status s = range.CommitNew();
+      differ->Process(derived_gid, step.base_gid, step.base_derived_gid,
+                      step.is_base_empty, &base_length, &derived_length);
+
+      if (derived_gid > 0 && was_new_data != differ->IsNewData()) {
+        Status s = Commit(range, was_new_data);
         if (!s.ok()) {
           return s;
         }
-      } else {
-        range.CommitExisting();
       }
-      range.stream().four_byte_align_uncompressed();
-      out.append(range.stream());
+
+      range.Extend(base_length, derived_length);
     }
 
+    // Finalize and commit any outstanding changes.
+    unsigned base_length = 0;
+    unsigned derived_length = 0;
+    bool was_new_data = differ->IsNewData();
+    differ->Finalize(&base_length, &derived_length);
+    if (was_new_data != differ->IsNewData()) {
+      // Finalize may switch modes (eg. for trailing data).
+      Status s = Commit(range, was_new_data);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    range.Extend(base_length, derived_length);
+    Status s = Commit(range, differ->IsNewData());
+    if (!s.ok()) {
+      return s;
+    }
+    s = range.Flush();
+    if (!s.ok()) {
+      return s;
+    }
+    if (pad_tables && range_and_differ.ends_table) {
+      range.stream().four_byte_align_uncompressed();
+    }
     return absl::OkStatus();
   }
 
- private:
-  unsigned BaseToDerivedGid(unsigned gid, bool* is_base_empty) {
+  static Status Commit(TableRange& range, bool is_new_data) {
+    return is_new_data ? range.CommitNew() : range.CommitExisting();
+  }
+
+  unsigned BaseToDerivedGid(unsigned gid, bool* is_base_empty) const {
     if (retain_gids) {
       if (gid < base_glyph_count) {
         // If retain gids is set gids are equivalent in all three spaces.
@@ -280,14 +509,18 @@ Status BrotliFontDiff::Diff(hb_subset_plan_t* base_plan, hb_blob_t* base,
   BrotliStream out(
       BrotliStream::WindowBitsFor(base_span.size(), derived_span.size()),
       base_span.size());
+  out.set_thread_pool(thread_pool_);
 
   unsigned derived_start_offset = 0;
   unsigned derived_end_offset = 0;
   unsigned base_start_offset = 0;
   unsigned base_end_offset = 0;
 
-  DiffDriver diff_driver(base_plan, base_face, derived_plan, derived_face,
-                         custom_diff_tables_.get(), out);
+  DiffDriver diff_driver(hb_subset_plan_new_to_old_glyph_mapping(base_plan),
+                         base_face,
+                         hb_subset_plan_old_to_new_glyph_mapping(derived_plan),
+                         derived_face, custom_diff_tables_.get(), out);
+  diff_driver.SetMinRetainedLength(min_retained_length_);
 
   const hb_set_t* tag_sets[] = {immutable_tables_.get(),
                                 custom_diff_tables_.get()};
@@ -363,10 +596,13 @@ Status BrotliFontDiff::Diff(hb_subset_plan_t* base_plan, hb_blob_t* base,
     }
   }
 
+  s = out.compress_pending();
+  if (!s.ok()) {
+    return s;
+  }
   out.end_stream();
 
-  patch->copy((const char*)out.compressed_data().data(),
-              out.compressed_data().size());
+  patch->take(out.take_compressed_data());
 
   hb_face_destroy(base_face);
   hb_face_destroy(derived_face);
@@ -374,4 +610,59 @@ Status BrotliFontDiff::Diff(hb_subset_plan_t* base_plan, hb_blob_t* base,
   return absl::OkStatus();
 }
 
+GlyphMapping::GlyphMapping(hb_subset_plan_t* plan)
+    : new_to_old_(hb_map_copy(hb_subset_plan_new_to_old_glyph_mapping(plan)),
+                  &hb_map_destroy),
+      old_to_new_(hb_map_copy(hb_subset_plan_old_to_new_glyph_mapping(plan)),
+                  &hb_map_destroy) {}
+
+bool BrotliFontDiff::CanDiffTable(hb_tag_t tag) {
+  return tag == DiffDriver::GLYF || tag == DiffDriver::CFF ||
+         tag == DiffDriver::CFF2 || tag == DiffDriver::GVAR ||
+         tag == DiffDriver::SBIX || tag == DiffDriver::CBDT;
+}
+
+Status BrotliFontDiff::DiffTable(hb_tag_t tag, const GlyphMapping& base_mapping,
+                                 hb_face_t* base_face,
+                                 const GlyphMapping& derived_mapping,
+                                 hb_face_t* derived_face, FontData* patch,
+                                 ThreadPool* pool,
+                                 unsigned min_retained_length) {
+  if (!CanDiffTable(tag)) {
+    return absl::InvalidArgumentError("Table is not supported by DiffTable().");
+  }
+  if (!HasTable(derived_face, tag)) {
+    return absl::InvalidArgumentError("derived is missing the table.");
+  }
+  if (tag == DiffDriver::GLYF && !HasTable(derived_face, DiffDriver::LOCA)) {
+    return absl::InvalidArgumentError("derived is missing loca.");
+  }
+  if (tag == DiffDriver::CBDT && !HasTable(derived_face, DiffDriver::CBLC)) {
+    return absl::InvalidArgumentError("derived is missing CBLC.");
+  }
+
+  Span<const uint8_t> base_span = TableRange::to_span(base_face, tag);
+  Span<const uint8_t> derived_span = TableRange::to_span(derived_face, tag);
+  BrotliStream out(
+      BrotliStream::WindowBitsFor(base_span.size(), derived_span.size()),
+      base_span.size());
+  out.set_thread_pool(pool);
+
+  DiffDriver diff_driver(base_mapping.new_to_old(), base_face,
+                         derived_mapping.old_to_new(), derived_face, tag, out);
+  diff_driver.SetMinRetainedLength(min_retained_length);
+  Status s = diff_driver.MakeDiff();
+  if (!s.ok()) {
+    return s;
+  }
+  s = out.compress_pending();
+  if (!s.ok()) {
+    return s;
+  }
+
+  out.end_stream();
+  patch->take(out.take_compressed_data());
+  return absl::OkStatus();
+}
+
 }  // namespace brotli
@@ -1,13 +1,32 @@
 #ifndef BROTLI_BROTLI_FONT_DIFF_H_
 #define BROTLI_BROTLI_FONT_DIFF_H_
 
+#include <memory>
+
 #include "absl/status/status.h"
 #include "common/font_data.h"
 #include "common/hb_set_unique_ptr.h"
+#include "common/thread_pool.h"
 #include "hb-subset.h"
 
 namespace brotli {
 
+/*
+ * The glyph id mappings between a font subset and the font it was cut from,
+ * copied from the subset plan which produced it.
+ */
+class GlyphMapping {
+ public:
+  explicit GlyphMapping(hb_subset_plan_t* plan);
+
+  const hb_map_t* new_to_old() const { return new_to_old_.get(); }
+  const hb_map_t* old_to_new() const { return old_to_new_.get(); }
+
+ private:
+  std::unique_ptr<hb_map_t, decltype(&hb_map_destroy)> new_to_old_;
+  std::unique_ptr<hb_map_t, decltype(&hb_map_destroy)> old_to_new_;
+};
+
 /*
  * Produces a brotli binary diff between two fonts. Uses knowledge of the
  * underlying font format to more efficiently produce a diff.
@@ -26,13 +45,56 @@ class BrotliFontDiff {
       : immutable_tables_(hb_set_copy(immutable_tables), &hb_set_destroy),
         custom_diff_tables_(hb_set_copy(custom_diff_tables), &hb_set_destroy) {}
 
+  /*
+   * Runs of data retained from the base which are shorter than this many
+   * bytes are compressed along with the neighbouring novel data rather than
+   * referenced from the dictionary, since each reference costs a meta-block
+   * and splits up the compressed data. Zero references every retained run.
+   */
+  static constexpr unsigned kDefaultMinRetainedLength = 16;
+
+  void SetMinRetainedLength(unsigned length) { min_retained_length_ = length; }
+
+  // If set, Diff() diffs the custom diff tables concurrently on this pool and
+  // compresses the chunks of novel data it finds concurrently too. The output
+  // is unchanged. The pool must outlive this differ.
+  void SetThreadPool(common::ThreadPool* pool) { thread_pool_ = pool; }
+
   absl::Status Diff(hb_subset_plan_t* base_plan, hb_blob_t* base,
                     hb_subset_plan_t* derived_plan, hb_blob_t* derived,
                     common::FontData* patch) const;
 
+  /*
+   * Produces a brotli stream which decodes to the table 'tag' of derived_face
+   * when the same table of base_face is used as the dictionary. This is the
+   * form of the per table patches in a table keyed patch.
+   *
+   * Both fonts must be subsets of the same font, glyphs are matched up using
+   * the mappings. Glyph data is compared before being referenced from the
+   * base, so the mappings only affect the size of the patch.
+   *
+   * If pool is non null the strikes of bitmap tables are diffed, and the
+   * chunks of novel glyph data compressed, concurrently on it. See
+   * SetMinRetainedLength() for min_retained_length.
+   */
+  static absl::Status DiffTable(hb_tag_t tag, const GlyphMapping& base_mapping,
+                                hb_face_t* base_face,
+                                const GlyphMapping& derived_mapping,
+                                hb_face_t* derived_face,
+                                common::FontData* patch,
+                                common::ThreadPool* pool = nullptr,
+                                unsigned min_retained_length =
+                                    kDefaultMinRetainedLength);
+
+  // Returns true if DiffTable() supports 'tag', ie. it's one of the tables
+  // which hold per glyph data: glyf, CFF, CFF2, gvar, sbix or CBDT.
+  static bool CanDiffTable(hb_tag_t tag);
+
  private:
   common::hb_set_unique_ptr immutable_tables_;
   common::hb_set_unique_ptr custom_diff_tables_;
+  common::ThreadPool* thread_pool_ = nullptr;
+  unsigned min_retained_length_ = kDefaultMinRetainedLength;
 };
 
 }  // namespace brotli
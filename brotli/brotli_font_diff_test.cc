@@ -3,6 +3,7 @@
 #include "absl/types/span.h"
 #include "common/brotli_binary_patch.h"
 #include "common/hb_set_unique_ptr.h"
+#include "common/thread_pool.h"
 #include "gtest/gtest.h"
 #include "hb-subset.h"
 
@@ -14,6 +15,7 @@ using common::BrotliBinaryPatch;
 using common::FontData;
 using common::hb_set_unique_ptr;
 using common::make_hb_set;
+using common::ThreadPool;
 
 const std::string kTestDataDir = "common/testdata/";
 
@@ -117,6 +119,84 @@ TEST_F(BrotliFontDiffTest, Diff) {
   hb_face_destroy(derived_face);
 }
 
+TEST_F(BrotliFontDiffTest, MinRetainedLength) {
+  hb_set_add_range(hb_subset_input_unicode_set(input), 0x41, 0x5A);
+  hb_subset_plan_t* base_plan = hb_subset_plan_create_or_fail(roboto, input);
+  hb_face_t* base_face = hb_subset_plan_execute_or_fail(base_plan);
+  SortTables(roboto, base_face);
+  hb_blob_t* base_blob = hb_face_reference_blob(base_face);
+  FontData base(base_face);
+  ASSERT_TRUE(base_plan);
+
+  hb_set_add_range(hb_subset_input_unicode_set(input), 0x61, 0x7A);
+  hb_subset_plan_t* derived_plan = hb_subset_plan_create_or_fail(roboto, input);
+  hb_face_t* derived_face = hb_subset_plan_execute_or_fail(derived_plan);
+  SortTables(roboto, derived_face);
+  hb_blob_t* derived_blob = hb_face_reference_blob(derived_face);
+  FontData derived(derived_face);
+  ASSERT_TRUE(derived_plan);
+
+  // From referencing every retained run through to compressing all of them.
+  BrotliFontDiff differ(immutable_tables.get(), custom_tables.get());
+  for (unsigned length : {0u, 1u, 2u, 4u, 64u, 1u << 24}) {
+    differ.SetMinRetainedLength(length);
+    FontData patch;
+    ASSERT_EQ(
+        differ.Diff(base_plan, base_blob, derived_plan, derived_blob, &patch),
+        absl::OkStatus())
+        << length;
+    Check(base, patch, derived);
+  }
+
+  hb_subset_plan_destroy(base_plan);
+  hb_subset_plan_destroy(derived_plan);
+  hb_blob_destroy(base_blob);
+  hb_blob_destroy(derived_blob);
+  hb_face_destroy(base_face);
+  hb_face_destroy(derived_face);
+}
+
+TEST_F(BrotliFontDiffTest, ThreadPool) {
+  hb_set_add_range(hb_subset_input_unicode_set(input), 0x41, 0x5A);
+  hb_subset_plan_t* base_plan = hb_subset_plan_create_or_fail(roboto, input);
+  hb_face_t* base_face = hb_subset_plan_execute_or_fail(base_plan);
+  SortTables(roboto, base_face);
+  hb_blob_t* base_blob = hb_face_reference_blob(base_face);
+  FontData base(base_face);
+  ASSERT_TRUE(base_plan);
+
+  hb_set_add_range(hb_subset_input_unicode_set(input), 0x61, 0x7A);
+  hb_subset_plan_t* derived_plan = hb_subset_plan_create_or_fail(roboto, input);
+  hb_face_t* derived_face = hb_subset_plan_execute_or_fail(derived_plan);
+  SortTables(roboto, derived_face);
+  hb_blob_t* derived_blob = hb_face_reference_blob(derived_face);
+  FontData derived(derived_face);
+  ASSERT_TRUE(derived_plan);
+
+  BrotliFontDiff differ(immutable_tables.get(), custom_tables.get());
+  FontData expected;
+  ASSERT_EQ(
+      differ.Diff(base_plan, base_blob, derived_plan, derived_blob, &expected),
+      absl::OkStatus());
+
+  // Tables are diffed concurrently but the patch is unchanged.
+  ThreadPool pool(4);
+  differ.SetThreadPool(&pool);
+  FontData patch;
+  ASSERT_EQ(
+      differ.Diff(base_plan, base_blob, derived_plan, derived_blob, &patch),
+      absl::OkStatus());
+  EXPECT_EQ(patch.str(), expected.str());
+  Check(base, patch, derived);
+
+  hb_subset_plan_destroy(base_plan);
+  hb_subset_plan_destroy(derived_plan);
+  hb_blob_destroy(base_blob);
+  hb_blob_destroy(derived_blob);
+  hb_face_destroy(base_face);
+  hb_face_destroy(derived_face);
+}
+
 TEST_F(BrotliFontDiffTest, DiffRetainGids) {
   hb_set_add_range(hb_subset_input_unicode_set(input), 0x41, 0x45);
   hb_set_add_range(hb_subset_input_unicode_set(input), 0x57, 0x59);
@@ -191,6 +271,90 @@ TEST_F(BrotliFontDiffTest, LongLoca) {
   hb_blob_destroy(derived_blob);
 }
 
+TEST_F(BrotliFontDiffTest, Cff) {
+  hb_blob_t* font_data = hb_blob_create_from_file_or_fail(
+      (kTestDataDir + "NotoSansJP-Regular.otf").c_str());
+  ASSERT_TRUE(font_data);
+  hb_face_t* face = hb_face_create(font_data, 0);
+  hb_blob_destroy(font_data);
+  hb_set_add(custom_tables.get(), HB_TAG('C', 'F', 'F', ' '));
+
+  hb_set_add_range(hb_subset_input_glyph_set(input), 1000, 1200);
+  hb_set_add_range(hb_subset_input_glyph_set(input), 8000, 8500);
+  hb_subset_plan_t* base_plan = hb_subset_plan_create_or_fail(face, input);
+  hb_face_t* base_face = hb_subset_plan_execute_or_fail(base_plan);
+  SortTables(face, base_face);
+  hb_blob_t* base_blob = hb_face_reference_blob(base_face);
+  FontData base(base_face);
+  ASSERT_TRUE(base_plan);
+
+  hb_set_add_range(hb_subset_input_glyph_set(input), 500, 750);
+  hb_set_add_range(hb_subset_input_glyph_set(input), 11000, 11100);
+  hb_subset_plan_t* derived_plan = hb_subset_plan_create_or_fail(face, input);
+  hb_face_t* derived_face = hb_subset_plan_execute_or_fail(derived_plan);
+  SortTables(face, derived_face);
+  hb_blob_t* derived_blob = hb_face_reference_blob(derived_face);
+  FontData derived(derived_face);
+  ASSERT_TRUE(derived_plan);
+
+  BrotliFontDiff differ(immutable_tables.get(), custom_tables.get());
+  FontData patch;
+  ASSERT_EQ(
+      differ.Diff(base_plan, base_blob, derived_plan, derived_blob, &patch),
+      absl::OkStatus());
+
+  Check(base, patch, derived);
+
+  hb_subset_plan_destroy(base_plan);
+  hb_subset_plan_destroy(derived_plan);
+  hb_face_destroy(base_face);
+  hb_face_destroy(derived_face);
+  hb_blob_destroy(base_blob);
+  hb_blob_destroy(derived_blob);
+  hb_face_destroy(face);
+}
+
+TEST_F(BrotliFontDiffTest, Gvar) {
+  hb_blob_t* font_data = hb_blob_create_from_file_or_fail(
+      (kTestDataDir + "Roboto[wdth,wght].ttf").c_str());
+  ASSERT_TRUE(font_data);
+  hb_face_t* face = hb_face_create(font_data, 0);
+  hb_blob_destroy(font_data);
+  hb_set_add(custom_tables.get(), HB_TAG('g', 'v', 'a', 'r'));
+
+  hb_set_add_range(hb_subset_input_unicode_set(input), 0x41, 0x5A);
+  hb_subset_plan_t* base_plan = hb_subset_plan_create_or_fail(face, input);
+  hb_face_t* base_face = hb_subset_plan_execute_or_fail(base_plan);
+  SortTables(face, base_face);
+  hb_blob_t* base_blob = hb_face_reference_blob(base_face);
+  FontData base(base_face);
+  ASSERT_TRUE(base_plan);
+
+  hb_set_add_range(hb_subset_input_unicode_set(input), 0x61, 0x7A);
+  hb_subset_plan_t* derived_plan = hb_subset_plan_create_or_fail(face, input);
+  hb_face_t* derived_face = hb_subset_plan_execute_or_fail(derived_plan);
+  SortTables(face, derived_face);
+  hb_blob_t* derived_blob = hb_face_reference_blob(derived_face);
+  FontData derived(derived_face);
+  ASSERT_TRUE(derived_plan);
+
+  BrotliFontDiff differ(immutable_tables.get(), custom_tables.get());
+  FontData patch;
+  ASSERT_EQ(
+      differ.Diff(base_plan, base_blob, derived_plan, derived_blob, &patch),
+      absl::OkStatus());
+
+  Check(base, patch, derived);
+
+  hb_subset_plan_destroy(base_plan);
+  hb_subset_plan_destroy(derived_plan);
+  hb_face_destroy(base_face);
+  hb_face_destroy(derived_face);
+  hb_blob_destroy(base_blob);
+  hb_blob_destroy(derived_blob);
+  hb_face_destroy(face);
+}
+
 TEST_F(BrotliFontDiffTest, ShortToLongLoca) {
   hb_set_add_range(hb_subset_input_glyph_set(input), 1000, 1200);
   hb_subset_plan_t* base_plan =
@@ -270,4 +434,45 @@ TEST_F(BrotliFontDiffTest, WithImmutableTables) {
   hb_face_destroy(derived_face);
 }
 
+TEST_F(BrotliFontDiffTest, DiffTable) {
+  constexpr hb_tag_t glyf = HB_TAG('g', 'l', 'y', 'f');
+  hb_set_add_range(hb_subset_input_unicode_set(input), 0x41, 0x5A);
+  hb_subset_plan_t* base_plan = hb_subset_plan_create_or_fail(roboto, input);
+  ASSERT_TRUE(base_plan);
+  hb_face_t* base_face = hb_subset_plan_execute_or_fail(base_plan);
+  GlyphMapping base_mapping(base_plan);
+
+  hb_set_add_range(hb_subset_input_unicode_set(input), 0x61, 0x7A);
+  hb_subset_plan_t* derived_plan = hb_subset_plan_create_or_fail(roboto, input);
+  ASSERT_TRUE(derived_plan);
+  hb_face_t* derived_face = hb_subset_plan_execute_or_fail(derived_plan);
+  GlyphMapping derived_mapping(derived_plan);
+
+  hb_blob_t* base_glyf = hb_face_reference_table(base_face, glyf);
+  hb_blob_t* derived_glyf = hb_face_reference_table(derived_face, glyf);
+
+  FontData patch;
+  ASSERT_EQ(BrotliFontDiff::DiffTable(glyf, base_mapping, base_face,
+                                      derived_mapping, derived_face, &patch),
+            absl::OkStatus());
+  Check(FontData(base_glyf), patch, FontData(derived_glyf));
+
+  // Swapping base and derived removes glyphs.
+  ASSERT_EQ(BrotliFontDiff::DiffTable(glyf, derived_mapping, derived_face,
+                                      base_mapping, base_face, &patch),
+            absl::OkStatus());
+  Check(FontData(derived_glyf), patch, FontData(base_glyf));
+
+  ASSERT_TRUE(absl::IsInvalidArgument(BrotliFontDiff::DiffTable(
+      HB_TAG('h', 'm', 't', 'x'), base_mapping, base_face, derived_mapping,
+      derived_face, &patch)));
+
+  hb_subset_plan_destroy(base_plan);
+  hb_subset_plan_destroy(derived_plan);
+  hb_blob_destroy(base_glyf);
+  hb_blob_destroy(derived_glyf);
+  hb_face_destroy(base_face);
+  hb_face_destroy(derived_face);
+}
+
 }  // namespace brotli
@@ -228,14 +228,6 @@ Status BrotliStream::insert_compressed_with_partial_dict(
   // the regular brotli encoder which will start byte aligned.
   byte_align();
 
-  DictionaryPointer dictionary(nullptr, nullptr);
-  if (partial_dict.size() > 0) {
-    dictionary = SharedBrotliEncoder::CreateDictionary(partial_dict);
-    if (!dictionary) {
-      return absl::InternalError("Failed to create brotli dictionary.");
-    }
-  }
-
   // dictionary_size is added to the stream offset so that static dictionary
   // references (which are window + dictionary size + static word id) will be
   // created with the right distance.
@@ -250,6 +242,38 @@ Status BrotliStream::insert_compressed_with_partial_dict(
     return absl::InternalError("stream offset exceeds window size.");
   }
 
+  if (thread_pool_) {
+    // The compressed output only depends on the inputs recorded here, so it
+    // can be produced later and spliced in at the current position.
+    pending_.push_back(PendingChunk{
+        .position = buffer_.sink().size(),
+        .bytes = bytes,
+        .partial_dict = partial_dict,
+        .stream_offset = stream_offset,
+    });
+  } else {
+    Status s = compress(bytes, partial_dict, stream_offset, &buffer_.sink());
+    if (!s.ok()) {
+      return s;
+    }
+  }
+
+  uncompressed_size_ += bytes.size();
+  return absl::OkStatus();
+}
+
+Status BrotliStream::compress(Span<const uint8_t> bytes,
+                              Span<const uint8_t> partial_dict,
+                              unsigned stream_offset,
+                              std::vector<uint8_t>* sink) const {
+  DictionaryPointer dictionary(nullptr, nullptr);
+  if (partial_dict.size() > 0) {
+    dictionary = SharedBrotliEncoder::CreateDictionary(partial_dict);
+    if (!dictionary) {
+      return absl::InternalError("Failed to create brotli dictionary.");
+    }
+  }
+
   EncoderStatePointer state = create_encoder(stream_offset, dictionary.get());
   if (!state) {
     return absl::InternalError("Failed to create brotli encoder.");
@@ -257,12 +281,56 @@ Status BrotliStream::insert_compressed_with_partial_dict(
 
   bool result = SharedBrotliEncoder::CompressToSink(
       absl::string_view((const char*)bytes.data(), bytes.size()), false,
-      state.get(), &buffer_.sink());
+      state.get(), sink);
   if (!result) {
     return absl::InternalError("Failed to encode brotli binary patch.");
   }
+  return absl::OkStatus();
+}
+
+Status BrotliStream::compress_pending() {
+  if (pending_.empty()) {
+    return absl::OkStatus();
+  }
 
-  uncompressed_size_ += bytes.size();
+  auto compress_one = [this](PendingChunk& chunk) {
+    chunk.status = compress(chunk.bytes, chunk.partial_dict,
+                            chunk.stream_offset, &chunk.compressed);
+  };
+  if (thread_pool_) {
+    thread_pool_->ParallelFor(pending_.size(), [&](uint32_t i) {
+      compress_one(pending_[i]);
+    });
+  } else {
+    // Chunks may have been appended from a stream with a pool.
+    for (auto& chunk : pending_) {
+      compress_one(chunk);
+    }
+  }
+
+  size_t size = buffer_.sink().size();
+  for (const auto& chunk : pending_) {
+    if (!chunk.status.ok()) {
+      return chunk.status;
+    }
+    size += chunk.compressed.size();
+  }
+
+  // Chunks are in order of position.
+  std::vector<uint8_t>& sink = buffer_.sink();
+  std::vector<uint8_t> result;
+  result.reserve(size);
+  size_t position = 0;
+  for (const auto& chunk : pending_) {
+    result.insert(result.end(), sink.begin() + position,
+                  sink.begin() + chunk.position);
+    result.insert(result.end(), chunk.compressed.begin(),
+                  chunk.compressed.end());
+    position = chunk.position;
+  }
+  result.insert(result.end(), sink.begin() + position, sink.end());
+  sink.swap(result);
+  pending_.clear();
   return absl::OkStatus();
 }
 
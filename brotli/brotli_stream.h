@@ -2,11 +2,14 @@
 #define BROTLI_BROTLI_STREAM_H_
 
 #include <algorithm>
+#include <cstddef>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "absl/types/span.h"
 #include "brotli/brotli_bit_buffer.h"
 #include "brotli/shared_brotli_encoder.h"
+#include "common/thread_pool.h"
 
 namespace brotli {
 
@@ -41,24 +44,49 @@ class BrotliStream {
   // Insert bytes into the stream raw with no compression applied.
   void insert_uncompressed(absl::Span<const uint8_t> bytes);
 
-  // Insert bytes and compress them. No shared dictionary is used.
+  /*
+   * If set, insert_compressed*() only records the bytes to compress. All of
+   * the recorded chunks are then compressed concurrently on pool by
+   * compress_pending() and stitched into the stream in order. Each chunk is
+   * its own sequence of meta-blocks so the output is identical to compressing
+   * them as they're inserted. The pool must outlive this stream.
+   */
+  void set_thread_pool(common::ThreadPool* pool) { thread_pool_ = pool; }
+  common::ThreadPool* thread_pool() const { return thread_pool_; }
+
+  // Insert bytes and compress them. No shared dictionary is used. If a thread
+  // pool is set bytes must stay valid until compress_pending() is called.
   absl::Status insert_compressed(absl::Span<const uint8_t> bytes);
 
   // Insert bytes and compress them uses a portion of the full dictionary.
   // Where partial_dict is the dictionary bytes from [0, partial_dict.size())
+  // If a thread pool is set bytes and partial_dict must stay valid until
+  // compress_pending() is called.
   absl::Status insert_compressed_with_partial_dict(
       absl::Span<const uint8_t> bytes, absl::Span<const uint8_t> partial_dict);
 
   // Appends another stream onto this one. The other stream must have been
-  // started with a starting_offset == this.uncompressed_size_.
+  // started with a starting_offset == this.uncompressed_size_. Chunks pending
+  // compression in other are moved to this stream.
   void append(BrotliStream& other) {
     byte_align();
     other.byte_align();
+    size_t position = buffer_.sink().size();
+    for (auto& chunk : other.pending_) {
+      chunk.position += position;
+      pending_.push_back(std::move(chunk));
+    }
+    other.pending_.clear();
     buffer_.sink().insert(buffer_.sink().end(), other.buffer_.sink().begin(),
                           other.buffer_.sink().end());
     uncompressed_size_ += (other.uncompressed_size_ - other.starting_offset_);
   }
 
+  // Compresses the chunks recorded by insert_compressed*() when a thread pool
+  // is set, see set_thread_pool(). Must be called before the compressed data
+  // is read. Does nothing if there are no pending chunks.
+  absl::Status compress_pending();
+
   // TODO(garretrieger): insert_compressed_with_partial_dict that is offset
   //                     from the start. Will need to disable static dict
   //                     references somehow. Can we set a empty custom static
@@ -82,11 +110,38 @@ class BrotliStream {
 
   absl::Span<const uint8_t> compressed_data() const { return buffer_.data(); }
 
+  // Moves the compressed data out of this stream without copying it. Should
+  // only be called once the stream is complete and compress_pending() has
+  // been called.
+  std::vector<uint8_t> take_compressed_data() {
+    std::vector<uint8_t> result;
+    result.swap(buffer_.sink());
+    return result;
+  }
+
   unsigned window_bits() const { return window_bits_; }
   unsigned dictionary_size() const { return dictionary_size_; }
   unsigned uncompressed_size() const { return uncompressed_size_; }
 
  private:
+  // Bytes to be compressed into the output at position (a byte offset into
+  // buffer_), see set_thread_pool().
+  struct PendingChunk {
+    size_t position;
+    absl::Span<const uint8_t> bytes;
+    absl::Span<const uint8_t> partial_dict;
+    unsigned stream_offset;
+    std::vector<uint8_t> compressed;
+    absl::Status status;
+  };
+
+  // Compresses bytes which start at stream_offset in the uncompressed stream
+  // and appends them to sink.
+  absl::Status compress(absl::Span<const uint8_t> bytes,
+                        absl::Span<const uint8_t> partial_dict,
+                        unsigned stream_offset,
+                        std::vector<uint8_t>* sink) const;
+
   EncoderStatePointer create_encoder(
       unsigned stream_offset,
       const BrotliEncoderPreparedDictionary* dictionary) const;
@@ -103,6 +158,8 @@ class BrotliStream {
   unsigned window_size_;
   unsigned dictionary_size_;
   BrotliBitBuffer buffer_;
+  common::ThreadPool* thread_pool_ = nullptr;
+  std::vector<PendingChunk> pending_;
 };
 
 }  // namespace brotli
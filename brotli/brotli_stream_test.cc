@@ -1,7 +1,10 @@
 #include "brotli/brotli_stream.h"
 
+#include <vector>
+
 #include "absl/types/span.h"
 #include "common/brotli_binary_patch.h"
+#include "common/thread_pool.h"
 #include "gtest/gtest.h"
 
 namespace brotli {
@@ -10,6 +13,7 @@ using absl::Span;
 using absl::Status;
 using common::BrotliBinaryPatch;
 using common::FontData;
+using common::ThreadPool;
 
 class BrotliStreamTest : public ::testing::Test {
  protected:
@@ -256,4 +260,55 @@ TEST_F(BrotliStreamTest, FourByteAlign) {
   CheckDecompressesTo(stream, expected, dict);
 }
 
+// Writes a stream mixing all kinds of inserts, plus an appended stream, into
+// a and b with a dictionary of size dict.size().
+void WriteMixed(Span<const uint8_t> data, Span<const uint8_t> dict,
+                BrotliStream& a, BrotliStream& b) {
+  ASSERT_TRUE(
+      a.insert_compressed_with_partial_dict(data.subspan(0, 300), dict).ok());
+  ASSERT_TRUE(a.insert_from_dictionary(10, 50));
+  a.insert_uncompressed(data.subspan(300, 3));
+  ASSERT_TRUE(a.insert_compressed(data.subspan(303, 500)).ok());
+
+  ASSERT_TRUE(b.insert_compressed(data.subspan(803, 400)).ok());
+  ASSERT_TRUE(b.insert_from_dictionary(0, 20));
+  ASSERT_TRUE(b.insert_compressed(data.subspan(1203, 200)).ok());
+  a.append(b);
+
+  ASSERT_TRUE(a.insert_compressed(data.subspan(1403, 97)).ok());
+}
+
+TEST_F(BrotliStreamTest, CompressPendingWithThreadPool) {
+  std::vector<uint8_t> dict;
+  std::vector<uint8_t> data;
+  for (unsigned i = 0; i < 1500; i++) {
+    dict.push_back((i * 7) % 251);
+    data.push_back((i * i) % 253);
+  }
+
+  BrotliStream sequential(22, dict.size());
+  BrotliStream sequential_b(22, dict.size(), 300 + 50 + 3 + 500);
+  WriteMixed(data, dict, sequential, sequential_b);
+  ASSERT_TRUE(sequential.compress_pending().ok());
+  sequential.end_stream();
+
+  ThreadPool pool(4);
+  BrotliStream parallel(22, dict.size());
+  parallel.set_thread_pool(&pool);
+  BrotliStream parallel_b(22, dict.size(), 300 + 50 + 3 + 500);
+  parallel_b.set_thread_pool(&pool);
+  WriteMixed(data, dict, parallel, parallel_b);
+  ASSERT_TRUE(parallel.compress_pending().ok());
+  parallel.end_stream();
+
+  ASSERT_EQ(parallel.compressed_data(), sequential.compressed_data());
+
+  std::vector<uint8_t> expected(data.begin(), data.begin() + 300);
+  expected.insert(expected.end(), dict.begin() + 10, dict.begin() + 60);
+  expected.insert(expected.end(), data.begin() + 300, data.begin() + 1203);
+  expected.insert(expected.end(), dict.begin(), dict.begin() + 20);
+  expected.insert(expected.end(), data.begin() + 1203, data.end());
+  CheckDecompressesTo(parallel, expected, dict);
+}
+
 }  // namespace brotli
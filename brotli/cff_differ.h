@@ -0,0 +1,36 @@
+#ifndef BROTLI_CFF_DIFFER_H_
+#define BROTLI_CFF_DIFFER_H_
+
+#include <cstdint>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "brotli/glyph_data_differ.h"
+#include "common/font_helper.h"
+
+namespace brotli {
+
+/*
+ * Differ for the CFF and CFF2 tables. The per glyph data is the charstrings,
+ * the header, dicts and subroutines are emitted as new data.
+ */
+class CffDiffer : public GlyphDataDiffer {
+ public:
+  CffDiffer(absl::Span<const uint8_t> base_table,
+            absl::Span<const uint8_t> derived_table, bool is_cff2)
+      : GlyphDataDiffer(base_table, derived_table,
+                        common::FontHelper::CffCharStringOffsets(
+                            ToStringView(base_table), is_cff2),
+                        common::FontHelper::CffCharStringOffsets(
+                            ToStringView(derived_table), is_cff2)) {}
+
+ private:
+  static absl::string_view ToStringView(absl::Span<const uint8_t> data) {
+    return absl::string_view(reinterpret_cast<const char*>(data.data()),
+                             data.size());
+  }
+};
+
+}  // namespace brotli
+
+#endif  // BROTLI_CFF_DIFFER_H_
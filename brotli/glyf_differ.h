@@ -1,7 +1,14 @@
 #ifndef BROTLI_GLYF_DIFFER_H_
 #define BROTLI_GLYF_DIFFER_H_
 
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
 #include "absl/types/span.h"
+#include "brotli/glyph_data_differ.h"
+#include "brotli/loca_offsets.h"
 #include "brotli/table_differ.h"
 
 namespace brotli {
@@ -14,14 +21,15 @@ class GlyfDiffer : public TableDiffer {
     EXISTING_DATA,
   } mode = INIT;
 
-  absl::Span<const uint8_t> loca_;
+  // Decoded derived loca.
+  std::vector<uint32_t> loca_offsets_;
   bool is_base_short_loca_;
   bool is_derived_short_loca_;
 
  public:
   GlyfDiffer(absl::Span<const uint8_t> loca, bool is_base_short_loca,
              bool is_derived_short_loca)
-      : loca_(loca),
+      : loca_offsets_(DecodeLoca(loca, is_derived_short_loca)),
         is_base_short_loca_(is_base_short_loca),
         is_derived_short_loca_(is_derived_short_loca) {}
 
@@ -53,7 +61,7 @@ class GlyfDiffer : public TableDiffer {
   }
 
   void Finalize(unsigned* base_delta, /* OUT */
-                unsigned* derived_delta /* OUT */) const override {
+                unsigned* derived_delta /* OUT */) override {
     // noop
     *base_delta = 0;
     *derived_delta = 0;
@@ -63,36 +71,43 @@ class GlyfDiffer : public TableDiffer {
 
  private:
   // Length of glyph (in bytes) found in the derived subset.
-  unsigned GlyphLength(unsigned gid) {
-    const uint8_t* derived_loca = loca_.data();
-
-    if (is_derived_short_loca_) {
-      unsigned index = gid * 2;
-
-      unsigned off_1 = ((derived_loca[index] & 0xFF) << 8) |
-                       (derived_loca[index + 1] & 0xFF);
-
-      index += 2;
-      unsigned off_2 = ((derived_loca[index] & 0xFF) << 8) |
-                       (derived_loca[index + 1] & 0xFF);
-
-      return (off_2 * 2) - (off_1 * 2);
+  unsigned GlyphLength(unsigned gid) const {
+    if (gid + 1 >= loca_offsets_.size()) {
+      return 0;
     }
+    return loca_offsets_[gid + 1] - loca_offsets_[gid];
+  }
+};
 
-    unsigned index = gid * 4;
-
-    unsigned off_1 = ((derived_loca[index] & 0xFF) << 24) |
-                     ((derived_loca[index + 1] & 0xFF) << 16) |
-                     ((derived_loca[index + 2] & 0xFF) << 8) |
-                     (derived_loca[index + 3] & 0xFF);
-
-    index += 4;
-    unsigned off_2 = ((derived_loca[index] & 0xFF) << 24) |
-                     ((derived_loca[index + 1] & 0xFF) << 16) |
-                     ((derived_loca[index + 2] & 0xFF) << 8) |
-                     (derived_loca[index + 3] & 0xFF);
+/*
+ * Differ for a glyf table which is diffed on its own rather than as part of a
+ * whole font. Unlike GlyfDiffer glyph data is compared rather than assumed to
+ * be equal for the same original glyph, so the two tables may come from
+ * different subsetting operations (eg. with different design spaces).
+ */
+class GlyfDataDiffer : public GlyphDataDiffer {
+ public:
+  GlyfDataDiffer(absl::Span<const uint8_t> base_glyf,
+                 absl::Span<const uint8_t> base_loca, bool is_base_short_loca,
+                 absl::Span<const uint8_t> derived_glyf,
+                 absl::Span<const uint8_t> derived_loca,
+                 bool is_derived_short_loca)
+      : GlyphDataDiffer(
+            base_glyf, derived_glyf,
+            GlyphStarts(base_glyf, base_loca, is_base_short_loca),
+            GlyphStarts(derived_glyf, derived_loca, is_derived_short_loca)) {}
 
-    return off_2 - off_1;
+ private:
+  static absl::StatusOr<std::vector<uint32_t>> GlyphStarts(
+      absl::Span<const uint8_t> glyf, absl::Span<const uint8_t> loca,
+      bool is_short_loca) {
+    std::vector<uint32_t> starts = DecodeLoca(loca, is_short_loca);
+    for (size_t i = 0; i < starts.size(); i++) {
+      if (starts[i] > glyf.size() || (i > 0 && starts[i] < starts[i - 1])) {
+        return absl::InvalidArgumentError("loca offsets are invalid.");
+      }
+    }
+    return starts;
   }
 };
 
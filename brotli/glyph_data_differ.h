@@ -0,0 +1,126 @@
+#ifndef BROTLI_GLYPH_DATA_DIFFER_H_
+#define BROTLI_GLYPH_DATA_DIFFER_H_
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "brotli/table_differ.h"
+
+namespace brotli {
+
+/*
+ * Differ for tables which store per glyph data contiguously in glyph id
+ * order, for example CFF charstrings or gvar glyph variation data.
+ *
+ * The glyph data is located by an array of offsets from the start of the
+ * table (or of a region of it, see GlyphDataRegion) to the data for each
+ * glyph, with one extra trailing entry for the end of the last glyph's data.
+ * Everything before the first glyph and after the last glyph is emitted as
+ * new data. Data for glyphs retained from the base which is byte for byte
+ * identical is encoded as a reference to the base.
+ *
+ * Glyph data is compared rather than assumed to be equal since a subsetter may
+ * rewrite it (eg. renumbering subroutines or shared tuples). If the offsets
+ * could not be determined for either table, the whole table is treated as new
+ * data.
+ */
+class GlyphDataDiffer : public TableDiffer {
+ private:
+  enum Mode {
+    INIT = 0,
+    NEW_DATA,
+    EXISTING_DATA,
+  } mode = INIT;
+
+  absl::Span<const uint8_t> base_table_;
+  absl::Span<const uint8_t> derived_table_;
+  absl::StatusOr<std::vector<uint32_t>> base_starts_;
+  absl::StatusOr<std::vector<uint32_t>> derived_starts_;
+  bool opaque_;
+
+ public:
+  GlyphDataDiffer(absl::Span<const uint8_t> base_table,
+                  absl::Span<const uint8_t> derived_table,
+                  absl::StatusOr<std::vector<uint32_t>> base_starts,
+                  absl::StatusOr<std::vector<uint32_t>> derived_starts)
+      : base_table_(base_table),
+        derived_table_(derived_table),
+        base_starts_(std::move(base_starts)),
+        derived_starts_(std::move(derived_starts)),
+        opaque_(!base_starts_.ok() || !derived_starts_.ok() ||
+                base_starts_->empty() || derived_starts_->empty()) {}
+
+  void Process(unsigned derived_gid, unsigned base_gid,
+               unsigned base_derived_gid, bool is_base_empty,
+               unsigned* base_delta, /* OUT */
+               unsigned* derived_delta /* OUT */) override {
+    if (opaque_) {
+      mode = NEW_DATA;
+      *base_delta = 0;
+      *derived_delta = derived_gid == 0 ? derived_table_.size() : 0;
+      return;
+    }
+
+    // Mirrors DiffDriver's advancement of base_gid.
+    bool consumes_base = base_derived_gid == derived_gid ||
+                         (base_gid == derived_gid && is_base_empty);
+    *derived_delta = Length(*derived_starts_, derived_gid);
+    *base_delta = consumes_base ? Length(*base_starts_, base_gid) : 0;
+
+    if (derived_gid == 0) {
+      // The data preceding the glyph data is always new.
+      mode = NEW_DATA;
+      *derived_delta += derived_starts_->front();
+      *base_delta += base_starts_->front();
+      return;
+    }
+
+    mode = (base_derived_gid == derived_gid &&
+            IsSameGlyphData(base_gid, derived_gid))
+               ? EXISTING_DATA
+               : NEW_DATA;
+  }
+
+  void Finalize(unsigned* base_delta, /* OUT */
+                unsigned* derived_delta /* OUT */) override {
+    *base_delta = 0;
+    *derived_delta = 0;
+    if (opaque_) {
+      return;
+    }
+
+    // Anything following the glyph data is new.
+    uint32_t end = derived_starts_->back();
+    if (end < derived_table_.size()) {
+      mode = NEW_DATA;
+      *derived_delta = derived_table_.size() - end;
+    }
+  }
+
+  bool IsNewData() const override { return mode == NEW_DATA; }
+
+ private:
+  static uint32_t Length(const std::vector<uint32_t>& starts, unsigned gid) {
+    return gid + 1 < starts.size() ? starts[gid + 1] - starts[gid] : 0;
+  }
+
+  bool IsSameGlyphData(unsigned base_gid, unsigned derived_gid) const {
+    if (base_gid + 1 >= base_starts_->size() ||
+        derived_gid + 1 >= derived_starts_->size()) {
+      return false;
+    }
+    uint32_t length = Length(*derived_starts_, derived_gid);
+    return Length(*base_starts_, base_gid) == length &&
+           memcmp(base_table_.data() + (*base_starts_)[base_gid],
+                  derived_table_.data() + (*derived_starts_)[derived_gid],
+                  length) == 0;
+  }
+};
+
+}  // namespace brotli
+
+#endif  // BROTLI_GLYPH_DATA_DIFFER_H_
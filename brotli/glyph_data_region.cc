@@ -0,0 +1,337 @@
+#include "brotli/glyph_data_region.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "common/indexed_data_reader.h"
+
+namespace brotli {
+
+using absl::Span;
+using absl::Status;
+using absl::StatusOr;
+using common::IndexedDataReader;
+
+namespace {
+
+// Reads a size byte big endian integer at offset. Returns false if it's out
+// of bounds.
+bool ReadUInt(Span<const uint8_t> data, uint64_t offset, uint32_t size,
+              uint32_t* value) {
+  if (offset + size > data.size()) {
+    return false;
+  }
+  *value = 0;
+  for (uint32_t i = 0; i < size; i++) {
+    *value = (*value << 8) | data[offset + i];
+  }
+  return true;
+}
+
+absl::string_view ToStringView(Span<const uint8_t> data) {
+  return absl::string_view(reinterpret_cast<const char*>(data.data()),
+                           data.size());
+}
+
+// The location of a glyph's image data in the table.
+struct GlyphLocation {
+  uint32_t gid;
+  uint32_t start;
+  uint32_t end;
+};
+
+// Adds the location of each glyph from first_gid onwards given an array of
+// offsets (one per glyph plus the end) from image_offset in data.
+template <typename offset_type>
+Status AddOffsetLocations(Span<const uint8_t> offsets,
+                          Span<const uint8_t> data, uint32_t image_offset,
+                          uint32_t first_gid,
+                          std::vector<GlyphLocation>* locations) {
+  if (image_offset > data.size()) {
+    return absl::InvalidArgumentError("CBLC image data offset is invalid.");
+  }
+  IndexedDataReader<offset_type, 1> reader(
+      ToStringView(offsets), ToStringView(data.subspan(image_offset)));
+  Status s = reader.Validate();
+  if (!s.ok()) {
+    return s;
+  }
+  for (uint32_t i = 0; i < reader.size(); i++) {
+    auto glyph = reader.DataFor(i);
+    if (!glyph.ok()) {
+      return glyph.status();
+    }
+    uint32_t start = reinterpret_cast<const uint8_t*>(glyph->data()) -
+                     data.data();
+    locations->push_back(
+        GlyphLocation{first_gid + i, start, start + (uint32_t)glyph->size()});
+  }
+  return absl::OkStatus();
+}
+
+// Adds the locations of the glyphs in one CBLC index subtable.
+// Reference: https://learn.microsoft.com/en-us/typography/opentype/spec/eblc
+Status AddSubtableLocations(Span<const uint8_t> cblc, uint64_t subtable,
+                            uint32_t first_gid, uint32_t last_gid,
+                            Span<const uint8_t> cbdt,
+                            std::vector<GlyphLocation>* locations) {
+  uint32_t index_format, image_offset;
+  if (last_gid < first_gid || !ReadUInt(cblc, subtable, 2, &index_format) ||
+      !ReadUInt(cblc, subtable + 4, 4, &image_offset)) {
+    return absl::InvalidArgumentError("CBLC index subtable is truncated.");
+  }
+  uint64_t num_offsets = (uint64_t)last_gid - first_gid + 2;
+  uint64_t array_start = subtable + 8;
+
+  switch (index_format) {
+    case 1:
+    case 3: {
+      uint32_t width = index_format == 1 ? 4 : 2;
+      if (array_start + num_offsets * width > cblc.size()) {
+        return absl::InvalidArgumentError("CBLC offsets are truncated.");
+      }
+      Span<const uint8_t> offsets =
+          cblc.subspan(array_start, num_offsets * width);
+      return index_format == 1
+                 ? AddOffsetLocations<uint32_t>(offsets, cbdt, image_offset,
+                                                first_gid, locations)
+                 : AddOffsetLocations<uint16_t>(offsets, cbdt, image_offset,
+                                                first_gid, locations);
+    }
+
+    case 2:
+    case 5: {
+      // Every image is the same size, format 5 lists the glyphs present.
+      uint32_t image_size, num_glyphs = num_offsets - 1;
+      if (!ReadUInt(cblc, array_start, 4, &image_size) ||
+          (index_format == 5 &&
+           !ReadUInt(cblc, array_start + 12, 4, &num_glyphs))) {
+        return absl::InvalidArgumentError("CBLC index subtable is truncated.");
+      }
+      if ((uint64_t)image_offset + (uint64_t)image_size * num_glyphs >
+          cbdt.size()) {
+        return absl::InvalidArgumentError("CBLC image data is out of bounds.");
+      }
+      for (uint32_t i = 0; i < num_glyphs; i++) {
+        uint32_t gid = first_gid + i;
+        if (index_format == 5 &&
+            !ReadUInt(cblc, array_start + 16 + i * 2, 2, &gid)) {
+          return absl::InvalidArgumentError("CBLC glyph ids are truncated.");
+        }
+        uint32_t start = image_offset + i * image_size;
+        locations->push_back(GlyphLocation{gid, start, start + image_size});
+      }
+      return absl::OkStatus();
+    }
+
+    case 4: {
+      // Pairs of glyph id and offset, with one extra for the end.
+      uint32_t num_glyphs;
+      if (!ReadUInt(cblc, array_start, 4, &num_glyphs) ||
+          array_start + 4 + ((uint64_t)num_glyphs + 1) * 4 > cblc.size()) {
+        return absl::InvalidArgumentError("CBLC glyph array is truncated.");
+      }
+      for (uint32_t i = 0; i < num_glyphs; i++) {
+        uint64_t pair = array_start + 4 + i * 4;
+        uint32_t gid, start, end;
+        ReadUInt(cblc, pair, 2, &gid);
+        ReadUInt(cblc, pair + 2, 2, &start);
+        ReadUInt(cblc, pair + 6, 2, &end);
+        start += image_offset;
+        end += image_offset;
+        if (end < start || end > cbdt.size()) {
+          return absl::InvalidArgumentError("CBLC glyph array is invalid.");
+        }
+        locations->push_back(GlyphLocation{gid, start, end});
+      }
+      return absl::OkStatus();
+    }
+
+    default:
+      return absl::InvalidArgumentError("Unsupported CBLC index format.");
+  }
+}
+
+// Computes the starts of a region from the locations of the glyphs with data
+// in it. Glyphs without data are given an empty range at the start of the
+// next glyph's data.
+Status FillStarts(std::vector<GlyphLocation>& locations, uint32_t glyph_count,
+                  uint32_t end, GlyphDataRegion* region) {
+  std::sort(locations.begin(), locations.end(),
+            [](const GlyphLocation& a, const GlyphLocation& b) {
+              return a.gid < b.gid;
+            });
+  for (uint32_t i = 0; i < locations.size(); i++) {
+    if (locations[i].gid >= glyph_count ||
+        (i && (locations[i].gid == locations[i - 1].gid ||
+               locations[i].start < locations[i - 1].end))) {
+      return absl::InvalidArgumentError(
+          "Glyph data is not in glyph id order.");
+    }
+  }
+  if (!locations.empty() && (locations.front().start < region->offset ||
+                             locations.back().end > end)) {
+    return absl::InvalidArgumentError("Glyph data is outside of its strike.");
+  }
+
+  region->starts.resize(glyph_count + 1);
+  uint32_t next = end;
+  region->starts[glyph_count] = next - region->offset;
+  uint32_t remaining = locations.size();
+  for (uint32_t gid = glyph_count; gid-- > 0;) {
+    if (remaining && locations[remaining - 1].gid == gid) {
+      next = locations[--remaining].start;
+    }
+    region->starts[gid] = next - region->offset;
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+StatusOr<std::vector<GlyphDataRegion>> GlyphDataRegion::ForSbix(
+    Span<const uint8_t> sbix, uint32_t glyph_count) {
+  // Reference:
+  // https://learn.microsoft.com/en-us/typography/opentype/spec/sbix
+  constexpr uint32_t kHeaderSize = 8;
+  constexpr uint32_t kStrikeHeaderSize = 4;
+  uint32_t num_strikes;
+  if (!ReadUInt(sbix, 4, 4, &num_strikes) ||
+      kHeaderSize + (uint64_t)num_strikes * 4 > sbix.size()) {
+    return absl::InvalidArgumentError("sbix header is truncated.");
+  }
+  if (!num_strikes || !glyph_count) {
+    return absl::InvalidArgumentError("sbix has no glyph data.");
+  }
+
+  std::vector<uint32_t> strike_offsets;
+  strike_offsets.reserve(num_strikes);
+  for (uint32_t i = 0; i < num_strikes; i++) {
+    uint32_t offset;
+    ReadUInt(sbix, kHeaderSize + i * 4, 4, &offset);
+    if (offset < kHeaderSize + num_strikes * 4 || offset > sbix.size() ||
+        (i && offset < strike_offsets.back())) {
+      return absl::InvalidArgumentError("sbix strikes are not in order.");
+    }
+    strike_offsets.push_back(offset);
+  }
+
+  std::vector<GlyphDataRegion> regions;
+  regions.reserve(num_strikes);
+  for (uint32_t i = 0; i < num_strikes; i++) {
+    uint32_t strike = strike_offsets[i];
+    uint32_t start = i ? strike : 0;
+    uint32_t end = i + 1 < num_strikes ? strike_offsets[i + 1] : sbix.size();
+    uint64_t offsets_size = ((uint64_t)glyph_count + 1) * 4;
+    if (strike + kStrikeHeaderSize + offsets_size > end) {
+      return absl::InvalidArgumentError("sbix strike is truncated.");
+    }
+
+    // Glyph data offsets are relative to the start of the strike.
+    IndexedDataReader<uint32_t, 1> reader(
+        ToStringView(sbix.subspan(strike + kStrikeHeaderSize, offsets_size)),
+        ToStringView(sbix.subspan(strike, end - strike)));
+    Status s = reader.Validate();
+    if (!s.ok()) {
+      return s;
+    }
+
+    GlyphDataRegion region{start, end - start, {}};
+    region.starts.reserve(glyph_count + 1);
+    const uint8_t* region_data = sbix.data() + start;
+    uint32_t data_end = 0;
+    for (uint32_t gid = 0; gid < glyph_count; gid++) {
+      auto glyph = reader.DataFor(gid);
+      if (!glyph.ok()) {
+        return glyph.status();
+      }
+      uint32_t glyph_start =
+          reinterpret_cast<const uint8_t*>(glyph->data()) - region_data;
+      region.starts.push_back(glyph_start);
+      data_end = glyph_start + glyph->size();
+    }
+    region.starts.push_back(data_end);
+    regions.push_back(std::move(region));
+  }
+  return regions;
+}
+
+StatusOr<std::vector<GlyphDataRegion>> GlyphDataRegion::ForCbdt(
+    Span<const uint8_t> cblc, Span<const uint8_t> cbdt, uint32_t glyph_count) {
+  // Reference:
+  // https://learn.microsoft.com/en-us/typography/opentype/spec/cblc
+  constexpr uint32_t kHeaderSize = 8;
+  constexpr uint32_t kBitmapSizeSize = 48;
+  uint32_t num_sizes;
+  if (!ReadUInt(cblc, 4, 4, &num_sizes) ||
+      kHeaderSize + (uint64_t)num_sizes * kBitmapSizeSize > cblc.size()) {
+    return absl::InvalidArgumentError("CBLC header is truncated.");
+  }
+  if (!num_sizes || !glyph_count) {
+    return absl::InvalidArgumentError("CBLC has no strikes.");
+  }
+
+  // Locate every glyph's image data, by strike.
+  std::vector<std::vector<GlyphLocation>> strikes(num_sizes);
+  for (uint32_t i = 0; i < num_sizes; i++) {
+    uint64_t bitmap_size = kHeaderSize + (uint64_t)i * kBitmapSizeSize;
+    uint32_t list_offset, num_subtables;
+    ReadUInt(cblc, bitmap_size, 4, &list_offset);
+    ReadUInt(cblc, bitmap_size + 8, 4, &num_subtables);
+    for (uint32_t j = 0; j < num_subtables; j++) {
+      uint64_t record = (uint64_t)list_offset + j * 8;
+      uint32_t first_gid, last_gid, subtable_offset;
+      if (!ReadUInt(cblc, record, 2, &first_gid) ||
+          !ReadUInt(cblc, record + 2, 2, &last_gid) ||
+          !ReadUInt(cblc, record + 4, 4, &subtable_offset)) {
+        return absl::InvalidArgumentError("CBLC subtable list is truncated.");
+      }
+      Status s = AddSubtableLocations(
+          cblc, (uint64_t)list_offset + subtable_offset, first_gid, last_gid,
+          cbdt, &strikes[i]);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    if (strikes[i].empty()) {
+      return absl::InvalidArgumentError("CBLC strike has no glyphs.");
+    }
+  }
+
+  // The image data of each strike must follow the data of the previous one.
+  std::vector<uint32_t> strike_starts;
+  std::vector<uint32_t> strike_ends;
+  for (const auto& locations : strikes) {
+    uint32_t start = cbdt.size(), end = 0;
+    for (const auto& location : locations) {
+      start = std::min(start, location.start);
+      end = std::max(end, location.end);
+    }
+    if (!strike_ends.empty() && start < strike_ends.back()) {
+      return absl::InvalidArgumentError("CBDT strikes are not in order.");
+    }
+    strike_starts.push_back(start);
+    strike_ends.push_back(end);
+  }
+
+  std::vector<GlyphDataRegion> regions;
+  regions.reserve(num_sizes);
+  for (uint32_t i = 0; i < num_sizes; i++) {
+    uint32_t start = i ? strike_starts[i] : 0;
+    uint32_t end = i + 1 < num_sizes ? strike_starts[i + 1] : cbdt.size();
+    GlyphDataRegion region{start, end - start, {}};
+    Status s = FillStarts(strikes[i], glyph_count, strike_ends[i], &region);
+    if (!s.ok()) {
+      return s;
+    }
+    regions.push_back(std::move(region));
+  }
+  return regions;
+}
+
+}  // namespace brotli
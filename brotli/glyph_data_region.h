@@ -0,0 +1,45 @@
+#ifndef BROTLI_GLYPH_DATA_REGION_H_
+#define BROTLI_GLYPH_DATA_REGION_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+
+namespace brotli {
+
+/*
+ * A region of a table which stores data for every glyph contiguously in glyph
+ * id order, as consumed by GlyphDataDiffer.
+ *
+ * starts holds the offset of each glyph's data (plus the end of the last
+ * glyph's data) relative to the start of the region. Bytes in the region
+ * before the first glyph or after the last are not per glyph data.
+ *
+ * Bitmap tables store a copy of the glyph data for each strike, so they're
+ * split into one region per strike. The regions returned for a table cover
+ * the whole table in order.
+ */
+struct GlyphDataRegion {
+  uint32_t offset;
+  uint32_t length;
+  std::vector<uint32_t> starts;
+
+  // Returns the regions of an sbix table, one per strike. Fails if the
+  // strikes are not stored in order.
+  static absl::StatusOr<std::vector<GlyphDataRegion>> ForSbix(
+      absl::Span<const uint8_t> sbix, uint32_t glyph_count);
+
+  // Returns the regions of a CBDT table, one per strike, where the glyph data
+  // is located with the index subtables in cblc. Fails if the image data of a
+  // strike is not stored in glyph id order, or strikes share or interleave
+  // image data.
+  static absl::StatusOr<std::vector<GlyphDataRegion>> ForCbdt(
+      absl::Span<const uint8_t> cblc, absl::Span<const uint8_t> cbdt,
+      uint32_t glyph_count);
+};
+
+}  // namespace brotli
+
+#endif  // BROTLI_GLYPH_DATA_REGION_H_
@@ -0,0 +1,167 @@
+#include "brotli/glyph_data_region.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gtest/gtest.h"
+
+namespace brotli {
+
+using std::vector;
+
+class GlyphDataRegionTest : public ::testing::Test {
+ protected:
+  static void Append(vector<uint8_t>* data, uint32_t value, uint32_t size) {
+    for (uint32_t i = size; i-- > 0;) {
+      data->push_back((value >> (i * 8)) & 0xFF);
+    }
+  }
+
+  static void AppendZeroes(vector<uint8_t>* data, uint32_t count) {
+    data->insert(data->end(), count, 0);
+  }
+
+  // An sbix table for 3 glyphs with two strikes.
+  static vector<uint8_t> Sbix() {
+    vector<uint8_t> sbix;
+    Append(&sbix, 1, 2);   // version
+    Append(&sbix, 1, 2);   // flags
+    Append(&sbix, 2, 4);   // numStrikes
+    Append(&sbix, 16, 4);  // strikeOffsets
+    Append(&sbix, 41, 4);
+
+    // Strike 1: glyphs of length 0, 3 and 2.
+    Append(&sbix, 20, 2);  // ppem
+    Append(&sbix, 72, 2);  // ppi
+    for (uint32_t offset : {20, 20, 23, 25}) {
+      Append(&sbix, offset, 4);
+    }
+    AppendZeroes(&sbix, 5);
+
+    // Strike 2: glyphs of length 1, 0 and 4.
+    Append(&sbix, 40, 2);
+    Append(&sbix, 72, 2);
+    for (uint32_t offset : {20, 21, 21, 25}) {
+      Append(&sbix, offset, 4);
+    }
+    AppendZeroes(&sbix, 5);
+    return sbix;
+  }
+
+  static void AppendBitmapSize(vector<uint8_t>* cblc, uint32_t list_offset) {
+    Append(cblc, list_offset, 4);  // indexSubtableListOffset
+    Append(cblc, 16, 4);           // indexSubtableListSize
+    Append(cblc, 1, 4);            // numberOfIndexSubtables
+    AppendZeroes(cblc, 36);
+  }
+
+  // A CBLC table for 4 glyphs with two strikes. The first uses format 1 for
+  // glyphs 1 and 2, the second format 2 for glyphs 0 and 1 with image data
+  // starting at strike_2_offset.
+  static vector<uint8_t> Cblc(uint32_t strike_2_offset = 12) {
+    vector<uint8_t> cblc;
+    Append(&cblc, 3, 2);  // majorVersion
+    Append(&cblc, 0, 2);  // minorVersion
+    Append(&cblc, 2, 4);  // numSizes
+    AppendBitmapSize(&cblc, 104);
+    AppendBitmapSize(&cblc, 132);
+
+    // Subtable list and subtable for strike 1.
+    Append(&cblc, 1, 2);   // firstGlyphIndex
+    Append(&cblc, 2, 2);   // lastGlyphIndex
+    Append(&cblc, 8, 4);   // indexSubtableOffset
+    Append(&cblc, 1, 2);   // indexFormat
+    Append(&cblc, 17, 2);  // imageFormat
+    Append(&cblc, 4, 4);   // imageDataOffset
+    for (uint32_t offset : {0, 3, 8}) {
+      Append(&cblc, offset, 4);
+    }
+
+    // Subtable list and subtable for strike 2.
+    Append(&cblc, 0, 2);
+    Append(&cblc, 1, 2);
+    Append(&cblc, 8, 4);
+    Append(&cblc, 2, 2);
+    Append(&cblc, 17, 2);
+    Append(&cblc, strike_2_offset, 4);
+    Append(&cblc, 2, 4);  // imageSize
+    AppendZeroes(&cblc, 8);
+    return cblc;
+  }
+};
+
+TEST_F(GlyphDataRegionTest, Sbix) {
+  vector<uint8_t> sbix = Sbix();
+  auto regions = GlyphDataRegion::ForSbix(sbix, 3);
+  ASSERT_TRUE(regions.ok()) << regions.status();
+  ASSERT_EQ(regions->size(), 2);
+
+  // The first region includes the table header.
+  EXPECT_EQ((*regions)[0].offset, 0);
+  EXPECT_EQ((*regions)[0].length, 41);
+  EXPECT_EQ((*regions)[0].starts, (vector<uint32_t>{36, 36, 39, 41}));
+
+  EXPECT_EQ((*regions)[1].offset, 41);
+  EXPECT_EQ((*regions)[1].length, 25);
+  EXPECT_EQ((*regions)[1].starts, (vector<uint32_t>{20, 21, 21, 25}));
+}
+
+TEST_F(GlyphDataRegionTest, Sbix_Invalid) {
+  vector<uint8_t> sbix = Sbix();
+  ASSERT_TRUE(absl::IsInvalidArgument(
+      GlyphDataRegion::ForSbix(sbix, 4).status()));
+  ASSERT_TRUE(absl::IsInvalidArgument(
+      GlyphDataRegion::ForSbix(sbix, 0).status()));
+
+  // Strikes out of order.
+  sbix[11] = 50;
+  ASSERT_TRUE(absl::IsInvalidArgument(
+      GlyphDataRegion::ForSbix(sbix, 3).status()));
+
+  ASSERT_TRUE(absl::IsInvalidArgument(
+      GlyphDataRegion::ForSbix(vector<uint8_t>{0, 1, 0}, 3).status()));
+}
+
+TEST_F(GlyphDataRegionTest, Cbdt) {
+  vector<uint8_t> cblc = Cblc();
+  vector<uint8_t> cbdt(16);
+
+  auto regions = GlyphDataRegion::ForCbdt(cblc, cbdt, 4);
+  ASSERT_TRUE(regions.ok()) << regions.status();
+  ASSERT_EQ(regions->size(), 2);
+
+  // Glyphs 0 and 3 have no data in the first strike.
+  EXPECT_EQ((*regions)[0].offset, 0);
+  EXPECT_EQ((*regions)[0].length, 12);
+  EXPECT_EQ((*regions)[0].starts, (vector<uint32_t>{4, 4, 7, 12, 12}));
+
+  EXPECT_EQ((*regions)[1].offset, 12);
+  EXPECT_EQ((*regions)[1].length, 4);
+  EXPECT_EQ((*regions)[1].starts, (vector<uint32_t>{0, 2, 4, 4, 4}));
+}
+
+TEST_F(GlyphDataRegionTest, Cbdt_Invalid) {
+  vector<uint8_t> cbdt(16);
+
+  // The strikes share image data.
+  vector<uint8_t> cblc = Cblc(10);
+  ASSERT_TRUE(absl::IsInvalidArgument(
+      GlyphDataRegion::ForCbdt(cblc, cbdt, 4).status()));
+
+  // Image data is out of bounds.
+  cblc = Cblc(14);
+  ASSERT_TRUE(absl::IsInvalidArgument(
+      GlyphDataRegion::ForCbdt(cblc, cbdt, 4).status()));
+
+  // Glyph is outside the font.
+  cblc = Cblc();
+  ASSERT_TRUE(absl::IsInvalidArgument(
+      GlyphDataRegion::ForCbdt(cblc, cbdt, 2).status()));
+
+  cblc.resize(100);
+  ASSERT_TRUE(absl::IsInvalidArgument(
+      GlyphDataRegion::ForCbdt(cblc, cbdt, 4).status()));
+}
+
+}  // namespace brotli
@@ -0,0 +1,74 @@
+#ifndef BROTLI_GVAR_DIFFER_H_
+#define BROTLI_GVAR_DIFFER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "brotli/glyph_data_differ.h"
+
+namespace brotli {
+
+/*
+ * Differ for the gvar table. The per glyph data is the glyph variation data,
+ * the header, offsets and shared tuples are emitted as new data.
+ */
+class GvarDiffer : public GlyphDataDiffer {
+ public:
+  GvarDiffer(absl::Span<const uint8_t> base_table,
+             absl::Span<const uint8_t> derived_table)
+      : GlyphDataDiffer(base_table, derived_table,
+                        GlyphVariationDataStarts(base_table),
+                        GlyphVariationDataStarts(derived_table)) {}
+
+ private:
+  // Returns the offset of each glyph's variation data (plus the end of the
+  // last) from the start of the table.
+  static absl::StatusOr<std::vector<uint32_t>> GlyphVariationDataStarts(
+      absl::Span<const uint8_t> table) {
+    constexpr uint32_t kHeaderSize = 20;
+    if (table.size() < kHeaderSize) {
+      return absl::InvalidArgumentError("gvar header is truncated.");
+    }
+
+    uint32_t glyph_count = ReadUInt(table, 12, 2);
+    bool long_offsets = ReadUInt(table, 14, 2) & 0x1;
+    uint32_t data_offset = ReadUInt(table, 16, 4);
+    uint32_t offset_size = long_offsets ? 4 : 2;
+    if (kHeaderSize + (uint64_t)(glyph_count + 1) * offset_size >
+        table.size()) {
+      return absl::InvalidArgumentError("gvar offsets are truncated.");
+    }
+
+    std::vector<uint32_t> starts;
+    starts.reserve(glyph_count + 1);
+    for (uint32_t i = 0; i <= glyph_count; i++) {
+      uint64_t offset =
+          ReadUInt(table, kHeaderSize + i * offset_size, offset_size);
+      // Short offsets are stored divided by two.
+      uint64_t start =
+          (uint64_t)data_offset + (long_offsets ? offset : offset * 2);
+      if (start > table.size() || (!starts.empty() && start < starts.back())) {
+        return absl::InvalidArgumentError("gvar offsets are invalid.");
+      }
+      starts.push_back(start);
+    }
+    return starts;
+  }
+
+  // Caller must ensure offset + size is in bounds.
+  static uint32_t ReadUInt(absl::Span<const uint8_t> data, uint32_t offset,
+                           uint32_t size) {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < size; i++) {
+      value = (value << 8) | data[offset + i];
+    }
+    return value;
+  }
+};
+
+}  // namespace brotli
+
+#endif  // BROTLI_GVAR_DIFFER_H_
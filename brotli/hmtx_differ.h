@@ -49,7 +49,7 @@ class HmtxDiffer : public TableDiffer {
   }
 
   void Finalize(unsigned* base_delta, /* OUT */
-                unsigned* derived_delta /* OUT */) const override {
+                unsigned* derived_delta /* OUT */) override {
     // noop
     *base_delta = 0;
     *derived_delta = 0;
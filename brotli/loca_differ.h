@@ -56,7 +56,7 @@ class LocaDiffer : public TableDiffer {
   }
 
   void Finalize(unsigned* base_delta, /* OUT */
-                unsigned* derived_delta /* OUT */) const override {
+                unsigned* derived_delta /* OUT */) override {
     // Loca table has one extra entry at the end. Stay in current mode.
     *base_delta = loca_width_;
     *derived_delta = loca_width_;
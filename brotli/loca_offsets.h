@@ -0,0 +1,40 @@
+#ifndef BROTLI_LOCA_OFFSETS_H_
+#define BROTLI_LOCA_OFFSETS_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/types/span.h"
+
+namespace brotli {
+
+/*
+ * Decodes all entries of a loca table into native byte offsets into glyf (short
+ * loca entries are scaled by two). Any trailing partial entry is ignored.
+ *
+ * The loops are kept free of branches and data dependent indexing so they can
+ * be vectorized by the compiler.
+ */
+inline std::vector<uint32_t> DecodeLoca(absl::Span<const uint8_t> loca,
+                                        bool is_short_loca) {
+  const uint8_t* data = loca.data();
+  if (is_short_loca) {
+    std::vector<uint32_t> offsets(loca.size() / 2);
+    for (size_t i = 0; i < offsets.size(); i++) {
+      offsets[i] = (((uint32_t)data[2 * i] << 8) | data[2 * i + 1]) * 2;
+    }
+    return offsets;
+  }
+
+  std::vector<uint32_t> offsets(loca.size() / 4);
+  for (size_t i = 0; i < offsets.size(); i++) {
+    offsets[i] = ((uint32_t)data[4 * i] << 24) |
+                 ((uint32_t)data[4 * i + 1] << 16) |
+                 ((uint32_t)data[4 * i + 2] << 8) | data[4 * i + 3];
+  }
+  return offsets;
+}
+
+}  // namespace brotli
+
+#endif  // BROTLI_LOCA_OFFSETS_H_
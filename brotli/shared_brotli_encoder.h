@@ -1,6 +1,9 @@
 #ifndef BROTLI_SHARED_BROTLI_ENCODER_H_
 #define BROTLI_SHARED_BROTLI_ENCODER_H_
 
+#include <cstddef>
+#include <cstdlib>
+#include <map>
 #include <memory>
 
 #include "absl/log/log.h"
@@ -17,23 +20,140 @@ typedef std::unique_ptr<BrotliEncoderPreparedDictionary,
                         decltype(&BrotliEncoderDestroyPreparedDictionary)>
     DictionaryPointer;
 
+/*
+ * Memory hooks for brotli encoder and decoder states, see brotli_alloc_func in
+ * brotli/types.h. For example a server can back all of the brotli work for a
+ * request with an arena which is dropped at once. If alloc and free are null
+ * the default allocator of each user is used.
+ */
+struct Allocator {
+  brotli_alloc_func alloc = nullptr;
+  brotli_free_func free = nullptr;
+  void* opaque = nullptr;
+
+  bool IsSet() const { return alloc && free; }
+};
+
+/*
+ * Default allocator for encoder states. It keeps their large blocks (eg. the
+ * hash tables) in a per thread cache when a state is destroyed and hands them
+ * to the next state created on that thread. At high qualities these blocks
+ * are tens of megabytes, so recycling them avoids allocator churn and page
+ * faults when many patches are encoded in a row.
+ *
+ * Brotli can't reset a state for use on a new stream, so this reuses the
+ * memory of states rather than the states themselves. Encoders with the same
+ * quality, window, and mode make the same allocations so blocks from one
+ * generally match the next. Brotli initializes everything it allocates, so
+ * output is unchanged.
+ */
+class EncoderMemoryPool {
+ public:
+  // Smaller blocks are left to the regular allocator.
+  static constexpr size_t kMinPooledSize = 64 * 1024;
+  // Upper bound on the size of the free blocks kept by each thread.
+  static constexpr size_t kMaxCachedBytes = 256 * 1024 * 1024;
+
+  // brotli_alloc_func and brotli_free_func implementations.
+  static void* Alloc(void* opaque, size_t size) {
+    return ForThread().Allocate(size);
+  }
+  static void Free(void* opaque, void* address) {
+    ForThread().Release(address);
+  }
+
+  // The number of bytes held in the calling thread's cache.
+  static size_t CachedBytes() { return ForThread().cached_bytes_; }
+
+ private:
+  // Placed in front of each block, keeps the block at malloc's alignment.
+  struct alignas(alignof(std::max_align_t)) Header {
+    size_t capacity;
+  };
+
+  EncoderMemoryPool() = default;
+  ~EncoderMemoryPool() {
+    for (const auto& [capacity, block] : blocks_) {
+      std::free(block);
+    }
+  }
+
+  static EncoderMemoryPool& ForThread() {
+    static thread_local EncoderMemoryPool pool;
+    return pool;
+  }
+
+  void* Allocate(size_t size) {
+    if (size >= kMinPooledSize) {
+      // Take the smallest cached block that fits, unless it would waste more
+      // than half of itself.
+      auto it = blocks_.lower_bound(size);
+      if (it != blocks_.end() && it->first / 2 <= size) {
+        Header* header = (Header*)it->second;
+        cached_bytes_ -= it->first;
+        blocks_.erase(it);
+        return header + 1;
+      }
+    }
+
+    Header* header = (Header*)std::malloc(sizeof(Header) + size);
+    if (!header) {
+      return nullptr;
+    }
+    header->capacity = size;
+    return header + 1;
+  }
+
+  void Release(void* address) {
+    if (!address) {
+      return;
+    }
+    Header* header = ((Header*)address) - 1;
+    size_t capacity = header->capacity;
+    if (capacity < kMinPooledSize ||
+        cached_bytes_ + capacity > kMaxCachedBytes) {
+      std::free(header);
+      return;
+    }
+    blocks_.emplace(capacity, header);
+    cached_bytes_ += capacity;
+  }
+
+  // Free blocks keyed by capacity.
+  std::multimap<size_t, void*> blocks_;
+  size_t cached_bytes_ = 0;
+};
+
 /* A collection of utilities that ease using the existing brotli encoder API. */
 class SharedBrotliEncoder {
  public:
-  static DictionaryPointer CreateDictionary(absl::Span<const uint8_t> data) {
+  static DictionaryPointer CreateDictionary(absl::Span<const uint8_t> data,
+                                            const Allocator& allocator = {}) {
     return DictionaryPointer(
         BrotliEncoderPrepareDictionary(
             BROTLI_SHARED_DICTIONARY_RAW, data.size(), data.data(),
-            BROTLI_MAX_QUALITY, nullptr, nullptr, nullptr),
+            BROTLI_MAX_QUALITY, allocator.alloc, allocator.free,
+            allocator.opaque),
         &BrotliEncoderDestroyPreparedDictionary);
   }
 
+  // If lgwin is 0 the encoder's default window size is used. The state's
+  // memory comes from allocator if set, otherwise from EncoderMemoryPool.
   static EncoderStatePointer CreateEncoder(
       unsigned quality, size_t font_size, unsigned stream_offset,
-      const BrotliEncoderPreparedDictionary* dictionary) {
+      const BrotliEncoderPreparedDictionary* dictionary, unsigned lgwin = 0,
+      const Allocator& allocator = {}) {
     EncoderStatePointer state = EncoderStatePointer(
-        BrotliEncoderCreateInstance(nullptr, nullptr, nullptr),
+        allocator.IsSet()
+            ? BrotliEncoderCreateInstance(allocator.alloc, allocator.free,
+                                          allocator.opaque)
+            : BrotliEncoderCreateInstance(&EncoderMemoryPool::Alloc,
+                                          &EncoderMemoryPool::Free, nullptr),
         &BrotliEncoderDestroyInstance);
+    if (!state) {
+      LOG(WARNING) << "Failed to create brotli encoder.";
+      return state;
+    }
 
     if (!BrotliEncoderSetParameter(state.get(), BROTLI_PARAM_QUALITY,
                                    quality)) {
@@ -41,6 +161,12 @@ class SharedBrotliEncoder {
       return EncoderStatePointer(nullptr, nullptr);
     }
 
+    if (lgwin &&
+        !BrotliEncoderSetParameter(state.get(), BROTLI_PARAM_LGWIN, lgwin)) {
+      LOG(WARNING) << "Failed to set brotli window size.";
+      return EncoderStatePointer(nullptr, nullptr);
+    }
+
     if (font_size && !BrotliEncoderSetParameter(
                          state.get(), BROTLI_PARAM_SIZE_HINT, font_size)) {
       LOG(WARNING) << "Failed to set brotli size hint.";
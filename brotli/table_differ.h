@@ -16,7 +16,7 @@ class TableDiffer {
                        unsigned* derived_delta /* OUT */) = 0;
 
   virtual void Finalize(unsigned* base_delta, /* OUT */
-                        unsigned* derived_delta /* OUT */) const = 0;
+                        unsigned* derived_delta /* OUT */) = 0;
 
   virtual bool IsNewData() const = 0;
 };
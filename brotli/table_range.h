@@ -54,11 +54,32 @@ class TableRange {
     out.reset(new BrotliStream(base_stream.window_bits(),
                                base_stream.dictionary_size(),
                                table_offset(derived_face, tag)));
+    out->set_thread_pool(base_stream.thread_pool());
 
     base_table_offset_ = table_offset(base_face, tag);
     tag_ = tag;
   }
 
+  // For a table which is diffed on its own, all offsets are relative to the
+  // start of the table.
+  TableRange(absl::Span<const uint8_t> derived_table, hb_tag_t tag,
+             const BrotliStream& base_stream)
+      : TableRange(derived_table, 0, 0, tag, base_stream) {}
+
+  // For part of a table, derived_region starts at stream_offset in the
+  // uncompressed stream and the matching base data starts at base_offset in
+  // the dictionary.
+  TableRange(absl::Span<const uint8_t> derived_region, unsigned base_offset,
+             unsigned stream_offset, hb_tag_t tag,
+             const BrotliStream& base_stream)
+      : derived_(derived_region),
+        base_table_offset_(base_offset),
+        out(new BrotliStream(base_stream.window_bits(),
+                             base_stream.dictionary_size(), stream_offset)),
+        tag_(tag) {
+    out->set_thread_pool(base_stream.thread_pool());
+  }
+
  private:
   absl::Span<const uint8_t> derived_;
 
@@ -67,6 +88,11 @@ class TableRange {
   unsigned derived_offset_ = 0;
   unsigned base_length_ = 0;
   unsigned derived_length_ = 0;
+  // Committed new data (including any short retained runs merged into it)
+  // which follows base_offset_/derived_offset_ and hasn't been compressed yet.
+  unsigned new_base_length_ = 0;
+  unsigned new_derived_length_ = 0;
+  unsigned min_existing_length_ = 0;
   std::unique_ptr<BrotliStream> out;
   hb_tag_t tag_;
 
@@ -79,20 +105,27 @@ class TableRange {
 
   unsigned length() { return derived_.size(); }
 
+  /*
+   * Retained runs shorter than length are compressed along with the
+   * surrounding new data instead of being referenced from the dictionary.
+   * Each dictionary reference is its own meta-block and splits the new data
+   * around it into separately compressed chunks, so for short runs that
+   * overhead exceeds the bytes saved. Zero references every retained run.
+   */
+  void set_min_existing_length(unsigned length) {
+    min_existing_length_ = length;
+  }
+
   void Extend(unsigned base_length, unsigned derived_length) {
     base_length_ += base_length;
     derived_length_ += derived_length;
   }
 
+  // New data is held back until the next retained run which is long enough
+  // to be referenced, or until Flush(), so that short runs can be merged in.
   absl::Status CommitNew() {
-    absl::Status s = out->insert_compressed(absl::Span<const uint8_t>(
-        derived_.data() + derived_offset_, derived_length_));
-    if (!s.ok()) {
-      return s;
-    }
-
-    derived_offset_ += derived_length_;
-    base_offset_ += base_length_;
+    new_base_length_ += base_length_;
+    new_derived_length_ += derived_length_;
 
     base_length_ = 0;
     derived_length_ = 0;
@@ -100,7 +133,16 @@ class TableRange {
     return absl::OkStatus();
   }
 
-  void CommitExisting() {
+  absl::Status CommitExisting() {
+    if (derived_length_ < min_existing_length_) {
+      return CommitNew();
+    }
+
+    absl::Status s = Flush();
+    if (!s.ok()) {
+      return s;
+    }
+
     if (!out->insert_from_dictionary(base_table_offset_ + base_offset_,
                                      derived_length_)) {
       // 1 byte backwards refs must be inserted as literals.
@@ -113,6 +155,26 @@ class TableRange {
 
     base_length_ = 0;
     derived_length_ = 0;
+
+    return absl::OkStatus();
+  }
+
+  // Compresses any new data which has been committed but not yet written to
+  // the stream. Must be called once the last run has been committed.
+  absl::Status Flush() {
+    absl::Status s = out->insert_compressed(absl::Span<const uint8_t>(
+        derived_.data() + derived_offset_, new_derived_length_));
+    if (!s.ok()) {
+      return s;
+    }
+
+    derived_offset_ += new_derived_length_;
+    base_offset_ += new_base_length_;
+
+    new_base_length_ = 0;
+    new_derived_length_ = 0;
+
+    return absl::OkStatus();
   }
 };
 
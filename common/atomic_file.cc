@@ -0,0 +1,59 @@
+#include "common/atomic_file.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+namespace common {
+
+using absl::Status;
+using absl::StrCat;
+
+namespace fs = std::filesystem;
+
+Status WriteFileAtomically(const std::string& path,
+                           absl::Span<const absl::string_view> pieces) {
+  // Unique per process and call so concurrent writers of the same path, in
+  // this or other processes, don't share a temporary file.
+  static std::atomic<uint64_t> temp_file_counter = 0;
+  std::string temp_path =
+      StrCat(path, ".", getpid(), ".", temp_file_counter++, ".tmp");
+
+  std::error_code ec;
+  {
+    std::ofstream output(temp_path,
+                         std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!output.is_open()) {
+      return absl::InternalError(StrCat("Unable to open ", temp_path, "."));
+    }
+    for (absl::string_view piece : pieces) {
+      output.write(piece.data(), piece.size());
+    }
+    // Buffered data is only written out on close, which must succeed too.
+    output.close();
+    if (output.fail()) {
+      fs::remove(temp_path, ec);
+      return absl::InternalError(StrCat("Failed to write to ", temp_path, "."));
+    }
+  }
+
+  fs::rename(temp_path, path, ec);
+  if (ec) {
+    fs::remove(temp_path, ec);
+    return absl::InternalError(
+        StrCat("Failed to move ", temp_path, " into place at ", path, "."));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace common
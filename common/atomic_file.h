@@ -0,0 +1,26 @@
+#ifndef COMMON_ATOMIC_FILE_H_
+#define COMMON_ATOMIC_FILE_H_
+
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+namespace common {
+
+/*
+ * Writes the concatenation of pieces to path, replacing any existing file.
+ *
+ * The data is first written to a uniquely named temporary file next to path
+ * which is only renamed into place once it's been fully written and
+ * successfully closed. So readers, including other processes, see either the
+ * previous file or the complete new one, never a partial write. On failure
+ * the temporary file is removed and path is left unchanged.
+ */
+absl::Status WriteFileAtomically(const std::string& path,
+                                 absl::Span<const absl::string_view> pieces);
+
+}  // namespace common
+
+#endif  // COMMON_ATOMIC_FILE_H_
@@ -0,0 +1,70 @@
+#include "common/atomic_file.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+
+namespace common {
+
+class AtomicFileTest : public ::testing::Test {
+ protected:
+  AtomicFileTest() {
+    directory_ = absl::StrCat(::testing::TempDir(), "/atomic_file_test_",
+                              ::testing::UnitTest::GetInstance()
+                                  ->current_test_info()
+                                  ->name());
+    std::filesystem::remove_all(directory_);
+    std::filesystem::create_directories(directory_);
+  }
+
+  ~AtomicFileTest() override { std::filesystem::remove_all(directory_); }
+
+  std::string Read(const std::string& path) {
+    std::ifstream input(path, std::ios::in | std::ios::binary);
+    std::stringstream buffer;
+    buffer << input.rdbuf();
+    return buffer.str();
+  }
+
+  std::string directory_;
+};
+
+TEST_F(AtomicFileTest, WritesAndReplaces) {
+  std::string path = absl::StrCat(directory_, "/file");
+  auto sc = WriteFileAtomically(path, {"abc", "", "de"});
+  ASSERT_TRUE(sc.ok()) << sc;
+  ASSERT_EQ(Read(path), "abcde");
+
+  sc = WriteFileAtomically(path, {"f"});
+  ASSERT_TRUE(sc.ok()) << sc;
+  ASSERT_EQ(Read(path), "f");
+
+  // No temporary files are left behind.
+  ASSERT_EQ(std::distance(std::filesystem::directory_iterator(directory_),
+                          std::filesystem::directory_iterator()),
+            1);
+}
+
+TEST_F(AtomicFileTest, FailureLeavesExistingFile) {
+  std::string path = absl::StrCat(directory_, "/file");
+  auto sc = WriteFileAtomically(path, {"abc"});
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  // A directory can't be replaced by a file.
+  std::string dir_path = absl::StrCat(directory_, "/dir");
+  std::filesystem::create_directories(dir_path + "/child");
+  sc = WriteFileAtomically(dir_path, {"abc"});
+  ASSERT_TRUE(absl::IsInternal(sc)) << sc;
+  ASSERT_TRUE(std::filesystem::is_directory(dir_path));
+
+  sc = WriteFileAtomically(absl::StrCat(directory_, "/missing/file"), {"abc"});
+  ASSERT_TRUE(absl::IsInternal(sc)) << sc;
+  ASSERT_EQ(Read(path), "abc");
+}
+
+}  // namespace common
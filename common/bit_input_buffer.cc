@@ -10,19 +10,18 @@ namespace common {
 static const uint32_t kBitsPerByte = 8;
 static const uint32_t kBitsPerTwoBytes = 16;
 static const uint32_t kBitsPerThreeBytes = 24;
-static const uint32_t kBitsPerNibble = 4;
-static const uint8_t kFirstNibbleMask = 0x0F;
-static const uint8_t kFirstTwoBitsMask = 0b11;
 
 static BranchFactor DecodeBranchFactor(string_view bits);
 static uint32_t DecodeDepth(string_view bits);
 
 BitInputBuffer::BitInputBuffer(string_view bits)
-    : branch_factor(DecodeBranchFactor(bits)), depth(DecodeDepth(bits)) {
+    : branch_factor(DecodeBranchFactor(bits)),
+      depth(DecodeDepth(bits)),
+      node_bits(kBFNodeSize[branch_factor]),
+      node_mask((1ull << kBFNodeSize[branch_factor]) - 1) {
   this->bits = bits;
   current_byte = 1;
-  current_pair = 0;
-  first_nibble = true;
+  bit_offset = 0;
 }
 
 const BranchFactor BitInputBuffer::GetBranchFactor() const {
@@ -32,69 +31,35 @@ const BranchFactor BitInputBuffer::GetBranchFactor() const {
 const uint32_t BitInputBuffer::Depth() const { return depth; }
 
 absl::string_view BitInputBuffer::Remaining() const {
-  int extra = 0;
-  switch (branch_factor) {
-    case BF2:
-      extra = (current_pair > 0) ? 1 : 0;
-      return ClippedSubstr(bits, current_byte + extra);
-    case BF4:
-      extra = !first_nibble ? 1 : 0;
-      return ClippedSubstr(bits, current_byte + extra);
-    case BF8:
-      // Fallthrough
-    case BF32:
-      return ClippedSubstr(bits, current_byte);
-    default:
-      // Invalid branch factor, nothing will be consumed.
-      return bits;
-  }
+  // A partially consumed byte counts as consumed.
+  return ClippedSubstr(bits, current_byte + (bit_offset ? 1 : 0));
 }
 
 bool BitInputBuffer::read(uint32_t *out) {
   if (!out) {
     return false;
   }
-  switch (branch_factor) {
-    case BF2:
-      if (current_byte >= bits.size()) {
-        return false;
-      }
-      *out = (bits[current_byte] >> (2 * current_pair)) & kFirstTwoBitsMask;
-      current_pair++;
-      if (current_pair == 4) {
-        current_byte++;
-        current_pair = 0;
-      }
-      break;
-    case BF4:
-      if (current_byte >= bits.size()) {
-        return false;
-      }
-      if (first_nibble) {
-        *out = (uint8_t)bits[current_byte] & kFirstNibbleMask;
-        first_nibble = false;
-      } else {
-        *out = (uint8_t)bits[current_byte++] >> kBitsPerNibble;
-        first_nibble = true;
-      }
-      break;
-    case BF8:
-      if (current_byte >= bits.size()) {
-        return false;
-      }
-      *out = (uint8_t)bits[current_byte++];
-      break;
-    case BF32:
-      if (current_byte + 3 >= bits.size()) {
-        return false;
-      }
-      *out = ((uint8_t)bits[current_byte + 3] << kBitsPerThreeBytes) |
-             ((uint8_t)bits[current_byte + 2] << kBitsPerTwoBytes) |
-             ((uint8_t)bits[current_byte + 1] << kBitsPerByte) |
-             (uint8_t)bits[current_byte];
-      current_byte += 4;
-      break;
+
+  if (branch_factor == BF32) {
+    if (current_byte + 3 >= bits.size()) {
+      return false;
+    }
+    *out = ((uint8_t)bits[current_byte + 3] << kBitsPerThreeBytes) |
+           ((uint8_t)bits[current_byte + 2] << kBitsPerTwoBytes) |
+           ((uint8_t)bits[current_byte + 1] << kBitsPerByte) |
+           (uint8_t)bits[current_byte];
+    current_byte += 4;
+    return true;
+  }
+
+  // BF2, BF4, and BF8 nodes never straddle a byte boundary.
+  if (current_byte >= bits.size()) {
+    return false;
   }
+  *out = ((uint8_t)bits[current_byte] >> bit_offset) & node_mask;
+  bit_offset += node_bits;
+  current_byte += bit_offset / kBitsPerByte;
+  bit_offset %= kBitsPerByte;
   return true;
 }
 
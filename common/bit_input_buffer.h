@@ -30,9 +30,13 @@ class BitInputBuffer {
   const BranchFactor branch_factor;
   const uint32_t depth;
   absl::string_view bits;
+  // Node width and mask for branch factors narrower than a byte, looked up
+  // once so reads don't need to switch on the branch factor.
+  const uint32_t node_bits;
+  const uint32_t node_mask;
   uint32_t current_byte;
-  uint8_t current_pair;
-  bool first_nibble;
+  // Offset of the next unread bit within current_byte.
+  uint32_t bit_offset;
 };
 
 }  // namespace common
@@ -0,0 +1,97 @@
+#include <cstdint>
+
+#include "benchmark/benchmark.h"
+#include "common/brotli_binary_diff.h"
+#include "common/brotli_binary_patch.h"
+#include "common/font_data.h"
+#include "hb-subset.h"
+#include "hb.h"
+
+using common::BrotliBinaryDiff;
+using common::BrotliBinaryPatch;
+using common::FontData;
+using common::hb_face_unique_ptr;
+using common::make_hb_blob;
+using common::make_hb_face;
+
+namespace {
+
+// Cuts a subset of Noto Sans JP holding the glyphs in [1000, 5000) and, if
+// extended, a few more ranges.
+FontData Subset(bool extended) {
+  FontData font;
+  auto blob = make_hb_blob(
+      hb_blob_create_from_file("common/testdata/NotoSansJP-Regular.ttf"));
+  font.set(blob.get());
+  hb_face_unique_ptr face = font.face();
+
+  hb_subset_input_t* input = hb_subset_input_create_or_fail();
+  hb_set_t* gids = hb_subset_input_glyph_set(input);
+  hb_set_add_range(gids, 1000, 4999);
+  if (extended) {
+    hb_set_add_range(gids, 500, 750);
+    hb_set_add_range(gids, 8000, 8500);
+  }
+  hb_face_unique_ptr subset =
+      make_hb_face(hb_subset_or_fail(face.get(), input));
+  hb_subset_input_destroy(input);
+  return FontData(subset.get());
+}
+
+// Diffs the extended subset against the base at quality state.range(0).
+void BM_BrotliBinaryDiff(benchmark::State& state) {
+  FontData base = Subset(false);
+  FontData derived = Subset(true);
+  BrotliBinaryDiff differ(state.range(0));
+
+  FontData patch;
+  for (auto _ : state) {
+    auto sc = differ.Diff(base, derived, &patch);
+    if (!sc.ok()) {
+      state.SkipWithError(sc.ToString().c_str());
+      return;
+    }
+  }
+
+  state.SetBytesProcessed(state.iterations() * derived.size());
+  state.counters["ratio"] = (double)patch.size() / derived.size();
+}
+BENCHMARK(BM_BrotliBinaryDiff)
+    ->ArgName("quality")
+    ->Arg(5)
+    ->Arg(9)
+    ->Arg(11)
+    ->Unit(benchmark::kMillisecond);
+
+// Applies a quality state.range(0) patch, throughput is of the decoded output.
+void BM_BrotliBinaryPatch(benchmark::State& state) {
+  FontData base = Subset(false);
+  FontData derived = Subset(true);
+  FontData patch;
+  auto sc = BrotliBinaryDiff(state.range(0)).Diff(base, derived, &patch);
+  if (!sc.ok()) {
+    state.SkipWithError(sc.ToString().c_str());
+    return;
+  }
+
+  BrotliBinaryPatch patcher;
+  for (auto _ : state) {
+    FontData patched;
+    sc = patcher.Patch(base, patch, &patched);
+    if (!sc.ok()) {
+      state.SkipWithError(sc.ToString().c_str());
+      return;
+    }
+  }
+
+  state.SetBytesProcessed(state.iterations() * derived.size());
+  state.counters["ratio"] = (double)patch.size() / derived.size();
+}
+BENCHMARK(BM_BrotliBinaryPatch)
+    ->ArgName("quality")
+    ->Arg(5)
+    ->Arg(9)
+    ->Arg(11)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
@@ -1,20 +1,42 @@
 #include "common/brotli_binary_diff.h"
 
+#include <memory>
+#include <utility>
 #include <vector>
 
 #include "absl/log/log.h"
 #include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
 #include "brotli/shared_brotli_encoder.h"
+#include "common/brotli_dictionary_cache.h"
 #include "common/font_data.h"
 
 namespace common {
 
 using absl::Status;
+using absl::StrCat;
 using absl::string_view;
 using brotli::DictionaryPointer;
 using brotli::EncoderStatePointer;
 using brotli::SharedBrotliEncoder;
 
+Status BrotliBinaryDiff::Options::Validate() const {
+  if (quality > BROTLI_MAX_QUALITY ||
+      small_input_quality > BROTLI_MAX_QUALITY) {
+    return absl::InvalidArgumentError(
+        StrCat("brotli quality must be at most ", BROTLI_MAX_QUALITY, "."));
+  }
+
+  if (lgwin &&
+      (lgwin < BROTLI_MIN_WINDOW_BITS || lgwin > BROTLI_MAX_WINDOW_BITS)) {
+    return absl::InvalidArgumentError(
+        StrCat("brotli lgwin must be 0 or in [", BROTLI_MIN_WINDOW_BITS, ", ",
+               BROTLI_MAX_WINDOW_BITS, "]."));
+  }
+
+  return absl::OkStatus();
+}
+
 Status BrotliBinaryDiff::Diff(const FontData& font_base,
                               const FontData& font_derived,
                               FontData* patch /* OUT */) const {
@@ -24,9 +46,7 @@ Status BrotliBinaryDiff::Diff(const FontData& font_base,
   Status sc = Diff(font_base, font_derived.str(), 0, true, sink);
 
   if (sc.ok()) {
-    // TODO(grieger): eliminate this extra copy (have fontdata take ownership of
-    // sink).
-    patch->copy(reinterpret_cast<const char*>(sink.data()), sink.size());
+    patch->take(std::move(sink));
   }
 
   return sc;
@@ -38,17 +58,29 @@ Status BrotliBinaryDiff::Diff(const FontData& font_base, string_view data,
   // There's a decent amount of overhead in creating a dictionary, even if it's
   // completely empty. So don't set a dictionary unless it's non-empty.
   DictionaryPointer dictionary(nullptr, nullptr);
-  if (font_base.size() > 0) {
-    dictionary = SharedBrotliEncoder::CreateDictionary(font_base.span());
+  std::shared_ptr<const PreparedBrotliDictionary> cached_dictionary;
+  const BrotliEncoderPreparedDictionary* prepared = nullptr;
+  if (font_base.size() > 0 && dictionary_cache_) {
+    auto entry = dictionary_cache_->Get(font_base.str());
+    if (!entry.ok()) {
+      return entry.status();
+    }
+    cached_dictionary = std::move(*entry);
+    prepared = cached_dictionary->get();
+  } else if (font_base.size() > 0) {
+    dictionary =
+        SharedBrotliEncoder::CreateDictionary(font_base.span(), allocator_);
     if (!dictionary) {
       return absl::InternalError("Failed to create the shared dictionary.");
     }
+    prepared = dictionary.get();
   }
 
   // Don't give the encoder an estimated size if this is not all the data.
   unsigned data_size = !stream_offset && is_last ? data.size() : 0;
   EncoderStatePointer state = SharedBrotliEncoder::CreateEncoder(
-      quality_, data_size, stream_offset, dictionary.get());
+      options_.QualityFor(data.size()), data_size, stream_offset, prepared,
+      options_.lgwin, allocator_);
   if (!state) {
     return absl::InternalError("Failed to create the encoder.");
   }
@@ -1,10 +1,15 @@
 #ifndef COMMON_BROTLI_BINARY_DIFF_H_
 #define COMMON_BROTLI_BINARY_DIFF_H_
 
+#include <cstdint>
+#include <memory>
+#include <utility>
 #include <vector>
 
 #include "absl/status/status.h"
+#include "brotli/shared_brotli_encoder.h"
 #include "common/binary_diff.h"
+#include "common/brotli_dictionary_cache.h"
 #include "common/font_data.h"
 
 namespace common {
@@ -13,8 +18,45 @@ namespace common {
 // with a shared dictionary.
 class BrotliBinaryDiff : public BinaryDiff {
  public:
-  BrotliBinaryDiff() : quality_(9) {}
-  BrotliBinaryDiff(unsigned quality) : quality_(quality) {}
+  struct Options {
+    unsigned quality = 9;
+
+    // Base 2 log of the sliding window size. 0 uses the brotli default.
+    unsigned lgwin = 0;
+
+    // If non-zero, inputs smaller than this many bytes are compressed with
+    // small_input_quality instead of quality. Compression time at high
+    // qualities is dominated by the many small patches while most of the size
+    // savings come from the few large ones.
+    uint32_t adaptive_threshold = 0;
+    unsigned small_input_quality = 5;
+
+    // Returns an error if any of the options are outside of the ranges
+    // supported by brotli.
+    absl::Status Validate() const;
+
+    unsigned QualityFor(uint64_t input_size) const {
+      return input_size < adaptive_threshold ? small_input_quality : quality;
+    }
+
+    bool operator==(const Options& other) const = default;
+  };
+
+  BrotliBinaryDiff() : options_() {}
+  BrotliBinaryDiff(unsigned quality) : options_{.quality = quality} {}
+  BrotliBinaryDiff(Options options) : options_(options) {}
+
+  // If set, prepared dictionaries for the base are obtained from (and shared
+  // via) this cache.
+  void SetDictionaryCache(std::shared_ptr<BrotliDictionaryCache> cache) {
+    dictionary_cache_ = std::move(cache);
+  }
+
+  // If set, encoder states and uncached dictionaries are allocated with
+  // allocator. Cached dictionaries are shared so always use the default.
+  void SetAllocator(const brotli::Allocator& allocator) {
+    allocator_ = allocator;
+  }
 
   absl::Status Diff(const FontData& font_base, const FontData& font_derived,
                     FontData* patch /* OUT */) const override;
@@ -25,7 +67,9 @@ class BrotliBinaryDiff : public BinaryDiff {
                     std::vector<uint8_t>& sink) const;
 
  private:
-  unsigned quality_;
+  Options options_;
+  std::shared_ptr<BrotliDictionaryCache> dictionary_cache_;
+  brotli::Allocator allocator_;
 };
 
 }  // namespace common
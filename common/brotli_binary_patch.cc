@@ -1,5 +1,8 @@
 #include "common/brotli_binary_patch.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
 #include <vector>
 
 #include "absl/log/log.h"
@@ -17,10 +20,16 @@ namespace common {
 using absl::Status;
 using absl::string_view;
 
-DecoderStatePointer CreateDecoder(const FontData& base) {
+DecoderStatePointer CreateDecoder(const FontData& base,
+                                  const brotli::Allocator& allocator) {
   DecoderStatePointer state = DecoderStatePointer(
-      BrotliDecoderCreateInstance(nullptr, nullptr, nullptr),
+      BrotliDecoderCreateInstance(allocator.alloc, allocator.free,
+                                  allocator.opaque),
       &BrotliDecoderDestroyInstance);
+  if (!state) {
+    LOG(WARNING) << "Failed to create the decoder.";
+    return state;
+  }
 
   if (!BrotliDecoderAttachDictionary(
           state.get(), BROTLI_SHARED_DICTIONARY_RAW, base.size(),
@@ -79,10 +88,33 @@ Status DecompressToSink(const FontData& patch,
   return absl::OkStatus();
 }
 
+Status DecompressToBuffer(const FontData& patch,
+                          BrotliDecoderState* state, /* OUT */
+                          uint8_t* buffer, size_t capacity,
+                          size_t* size /* OUT */) {
+  size_t available_in = patch.size();
+  const uint8_t* next_in = reinterpret_cast<const uint8_t*>(patch.data());
+  size_t available_out = capacity;
+  uint8_t* next_out = buffer;
+  BrotliDecoderResult result = BrotliDecoderDecompressStream(
+      state, &available_in, &next_in, &available_out, &next_out, nullptr);
+
+  if (result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT) {
+    return absl::InvalidArgumentError(
+        "Decoded patch exceeds the max uncompressed length.");
+  }
+  if (result != BROTLI_DECODER_RESULT_SUCCESS || available_in != 0) {
+    return absl::InternalError("Brotli decoder failed.");
+  }
+
+  *size = capacity - available_out;
+  return absl::OkStatus();
+}
+
 Status BrotliBinaryPatch::Patch(const FontData& font_base,
                                 const FontData& patch,
                                 FontData* font_derived /* OUT */) const {
-  DecoderStatePointer state = CreateDecoder(font_base);
+  DecoderStatePointer state = CreateDecoder(font_base, allocator_);
   if (!state) {
     return absl::InternalError("Decoder creation failed.");
   }
@@ -95,8 +127,63 @@ Status BrotliBinaryPatch::Patch(const FontData& font_base,
     return sc;
   }
 
-  font_derived->copy(reinterpret_cast<const char*>(sink.data()), sink.size());
+  font_derived->take(std::move(sink));
+
+  return absl::OkStatus();
+}
+
+Status BrotliBinaryPatch::Patch(const FontData& font_base,
+                                const FontData& patch,
+                                uint32_t max_uncompressed_length,
+                                FontData* font_derived /* OUT */) const {
+  // max_uncompressed_length comes from the patch so it can't be trusted to
+  // size an allocation up front, past this decode into a growing buffer.
+  constexpr uint32_t kMaxPreallocatedLength = 64 * 1024 * 1024;
+  if (max_uncompressed_length > kMaxPreallocatedLength) {
+    FontData derived;
+    Status sc = Patch(font_base, patch, &derived);
+    if (!sc.ok()) {
+      return sc;
+    }
+    if (derived.size() > max_uncompressed_length) {
+      return absl::InvalidArgumentError(
+          "Decoded patch exceeds the max uncompressed length.");
+    }
+    *font_derived = std::move(derived);
+    return absl::OkStatus();
+  }
+
+  DecoderStatePointer state = CreateDecoder(font_base, allocator_);
+  if (!state) {
+    return absl::InternalError("Decoder creation failed.");
+  }
+
+  uint8_t* buffer = reinterpret_cast<uint8_t*>(
+      malloc(std::max(max_uncompressed_length, (uint32_t)1)));
+  if (!buffer) {
+    return absl::InternalError("Failed to allocate the patch output buffer.");
+  }
+  size_t size = 0;
+  Status sc = DecompressToBuffer(patch, state.get(), buffer,
+                                 max_uncompressed_length, &size);
+  if (!sc.ok()) {
+    free(buffer);
+    return sc;
+  }
+
+  // Release the unused tail, the limit can be much larger than the output.
+  if (size < max_uncompressed_length) {
+    uint8_t* shrunk =
+        reinterpret_cast<uint8_t*>(realloc(buffer, std::max(size, (size_t)1)));
+    if (shrunk) {
+      buffer = shrunk;
+    }
+  }
 
+  hb_blob_unique_ptr blob =
+      make_hb_blob(hb_blob_create(reinterpret_cast<const char*>(buffer), size,
+                                  HB_MEMORY_MODE_READONLY, buffer, &free));
+  font_derived->set(blob.get());
   return absl::OkStatus();
 }
 
@@ -1,7 +1,11 @@
 #ifndef COMMON_BROTLI_BINARY_PATCH_H_
 #define COMMON_BROTLI_BINARY_PATCH_H_
 
+#include <cstdint>
+#include <vector>
+
 #include "absl/status/status.h"
+#include "brotli/shared_brotli_encoder.h"
 #include "common/binary_patch.h"
 #include "common/font_data.h"
 
@@ -11,12 +15,29 @@ namespace common {
 // with a shared dictionary.
 class BrotliBinaryPatch : public BinaryPatch {
  public:
+  // If set, decoder states are allocated with allocator. Patched outputs are
+  // always allocated normally since they outlive the call.
+  void SetAllocator(const brotli::Allocator& allocator) {
+    allocator_ = allocator;
+  }
+
   absl::Status Patch(const FontData& font_base, const FontData& patch,
                      FontData* font_derived /* OUT */) const override;
 
   absl::Status Patch(const FontData& font_base,
                      const std::vector<FontData>& patch,
                      FontData* font_derived) const override;
+
+  // Applies a patch whose decoded size is known to be at most
+  // max_uncompressed_length (eg. from the max uncompressed length fields of
+  // table and glyph keyed patches). The output is allocated once and decoded
+  // into directly. Fails if the decoded data would exceed the limit.
+  absl::Status Patch(const FontData& font_base, const FontData& patch,
+                     uint32_t max_uncompressed_length,
+                     FontData* font_derived /* OUT */) const;
+
+ private:
+  brotli::Allocator allocator_;
 };
 
 }  // namespace common
@@ -0,0 +1,74 @@
+#include "common/brotli_dictionary_cache.h"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "absl/hash/hash.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+
+namespace common {
+
+using absl::MutexLock;
+using absl::StatusOr;
+using absl::string_view;
+
+StatusOr<std::shared_ptr<const PreparedBrotliDictionary>>
+BrotliDictionaryCache::Get(string_view data) {
+  uint64_t key = absl::HashOf(data);
+  {
+    MutexLock lock(&mutex_);
+    auto it = entries_.find(key);
+    if (it != entries_.end() && it->second->data().str() == data) {
+      hits_++;
+      return it->second;
+    }
+    misses_++;
+  }
+
+  // Preparing is expensive so don't hold the lock while doing it. If another
+  // thread concurrently prepares the same data one of the results is kept.
+  auto dictionary = std::make_shared<const PreparedBrotliDictionary>(data);
+  if (!dictionary->get()) {
+    return absl::InternalError("Failed to create the shared dictionary.");
+  }
+
+  MutexLock lock(&mutex_);
+  Insert(key, dictionary);
+  return dictionary;
+}
+
+void BrotliDictionaryCache::Insert(
+    uint64_t key, std::shared_ptr<const PreparedBrotliDictionary> dictionary) {
+  uint64_t size = dictionary->data().size();
+  if (size > max_size_bytes_) {
+    return;
+  }
+
+  auto [it, inserted] = entries_.try_emplace(key, dictionary);
+  if (!inserted) {
+    // Either a concurrent insert of the same data or a hash collision, in both
+    // cases keep the most recent.
+    size_ -= it->second->data().size();
+    it->second = std::move(dictionary);
+  } else {
+    insertion_order_.push_back(key);
+  }
+  size_ += size;
+
+  while (size_ > max_size_bytes_ && !insertion_order_.empty()) {
+    uint64_t oldest = insertion_order_.front();
+    insertion_order_.pop_front();
+    auto old = entries_.find(oldest);
+    if (old == entries_.end()) {
+      continue;
+    }
+    size_ -= old->second->data().size();
+    entries_.erase(old);
+  }
+}
+
+}  // namespace common
@@ -0,0 +1,106 @@
+#ifndef COMMON_BROTLI_DICTIONARY_CACHE_H_
+#define COMMON_BROTLI_DICTIONARY_CACHE_H_
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "brotli/shared_brotli_encoder.h"
+#include "common/font_data.h"
+
+namespace common {
+
+/*
+ * A brotli shared dictionary which has been prepared for use by the encoder,
+ * along with a copy of the data it was prepared from.
+ */
+class PreparedBrotliDictionary {
+ public:
+  explicit PreparedBrotliDictionary(absl::string_view data)
+      : data_(data),
+        dictionary_(brotli::SharedBrotliEncoder::CreateDictionary(
+            absl::Span<const uint8_t>(
+                reinterpret_cast<const uint8_t*>(data_.data()),
+                data_.size()))) {}
+
+  PreparedBrotliDictionary(const PreparedBrotliDictionary&) = delete;
+  PreparedBrotliDictionary& operator=(const PreparedBrotliDictionary&) =
+      delete;
+
+  const FontData& data() const { return data_; }
+  const BrotliEncoderPreparedDictionary* get() const {
+    return dictionary_.get();
+  }
+
+ private:
+  FontData data_;
+  brotli::DictionaryPointer dictionary_;
+};
+
+/*
+ * Caches prepared brotli dictionaries keyed by the content of the dictionary
+ * data. Preparing a dictionary at max quality builds a large hash table over
+ * the data, when many patches are produced against the same base this allows
+ * that cost to be paid once per base instead of once per patch.
+ *
+ * The total size of the dictionary data held by the cache is bounded, once the
+ * limit is exceeded the oldest entries are dropped. Dictionaries returned from
+ * Get() remain valid while referenced even if they've been dropped from the
+ * cache. Methods are thread safe.
+ */
+class BrotliDictionaryCache {
+ public:
+  static constexpr uint64_t kDefaultMaxSizeBytes = 64 * 1024 * 1024;
+
+  explicit BrotliDictionaryCache(
+      uint64_t max_size_bytes = kDefaultMaxSizeBytes)
+      : max_size_bytes_(max_size_bytes) {}
+
+  BrotliDictionaryCache(const BrotliDictionaryCache&) = delete;
+  BrotliDictionaryCache& operator=(const BrotliDictionaryCache&) = delete;
+
+  // Returns a prepared dictionary for data, preparing it if it isn't already
+  // cached.
+  absl::StatusOr<std::shared_ptr<const PreparedBrotliDictionary>> Get(
+      absl::string_view data);
+
+  uint32_t Hits() {
+    absl::MutexLock lock(&mutex_);
+    return hits_;
+  }
+
+  uint32_t Misses() {
+    absl::MutexLock lock(&mutex_);
+    return misses_;
+  }
+
+  // Total size in bytes of the dictionary data currently cached.
+  uint64_t Size() {
+    absl::MutexLock lock(&mutex_);
+    return size_;
+  }
+
+ private:
+  void Insert(uint64_t key,
+              std::shared_ptr<const PreparedBrotliDictionary> dictionary)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const uint64_t max_size_bytes_;
+
+  absl::Mutex mutex_;
+  absl::flat_hash_map<uint64_t, std::shared_ptr<const PreparedBrotliDictionary>>
+      entries_ ABSL_GUARDED_BY(mutex_);
+  // Keys in insertion order, used for eviction.
+  std::deque<uint64_t> insertion_order_ ABSL_GUARDED_BY(mutex_);
+  uint64_t size_ ABSL_GUARDED_BY(mutex_) = 0;
+  uint32_t hits_ ABSL_GUARDED_BY(mutex_) = 0;
+  uint32_t misses_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace common
+
+#endif  // COMMON_BROTLI_DICTIONARY_CACHE_H_
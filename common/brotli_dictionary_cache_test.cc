@@ -0,0 +1,67 @@
+#include "common/brotli_dictionary_cache.h"
+
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace common {
+
+class BrotliDictionaryCacheTest : public ::testing::Test {};
+
+TEST_F(BrotliDictionaryCacheTest, ReusesPreparedDictionary) {
+  BrotliDictionaryCache cache;
+
+  auto a = cache.Get("abcdefghijklmnop");
+  ASSERT_TRUE(a.ok()) << a.status();
+  ASSERT_NE((*a)->get(), nullptr);
+  ASSERT_EQ((*a)->data().str(), "abcdefghijklmnop");
+
+  auto b = cache.Get("abcdefghijklmnop");
+  ASSERT_TRUE(b.ok()) << b.status();
+  ASSERT_EQ(a->get(), b->get());
+
+  auto c = cache.Get("0123456789");
+  ASSERT_TRUE(c.ok()) << c.status();
+  ASSERT_NE(a->get(), c->get());
+
+  ASSERT_EQ(cache.Hits(), 1);
+  ASSERT_EQ(cache.Misses(), 2);
+  ASSERT_EQ(cache.Size(), 26);
+}
+
+TEST_F(BrotliDictionaryCacheTest, EvictsOldest) {
+  BrotliDictionaryCache cache(20);
+
+  auto a = cache.Get("aaaaaaaaaa");
+  ASSERT_TRUE(a.ok()) << a.status();
+  auto b = cache.Get("bbbbbbbbbb");
+  ASSERT_TRUE(b.ok()) << b.status();
+  ASSERT_EQ(cache.Size(), 20);
+
+  auto c = cache.Get("cccccccccc");
+  ASSERT_TRUE(c.ok()) << c.status();
+  ASSERT_EQ(cache.Size(), 20);
+
+  // 'a' was evicted but is still usable by existing holders.
+  ASSERT_EQ((*a)->data().str(), "aaaaaaaaaa");
+  ASSERT_NE((*a)->get(), nullptr);
+
+  auto a_again = cache.Get("aaaaaaaaaa");
+  ASSERT_TRUE(a_again.ok()) << a_again.status();
+  ASSERT_NE(a->get(), a_again->get());
+
+  ASSERT_EQ(cache.Hits(), 0);
+  ASSERT_EQ(cache.Misses(), 4);
+}
+
+TEST_F(BrotliDictionaryCacheTest, TooLargeIsNotCached) {
+  BrotliDictionaryCache cache(4);
+
+  auto a = cache.Get("abcdefgh");
+  ASSERT_TRUE(a.ok()) << a.status();
+  ASSERT_NE((*a)->get(), nullptr);
+  ASSERT_EQ(cache.Size(), 0);
+}
+
+}  // namespace common
@@ -1,7 +1,9 @@
 #include "absl/status/status.h"
 #include "absl/types/span.h"
+#include "brotli/shared_brotli_encoder.h"
 #include "common/brotli_binary_diff.h"
 #include "common/brotli_binary_patch.h"
+#include "common/brotli_dictionary_cache.h"
 #include "common/file_font_provider.h"
 #include "common/font_provider.h"
 #include "gtest/gtest.h"
@@ -10,6 +12,7 @@ namespace common {
 
 using absl::Span;
 using absl::Status;
+using brotli::EncoderMemoryPool;
 
 class BrotliPatchingTest : public ::testing::Test {
  protected:
@@ -50,6 +53,25 @@ TEST_F(BrotliPatchingTest, DiffAndPatchPatchWithEmptyBase) {
   EXPECT_EQ(Span<const char>(patched), Span<const char>(subset_a_));
 }
 
+TEST_F(BrotliPatchingTest, DiffWithDictionaryCache) {
+  FontData expected;
+  EXPECT_EQ(diff_->Diff(subset_a_, subset_b_, &expected), absl::OkStatus());
+
+  auto cache = std::make_shared<BrotliDictionaryCache>();
+  BrotliBinaryDiff cached_diff;
+  cached_diff.SetDictionaryCache(cache);
+
+  FontData patch_1;
+  EXPECT_EQ(cached_diff.Diff(subset_a_, subset_b_, &patch_1), absl::OkStatus());
+  FontData patch_2;
+  EXPECT_EQ(cached_diff.Diff(subset_a_, subset_b_, &patch_2), absl::OkStatus());
+
+  EXPECT_EQ(patch_1, expected);
+  EXPECT_EQ(patch_2, expected);
+  EXPECT_EQ(cache->Misses(), 1);
+  EXPECT_EQ(cache->Hits(), 1);
+}
+
 TEST_F(BrotliPatchingTest, DiffAndPatch) {
   FontData patch;
   EXPECT_EQ(diff_->Diff(subset_a_, subset_b_, &patch), absl::OkStatus());
@@ -65,6 +87,30 @@ TEST_F(BrotliPatchingTest, DiffAndPatch) {
   EXPECT_EQ(Span<const char>(patched), Span<const char>(subset_b_));
 }
 
+TEST_F(BrotliPatchingTest, PatchWithMaxUncompressedLength) {
+  FontData patch;
+  EXPECT_EQ(diff_->Diff(subset_a_, subset_b_, &patch), absl::OkStatus());
+
+  BrotliBinaryPatch patcher;
+  FontData patched;
+  EXPECT_EQ(patcher.Patch(subset_a_, patch, subset_b_.size(), &patched),
+            absl::OkStatus());
+  EXPECT_EQ(Span<const char>(patched), Span<const char>(subset_b_));
+
+  // Larger limits are fine, the output is only as big as the decoded data.
+  EXPECT_EQ(patcher.Patch(subset_a_, patch, 2 * subset_b_.size(), &patched),
+            absl::OkStatus());
+  EXPECT_EQ(Span<const char>(patched), Span<const char>(subset_b_));
+
+  EXPECT_TRUE(absl::IsInvalidArgument(
+      patcher.Patch(subset_a_, patch, subset_b_.size() - 1, &patched)));
+
+  // Limits too large to allocate up front decode into a growing buffer.
+  EXPECT_EQ(patcher.Patch(subset_a_, patch, UINT32_MAX, &patched),
+            absl::OkStatus());
+  EXPECT_EQ(Span<const char>(patched), Span<const char>(subset_b_));
+}
+
 TEST_F(BrotliPatchingTest, StitchingWithEmptyBase) {
   FontData empty;
 
@@ -109,4 +155,105 @@ TEST_F(BrotliPatchingTest, StitchingWithBase) {
   EXPECT_EQ(Span<const char>(patched), Span<const char>(subset_b_));
 }
 
+TEST_F(BrotliPatchingTest, DiffAndPatchWithOptions) {
+  BrotliBinaryDiff::Options options{.quality = 5, .lgwin = 16};
+  ASSERT_EQ(options.Validate(), absl::OkStatus());
+  BrotliBinaryDiff diff(options);
+
+  FontData patch;
+  EXPECT_EQ(diff.Diff(subset_a_, subset_b_, &patch), absl::OkStatus());
+
+  FontData patched;
+  EXPECT_EQ(patch_->Patch(subset_a_, patch, &patched), absl::OkStatus());
+  EXPECT_EQ(Span<const char>(patched), Span<const char>(subset_b_));
+}
+
+TEST_F(BrotliPatchingTest, AdaptiveQuality) {
+  BrotliBinaryDiff::Options options{
+      .quality = 11, .adaptive_threshold = 1000, .small_input_quality = 1};
+  EXPECT_EQ(options.QualityFor(999), 1);
+  EXPECT_EQ(options.QualityFor(1000), 11);
+
+  BrotliBinaryDiff diff(options);
+  FontData patch;
+  EXPECT_EQ(diff.Diff(subset_a_, subset_b_, &patch), absl::OkStatus());
+
+  FontData patched;
+  EXPECT_EQ(patch_->Patch(subset_a_, patch, &patched), absl::OkStatus());
+  EXPECT_EQ(Span<const char>(patched), Span<const char>(subset_b_));
+}
+
+TEST_F(BrotliPatchingTest, RepeatedDiffsReuseEncoderMemory) {
+  FontData first;
+  EXPECT_EQ(diff_->Diff(subset_a_, subset_b_, &first), absl::OkStatus());
+  // The finished encoder's hash tables are kept for the next diff.
+  size_t cached = EncoderMemoryPool::CachedBytes();
+  EXPECT_GT(cached, 0);
+
+  FontData second;
+  EXPECT_EQ(diff_->Diff(subset_a_, subset_b_, &second), absl::OkStatus());
+  EXPECT_EQ(EncoderMemoryPool::CachedBytes(), cached);
+  EXPECT_EQ(Span<const char>(first), Span<const char>(second));
+
+  FontData patched;
+  EXPECT_EQ(patch_->Patch(subset_a_, second, &patched), absl::OkStatus());
+  EXPECT_EQ(Span<const char>(patched), Span<const char>(subset_b_));
+}
+
+// Tracks the allocations made through it.
+struct CountingAllocator {
+  static void* Alloc(void* opaque, size_t size) {
+    auto* counter = (CountingAllocator*)opaque;
+    counter->allocations++;
+    counter->live++;
+    return malloc(size);
+  }
+
+  static void Free(void* opaque, void* address) {
+    if (address) {
+      ((CountingAllocator*)opaque)->live--;
+    }
+    free(address);
+  }
+
+  brotli::Allocator allocator() {
+    return brotli::Allocator{.alloc = Alloc, .free = Free, .opaque = this};
+  }
+
+  uint32_t allocations = 0;
+  int32_t live = 0;
+};
+
+TEST_F(BrotliPatchingTest, CustomAllocator) {
+  CountingAllocator counter;
+  BrotliBinaryDiff diff;
+  diff.SetAllocator(counter.allocator());
+  BrotliBinaryPatch patch;
+  patch.SetAllocator(counter.allocator());
+
+  FontData encoded;
+  EXPECT_EQ(diff.Diff(subset_a_, subset_b_, &encoded), absl::OkStatus());
+  uint32_t encoder_allocations = counter.allocations;
+  EXPECT_GT(encoder_allocations, 0);
+
+  FontData patched;
+  EXPECT_EQ(patch.Patch(subset_a_, encoded, &patched), absl::OkStatus());
+  EXPECT_GT(counter.allocations, encoder_allocations);
+  EXPECT_EQ(Span<const char>(patched), Span<const char>(subset_b_));
+
+  // Everything was released through the allocator.
+  EXPECT_EQ(counter.live, 0);
+}
+
+TEST_F(BrotliPatchingTest, InvalidOptions) {
+  EXPECT_TRUE(absl::IsInvalidArgument(
+      BrotliBinaryDiff::Options{.quality = 12}.Validate()));
+  EXPECT_TRUE(absl::IsInvalidArgument(
+      BrotliBinaryDiff::Options{.lgwin = 9}.Validate()));
+  EXPECT_TRUE(absl::IsInvalidArgument(
+      BrotliBinaryDiff::Options{.lgwin = 25}.Validate()));
+  EXPECT_TRUE(absl::IsInvalidArgument(
+      BrotliBinaryDiff::Options{.small_input_quality = 12}.Validate()));
+}
+
 }  // namespace common
@@ -0,0 +1,81 @@
+#include "common/cmap_index.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/types/span.h"
+#include "common/hb_set_unique_ptr.h"
+#include "hb.h"
+
+using absl::btree_set;
+using absl::Span;
+
+namespace common {
+
+CmapIndex::CmapIndex(hb_face_t* face) {
+  hb_map_t* unicode_to_gid = hb_map_create();
+  hb_set_unique_ptr unicodes = make_hb_set();
+  hb_face_collect_nominal_glyph_mapping(face, unicode_to_gid, unicodes.get());
+
+  by_codepoint_.reserve(hb_set_get_population(unicodes.get()));
+  hb_codepoint_t cp = HB_SET_VALUE_INVALID;
+  while (hb_set_next(unicodes.get(), &cp)) {
+    by_codepoint_.emplace_back(cp, hb_map_get(unicode_to_gid, cp));
+  }
+  hb_map_destroy(unicode_to_gid);
+
+  std::vector<std::pair<uint32_t, uint32_t>> by_glyph;
+  by_glyph.reserve(by_codepoint_.size());
+  for (const auto& [cp, gid] : by_codepoint_) {
+    by_glyph.emplace_back(gid, cp);
+  }
+  std::sort(by_glyph.begin(), by_glyph.end());
+
+  codepoints_.reserve(by_glyph.size());
+  for (const auto& [gid, cp] : by_glyph) {
+    if (glyphs_.empty() || glyphs_.back() != gid) {
+      glyphs_.push_back(gid);
+      starts_.push_back(codepoints_.size());
+    }
+    codepoints_.push_back(cp);
+  }
+  starts_.push_back(codepoints_.size());
+}
+
+std::optional<uint32_t> CmapIndex::GlyphFor(uint32_t codepoint) const {
+  auto it = std::lower_bound(
+      by_codepoint_.begin(), by_codepoint_.end(), codepoint,
+      [](const std::pair<uint32_t, uint32_t>& e, uint32_t cp) {
+        return e.first < cp;
+      });
+  if (it == by_codepoint_.end() || it->first != codepoint) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+Span<const uint32_t> CmapIndex::CodepointsFor(uint32_t gid) const {
+  auto it = std::lower_bound(glyphs_.begin(), glyphs_.end(), gid);
+  if (it == glyphs_.end() || *it != gid) {
+    return {};
+  }
+  uint32_t i = it - glyphs_.begin();
+  return Span<const uint32_t>(codepoints_.data() + starts_[i],
+                              starts_[i + 1] - starts_[i]);
+}
+
+btree_set<uint32_t> CmapIndex::CodepointsFor(
+    const btree_set<uint32_t>& gids) const {
+  btree_set<uint32_t> result;
+  for (uint32_t gid : gids) {
+    Span<const uint32_t> codepoints = CodepointsFor(gid);
+    result.insert(codepoints.begin(), codepoints.end());
+  }
+  return result;
+}
+
+}  // namespace common
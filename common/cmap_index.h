@@ -0,0 +1,53 @@
+#ifndef COMMON_CMAP_INDEX_H_
+#define COMMON_CMAP_INDEX_H_
+
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/types/span.h"
+#include "hb.h"
+
+namespace common {
+
+/*
+ * The nominal (cmap) mapping of a font in both directions, stored as flat
+ * sorted arrays.
+ *
+ * Collecting the mapping from harfbuzz parses the whole cmap table, so callers
+ * which do repeated lookups against a font should build the index once and
+ * reuse it. Lookups are thread safe.
+ */
+class CmapIndex {
+ public:
+  explicit CmapIndex(hb_face_t* face);
+
+  // Returns the glyph mapped to codepoint, if any.
+  std::optional<uint32_t> GlyphFor(uint32_t codepoint) const;
+
+  // Returns the codepoints mapped to gid in increasing order.
+  absl::Span<const uint32_t> CodepointsFor(uint32_t gid) const;
+
+  // Returns all codepoints mapped to any of gids.
+  absl::btree_set<uint32_t> CodepointsFor(
+      const absl::btree_set<uint32_t>& gids) const;
+
+  // (codepoint, gid) pairs sorted by codepoint.
+  const std::vector<std::pair<uint32_t, uint32_t>>& Mapping() const {
+    return by_codepoint_;
+  }
+
+ private:
+  std::vector<std::pair<uint32_t, uint32_t>> by_codepoint_;
+  // For each entry of glyphs_ the codepoints mapped to it are
+  // codepoints_[starts_[i], starts_[i + 1]).
+  std::vector<uint32_t> glyphs_;
+  std::vector<uint32_t> starts_;
+  std::vector<uint32_t> codepoints_;
+};
+
+}  // namespace common
+
+#endif  // COMMON_CMAP_INDEX_H_
@@ -0,0 +1,60 @@
+#include "common/cmap_index.h"
+
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "common/font_data.h"
+#include "gtest/gtest.h"
+#include "hb.h"
+
+using absl::btree_set;
+
+namespace common {
+
+class CmapIndexTest : public ::testing::Test {
+ protected:
+  CmapIndexTest() : roboto_ab(make_hb_face(nullptr)) {
+    hb_blob_unique_ptr blob = make_hb_blob(
+        hb_blob_create_from_file("common/testdata/Roboto-Regular.ab.ttf"));
+    roboto_ab = make_hb_face(hb_face_create(blob.get(), 0));
+  }
+
+  hb_face_unique_ptr roboto_ab;
+};
+
+TEST_F(CmapIndexTest, Lookups) {
+  CmapIndex cmap(roboto_ab.get());
+
+  EXPECT_EQ(cmap.GlyphFor(0x61), 69);
+  EXPECT_EQ(cmap.GlyphFor(0x62), 70);
+  EXPECT_EQ(cmap.GlyphFor(0x63), std::nullopt);
+
+  EXPECT_EQ(std::vector<uint32_t>(cmap.CodepointsFor(69).begin(),
+                                  cmap.CodepointsFor(69).end()),
+            std::vector<uint32_t>{0x61});
+  EXPECT_TRUE(cmap.CodepointsFor(0).empty());
+  EXPECT_TRUE(cmap.CodepointsFor(1000).empty());
+
+  EXPECT_EQ(cmap.CodepointsFor(btree_set<uint32_t>{0, 69, 70}),
+            (btree_set<uint32_t>{0x61, 0x62}));
+}
+
+TEST_F(CmapIndexTest, Mapping) {
+  CmapIndex cmap(roboto_ab.get());
+  std::vector<std::pair<uint32_t, uint32_t>> expected = {{0x61, 69},
+                                                         {0x62, 70}};
+  EXPECT_EQ(cmap.Mapping(), expected);
+}
+
+TEST_F(CmapIndexTest, Empty) {
+  hb_face_unique_ptr empty = make_hb_face_builder();
+  CmapIndex cmap(empty.get());
+  EXPECT_TRUE(cmap.Mapping().empty());
+  EXPECT_EQ(cmap.GlyphFor(0x61), std::nullopt);
+  EXPECT_TRUE(cmap.CodepointsFor(0).empty());
+}
+
+}  // namespace common
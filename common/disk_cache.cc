@@ -0,0 +1,206 @@
+#include "common/disk_cache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "absl/base/internal/endian.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "common/atomic_file.h"
+#include "common/font_data.h"
+
+namespace common {
+
+using absl::MutexLock;
+using absl::Status;
+using absl::StatusOr;
+using absl::StrCat;
+
+namespace fs = std::filesystem;
+
+static constexpr char kEntryExtension[] = ".entry";
+
+// Each entry file starts with the length and checksum of the data (both 64 bit
+// big endian) so that truncated or corrupted entries are detected by Get().
+static constexpr uint32_t kEntryHeaderSize = 16;
+
+// FNV-1a, which unlike absl::Hash is stable across processes.
+static uint64_t Checksum(absl::string_view data) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (char c : data) {
+    h ^= (uint8_t)c;
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+StatusOr<std::unique_ptr<DiskCache>> DiskCache::Create(
+    const std::string& directory, uint64_t max_size_bytes) {
+  std::error_code ec;
+  fs::create_directories(directory, ec);
+  if (ec) {
+    return absl::InvalidArgumentError(StrCat(
+        "Unable to create cache directory ", directory, ": ", ec.message()));
+  }
+
+  std::unique_ptr<DiskCache> cache(new DiskCache(directory, max_size_bytes));
+  {
+    MutexLock lock(&cache->mutex_);
+    auto sc = cache->Scan();
+    if (!sc.ok()) {
+      return sc;
+    }
+  }
+  return cache;
+}
+
+std::string DiskCache::PathFor(uint64_t key) const {
+  return StrCat(directory_, "/", absl::Hex(key, absl::kZeroPad16),
+                kEntryExtension);
+}
+
+std::optional<FontData> DiskCache::Get(uint64_t key) {
+  std::string path = PathFor(key);
+  hb_blob_unique_ptr blob =
+      make_hb_blob(hb_blob_create_from_file_or_fail(path.c_str()));
+  if (!blob.get()) {
+    // May have been evicted by another process.
+    MutexLock lock(&mutex_);
+    Forget(key);
+    return std::nullopt;
+  }
+
+  unsigned file_size = 0;
+  const char* file_data = hb_blob_get_data(blob.get(), &file_size);
+  absl::string_view entry(file_data, file_size);
+  if (entry.size() < kEntryHeaderSize ||
+      absl::big_endian::Load64(entry.data()) !=
+          entry.size() - kEntryHeaderSize ||
+      absl::big_endian::Load64(entry.data() + 8) !=
+          Checksum(entry.substr(kEntryHeaderSize))) {
+    // Truncated or corrupted, discard it so it gets rewritten.
+    std::error_code ec;
+    fs::remove(path, ec);
+    MutexLock lock(&mutex_);
+    Forget(key);
+    return std::nullopt;
+  }
+
+  // Refresh the modification time so this entry is considered recently used,
+  // by this and later instances.
+  std::error_code ec;
+  fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+
+  FontData data(make_hb_blob(hb_blob_create_sub_blob(
+      blob.get(), kEntryHeaderSize, entry.size() - kEntryHeaderSize)));
+  MutexLock lock(&mutex_);
+  Touch(key, data.size());
+  return data;
+}
+
+Status DiskCache::Put(uint64_t key, const FontData& data) {
+  char header[kEntryHeaderSize];
+  absl::big_endian::Store64(header, data.size());
+  absl::big_endian::Store64(header + 8, Checksum(data.str()));
+
+  std::string path = PathFor(key);
+  auto sc = WriteFileAtomically(
+      path, {absl::string_view(header, kEntryHeaderSize), data.str()});
+  if (!sc.ok()) {
+    return sc;
+  }
+
+  MutexLock lock(&mutex_);
+  Touch(key, data.size());
+  Evict();
+  return absl::OkStatus();
+}
+
+void DiskCache::Touch(uint64_t key, uint64_t size) {
+  Forget(key);
+  uint64_t last_used = clock_++;
+  index_[key] = IndexEntry{.size = size, .last_used = last_used};
+  lru_.insert(std::pair(last_used, key));
+  size_ += size;
+}
+
+void DiskCache::Forget(uint64_t key) {
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    return;
+  }
+  size_ -= it->second.size;
+  lru_.erase(std::pair(it->second.last_used, key));
+  index_.erase(it);
+}
+
+void DiskCache::Evict() {
+  while (size_ > max_size_bytes_ && !lru_.empty()) {
+    uint64_t key = lru_.begin()->second;
+    std::error_code ec;
+    fs::remove(PathFor(key), ec);
+    Forget(key);
+  }
+}
+
+Status DiskCache::Scan() {
+  struct Entry {
+    uint64_t key;
+    fs::file_time_type time;
+    uint64_t size;
+  };
+
+  std::error_code ec;
+  std::vector<Entry> entries;
+  for (const auto& file : fs::directory_iterator(directory_, ec)) {
+    std::string name = file.path().filename().string();
+    uint64_t key;
+    if (!file.is_regular_file() || !absl::EndsWith(name, kEntryExtension) ||
+        !absl::SimpleHexAtoi(
+            name.substr(0, name.size() - strlen(kEntryExtension)), &key)) {
+      continue;
+    }
+
+    std::error_code entry_ec;
+    Entry entry{
+        .key = key,
+        .time = file.last_write_time(entry_ec),
+        .size = file.file_size(entry_ec),
+    };
+    if (entry_ec) {
+      // Likely removed by a concurrent process.
+      continue;
+    }
+    // Malformed entries are counted as empty and discarded when next read.
+    entry.size = entry.size > kEntryHeaderSize ? entry.size - kEntryHeaderSize
+                                               : 0;
+    entries.push_back(std::move(entry));
+  }
+  if (ec) {
+    return absl::InternalError(
+        StrCat("Unable to list cache directory ", directory_, "."));
+  }
+
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b) { return a.time < b.time; });
+  for (const auto& entry : entries) {
+    Touch(entry.key, entry.size);
+  }
+  Evict();
+  return absl::OkStatus();
+}
+
+}  // namespace common
@@ -0,0 +1,93 @@
+#ifndef COMMON_DISK_CACHE_H_
+#define COMMON_DISK_CACHE_H_
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "common/font_data.h"
+
+namespace common {
+
+/*
+ * A content addressed cache of binary blobs stored in a directory on disk.
+ *
+ * Each entry is stored in it's own file named after the entry key. The total
+ * size of the cache is bounded, once the limit is exceeded the least recently
+ * used entries are removed. Recency is tracked by an in memory index which is
+ * seeded from the file modification times (also updated on each hit) when the
+ * cache is opened, so eviction doesn't need to rescan the directory. Entries
+ * added by other processes join the index when they're first hit.
+ *
+ * Entries are written atomically (see WriteFileAtomically()) so the same
+ * directory can be safely shared by multiple processes. Each entry records
+ * its length and checksum, entries which fail verification are treated as
+ * missing. Methods are thread safe.
+ */
+class DiskCache {
+ public:
+  static absl::StatusOr<std::unique_ptr<DiskCache>> Create(
+      const std::string& directory, uint64_t max_size_bytes);
+
+  DiskCache(const DiskCache&) = delete;
+  DiskCache& operator=(const DiskCache&) = delete;
+
+  // Returns the cached data for key, or std::nullopt if it isn't present.
+  std::optional<FontData> Get(uint64_t key);
+
+  // Adds (or replaces) the cached data for key.
+  absl::Status Put(uint64_t key, const FontData& data);
+
+  // Total size in bytes of all entries, as last observed by this instance.
+  uint64_t Size() {
+    absl::MutexLock lock(&mutex_);
+    return size_;
+  }
+
+ private:
+  DiskCache(const std::string& directory, uint64_t max_size_bytes)
+      : directory_(directory), max_size_bytes_(max_size_bytes) {}
+
+  std::string PathFor(uint64_t key) const;
+
+  struct IndexEntry {
+    uint64_t size;
+    uint64_t last_used;
+  };
+
+  // Scans the directory to build the index, then evicts down to the limit.
+  absl::Status Scan() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Records key, of size bytes, as the most recently used entry. Replaces any
+  // existing index entry for key.
+  void Touch(uint64_t key, uint64_t size) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Removes key from the index (but not the disk).
+  void Forget(uint64_t key) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Removes the least recently used entries until the total is within
+  // max_size_bytes_.
+  void Evict() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const std::string directory_;
+  const uint64_t max_size_bytes_;
+
+  absl::Mutex mutex_;
+  uint64_t size_ ABSL_GUARDED_BY(mutex_) = 0;
+  uint64_t clock_ ABSL_GUARDED_BY(mutex_) = 0;
+  absl::flat_hash_map<uint64_t, IndexEntry> index_ ABSL_GUARDED_BY(mutex_);
+  // (last_used, key) for every entry in index_, oldest first.
+  absl::btree_set<std::pair<uint64_t, uint64_t>> lru_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace common
+
+#endif  // COMMON_DISK_CACHE_H_
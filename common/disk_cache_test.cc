@@ -0,0 +1,138 @@
+#include "common/disk_cache.h"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include "absl/strings/str_cat.h"
+#include "common/font_data.h"
+#include "gtest/gtest.h"
+
+namespace common {
+
+class DiskCacheTest : public ::testing::Test {
+ protected:
+  DiskCacheTest() {
+    directory_ = absl::StrCat(::testing::TempDir(), "/disk_cache_test_",
+                              ::testing::UnitTest::GetInstance()
+                                  ->current_test_info()
+                                  ->name());
+    std::filesystem::remove_all(directory_);
+  }
+
+  ~DiskCacheTest() override { std::filesystem::remove_all(directory_); }
+
+  std::string directory_;
+};
+
+TEST_F(DiskCacheTest, PutAndGet) {
+  auto cache = DiskCache::Create(directory_, 1000);
+  ASSERT_TRUE(cache.ok()) << cache.status();
+
+  ASSERT_FALSE((*cache)->Get(1).has_value());
+
+  auto sc = (*cache)->Put(1, FontData("abc"));
+  ASSERT_TRUE(sc.ok()) << sc;
+  sc = (*cache)->Put(2, FontData("defg"));
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  auto value = (*cache)->Get(1);
+  ASSERT_TRUE(value.has_value());
+  ASSERT_EQ(value->str(), "abc");
+
+  value = (*cache)->Get(2);
+  ASSERT_TRUE(value.has_value());
+  ASSERT_EQ(value->str(), "defg");
+
+  ASSERT_EQ((*cache)->Size(), 7);
+}
+
+TEST_F(DiskCacheTest, PersistsAcrossInstances) {
+  {
+    auto cache = DiskCache::Create(directory_, 1000);
+    ASSERT_TRUE(cache.ok()) << cache.status();
+    auto sc = (*cache)->Put(42, FontData("hello"));
+    ASSERT_TRUE(sc.ok()) << sc;
+  }
+
+  auto cache = DiskCache::Create(directory_, 1000);
+  ASSERT_TRUE(cache.ok()) << cache.status();
+  ASSERT_EQ((*cache)->Size(), 5);
+
+  auto value = (*cache)->Get(42);
+  ASSERT_TRUE(value.has_value());
+  ASSERT_EQ(value->str(), "hello");
+}
+
+TEST_F(DiskCacheTest, EvictsLeastRecentlyUsed) {
+  auto cache = DiskCache::Create(directory_, 10);
+  ASSERT_TRUE(cache.ok()) << cache.status();
+
+  auto sc = (*cache)->Put(1, FontData("aaaa"));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  sc.Update((*cache)->Put(2, FontData("bbbb")));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  // Touch 1 so that 2 is the least recently used.
+  ASSERT_TRUE((*cache)->Get(1).has_value());
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+  sc = (*cache)->Put(3, FontData("cccc"));
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  ASSERT_TRUE((*cache)->Get(1).has_value());
+  ASSERT_FALSE((*cache)->Get(2).has_value());
+  ASSERT_TRUE((*cache)->Get(3).has_value());
+  ASSERT_EQ((*cache)->Size(), 8);
+}
+
+TEST_F(DiskCacheTest, ReplaceUpdatesSize) {
+  auto cache = DiskCache::Create(directory_, 10);
+  ASSERT_TRUE(cache.ok()) << cache.status();
+
+  auto sc = (*cache)->Put(1, FontData("aaaa"));
+  sc.Update((*cache)->Put(1, FontData("aaaaaa")));
+  ASSERT_TRUE(sc.ok()) << sc;
+  ASSERT_EQ((*cache)->Size(), 6);
+
+  sc = (*cache)->Put(2, FontData("bbbb"));
+  ASSERT_TRUE(sc.ok()) << sc;
+  ASSERT_EQ((*cache)->Size(), 10);
+  auto value = (*cache)->Get(1);
+  ASSERT_TRUE(value.has_value());
+  ASSERT_EQ(value->str(), "aaaaaa");
+  ASSERT_TRUE((*cache)->Get(2).has_value());
+}
+
+TEST_F(DiskCacheTest, DiscardsCorruptEntries) {
+  auto cache = DiskCache::Create(directory_, 1000);
+  ASSERT_TRUE(cache.ok()) << cache.status();
+
+  auto sc = (*cache)->Put(1, FontData("abcdef"));
+  sc.Update((*cache)->Put(2, FontData("ghijkl")));
+  ASSERT_TRUE(sc.ok()) << sc;
+  ASSERT_EQ((*cache)->Size(), 12);
+
+  std::string path_1 = absl::StrCat(directory_, "/0000000000000001.entry");
+  std::string path_2 = absl::StrCat(directory_, "/0000000000000002.entry");
+  ASSERT_TRUE(std::filesystem::exists(path_1));
+  ASSERT_TRUE(std::filesystem::exists(path_2));
+
+  // Truncate one entry and flip a data byte in the other.
+  std::filesystem::resize_file(path_1, std::filesystem::file_size(path_1) - 1);
+  {
+    std::fstream file(path_2, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(-1, std::ios::end);
+    file.put('x');
+  }
+
+  ASSERT_FALSE((*cache)->Get(1).has_value());
+  ASSERT_FALSE((*cache)->Get(2).has_value());
+  ASSERT_FALSE(std::filesystem::exists(path_1));
+  ASSERT_FALSE(std::filesystem::exists(path_2));
+  ASSERT_EQ((*cache)->Size(), 0);
+}
+
+}  // namespace common
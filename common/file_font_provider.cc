@@ -3,6 +3,7 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "absl/log/log.h"
@@ -16,15 +17,12 @@ using absl::Status;
 
 Status FileFontProvider::GetFont(const std::string& id, FontData* out) const {
   std::string path = base_directory_ + id;
-  hb_blob_t* blob = hb_blob_create_from_file(path.c_str());
-  if (!hb_blob_get_length(blob)) {
-    hb_blob_destroy(blob);
+  auto font = FontData::FromFile(path);
+  if (!font.ok() || font->empty()) {
     return absl::NotFoundError(absl::StrCat(path, " does not exist."));
   }
 
-  out->set(blob);
-  hb_blob_destroy(blob);
-
+  *out = std::move(*font);
   return absl::OkStatus();
 }
 
@@ -1,11 +1,19 @@
 #ifndef COMMON_FONT_DATA_H_
 #define COMMON_FONT_DATA_H_
 
+#include <atomic>
+#include <cstdint>
 #include <cstring>
 #include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/span.h"
+#include "common/table_directory.h"
 #include "hb.h"
 
 namespace common {
@@ -58,7 +66,7 @@ class FontData {
       : buffer_(std::move(blob)), saved_face_(make_hb_face(nullptr)) {}
 
   explicit FontData(hb_face_unique_ptr face)
-      : buffer_(make_hb_blob(hb_face_reference_blob(face.get()))),
+      : buffer_(make_hb_blob(reference_serialized_blob(face.get()))),
         saved_face_(std::move(face)) {}
 
   explicit FontData(::absl::string_view data)
@@ -66,12 +74,26 @@ class FontData {
     copy(data);
   }
 
+  // Loads the file at path. Where supported (HAVE_MMAP) the data is a read
+  // only memory mapping of the file, so processes loading the same file share
+  // the page cache instead of each holding a heap copy.
+  static ::absl::StatusOr<FontData> FromFile(const std::string& path) {
+    hb_blob_unique_ptr blob =
+        make_hb_blob(hb_blob_create_from_file_or_fail(path.c_str()));
+    if (!blob.get()) {
+      return ::absl::NotFoundError(
+          ::absl::StrCat("File ", path, " was not found."));
+    }
+    return FontData(std::move(blob));
+  }
+
   FontData(const FontData&) = delete;
 
   FontData(FontData&& other)
       : buffer_(make_hb_blob(nullptr)), saved_face_(make_hb_face(nullptr)) {
     buffer_ = std::move(other.buffer_);
     saved_face_ = std::move(other.saved_face_);
+    cached_face_.store(other.cached_face_.exchange(nullptr));
 
     other.buffer_ = make_hb_blob();
     other.saved_face_ = make_hb_face(nullptr);
@@ -87,6 +109,7 @@ class FontData {
 
     buffer_ = std::move(other.buffer_);
     saved_face_ = std::move(other.saved_face_);
+    cached_face_.store(other.cached_face_.exchange(nullptr));
 
     other.buffer_ = make_hb_blob();
     other.saved_face_ = make_hb_face(nullptr);
@@ -140,7 +163,7 @@ class FontData {
     reset();
 
     saved_face_ = make_hb_face(hb_face_reference(face));
-    buffer_ = make_hb_blob(hb_face_reference_blob(face));
+    buffer_ = make_hb_blob(reference_serialized_blob(face));
   }
 
   void set(hb_face_t* face, hb_blob_t* blob) {
@@ -150,16 +173,24 @@ class FontData {
     buffer_ = make_hb_blob(hb_blob_reference(blob));
   }
 
+  // Shares other's blob and face (if any) without serializing or copying.
   void shallow_copy(const FontData& other) {
-    if (other.saved_face_) {
-      set(other.saved_face_.get());
+    hb_face_t* face = other.saved_face_
+                          ? other.saved_face_.get()
+                          : other.cached_face_.load(std::memory_order_acquire);
+    if (face) {
+      set(face, other.buffer_.get());
     } else {
       set(other.buffer_.get());
     }
   }
 
   // TODO(garretrieger): copy method which takes vector<uint8_t>.
-  // TODO(garretgrieger): method which takes ownership of a vector<uint8_t>
+
+  // Takes ownership of data, the resulting blob references the container's
+  // buffer directly so no copy is made.
+  void take(std::vector<uint8_t>&& data) { take_container(std::move(data)); }
+  void take(std::string&& data) { take_container(std::move(data)); }
 
   void copy(const char* data, unsigned int length) {
     reset();
@@ -179,17 +210,39 @@ class FontData {
     if (saved_face_.get() != nullptr) {
       saved_face_ = make_hb_face(nullptr);
     }
+
+    hb_face_t* cached = cached_face_.exchange(nullptr);
+    if (cached) {
+      hb_face_destroy(cached);
+    }
   }
 
   hb_face_unique_ptr face() const { return make_hb_face(reference_face()); }
 
   hb_blob_unique_ptr blob() const { return make_hb_blob(reference_blob()); }
 
+  // Faces created from the data are cached, so repeated calls (including from
+  // multiple threads) share a single immutable face along with its table
+  // lookups. The face carries the data's TableDirectory.
   hb_face_t* reference_face() const {
     if (saved_face_) {
       return hb_face_reference(saved_face_.get());
     }
-    return hb_face_create(buffer_.get(), 0);
+
+    hb_face_t* face = cached_face_.load(std::memory_order_acquire);
+    if (!face) {
+      hb_face_t* created = hb_face_create(buffer_.get(), 0);
+      TableDirectory::AttachTo(created, str());
+      hb_face_make_immutable(created);
+      if (cached_face_.compare_exchange_strong(face, created,
+                                               std::memory_order_acq_rel)) {
+        face = created;
+      } else {
+        // Another thread cached a face first, face now holds that one.
+        hb_face_destroy(created);
+      }
+    }
+    return hb_face_reference(face);
   }
 
   hb_blob_t* reference_blob() const { return hb_blob_reference(buffer_.get()); }
@@ -202,8 +255,48 @@ class FontData {
   unsigned int size() const { return hb_blob_get_length(buffer_.get()); }
 
  private:
+  template <typename T>
+  void take_container(T&& data) {
+    reset();
+    if (data.empty()) {
+      return;
+    }
+    T* owned = new T(std::move(data));
+    buffer_ = make_hb_blob(hb_blob_create(
+        reinterpret_cast<const char*>(owned->data()), owned->size(),
+        HB_MEMORY_MODE_READONLY, owned,
+        [](void* user_data) { delete static_cast<T*>(user_data); }));
+  }
+
+  // Returns a new reference to the serialized form of face. Serializing a face
+  // which is not backed by a blob (eg. a face builder) compiles the whole font,
+  // so for immutable faces the result is attached to the face and shared by
+  // every FontData that later wraps it.
+  static hb_blob_t* reference_serialized_blob(hb_face_t* face) {
+    if (!hb_face_is_immutable(face)) {
+      return hb_face_reference_blob(face);
+    }
+
+    void* cached = hb_face_get_user_data(face, &serialized_blob_key_);
+    if (cached) {
+      return hb_blob_reference(static_cast<hb_blob_t*>(cached));
+    }
+
+    hb_blob_t* blob = hb_face_reference_blob(face);
+    hb_blob_t* attached = hb_blob_reference(blob);
+    if (!hb_face_set_user_data(face, &serialized_blob_key_, attached,
+                               (hb_destroy_func_t)hb_blob_destroy, false)) {
+      // Either another thread attached a blob first, or the face is inert.
+      hb_blob_destroy(attached);
+    }
+    return blob;
+  }
+
+  static inline hb_user_data_key_t serialized_blob_key_;
+
   hb_blob_unique_ptr buffer_;
   hb_face_unique_ptr saved_face_;
+  mutable std::atomic<hb_face_t*> cached_face_ = nullptr;
 };
 
 }  // namespace common
@@ -0,0 +1,78 @@
+#include "common/font_data.h"
+
+#include <utility>
+
+#include "absl/status/status.h"
+#include "common/font_helper.h"
+#include "gtest/gtest.h"
+#include "hb.h"
+
+namespace common {
+
+class FontDataTest : public ::testing::Test {
+ protected:
+  FontDataTest()
+      : font(FontHelper::BuildFont({
+            {HB_TAG('a', 'b', 'c', 'd'), "abc"},
+            {HB_TAG('e', 'f', 'g', 'h'), "defg"},
+        })) {}
+
+  FontData font;
+};
+
+TEST_F(FontDataTest, FaceIsCached) {
+  hb_face_unique_ptr face_1 = font.face();
+  hb_face_unique_ptr face_2 = font.face();
+  ASSERT_EQ(face_1.get(), face_2.get());
+  ASSERT_TRUE(hb_face_is_immutable(face_1.get()));
+  ASSERT_EQ(FontHelper::TableData(face_1.get(), HB_TAG('a', 'b', 'c', 'd'))
+                .str(),
+            "abc");
+
+  // Changing the data drops the cached face.
+  FontData other = FontHelper::BuildFont({{HB_TAG('a', 'b', 'c', 'd'), "x"}});
+  font = std::move(other);
+  hb_face_unique_ptr face_3 = font.face();
+  ASSERT_NE(face_3.get(), face_1.get());
+  ASSERT_EQ(FontHelper::TableData(face_3.get(), HB_TAG('a', 'b', 'c', 'd'))
+                .str(),
+            "x");
+  ASSERT_EQ(face_3.get(), font.face().get());
+}
+
+TEST_F(FontDataTest, ShallowCopySharesFace) {
+  hb_face_unique_ptr face = font.face();
+
+  FontData copy;
+  copy.shallow_copy(font);
+  ASSERT_EQ(copy, font);
+  ASSERT_EQ(copy.data(), font.data());
+  ASSERT_EQ(copy.face().get(), face.get());
+}
+
+TEST_F(FontDataTest, WrappingImmutableFaceReusesSerialization) {
+  hb_face_unique_ptr builder = make_hb_face_builder();
+  hb_blob_unique_ptr table = make_hb_blob(
+      hb_blob_create("abc", 3, HB_MEMORY_MODE_READONLY, nullptr, nullptr));
+  hb_face_builder_add_table(builder.get(), HB_TAG('a', 'b', 'c', 'd'),
+                            table.get());
+  hb_face_make_immutable(builder.get());
+
+  FontData wrapped_1(builder.get());
+  FontData wrapped_2(builder.get());
+  ASSERT_FALSE(wrapped_1.empty());
+  ASSERT_EQ(wrapped_1.data(), wrapped_2.data());
+  ASSERT_EQ(wrapped_1.face().get(), builder.get());
+}
+
+TEST_F(FontDataTest, FromFile) {
+  auto loaded = FontData::FromFile("common/testdata/font.txt");
+  ASSERT_TRUE(loaded.ok()) << loaded.status();
+  ASSERT_EQ(loaded->str(), "a font\n");
+
+  ASSERT_TRUE(
+      absl::IsNotFound(FontData::FromFile("common/testdata/nothere.txt")
+                           .status()));
+}
+
+}  // namespace common
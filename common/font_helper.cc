@@ -1,20 +1,29 @@
 #include "common/font_helper.h"
 
 #include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
 
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
+#include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
 #include "common/axis_range.h"
+#include "common/cmap_index.h"
 #include "common/font_data.h"
 #include "common/hb_set_unique_ptr.h"
 #include "common/indexed_data_reader.h"
+#include "common/table_directory.h"
 #include "hb-ot.h"
 #include "hb-subset.h"
 #include "hb.h"
 
 using absl::btree_set;
 using absl::flat_hash_map;
+using absl::MutexLock;
 using absl::StatusOr;
 using absl::StrCat;
 using absl::string_view;
@@ -108,6 +117,328 @@ StatusOr<string_view> FontHelper::GvarData(const hb_face_t* face,
   return reader.DataFor(gid);
 }
 
+namespace {
+
+// A CFF INDEX structure:
+// https://learn.microsoft.com/en-us/typography/opentype/spec/cff2#index-data
+struct CffIndex {
+  uint32_t count = 0;
+  uint32_t off_size = 0;
+  uint32_t offsets_start = 0;
+  uint32_t end = 0;
+};
+
+bool ReadCffUInt(string_view data, uint64_t offset, uint32_t size,
+                 uint32_t& out) {
+  if (offset + size > data.size()) {
+    return false;
+  }
+  out = 0;
+  for (uint32_t i = 0; i < size; i++) {
+    out = (out << 8) | (uint8_t)data[offset + i];
+  }
+  return true;
+}
+
+// Offset from the start of the table to element i, i == count gives the end of
+// the data. The index must have been validated by ParseCffIndex(). Computed in
+// 64 bits so that offsets past the end of the table can't wrap around.
+uint64_t CffElementStart(string_view table, const CffIndex& index,
+                         uint64_t i) {
+  uint32_t value = 0;
+  ReadCffUInt(table, index.offsets_start + i * index.off_size, index.off_size,
+              value);
+  // Offsets are relative to the byte preceding the data.
+  return (uint64_t)index.offsets_start +
+         ((uint64_t)index.count + 1) * index.off_size - 1 + value;
+}
+
+bool ParseCffIndex(string_view table, uint32_t offset, bool is_cff2,
+                   CffIndex& index) {
+  uint32_t count_size = is_cff2 ? 4 : 2;
+  if (!ReadCffUInt(table, offset, count_size, index.count)) {
+    return false;
+  }
+  if (index.count == 0) {
+    index.end = offset + count_size;
+    return true;
+  }
+
+  if (!ReadCffUInt(table, offset + count_size, 1, index.off_size) ||
+      index.off_size < 1 || index.off_size > 4) {
+    return false;
+  }
+  index.offsets_start = offset + count_size + 1;
+  // Rejects counts whose offset array doesn't fit in the table.
+  uint64_t offsets_end = (uint64_t)index.offsets_start +
+                         ((uint64_t)index.count + 1) * index.off_size;
+  if (offsets_end > table.size()) {
+    return false;
+  }
+
+  uint64_t end = CffElementStart(table, index, index.count);
+  if (end > table.size()) {
+    return false;
+  }
+  index.end = end;
+  return true;
+}
+
+// Scans the operators in a DICT for CharStrings (17) and returns its operand.
+bool FindCharStringsOffset(string_view dict, uint32_t& offset) {
+  constexpr uint8_t kCharStrings = 17;
+  int64_t last_operand = -1;
+  uint32_t i = 0;
+  while (i < dict.size()) {
+    uint8_t b0 = dict[i];
+    if (b0 <= 27) {
+      // Operator, 12 is an escape for a two byte operator.
+      if (b0 == kCharStrings) {
+        if (last_operand < 0) {
+          return false;
+        }
+        offset = last_operand;
+        return true;
+      }
+      i += (b0 == 12) ? 2 : 1;
+      last_operand = -1;
+    } else if (b0 == 28) {
+      if (i + 2 >= dict.size()) return false;
+      last_operand =
+          (int16_t)(((uint8_t)dict[i + 1] << 8) | (uint8_t)dict[i + 2]);
+      i += 3;
+    } else if (b0 == 29) {
+      uint32_t value = 0;
+      if (!ReadCffUInt(dict, i + 1, 4, value)) return false;
+      last_operand = (int32_t)value;
+      i += 5;
+    } else if (b0 == 30) {
+      // Real number, ends with a 0xf nibble.
+      i++;
+      while (i < dict.size() && ((uint8_t)dict[i] & 0x0F) != 0x0F &&
+             ((uint8_t)dict[i] & 0xF0) != 0xF0) {
+        i++;
+      }
+      i++;
+      last_operand = -1;
+    } else if (b0 >= 32 && b0 <= 246) {
+      last_operand = (int32_t)b0 - 139;
+      i += 1;
+    } else if (b0 >= 247 && b0 <= 250) {
+      if (i + 1 >= dict.size()) return false;
+      last_operand = ((int32_t)b0 - 247) * 256 + (uint8_t)dict[i + 1] + 108;
+      i += 2;
+    } else if (b0 >= 251 && b0 <= 254) {
+      if (i + 1 >= dict.size()) return false;
+      last_operand = -((int32_t)b0 - 251) * 256 - (uint8_t)dict[i + 1] - 108;
+      i += 2;
+    } else {
+      return false;
+    }
+  }
+  return false;
+}
+
+// Locates and validates the CharStrings INDEX of a CFF or CFF2 table. If set
+// index_offset is set to the offset of the INDEX in the table.
+absl::Status FindCharStrings(string_view table, bool is_cff2,
+                             CffIndex& charstrings,
+                             uint32_t* index_offset = nullptr) {
+  uint64_t top_dict_start = 0;
+  uint64_t top_dict_end = 0;
+  if (!is_cff2) {
+    // Header, Name INDEX, Top DICT INDEX.
+    if (table.size() < 4) {
+      return absl::InvalidArgumentError("CFF header is truncated.");
+    }
+    CffIndex names;
+    if (!ParseCffIndex(table, (uint8_t)table[2], false, names)) {
+      return absl::InvalidArgumentError("Invalid CFF Name INDEX.");
+    }
+    CffIndex top_dicts;
+    if (!ParseCffIndex(table, names.end, false, top_dicts) ||
+        top_dicts.count == 0) {
+      return absl::InvalidArgumentError("Invalid CFF Top DICT INDEX.");
+    }
+    top_dict_start = CffElementStart(table, top_dicts, 0);
+    top_dict_end = CffElementStart(table, top_dicts, 1);
+  } else {
+    // Header with the Top DICT immediately following.
+    if (table.size() < 5) {
+      return absl::InvalidArgumentError("CFF2 header is truncated.");
+    }
+    top_dict_start = (uint8_t)table[2];
+    top_dict_end =
+        top_dict_start + (((uint8_t)table[3] << 8) | (uint8_t)table[4]);
+  }
+
+  if (top_dict_start > top_dict_end || top_dict_end > table.size()) {
+    return absl::InvalidArgumentError("Top DICT is out of bounds.");
+  }
+
+  uint32_t charstrings_offset = 0;
+  if (!FindCharStringsOffset(
+          table.substr(top_dict_start, top_dict_end - top_dict_start),
+          charstrings_offset)) {
+    return absl::InvalidArgumentError(
+        "CharStrings offset not found in Top DICT.");
+  }
+
+  if (!ParseCffIndex(table, charstrings_offset, is_cff2, charstrings)) {
+    return absl::InvalidArgumentError("Invalid CharStrings INDEX.");
+  }
+  if (index_offset) {
+    *index_offset = charstrings_offset;
+  }
+  return absl::OkStatus();
+}
+
+StatusOr<string_view> CharStringData(string_view table, bool is_cff2,
+                                     uint32_t gid) {
+  CffIndex charstrings;
+  auto sc = FindCharStrings(table, is_cff2, charstrings);
+  if (!sc.ok()) {
+    return sc;
+  }
+
+  if (gid >= charstrings.count) {
+    return absl::NotFoundError(StrCat("No charstring for gid ", gid, "."));
+  }
+
+  uint64_t start = CffElementStart(table, charstrings, gid);
+  uint64_t end = CffElementStart(table, charstrings, (uint64_t)gid + 1);
+  if (start > end || end > table.size()) {
+    return absl::InvalidArgumentError("CharStrings INDEX offsets are invalid.");
+  }
+  return table.substr(start, end - start);
+}
+
+}  // namespace
+
+StatusOr<string_view> FontHelper::CffCharStringData(const hb_face_t* face,
+                                                    uint32_t gid) {
+  auto cff = TableData(face, kCFF);
+  if (cff.empty()) {
+    return absl::NotFoundError("CFF not in the font.");
+  }
+  return CharStringData(cff.str(), false, gid);
+}
+
+StatusOr<string_view> FontHelper::Cff2CharStringData(const hb_face_t* face,
+                                                     uint32_t gid) {
+  auto cff2 = TableData(face, kCFF2);
+  if (cff2.empty()) {
+    return absl::NotFoundError("CFF2 not in the font.");
+  }
+  return CharStringData(cff2.str(), true, gid);
+}
+
+StatusOr<std::vector<uint32_t>> FontHelper::CffCharStringOffsets(
+    string_view table, bool is_cff2) {
+  CffIndex charstrings;
+  auto sc = FindCharStrings(table, is_cff2, charstrings);
+  if (!sc.ok()) {
+    return sc;
+  }
+
+  std::vector<uint32_t> offsets;
+  if (charstrings.count == 0) {
+    return offsets;
+  }
+  offsets.reserve((uint64_t)charstrings.count + 1);
+  for (uint64_t i = 0; i <= charstrings.count; i++) {
+    uint64_t start = CffElementStart(table, charstrings, i);
+    if (start > table.size() || (!offsets.empty() && start < offsets.back())) {
+      return absl::InvalidArgumentError(
+          "CharStrings INDEX offsets are invalid.");
+    }
+    offsets.push_back(start);
+  }
+  return offsets;
+}
+
+StatusOr<uint32_t> FontHelper::CffCharStringsIndexOffset(string_view table,
+                                                         bool is_cff2) {
+  CffIndex charstrings;
+  uint32_t index_offset = 0;
+  auto sc = FindCharStrings(table, is_cff2, charstrings, &index_offset);
+  if (!sc.ok()) {
+    return sc;
+  }
+  return index_offset;
+}
+
+StatusOr<std::string> FontHelper::RebuildCffCharStrings(
+    string_view table, bool is_cff2,
+    const std::function<string_view(uint32_t, string_view)>& charstring) {
+  auto index_offset = CffCharStringsIndexOffset(table, is_cff2);
+  if (!index_offset.ok()) {
+    return index_offset.status();
+  }
+  auto offsets_or = CffCharStringOffsets(table, is_cff2);
+  if (!offsets_or.ok()) {
+    return offsets_or.status();
+  }
+  const std::vector<uint32_t>& offsets = *offsets_or;
+  if (offsets.empty()) {
+    // No glyphs, so none to replace.
+    return std::string(table);
+  }
+  if (offsets.back() != table.size()) {
+    return absl::InvalidArgumentError(
+        "The CharStrings INDEX must be at the end of the table.");
+  }
+
+  uint32_t glyph_count = offsets.size() - 1;
+  std::string charstrings;
+  std::vector<uint64_t> new_offsets;
+  new_offsets.reserve(offsets.size());
+  for (uint32_t gid = 0; gid < glyph_count; gid++) {
+    // INDEX offsets are relative to the byte preceding the data.
+    new_offsets.push_back((uint64_t)charstrings.size() + 1);
+    charstrings += charstring(
+        gid, table.substr(offsets[gid], offsets[gid + 1] - offsets[gid]));
+  }
+  new_offsets.push_back((uint64_t)charstrings.size() + 1);
+
+  uint64_t max_offset = new_offsets.back();
+  if (max_offset > UINT32_MAX) {
+    return absl::InvalidArgumentError("Rebuilt CharStrings are too large.");
+  }
+  uint32_t off_size = 1;
+  while (off_size < 4 && (max_offset >> (8 * off_size))) {
+    off_size++;
+  }
+
+  std::string result;
+  result.reserve(*index_offset + (is_cff2 ? 4 : 2) + 1 +
+                 (glyph_count + 1) * off_size + charstrings.size());
+  result += table.substr(0, *index_offset);
+  if (is_cff2) {
+    WriteUInt32(glyph_count, result);
+  } else {
+    WriteUInt16(glyph_count, result);
+  }
+  WriteUInt8(off_size, result);
+  for (uint64_t offset : new_offsets) {
+    switch (off_size) {
+      case 1:
+        WriteUInt8(offset, result);
+        break;
+      case 2:
+        WriteUInt16(offset, result);
+        break;
+      case 3:
+        WriteUInt24(offset, result);
+        break;
+      default:
+        WriteUInt32(offset, result);
+    }
+  }
+  result += charstrings;
+  return result;
+}
+
 StatusOr<uint32_t> FontHelper::GvarSharedTupleCount(const hb_face_t* face) {
   auto gvar = TableData(face, kGvar);
   if (gvar.empty()) {
@@ -130,30 +461,15 @@ StatusOr<uint32_t> FontHelper::GvarSharedTupleCount(const hb_face_t* face) {
 
 btree_set<uint32_t> FontHelper::GidsToUnicodes(
     hb_face_t* face, const btree_set<uint32_t>& gids) {
-  auto gid_to_unicode = FontHelper::GidToUnicodeMap(face);
-  btree_set<uint32_t> result;
-  for (uint32_t gid : gids) {
-    auto unicode = gid_to_unicode.find(gid);
-    if (unicode != gid_to_unicode.end()) {
-      result.insert(unicode->second);
-    }
-  }
-  return result;
+  return CmapIndex(face).CodepointsFor(gids);
 }
 
 flat_hash_map<uint32_t, uint32_t> FontHelper::GidToUnicodeMap(hb_face_t* face) {
-  hb_map_t* unicode_to_gid = hb_map_create();
-  hb_face_collect_nominal_glyph_mapping(face, unicode_to_gid, nullptr);
-
   flat_hash_map<uint32_t, uint32_t> gid_to_unicode;
-  int index = -1;
-  uint32_t cp = HB_MAP_VALUE_INVALID;
-  uint32_t gid = HB_MAP_VALUE_INVALID;
-  while (hb_map_next(unicode_to_gid, &index, &cp, &gid)) {
-    gid_to_unicode[gid] = cp;
+  // Mapping() is in codepoint order, so this keeps the lowest codepoint.
+  for (const auto& [cp, gid] : CmapIndex(face).Mapping()) {
+    gid_to_unicode.try_emplace(gid, cp);
   }
-
-  hb_map_destroy(unicode_to_gid);
   return gid_to_unicode;
 }
 
@@ -170,8 +486,86 @@ btree_set<uint32_t> FontHelper::ToCodepointsSet(hb_face_t* face) {
   return result;
 }
 
+namespace {
+
+struct TableHashes {
+  absl::Mutex mutex;
+  flat_hash_map<hb_tag_t, uint64_t> hashes ABSL_GUARDED_BY(mutex);
+};
+
+hb_user_data_key_t table_hashes_key;
+
+void DestroyTableHashes(void* data) { delete (TableHashes*)data; }
+
+// Returns the table hashes attached to blob, attaching a new set if needed.
+// Returns nullptr if the blob can't hold user data (eg. the empty blob).
+TableHashes* GetTableHashes(hb_blob_t* blob) {
+  void* existing = hb_blob_get_user_data(blob, &table_hashes_key);
+  if (existing) {
+    return (TableHashes*)existing;
+  }
+
+  TableHashes* hashes = new TableHashes;
+  if (hb_blob_set_user_data(blob, &table_hashes_key, hashes,
+                            DestroyTableHashes, false)) {
+    return hashes;
+  }
+
+  // Either another thread attached a set first, or the blob is immutable.
+  delete hashes;
+  return (TableHashes*)hb_blob_get_user_data(blob, &table_hashes_key);
+}
+
+}  // namespace
+
+uint64_t FontHelper::TableHash(hb_face_t* face, hb_tag_t tag) {
+  hb_blob_unique_ptr font_blob = make_hb_blob(hb_face_reference_blob(face));
+  TableHashes* hashes = GetTableHashes(font_blob.get());
+  if (hashes) {
+    MutexLock lock(&hashes->mutex);
+    auto it = hashes->hashes.find(tag);
+    if (it != hashes->hashes.end()) {
+      return it->second;
+    }
+  }
+
+  uint64_t hash = absl::HashOf(TableData(face, tag).str());
+  if (hashes) {
+    MutexLock lock(&hashes->mutex);
+    hashes->hashes[tag] = hash;
+  }
+  return hash;
+}
+
+FontData FontHelper::TableData(const hb_face_t* face, hb_tag_t tag) {
+  const TableDirectory* directory = TableDirectory::ForFace(face);
+  if (!directory) {
+    return FontData(make_hb_blob(hb_face_reference_table(face, tag)));
+  }
+
+  const TableDirectory::Entry* entry = directory->Find(tag);
+  if (!entry) {
+    return FontData();
+  }
+  // Faces with a directory are backed by the font data, so this doesn't
+  // serialize anything.
+  hb_blob_unique_ptr font =
+      make_hb_blob(hb_face_reference_blob(const_cast<hb_face_t*>(face)));
+  return FontData(make_hb_blob(
+      hb_blob_create_sub_blob(font.get(), entry->offset, entry->length)));
+}
+
 absl::flat_hash_set<hb_tag_t> FontHelper::GetTags(hb_face_t* face) {
   absl::flat_hash_set<hb_tag_t> tag_set;
+  const TableDirectory* directory = TableDirectory::ForFace(face);
+  if (directory) {
+    tag_set.reserve(directory->Entries().size());
+    for (const auto& entry : directory->Entries()) {
+      tag_set.insert(entry.tag);
+    }
+    return tag_set;
+  }
+
   constexpr uint32_t max_tags = 64;
   hb_tag_t table_tags[max_tags];
   unsigned table_count = max_tags;
@@ -190,6 +584,16 @@ absl::flat_hash_set<hb_tag_t> FontHelper::GetTags(hb_face_t* face) {
 
 std::vector<hb_tag_t> FontHelper::GetOrderedTags(hb_face_t* face) {
   std::vector<hb_tag_t> ordered_tags;
+  const TableDirectory* directory = TableDirectory::ForFace(face);
+  if (directory) {
+    // Entries are already in offset order.
+    ordered_tags.reserve(directory->Entries().size());
+    for (const auto& entry : directory->Entries()) {
+      ordered_tags.push_back(entry.tag);
+    }
+    return ordered_tags;
+  }
+
   auto tags = GetTags(face);
 
   std::copy(tags.begin(), tags.end(), std::back_inserter(ordered_tags));
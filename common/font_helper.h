@@ -3,6 +3,9 @@
 
 #include <cmath>
 #include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
 
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_map.h"
@@ -12,6 +15,7 @@
 #include "absl/strings/string_view.h"
 #include "common/axis_range.h"
 #include "common/font_data.h"
+#include "common/table_directory.h"
 #include "hb.h"
 
 namespace common {
@@ -21,6 +25,12 @@ struct CompareTableOffsets {
   CompareTableOffsets(hb_face_t* f) { face = f; }
 
   uint32_t table_offset(hb_tag_t tag) const {
+    const TableDirectory* directory = TableDirectory::ForFace(face);
+    if (directory) {
+      const TableDirectory::Entry* entry = directory->Find(tag);
+      return entry ? entry->offset : 0;
+    }
+
     hb_blob_t* font = hb_face_reference_blob(face);
     hb_blob_t* table = hb_face_reference_table(face, tag);
 
@@ -46,6 +56,8 @@ class FontHelper {
   constexpr static hb_tag_t kGlyf = HB_TAG('g', 'l', 'y', 'f');
   constexpr static hb_tag_t kHead = HB_TAG('h', 'e', 'a', 'd');
   constexpr static hb_tag_t kGvar = HB_TAG('g', 'v', 'a', 'r');
+  constexpr static hb_tag_t kFvar = HB_TAG('f', 'v', 'a', 'r');
+  constexpr static hb_tag_t kAvar = HB_TAG('a', 'v', 'a', 'r');
   constexpr static hb_tag_t kCFF = HB_TAG('C', 'F', 'F', ' ');
   constexpr static hb_tag_t kCFF2 = HB_TAG('C', 'F', 'F', '2');
   constexpr static hb_tag_t kGSUB = HB_TAG('G', 'S', 'U', 'B');
@@ -142,6 +154,39 @@ class FontHelper {
 
   static absl::StatusOr<uint32_t> GvarSharedTupleCount(const hb_face_t* face);
 
+  // Returns the charstring for gid from the CFF table.
+  static absl::StatusOr<absl::string_view> CffCharStringData(
+      const hb_face_t* face, uint32_t gid);
+
+  // Returns the charstring for gid from the CFF2 table.
+  static absl::StatusOr<absl::string_view> Cff2CharStringData(
+      const hb_face_t* face, uint32_t gid);
+
+  /*
+   * Returns the offset from the start of a CFF or CFF2 table to each charstring
+   * in its CharStrings INDEX, plus a trailing offset to the end of the last
+   * charstring.
+   */
+  static absl::StatusOr<std::vector<uint32_t>> CffCharStringOffsets(
+      absl::string_view table, bool is_cff2);
+
+  // Returns the offset from the start of a CFF or CFF2 table to its
+  // CharStrings INDEX.
+  static absl::StatusOr<uint32_t> CffCharStringsIndexOffset(
+      absl::string_view table, bool is_cff2);
+
+  /*
+   * Returns a copy of a CFF or CFF2 table with its CharStrings INDEX rebuilt,
+   * using the minimal offSize. The charstring of each gid is replaced with
+   * charstring(gid, current charstring). Nothing in the table may follow the
+   * CharStrings INDEX, so that it can be resized without updating any other
+   * offsets.
+   */
+  static absl::StatusOr<std::string> RebuildCffCharStrings(
+      absl::string_view table, bool is_cff2,
+      const std::function<absl::string_view(uint32_t, absl::string_view)>&
+          charstring);
+
   static absl::StatusOr<absl::string_view> Loca(const hb_face_t* face) {
     auto result = FontHelper::TableData(face, kLoca).str();
     if (result.empty()) {
@@ -150,12 +195,17 @@ class FontHelper {
     return result;
   }
 
-  static FontData TableData(const hb_face_t* face, hb_tag_t tag) {
-    hb_blob_t* blob = hb_face_reference_table(face, tag);
-    FontData result(blob);
-    hb_blob_destroy(blob);
-    return result;
-  }
+  // Returns the data of table 'tag' in face, which is empty if the table isn't
+  // present. Uses the face's TableDirectory when it has one.
+  static FontData TableData(const hb_face_t* face, hb_tag_t tag);
+
+  /*
+   * Returns a hash of the contents of the table 'tag' in face. Hashes are
+   * cached on the face's underlying font blob, so repeated calls for the same
+   * font (including via other faces created from the same blob) don't need to
+   * re-read the table data. Thread safe.
+   */
+  static uint64_t TableHash(hb_face_t* face, hb_tag_t tag);
 
   static FontData BuildFont(
       const absl::flat_hash_map<hb_tag_t, std::string> tables) {
@@ -175,9 +225,12 @@ class FontHelper {
     return result;
   }
 
+  // Maps each glyph in the cmap to the lowest codepoint mapped to it.
   static absl::flat_hash_map<uint32_t, uint32_t> GidToUnicodeMap(
       hb_face_t* face);
 
+  // Returns all codepoints mapped to gids. Both of these collect the full
+  // cmap, callers doing repeated lookups should use a CmapIndex instead.
   static absl::btree_set<uint32_t> GidsToUnicodes(
       hb_face_t* face, const absl::btree_set<uint32_t>& gids);
 
@@ -199,15 +252,19 @@ class FontHelper {
   static hb_tag_t ToTag(const std::string& tag);
 
  private:
+  // Bytes are staged locally and appended in one call so each write does a
+  // single capacity check on out instead of one per byte.
   template <int num_bits, typename int_type_t>
   static void WriteInt(int_type_t value, std::string& out) {
     constexpr int num_bytes = num_bits / 8;
+    char bytes[num_bytes];
     int shift = num_bits - 8;
     for (int i = 0; i < num_bytes; i++) {
-      out.push_back(
-          (uint8_t)((int_type_t)(value >> shift) & (int_type_t)0x000000FFu));
+      bytes[i] =
+          (uint8_t)((int_type_t)(value >> shift) & (int_type_t)0x000000FFu);
       shift -= 8;
     }
+    out.append(bytes, num_bytes);
   }
 
   template <unsigned num_bits, typename int_type_t>
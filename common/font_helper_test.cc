@@ -3,6 +3,7 @@
 #include <cstdint>
 
 #include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
 #include "common/font_data.h"
 #include "gtest/gtest.h"
 #include "hb-subset.h"
@@ -391,6 +392,48 @@ TEST_F(FontHelperTest, GidToUnicodeMap) {
   ASSERT_EQ(map, expected);
 }
 
+TEST_F(FontHelperTest, CffCharStringData) {
+  auto data = FontHelper::CffCharStringData(noto_sans_jp_otf.get(), 0);
+  ASSERT_TRUE(data.ok()) << data.status();
+  ASSERT_EQ(data->size(), 77);
+
+  data = FontHelper::CffCharStringData(noto_sans_jp_otf.get(), 1);
+  ASSERT_TRUE(data.ok()) << data.status();
+  ASSERT_EQ(*data, "\xfc\x2f\x0e");
+
+  data = FontHelper::CffCharStringData(noto_sans_jp_otf.get(), 100);
+  ASSERT_TRUE(data.ok()) << data.status();
+  ASSERT_EQ(data->size(), 80);
+
+  data = FontHelper::CffCharStringData(noto_sans_jp_otf.get(), 17850);
+  ASSERT_TRUE(absl::IsNotFound(data.status())) << data.status();
+
+  data = FontHelper::CffCharStringData(roboto.get(), 1);
+  ASSERT_TRUE(absl::IsNotFound(data.status())) << data.status();
+
+  data = FontHelper::Cff2CharStringData(noto_sans_jp_otf.get(), 1);
+  ASSERT_TRUE(absl::IsNotFound(data.status())) << data.status();
+}
+
+TEST_F(FontHelperTest, CffCharStringOffsets) {
+  auto cff = FontHelper::TableData(noto_sans_jp_otf.get(), FontHelper::kCFF);
+  auto offsets = FontHelper::CffCharStringOffsets(cff.str(), false);
+  ASSERT_TRUE(offsets.ok()) << offsets.status();
+  ASSERT_EQ(offsets->size(), 17851);
+  ASSERT_EQ((*offsets)[2] - (*offsets)[1], 3);
+  ASSERT_LE(offsets->back(), cff.size());
+
+  offsets = FontHelper::CffCharStringOffsets("foo", false);
+  ASSERT_TRUE(absl::IsInvalidArgument(offsets.status())) << offsets.status();
+
+  // CFF2 header and a Top DICT pointing at a CharStrings INDEX with a count of
+  // 0xFFFFFFFF, whose offset array can't fit in the table.
+  std::string cff2 = {0x02, 0x00, 0x05, 0x00, 0x02, (char)(139 + 7), 17};
+  cff2 += std::string(4, (char)0xFF) + std::string{0x01, 0x01, 0x01};
+  offsets = FontHelper::CffCharStringOffsets(cff2, true);
+  ASSERT_TRUE(absl::IsInvalidArgument(offsets.status())) << offsets.status();
+}
+
 TEST_F(FontHelperTest, GetTags) {
   auto s = FontHelper::GetTags(roboto_ab.get());
   ASSERT_TRUE(s.contains(FontHelper::kLoca));
@@ -478,6 +521,35 @@ TEST_F(FontHelperTest, BuildFont) {
   ASSERT_EQ(table_2.str(), "table_2");
 }
 
+TEST_F(FontHelperTest, TableHash) {
+  auto font_a = FontHelper::BuildFont({
+      {HB_TAG('a', 'b', 'c', 'd'), "table_1"},
+      {HB_TAG('d', 'e', 'f', 'g'), "table_2"},
+  });
+  auto font_b = FontHelper::BuildFont({
+      {HB_TAG('a', 'b', 'c', 'd'), "table_1"},
+      {HB_TAG('d', 'e', 'f', 'g'), "table_3"},
+  });
+
+  hb_face_unique_ptr face_a = font_a.face();
+  hb_face_unique_ptr face_b = font_b.face();
+
+  uint64_t a1 = FontHelper::TableHash(face_a.get(), HB_TAG('a', 'b', 'c', 'd'));
+  uint64_t a2 = FontHelper::TableHash(face_a.get(), HB_TAG('d', 'e', 'f', 'g'));
+  uint64_t b1 = FontHelper::TableHash(face_b.get(), HB_TAG('a', 'b', 'c', 'd'));
+  uint64_t b2 = FontHelper::TableHash(face_b.get(), HB_TAG('d', 'e', 'f', 'g'));
+
+  ASSERT_EQ(a1, b1);
+  ASSERT_NE(a2, b2);
+  ASSERT_NE(a1, a2);
+
+  // Cached values are returned for other faces on the same font.
+  hb_face_unique_ptr face_a_again = font_a.face();
+  ASSERT_EQ(
+      FontHelper::TableHash(face_a_again.get(), HB_TAG('d', 'e', 'f', 'g')),
+      a2);
+}
+
 TEST_F(FontHelperTest, GlyfData_ShortOverflow) {
   // This glyph has a start < 65536 and end > 65536 and so will create an
   // overflow in offset calculation if the wrong data types are used.
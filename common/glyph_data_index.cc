@@ -0,0 +1,216 @@
+#include "common/glyph_data_index.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "common/try.h"
+#include "hb.h"
+
+using absl::btree_set;
+using absl::StatusOr;
+using absl::StrCat;
+using absl::string_view;
+
+namespace common {
+
+GlyphDataIndex::GlyphDataIndex(const hb_face_t* face)
+    : glyf_(IndexGlyf(face)),
+      gvar_(IndexGvar(face)),
+      cff_(IndexCff(face, false)),
+      cff2_(IndexCff(face, true)) {}
+
+bool GlyphDataIndex::Has(hb_tag_t table) const {
+  const TableIndex* index = Find(table);
+  return index && index->present;
+}
+
+StatusOr<const GlyphDataIndex::TableIndex*> GlyphDataIndex::IndexFor(
+    hb_tag_t table) const {
+  const TableIndex* index = Find(table);
+  if (!index) {
+    return absl::InvalidArgumentError(
+        StrCat("Table ", FontHelper::ToString(table),
+               " does not have per glyph data."));
+  }
+  if (!index->present) {
+    return absl::NotFoundError(
+        StrCat(FontHelper::ToString(table), " not in the font."));
+  }
+  if (!index->status.ok()) {
+    return index->status;
+  }
+  return index;
+}
+
+StatusOr<string_view> GlyphDataIndex::GlyphData(hb_tag_t table,
+                                                uint32_t gid) const {
+  const TableIndex* index = TRY(IndexFor(table));
+  return index->DataFor(gid);
+}
+
+StatusOr<uint64_t> GlyphDataIndex::AppendGlyphData(
+    hb_tag_t table, const btree_set<uint32_t>& gids,
+    std::vector<string_view>& out) const {
+  const TableIndex* index = TRY(IndexFor(table));
+  const std::vector<uint32_t>& offsets = index->offsets;
+  uint64_t total_size = 0;
+  for (uint32_t gid : gids) {
+    // Same checks as DataFor(), inlined so a StatusOr isn't created for every
+    // glyph. On failure DataFor() produces the error.
+    if ((uint64_t)gid + 1 >= offsets.size() ||
+        offsets[gid + 1] < offsets[gid] ||
+        offsets[gid + 1] > index->data.size()) {
+      return index->DataFor(gid).status();
+    }
+    uint32_t start = offsets[gid];
+    uint32_t size = offsets[gid + 1] - start;
+    out.push_back(index->data.substr(start, size));
+    total_size += size;
+  }
+  return total_size;
+}
+
+StatusOr<string_view> GlyphDataIndex::TableIndex::DataFor(uint32_t gid) const {
+  if ((uint64_t)gid + 1 >= offsets.size()) {
+    return absl::NotFoundError(
+        StrCat("Entry ", gid, " not found in offset table."));
+  }
+
+  uint32_t start = offsets[gid];
+  uint32_t end = offsets[gid + 1];
+  if (end < start) {
+    return absl::InvalidArgumentError(
+        StrCat("Invalid index. end (", end, ") < start (", start, ")."));
+  }
+  if (end > data.size()) {
+    return absl::InvalidArgumentError("Data offsets exceed data size.");
+  }
+  return data.substr(start, end - start);
+}
+
+const GlyphDataIndex::TableIndex* GlyphDataIndex::Find(hb_tag_t table) const {
+  switch (table) {
+    case FontHelper::kGlyf:
+      return &glyf_;
+    case FontHelper::kGvar:
+      return &gvar_;
+    case FontHelper::kCFF:
+      return &cff_;
+    case FontHelper::kCFF2:
+      return &cff2_;
+    default:
+      return nullptr;
+  }
+}
+
+GlyphDataIndex::TableIndex GlyphDataIndex::IndexGlyf(const hb_face_t* face) {
+  TableIndex index;
+  index.table = FontHelper::TableData(face, FontHelper::kGlyf);
+  FontData loca = FontHelper::TableData(face, FontHelper::kLoca);
+  index.present = !index.table.empty() && !loca.empty();
+  if (!index.present) {
+    return index;
+  }
+
+  FontData head = FontHelper::TableData(face, FontHelper::kHead);
+  if (head.size() < 52) {
+    index.status = absl::InvalidArgumentError("invalid head table, too short.");
+    return index;
+  }
+
+  bool is_short_loca = !head.str()[51];
+  index.data = index.table.str();
+  index.offsets = is_short_loca ? DecodeOffsets(loca.str(), 2, 2, UINT32_MAX)
+                                : DecodeOffsets(loca.str(), 4, 1, UINT32_MAX);
+  return index;
+}
+
+GlyphDataIndex::TableIndex GlyphDataIndex::IndexGvar(const hb_face_t* face) {
+  TableIndex index;
+  index.table = FontHelper::TableData(face, FontHelper::kGvar);
+  index.present = !index.table.empty();
+  if (!index.present) {
+    return index;
+  }
+
+  constexpr uint32_t glyph_count_offset = 12;
+  constexpr uint32_t gvar_flags_offset = 15;
+  constexpr uint32_t data_array_offset = 16;
+  constexpr uint32_t gvar_offsets_table_offset = 20;
+
+  string_view gvar = index.table.str();
+  if (gvar.size() < 20) {
+    index.status = absl::InvalidArgumentError("gvar table is too short.");
+    return index;
+  }
+
+  uint32_t glyph_count =
+      *FontHelper::ReadUInt16(gvar.substr(glyph_count_offset));
+  uint32_t data_offset =
+      *FontHelper::ReadUInt32(gvar.substr(data_array_offset));
+  if (data_offset > gvar.size()) {
+    index.status =
+        absl::InvalidArgumentError("gvar glyph data offset is out of bounds.");
+    return index;
+  }
+
+  bool is_wide = ((uint8_t)gvar[gvar_flags_offset]) & 0x01;
+  index.data = gvar.substr(data_offset);
+  index.offsets = DecodeOffsets(gvar.substr(gvar_offsets_table_offset),
+                                is_wide ? 4 : 2, is_wide ? 1 : 2,
+                                glyph_count + 1);
+  return index;
+}
+
+GlyphDataIndex::TableIndex GlyphDataIndex::IndexCff(const hb_face_t* face,
+                                                    bool is_cff2) {
+  TableIndex index;
+  index.table = FontHelper::TableData(
+      face, is_cff2 ? FontHelper::kCFF2 : FontHelper::kCFF);
+  index.present = !index.table.empty();
+  if (!index.present) {
+    return index;
+  }
+
+  index.data = index.table.str();
+  auto offsets = FontHelper::CffCharStringOffsets(index.data, is_cff2);
+  if (!offsets.ok()) {
+    index.status = offsets.status();
+    return index;
+  }
+  index.offsets = std::move(*offsets);
+  return index;
+}
+
+std::vector<uint32_t> GlyphDataIndex::DecodeOffsets(string_view offsets,
+                                                    uint32_t width,
+                                                    uint32_t multiplier,
+                                                    uint32_t count) {
+  uint64_t available = offsets.size() / width;
+  std::vector<uint32_t> result(count < available ? count : available);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(offsets.data());
+  if (width == 2) {
+    for (size_t i = 0; i < result.size(); i++) {
+      result[i] = (((uint32_t)data[2 * i] << 8) | data[2 * i + 1]) * multiplier;
+    }
+    return result;
+  }
+
+  for (size_t i = 0; i < result.size(); i++) {
+    result[i] = (((uint32_t)data[4 * i] << 24) |
+                 ((uint32_t)data[4 * i + 1] << 16) |
+                 ((uint32_t)data[4 * i + 2] << 8) | data[4 * i + 3]) *
+                multiplier;
+  }
+  return result;
+}
+
+}  // namespace common
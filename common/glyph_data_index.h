@@ -0,0 +1,93 @@
+#ifndef COMMON_GLYPH_DATA_INDEX_H_
+#define COMMON_GLYPH_DATA_INDEX_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "common/font_data.h"
+#include "hb.h"
+
+namespace common {
+
+/*
+ * Provides access to the per glyph data of a font's glyf, gvar, CFF and CFF2
+ * tables.
+ *
+ * The offset tables (loca, the gvar offsets and the CharStrings INDEX) are
+ * decoded once on construction, after which looking up the data for a glyph
+ * is constant time. This is preferable to FontHelper::GlyfData() and friends
+ * when many glyphs are looked up in the same font.
+ *
+ * The index holds references to the table data so returned views remain valid
+ * for the lifetime of the index. Lookups are thread safe.
+ */
+class GlyphDataIndex {
+ public:
+  explicit GlyphDataIndex(const hb_face_t* face);
+
+  GlyphDataIndex(const GlyphDataIndex&) = delete;
+  GlyphDataIndex& operator=(const GlyphDataIndex&) = delete;
+  GlyphDataIndex(GlyphDataIndex&&) = default;
+  GlyphDataIndex& operator=(GlyphDataIndex&&) = default;
+
+  // Returns true if the font has table (glyf additionally requires loca). This
+  // is true even if the table failed to index, in which case lookups will
+  // return the error.
+  bool Has(hb_tag_t table) const;
+
+  // Returns the data for gid in table, which must be one of glyf, gvar, CFF or
+  // CFF2.
+  absl::StatusOr<absl::string_view> GlyphData(hb_tag_t table,
+                                              uint32_t gid) const;
+
+  /*
+   * Appends the data for each of gids in table to out, in gid order. Returns
+   * the total size of the appended data, or the error of the first glyph
+   * which couldn't be looked up. The table is resolved once so this is
+   * cheaper than calling GlyphData() for each glyph.
+   */
+  absl::StatusOr<uint64_t> AppendGlyphData(
+      hb_tag_t table, const absl::btree_set<uint32_t>& gids,
+      std::vector<absl::string_view>& out) const;
+
+ private:
+  struct TableIndex {
+    bool present = false;
+    absl::Status status = absl::OkStatus();
+    FontData table;
+    // Glyph data for all glyphs, offsets are relative to this.
+    absl::string_view data;
+    std::vector<uint32_t> offsets;
+
+    absl::StatusOr<absl::string_view> DataFor(uint32_t gid) const;
+  };
+
+  // Returns the index for table, or an error if it can't be used.
+  absl::StatusOr<const TableIndex*> IndexFor(hb_tag_t table) const;
+
+  static TableIndex IndexGlyf(const hb_face_t* face);
+  static TableIndex IndexGvar(const hb_face_t* face);
+  static TableIndex IndexCff(const hb_face_t* face, bool is_cff2);
+
+  // Decodes count big endian offsets of the given width, each multiplied by
+  // multiplier. Fewer are returned if offsets is too short.
+  static std::vector<uint32_t> DecodeOffsets(absl::string_view offsets,
+                                             uint32_t width,
+                                             uint32_t multiplier,
+                                             uint32_t count);
+
+  const TableIndex* Find(hb_tag_t table) const;
+
+  TableIndex glyf_;
+  TableIndex gvar_;
+  TableIndex cff_;
+  TableIndex cff2_;
+};
+
+}  // namespace common
+
+#endif  // COMMON_GLYPH_DATA_INDEX_H_
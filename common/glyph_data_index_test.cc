@@ -0,0 +1,140 @@
+#include "common/glyph_data_index.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "gtest/gtest.h"
+#include "hb.h"
+
+namespace common {
+
+constexpr hb_tag_t kHmtx = HB_TAG('h', 'm', 't', 'x');
+
+class GlyphDataIndexTest : public ::testing::Test {
+ protected:
+  GlyphDataIndexTest()
+      : roboto_ab(make_hb_face(nullptr)),
+        roboto_vf(make_hb_face(nullptr)),
+        noto_sans_jp_otf(make_hb_face(nullptr)),
+        noto_sans_ift_ttf(make_hb_face(nullptr)) {
+    hb_blob_unique_ptr blob = make_hb_blob(
+        hb_blob_create_from_file("common/testdata/Roboto-Regular.ab.ttf"));
+    roboto_ab = make_hb_face(hb_face_create(blob.get(), 0));
+
+    blob = make_hb_blob(
+        hb_blob_create_from_file("common/testdata/Roboto[wdth,wght].ttf"));
+    roboto_vf = make_hb_face(hb_face_create(blob.get(), 0));
+
+    blob = make_hb_blob(
+        hb_blob_create_from_file("common/testdata/NotoSansJP-Regular.otf"));
+    noto_sans_jp_otf = make_hb_face(hb_face_create(blob.get(), 0));
+
+    blob = make_hb_blob(
+        hb_blob_create_from_file("ift/testdata/NotoSansJP-Regular.ift.ttf"));
+    noto_sans_ift_ttf = make_hb_face(hb_face_create(blob.get(), 0));
+  }
+
+  // Checks that every glyph matches the per call FontHelper lookup.
+  static void CheckMatchesFontHelper(
+      hb_face_t* face, hb_tag_t tag,
+      absl::StatusOr<absl::string_view> (*expected)(const hb_face_t*,
+                                                    uint32_t)) {
+    GlyphDataIndex index(face);
+    ASSERT_TRUE(index.Has(tag));
+    uint32_t glyph_count = hb_face_get_glyph_count(face);
+    for (uint32_t gid = 0; gid < glyph_count; gid++) {
+      auto data = index.GlyphData(tag, gid);
+      auto expected_data = expected(face, gid);
+      ASSERT_TRUE(data.ok()) << data.status();
+      ASSERT_TRUE(expected_data.ok()) << expected_data.status();
+      ASSERT_EQ(*data, *expected_data) << gid;
+    }
+  }
+
+  hb_face_unique_ptr roboto_ab;
+  hb_face_unique_ptr roboto_vf;
+  hb_face_unique_ptr noto_sans_jp_otf;
+  hb_face_unique_ptr noto_sans_ift_ttf;
+};
+
+TEST_F(GlyphDataIndexTest, Glyf_ShortLoca) {
+  CheckMatchesFontHelper(roboto_ab.get(), FontHelper::kGlyf,
+                         FontHelper::GlyfData);
+}
+
+TEST_F(GlyphDataIndexTest, Glyf_LongLoca) {
+  CheckMatchesFontHelper(noto_sans_ift_ttf.get(), FontHelper::kGlyf,
+                         FontHelper::GlyfData);
+}
+
+TEST_F(GlyphDataIndexTest, Gvar) {
+  CheckMatchesFontHelper(roboto_vf.get(), FontHelper::kGvar,
+                         FontHelper::GvarData);
+}
+
+TEST_F(GlyphDataIndexTest, Cff) {
+  CheckMatchesFontHelper(noto_sans_jp_otf.get(), FontHelper::kCFF,
+                         FontHelper::CffCharStringData);
+}
+
+TEST_F(GlyphDataIndexTest, MissingTablesAndGlyphs) {
+  GlyphDataIndex index(roboto_ab.get());
+  ASSERT_TRUE(index.Has(FontHelper::kGlyf));
+  ASSERT_FALSE(index.Has(FontHelper::kGvar));
+  ASSERT_FALSE(index.Has(FontHelper::kCFF));
+  ASSERT_FALSE(index.Has(FontHelper::kCFF2));
+  ASSERT_FALSE(index.Has(kHmtx));
+
+  uint32_t glyph_count = hb_face_get_glyph_count(roboto_ab.get());
+  auto data = index.GlyphData(FontHelper::kGlyf, glyph_count);
+  ASSERT_EQ(data.status(),
+            absl::NotFoundError(absl::StrCat("Entry ", glyph_count,
+                                             " not found in offset table.")));
+
+  data = index.GlyphData(FontHelper::kGvar, 1);
+  ASSERT_TRUE(absl::IsNotFound(data.status())) << data.status();
+
+  data = index.GlyphData(kHmtx, 1);
+  ASSERT_TRUE(absl::IsInvalidArgument(data.status())) << data.status();
+}
+
+TEST_F(GlyphDataIndexTest, AppendGlyphData) {
+  GlyphDataIndex index(roboto_vf.get());
+  absl::btree_set<uint32_t> gids = {1, 2, 3, 10, 40};
+  for (hb_tag_t tag : {FontHelper::kGlyf, FontHelper::kGvar}) {
+    std::vector<absl::string_view> data;
+    auto size = index.AppendGlyphData(tag, gids, data);
+    ASSERT_TRUE(size.ok()) << size.status();
+    ASSERT_EQ(data.size(), gids.size());
+
+    uint64_t expected_size = 0;
+    auto it = data.begin();
+    for (uint32_t gid : gids) {
+      auto expected = index.GlyphData(tag, gid);
+      ASSERT_TRUE(expected.ok()) << expected.status();
+      ASSERT_EQ(*it++, *expected) << gid;
+      expected_size += expected->size();
+    }
+    ASSERT_EQ(*size, expected_size);
+  }
+
+  uint32_t glyph_count = hb_face_get_glyph_count(roboto_vf.get());
+  std::vector<absl::string_view> data;
+  auto size =
+      index.AppendGlyphData(FontHelper::kGlyf, {1, glyph_count}, data);
+  ASSERT_EQ(size.status(),
+            absl::NotFoundError(absl::StrCat("Entry ", glyph_count,
+                                             " not found in offset table.")));
+
+  size = index.AppendGlyphData(FontHelper::kCFF, {1}, data);
+  ASSERT_TRUE(absl::IsNotFound(size.status())) << size.status();
+}
+
+}  // namespace common
@@ -0,0 +1,49 @@
+#include "common/hb_set_key.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#include "absl/hash/hash.h"
+#include "hb.h"
+
+namespace common {
+
+HbSetKey::HbSetKey(const hb_set_t* set) : hash_(HashOf(set)) {
+  hb_codepoint_t first = HB_SET_VALUE_INVALID;
+  hb_codepoint_t last = HB_SET_VALUE_INVALID;
+  while (hb_set_next_range(set, &first, &last)) {
+    ranges_.push_back(first);
+    ranges_.push_back(last);
+  }
+}
+
+size_t HbSetKey::HashOf(const hb_set_t* set) {
+  size_t hash = absl::HashOf(hb_set_get_population(set));
+  hb_codepoint_t first = HB_SET_VALUE_INVALID;
+  hb_codepoint_t last = HB_SET_VALUE_INVALID;
+  while (hb_set_next_range(set, &first, &last)) {
+    hash = absl::HashOf(hash, first, last);
+  }
+  return hash;
+}
+
+bool HbSetKey::Equals(const hb_set_t* set) const {
+  hb_codepoint_t first = HB_SET_VALUE_INVALID;
+  hb_codepoint_t last = HB_SET_VALUE_INVALID;
+  auto it = ranges_.begin();
+  while (hb_set_next_range(set, &first, &last)) {
+    if (it == ranges_.end() || *it != first || *(it + 1) != last) {
+      return false;
+    }
+    it += 2;
+  }
+  return it == ranges_.end();
+}
+
+void HbSetKey::AddTo(hb_set_t* out) const {
+  for (auto it = ranges_.begin(); it != ranges_.end(); it += 2) {
+    hb_set_add_range(out, *it, *(it + 1));
+  }
+}
+
+}  // namespace common
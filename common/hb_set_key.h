@@ -0,0 +1,82 @@
+#ifndef COMMON_HB_SET_KEY_H_
+#define COMMON_HB_SET_KEY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "hb.h"
+
+namespace common {
+
+/*
+ * An immutable copy of the contents of an hb_set_t that can be used as a hash
+ * map key.
+ *
+ * The set is stored as a list of ranges which is compact for the mostly
+ * contiguous sets typical of unicode codepoint segments and glyph closures.
+ * The hash is computed once on construction.
+ */
+class HbSetKey {
+ public:
+  explicit HbSetKey(const hb_set_t* set);
+
+  // Hash of the contents of set, matches HbSetKey(set).Hash().
+  static size_t HashOf(const hb_set_t* set);
+
+  size_t Hash() const { return hash_; }
+
+  // Returns true if this key has the same contents as set.
+  bool Equals(const hb_set_t* set) const;
+
+  // Adds the contents of this key to out.
+  void AddTo(hb_set_t* out) const;
+
+  bool operator==(const HbSetKey& other) const {
+    return hash_ == other.hash_ && ranges_ == other.ranges_;
+  }
+
+ private:
+  // Pairs of inclusive (first, last) values.
+  std::vector<hb_codepoint_t> ranges_;
+  size_t hash_;
+};
+
+/*
+ * A non owning reference to an hb_set_t, used to probe maps keyed by HbSetKey
+ * without having to copy the set into a key.
+ */
+struct HbSetRef {
+  explicit HbSetRef(const hb_set_t* set_)
+      : set(set_), hash(HbSetKey::HashOf(set_)) {}
+
+  const hb_set_t* set;
+  size_t hash;
+};
+
+struct HbSetKeyHash {
+  using is_transparent = void;
+
+  size_t operator()(const HbSetKey& key) const { return key.Hash(); }
+  size_t operator()(const HbSetRef& ref) const { return ref.hash; }
+};
+
+struct HbSetKeyEq {
+  using is_transparent = void;
+
+  bool operator()(const HbSetKey& a, const HbSetKey& b) const { return a == b; }
+  bool operator()(const HbSetKey& a, const HbSetRef& b) const {
+    return a.Hash() == b.hash && a.Equals(b.set);
+  }
+  bool operator()(const HbSetRef& a, const HbSetKey& b) const {
+    return (*this)(b, a);
+  }
+};
+
+template <typename V>
+using HbSetKeyMap = absl::flat_hash_map<HbSetKey, V, HbSetKeyHash, HbSetKeyEq>;
+
+}  // namespace common
+
+#endif  // COMMON_HB_SET_KEY_H_
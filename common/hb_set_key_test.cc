@@ -0,0 +1,60 @@
+#include "common/hb_set_key.h"
+
+#include "common/hb_set_unique_ptr.h"
+#include "gtest/gtest.h"
+
+namespace common {
+
+class HbSetKeyTest : public ::testing::Test {};
+
+TEST_F(HbSetKeyTest, Equality) {
+  auto a = make_hb_set_from_ranges(2, 1, 5, 10, 10);
+  auto b = make_hb_set(6, 1, 2, 3, 4, 5, 10);
+  auto c = make_hb_set(5, 1, 2, 3, 4, 5);
+  auto empty = make_hb_set();
+
+  ASSERT_EQ(HbSetKey(a.get()), HbSetKey(b.get()));
+  ASSERT_EQ(HbSetKey(a.get()).Hash(), HbSetKey(b.get()).Hash());
+  ASSERT_EQ(HbSetKey(a.get()).Hash(), HbSetKey::HashOf(b.get()));
+  ASSERT_FALSE(HbSetKey(a.get()) == HbSetKey(c.get()));
+  ASSERT_FALSE(HbSetKey(a.get()) == HbSetKey(empty.get()));
+  ASSERT_EQ(HbSetKey(empty.get()), HbSetKey(empty.get()));
+
+  ASSERT_TRUE(HbSetKey(a.get()).Equals(b.get()));
+  ASSERT_FALSE(HbSetKey(a.get()).Equals(c.get()));
+  ASSERT_FALSE(HbSetKey(c.get()).Equals(a.get()));
+  ASSERT_FALSE(HbSetKey(a.get()).Equals(empty.get()));
+  ASSERT_TRUE(HbSetKey(empty.get()).Equals(empty.get()));
+}
+
+TEST_F(HbSetKeyTest, MapLookup) {
+  auto a = make_hb_set(3, 1, 2, 3);
+  auto b = make_hb_set(2, 7, 9);
+  auto c = make_hb_set(2, 7, 8);
+
+  HbSetKeyMap<int> map;
+  map.insert(std::pair(HbSetKey(a.get()), 1));
+  map.insert(std::pair(HbSetKey(b.get()), 2));
+
+  auto it = map.find(HbSetRef(a.get()));
+  ASSERT_NE(it, map.end());
+  ASSERT_EQ(it->second, 1);
+
+  it = map.find(HbSetRef(b.get()));
+  ASSERT_NE(it, map.end());
+  ASSERT_EQ(it->second, 2);
+
+  ASSERT_EQ(map.find(HbSetRef(c.get())), map.end());
+  ASSERT_EQ(map.find(HbSetKey(c.get())), map.end());
+}
+
+TEST_F(HbSetKeyTest, AddTo) {
+  auto a = make_hb_set_from_ranges(2, 1, 5, 10, 10);
+  auto out = make_hb_set(1, 7);
+  HbSetKey(a.get()).AddTo(out.get());
+
+  auto expected = make_hb_set(7, 1, 2, 3, 4, 5, 7, 10);
+  ASSERT_TRUE(hb_set_is_equal(out.get(), expected.get()));
+}
+
+}  // namespace common
@@ -1,7 +1,10 @@
 #include "common/hb_set_unique_ptr.h"
 
+#include <algorithm>
 #include <cstdarg>
+#include <cstdint>
 #include <memory>
+#include <vector>
 
 #include "hb.h"
 
@@ -20,12 +23,27 @@ hb_set_unique_ptr make_hb_set(hb_set_t* set) {
 
 hb_set_unique_ptr make_hb_set(const absl::flat_hash_set<uint32_t>& int_set) {
   hb_set_unique_ptr out = make_hb_set();
-  for (uint32_t v : int_set) {
-    hb_set_add(out.get(), v);
-  }
+  add_to_hb_set(int_set, out.get());
+  return out;
+}
+
+hb_set_unique_ptr make_hb_set(const absl::btree_set<uint32_t>& int_set) {
+  hb_set_unique_ptr out = make_hb_set();
+  add_to_hb_set(int_set, out.get());
   return out;
 }
 
+void add_to_hb_set(const flat_hash_set<uint32_t>& values, hb_set_t* set) {
+  std::vector<hb_codepoint_t> sorted(values.begin(), values.end());
+  std::sort(sorted.begin(), sorted.end());
+  hb_set_add_sorted_array(set, sorted.data(), sorted.size());
+}
+
+void add_to_hb_set(const btree_set<uint32_t>& values, hb_set_t* set) {
+  std::vector<hb_codepoint_t> sorted(values.begin(), values.end());
+  hb_set_add_sorted_array(set, sorted.data(), sorted.size());
+}
+
 hb_set_unique_ptr make_hb_set(int length, ...) {
   hb_set_unique_ptr result = make_hb_set();
   va_list values;
@@ -56,18 +74,29 @@ hb_set_unique_ptr make_hb_set_from_ranges(int number_of_ranges, ...) {
 
 flat_hash_set<uint32_t> to_hash_set(const hb_set_t* set) {
   flat_hash_set<uint32_t> out;
-  hb_codepoint_t v = HB_SET_VALUE_INVALID;
-  while (hb_set_next(set, &v)) {
-    out.insert(v);
+  out.reserve(hb_set_get_population(set));
+  hb_codepoint_t first = HB_SET_VALUE_INVALID;
+  hb_codepoint_t last = HB_SET_VALUE_INVALID;
+  while (hb_set_next_range(set, &first, &last)) {
+    for (uint64_t v = first; v <= last; v++) {
+      out.insert(v);
+    }
   }
   return out;
 }
 
 btree_set<uint32_t> to_btree_set(const hb_set_t* set) {
+  // Values come out in increasing order so each can be appended at the end.
   btree_set<uint32_t> out;
-  hb_codepoint_t v = HB_SET_VALUE_INVALID;
-  while (hb_set_next(set, &v)) {
-    out.insert(v);
+  constexpr unsigned kBatch = 256;
+  hb_codepoint_t values[kBatch];
+  hb_codepoint_t next = HB_SET_VALUE_INVALID;
+  unsigned count;
+  while ((count = hb_set_next_many(set, next, values, kBatch))) {
+    for (unsigned i = 0; i < count; i++) {
+      out.insert(out.end(), values[i]);
+    }
+    next = values[count - 1];
   }
   return out;
 }
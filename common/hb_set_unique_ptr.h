@@ -18,12 +18,20 @@ hb_set_unique_ptr make_hb_set(hb_set_t* set);
 
 hb_set_unique_ptr make_hb_set(const absl::flat_hash_set<uint32_t>& int_set);
 
+hb_set_unique_ptr make_hb_set(const absl::btree_set<uint32_t>& int_set);
+
 hb_set_unique_ptr make_hb_set(int length, ...);
 
 hb_set_unique_ptr make_hb_set_from_ranges(int number_of_ranges, ...);
 
 hb_set_unique_ptr make_hb_set(int length, ...);
 
+// Adds all values to set. Values are added in bulk as a sorted array rather
+// than one at a time.
+void add_to_hb_set(const absl::flat_hash_set<uint32_t>& values, hb_set_t* set);
+
+void add_to_hb_set(const absl::btree_set<uint32_t>& values, hb_set_t* set);
+
 absl::flat_hash_set<uint32_t> to_hash_set(const hb_set_t* set);
 
 absl::btree_set<uint32_t> to_btree_set(const hb_set_t* set);
@@ -0,0 +1,56 @@
+#include "common/hb_set_unique_ptr.h"
+
+#include <cstdint>
+
+#include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_set.h"
+#include "gtest/gtest.h"
+
+using absl::btree_set;
+using absl::flat_hash_set;
+
+namespace common {
+
+class HbSetUniquePtrTest : public ::testing::Test {};
+
+TEST_F(HbSetUniquePtrTest, ToContainers) {
+  auto set = make_hb_set_from_ranges(3, 1, 3, 7, 7, 300, 1000);
+
+  btree_set<uint32_t> expected = {1, 2, 3, 7};
+  for (uint32_t v = 300; v <= 1000; v++) {
+    expected.insert(v);
+  }
+  ASSERT_EQ(to_btree_set(set.get()), expected);
+  ASSERT_EQ(to_hash_set(set.get()),
+            flat_hash_set<uint32_t>(expected.begin(), expected.end()));
+
+  auto empty = make_hb_set();
+  ASSERT_TRUE(to_btree_set(empty.get()).empty());
+  ASSERT_TRUE(to_hash_set(empty.get()).empty());
+
+  // The largest value isn't mistaken for the end of the set.
+  auto max = make_hb_set(2, 5, HB_SET_VALUE_INVALID - 1);
+  ASSERT_EQ(to_btree_set(max.get()),
+            (btree_set<uint32_t>{5, HB_SET_VALUE_INVALID - 1}));
+  ASSERT_EQ(to_hash_set(max.get()),
+            (flat_hash_set<uint32_t>{5, HB_SET_VALUE_INVALID - 1}));
+}
+
+TEST_F(HbSetUniquePtrTest, FromContainers) {
+  auto expected = make_hb_set(5, 2, 9, 10, 11, 500);
+
+  auto from_hash = make_hb_set(flat_hash_set<uint32_t>{500, 10, 2, 11, 9});
+  ASSERT_TRUE(hb_set_is_equal(from_hash.get(), expected.get()));
+
+  auto from_btree = make_hb_set(btree_set<uint32_t>{2, 9, 10, 11, 500});
+  ASSERT_TRUE(hb_set_is_equal(from_btree.get(), expected.get()));
+
+  // Adding keeps the existing values.
+  auto set = make_hb_set(1, 1);
+  add_to_hb_set(flat_hash_set<uint32_t>{3, 2}, set.get());
+  add_to_hb_set(btree_set<uint32_t>{}, set.get());
+  add_to_hb_set(btree_set<uint32_t>{4}, set.get());
+  ASSERT_EQ(to_btree_set(set.get()), (btree_set<uint32_t>{1, 2, 3, 4}));
+}
+
+}  // namespace common
@@ -3,6 +3,8 @@
 
 #include <cstdint>
 
+#include "absl/base/internal/endian.h"
+#include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
@@ -13,54 +15,111 @@ namespace common {
  * Helper class to read indexed data from a font. Indexed data
  * is data that has been segmented into chunks which are listed
  * in an offset table (for example loca + glyf).
+ *
+ * By default every lookup checks the offsets it reads. If Validate() succeeds
+ * the whole offset table has been checked, so later lookups only check that
+ * the requested ids are present.
  */
 template <typename offset_type, int offset_multiplier>
 class IndexedDataReader {
+  static constexpr uint32_t width = sizeof(offset_type);
+  static_assert(width == 1 || width == 2 || width == 4,
+                "offset_type must be 1, 2, or 4 bytes wide.");
+
  public:
   IndexedDataReader(absl::string_view offsets, absl::string_view data)
       : offsets_(offsets), data_(data) {}
 
-  absl::StatusOr<absl::string_view> DataFor(uint32_t id) const {
-    constexpr int width = sizeof(offset_type);
+  // The number of entries which can be looked up.
+  uint32_t size() const {
+    uint64_t num_offsets = offsets_.size() / width;
+    return num_offsets ? num_offsets - 1 : 0;
+  }
 
-    uint32_t start_index = id * width;
-    uint32_t end_index = (id + 1) * width;
-    if (end_index + width > offsets_.size()) {
+  /*
+   * Checks every offset in the table, on success later lookups skip the
+   * offset checks.
+   */
+  absl::Status Validate() {
+    uint32_t num_offsets = size() ? size() + 1 : 0;
+    uint32_t previous = 0;
+    for (uint32_t i = 0; i < num_offsets; i++) {
+      uint32_t offset = Offset(i);
+      if (offset < previous) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "Invalid index. end (", offset, ") < start (", previous,
+            "), width = ", width, "."));
+      }
+      if (offset > data_.size()) {
+        return absl::InvalidArgumentError("Data offsets exceed data size.");
+      }
+      previous = offset;
+    }
+    validated_ = true;
+    return absl::OkStatus();
+  }
+
+  absl::StatusOr<absl::string_view> DataFor(uint32_t id) const {
+    if (id >= size()) {
       return absl::NotFoundError(
           absl::StrCat("Entry ", id, " not found in offset table."));
     }
+    return Data(id, id + 1);
+  }
 
-    uint32_t start_offset =
-        ((uint32_t)ReadValue(start_index, offsets_)) * offset_multiplier;
-    uint32_t end_offset =
-        ((uint32_t)ReadValue(end_index, offsets_)) * offset_multiplier;
-    if (end_offset < start_offset) {
-      return absl::InvalidArgumentError(
-          absl::StrCat("Invalid index. end (", end_offset, ") < start (",
-                       start_offset, "), width = ", width, "."));
+  /*
+   * Returns the data for the entries [begin, end), which is contiguous since
+   * the offsets must be in increasing order.
+   */
+  absl::StatusOr<absl::string_view> DataForRange(uint32_t begin,
+                                                 uint32_t end) const {
+    if (begin > end || end > size()) {
+      return absl::NotFoundError(absl::StrCat(
+          "Entries [", begin, ", ", end, ") not found in offset table."));
     }
+    return Data(begin, end);
+  }
+
+ private:
+  // Caller must ensure begin and end are in bounds of the offset table.
+  absl::StatusOr<absl::string_view> Data(uint32_t begin, uint32_t end) const {
+    uint32_t start_offset = Offset(begin);
+    uint32_t end_offset = Offset(end);
+    if (!validated_) {
+      if (end_offset < start_offset) {
+        return absl::InvalidArgumentError(
+            absl::StrCat("Invalid index. end (", end_offset, ") < start (",
+                         start_offset, "), width = ", width, "."));
+      }
 
-    if (end_offset > data_.size()) {
-      return absl::InvalidArgumentError("Data offsets exceed data size.");
+      if (end_offset > data_.size()) {
+        return absl::InvalidArgumentError("Data offsets exceed data size.");
+      }
     }
 
     return data_.substr(start_offset, end_offset - start_offset);
   }
 
- private:
-  offset_type ReadValue(uint32_t index, absl::string_view offsets) const {
-    uint32_t value = 0;
-    for (uint32_t i = 0; i < sizeof(offset_type); i++) {
-      uint8_t v = offsets[index + i];
-      value |= ((uint32_t)v) << (8 * (sizeof(offset_type) - i - 1));
+  uint32_t Offset(uint32_t index) const {
+    return ReadValue(offsets_.data() + (uint64_t)index * width) *
+           offset_multiplier;
+  }
+
+  static uint32_t ReadValue(const char* value) {
+    if constexpr (width == 4) {
+      return absl::big_endian::Load32(value);
+    } else if constexpr (width == 2) {
+      return absl::big_endian::Load16(value);
+    } else {
+      return (uint8_t)*value;
     }
-    return value;
   }
 
   absl::string_view offsets_;
   absl::string_view data_;
+  bool validated_ = false;
 };
 
 }  // namespace common
 
-#endif  // COMMON_INDEXED_DATA_READER_H_
\ No newline at end of file
+#endif  // COMMON_INDEXED_DATA_READER_H_
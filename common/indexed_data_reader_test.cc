@@ -123,4 +123,47 @@ TEST_F(IndexedDataReaderTest, BadIndex) {
   ASSERT_TRUE(absl::IsInvalidArgument(data.status())) << data.status();
 }
 
-}  // namespace common
\ No newline at end of file
+TEST_F(IndexedDataReaderTest, DataForRange) {
+  ASSERT_EQ(short_reader.size(), 4);
+
+  auto data = short_reader.DataForRange(0, 2);
+  ASSERT_TRUE(data.ok()) << data.status();
+  ASSERT_EQ(*data, "00010203040506");
+
+  data = short_reader.DataForRange(1, 4);
+  ASSERT_TRUE(data.ok()) << data.status();
+  ASSERT_EQ(*data, "03040506070809");
+
+  data = wide_reader.DataForRange(2, 2);
+  ASSERT_TRUE(data.ok()) << data.status();
+  ASSERT_EQ(*data, "");
+
+  data = short_reader.DataForRange(3, 5);
+  ASSERT_TRUE(absl::IsNotFound(data.status())) << data.status();
+  data = short_reader.DataForRange(2, 1);
+  ASSERT_TRUE(absl::IsNotFound(data.status())) << data.status();
+}
+
+TEST_F(IndexedDataReaderTest, Validate) {
+  IndexedDataReader<uint32_t, 1> reader(
+      string_view((const char*)wide_index, 20), data);
+  ASSERT_TRUE(reader.Validate().ok());
+
+  auto entry = reader.DataFor(3);
+  ASSERT_TRUE(entry.ok()) << entry.status();
+  ASSERT_EQ(*entry, "070809");
+  entry = reader.DataFor(4);
+  ASSERT_TRUE(absl::IsNotFound(entry.status())) << entry.status();
+
+  IndexedDataReader<uint16_t, 2> bad_data(
+      string_view((const char*)short_index, 10), string_view(data, 7));
+  ASSERT_TRUE(absl::IsInvalidArgument(bad_data.Validate()));
+
+  IndexedDataReader<uint16_t, 2> bad_index_reader(
+      string_view((const char*)bad_index, 10), data);
+  ASSERT_TRUE(absl::IsInvalidArgument(bad_index_reader.Validate()));
+  // Lookups are still checked after a failed validation.
+  ASSERT_TRUE(absl::IsInvalidArgument(bad_index_reader.DataFor(1).status()));
+}
+
+}  // namespace common
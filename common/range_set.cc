@@ -0,0 +1,191 @@
+#include "common/range_set.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/types/span.h"
+
+using absl::Span;
+using std::vector;
+
+namespace common {
+
+static uint64_t RangeSize(const RangeSet::Range& range) {
+  return (uint64_t)range.last - range.first + 1;
+}
+
+bool RangeSet::contains(uint32_t value) const {
+  Span<const Range> ranges = Ranges();
+  // First range starting after value, the one before it is the only one
+  // that could contain value.
+  auto it = std::upper_bound(
+      ranges.begin(), ranges.end(), value,
+      [](uint32_t value, const Range& range) { return value < range.first; });
+  return it != ranges.begin() && (it - 1)->last >= value;
+}
+
+void RangeSet::AddRange(uint32_t first, uint32_t last) {
+  if (first > last) {
+    return;
+  }
+
+  vector<Range>& ranges = MutableRanges();
+  if (ranges.empty() || (uint64_t)ranges.back().last + 1 < first) {
+    // Fast path for values added in ascending order.
+    ranges.push_back({first, last});
+    size_ += RangeSize(ranges.back());
+    return;
+  }
+  if (first >= ranges.back().first) {
+    // Only overlaps or extends the last range.
+    if (last > ranges.back().last) {
+      size_ += last - ranges.back().last;
+      ranges.back().last = last;
+    }
+    return;
+  }
+
+  // Ranges in [start, end) overlap or are adjacent to [first, last] and are
+  // merged with it.
+  auto start = std::lower_bound(ranges.begin(), ranges.end(), first,
+                                [](const Range& range, uint32_t first) {
+                                  return (uint64_t)range.last + 1 < first;
+                                });
+  auto end = std::upper_bound(start, ranges.end(), last,
+                              [](uint32_t last, const Range& range) {
+                                return (uint64_t)last + 1 < range.first;
+                              });
+  if (start == end) {
+    ranges.insert(start, {first, last});
+    size_ += (uint64_t)last - first + 1;
+    return;
+  }
+
+  Range merged{std::min(first, start->first),
+               std::max(last, (end - 1)->last)};
+  for (auto it = start; it != end; ++it) {
+    size_ -= RangeSize(*it);
+  }
+  size_ += RangeSize(merged);
+  *start = merged;
+  ranges.erase(start + 1, end);
+}
+
+void RangeSet::InsertSorted(Span<const uint32_t> values) {
+  auto it = values.begin();
+  while (it != values.end()) {
+    // Collapse each run of consecutive values into a single range.
+    uint32_t first = *it;
+    uint32_t last = first;
+    for (++it; it != values.end() && *it <= (uint64_t)last + 1; ++it) {
+      last = *it;
+    }
+    AddRange(first, last);
+  }
+}
+
+bool RangeSet::Intersects(const RangeSet& other) const {
+  Span<const Range> a = Ranges();
+  Span<const Range> b = other.Ranges();
+  auto a_it = a.begin();
+  auto b_it = b.begin();
+  while (a_it != a.end() && b_it != b.end()) {
+    if (a_it->last < b_it->first) {
+      ++a_it;
+    } else if (b_it->last < a_it->first) {
+      ++b_it;
+    } else {
+      return true;
+    }
+  }
+  return false;
+}
+
+void RangeSet::Union(const RangeSet& other) {
+  if (other.empty()) {
+    return;
+  }
+  if (empty()) {
+    *this = other;
+    return;
+  }
+
+  Span<const Range> a = Ranges();
+  Span<const Range> b = other.Ranges();
+  auto merged = std::make_shared<vector<Range>>();
+  merged->reserve(a.size() + b.size());
+  size_t size = 0;
+  auto a_it = a.begin();
+  auto b_it = b.begin();
+  while (a_it != a.end() || b_it != b.end()) {
+    // Take whichever range starts first, then merge it into the last output
+    // range if they overlap or touch.
+    const Range& next = (b_it == b.end() ||
+                         (a_it != a.end() && a_it->first <= b_it->first))
+                            ? *a_it++
+                            : *b_it++;
+    if (!merged->empty() && (uint64_t)merged->back().last + 1 >= next.first) {
+      if (next.last > merged->back().last) {
+        size += next.last - merged->back().last;
+        merged->back().last = next.last;
+      }
+      continue;
+    }
+    merged->push_back(next);
+    size += RangeSize(next);
+  }
+
+  ranges_ = std::move(merged);
+  size_ = size;
+}
+
+void RangeSet::Subtract(const RangeSet& other) {
+  if (empty() || other.empty() || !Intersects(other)) {
+    return;
+  }
+
+  Span<const Range> a = Ranges();
+  Span<const Range> b = other.Ranges();
+  auto remaining = std::make_shared<vector<Range>>();
+  remaining->reserve(a.size() + b.size());
+  size_t size = 0;
+  auto b_it = b.begin();
+  for (const Range& range : a) {
+    uint64_t first = range.first;
+    // Ranges of b which end before this range can't affect later ones.
+    while (b_it != b.end() && b_it->last < first) {
+      ++b_it;
+    }
+    for (auto it = b_it; it != b.end() && it->first <= range.last; ++it) {
+      if (it->first > first) {
+        remaining->push_back({(uint32_t)first, it->first - 1});
+        size += RangeSize(remaining->back());
+      }
+      first = (uint64_t)it->last + 1;
+    }
+    if (first <= range.last) {
+      remaining->push_back({(uint32_t)first, range.last});
+      size += RangeSize(remaining->back());
+    }
+  }
+
+  if (remaining->empty()) {
+    clear();
+    return;
+  }
+  ranges_ = std::move(remaining);
+  size_ = size;
+}
+
+vector<RangeSet::Range>& RangeSet::MutableRanges() {
+  if (!ranges_) {
+    ranges_ = std::make_shared<vector<Range>>();
+  } else if (ranges_.use_count() > 1) {
+    ranges_ = std::make_shared<vector<Range>>(*ranges_);
+  }
+  return *ranges_;
+}
+
+}  // namespace common
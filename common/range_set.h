@@ -0,0 +1,176 @@
+#ifndef COMMON_RANGE_SET_H_
+#define COMMON_RANGE_SET_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/types/span.h"
+
+namespace common {
+
+/*
+ * A set of uint32_t values stored as a sorted list of disjoint inclusive
+ * ranges, which is compact for the mostly contiguous sets typical of unicode
+ * codepoint segments.
+ *
+ * Copies share the underlying ranges, which are only duplicated when a shared
+ * set is modified. So a set can be handed to many owners (for example patch
+ * map entries) for the cost of a reference count.
+ *
+ * Iteration visits values in ascending order.
+ */
+class RangeSet {
+ public:
+  struct Range {
+    uint32_t first;
+    uint32_t last;
+
+    bool operator==(const Range& other) const {
+      return first == other.first && last == other.last;
+    }
+  };
+
+  class const_iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = uint32_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const uint32_t*;
+    using reference = uint32_t;
+
+    const_iterator() = default;
+
+    uint32_t operator*() const { return value_; }
+
+    const_iterator& operator++() {
+      if (value_ == range_->last) {
+        ++range_;
+        value_ = range_ != end_ ? range_->first : 0;
+      } else {
+        value_++;
+      }
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      const_iterator prev = *this;
+      ++*this;
+      return prev;
+    }
+
+    bool operator==(const const_iterator& other) const {
+      return range_ == other.range_ && value_ == other.value_;
+    }
+    bool operator!=(const const_iterator& other) const {
+      return !(*this == other);
+    }
+
+   private:
+    friend class RangeSet;
+
+    const_iterator(const Range* range, const Range* end)
+        : range_(range), end_(end), value_(range != end ? range->first : 0) {}
+
+    const Range* range_ = nullptr;
+    const Range* end_ = nullptr;
+    uint32_t value_ = 0;
+  };
+  using iterator = const_iterator;
+
+  RangeSet() = default;
+  RangeSet(std::initializer_list<uint32_t> values) {
+    insert(values.begin(), values.end());
+  }
+
+  // Values may be in any order.
+  template <typename It>
+  RangeSet(It begin, It end) {
+    insert(begin, end);
+  }
+
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+  bool contains(uint32_t value) const;
+
+  const_iterator begin() const {
+    absl::Span<const Range> ranges = Ranges();
+    return const_iterator(ranges.data(), ranges.data() + ranges.size());
+  }
+  const_iterator end() const {
+    absl::Span<const Range> ranges = Ranges();
+    return const_iterator(ranges.data() + ranges.size(),
+                          ranges.data() + ranges.size());
+  }
+
+  void insert(uint32_t value) { AddRange(value, value); }
+
+  template <typename It>
+  void insert(It begin, It end) {
+    std::vector<uint32_t> values(begin, end);
+    std::sort(values.begin(), values.end());
+    InsertSorted(values);
+  }
+
+  // Adds all values in [first, last].
+  void AddRange(uint32_t first, uint32_t last);
+
+  void clear() {
+    ranges_.reset();
+    size_ = 0;
+  }
+
+  // The sorted, disjoint and non adjacent ranges in this set.
+  absl::Span<const Range> Ranges() const {
+    if (!ranges_) {
+      return {};
+    }
+    return *ranges_;
+  }
+
+  // Returns true if this and other have at least one value in common.
+  bool Intersects(const RangeSet& other) const;
+
+  // Adds all values of other to this set. Runs in time linear in the number
+  // of ranges of both sets; if this set is empty it shares other's ranges.
+  void Union(const RangeSet& other);
+
+  // Removes all values of other from this set. Runs in time linear in the
+  // number of ranges of both sets.
+  void Subtract(const RangeSet& other);
+
+  bool operator==(const RangeSet& other) const {
+    return size_ == other.size_ &&
+           (ranges_ == other.ranges_ || Ranges() == other.Ranges());
+  }
+  bool operator!=(const RangeSet& other) const { return !(*this == other); }
+
+  template <typename H>
+  friend H AbslHashValue(H h, const RangeSet& set) {
+    h = H::combine(std::move(h), set.size_);
+    for (const Range& range : set.Ranges()) {
+      h = H::combine(std::move(h), range.first, range.last);
+    }
+    return h;
+  }
+
+ private:
+  void InsertSorted(absl::Span<const uint32_t> values);
+
+  // Returns the ranges for modification, making a private copy first if they
+  // are shared with another set.
+  std::vector<Range>& MutableRanges();
+
+  // Null when the set is empty.
+  std::shared_ptr<std::vector<Range>> ranges_;
+  size_t size_ = 0;
+};
+
+}  // namespace common
+
+#endif  // COMMON_RANGE_SET_H_
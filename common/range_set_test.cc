@@ -0,0 +1,208 @@
+#include "common/range_set.h"
+
+#include <cstdint>
+#include <set>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "gtest/gtest.h"
+
+using std::vector;
+
+namespace common {
+
+class RangeSetTest : public ::testing::Test {};
+
+static vector<RangeSet::Range> Ranges(const RangeSet& set) {
+  return vector<RangeSet::Range>(set.Ranges().begin(), set.Ranges().end());
+}
+
+static vector<uint32_t> Values(const RangeSet& set) {
+  return vector<uint32_t>(set.begin(), set.end());
+}
+
+TEST_F(RangeSetTest, Empty) {
+  RangeSet set;
+  ASSERT_TRUE(set.empty());
+  ASSERT_EQ(set.size(), 0);
+  ASSERT_FALSE(set.contains(0));
+  ASSERT_EQ(set.begin(), set.end());
+  ASSERT_EQ(set, RangeSet{});
+}
+
+TEST_F(RangeSetTest, Insert) {
+  RangeSet set{5, 1, 2, 3, 10, 4};
+  ASSERT_EQ(Ranges(set), (vector<RangeSet::Range>{{1, 5}, {10, 10}}));
+  ASSERT_EQ(set.size(), 6);
+  ASSERT_EQ(Values(set), (vector<uint32_t>{1, 2, 3, 4, 5, 10}));
+
+  set.insert(7);
+  ASSERT_EQ(Ranges(set), (vector<RangeSet::Range>{{1, 5}, {7, 7}, {10, 10}}));
+
+  // Bridges the gaps on both sides.
+  set.insert(6);
+  set.AddRange(8, 9);
+  ASSERT_EQ(Ranges(set), (vector<RangeSet::Range>{{1, 10}}));
+  ASSERT_EQ(set.size(), 10);
+
+  // Already present.
+  set.insert(3);
+  set.AddRange(2, 8);
+  ASSERT_EQ(set.size(), 10);
+
+  set.AddRange(0, 20);
+  ASSERT_EQ(Ranges(set), (vector<RangeSet::Range>{{0, 20}}));
+  ASSERT_EQ(set.size(), 21);
+
+  set.AddRange(0xFFFFFFFE, 0xFFFFFFFF);
+  ASSERT_TRUE(set.contains(0xFFFFFFFF));
+  ASSERT_EQ(set.size(), 23);
+  ASSERT_EQ(Values(set).back(), 0xFFFFFFFF);
+
+  set.clear();
+  ASSERT_TRUE(set.empty());
+  ASSERT_EQ(set.begin(), set.end());
+}
+
+TEST_F(RangeSetTest, Contains) {
+  RangeSet set{1, 2, 3, 7, 9, 10};
+  for (uint32_t v : {1, 2, 3, 7, 9, 10}) {
+    ASSERT_TRUE(set.contains(v)) << v;
+  }
+  for (uint32_t v : {0, 4, 6, 8, 11}) {
+    ASSERT_FALSE(set.contains(v)) << v;
+  }
+}
+
+TEST_F(RangeSetTest, FromContainer) {
+  absl::flat_hash_set<uint32_t> values{9, 3, 2, 100, 1, 4};
+  RangeSet set(values.begin(), values.end());
+  ASSERT_EQ(set, (RangeSet{1, 2, 3, 4, 9, 100}));
+  ASSERT_NE(set, (RangeSet{1, 2, 3, 4, 9}));
+  ASSERT_NE(set, (RangeSet{1, 2, 3, 4, 9, 101}));
+}
+
+TEST_F(RangeSetTest, CopiesAreIndependent) {
+  RangeSet a{1, 2, 3};
+  RangeSet b = a;
+  ASSERT_EQ(a, b);
+
+  b.insert(10);
+  ASSERT_EQ(Values(a), (vector<uint32_t>{1, 2, 3}));
+  ASSERT_EQ(Values(b), (vector<uint32_t>{1, 2, 3, 10}));
+
+  RangeSet c = b;
+  c.clear();
+  ASSERT_EQ(b.size(), 4);
+}
+
+TEST_F(RangeSetTest, Intersects) {
+  RangeSet a{1, 2, 3, 20};
+  ASSERT_TRUE(a.Intersects(RangeSet{3}));
+  ASSERT_TRUE(a.Intersects(RangeSet{10, 20}));
+  ASSERT_FALSE(a.Intersects(RangeSet{0, 4, 19, 21}));
+  ASSERT_FALSE(a.Intersects(RangeSet{}));
+  ASSERT_FALSE(RangeSet{}.Intersects(a));
+}
+
+TEST_F(RangeSetTest, Union) {
+  RangeSet a{1, 2, 3, 10, 20};
+  a.Union(RangeSet{4, 5, 9, 30, 0xFFFFFFFF});
+  ASSERT_EQ(Ranges(a), (vector<RangeSet::Range>{
+                           {1, 5}, {9, 10}, {20, 20}, {30, 30},
+                           {0xFFFFFFFF, 0xFFFFFFFF}}));
+  ASSERT_EQ(a.size(), 10);
+
+  // Unioning into an empty set shares the other set's ranges.
+  RangeSet b;
+  b.Union(a);
+  ASSERT_EQ(b, a);
+  b.insert(15);
+  ASSERT_FALSE(a.contains(15));
+
+  b.Union(RangeSet{});
+  ASSERT_EQ(b.size(), 11);
+}
+
+TEST_F(RangeSetTest, Subtract) {
+  RangeSet a{1, 2, 3, 4, 5, 10, 11, 12, 20};
+  RangeSet shared = a;
+  a.Subtract(RangeSet{0, 3, 11, 12, 13, 20});
+  ASSERT_EQ(Ranges(a),
+            (vector<RangeSet::Range>{{1, 2}, {4, 5}, {10, 10}}));
+  ASSERT_EQ(a.size(), 5);
+  ASSERT_EQ(shared.size(), 9);
+
+  a.Subtract(RangeSet{100});
+  ASSERT_EQ(a.size(), 5);
+  a.Subtract(RangeSet{1, 2, 4, 5, 10});
+  ASSERT_TRUE(a.empty());
+  ASSERT_EQ(a, RangeSet{});
+}
+
+TEST_F(RangeSetTest, RandomUnionAndSubtract) {
+  unsigned int seed = 7;
+  auto random_set = [&](RangeSet& set, std::set<uint32_t>& values) {
+    for (int j = 0; j < 50; j++) {
+      uint32_t first = rand_r(&seed) % 500;
+      uint32_t last = first + rand_r(&seed) % 8;
+      set.AddRange(first, last);
+      for (uint32_t v = first; v <= last; v++) {
+        values.insert(v);
+      }
+    }
+  };
+
+  for (int i = 0; i < 100; i++) {
+    RangeSet a, b;
+    std::set<uint32_t> a_values, b_values;
+    random_set(a, a_values);
+    random_set(b, b_values);
+
+    RangeSet united = a;
+    united.Union(b);
+    std::set<uint32_t> expected = a_values;
+    expected.insert(b_values.begin(), b_values.end());
+    ASSERT_EQ(Values(united),
+              vector<uint32_t>(expected.begin(), expected.end()));
+    ASSERT_EQ(united.size(), expected.size());
+
+    RangeSet difference = a;
+    difference.Subtract(b);
+    expected.clear();
+    for (uint32_t v : a_values) {
+      if (!b_values.contains(v)) {
+        expected.insert(v);
+      }
+    }
+    ASSERT_EQ(Values(difference),
+              vector<uint32_t>(expected.begin(), expected.end()));
+    ASSERT_EQ(difference.size(), expected.size());
+  }
+}
+
+TEST_F(RangeSetTest, RandomInserts) {
+  unsigned int seed = 42;
+  for (int i = 0; i < 100; i++) {
+    RangeSet set;
+    std::set<uint32_t> expected;
+    for (int j = 0; j < 200; j++) {
+      uint32_t first = rand_r(&seed) % 1000;
+      uint32_t last = first + rand_r(&seed) % 5;
+      set.AddRange(first, last);
+      for (uint32_t v = first; v <= last; v++) {
+        expected.insert(v);
+      }
+    }
+    ASSERT_EQ(Values(set), vector<uint32_t>(expected.begin(), expected.end()));
+    ASSERT_EQ(set.size(), expected.size());
+
+    auto ranges = set.Ranges();
+    for (size_t j = 1; j < ranges.size(); j++) {
+      // Ranges are never adjacent.
+      ASSERT_GT(ranges[j].first, ranges[j - 1].last + 1);
+    }
+  }
+}
+
+}  // namespace common
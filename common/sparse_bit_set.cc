@@ -1,14 +1,18 @@
 #include "common/sparse_bit_set.h"
 
-#include <unordered_map>
+#include <algorithm>
+#include <utility>
 #include <vector>
 
+#include "absl/numeric/bits.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "common/bit_input_buffer.h"
 #include "common/bit_output_buffer.h"
 #include "common/branch_factor.h"
+#include "common/try.h"
 #include "hb.h"
 
 namespace common {
@@ -16,7 +20,6 @@ namespace common {
 using absl::StatusOr;
 using absl::string_view;
 using std::string;
-using std::unordered_map;
 using std::vector;
 
 // Finds the tree height needed to represent the codepoints in the set.
@@ -51,13 +54,22 @@ uint8_t ValuesPerBitLog2ForLayer(uint32_t layer, uint32_t tree_depth,
   return kBFNodeSizeLog2[branch_factor] * num_layers;
 }
 
-StatusOr<string_view> SparseBitSet::Decode(string_view sparse_bit_set,
-                                           hb_set_t* out) {
+/*
+ * Walks the tree encoded in sparse_bit_set, passing the members of the set to
+ * sink. Sink must provide:
+ *
+ *   // Called for completely filled nodes.
+ *   bool AddRange(uint32_t first, uint32_t last);
+ *   // Called for each value in the leaf layer, in ascending order.
+ *   bool Add(uint32_t value);
+ *
+ * If either returns false decoding stops early. Returns a sub string of
+ * sparse_bit_set with the consumed bytes removed.
+ */
+template <typename Sink>
+static StatusOr<string_view> DecodeTree(string_view sparse_bit_set,
+                                        Sink& sink) {
   // TODO(garretrieger): ignore values beyond unicode max as required by spec.
-
-  if (!out) {
-    return absl::InvalidArgumentError("out is null.");
-  }
   if (sparse_bit_set.empty()) {
     return sparse_bit_set;
   }
@@ -87,7 +99,6 @@ StatusOr<string_view> SparseBitSet::Decode(string_view sparse_bit_set,
   uint64_t node_base_factor = leaf_node_size >> kBFNodeSizeLog2[branch_factor];
   vector<uint32_t> node_bases{0u};  // Root node.
   vector<uint32_t> next_level_node_bases;
-  vector<hb_codepoint_t> pending_codepoints;
 
   for (uint32_t level = 0; level < tree_height; level++) {
     for (uint32_t node_base : node_bases) {
@@ -99,27 +110,31 @@ StatusOr<string_view> SparseBitSet::Decode(string_view sparse_bit_set,
       if (current_node_bits == 0u) {
         // This is a completely filled node encoded as a zero!
         uint32_t leaf_node_base = node_base * node_base_factor;
-        // Add to the set now; range additions are efficient.
-        hb_set_add_range(out, leaf_node_base,
-                         leaf_node_base + leaf_node_size - 1);
-      } else {
-        // It's a normally encoded node.
-        for (uint32_t bit_index = 0u; bit_index < kBFNodeSize[branch_factor];
-             bit_index++) {
-          if (current_node_bits & (1u << bit_index)) {
-            if (level == tree_height - 1) {
-              // Queue up individual additions to the set for a later bulk add.
-              // Bit-based version of:
-              //   pending_codepoints.push_back(node_base + bit_index);
-              pending_codepoints.push_back(node_base | bit_index);
-            } else {
-              // Bit-based version of:
-              //   base = (node_base + bit_index) * kBFNodeSize[branch_factor];
-              uint32_t base = (node_base | bit_index)
-                              << kBFNodeSizeLog2[branch_factor];
-              next_level_node_bases.push_back(base);
-            }
+        if (!sink.AddRange(leaf_node_base,
+                           leaf_node_base + leaf_node_size - 1)) {
+          return bits.Remaining();
+        }
+      } else if (level == tree_height - 1) {
+        // Leaf node, visit only the set bits.
+        while (current_node_bits) {
+          // Bit-based version of:
+          //   sink.Add(node_base + bit_index);
+          uint32_t bit_index = absl::countr_zero(current_node_bits);
+          if (!sink.Add(node_base | bit_index)) {
+            return bits.Remaining();
           }
+          current_node_bits &= current_node_bits - 1;  // Clear lowest bit.
+        }
+      } else {
+        // It's a normally encoded node, visit only the set bits.
+        while (current_node_bits) {
+          // Bit-based version of:
+          //   base = (node_base + bit_index) * kBFNodeSize[branch_factor];
+          uint32_t bit_index = absl::countr_zero(current_node_bits);
+          uint32_t base = (node_base | bit_index)
+                          << kBFNodeSizeLog2[branch_factor];
+          next_level_node_bases.push_back(base);
+          current_node_bits &= current_node_bits - 1;  // Clear lowest bit.
         }
       }
     }
@@ -131,9 +146,211 @@ StatusOr<string_view> SparseBitSet::Decode(string_view sparse_bit_set,
     node_bases.swap(next_level_node_bases);
     next_level_node_bases.clear();
   }
-  if (!pending_codepoints.empty()) {
-    hb_set_add_sorted_array(out, pending_codepoints.data(),
-                            pending_codepoints.size());
+
+  return bits.Remaining();
+}
+
+namespace {
+
+class HbSetSink {
+ public:
+  explicit HbSetSink(hb_set_t* out) : out_(out) {}
+
+  bool AddRange(uint32_t first, uint32_t last) {
+    // Add to the set now; range additions are efficient.
+    hb_set_add_range(out_, first, last);
+    return true;
+  }
+
+  bool Add(uint32_t value) {
+    // Queue up individual additions to the set for a later bulk add.
+    pending_.push_back(value);
+    return true;
+  }
+
+  void Finish() {
+    if (!pending_.empty()) {
+      hb_set_add_sorted_array(out_, pending_.data(), pending_.size());
+    }
+  }
+
+ private:
+  hb_set_t* out_;
+  vector<hb_codepoint_t> pending_;
+};
+
+class SortedVectorSink {
+ public:
+  bool AddRange(uint32_t first, uint32_t last) {
+    ranges_.push_back({first, last});
+    return true;
+  }
+
+  bool Add(uint32_t value) {
+    values_.push_back(value);
+    return true;
+  }
+
+  // Leaf values arrive in ascending order, as do the filled ranges within a
+  // single layer. Ranges from different layers interleave so they are sorted
+  // and then merged with the leaf values, which they never overlap.
+  void Finish(vector<uint32_t>& out) {
+    std::sort(ranges_.begin(), ranges_.end());
+    out.reserve(out.size() + values_.size());
+    auto value = values_.begin();
+    for (const auto& [first, last] : ranges_) {
+      for (; value != values_.end() && *value < first; value++) {
+        out.push_back(*value);
+      }
+      for (uint64_t v = first; v <= last; v++) {
+        out.push_back(v);
+      }
+    }
+    out.insert(out.end(), value, values_.end());
+  }
+
+ private:
+  vector<std::pair<uint32_t, uint32_t>> ranges_;
+  vector<uint32_t> values_;
+};
+
+class BitmapSink {
+ public:
+  explicit BitmapSink(absl::Span<uint64_t> bitmap)
+      : bitmap_(bitmap), size_(bitmap.size() * 64ull) {}
+
+  bool AddRange(uint32_t first, uint32_t last) {
+    if (first >= size_) {
+      return true;
+    }
+    uint64_t end = std::min<uint64_t>(last, size_ - 1) + 1;
+    uint64_t v = first;
+    // Set unaligned leading bits, then whole words, then trailing bits.
+    for (; v < end && (v % 64); v++) {
+      bitmap_[v / 64] |= 1ull << (v % 64);
+    }
+    for (; v + 64 <= end; v += 64) {
+      bitmap_[v / 64] = ~0ull;
+    }
+    for (; v < end; v++) {
+      bitmap_[v / 64] |= 1ull << (v % 64);
+    }
+    return true;
+  }
+
+  bool Add(uint32_t value) {
+    if (value < size_) {
+      bitmap_[value / 64] |= 1ull << (value % 64);
+    }
+    return true;
+  }
+
+ private:
+  absl::Span<uint64_t> bitmap_;
+  uint64_t size_;
+};
+
+class IntersectionSink {
+ public:
+  IntersectionSink(const hb_set_t* query, uint32_t bias)
+      : query_(query), bias_(bias) {}
+
+  bool AddRange(uint32_t first, uint32_t last) {
+    uint64_t biased_first = (uint64_t)first + bias_;
+    if (biased_first > UINT32_MAX) {
+      return true;
+    }
+    uint64_t biased_last =
+        std::min<uint64_t>((uint64_t)last + bias_, UINT32_MAX);
+    hb_codepoint_t next =
+        biased_first ? biased_first - 1 : HB_SET_VALUE_INVALID;
+    intersects_ = hb_set_next(query_, &next) && next <= biased_last;
+    return !intersects_;
+  }
+
+  bool Add(uint32_t value) {
+    uint64_t biased = (uint64_t)value + bias_;
+    intersects_ = biased <= UINT32_MAX && hb_set_has(query_, biased);
+    return !intersects_;
+  }
+
+  bool Intersects() const { return intersects_; }
+
+ private:
+  const hb_set_t* query_;
+  uint32_t bias_;
+  bool intersects_ = false;
+};
+
+}  // namespace
+
+StatusOr<string_view> SparseBitSet::Decode(string_view sparse_bit_set,
+                                           hb_set_t* out) {
+  if (!out) {
+    return absl::InvalidArgumentError("out is null.");
+  }
+
+  HbSetSink sink(out);
+  string_view remaining = TRY(DecodeTree(sparse_bit_set, sink));
+  sink.Finish();
+  return remaining;
+}
+
+StatusOr<string_view> SparseBitSet::Decode(string_view sparse_bit_set,
+                                           vector<uint32_t>& out) {
+  SortedVectorSink sink;
+  string_view remaining = TRY(DecodeTree(sparse_bit_set, sink));
+  sink.Finish(out);
+  return remaining;
+}
+
+StatusOr<string_view> SparseBitSet::Decode(string_view sparse_bit_set,
+                                           absl::Span<uint64_t> bitmap) {
+  BitmapSink sink(bitmap);
+  return DecodeTree(sparse_bit_set, sink);
+}
+
+StatusOr<bool> SparseBitSet::Intersects(string_view sparse_bit_set,
+                                        const hb_set_t* query, uint32_t bias) {
+  if (!query) {
+    return absl::InvalidArgumentError("query is null.");
+  }
+  if (hb_set_is_empty(query)) {
+    return false;
+  }
+
+  IntersectionSink sink(query, bias);
+  TRY(DecodeTree(sparse_bit_set, sink));
+  return sink.Intersects();
+}
+
+StatusOr<string_view> SparseBitSet::Skip(string_view sparse_bit_set) {
+  if (sparse_bit_set.empty()) {
+    return sparse_bit_set;
+  }
+
+  BitInputBuffer bits(sparse_bit_set);
+  BranchFactor branch_factor = bits.GetBranchFactor();
+  uint32_t tree_height = bits.Depth();
+  if (tree_height > kBFMaxDepth[branch_factor]) {
+    return absl::InvalidArgumentError(absl::StrCat("tree_height, ", tree_height,
+                                                   " is larger than max ",
+                                                   kBFMaxDepth[branch_factor]));
+  }
+
+  // Each set bit of a non-filled node above the leaves has a child node in
+  // the next layer.
+  uint64_t layer_nodes = 1;
+  for (uint32_t level = 0; level < tree_height; level++) {
+    uint64_t next_layer_nodes = 0;
+    for (uint64_t i = 0; i < layer_nodes; i++) {
+      uint32_t current_node_bits;
+      if (!bits.read(&current_node_bits)) {
+        return absl::InvalidArgumentError("ran out of node bits.");
+      }
+      next_layer_nodes += absl::popcount(current_node_bits);
+    }
+    layer_nodes = next_layer_nodes;
   }
 
   return bits.Remaining();
@@ -342,26 +559,43 @@ vector<uint32_t> FindFilledTwigs(const vector<hb_codepoint_t>& codepoints,
 }
 
 /*
- * Determines which nodes are completely filled, and thus should be encoded
- * with a zero. Leaf nodes are never marked as filled - writing all 0s instead
- * of all ones would not save any bytes. So the length of the array is the
- * number of nodes one level above the leaf level. For a given codepoint CP,
- * the value stored at index CP / (bits_per_node * bits_per_node). The value
- * will be the tree depth (0 for root) at which the node is first completely
- * filled, and thus should be encoded as a zero. The value will be greater
- * than the tree height when no filled nodes exist for these codepoints.
+ * Records the tree depth (0 for root) at which each completely filled twig is
+ * first part of a completely filled node, and thus should be encoded as a
+ * zero. Leaf nodes are never marked as filled - writing all 0s instead of all
+ * ones would not save any bytes.
+ *
+ * levels[i] is the depth for twigs[i]. Since both are sorted by twig, and the
+ * encoder visits twigs in ascending order within a layer, lookups are done
+ * with a forward only cursor instead of a hash map.
  */
-unordered_map<uint32_t, uint8_t> FindFilledNodes(
-    BranchFactor branch_factor, uint32_t tree_height,
-    const vector<uint32_t>& filled_twigs) {
-  unordered_map<uint32_t, uint8_t> filled_levels;
+struct FilledNodes {
+  const vector<uint32_t>& twigs;
+  vector<uint8_t> levels;
+
+  static constexpr uint8_t kNotFilled = UINT8_MAX;
+
+  // Returns the filled level of twig, or kNotFilled. Successive calls must use
+  // non-decreasing values of twig, starting from a cursor of 0.
+  uint8_t Level(uint32_t twig, size_t& cursor) const {
+    while (cursor < twigs.size() && twigs[cursor] < twig) {
+      cursor++;
+    }
+    if (cursor < twigs.size() && twigs[cursor] == twig) {
+      return levels[cursor];
+    }
+    return kNotFilled;
+  }
+};
+
+static FilledNodes FindFilledNodes(BranchFactor branch_factor,
+                                   uint32_t tree_height,
+                                   const vector<uint32_t>& filled_twigs) {
+  FilledNodes filled{filled_twigs, {}};
   if (tree_height < 2 || filled_twigs.empty()) {
-    return filled_levels;
+    return filled;
   }
   // "Twigs" are nodes one layer above the leaves. Layer tree_height - 2.
-  for (uint32_t filled_twig : filled_twigs) {
-    filled_levels[filled_twig] = tree_height - 2;
-  }
+  filled.levels.resize(filled_twigs.size(), tree_height - 2);
 
   // Now work our way up the layers, "merging" filled nodes by decrementing
   // their filled-at number. Start processing at the layer above the twigs.
@@ -373,8 +607,9 @@ unordered_map<uint32_t, uint8_t> FindFilledNodes(
     uint32_t prev_twig = UINT32_MAX - 1;
     uint32_t seq_len = 0;
     uint32_t num_merged_nodes = 0;
-    for (uint32_t twig : filled_twigs) {
-      uint8_t filled_level = filled_levels[twig];
+    for (size_t i = 0; i < filled_twigs.size(); i++) {
+      uint32_t twig = filled_twigs[i];
+      uint8_t filled_level = filled.levels[i];
       if (twig == prev_twig + 1 && filled_level == target_level) {
         seq_len++;  // Continue a good sequence.
       } else if (filled_level == target_level) {
@@ -388,9 +623,10 @@ unordered_map<uint32_t, uint8_t> FindFilledNodes(
           (twig & node_size_bit_mask) == node_size_bit_mask;
       if (last_value_in_twig) {
         if (seq_len == node_size) {
-          for (uint32_t i = twig - node_size + 1; i <= twig; i++) {
-            filled_levels.find(i)->second = layer;  // Increment to next level.
-          }
+          // The sequence is the node_size entries ending at i.
+          std::fill(filled.levels.begin() + (i + 1 - node_size),
+                    filled.levels.begin() + (i + 1),
+                    layer);  // Increment to next level.
           num_merged_nodes++;
         }
         seq_len = 0;
@@ -406,7 +642,7 @@ unordered_map<uint32_t, uint8_t> FindFilledNodes(
     node_size_bit_mask <<= kBFNodeSizeLog2[branch_factor];
     node_size_bit_mask |= kBFNodeSizeBitMask[branch_factor];
   }
-  return filled_levels;
+  return filled;
 }
 
 enum EncodeState {
@@ -441,7 +677,8 @@ struct EncodeContext {
   const uint32_t tree_height;
   const uint8_t values_per_bit_log_2;
   const uint64_t node_size;
-  const unordered_map<uint32_t, uint8_t>& filled_levels;
+  const FilledNodes& filled_nodes;
+  size_t filled_cursor;
   const vector<uint32_t>& node_bases;
   int next_node_base;
   uint32_t node_base;
@@ -449,15 +686,23 @@ struct EncodeContext {
   uint32_t node_mask;
   uint32_t filled_max;
   vector<uint32_t>& next_node_bases; /* OUT */
-  BitOutputBuffer& bit_buffer;       /* OUT */
+  BitOutputBuffer* bit_buffer;       /* OUT, null when only counting */
+  uint32_t& num_nodes;               /* OUT */
 };
 
-static EncodeSymbolType OverrideIfFilled(uint32_t cp,
-                                         const EncodeContext& context) {
+static void AppendNode(uint32_t bits, EncodeContext& context) {
+  context.num_nodes++;
+  if (context.bit_buffer) {
+    context.bit_buffer->append(bits);
+  }
+}
+
+static EncodeSymbolType OverrideIfFilled(uint32_t cp, EncodeContext& context) {
   // Bit-based version of: twig = cp / context.twig_size;
   uint32_t twig = cp >> kBFTwigSizeLog2[context.branch_factor];
-  if (context.filled_levels.count(twig)) {
-    uint8_t filled_level = context.filled_levels.at(twig);
+  uint8_t filled_level =
+      context.filled_nodes.Level(twig, context.filled_cursor);
+  if (filled_level != FilledNodes::kNotFilled) {
     if (context.layer == filled_level) {
       return NEW_FILLED_NODE;
     } else if (context.layer > filled_level) {
@@ -468,7 +713,7 @@ static EncodeSymbolType OverrideIfFilled(uint32_t cp,
 }
 
 static void ParseCodepoint(uint32_t cp, EncodeState state,
-                           const EncodeContext& context,
+                           EncodeContext& context,
                            EncodeSymbol& symbol /* OUT */) {
   symbol.cp = cp;
   switch (state) {
@@ -499,7 +744,7 @@ static void ParseCodepoint(uint32_t cp, EncodeState state,
 
 static void StartFilledNode(EncodeContext& context) {
   uint32_t node_base = context.node_bases[context.next_node_base++];
-  context.bit_buffer.append(0u);
+  AppendNode(0u, context);
   context.filled_max = node_base + context.node_size - 1;
 }
 
@@ -507,23 +752,25 @@ static void SkipExistingFilledNode(uint32_t cp, EncodeContext& context) {
   // Bit-based version of: twig = cp / twig-size;
   uint32_t twig = cp >> kBFTwigSizeLog2[context.branch_factor];
   // Scan to the right across all applicable filled twigs.
+  uint8_t filled_depth =
+      context.filled_nodes.Level(twig, context.filled_cursor);
   do {
-    uint8_t filled_depth = context.filled_levels.at(twig);
     // # of twigs covered by this filled node depends on its level.
     uint32_t twig_size = 1 << (context.tree_height - filled_depth - 2) *
                                   kBFNodeSizeLog2[context.branch_factor];
     // Advance 1 past this filled node.
     twig += twig_size;
+    filled_depth = context.filled_nodes.Level(twig, context.filled_cursor);
     // Did we land on another filled node?
-  } while (context.filled_levels.count(twig) &&
-           context.filled_levels.at(twig) < context.layer);
+  } while (filled_depth != FilledNodes::kNotFilled &&
+           filled_depth < context.layer);
   // Bit-based version of: context.filled_max = (twig * context.twig_size) - 1;
   context.filled_max = twig << kBFTwigSizeLog2[context.branch_factor];
   context.filled_max--;
 }
 
 static void EndNormalNode(EncodeContext& context) {
-  context.bit_buffer.append(context.node_mask);
+  AppendNode(context.node_mask, context);
   // Reset context.
   context.node_mask = 0u;
   context.node_base = kInvalidCp;
@@ -632,59 +879,104 @@ static EncodeState UpdateState(EncodeState state, const EncodeSymbol& input,
 
 void EncodeLayer(const vector<uint32_t>& codepoints, uint32_t layer,
                  uint32_t tree_height, BranchFactor branch_factor,
-                 const unordered_map<uint32_t, uint8_t>& filled_levels,
+                 const FilledNodes& filled_nodes,
                  const vector<uint32_t>& node_bases,
                  vector<uint32_t>& next_node_bases, /* OUT */
-                 BitOutputBuffer& bit_buffer /* OUT */) {
+                 BitOutputBuffer* bit_buffer,       /* OUT */
+                 uint32_t& num_nodes /* OUT */) {
   uint8_t values_per_bit_log_2 =
       ValuesPerBitLog2ForLayer(layer, tree_height, branch_factor);
   uint64_t node_size = (uint64_t)kBFNodeSize[branch_factor]
                        << values_per_bit_log_2;
-  EncodeContext context{
-      layer,           branch_factor, tree_height, values_per_bit_log_2,
-      node_size,       filled_levels, node_bases,  0,
-      kInvalidCp,      kInvalidCp,    0u,          kInvalidCp,
-      next_node_bases, bit_buffer};
+  EncodeContext context{layer,
+                        branch_factor,
+                        tree_height,
+                        values_per_bit_log_2,
+                        node_size,
+                        filled_nodes,
+                        0,
+                        node_bases,
+                        0,
+                        kInvalidCp,
+                        kInvalidCp,
+                        0u,
+                        kInvalidCp,
+                        next_node_bases,
+                        bit_buffer,
+                        num_nodes};
   EncodeState state = START;
   EncodeSymbol input{INVALID, kInvalidCp};
-  for (uint32_t cp : codepoints) {
+  // Values per bit minus one, all of the values covered by a single bit.
+  uint64_t bit_range_mask = (1ull << values_per_bit_log_2) - 1;
+  auto it = codepoints.begin();
+  while (it != codepoints.end()) {
+    uint32_t cp = *it;
     ParseCodepoint(cp, state, context, input);
     state = UpdateState(state, input, context);
+
+    // Values which fall under an already set bit of the current node, or
+    // inside of a filled node, don't change anything, so skip past them.
+    uint64_t last = cp;
+    if (state == BUILDING_NORMAL_NODE) {
+      last = cp | bit_range_mask;
+    } else if (state == SKIPPING_FILLED_NODE) {
+      last = context.filled_max;
+    }
+    if (last == cp) {
+      it++;
+    } else {
+      it = std::upper_bound(it + 1, codepoints.end(), last);
+    }
   }
   UpdateState(state, kEndOfValues, context);
 }
 
 /*
- * Encodes the set as a sparse bit set with the given branch factor.
- * The fully filled twigs lists the twigs (1 level above leaves) that are
- * completely filled. For example, with BF4, a 1 in filled_twigs means that
- * values 16..31 are all present in the set.
+ * Walks the tree for codepoints (which must be non-empty) layer by layer,
+ * appending each node to bit_buffer when it's not null. Returns the number of
+ * nodes in the tree.
  */
-string EncodeSet(const vector<uint32_t>& codepoints, BranchFactor branch_factor,
-                 const vector<uint32_t>& filled_twigs) {
-  if (codepoints.empty()) {
-    // One empty byte signifies an empty set.
-    return string{0b00000000};
-  }
-  uint32_t tree_height = TreeDepthFor(codepoints, branch_factor);
+static uint32_t EncodeTree(const vector<uint32_t>& codepoints,
+                           BranchFactor branch_factor, uint32_t tree_height,
+                           const vector<uint32_t>& filled_twigs,
+                           BitOutputBuffer* bit_buffer /* OUT */) {
   // Determine which nodes are completely filled; encode them with zero.
-  unordered_map<uint32_t, uint8_t> filled_levels =
+  FilledNodes filled_nodes =
       FindFilledNodes(branch_factor, tree_height, filled_twigs);
-  BitOutputBuffer bit_buffer(branch_factor, tree_height);
 
   // Starting values of the encoding ranges of the nodes queued to be encoded.
   // Queue up the root node.
+  uint32_t num_nodes = 0;
   vector<uint32_t> node_bases(1, 0);
   vector<uint32_t> next_node_bases;
   for (uint32_t layer = 0; layer < tree_height; layer++) {
-    EncodeLayer(codepoints, layer, tree_height, branch_factor, filled_levels,
-                node_bases, next_node_bases, bit_buffer);
+    EncodeLayer(codepoints, layer, tree_height, branch_factor, filled_nodes,
+                node_bases, next_node_bases, bit_buffer, num_nodes);
     if (next_node_bases.empty()) {
       break;  // Filled nodes mean nothing left to encode.
     }
     node_bases.swap(next_node_bases);
     next_node_bases.clear();
   }
+  return num_nodes;
+}
+
+/*
+ * Encodes the set as a sparse bit set with the given branch factor.
+ * The fully filled twigs lists the twigs (1 level above leaves) that are
+ * completely filled. For example, with BF4, a 1 in filled_twigs means that
+ * values 16..31 are all present in the set.
+ */
+string EncodeSet(const vector<uint32_t>& codepoints, BranchFactor branch_factor,
+                 const vector<uint32_t>& filled_twigs) {
+  if (codepoints.empty()) {
+    // One empty byte signifies an empty set.
+    return string{0b00000000};
+  }
+  uint32_t tree_height = TreeDepthFor(codepoints, branch_factor);
+  BitOutputBuffer bit_buffer(branch_factor, tree_height);
+  EncodeTree(codepoints, branch_factor, tree_height, filled_twigs,
+             &bit_buffer);
   return bit_buffer.to_string();
 }
 
@@ -710,16 +1002,35 @@ string SparseBitSet::Encode(const hb_set_t& set, BranchFactor branch_factor) {
 
 string SparseBitSet::Encode(const hb_set_t& set) {
   uint32_t size = hb_set_get_population(&set);
-  if (size == 0) {
-    return "";
-  }
   vector<hb_codepoint_t> codepoints;
   codepoints.resize(size);
   hb_set_next_many(&set, HB_SET_VALUE_INVALID, codepoints.data(), size);
+  return Encode(codepoints);
+}
+
+string SparseBitSet::Encode(const vector<uint32_t>& sorted_values) {
+  if (sorted_values.empty()) {
+    return "";
+  }
   vector<uint32_t> filled_twigs;
-  BranchFactor branch_factor = ChooseBranchFactor(codepoints, filled_twigs);
+  BranchFactor branch_factor = ChooseBranchFactor(sorted_values, filled_twigs);
 
-  return EncodeSet(codepoints, branch_factor, filled_twigs);
+  return EncodeSet(sorted_values, branch_factor, filled_twigs);
+}
+
+uint32_t SparseBitSet::EncodedSize(const vector<uint32_t>& sorted_values) {
+  if (sorted_values.empty()) {
+    return 0;
+  }
+  vector<uint32_t> filled_twigs;
+  BranchFactor branch_factor = ChooseBranchFactor(sorted_values, filled_twigs);
+  uint32_t tree_height = TreeDepthFor(sorted_values, branch_factor);
+  uint64_t num_nodes = EncodeTree(sorted_values, branch_factor, tree_height,
+                                  filled_twigs, nullptr);
+
+  // One header byte, followed by the nodes packed into bytes.
+  uint64_t num_bits = num_nodes * kBFNodeSize[branch_factor];
+  return 1 + (num_bits + 7) / 8;
 }
 
 }  // namespace common
@@ -1,8 +1,13 @@
 #ifndef COMMON_SPARSE_BIT_SET_H_
 #define COMMON_SPARSE_BIT_SET_H_
 
+#include <cstdint>
+#include <string>
+#include <vector>
+
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "common/branch_factor.h"
 #include "hb.h"
 
@@ -51,6 +56,42 @@ class SparseBitSet {
   static absl::StatusOr<absl::string_view> Decode(
       absl::string_view sparse_bit_set, hb_set_t* out);
 
+  /*
+   * Same as Decode(sparse_bit_set, hb_set_t*) but appends the decoded values
+   * to out in ascending order. Values already present in out are not
+   * considered, so out is only sorted if it was empty or held values smaller
+   * than those in the set.
+   *
+   * Filled nodes are expanded into individual values, so callers should only
+   * use this with sets from a trusted source or of known bounded size.
+   */
+  static absl::StatusOr<absl::string_view> Decode(
+      absl::string_view sparse_bit_set, std::vector<uint32_t>& out);
+
+  /*
+   * Same as Decode(sparse_bit_set, hb_set_t*) but sets the bits for the
+   * decoded values in a caller provided bitmap, where value v is bit v % 64
+   * of bitmap[v / 64]. Values which don't fit in the bitmap are ignored.
+   */
+  static absl::StatusOr<absl::string_view> Decode(
+      absl::string_view sparse_bit_set, absl::Span<uint64_t> bitmap);
+
+  /*
+   * Returns true if the set encoded in sparse_bit_set, with bias added to
+   * each of its values, contains at least one member of query. The set is not
+   * materialized and decoding stops as soon as a common member is found.
+   */
+  static absl::StatusOr<bool> Intersects(absl::string_view sparse_bit_set,
+                                         const hb_set_t* query,
+                                         uint32_t bias = 0);
+
+  /*
+   * Returns a sub string of 'sparse_bit_set' with the bytes of the encoded set
+   * removed. Only the tree structure is walked, no values are decoded.
+   */
+  static absl::StatusOr<absl::string_view> Skip(
+      absl::string_view sparse_bit_set);
+
   // Encode a set of integers into a sparse bit set binary blob.
   static std::string Encode(const hb_set_t& set, BranchFactor branch_factor);
   /*
@@ -58,6 +99,18 @@ class SparseBitSet {
    * The optimal branch_factor will be estimated and used automatically.
    */
   static std::string Encode(const hb_set_t& set);
+
+  /*
+   * Same as Encode(const hb_set_t&) but takes the set as a sorted vector of
+   * distinct values.
+   */
+  static std::string Encode(const std::vector<uint32_t>& sorted_values);
+
+  /*
+   * Returns the number of bytes Encode(sorted_values) would produce, without
+   * producing the encoding.
+   */
+  static uint32_t EncodedSize(const std::vector<uint32_t>& sorted_values);
 };
 
 }  // namespace common
@@ -0,0 +1,118 @@
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "common/branch_factor.h"
+#include "common/hb_set_unique_ptr.h"
+#include "common/sparse_bit_set.h"
+#include "hb.h"
+
+using common::BF2;
+using common::BF32;
+using common::BF4;
+using common::BF8;
+using common::BranchFactor;
+using common::hb_set_unique_ptr;
+using common::make_hb_set;
+using common::SparseBitSet;
+
+namespace {
+
+enum SetShape {
+  // Printable ASCII, a single contiguous range.
+  DENSE_ASCII = 0,
+  // Every 7th codepoint of the CJK unified ideographs block, similar to a
+  // frequency based CJK segment.
+  SPARSE_CJK = 1,
+  // 5000 codepoints spread uniformly over the BMP and SMP.
+  RANDOM = 2,
+};
+
+hb_set_unique_ptr MakeSet(int64_t shape) {
+  hb_set_unique_ptr set = make_hb_set();
+  switch (shape) {
+    case DENSE_ASCII:
+      hb_set_add_range(set.get(), 0x20, 0x7E);
+      break;
+    case SPARSE_CJK:
+      for (uint32_t cp = 0x4E00; cp <= 0x9FFF; cp += 7) {
+        hb_set_add(set.get(), cp);
+      }
+      break;
+    case RANDOM:
+    default: {
+      unsigned int seed = 42;
+      for (int i = 0; i < 5000; i++) {
+        hb_set_add(set.get(), rand_r(&seed) % 0x20000);
+      }
+      break;
+    }
+  }
+  return set;
+}
+
+void Shapes(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"shape", "bf"});
+  for (int64_t shape : {DENSE_ASCII, SPARSE_CJK, RANDOM}) {
+    for (int64_t bf : {BF2, BF4, BF8, BF32}) {
+      b->Args({shape, bf});
+    }
+  }
+}
+
+void BM_Encode(benchmark::State& state) {
+  hb_set_unique_ptr set = MakeSet(state.range(0));
+  BranchFactor bf = (BranchFactor)state.range(1);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(SparseBitSet::Encode(*set, bf));
+  }
+  state.SetItemsProcessed(state.iterations() *
+                          hb_set_get_population(set.get()));
+}
+BENCHMARK(BM_Encode)->Apply(Shapes);
+
+// Encode with the branch factor chosen automatically.
+void BM_EncodeAuto(benchmark::State& state) {
+  hb_set_unique_ptr set = MakeSet(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(SparseBitSet::Encode(*set));
+  }
+  state.SetItemsProcessed(state.iterations() *
+                          hb_set_get_population(set.get()));
+}
+BENCHMARK(BM_EncodeAuto)
+    ->ArgName("shape")
+    ->Arg(DENSE_ASCII)
+    ->Arg(SPARSE_CJK)
+    ->Arg(RANDOM);
+
+void BM_DecodeToHbSet(benchmark::State& state) {
+  hb_set_unique_ptr set = MakeSet(state.range(0));
+  std::string encoded =
+      SparseBitSet::Encode(*set, (BranchFactor)state.range(1));
+  for (auto _ : state) {
+    hb_set_unique_ptr out = make_hb_set();
+    benchmark::DoNotOptimize(SparseBitSet::Decode(encoded, out.get()));
+  }
+  state.SetItemsProcessed(state.iterations() *
+                          hb_set_get_population(set.get()));
+}
+BENCHMARK(BM_DecodeToHbSet)->Apply(Shapes);
+
+void BM_DecodeToVector(benchmark::State& state) {
+  hb_set_unique_ptr set = MakeSet(state.range(0));
+  std::string encoded =
+      SparseBitSet::Encode(*set, (BranchFactor)state.range(1));
+  std::vector<uint32_t> out;
+  for (auto _ : state) {
+    out.clear();
+    benchmark::DoNotOptimize(SparseBitSet::Decode(encoded, out));
+  }
+  state.SetItemsProcessed(state.iterations() *
+                          hb_set_get_population(set.get()));
+}
+BENCHMARK(BM_DecodeToVector)->Apply(Shapes);
+
+}  // namespace
@@ -210,6 +210,138 @@ TEST_F(SparseBitSetTest, RemainingOnDecode_Empty) {
   ASSERT_EQ(*s, "");
 }
 
+TEST_F(SparseBitSetTest, DecodeToVector) {
+  // Mix of filled nodes at several layers and leaf values.
+  string bits =
+      SparseBitSet::Encode(*Set({{0, 115}, {117, 217}, {219, 255}}), BF4);
+  bits.append("abcd");
+
+  vector<uint32_t> decoded;
+  auto s = SparseBitSet::Decode(bits, decoded);
+  ASSERT_TRUE(s.ok()) << s.status();
+  ASSERT_EQ(*s, "abcd");
+
+  vector<uint32_t> expected;
+  for (uint32_t v = 0; v <= 255; v++) {
+    if (v != 116 && v != 218) {
+      expected.push_back(v);
+    }
+  }
+  ASSERT_EQ(decoded, expected);
+}
+
+TEST_F(SparseBitSetTest, DecodeToBitmap) {
+  string bits =
+      SparseBitSet::Encode(*Set({{0, 115}, {117, 217}, {219, 255}}), BF4);
+
+  // Values beyond the bitmap are dropped.
+  uint64_t bitmap[2] = {0, 0};
+  auto s = SparseBitSet::Decode(bits, absl::MakeSpan(bitmap));
+  ASSERT_TRUE(s.ok()) << s.status();
+  ASSERT_EQ(*s, "");
+  ASSERT_EQ(bitmap[0], ~0ull);
+  ASSERT_EQ(bitmap[1], ~0ull & ~(1ull << (116 - 64)));
+
+  uint64_t large_bitmap[5] = {0, 0, 0, 0, 1};
+  s = SparseBitSet::Decode(bits, absl::MakeSpan(large_bitmap));
+  ASSERT_TRUE(s.ok()) << s.status();
+  ASSERT_EQ(large_bitmap[0], ~0ull);
+  ASSERT_EQ(large_bitmap[1], ~0ull & ~(1ull << (116 - 64)));
+  ASSERT_EQ(large_bitmap[2], ~0ull);
+  ASSERT_EQ(large_bitmap[3], ~0ull & ~(1ull << (218 - 192)));
+  ASSERT_EQ(large_bitmap[4], 1);
+}
+
+TEST_F(SparseBitSetTest, Intersects) {
+  string bits = SparseBitSet::Encode(*make_hb_set(5, 4, 5, 12, 17, 38));
+  EXPECT_FALSE(*SparseBitSet::Intersects(bits, make_hb_set().get()));
+  EXPECT_FALSE(*SparseBitSet::Intersects(bits, make_hb_set(2, 6, 39).get()));
+  EXPECT_TRUE(*SparseBitSet::Intersects(bits, make_hb_set(2, 6, 17).get()));
+  EXPECT_TRUE(*SparseBitSet::Intersects(bits, make_hb_set(1, 38).get()));
+
+  // Filled nodes
+  bits = SparseBitSet::Encode(*Set({{0, 115}, {117, 217}, {219, 255}}), BF4);
+  EXPECT_FALSE(
+      *SparseBitSet::Intersects(bits, make_hb_set(3, 116, 218, 256).get()));
+  EXPECT_TRUE(*SparseBitSet::Intersects(bits, make_hb_set(2, 116, 150).get()));
+  EXPECT_TRUE(*SparseBitSet::Intersects(bits, make_hb_set(1, 0).get()));
+
+  EXPECT_FALSE(*SparseBitSet::Intersects("", make_hb_set(1, 0).get()));
+  EXPECT_TRUE(absl::IsInvalidArgument(
+      SparseBitSet::Intersects(bits, nullptr).status()));
+  EXPECT_TRUE(absl::IsInvalidArgument(
+      SparseBitSet::Intersects(string{0b00001010, 0b01010101},
+                               make_hb_set(1, 1000).get())
+          .status()));
+}
+
+TEST_F(SparseBitSetTest, IntersectsWithBias) {
+  string bits = SparseBitSet::Encode(*make_hb_set(3, 1, 2, 3));
+  EXPECT_FALSE(*SparseBitSet::Intersects(bits, make_hb_set(1, 1).get(), 10));
+  EXPECT_TRUE(*SparseBitSet::Intersects(bits, make_hb_set(1, 12).get(), 10));
+
+  // Values which overflow after biasing never intersect.
+  bits = SparseBitSet::Encode(*Set({{0, 15}}), BF4);
+  EXPECT_TRUE(*SparseBitSet::Intersects(bits, make_hb_set(1, 0xFFFFFFFE).get(),
+                                        0xFFFFFFF0));
+  EXPECT_FALSE(*SparseBitSet::Intersects(bits, make_hb_set(1, 5).get(),
+                                         0xFFFFFFF0));
+}
+
+TEST_F(SparseBitSetTest, Skip) {
+  for (BranchFactor bf : {BF2, BF4, BF8, BF32}) {
+    for (const auto& set :
+         {make_hb_set(), make_hb_set(5, 4, 5, 12, 17, 38),
+          Set({{0, 115}, {117, 217}, {219, 255}}), Set({{0, 70000}})}) {
+      string bits = SparseBitSet::Encode(*set, bf);
+      string data = bits + "abc";
+      auto s = SparseBitSet::Skip(data);
+      ASSERT_TRUE(s.ok()) << s.status();
+      ASSERT_EQ(*s, "abc");
+    }
+  }
+
+  EXPECT_TRUE(absl::IsInvalidArgument(
+      SparseBitSet::Skip(string{0b00001010, 0b01010101}).status()));
+}
+
+TEST_F(SparseBitSetTest, RandomSets_AllDecodeTargets) {
+  unsigned int seed = 42;
+  for (int i = 0; i < 500; i++) {
+    int size = rand_r(&seed) % 3000;
+    hb_set_unique_ptr input = make_hb_set();
+    for (int j = 0; j < size; j++) {
+      hb_set_add(input.get(), rand_r(&seed) % 2048);
+    }
+    vector<uint32_t> expected;
+    for (hb_codepoint_t cp = HB_SET_VALUE_INVALID;
+         hb_set_next(input.get(), &cp);) {
+      expected.push_back(cp);
+    }
+    uint32_t probe = rand_r(&seed) % 2048;
+
+    for (BranchFactor bf : {BF2, BF4, BF8, BF32}) {
+      string bit_set = SparseBitSet::Encode(*input, bf);
+
+      vector<uint32_t> vector_out;
+      EXPECT_EQ(absl::OkStatus(),
+                SparseBitSet::Decode(bit_set, vector_out).status());
+      EXPECT_EQ(vector_out, expected);
+
+      uint64_t bitmap[2048 / 64] = {};
+      EXPECT_EQ(absl::OkStatus(),
+                SparseBitSet::Decode(bit_set, absl::MakeSpan(bitmap)).status());
+      for (uint32_t v = 0; v < 2048; v++) {
+        EXPECT_EQ((bool)(bitmap[v / 64] & (1ull << (v % 64))),
+                  (bool)hb_set_has(input.get(), v));
+      }
+
+      EXPECT_EQ(*SparseBitSet::Intersects(bit_set, make_hb_set(1, probe).get()),
+                (bool)hb_set_has(input.get(), probe));
+    }
+  }
+}
+
 TEST_F(SparseBitSetTest, EncodeEmpty) { TestEncodeDecode(make_hb_set(), 0); }
 
 TEST_F(SparseBitSetTest, EncodeOneLayer) {
@@ -687,4 +819,25 @@ TEST_F(SparseBitSetTest, RegressionTest32BitRanges) {
   TestEncodeDecode(make_hb_set(2, 1, 2546490705), BF32);
 }
 
+TEST_F(SparseBitSetTest, EncodedSize) {
+  vector<vector<uint32_t>> sets = {
+      {},
+      {0},
+      {2, 63},
+      {5, 6, 7, 8, 100, 1000, 10000},
+      {0x3000, 0x3001, 0x3002, 0x4E00, 0x4E01, 0x9FA5},
+      {0xFFFFFFFF},
+  };
+  vector<uint32_t> range;
+  for (uint32_t i = 0; i <= 32 * 32 * 32; i++) {
+    range.push_back(i);
+  }
+  sets.push_back(range);
+
+  for (const auto& set : sets) {
+    EXPECT_EQ(SparseBitSet::EncodedSize(set),
+              SparseBitSet::Encode(set).size());
+  }
+}
+
 }  // namespace common
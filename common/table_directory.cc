@@ -0,0 +1,103 @@
+#include "common/table_directory.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+#include "absl/base/internal/endian.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "hb.h"
+
+using absl::StatusOr;
+using absl::StrCat;
+using absl::string_view;
+
+namespace common {
+
+namespace {
+
+constexpr uint32_t kHeaderSize = 12;
+constexpr uint32_t kRecordSize = 16;
+
+uint16_t Load16(string_view data, uint32_t offset) {
+  return absl::big_endian::Load16(data.data() + offset);
+}
+
+uint32_t Load32(string_view data, uint32_t offset) {
+  return absl::big_endian::Load32(data.data() + offset);
+}
+
+bool IsSfntVersion(uint32_t version) {
+  return version == 0x00010000 || version == HB_TAG('O', 'T', 'T', 'O') ||
+         version == HB_TAG('t', 'r', 'u', 'e') ||
+         version == HB_TAG('t', 'y', 'p', '1');
+}
+
+}  // namespace
+
+StatusOr<TableDirectory> TableDirectory::Parse(string_view data) {
+  if (data.size() < kHeaderSize) {
+    return absl::InvalidArgumentError(
+        "Font is too short for a table directory.");
+  }
+  if (!IsSfntVersion(Load32(data, 0))) {
+    return absl::InvalidArgumentError("Not a single sfnt font.");
+  }
+
+  uint32_t num_tables = Load16(data, 4);
+  if (data.size() < kHeaderSize + num_tables * kRecordSize) {
+    return absl::InvalidArgumentError("Table records are out of bounds.");
+  }
+
+  TableDirectory directory;
+  directory.entries_.reserve(num_tables);
+  for (uint32_t i = 0; i < num_tables; i++) {
+    uint32_t record = kHeaderSize + i * kRecordSize;
+    Entry entry{Load32(data, record), Load32(data, record + 8),
+                Load32(data, record + 12), Load32(data, record + 4)};
+    if (entry.offset > data.size() ||
+        entry.length > data.size() - entry.offset) {
+      return absl::InvalidArgumentError(
+          StrCat("Table ", i, " is out of bounds."));
+    }
+    directory.entries_.push_back(entry);
+  }
+
+  std::sort(directory.entries_.begin(), directory.entries_.end(),
+            [](const Entry& a, const Entry& b) {
+              return std::pair(a.offset, a.tag) < std::pair(b.offset, b.tag);
+            });
+  for (uint32_t i = 0; i < directory.entries_.size(); i++) {
+    if (!directory.index_.insert({directory.entries_[i].tag, i}).second) {
+      return absl::InvalidArgumentError("Table tag is repeated.");
+    }
+  }
+  return directory;
+}
+
+void TableDirectory::AttachTo(hb_face_t* face, string_view data) {
+  auto directory = Parse(data);
+  if (!directory.ok() || hb_face_get_table_tags(face, 0, nullptr, nullptr) !=
+                             directory->entries_.size()) {
+    // Harfbuzz rejected the font or parsed it differently, leave lookups to
+    // harfbuzz so results match what's in the face.
+    return;
+  }
+
+  TableDirectory* attached = new TableDirectory(*std::move(directory));
+  if (!hb_face_set_user_data(
+          face, &key_, attached,
+          [](void* data) { delete static_cast<TableDirectory*>(data); },
+          false)) {
+    delete attached;
+  }
+}
+
+const TableDirectory* TableDirectory::ForFace(const hb_face_t* face) {
+  return static_cast<const TableDirectory*>(
+      hb_face_get_user_data(face, &key_));
+}
+
+}  // namespace common
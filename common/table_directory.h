@@ -0,0 +1,72 @@
+#ifndef COMMON_TABLE_DIRECTORY_H_
+#define COMMON_TABLE_DIRECTORY_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "hb.h"
+
+namespace common {
+
+/*
+ * The table directory of a font: the tag, offset, length and checksum of each
+ * table, parsed directly from the sfnt header.
+ *
+ * FontData attaches a directory to the faces it creates from font data, which
+ * lets FontHelper list, order and locate tables with a single lookup instead
+ * of repeatedly querying harfbuzz. Faces which are not backed by font data
+ * (eg. face builders) have no directory.
+ */
+class TableDirectory {
+ public:
+  struct Entry {
+    hb_tag_t tag;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t checksum;
+  };
+
+  /*
+   * Parses the table directory of the font in data. Fails if data is not a
+   * single sfnt font (font collections are not supported), a table extends
+   * past the end of the data or a tag is repeated.
+   */
+  static absl::StatusOr<TableDirectory> Parse(absl::string_view data);
+
+  /*
+   * Parses the directory of data and attaches it to face, which must have been
+   * created from data. Nothing is attached if parsing fails or the directory
+   * doesn't match the tables harfbuzz found in face.
+   */
+  static void AttachTo(hb_face_t* face, absl::string_view data);
+
+  // Returns the directory attached to face, or nullptr if there is none.
+  static const TableDirectory* ForFace(const hb_face_t* face);
+
+  // Returns the entry for tag, or nullptr if the font has no such table.
+  const Entry* Find(hb_tag_t tag) const {
+    auto it = index_.find(tag);
+    if (it == index_.end()) {
+      return nullptr;
+    }
+    return &entries_[it->second];
+  }
+
+  // All entries ordered by increasing offset (then tag).
+  const std::vector<Entry>& Entries() const { return entries_; }
+
+ private:
+  TableDirectory() = default;
+
+  std::vector<Entry> entries_;
+  absl::flat_hash_map<hb_tag_t, uint32_t> index_;
+
+  static inline hb_user_data_key_t key_;
+};
+
+}  // namespace common
+
+#endif  // COMMON_TABLE_DIRECTORY_H_
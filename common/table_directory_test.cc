@@ -0,0 +1,98 @@
+#include "common/table_directory.h"
+
+#include <string>
+
+#include "absl/status/status.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "gtest/gtest.h"
+#include "hb.h"
+
+namespace common {
+
+class TableDirectoryTest : public ::testing::Test {
+ protected:
+  TableDirectoryTest()
+      : font(FontHelper::BuildFont({
+            {HB_TAG('a', 'b', 'c', 'd'), "abc"},
+            {HB_TAG('e', 'f', 'g', 'h'), "defg"},
+        })) {}
+
+  FontData font;
+};
+
+TEST_F(TableDirectoryTest, Parse) {
+  auto directory = TableDirectory::Parse(font.str());
+  ASSERT_TRUE(directory.ok()) << directory.status();
+  ASSERT_EQ(directory->Entries().size(), 2);
+
+  const TableDirectory::Entry* abcd =
+      directory->Find(HB_TAG('a', 'b', 'c', 'd'));
+  ASSERT_NE(abcd, nullptr);
+  EXPECT_EQ(font.str().substr(abcd->offset, abcd->length), "abc");
+
+  const TableDirectory::Entry* efgh =
+      directory->Find(HB_TAG('e', 'f', 'g', 'h'));
+  ASSERT_NE(efgh, nullptr);
+  EXPECT_EQ(font.str().substr(efgh->offset, efgh->length), "defg");
+
+  EXPECT_EQ(directory->Find(HB_TAG('x', 'x', 'x', 'x')), nullptr);
+
+  // Ordered by offset.
+  EXPECT_LT(directory->Entries()[0].offset, directory->Entries()[1].offset);
+}
+
+TEST_F(TableDirectoryTest, Parse_Invalid) {
+  ASSERT_TRUE(absl::IsInvalidArgument(TableDirectory::Parse("").status()));
+  ASSERT_TRUE(absl::IsInvalidArgument(
+      TableDirectory::Parse(font.str().substr(0, 20)).status()));
+
+  std::string collection = font.string();
+  collection.replace(0, 4, "ttcf");
+  ASSERT_TRUE(
+      absl::IsInvalidArgument(TableDirectory::Parse(collection).status()));
+
+  // Last table extends past the end of the font.
+  std::string truncated = font.string();
+  truncated.resize(truncated.size() - 4);
+  ASSERT_TRUE(
+      absl::IsInvalidArgument(TableDirectory::Parse(truncated).status()));
+}
+
+TEST_F(TableDirectoryTest, AttachedByFontData) {
+  hb_face_unique_ptr face = font.face();
+  ASSERT_NE(TableDirectory::ForFace(face.get()), nullptr);
+  EXPECT_EQ(
+      FontHelper::TableData(face.get(), HB_TAG('e', 'f', 'g', 'h')).str(),
+      "defg");
+  EXPECT_TRUE(
+      FontHelper::TableData(face.get(), HB_TAG('x', 'x', 'x', 'x')).empty());
+
+  // Faces not created by FontData, or not backed by font data, have none.
+  hb_blob_unique_ptr blob = font.blob();
+  hb_face_unique_ptr plain = make_hb_face(hb_face_create(blob.get(), 0));
+  EXPECT_EQ(TableDirectory::ForFace(plain.get()), nullptr);
+  hb_face_unique_ptr builder = make_hb_face_builder();
+  EXPECT_EQ(TableDirectory::ForFace(builder.get()), nullptr);
+}
+
+TEST_F(TableDirectoryTest, MatchesHarfbuzz) {
+  FontData roboto =
+      *FontData::FromFile("common/testdata/Roboto-Regular.ab.ttf");
+  hb_face_unique_ptr face = roboto.face();
+  ASSERT_NE(TableDirectory::ForFace(face.get()), nullptr);
+
+  hb_blob_unique_ptr blob = roboto.blob();
+  hb_face_unique_ptr plain = make_hb_face(hb_face_create(blob.get(), 0));
+
+  EXPECT_EQ(FontHelper::GetTags(face.get()), FontHelper::GetTags(plain.get()));
+  EXPECT_EQ(FontHelper::GetOrderedTags(face.get()),
+            FontHelper::GetOrderedTags(plain.get()));
+  for (hb_tag_t tag : FontHelper::GetOrderedTags(plain.get())) {
+    EXPECT_EQ(FontHelper::TableData(face.get(), tag),
+              FontHelper::TableData(plain.get(), tag))
+        << FontHelper::ToString(tag);
+  }
+}
+
+}  // namespace common
@@ -0,0 +1,145 @@
+#include "common/thread_pool.h"
+
+#include <functional>
+#include <utility>
+
+#include "absl/synchronization/mutex.h"
+
+using absl::Condition;
+using absl::MutexLock;
+
+namespace common {
+
+ThreadPool::ThreadPool(uint32_t num_threads) {
+  if (num_threads <= 1) {
+    // Tasks will be executed inline.
+    return;
+  }
+
+  workers_.reserve(num_threads);
+  for (uint32_t i = 0; i < num_threads; i++) {
+    workers_.emplace_back(&ThreadPool::WorkerLoop, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  Wait();
+  {
+    MutexLock lock(&mutex_);
+    shutdown_ = true;
+  }
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::Schedule(std::function<void()> task) {
+  if (workers_.empty()) {
+    task();
+    return;
+  }
+
+  MutexLock lock(&mutex_);
+  queue_.push_back(std::move(task));
+}
+
+void ThreadPool::Wait() {
+  if (workers_.empty()) {
+    return;
+  }
+
+  MutexLock lock(&mutex_);
+  mutex_.Await(Condition(this, &ThreadPool::IsIdle));
+}
+
+bool ThreadPool::RunNext(Group& group) {
+  uint32_t i;
+  {
+    MutexLock lock(&mutex_);
+    if (group.next == group.count) {
+      return false;
+    }
+    i = group.next++;
+  }
+
+  (*group.task)(i);
+
+  MutexLock lock(&mutex_);
+  group.done++;
+  return true;
+}
+
+void ThreadPool::ParallelFor(uint32_t count,
+                             const std::function<void(uint32_t)>& task) {
+  if (workers_.empty() || count <= 1) {
+    for (uint32_t i = 0; i < count; i++) {
+      task(i);
+    }
+    return;
+  }
+
+  // Queued entries only claim the next unstarted item, so entries which run
+  // after the caller has claimed everything do nothing. They may outlive this
+  // call, so share ownership of the group with them.
+  auto group = std::make_shared<Group>();
+  group->task = &task;
+  group->count = count;
+  {
+    MutexLock lock(&mutex_);
+    // The caller runs at least one item itself.
+    for (uint32_t i = 1; i < count; i++) {
+      queue_.push_back([this, group]() { RunNext(*group); });
+    }
+  }
+
+  while (true) {
+    if (RunNext(*group)) {
+      continue;
+    }
+
+    // All items have started, help with other work until they're done.
+    std::function<void()> other;
+    {
+      MutexLock lock(&mutex_);
+      auto ready = [&]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+        return group->IsDone() || !queue_.empty();
+      };
+      mutex_.Await(Condition(&ready));
+      if (group->IsDone()) {
+        return;
+      }
+      other = std::move(queue_.front());
+      queue_.pop_front();
+      active_++;
+    }
+
+    other();
+
+    MutexLock lock(&mutex_);
+    active_--;
+  }
+}
+
+void ThreadPool::WorkerLoop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      MutexLock lock(&mutex_);
+      mutex_.Await(Condition(this, &ThreadPool::HasWork));
+      if (queue_.empty()) {
+        // shutdown_ is set and no work remains.
+        return;
+      }
+      task = std::move(queue_.front());
+      queue_.pop_front();
+      active_++;
+    }
+
+    task();
+
+    MutexLock lock(&mutex_);
+    active_--;
+  }
+}
+
+}  // namespace common
@@ -0,0 +1,96 @@
+#ifndef COMMON_THREAD_POOL_H_
+#define COMMON_THREAD_POOL_H_
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+
+namespace common {
+
+/*
+ * A simple fixed size pool of worker threads which execute scheduled tasks.
+ *
+ * If the pool is created with one (or zero) threads no workers are started and
+ * tasks are instead run immediately on the calling thread inside of
+ * Schedule(). This allows callers to use the same code path for sequential
+ * and parallel execution.
+ *
+ * A single pool is meant to be shared by everything running in a process (eg.
+ * the encoder's nodes and the per table diffs within each) so that the number
+ * of threads stays bounded. ParallelFor() supports nesting for this.
+ */
+class ThreadPool {
+ public:
+  explicit ThreadPool(uint32_t num_threads);
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool(ThreadPool&& other) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  ThreadPool& operator=(ThreadPool&& other) = delete;
+
+  // Waits for all outstanding tasks to complete and then stops the workers.
+  ~ThreadPool();
+
+  uint32_t NumThreads() const { return workers_.empty() ? 1 : workers_.size(); }
+
+  // Adds a task to the queue, it will be run by the next available worker.
+  void Schedule(std::function<void()> task);
+
+  // Blocks until all scheduled tasks have finished executing. Must not be
+  // called from a task running on this pool.
+  void Wait();
+
+  /*
+   * Runs task(i) for each i in [0, count) and returns once all of them have
+   * finished. The calling thread takes part: it runs items itself, and while
+   * waiting for items running on other threads it runs other queued tasks.
+   * So unlike Schedule() + Wait() this may be called from a task running on
+   * this pool, the nested items are spread over idle workers without using
+   * more threads.
+   *
+   * Since the caller may run unrelated queued tasks while waiting, it must not
+   * hold locks which those tasks could need.
+   */
+  void ParallelFor(uint32_t count, const std::function<void(uint32_t)>& task);
+
+ private:
+  // The state of a single ParallelFor() call.
+  struct Group {
+    const std::function<void(uint32_t)>* task;
+    uint32_t count;
+    uint32_t next = 0;
+    uint32_t done = 0;
+
+    bool IsDone() const { return done == count; }
+  };
+
+  // Runs the next item of group if any are left, returns false otherwise.
+  bool RunNext(Group& group) ABSL_LOCKS_EXCLUDED(mutex_);
+
+  void WorkerLoop();
+
+  bool HasWork() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return !queue_.empty() || shutdown_;
+  }
+
+  bool IsIdle() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return queue_.empty() && active_ == 0;
+  }
+
+  absl::Mutex mutex_;
+  std::deque<std::function<void()>> queue_ ABSL_GUARDED_BY(mutex_);
+  uint32_t active_ ABSL_GUARDED_BY(mutex_) = 0;
+  bool shutdown_ ABSL_GUARDED_BY(mutex_) = false;
+
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace common
+
+#endif  // COMMON_THREAD_POOL_H_
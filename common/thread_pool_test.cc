@@ -0,0 +1,127 @@
+#include "common/thread_pool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace common {
+
+class ThreadPoolTest : public ::testing::Test {};
+
+TEST_F(ThreadPoolTest, SingleThreadRunsInline) {
+  ThreadPool pool(1);
+  ASSERT_EQ(pool.NumThreads(), 1);
+
+  std::thread::id caller = std::this_thread::get_id();
+  std::thread::id runner;
+  pool.Schedule([&]() { runner = std::this_thread::get_id(); });
+
+  // No Wait() needed, the task should have already run.
+  ASSERT_EQ(runner, caller);
+}
+
+TEST_F(ThreadPoolTest, RunsAllTasks) {
+  ThreadPool pool(4);
+  ASSERT_EQ(pool.NumThreads(), 4);
+
+  std::vector<uint32_t> results(1000, 0);
+  for (uint32_t i = 0; i < results.size(); i++) {
+    pool.Schedule([&results, i]() { results[i] = i * 2; });
+  }
+  pool.Wait();
+
+  for (uint32_t i = 0; i < results.size(); i++) {
+    ASSERT_EQ(results[i], i * 2);
+  }
+}
+
+TEST_F(ThreadPoolTest, WaitCanBeCalledRepeatedly) {
+  ThreadPool pool(3);
+  std::atomic<uint32_t> count = 0;
+
+  for (uint32_t i = 0; i < 10; i++) {
+    pool.Schedule([&count]() { count++; });
+  }
+  pool.Wait();
+  ASSERT_EQ(count, 10);
+
+  for (uint32_t i = 0; i < 10; i++) {
+    pool.Schedule([&count]() { count++; });
+  }
+  pool.Wait();
+  ASSERT_EQ(count, 20);
+
+  // Nothing outstanding.
+  pool.Wait();
+  ASSERT_EQ(count, 20);
+}
+
+TEST_F(ThreadPoolTest, DestructorWaitsForTasks) {
+  std::atomic<uint32_t> count = 0;
+  {
+    ThreadPool pool(2);
+    for (uint32_t i = 0; i < 50; i++) {
+      pool.Schedule([&count]() { count++; });
+    }
+  }
+  ASSERT_EQ(count, 50);
+}
+
+TEST_F(ThreadPoolTest, ParallelFor) {
+  ThreadPool pool(4);
+  std::vector<uint32_t> results(1000, 0);
+  pool.ParallelFor(results.size(), [&results](uint32_t i) {
+    results[i] = i * 2;
+  });
+
+  for (uint32_t i = 0; i < results.size(); i++) {
+    ASSERT_EQ(results[i], i * 2);
+  }
+
+  // Empty and single item ranges.
+  pool.ParallelFor(0, [](uint32_t i) { FAIL(); });
+  uint32_t count = 0;
+  pool.ParallelFor(1, [&count](uint32_t i) { count++; });
+  ASSERT_EQ(count, 1);
+}
+
+TEST_F(ThreadPoolTest, ParallelForSingleThread) {
+  ThreadPool pool(1);
+  std::thread::id caller = std::this_thread::get_id();
+  std::vector<uint32_t> order;
+  pool.ParallelFor(5, [&](uint32_t i) {
+    ASSERT_EQ(std::this_thread::get_id(), caller);
+    order.push_back(i);
+  });
+  ASSERT_EQ(order, (std::vector<uint32_t>{0, 1, 2, 3, 4}));
+}
+
+TEST_F(ThreadPoolTest, NestedParallelFor) {
+  // More outer items than threads, each of which blocks on nested items. This
+  // would deadlock if waiting threads didn't help with queued work.
+  ThreadPool pool(2);
+  std::atomic<uint32_t> count = 0;
+  pool.ParallelFor(8, [&pool, &count](uint32_t i) {
+    pool.ParallelFor(8, [&pool, &count](uint32_t j) {
+      pool.ParallelFor(4, [&count](uint32_t k) { count++; });
+    });
+  });
+  ASSERT_EQ(count, 8 * 8 * 4);
+}
+
+TEST_F(ThreadPoolTest, ParallelForFromScheduledTasks) {
+  ThreadPool pool(3);
+  std::atomic<uint32_t> count = 0;
+  for (uint32_t i = 0; i < 10; i++) {
+    pool.Schedule([&pool, &count]() {
+      pool.ParallelFor(20, [&count](uint32_t j) { count++; });
+    });
+  }
+  pool.Wait();
+  ASSERT_EQ(count, 200);
+}
+
+}  // namespace common
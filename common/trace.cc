@@ -0,0 +1,96 @@
+#include "common/trace.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+
+using absl::MutexLock;
+using absl::StrAppend;
+
+namespace common {
+
+namespace {
+
+struct Event {
+  const char* name;
+  uint32_t thread;
+  int64_t start_ns;
+  int64_t end_ns;
+};
+
+struct Recording {
+  absl::Mutex mutex;
+  int64_t start_ns ABSL_GUARDED_BY(mutex) = 0;
+  std::vector<Event> events ABSL_GUARDED_BY(mutex);
+};
+
+Recording& GetRecording() {
+  // Never destroyed so spans can be recorded during exit.
+  static Recording* recording = new Recording;
+  return *recording;
+}
+
+// Small sequential ids are easier to read in trace viewers than native ones.
+uint32_t ThreadId() {
+  static std::atomic<uint32_t> next_id = 1;
+  thread_local uint32_t id = next_id.fetch_add(1, std::memory_order_relaxed);
+  return id;
+}
+
+}  // namespace
+
+std::atomic<bool> Trace::enabled_ = false;
+
+void Trace::Start() {
+  Recording& recording = GetRecording();
+  MutexLock lock(&recording.mutex);
+  recording.start_ns = absl::GetCurrentTimeNanos();
+  recording.events.clear();
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+std::string Trace::Stop() {
+  Recording& recording = GetRecording();
+  std::vector<Event> events;
+  int64_t start_ns;
+  {
+    MutexLock lock(&recording.mutex);
+    enabled_.store(false, std::memory_order_relaxed);
+    events.swap(recording.events);
+    start_ns = recording.start_ns;
+  }
+
+  // Complete ("X") events from the trace event format, timestamps are in
+  // microseconds since Start().
+  std::string json = "{\"traceEvents\":[";
+  for (uint32_t i = 0; i < events.size(); i++) {
+    const Event& e = events[i];
+    StrAppend(&json, i ? "," : "", "\n{\"name\":\"", e.name,
+              "\",\"ph\":\"X\",\"pid\":1,\"tid\":", e.thread,
+              ",\"ts\":", (e.start_ns - start_ns) / 1000.0,
+              ",\"dur\":", (e.end_ns - e.start_ns) / 1000.0, "}");
+  }
+  StrAppend(&json, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  return json;
+}
+
+void Trace::Record(const char* name, int64_t start_ns, int64_t end_ns) {
+  uint32_t thread = ThreadId();
+  Recording& recording = GetRecording();
+  MutexLock lock(&recording.mutex);
+  if (!Enabled() || start_ns < recording.start_ns) {
+    // Started before the current recording, or finished after it stopped.
+    return;
+  }
+  recording.events.push_back(Event{name, thread, start_ns, end_ns});
+}
+
+int64_t TraceSpan::NowNanos() { return absl::GetCurrentTimeNanos(); }
+
+}  // namespace common
@@ -0,0 +1,63 @@
+#ifndef COMMON_TRACE_H_
+#define COMMON_TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace common {
+
+/*
+ * Process wide recording of timed spans which can be output in the Chrome
+ * trace event JSON format (viewable with Perfetto or chrome://tracing).
+ *
+ * Recording is off by default, in which case a TraceSpan costs a single
+ * relaxed atomic load. Methods are thread safe.
+ */
+class Trace {
+ public:
+  // Discards any previously recorded spans and begins recording.
+  static void Start();
+
+  // Stops recording and returns the spans recorded since Start() as a Chrome
+  // trace JSON object. Recorded spans are discarded.
+  static std::string Stop();
+
+  static bool Enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  // Records a span, times are in nanoseconds since the unix epoch. name must
+  // outlive the call to Stop().
+  static void Record(const char* name, int64_t start_ns, int64_t end_ns);
+
+ private:
+  static std::atomic<bool> enabled_;
+};
+
+/*
+ * Records the time from construction to destruction as a span named name,
+ * which must be a string literal. Does nothing if tracing is not enabled
+ * when it's constructed.
+ */
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char* name)
+      : name_(name), start_ns_(Trace::Enabled() ? NowNanos() : 0) {}
+  ~TraceSpan() {
+    if (start_ns_) {
+      Trace::Record(name_, start_ns_, NowNanos());
+    }
+  }
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+ private:
+  static int64_t NowNanos();
+
+  const char* name_;
+  int64_t start_ns_;
+};
+
+}  // namespace common
+
+#endif  // COMMON_TRACE_H_
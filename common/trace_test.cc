@@ -0,0 +1,56 @@
+#include "common/trace.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace common {
+
+class TraceTest : public ::testing::Test {};
+
+TEST_F(TraceTest, DisabledByDefault) {
+  ASSERT_FALSE(Trace::Enabled());
+  { TraceSpan span("Ignored"); }
+
+  Trace::Start();
+  ASSERT_TRUE(Trace::Enabled());
+  std::string json = Trace::Stop();
+  ASSERT_FALSE(Trace::Enabled());
+  ASSERT_EQ(json.find("Ignored"), std::string::npos) << json;
+}
+
+TEST_F(TraceTest, RecordsSpans) {
+  Trace::Start();
+  {
+    TraceSpan outer("Outer");
+    TraceSpan inner("Inner");
+  }
+  std::string json = Trace::Stop();
+
+  ASSERT_EQ(json.find("{\"traceEvents\":["), 0) << json;
+  ASSERT_NE(json.find("\"name\":\"Outer\",\"ph\":\"X\""), std::string::npos)
+      << json;
+  ASSERT_NE(json.find("\"name\":\"Inner\",\"ph\":\"X\""), std::string::npos)
+      << json;
+
+  // Spans are moved out by Stop().
+  Trace::Start();
+  json = Trace::Stop();
+  ASSERT_EQ(json.find("Outer"), std::string::npos) << json;
+}
+
+TEST_F(TraceTest, SpanOpenWhenStoppedIsDropped) {
+  Trace::Start();
+  std::string json;
+  {
+    TraceSpan span("Unfinished");
+    json = Trace::Stop();
+  }
+  ASSERT_EQ(json.find("Unfinished"), std::string::npos) << json;
+
+  Trace::Start();
+  json = Trace::Stop();
+  ASSERT_EQ(json.find("Unfinished"), std::string::npos) << json;
+}
+
+}  // namespace common
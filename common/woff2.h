@@ -8,8 +8,11 @@
 namespace common {
 
 struct Woff2 {
+  // brotli_quality only affects the size of the encoded font, decoding the
+  // result produces the same font file at any quality.
   static absl::StatusOr<FontData> EncodeWoff2(absl::string_view font,
-                                              bool glyf_transform = true);
+                                              bool glyf_transform = true,
+                                              int brotli_quality = 11);
   static absl::StatusOr<FontData> DecodeWoff2(absl::string_view font);
 };
 
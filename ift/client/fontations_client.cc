@@ -1,13 +1,20 @@
 #include "ift/client/fontations_client.h"
 
+#include <atomic>
 #include <cstdio>
 #include <filesystem>
 #include <sstream>
+#include <utility>
+#include <vector>
 
 #include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
 #include "common/axis_range.h"
 #include "common/font_data.h"
+#include "common/range_set.h"
+#include "common/thread_pool.h"
 #include "ift/encoder/encoder.h"
+#include "ift/proto/patch_map.h"
 
 using absl::btree_set;
 using absl::flat_hash_map;
@@ -17,7 +24,10 @@ using common::AxisRange;
 using common::FontData;
 using common::make_hb_blob;
 using common::make_hb_face;
+using common::RangeSet;
+using common::ThreadPool;
 using ift::encoder::Encoder;
+using ift::proto::PatchMap;
 
 namespace ift::client {
 
@@ -127,22 +137,27 @@ Status ToGraph(const Encoder::Encoding& encoding, graph& out) {
   return absl::OkStatus();
 }
 
-StatusOr<FontData> ExtendWithDesignSpace(
-    const Encoder::Encoding& encoding, btree_set<uint32_t> codepoints,
-    btree_set<hb_tag_t> feature_tags,
-    flat_hash_map<hb_tag_t, AxisRange> design_space,
-    btree_set<std::string>* applied_uris) {
-  auto font_path_str = WriteFontToDisk(encoding);
-  if (!font_path_str.ok()) {
-    return font_path_str.status();
+StatusOr<FontationsSession> FontationsSession::Create(
+    const Encoder::Encoding& encoding) {
+  auto font_path = WriteFontToDisk(encoding);
+  if (!font_path.ok()) {
+    return font_path.status();
   }
+  return FontationsSession(std::move(*font_path));
+}
 
-  std::filesystem::path font_path(*font_path_str);
-  std::filesystem::path directory = font_path.parent_path();
-  std::filesystem::path output = directory / "out.ttf";
+StatusOr<FontData> FontationsSession::Extend(
+    const PatchMap::Coverage& target,
+    btree_set<std::string>* applied_uris) const {
+  // Each extension gets its own output so that they can run concurrently.
+  static std::atomic<uint32_t> next_output = 0;
+  std::filesystem::path font_path(font_path_);
+  std::filesystem::path output =
+      font_path.parent_path() /
+      absl::StrCat("out_", next_output.fetch_add(1), ".ttf");
 
   std::stringstream ss;
-  for (uint32_t cp : codepoints) {
+  for (uint32_t cp : target.codepoints) {
     ss << cp << ",";
   }
   std::string unicodes = ss.str();
@@ -151,7 +166,7 @@ StatusOr<FontData> ExtendWithDesignSpace(
   }
 
   std::stringstream features_ss;
-  for (uint32_t tag : feature_tags) {
+  for (uint32_t tag : target.features) {
     char tag_string[5] = {'a', 'a', 'a', 'a', 0};
     snprintf(tag_string, 5, "%c%c%c%c", HB_UNTAG(tag));
     features_ss << tag_string << ",";
@@ -162,7 +177,7 @@ StatusOr<FontData> ExtendWithDesignSpace(
   }
 
   std::stringstream ds_ss;
-  for (const auto& [tag, range] : design_space) {
+  for (const auto& [tag, range] : target.design_space) {
     char tag_string[5] = {'a', 'a', 'a', 'a', 0};
     snprintf(tag_string, 5, "%c%c%c%c", HB_UNTAG(tag));
 
@@ -195,6 +210,32 @@ StatusOr<FontData> ExtendWithDesignSpace(
   return FontData(make_hb_blob(hb_blob_create_from_file(output.c_str())));
 }
 
+std::vector<StatusOr<FontData>> FontationsSession::ExtendAll(
+    const std::vector<PatchMap::Coverage>& targets, ThreadPool& pool) const {
+  std::vector<StatusOr<FontData>> results(targets.size());
+  pool.ParallelFor(targets.size(), [this, &targets, &results](uint32_t i) {
+    results[i] = Extend(targets[i]);
+  });
+  return results;
+}
+
+StatusOr<FontData> ExtendWithDesignSpace(
+    const Encoder::Encoding& encoding, btree_set<uint32_t> codepoints,
+    btree_set<hb_tag_t> feature_tags,
+    flat_hash_map<hb_tag_t, AxisRange> design_space,
+    btree_set<std::string>* applied_uris) {
+  auto session = FontationsSession::Create(encoding);
+  if (!session.ok()) {
+    return session.status();
+  }
+
+  PatchMap::Coverage target;
+  target.codepoints = RangeSet(codepoints.begin(), codepoints.end());
+  target.features = std::move(feature_tags);
+  target.design_space.insert(design_space.begin(), design_space.end());
+  return session->Extend(target, applied_uris);
+}
+
 StatusOr<FontData> Extend(const Encoder::Encoding& encoding,
                           absl::btree_set<uint32_t> codepoints) {
   absl::flat_hash_map<hb_tag_t, common::AxisRange> design_space;
@@ -6,12 +6,18 @@
  * tests.
  */
 
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
 #include "common/axis_range.h"
 #include "common/font_data.h"
+#include "common/thread_pool.h"
 #include "ift/encoder/encoder.h"
+#include "ift/proto/patch_map.h"
 
 namespace ift::client {
 
@@ -42,6 +48,41 @@ absl::StatusOr<common::FontData> Extend(
     const ift::encoder::Encoder::Encoding& encoding,
     absl::btree_set<uint32_t> codepoints);
 
+/*
+ * Runs 'ift_extend' any number of times against one encoding, which is only
+ * written to disk once by Create(). Extend() may be called concurrently from
+ * multiple threads.
+ */
+class FontationsSession {
+ public:
+  static absl::StatusOr<FontationsSession> Create(
+      const ift::encoder::Encoder::Encoding& encoding);
+
+  /*
+   * Same as ExtendWithDesignSpace() above. If non null, applied_uris will be
+   * populated with the set of uris that the client ended up fetching and
+   * applying.
+   */
+  absl::StatusOr<common::FontData> Extend(
+      const ift::proto::PatchMap::Coverage& target,
+      absl::btree_set<std::string>* applied_uris = nullptr) const;
+
+  /*
+   * Runs Extend() for each of targets on pool, so the 'ift_extend' processes
+   * run concurrently, and waits for them to finish. Results are in the same
+   * order as targets.
+   */
+  std::vector<absl::StatusOr<common::FontData>> ExtendAll(
+      const std::vector<ift::proto::PatchMap::Coverage>& targets,
+      common::ThreadPool& pool) const;
+
+ private:
+  explicit FontationsSession(std::string font_path)
+      : font_path_(std::move(font_path)) {}
+
+  std::string font_path_;
+};
+
 }  // namespace ift::client
 
 #endif  // IFT_CLIENT_FONTATIONS_CLIENT_H_
\ No newline at end of file
@@ -0,0 +1,342 @@
+#include "ift/client/in_process_client.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "common/axis_range.h"
+#include "common/font_data.h"
+#include "common/range_set.h"
+#include "common/thread_pool.h"
+#include "common/try.h"
+#include "hb.h"
+#include "ift/encoder/encoder.h"
+#include "ift/patch_applier.h"
+#include "ift/proto/ift_table.h"
+#include "ift/proto/patch_encoding.h"
+#include "ift/proto/patch_map.h"
+#include "ift/proto/patch_map_index.h"
+#include "ift/url_template.h"
+
+using absl::btree_set;
+using absl::flat_hash_map;
+using absl::Status;
+using absl::StatusOr;
+using absl::StrCat;
+using common::AxisRange;
+using common::FontData;
+using common::hb_face_unique_ptr;
+using common::make_hb_blob;
+using common::make_hb_face;
+using common::RangeSet;
+using common::ThreadPool;
+using ift::encoder::Encoder;
+using ift::proto::IFTTable;
+using ift::proto::PatchMap;
+using ift::proto::PatchMapIndex;
+using ift::proto::TABLE_KEYED_FULL;
+
+namespace ift::client {
+
+namespace {
+
+struct Candidate {
+  const PatchMap::Entry* entry;
+  const std::string* url;
+};
+
+}  // namespace
+
+static uint64_t IntersectionSize(const RangeSet& a, const RangeSet& b) {
+  uint64_t size = 0;
+  auto a_ranges = a.Ranges();
+  auto b_ranges = b.Ranges();
+  auto a_it = a_ranges.begin();
+  auto b_it = b_ranges.begin();
+  while (a_it != a_ranges.end() && b_it != b_ranges.end()) {
+    uint32_t first = std::max(a_it->first, b_it->first);
+    uint32_t last = std::min(a_it->last, b_it->last);
+    if (first <= last) {
+      size += (uint64_t)last - first + 1;
+    }
+    if (a_it->last < b_it->last) {
+      ++a_it;
+    } else {
+      ++b_it;
+    }
+  }
+  return size;
+}
+
+// Returns the invalidating candidate to apply next, or null if there are none.
+static const Candidate* SelectInvalidating(
+    const std::vector<Candidate>& candidates,
+    const PatchMap::Coverage& target) {
+  const Candidate* selected = nullptr;
+  bool selected_full = false;
+  uint64_t selected_size = 0;
+  for (const Candidate& candidate : candidates) {
+    if (!candidate.entry->IsInvalidating()) {
+      continue;
+    }
+    bool full = candidate.entry->encoding == TABLE_KEYED_FULL;
+    uint64_t size = IntersectionSize(candidate.entry->coverage.codepoints,
+                                     target.codepoints);
+    if (!selected || (full && !selected_full) ||
+        (full == selected_full && size > selected_size)) {
+      selected = &candidate;
+      selected_full = full;
+      selected_size = size;
+    }
+  }
+  return selected;
+}
+
+static Status Apply(const Encoder::Encoding& encoding, const std::string& url,
+                    PatchApplier& applier) {
+  auto it = encoding.patches.find(url);
+  if (it == encoding.patches.end()) {
+    return absl::NotFoundError(
+        StrCat("Patch '", url, "' is not in the encoding."));
+  }
+  return applier.Apply(it->second);
+}
+
+// A font reached during extension along with its decoded mapping tables.
+//
+// The font is held as a face, for intermediate fonts a face builder with the
+// tables decoded by PatchApplier, so moving between states never assembles
+// the font binary. It's only assembled if the state is returned to a caller.
+struct ClientSession::State {
+  struct Mapping {
+    IFTTable table;
+    // Refers to the entries of table.
+    std::unique_ptr<PatchMapIndex> index;
+    // The patch url of each entry in table.
+    std::vector<std::string> urls;
+  };
+
+  static StatusOr<std::shared_ptr<const State>> Load(
+      hb_face_unique_ptr face) {
+    static constexpr StatusOr<IFTTable> (*kLoaders[])(hb_face_t*) = {
+        &IFTTable::FromFont, &IFTTable::ExtensionFromFont};
+
+    auto state = std::make_shared<State>();
+    state->face = std::move(face);
+    for (auto loader : kLoaders) {
+      auto table = loader(state->face.get());
+      if (absl::IsNotFound(table.status())) {
+        continue;
+      }
+      if (!table.ok()) {
+        return table.status();
+      }
+
+      Mapping& mapping = state->mappings.emplace_back();
+      mapping.table = std::move(*table);
+      const PatchMap& patch_map = mapping.table.GetPatchMap();
+      mapping.index = std::make_unique<PatchMapIndex>(patch_map);
+      for (const auto& entry : patch_map.GetEntries()) {
+        mapping.urls.push_back(URLTemplate::PatchToUrl(
+            mapping.table.GetUrlTemplate(), entry.patch_index));
+      }
+    }
+    return state;
+  }
+
+  // Adds the entries which match target and haven't been applied yet.
+  void AddCandidates(const PatchMap::Coverage& target,
+                     const btree_set<std::string>& applied,
+                     std::vector<Candidate>& candidates) const {
+    for (const Mapping& mapping : mappings) {
+      auto entries = mapping.table.GetPatchMap().GetEntries();
+      for (uint32_t i : mapping.index->Intersecting(target)) {
+        if (!applied.contains(mapping.urls[i])) {
+          candidates.push_back({&entries[i], &mapping.urls[i]});
+        }
+      }
+    }
+  }
+
+  // Returns the font binary, which is assembled on first use.
+  FontData Font() const {
+    absl::MutexLock lock(&font_mutex);
+    if (!font) {
+      font.emplace(make_hb_blob(hb_face_reference_blob(face.get())));
+    }
+    FontData result;
+    result.shallow_copy(*font);
+    return result;
+  }
+
+  hb_face_unique_ptr face = make_hb_face(nullptr);
+  // 'IFT ' then 'IFTX', for those present in face.
+  std::vector<Mapping> mappings;
+
+ private:
+  mutable absl::Mutex font_mutex;
+  mutable std::optional<FontData> font ABSL_GUARDED_BY(font_mutex);
+};
+
+std::vector<std::string> ClientSession::NextRound(
+    const State& state, const PatchMap::Coverage& target,
+    btree_set<std::string>& applied) {
+  std::vector<Candidate> candidates;
+  state.AddCandidates(target, applied, candidates);
+
+  // Invalidating patches change the mapping, so they are applied one at a
+  // time and the mapping is then reloaded.
+  std::vector<std::string> patches;
+  const Candidate* invalidating = SelectInvalidating(candidates, target);
+  if (invalidating) {
+    applied.insert(*invalidating->url);
+    patches.push_back(*invalidating->url);
+    return patches;
+  }
+
+  for (const Candidate& candidate : candidates) {
+    if (applied.insert(*candidate.url).second) {
+      patches.push_back(*candidate.url);
+    }
+  }
+  return patches;
+}
+
+StatusOr<std::shared_ptr<const ClientSession::State>> ClientSession::Advance(
+    const State& from, const std::vector<std::string>& patches) const {
+  PatchApplier applier(from.face.get());
+  for (const std::string& url : patches) {
+    TRYV(Apply(encoding_, url, applier));
+  }
+  return State::Load(TRY(applier.Face()));
+}
+
+StatusOr<std::shared_ptr<const ClientSession::State>> ClientSession::GetState(
+    const btree_set<std::string>& applied, const State* from,
+    const std::vector<std::string>& patches) {
+  {
+    absl::MutexLock lock(&mutex_);
+    auto it = states_.find(applied);
+    if (it != states_.end()) {
+      return it->second;
+    }
+  }
+
+  std::shared_ptr<const State> state;
+  if (!from) {
+    state = TRY(State::Load(encoding_.init_font.face()));
+  } else {
+    state = TRY(Advance(*from, patches));
+  }
+
+  absl::MutexLock lock(&mutex_);
+  // If another thread built the same state concurrently keep the first one.
+  return states_.try_emplace(applied, std::move(state)).first->second;
+}
+
+StatusOr<std::shared_ptr<const ClientSession::State>> ClientSession::Walk(
+    const PatchMap::Coverage& target, btree_set<std::string>& applied,
+    std::vector<std::vector<std::string>>* rounds) {
+  std::shared_ptr<const State> state = TRY(GetState(applied, nullptr, {}));
+  while (true) {
+    btree_set<std::string> next = applied;
+    std::vector<std::string> patches = NextRound(*state, target, next);
+    if (patches.empty()) {
+      return state;
+    }
+
+    state = TRY(GetState(next, state.get(), patches));
+    applied = std::move(next);
+    if (rounds) {
+      rounds->push_back(std::move(patches));
+    }
+  }
+}
+
+StatusOr<FontData> ClientSession::Extend(const PatchMap::Coverage& target,
+                                         btree_set<std::string>* applied_uris) {
+  btree_set<std::string> applied;
+  std::shared_ptr<const State> state = TRY(Walk(target, applied, nullptr));
+
+  if (applied_uris) {
+    applied_uris->insert(applied.begin(), applied.end());
+  }
+  return state->Font();
+}
+
+StatusOr<std::vector<std::vector<std::string>>> ClientSession::Plan(
+    const PatchMap::Coverage& target) {
+  btree_set<std::string> applied;
+  std::vector<std::vector<std::string>> rounds;
+  TRYV(Walk(target, applied, &rounds).status());
+  return rounds;
+}
+
+StatusOr<std::vector<std::vector<std::string>>> ClientSession::Plan(
+    const FontData& font, const btree_set<std::string>& applied_uris,
+    const PatchMap::Coverage& target) const {
+  std::shared_ptr<const State> state = TRY(State::Load(font.face()));
+
+  btree_set<std::string> applied = applied_uris;
+  std::vector<std::vector<std::string>> rounds;
+  while (true) {
+    std::vector<std::string> patches = NextRound(*state, target, applied);
+    if (patches.empty()) {
+      return rounds;
+    }
+    state = TRY(Advance(*state, patches));
+    rounds.push_back(std::move(patches));
+  }
+}
+
+std::vector<StatusOr<FontData>> ClientSession::ExtendAll(
+    const std::vector<PatchMap::Coverage>& targets, ThreadPool& pool) {
+  std::vector<StatusOr<FontData>> results(targets.size());
+  pool.ParallelFor(targets.size(), [this, &targets, &results](uint32_t i) {
+    results[i] = Extend(targets[i]);
+  });
+  return results;
+}
+
+size_t ClientSession::NumCachedFonts() const {
+  absl::MutexLock lock(&mutex_);
+  return states_.size();
+}
+
+StatusOr<FontData> ExtendInProcess(const Encoder::Encoding& encoding,
+                                   const PatchMap::Coverage& target,
+                                   btree_set<std::string>* applied_uris) {
+  ClientSession session(encoding);
+  return session.Extend(target, applied_uris);
+}
+
+StatusOr<FontData> ExtendWithDesignSpaceInProcess(
+    const Encoder::Encoding& encoding, const btree_set<uint32_t>& codepoints,
+    const btree_set<hb_tag_t>& feature_tags,
+    const flat_hash_map<hb_tag_t, AxisRange>& design_space,
+    btree_set<std::string>* applied_uris) {
+  PatchMap::Coverage target;
+  target.codepoints = RangeSet(codepoints.begin(), codepoints.end());
+  target.features = feature_tags;
+  target.design_space.insert(design_space.begin(), design_space.end());
+  return ExtendInProcess(encoding, target, applied_uris);
+}
+
+StatusOr<FontData> ExtendInProcess(const Encoder::Encoding& encoding,
+                                   const btree_set<uint32_t>& codepoints) {
+  return ExtendWithDesignSpaceInProcess(encoding, codepoints, {}, {});
+}
+
+}  // namespace ift::client
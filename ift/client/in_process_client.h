@@ -0,0 +1,162 @@
+#ifndef IFT_CLIENT_IN_PROCESS_CLIENT_H_
+#define IFT_CLIENT_IN_PROCESS_CLIENT_H_
+
+/*
+ * A native IFT client which extends fonts directly from an in memory encoding,
+ * for use in tests and tools. Unlike fontations_client.h nothing is written to
+ * disk and no processes are spawned.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "common/axis_range.h"
+#include "common/font_data.h"
+#include "common/thread_pool.h"
+#include "ift/encoder/encoder.h"
+#include "ift/proto/patch_map.h"
+
+namespace ift::client {
+
+/**
+ * Extends the init font of encoding to cover target, following
+ * https://w3c.github.io/IFT/Overview.html#extending-font-subset.
+ *
+ * Patches are looked up in encoding.patches by url. When more than one
+ * invalidating patch matches, full invalidation patches are preferred and
+ * then the one whose codepoints overlap target the most. All matching glyph
+ * keyed patches are applied together.
+ *
+ * If non null, applied_uris will be populated with the set of uris that were
+ * applied.
+ */
+absl::StatusOr<common::FontData> ExtendInProcess(
+    const ift::encoder::Encoder::Encoding& encoding,
+    const ift::proto::PatchMap::Coverage& target,
+    absl::btree_set<std::string>* applied_uris = nullptr);
+
+/**
+ * Same as ExtendWithDesignSpace() from fontations_client.h, but runs
+ * in process.
+ */
+absl::StatusOr<common::FontData> ExtendWithDesignSpaceInProcess(
+    const ift::encoder::Encoder::Encoding& encoding,
+    const absl::btree_set<uint32_t>& codepoints,
+    const absl::btree_set<hb_tag_t>& feature_tags,
+    const absl::flat_hash_map<hb_tag_t, common::AxisRange>& design_space,
+    absl::btree_set<std::string>* applied_uris = nullptr);
+
+absl::StatusOr<common::FontData> ExtendInProcess(
+    const ift::encoder::Encoder::Encoding& encoding,
+    const absl::btree_set<uint32_t>& codepoints);
+
+/*
+ * Runs many extension queries against a single encoding. Extend() gives the
+ * same results as ExtendInProcess().
+ *
+ * Every intermediate font reached while extending is memoized, along with
+ * its decoded mapping tables, keyed by the set of patches applied to reach
+ * it. Queries which share a sequence of patches only apply the patches past
+ * the shared prefix. Memoized fonts are kept for the life of the session.
+ *
+ * Extend() may be called concurrently from multiple threads. The encoding
+ * must outlive the session.
+ */
+class ClientSession {
+ public:
+  explicit ClientSession(const ift::encoder::Encoder::Encoding& encoding)
+      : encoding_(encoding) {}
+
+  ClientSession(const ClientSession&) = delete;
+  ClientSession& operator=(const ClientSession&) = delete;
+
+  absl::StatusOr<common::FontData> Extend(
+      const ift::proto::PatchMap::Coverage& target,
+      absl::btree_set<std::string>* applied_uris = nullptr);
+
+  /*
+   * Runs Extend() for each of targets on pool and waits for them to finish.
+   * Results are in the same order as targets. Only these extensions are
+   * waited on, so pool may be shared.
+   */
+  std::vector<absl::StatusOr<common::FontData>> ExtendAll(
+      const std::vector<ift::proto::PatchMap::Coverage>& targets,
+      common::ThreadPool& pool);
+
+  /*
+   * Plans the patches needed to extend the init font to cover target, for
+   * example so that a server can push them all at once. Returns the patch urls
+   * grouped into rounds, in the order Extend() applies them. The urls of a
+   * round are only discoverable by a client once the previous rounds are
+   * applied.
+   */
+  absl::StatusOr<std::vector<std::vector<std::string>>> Plan(
+      const ift::proto::PatchMap::Coverage& target);
+
+  /*
+   * Same as above but starts from font, which must have been produced by
+   * applying patches of this encoding. applied_uris holds the urls a client
+   * has already applied to font, only the glyph keyed ones matter since table
+   * keyed patches replace the mapping. Nothing is memoized.
+   */
+  absl::StatusOr<std::vector<std::vector<std::string>>> Plan(
+      const common::FontData& font,
+      const absl::btree_set<std::string>& applied_uris,
+      const ift::proto::PatchMap::Coverage& target) const;
+
+  // The number of distinct fonts memoized so far.
+  size_t NumCachedFonts() const;
+
+ private:
+  struct State;
+
+  /*
+   * Returns the memoized state reached by applying patches to from, which is
+   * keyed by applied. If from is null the state for the init font is
+   * returned.
+   */
+  absl::StatusOr<std::shared_ptr<const State>> GetState(
+      const absl::btree_set<std::string>& applied, const State* from,
+      const std::vector<std::string>& patches);
+
+  /*
+   * Selects the patches to apply next from the entries of state which match
+   * target and are not in applied. They are added to applied.
+   */
+  static std::vector<std::string> NextRound(
+      const State& state, const ift::proto::PatchMap::Coverage& target,
+      absl::btree_set<std::string>& applied);
+
+  // Applies patches to the font of from and loads the result.
+  absl::StatusOr<std::shared_ptr<const State>> Advance(
+      const State& from, const std::vector<std::string>& patches) const;
+
+  /*
+   * Extends the init font to cover target using memoized states. Populates
+   * applied with the patches applied and, if non null, rounds with them
+   * grouped by round.
+   */
+  absl::StatusOr<std::shared_ptr<const State>> Walk(
+      const ift::proto::PatchMap::Coverage& target,
+      absl::btree_set<std::string>& applied,
+      std::vector<std::vector<std::string>>* rounds);
+
+  const ift::encoder::Encoder::Encoding& encoding_;
+
+  mutable absl::Mutex mutex_;
+  absl::flat_hash_map<absl::btree_set<std::string>,
+                      std::shared_ptr<const State>>
+      states_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace ift::client
+
+#endif  // IFT_CLIENT_IN_PROCESS_CLIENT_H_
@@ -3,30 +3,48 @@
 #include <algorithm>
 #include <cstdint>
 #include <cstdio>
+#include <functional>
 #include <iterator>
 #include <memory>
+#include <numeric>
 #include <optional>
+#include <thread>
+#include <utility>
 
+#include "absl/base/casts.h"
+#include "absl/container/btree_map.h"
+#include "absl/log/log.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "brotli/brotli_font_diff.h"
 #include "common/axis_range.h"
 #include "common/binary_diff.h"
+#include "common/brotli_binary_diff.h"
 #include "common/compat_id.h"
+#include "common/disk_cache.h"
 #include "common/font_data.h"
 #include "common/font_helper.h"
+#include "common/glyph_data_index.h"
 #include "common/hb_set_unique_ptr.h"
+#include "common/range_set.h"
+#include "common/thread_pool.h"
+#include "common/trace.h"
 #include "common/try.h"
 #include "common/woff2.h"
 #include "hb-subset.h"
+#include "ift/encoder/encoder_stats.h"
 #include "ift/encoder/subset_definition.h"
 #include "ift/glyph_keyed_diff.h"
+#include "ift/proto/format_2_patch_map.h"
 #include "ift/proto/ift_table.h"
 #include "ift/proto/patch_encoding.h"
 #include "ift/proto/patch_map.h"
 #include "ift/url_template.h"
 
+using absl::btree_map;
 using absl::btree_set;
 using absl::flat_hash_map;
 using absl::flat_hash_set;
@@ -34,19 +52,27 @@ using absl::Status;
 using absl::StatusOr;
 using absl::StrCat;
 using absl::string_view;
+using brotli::GlyphMapping;
 using common::AxisRange;
 using common::BinaryDiff;
+using common::BrotliBinaryDiff;
 using common::CompatId;
 using common::FontData;
 using common::FontHelper;
+using common::GlyphDataIndex;
 using common::hb_blob_unique_ptr;
 using common::hb_face_unique_ptr;
 using common::hb_set_unique_ptr;
 using common::make_hb_blob;
 using common::make_hb_face;
 using common::make_hb_set;
+using common::RangeSet;
+using common::ThreadPool;
+using common::TraceSpan;
 using common::Woff2;
 using ift::GlyphKeyedDiff;
+using ift::GlyphKeyedStreamCache;
+using ift::proto::Format2PatchMap;
 using ift::proto::GLYPH_KEYED;
 using ift::proto::IFTTable;
 using ift::proto::PatchEncoding;
@@ -56,35 +82,210 @@ using ift::proto::TABLE_KEYED_PARTIAL;
 
 namespace ift::encoder {
 
-void Encoder::AddCombinations(const std::vector<const SubsetDefinition*>& in,
-                              uint32_t choose,
-                              std::vector<SubsetDefinition>& out) {
-  if (!choose || in.size() < choose) {
-    return;
+// Compat ids (see Encoder::ProcessingContext::GenerateCompatId()) must be
+// stable across runs and platforms so they are computed with a fixed hash
+// function (FNV-1a) instead of absl::Hash which is randomly seeded per process.
+static constexpr uint64_t kFnvOffsetBasis = 0xcbf29ce484222325ull;
+static constexpr uint64_t kFnvPrime = 0x100000001b3ull;
+
+static constexpr uint32_t kTableKeyedCompatId = 0;
+static constexpr uint32_t kGlyphKeyedCompatId = 1;
+static constexpr uint32_t kNodeFingerprint = 2;
+static constexpr uint32_t kEdgeFingerprint = 3;
+static constexpr uint32_t kGlyphKeyedFingerprint = 4;
+static constexpr uint32_t kConditionFingerprint = 5;
+static constexpr uint32_t kBaseSubsetFingerprint = 6;
+static constexpr uint32_t kSubsetCacheKey = 7;
+static constexpr uint32_t kGlyphKeyedContentHash = 8;
+
+// Mixed into subset cache keys. Must be incremented whenever a change to the
+// encoder alters the subsets it produces (other than through the subsetter
+// flags or harfbuzz version, which are keyed separately) so that previously
+// cached subsets aren't reused.
+static constexpr uint32_t kSubsetCacheVersion = 1;
+
+// Mixed into the content hash of glyph keyed patches. Must be incremented
+// whenever a change to the encoder alters the glyph keyed patches generated
+// from the same glyph data, so that the changed patches get new urls.
+static constexpr uint32_t kGlyphKeyedPatchFormatVersion = 1;
+
+static uint64_t Fnv1a(uint64_t h, absl::string_view data) {
+  for (char c : data) {
+    h ^= (uint8_t)c;
+    h *= kFnvPrime;
   }
+  return h;
+}
+
+static uint64_t Fnv1a(uint64_t h, uint32_t value) {
+  for (uint32_t i = 0; i < 4; i++) {
+    h ^= (value >> (i * 8)) & 0xFF;
+    h *= kFnvPrime;
+  }
+  return h;
+}
 
-  if (choose == 1) {
-    for (auto item : in) {
-      out.push_back(*item);
+static uint64_t Fnv1a(uint64_t h, uint64_t value) {
+  h = Fnv1a(h, (uint32_t)(value >> 32));
+  return Fnv1a(h, (uint32_t)(value & 0xFFFFFFFF));
+}
+
+static uint64_t Fnv1a(uint64_t h, const CompatId& id) {
+  for (uint32_t i = 0; i < 4; i++) {
+    h = Fnv1a(h, id.as_ptr()[i]);
+  }
+  return h;
+}
+
+template <typename T>
+static uint64_t Fnv1aSorted(uint64_t h, const T& values) {
+  std::vector<uint32_t> sorted(values.begin(), values.end());
+  std::sort(sorted.begin(), sorted.end());
+  h = Fnv1a(h, (uint32_t)sorted.size());
+  for (uint32_t v : sorted) {
+    h = Fnv1a(h, v);
+  }
+  return h;
+}
+
+// Range sets iterate in sorted order so don't need to be copied and sorted,
+// the hash is the same as for any other container.
+static uint64_t Fnv1aSorted(uint64_t h, const RangeSet& values) {
+  h = Fnv1a(h, (uint32_t)values.size());
+  for (uint32_t v : values) {
+    h = Fnv1a(h, v);
+  }
+  return h;
+}
+
+// A second stable hash (built on the splitmix64 finalizer) which shares no
+// structure with FNV-1a. Used to confirm that glyph keyed content with
+// matching FNV-1a hashes is actually the same content.
+static uint64_t Digest(uint64_t d, uint64_t value) {
+  uint64_t x = (d ^ value) + 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+static uint64_t Digest(uint64_t d, absl::string_view data) {
+  d = Digest(d, (uint64_t)data.size());
+  uint64_t word = 0;
+  for (size_t i = 0; i < data.size(); i++) {
+    word = (word << 8) | (uint8_t)data[i];
+    if (i % 8 == 7) {
+      d = Digest(d, word);
+      word = 0;
     }
-    return;
   }
+  return Digest(d, word);
+}
+
+static uint64_t StableHash(uint64_t seed, uint32_t kind,
+                           const SubsetDefinition& def) {
+  uint64_t h = Fnv1a(seed, kind);
+  h = Fnv1aSorted(h, def.codepoints);
+  h = Fnv1aSorted(h, def.gids);
+  h = Fnv1aSorted(h, def.feature_tags);
+
+  btree_map<hb_tag_t, AxisRange> design_space(def.design_space.begin(),
+                                              def.design_space.end());
+  h = Fnv1a(h, (uint32_t)design_space.size());
+  for (const auto& [tag, range] : design_space) {
+    h = Fnv1a(h, tag);
+    h = Fnv1a(h, absl::bit_cast<uint32_t>(range.start()));
+    h = Fnv1a(h, absl::bit_cast<uint32_t>(range.end()));
+  }
+  return h;
+}
 
-  for (auto it = in.begin(); it != in.end(); it++) {
-    auto it_inner = it + 1;
-    std::vector<const SubsetDefinition*> remaining;
-    std::copy(it_inner, in.end(), std::back_inserter(remaining));
+static uint64_t Fnv1a(uint64_t h, const BrotliBinaryDiff::Options& options) {
+  h = Fnv1a(h, options.quality);
+  h = Fnv1a(h, options.lgwin);
+  h = Fnv1a(h, options.adaptive_threshold);
+  return Fnv1a(h, options.small_input_quality);
+}
 
-    std::vector<SubsetDefinition> combinations;
-    AddCombinations(remaining, choose - 1, combinations);
-    for (auto& s : combinations) {
-      s.Union(**it);
-      out.push_back(std::move(s));
+static uint64_t Fnv1a(uint64_t h, const PatchMap::Coverage& coverage) {
+  h = Fnv1aSorted(h, coverage.codepoints);
+  h = Fnv1aSorted(h, coverage.features);
+  h = Fnv1a(h, (uint32_t)coverage.design_space.size());
+  for (const auto& [tag, range] : coverage.design_space) {
+    h = Fnv1a(h, tag);
+    h = Fnv1a(h, absl::bit_cast<uint32_t>(range.start()));
+    h = Fnv1a(h, absl::bit_cast<uint32_t>(range.end()));
+  }
+  h = Fnv1a(h, (uint32_t)coverage.conjunctive);
+  return Fnv1aSorted(h, coverage.child_indices);
+}
+
+// Steps the provided state returning the next value in the sequence, see:
+// https://prng.di.unimi.it/splitmix64.c
+static uint64_t SplitMix64(uint64_t& state) {
+  uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+namespace {
+
+/*
+ * Enumerates the combinations of between 1 and max_size of count items,
+ * ordered by size and then lexicographically by item index. Only the indices
+ * of the current combination are held, so this is cheap even when the number
+ * of combinations is very large.
+ */
+class Combinations {
+ public:
+  Combinations(uint32_t count, uint32_t max_size)
+      : count_(count), max_size_(std::min(count, max_size)) {}
+
+  // Moves to the next combination. Returns false once all have been visited.
+  bool Next() {
+    uint32_t size = indices_.size();
+    // Advance the right most index which isn't at its last position.
+    for (uint32_t i = size; i-- > 0;) {
+      if (indices_[i] < count_ - size + i) {
+        indices_[i]++;
+        for (uint32_t j = i + 1; j < size; j++) {
+          indices_[j] = indices_[j - 1] + 1;
+        }
+        return true;
+      }
+    }
+
+    if (size >= max_size_) {
+      return false;
     }
+    indices_.resize(size + 1);
+    std::iota(indices_.begin(), indices_.end(), 0);
+    return true;
   }
+
+  // Sorted indices of the items in the current combination.
+  const std::vector<uint32_t>& Indices() const { return indices_; }
+
+ private:
+  uint32_t count_;
+  uint32_t max_size_;
+  std::vector<uint32_t> indices_;
+};
+
+}  // namespace
+
+SubsetDefinition Encoder::UnionOf(const std::vector<SubsetDefinition>& segments,
+                                  const std::vector<uint32_t>& indices) {
+  // Union in reverse so that the result matches unioning each segment into
+  // the combination of the segments which follow it.
+  SubsetDefinition result = segments[indices.back()];
+  for (auto it = indices.rbegin() + 1; it != indices.rend(); it++) {
+    result.Union(segments[*it]);
+  }
+  return result;
 }
 
-StatusOr<FontData> Encoder::FullyExpandedSubset(
+SubsetDefinition Encoder::FullyExpandedDefinition(
     const ProcessingContext& context) const {
   SubsetDefinition all;
   all.Union(context.base_subset_);
@@ -102,8 +303,14 @@ StatusOr<FontData> Encoder::FullyExpandedSubset(
   // space.
   // TODO(garretrieger): once union works correctly remove this.
   all.design_space.clear();
+  return all;
+}
 
-  return CutSubset(context, face_.get(), all);
+StatusOr<FontData> Encoder::FullyExpandedSubset(
+    const ProcessingContext& context) const {
+  EncoderStats::Timer timer(stats_, EncoderStats::FULLY_EXPANDED_SUBSET);
+  return CutSubset(context, face_.get(), context.input_font_hash_,
+                   FullyExpandedDefinition(context));
 }
 
 bool is_subset(const flat_hash_set<uint32_t>& a,
@@ -112,29 +319,37 @@ bool is_subset(const flat_hash_set<uint32_t>& a,
                      [&a](const uint32_t& v) { return a.count(v) > 0; });
 }
 
-std::vector<SubsetDefinition> Encoder::OutgoingEdges(
-    const SubsetDefinition& base_subset, uint32_t choose) const {
+std::vector<SubsetDefinition> Encoder::RemainingSegments(
+    const SubsetDefinition& base_subset,
+    std::vector<uint64_t>* covered) const {
+  if (covered) {
+    covered->assign((extension_subsets_.size() + 63) / 64, 0);
+  }
+
   std::vector<SubsetDefinition> remaining_subsets;
-  for (const auto& s : extension_subsets_) {
-    SubsetDefinition filtered = s;
+  for (uint32_t i = 0; i < extension_subsets_.size(); i++) {
+    SubsetDefinition filtered = extension_subsets_[i];
     filtered.Subtract(base_subset);
     if (filtered.empty()) {
+      if (covered) {
+        (*covered)[i / 64] |= 1ull << (i % 64);
+      }
       continue;
     }
 
     remaining_subsets.push_back(std::move(filtered));
   }
+  return remaining_subsets;
+}
 
-  std::vector<const SubsetDefinition*> input;
-  for (const auto& s : remaining_subsets) {
-    input.push_back(&s);
-  }
-
+std::vector<SubsetDefinition> Encoder::OutgoingEdges(
+    const SubsetDefinition& base_subset, uint32_t choose) const {
+  std::vector<SubsetDefinition> remaining = RemainingSegments(base_subset);
   std::vector<SubsetDefinition> result;
-  for (uint32_t i = 1; i <= choose; i++) {
-    AddCombinations(input, i, result);
+  Combinations combinations(remaining.size(), choose);
+  while (combinations.Next()) {
+    result.push_back(UnionOf(remaining, combinations.Indices()));
   }
-
   return result;
 }
 
@@ -204,13 +419,78 @@ void Encoder::AddDesignSpaceSegment(const design_space_t& space) {
   extension_subsets_.push_back(def);
 }
 
-StatusOr<Encoder::Encoding> Encoder::Encode() const {
-  if (!face_) {
-    return absl::FailedPreconditionError("Encoder must have a face set.");
+// Returns the tables which glyph keyed patches carry the data of.
+static flat_hash_set<hb_tag_t> GlyphKeyedTables() {
+  return {FontHelper::kGlyf, FontHelper::kGvar, FontHelper::kCFF,
+          FontHelper::kCFF2};
+}
+
+// Lower bound on the number of table keyed patches generated per batch.
+static constexpr uint32_t kMinBatchSize = 64;
+
+// Runs all of the tasks on pool and waits for them to finish. Returns the
+// first error (in task order) if any task failed. Only these tasks are waited
+// on so the pool can be shared with other callers, including from tasks
+// already running on it.
+static Status RunTasks(ThreadPool& pool,
+                       const std::vector<std::function<Status()>>& tasks) {
+  std::vector<Status> results(tasks.size());
+  pool.ParallelFor(tasks.size(),
+                   [&](uint32_t i) { results[i] = tasks[i](); });
+
+  for (const auto& sc : results) {
+    if (!sc.ok()) {
+      return sc;
+    }
   }
+  return absl::OkStatus();
+}
 
-  ProcessingContext context(next_id_);
-  context.base_subset_ = base_subset_;
+namespace {
+
+// Runs a single task at a time on a background thread. Starting a task first
+// waits for the previous one, so at most one is ever queued.
+class BackgroundTask {
+ public:
+  ~BackgroundTask() { Wait().IgnoreError(); }
+
+  // Waits for the previous task and returns its error if it failed,
+  // otherwise starts task.
+  Status Start(std::function<Status()> task) {
+    TRYV(Wait());
+    thread_ = std::thread([this, task = std::move(task)]() {
+      status_ = task();
+    });
+    return absl::OkStatus();
+  }
+
+  // Waits for the current task and returns the first error of any task.
+  Status Wait() {
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+    return status_;
+  }
+
+ private:
+  std::thread thread_;
+  Status status_;
+};
+
+}  // namespace
+
+// Returns the max uncompressed length field from the header of a glyph keyed
+// patch: https://w3c.github.io/IFT/Overview.html#glyph-keyed
+static uint64_t GlyphKeyedUncompressedLength(const FontData& patch) {
+  constexpr uint32_t kOffset = 25;
+  if (patch.size() < kOffset + 4) {
+    return 0;
+  }
+  return FontHelper::ReadUInt32(patch.str().substr(kOffset)).value_or(0);
+}
+
+SubsetDefinition Encoder::RootSubset() const {
+  SubsetDefinition root = base_subset_;
   if (IsMixedMode()) {
     // Glyph keyed patches can't change the glyph count in the font (and hence
     // loca len) so always include the last gid in the base subset to force the
@@ -230,32 +510,807 @@ StatusOr<Encoder::Encoding> Encoder::Encode() const {
     //                     require us to examine conditions against each subset
     //                     to determine patch reachability.
     uint32_t gid_count = hb_face_get_glyph_count(face_.get());
-    if (gid_count > 0) context.base_subset_.gids.insert(gid_count - 1);
+    if (gid_count > 0) root.gids.insert(gid_count - 1);
+  }
+  return root;
+}
+
+StatusOr<Encoder::Encoding> Encoder::Encode() const {
+  MemoryPatchSink sink;
+  auto result = Encode(sink);
+  if (!result.ok()) {
+    return result.status();
+  }
+
+  result->patches = sink.TakePatches();
+  return result;
+}
+
+Status Encoder::ValidateConfiguration() const {
+  if (!face_) {
+    return absl::FailedPreconditionError("Encoder must have a face set.");
+  }
+
+  if (max_depth_ == 1) {
+    return absl::InvalidArgumentError("max_depth must be 0 or at least 2.");
+  }
+  TRYV(table_keyed_brotli_options_.Validate());
+  TRYV(glyph_keyed_brotli_options_.Validate());
+
+  if (glyph_keyed_dictionary_size_ && !allow_non_conformant_) {
+    return absl::InvalidArgumentError(
+        "Glyph keyed dictionaries produce a non-conformant encoding, "
+        "SetAllowNonConformant() must be set to use them.");
+  }
+
+  if (content_addressed_glyph_keyed_patches_ && glyph_keyed_dictionary_size_) {
+    return absl::InvalidArgumentError(
+        "Content addressed glyph keyed patches can't use a dictionary.");
+  }
+
+  return absl::OkStatus();
+}
+
+Status Encoder::InitContext(ProcessingContext& context) const {
+  TRYV(ValidateConfiguration());
+
+  context.base_subset_ = RootSubset();
+
+  {
+    hb_blob_unique_ptr blob = make_hb_blob(hb_face_reference_blob(face_.get()));
+    FontData input(blob.get());
+    context.input_font_hash_ = Fnv1a(kFnvOffsetBasis, input.str());
+    context.compat_id_seed_ = context.input_font_hash_;
+  }
+
+  if (content_addressed_glyph_keyed_patches_) {
+    // Content addressed urls ensure a patch is never fetched for a font it
+    // wasn't generated from, so the compat id can stay the same across
+    // releases.
+    context.glyph_keyed_compat_id_seed_ =
+        Fnv1a(kFnvOffsetBasis, kGlyphKeyedContentHash);
+  } else {
+    context.glyph_keyed_compat_id_seed_ = context.compat_id_seed_;
   }
 
   context.force_long_loca_and_gvar_ = false;
+  context.has_cff_outlines_ =
+      !FontHelper::TableData(face_.get(), FontHelper::kCFF).empty() ||
+      !FontHelper::TableData(face_.get(), FontHelper::kCFF2).empty();
   auto expanded = FullyExpandedSubset(context);
   if (!expanded.ok()) {
     return expanded.status();
   }
 
   context.fully_expanded_subset_.shallow_copy(*expanded);
+  context.fully_expanded_hash_ =
+      Fnv1a(kFnvOffsetBasis, context.fully_expanded_subset_.str());
   auto expanded_face = expanded->face();
+  context.fully_expanded_face_ =
+      make_hb_face(hb_subset_preprocess(expanded_face.get()));
   context.force_long_loca_and_gvar_ =
       FontHelper::HasLongLoca(expanded_face.get()) ||
       FontHelper::HasWideGvar(expanded_face.get());
 
-  auto init_font = Encode(context, context.base_subset_, true);
-  if (!init_font.ok()) {
-    return init_font.status();
+  // All outputs are derived from the fully expanded subset so it, along with
+  // the other encoder wide settings, is included in every fingerprint.
+  context.fingerprint_seed_ =
+      Fnv1a(context.compat_id_seed_, context.fully_expanded_hash_);
+  context.fingerprint_seed_ = Fnv1a(
+      context.fingerprint_seed_, (uint32_t)context.force_long_loca_and_gvar_);
+  for (const auto& options :
+       {table_keyed_brotli_options_, glyph_keyed_brotli_options_}) {
+    context.fingerprint_seed_ = Fnv1a(context.fingerprint_seed_, options);
+  }
+  if (glyph_keyed_dictionary_size_) {
+    // Only mixed in when set so that existing fingerprints are unchanged.
+    context.fingerprint_seed_ =
+        Fnv1a(context.fingerprint_seed_, glyph_keyed_dictionary_size_);
   }
+  context.fingerprint_seed_ =
+      StableHash(context.fingerprint_seed_, kBaseSubsetFingerprint,
+                 context.base_subset_);
+  for (const auto& condition : glyph_patch_conditions_) {
+    context.fingerprint_seed_ =
+        StableHash(context.fingerprint_seed_, kConditionFingerprint,
+                   condition.subset_definition);
+    context.fingerprint_seed_ =
+        Fnv1aSorted(context.fingerprint_seed_, condition.child_conditions);
+    context.fingerprint_seed_ = Fnv1a(context.fingerprint_seed_,
+                                      (uint32_t)condition.conjunctive);
+    context.fingerprint_seed_ = Fnv1a(
+        context.fingerprint_seed_, condition.activated_patch_id.value_or(-1));
+  }
+  return absl::OkStatus();
+}
 
+StatusOr<Encoder::Encoding> Encoder::Encode(PatchSink& sink) const {
+  EncoderStats::Timer timer(stats_, EncoderStats::ENCODE);
+  ProcessingContext context(next_id_);
+  TRYV(InitContext(context));
+
+  uint32_t root = PlanGraph(context, context.base_subset_,
+                            max_depth_ ? max_depth_ : UINT32_MAX);
+  TRYV(AssignGlyphKeyedPatchIds(context));
+  ComputeFingerprints(context, root);
+  TRYV(CheckProgress());
+
+  // All ids have been assigned by the planning step, so from here on the
+  // graph nodes, glyph keyed patch sets, and table keyed patches can be
+  // produced in any order.
+  std::optional<ThreadPool> owned_pool;
+  if (!thread_pool_) {
+    owned_pool.emplace(num_threads_);
+  }
+  ThreadPool& pool = thread_pool_ ? *thread_pool_ : *owned_pool;
+  context.pool_ = &pool;
   Encoding result;
-  result.init_font.shallow_copy(*init_font);
-  result.patches = std::move(context.patches_);
+  result.glyph_keyed_patch_ids = context.glyph_keyed_content_ids_;
+
+  // Outputs which match a prior artifact don't need to be regenerated. A node
+  // only needs to be built if it's the init font or if it's the base or target
+  // of at least one patch which must be regenerated. pending tracks the number
+  // of patches still to be generated which need each node, once it reaches
+  // zero the node's font is released.
+  uint32_t num_critical = 0;
+  std::vector<std::pair<uint32_t, const GraphEdge*>> edges =
+      EdgeOrder(context, root, num_critical);
+  std::vector<uint32_t> pending(context.nodes_.size(), 0);
+  for (const auto& [node_index, edge] : edges) {
+    if (!FindPriorArtifact(edge->fingerprint)) {
+      pending[node_index]++;
+      pending[edge->child_index]++;
+    }
+  }
+
+  if (progress_) {
+    bool build_root = !FindPriorArtifact(context.nodes_[root].fingerprint);
+    uint32_t num_nodes = 0;
+    for (uint32_t i = 0; i < pending.size(); i++) {
+      if (pending[i] || (i == root && build_root)) {
+        num_nodes++;
+      }
+    }
+    uint64_t num_patches =
+        (NumReachableGlyphSegments() + (glyph_keyed_dictionary_size_ ? 1 : 0)) *
+        context.patch_set_design_spaces_.size();
+    progress_->Add(Progress::NODES_TOTAL, num_nodes);
+    progress_->Add(Progress::PATCHES_TOTAL, edges.size() + num_patches);
+  }
+
+  // The init font only depends on the glyph keyed patch ids, not the patches,
+  // so it's produced first.
+  const GraphNode& root_node = context.nodes_[root];
+  const FontData* prior_root = FindPriorArtifact(root_node.fingerprint);
+  if (prior_root) {
+    result.init_font.shallow_copy(*prior_root);
+  } else {
+    result.init_font = TRY(BuildNode(context, root_node, true,
+                                     &context.nodes_[root].glyph_mapping));
+    context.nodes_[root].font.shallow_copy(result.init_font);
+    RecordProgress(Progress::NODES_DONE);
+  }
+  result.init_font_fingerprint = root_node.fingerprint;
+  TRYV(sink.AddInitFont(result.init_font, result.init_font_fingerprint));
+
+  // On the critical path only the patch set for the init font's design space
+  // is needed, the rest wait until the critical table keyed patches are done.
+  std::vector<design_space_t> deferred_patch_sets;
+  if (critical_path_first_ && !context.patch_set_design_spaces_.empty()) {
+    const design_space_t& root_design_space = root_node.subset.design_space;
+    for (const auto& design_space : context.patch_set_design_spaces_) {
+      if (design_space != root_design_space) {
+        deferred_patch_sets.push_back(design_space);
+      }
+    }
+    TRYV(EmitGlyphKeyedPatches(context, {root_design_space}, pool, sink,
+                               result));
+    if (!num_critical) {
+      TRYV(sink.CriticalPathDone());
+      TRYV(EmitGlyphKeyedPatches(context, deferred_patch_sets, pool, sink,
+                                 result));
+    }
+  } else {
+    TRYV(EmitGlyphKeyedPatches(context, context.patch_set_design_spaces_,
+                               pool, sink, result));
+  }
+
+  // Table keyed patches are generated in batches (see EdgeOrder()). Each
+  // batch first builds any nodes which are needed but not yet available, then
+  // generates the patches. Nodes are freed as soon as all patches which touch
+  // them are done, bounding memory use by the number of nodes which are
+  // concurrently in use rather than the total size of the graph.
+  //
+  // When running on multiple threads each finished batch is passed to the sink
+  // on a background thread while the next batch is generated, so that slow
+  // sinks overlap with subsetting and diffing. Only one finished batch waits
+  // for output at a time: a sink which can't keep up throttles generation
+  // instead of letting finished patches pile up in memory.
+  std::string table_keyed_uri_template = UrlTemplate(0);
+  const uint32_t batch_size = std::max(kMinBatchSize, 4 * pool.NumThreads());
+  std::vector<bool> built(context.nodes_.size(), false);
+  built[root] = !prior_root;
+  BackgroundTask output;
+  for (uint32_t start = 0; start < edges.size();) {
+    TRYV(CheckProgress());
+    uint32_t end = std::min((uint32_t)edges.size(), start + batch_size);
+    if (start < num_critical) {
+      // The critical path ends on a batch boundary so it can be reported as
+      // soon as it's been output.
+      end = std::min(end, num_critical);
+    }
+
+    std::vector<uint32_t> to_build;
+    for (uint32_t i = start; i < end; i++) {
+      const auto& [node_index, edge] = edges[i];
+      if (FindPriorArtifact(edge->fingerprint)) {
+        continue;
+      }
+      for (uint32_t index : {node_index, edge->child_index}) {
+        if (!built[index]) {
+          built[index] = true;
+          to_build.push_back(index);
+        }
+      }
+    }
+
+    std::vector<StatusOr<FontData>> nodes(to_build.size());
+    std::vector<std::shared_ptr<const GlyphMapping>> mappings(to_build.size());
+    std::vector<std::function<Status()>> tasks;
+    for (uint32_t i = 0; i < to_build.size(); i++) {
+      tasks.push_back([&, i]() {
+        TRYV(CheckProgress());
+        // The root is rebuilt when it came from a prior artifact but some of
+        // its edges didn't, it must match the (woff2 round tripped) init font.
+        nodes[i] = BuildNode(context, context.nodes_[to_build[i]],
+                             to_build[i] == root, &mappings[i]);
+        if (nodes[i].ok()) {
+          RecordProgress(Progress::NODES_DONE);
+        }
+        return nodes[i].status();
+      });
+    }
+    TRYV(RunTasks(pool, tasks));
+    for (uint32_t i = 0; i < to_build.size(); i++) {
+      context.nodes_[to_build[i]].font = std::move(*nodes[i]);
+      context.nodes_[to_build[i]].glyph_mapping = std::move(mappings[i]);
+    }
+
+    // Shared since tasks must be copyable, which FontData isn't.
+    auto patches =
+        std::make_shared<std::vector<StatusOr<FontData>>>(end - start);
+    tasks.clear();
+    for (uint32_t i = start; i < end; i++) {
+      const auto& [node_index, edge] = edges[i];
+      if (FindPriorArtifact(edge->fingerprint)) {
+        continue;
+      }
+      tasks.push_back([&, i, node_index = node_index, edge = edge]() {
+        TRYV(CheckProgress());
+        (*patches)[i - start] =
+            BuildEdge(context, context.nodes_[node_index], *edge);
+        return (*patches)[i - start].status();
+      });
+    }
+    TRYV(RunTasks(pool, tasks));
+
+    // Nodes are only released once no later batch needs them, so this never
+    // touches a node which is being built or diffed concurrently.
+    auto emit = [&, start, end, patches]() -> Status {
+      for (uint32_t i = start; i < end; i++) {
+        TRYV(CheckProgress());
+        const auto& [node_index, edge] = edges[i];
+        std::string url =
+            URLTemplate::PatchToUrl(table_keyed_uri_template, edge->patch_id);
+        result.fingerprints[url] = edge->fingerprint;
+
+        const FontData* prior = FindPriorArtifact(edge->fingerprint);
+        if (prior) {
+          TRYV(sink.Add(url, *prior, edge->fingerprint));
+          RecordProgress(Progress::PATCHES_EMITTED);
+          continue;
+        }
+
+        TRYV(sink.Add(url, *(*patches)[i - start], edge->fingerprint));
+        RecordProgress(Progress::PATCHES_EMITTED);
+        for (uint32_t index : {node_index, edge->child_index}) {
+          if (!--pending[index]) {
+            context.nodes_[index].font = FontData();
+            context.nodes_[index].glyph_mapping = nullptr;
+          }
+        }
+      }
+
+      if (end == num_critical) {
+        TRYV(sink.CriticalPathDone());
+        if (!deferred_patch_sets.empty()) {
+          TRYV(EmitGlyphKeyedPatches(context, deferred_patch_sets, pool, sink,
+                                     result));
+        }
+      }
+      return absl::OkStatus();
+    };
+    if (pool.NumThreads() > 1) {
+      TRYV(output.Start(emit));
+    } else {
+      TRYV(emit());
+    }
+    start = end;
+  }
+
+  TRYV(output.Wait());
+  TRYV(sink.Flush());
+  return result;
+}
+
+StatusOr<std::unique_ptr<Encoder::LazyEncoding>> Encoder::EncodeLazy() const {
+  EncoderStats::Timer timer(stats_, EncoderStats::ENCODE);
+  std::unique_ptr<LazyEncoding> lazy(new LazyEncoding(*this));
+  ProcessingContext& context = lazy->context_;
+  TRYV(InitContext(context));
+
+  lazy->root_ = PlanGraph(context, context.base_subset_,
+                          max_depth_ ? max_depth_ : UINT32_MAX);
+  TRYV(AssignGlyphKeyedPatchIds(context));
+  ComputeFingerprints(context, lazy->root_);
+
+  // Lazy builds run with their node or patch state locked, and their diffs
+  // call ParallelFor() which may run unrelated queued tasks on the waiting
+  // thread. So they use a pool private to this encoding, where every task is
+  // a diff item that never takes those locks, rather than the shared pool
+  // which could have other Patch() calls queued.
+  lazy->owned_pool_.emplace(thread_pool_ ? thread_pool_->NumThreads()
+                                         : num_threads_);
+  ThreadPool& pool = thread_pool_ ? *thread_pool_ : *lazy->owned_pool_;
+  context.pool_ = &pool;
+
+  // The number of glyph keyed patches is linear in the number of segments so
+  // they're all generated now, only the table keyed graph is deferred.
+  MemoryPatchSink sink;
+  Encoding glyph_keyed;
+  TRYV(EmitGlyphKeyedPatches(context, context.patch_set_design_spaces_, pool,
+                             sink, glyph_keyed));
+  lazy->glyph_keyed_patches_ = sink.TakePatches();
+  lazy->fingerprints_ = std::move(glyph_keyed.fingerprints);
+  context.pool_ = &*lazy->owned_pool_;
+
+  for (uint32_t i = 0; i < context.nodes_.size(); i++) {
+    lazy->node_states_.push_back(std::make_unique<LazyEncoding::NodeState>());
+  }
+
+  const GraphNode& root_node = context.nodes_[lazy->root_];
+  lazy->init_font_fingerprint_ = root_node.fingerprint;
+  const FontData* prior_root = FindPriorArtifact(root_node.fingerprint);
+  if (prior_root) {
+    lazy->init_font_.shallow_copy(*prior_root);
+  } else {
+    TRYV(lazy->EnsureBuilt(lazy->root_));
+    lazy->init_font_.shallow_copy(root_node.font);
+  }
+
+  std::string table_keyed_uri_template = UrlTemplate(0);
+  for (uint32_t i = 0; i < context.nodes_.size(); i++) {
+    for (const auto& edge : context.nodes_[i].edges) {
+      std::string url =
+          URLTemplate::PatchToUrl(table_keyed_uri_template, edge.patch_id);
+      lazy->fingerprints_[url] = edge.fingerprint;
+      auto state = std::make_unique<LazyEncoding::PatchState>();
+      state->node_index = i;
+      state->edge = &edge;
+      lazy->table_keyed_patches_[url] = std::move(state);
+    }
+  }
+
+  return lazy;
+}
+
+std::vector<std::string> Encoder::LazyEncoding::PatchUrls() const {
+  std::vector<std::string> urls;
+  urls.reserve(fingerprints_.size());
+  for (const auto& [url, fingerprint] : fingerprints_) {
+    urls.push_back(url);
+  }
+  std::sort(urls.begin(), urls.end());
+  return urls;
+}
+
+StatusOr<uint64_t> Encoder::LazyEncoding::Fingerprint(string_view url) const {
+  auto it = fingerprints_.find(url);
+  if (it == fingerprints_.end()) {
+    return absl::NotFoundError(StrCat("No patch at url ", url));
+  }
+  return it->second;
+}
+
+StatusOr<FontData> Encoder::LazyEncoding::Patch(string_view url) {
+  FontData result;
+  auto glyph_keyed = glyph_keyed_patches_.find(url);
+  if (glyph_keyed != glyph_keyed_patches_.end()) {
+    result.shallow_copy(glyph_keyed->second);
+    return result;
+  }
+
+  auto it = table_keyed_patches_.find(url);
+  if (it == table_keyed_patches_.end()) {
+    return absl::NotFoundError(StrCat("No patch at url ", url));
+  }
+
+  PatchState& state = *it->second;
+  const FontData* prior = encoder_.FindPriorArtifact(state.edge->fingerprint);
+  if (prior) {
+    result.shallow_copy(*prior);
+    return result;
+  }
+
+  absl::MutexLock lock(&state.mutex);
+  if (!state.patch.has_value()) {
+    Status sc = EnsureBuilt(state.node_index);
+    if (sc.ok()) {
+      sc = EnsureBuilt(state.edge->child_index);
+    }
+    if (sc.ok()) {
+      state.patch = encoder_.BuildEdge(
+          context_, context_.nodes_[state.node_index], *state.edge);
+    } else {
+      state.patch = sc;
+    }
+  }
+
+  if (!state.patch->ok()) {
+    return state.patch->status();
+  }
+  result.shallow_copy(**state.patch);
   return result;
 }
 
+uint32_t Encoder::LazyEncoding::NumBuiltNodes() const {
+  uint32_t count = 0;
+  for (const auto& state : node_states_) {
+    absl::MutexLock lock(&state->mutex);
+    if (state->status.has_value() && state->status->ok()) {
+      count++;
+    }
+  }
+  return count;
+}
+
+Status Encoder::LazyEncoding::EnsureBuilt(uint32_t index) {
+  NodeState& state = *node_states_[index];
+  absl::MutexLock lock(&state.mutex);
+  if (state.status.has_value()) {
+    return *state.status;
+  }
+
+  GraphNode& node = context_.nodes_[index];
+  std::shared_ptr<const GlyphMapping> glyph_mapping;
+  auto font =
+      encoder_.BuildNode(context_, node, index == root_, &glyph_mapping);
+  if (font.ok()) {
+    node.font = std::move(*font);
+    node.glyph_mapping = std::move(glyph_mapping);
+  }
+  state.status = font.status();
+  return *state.status;
+}
+
+namespace {
+
+// Records the size of each patch instead of keeping it.
+class SizePatchSink : public PatchSink {
+ public:
+  explicit SizePatchSink(btree_map<std::string, uint32_t>& sizes)
+      : sizes_(sizes) {}
+
+  Status Add(const std::string& url, const FontData& patch,
+             uint64_t fingerprint) override {
+    sizes_[url] = patch.size();
+    return absl::OkStatus();
+  }
+
+ private:
+  btree_map<std::string, uint32_t>& sizes_;
+};
+
+}  // namespace
+
+StatusOr<Encoder::GlyphKeyedSizes> Encoder::ComputeGlyphKeyedSizes() const {
+  ProcessingContext context(next_id_);
+  TRYV(InitContext(context));
+  uint32_t root = PlanGraph(context, context.base_subset_,
+                            max_depth_ ? max_depth_ : UINT32_MAX);
+  TRYV(AssignGlyphKeyedPatchIds(context));
+
+  std::optional<ThreadPool> owned_pool;
+  if (!thread_pool_) {
+    owned_pool.emplace(num_threads_);
+  }
+  ThreadPool& pool = thread_pool_ ? *thread_pool_ : *owned_pool;
+  context.pool_ = &pool;
+
+  GlyphKeyedSizes sizes;
+  SizePatchSink sink(sizes.patch_sizes);
+  Encoding unused;
+  TRYV(EmitGlyphKeyedPatches(context, context.patch_set_design_spaces_, pool,
+                             sink, unused));
+
+  if (!IsMixedMode()) {
+    return sizes;
+  }
+
+  // Matches the 'IFTX' table added to the init font by BuildNode().
+  sizes.mapping_table_size =
+      TRY(CachedGlyphKeyedTable(context, context.nodes_[root]))->size();
+  return sizes;
+}
+
+std::vector<std::pair<uint32_t, const Encoder::GraphEdge*>>
+Encoder::EdgeOrder(const ProcessingContext& context, uint32_t root,
+                   uint32_t& num_critical) const {
+  num_critical = 0;
+  std::vector<std::pair<uint32_t, const GraphEdge*>> edges;
+  if (!critical_path_first_) {
+    // Planning order, which keeps the patches that share nodes close
+    // together.
+    for (uint32_t i = 0; i < context.nodes_.size(); i++) {
+      for (const auto& edge : context.nodes_[i].edges) {
+        edges.push_back(std::pair(i, &edge));
+      }
+    }
+    return edges;
+  }
+
+  // Breadth first from the root, each node's edges are output when it's first
+  // reached so the root's edges come first.
+  std::vector<bool> visited(context.nodes_.size(), false);
+  std::vector<uint32_t> queue = {root};
+  visited[root] = true;
+  for (uint32_t next = 0; next < queue.size(); next++) {
+    uint32_t index = queue[next];
+    for (const auto& edge : context.nodes_[index].edges) {
+      edges.push_back(std::pair(index, &edge));
+      if (!visited[edge.child_index]) {
+        visited[edge.child_index] = true;
+        queue.push_back(edge.child_index);
+      }
+    }
+  }
+  num_critical = context.nodes_[root].edges.size();
+  return edges;
+}
+
+Status Encoder::EmitGlyphKeyedPatches(
+    ProcessingContext& context,
+    const std::vector<design_space_t>& design_spaces, ThreadPool& pool,
+    PatchSink& sink, Encoding& result) const {
+  // Glyphs not affected by instancing produce the same data stream in every
+  // patch set, so those are only compressed once.
+  GlyphKeyedStreamCache stream_cache;
+
+  // Each patch set is held in memory until it's been emitted, so limit the
+  // number of sets which are generated at once to the number of threads.
+  for (uint32_t start = 0; start < design_spaces.size();
+       start += pool.NumThreads()) {
+    TRYV(CheckProgress());
+    uint32_t end =
+        std::min((uint32_t)design_spaces.size(), start + pool.NumThreads());
+    std::vector<btree_map<std::string, FontData>> patches(end - start);
+    std::vector<flat_hash_map<std::string, uint64_t>> fingerprints(end - start);
+    std::vector<btree_set<uint32_t>> missing_segments(end - start);
+    std::vector<FontData> instances(end - start);
+    std::vector<std::optional<FontData>> dictionaries(end - start);
+
+    std::vector<std::function<Status()>> tasks;
+    for (uint32_t i = start; i < end; i++) {
+      tasks.push_back([&, i]() -> Status {
+        const design_space_t& design_space = design_spaces[i];
+        const std::string& uri_template =
+            context.patch_set_uri_templates_.at(design_space);
+        TRYV(PopulateGlyphKeyedPatches(
+            context, design_space, uri_template,
+            context.glyph_keyed_compat_ids_.at(design_space),
+            patches[i - start], fingerprints[i - start],
+            missing_segments[i - start], instances[i - start],
+            dictionaries[i - start]));
+
+        std::optional<FontData>& dictionary = dictionaries[i - start];
+        if (glyph_keyed_dictionary_size_ && !dictionary.has_value()) {
+          dictionary = TRY(GlyphKeyedDiff::TrainDictionary(
+              instances[i - start], GlyphKeyedTables(),
+              glyph_keyed_dictionary_size_));
+          patches[i - start][GlyphKeyedDictionaryUrl(uri_template)]
+              .shallow_copy(*dictionary);
+        }
+        return absl::OkStatus();
+      });
+    }
+    TRYV(RunTasks(pool, tasks));
+
+    // Segments are independent of each other, so the patches for every set in
+    // the batch are fanned out across the pool together. Each task writes to
+    // its own slot so the output doesn't depend on scheduling.
+    std::vector<GlyphKeyedDiff> differs;
+    differs.reserve(end - start);
+    std::vector<std::pair<uint32_t, uint32_t>> pending;
+    for (uint32_t i = 0; i < missing_segments.size(); i++) {
+      const design_space_t& design_space = design_spaces[start + i];
+      differs.emplace_back(instances[i],
+                           context.glyph_keyed_compat_ids_.at(design_space),
+                           GlyphKeyedTables(), glyph_keyed_brotli_options_);
+      if (dictionaries[i].has_value()) {
+        // Each set has it's own dictionary, so streams can't be shared.
+        FontData dictionary;
+        dictionary.shallow_copy(*dictionaries[i]);
+        differs.back().SetDictionary(std::move(dictionary),
+                                     context.dictionary_cache_);
+      } else {
+        differs.back().SetStreamCache(&stream_cache);
+      }
+      for (uint32_t index : missing_segments[i]) {
+        pending.push_back(std::pair(i, index));
+      }
+    }
+
+    std::vector<FontData> new_patches(pending.size());
+    tasks.clear();
+    for (uint32_t j = 0; j < pending.size(); j++) {
+      tasks.push_back([&, j]() -> Status {
+        TRYV(CheckProgress());
+        auto [i, index] = pending[j];
+        EncoderStats::Timer timer(stats_, EncoderStats::GLYPH_KEYED_DIFF);
+        new_patches[j] =
+            TRY(differs[i].CreatePatch(glyph_data_patches_.at(index)));
+        if (stats_) {
+          stats_->RecordPatch(EncoderStats::GLYPH_KEYED,
+                              GlyphKeyedUncompressedLength(new_patches[j]),
+                              new_patches[j].size());
+        }
+        return absl::OkStatus();
+      });
+    }
+    TRYV(RunTasks(pool, tasks));
+
+    for (uint32_t j = 0; j < pending.size(); j++) {
+      auto [i, index] = pending[j];
+      const design_space_t& design_space = design_spaces[start + i];
+      std::string url = URLTemplate::PatchToUrl(
+          context.patch_set_uri_templates_.at(design_space),
+          context.GlyphKeyedPatchId(design_space, index));
+      patches[i][url] = std::move(new_patches[j]);
+    }
+
+    for (uint32_t i = 0; i < patches.size(); i++) {
+      for (const auto& [url, patch] : patches[i]) {
+        TRYV(CheckProgress());
+        TRYV(sink.Add(url, patch, fingerprints[i].at(url)));
+        RecordProgress(Progress::PATCHES_EMITTED);
+      }
+      result.fingerprints.insert(fingerprints[i].begin(),
+                                 fingerprints[i].end());
+    }
+  }
+
+  return absl::OkStatus();
+}
+
+StatusOr<Encoder::EncodingEstimate> Encoder::DryRun() const {
+  TRYV(ValidateConfiguration());
+
+  ProcessingContext context(next_id_);
+  context.base_subset_ = RootSubset();
+  uint32_t root = PlanGraph(context, context.base_subset_,
+                            max_depth_ ? max_depth_ : UINT32_MAX);
+
+  EncodingEstimate estimate;
+  estimate.num_nodes = context.nodes_.size();
+  for (const auto& node : context.nodes_) {
+    estimate.num_table_keyed_patches += node.edges.size();
+  }
+
+  estimate.num_glyph_keyed_patches =
+      NumReachableGlyphSegments() * context.patch_set_uri_templates_.size();
+
+  // Edges always add coverage so the graph is acyclic. Visiting nodes in post
+  // order ensures all children are processed before their parents.
+  std::vector<uint32_t> depths(context.nodes_.size(), 0);
+  std::vector<uint32_t> order;
+  std::vector<bool> visited(context.nodes_.size(), false);
+  std::vector<std::pair<uint32_t, uint32_t>> stack{{root, 0}};
+  visited[root] = true;
+  while (!stack.empty()) {
+    auto& [index, next_edge] = stack.back();
+    const auto& edges = context.nodes_[index].edges;
+    if (next_edge < edges.size()) {
+      uint32_t child = edges[next_edge++].child_index;
+      if (!visited[child]) {
+        visited[child] = true;
+        stack.push_back(std::pair(child, 0));
+      }
+      continue;
+    }
+    order.push_back(index);
+    stack.pop_back();
+  }
+  for (uint32_t index : order) {
+    uint32_t depth = 0;
+    for (const auto& edge : context.nodes_[index].edges) {
+      depth = std::max(depth, depths[edge.child_index]);
+    }
+    depths[index] = depth + 1;
+  }
+  estimate.depth = depths[root];
+
+  // Encode() holds one batch of patches and the nodes at either end of them
+  // in memory at once (plus the input font and fully expanded subset). With
+  // multiple threads a finished batch is output in the background while the
+  // next is generated, so two batches and their nodes may be live.
+  hb_blob_unique_ptr blob = make_hb_blob(hb_face_reference_blob(face_.get()));
+  uint64_t font_size = hb_blob_get_length(blob.get());
+  uint64_t num_threads =
+      thread_pool_ ? thread_pool_->NumThreads() : std::max(num_threads_, 1u);
+  uint64_t batch_size = std::max((uint64_t)kMinBatchSize, 4 * num_threads);
+  uint64_t live_batches = num_threads > 1 ? 2 : 1;
+  uint64_t live_patches = std::min(live_batches * batch_size,
+                                   (uint64_t)estimate.num_table_keyed_patches);
+  uint64_t live_nodes =
+      std::min(2 * live_patches + 1, (uint64_t)estimate.num_nodes);
+  estimate.max_output_bytes =
+      font_size * (1 + (uint64_t)estimate.num_table_keyed_patches +
+                   estimate.num_glyph_keyed_patches);
+  estimate.max_memory_bytes = font_size * (2 + live_nodes + live_patches);
+
+  return estimate;
+}
+
+void Encoder::ComputeFingerprints(ProcessingContext& context,
+                                  uint32_t root) const {
+  for (uint32_t i = 0; i < context.nodes_.size(); i++) {
+    GraphNode& node = context.nodes_[i];
+    uint64_t h =
+        StableHash(context.fingerprint_seed_, kNodeFingerprint, node.subset);
+    h = Fnv1a(h, (uint32_t)(i == root));
+    h = Fnv1a(h, node.table_keyed_compat_id);
+    h = Fnv1a(h, node.glyph_keyed_uri_template);
+    h = Fnv1a(h, node.glyph_keyed_compat_id);
+    auto patch_ids =
+        context.glyph_keyed_patch_ids_.find(node.subset.design_space);
+    if (patch_ids != context.glyph_keyed_patch_ids_.end()) {
+      // The glyph keyed patch map references these ids.
+      btree_map<uint32_t, uint32_t> sorted(patch_ids->second.begin(),
+                                           patch_ids->second.end());
+      for (const auto& [segment, id] : sorted) {
+        h = Fnv1a(h, segment);
+        h = Fnv1a(h, id);
+      }
+    }
+    h = Fnv1a(h, (uint32_t)node.edges.size());
+    for (const auto& edge : node.edges) {
+      h = Fnv1a(h, edge.patch_id);
+      h = Fnv1a(h, edge.coverage);
+    }
+    node.fingerprint = h;
+  }
+
+  for (auto& node : context.nodes_) {
+    for (auto& edge : node.edges) {
+      uint64_t h = Fnv1a(context.fingerprint_seed_, kEdgeFingerprint);
+      h = Fnv1a(h, edge.patch_id);
+      h = Fnv1a(h, node.fingerprint);
+      h = Fnv1a(h, context.nodes_[edge.child_index].fingerprint);
+      edge.fingerprint = h;
+    }
+  }
+}
+
+uint32_t Encoder::NumReachableGlyphSegments() const {
+  flat_hash_set<uint32_t> reachable_segments;
+  for (const auto& condition : glyph_patch_conditions_) {
+    if (condition.activated_patch_id.has_value()) {
+      reachable_segments.insert(*condition.activated_patch_id);
+    }
+  }
+  return reachable_segments.size();
+}
+
 bool Encoder::AllocatePatchSet(ProcessingContext& context,
                                const design_space_t& design_space,
                                std::string& uri_template,
@@ -274,48 +1329,118 @@ bool Encoder::AllocatePatchSet(ProcessingContext& context,
   }
 
   uri_template = UrlTemplate(context.next_patch_set_id_++);
-  compat_id = context.GenerateCompatId();
+  SubsetDefinition patch_set_def;
+  patch_set_def.design_space = design_space;
+  compat_id = context.GenerateCompatId(patch_set_def, kGlyphKeyedCompatId);
 
   context.patch_set_uri_templates_[design_space] = uri_template;
   context.glyph_keyed_compat_ids_[design_space] = compat_id;
+  context.patch_set_design_spaces_.push_back(design_space);
   return true;
 }
 
-Status Encoder::EnsureGlyphKeyedPatchesPopulated(
-    ProcessingContext& context, const design_space_t& design_space,
-    std::string& uri_template, CompatId& compat_id) const {
-  if (glyph_data_patches_.empty()) {
+Status Encoder::AssignGlyphKeyedPatchIds(ProcessingContext& context) const {
+  if (!content_addressed_glyph_keyed_patches_) {
     return absl::OkStatus();
   }
 
-  flat_hash_set<uint32_t> reachable_segments;
   for (const auto& condition : glyph_patch_conditions_) {
-    if (condition.activated_patch_id.has_value()) {
-      reachable_segments.insert(*condition.activated_patch_id);
+    if (condition.activated_patch_id.has_value() &&
+        !glyph_data_patches_.contains(*condition.activated_patch_id)) {
+      return absl::InvalidArgumentError(
+          StrCat("Glyph data segment ", *condition.activated_patch_id,
+                 " was not provided."));
     }
   }
 
-  if (!AllocatePatchSet(context, design_space, uri_template, compat_id)) {
-    // Patches have already been populated for this design space.
-    return absl::OkStatus();
+  // New content is numbered after every prior id so that ids, and therefore
+  // urls, are never reused for different content.
+  context.glyph_keyed_content_ids_ = prior_glyph_keyed_patch_ids_;
+  uint32_t next_id = 0;
+  for (const auto& [content_key, id] : prior_glyph_keyed_patch_ids_) {
+    next_id = std::max(next_id, id + 1);
   }
 
-  auto full_face = context.fully_expanded_subset_.face();
-  FontData instance;
-  instance.set(full_face.get());
+  // Patches are generated from (instances of) the fully expanded subset, so
+  // it's glyph data determines the patch contents.
+  hb_face_unique_ptr face = context.fully_expanded_subset_.face();
+  GlyphDataIndex glyph_data(face.get());
+  for (const design_space_t& design_space : context.patch_set_design_spaces_) {
+    // Ids are scoped to the url template, which is included so that content
+    // moving to a different patch set is given a new id.
+    SubsetDefinition patch_set_def;
+    patch_set_def.design_space = design_space;
+    uint64_t seed = StableHash(kFnvOffsetBasis, kGlyphKeyedContentHash,
+                               patch_set_def);
+    seed = Fnv1a(seed, context.patch_set_uri_templates_.at(design_space));
+    seed = Fnv1a(seed, glyph_keyed_brotli_options_);
+    seed = Fnv1a(seed, kGlyphKeyedPatchFormatVersion);
+    if (!design_space.empty()) {
+      // Instanced glyph data is generated by harfbuzz's instancer from the
+      // hashed glyph data, so also depends on the axis definitions and the
+      // harfbuzz version.
+      for (hb_tag_t tag : {FontHelper::kFvar, FontHelper::kAvar}) {
+        seed = Fnv1a(seed, FontHelper::TableData(face.get(), tag).str());
+      }
+      seed = Fnv1a(seed, absl::string_view(hb_version_string()));
+    }
 
-  if (!design_space.empty()) {
-    // If a design space is provided, apply it.
-    auto result = Instance(context, full_face.get(), design_space);
-    if (!result.ok()) {
-      return result.status();
+    auto& ids = context.glyph_keyed_patch_ids_[design_space];
+    for (const auto& [segment, gids] : glyph_data_patches_) {
+      uint64_t h = Fnv1aSorted(seed, gids);
+      uint64_t d = Digest(seed, (uint64_t)gids.size());
+      for (uint32_t gid : gids) {
+        d = Digest(d, (uint64_t)gid);
+      }
+      for (hb_tag_t tag : {FontHelper::kCFF, FontHelper::kCFF2,
+                           FontHelper::kGlyf, FontHelper::kGvar}) {
+        if (!glyph_data.Has(tag)) {
+          continue;
+        }
+        h = Fnv1a(h, tag);
+        d = Digest(d, (uint64_t)tag);
+        for (uint32_t gid : gids) {
+          string_view data = TRY(glyph_data.GlyphData(tag, gid));
+          h = Fnv1a(h, (uint32_t)data.size());
+          h = Fnv1a(h, data);
+          d = Digest(d, data);
+        }
+      }
+
+      // A prior id is only reused when both the hash and digest match, so a
+      // hash collision between different content gets a new id.
+      auto [it, inserted] =
+          context.glyph_keyed_content_ids_.insert({{h, d}, next_id});
+      if (inserted) {
+        next_id++;
+      }
+      ids[segment] = it->second;
     }
-    instance.shallow_copy(*result);
   }
 
-  GlyphKeyedDiff differ(instance, compat_id,
-                        {FontHelper::kGlyf, FontHelper::kGvar});
+  return absl::OkStatus();
+}
+
+Status Encoder::PopulateGlyphKeyedPatches(
+    const ProcessingContext& context, const design_space_t& design_space,
+    const std::string& uri_template, CompatId compat_id,
+    btree_map<std::string, FontData>& patches,
+    flat_hash_map<std::string, uint64_t>& fingerprints,
+    btree_set<uint32_t>& missing_segments, FontData& instance,
+    std::optional<FontData>& dictionary) const {
+  if (glyph_data_patches_.empty()) {
+    return absl::OkStatus();
+  }
 
+  flat_hash_set<uint32_t> reachable_segments;
+  for (const auto& condition : glyph_patch_conditions_) {
+    if (condition.activated_patch_id.has_value()) {
+      reachable_segments.insert(*condition.activated_patch_id);
+    }
+  }
+
+  SubsetDefinition patch_set_def;
+  patch_set_def.design_space = design_space;
   for (uint32_t index : reachable_segments) {
     auto e = glyph_data_patches_.find(index);
     if (e == glyph_data_patches_.end()) {
@@ -323,21 +1448,62 @@ Status Encoder::EnsureGlyphKeyedPatchesPopulated(
           StrCat("Glyph data segment ", index, " was not provided."));
     }
 
-    std::string url = URLTemplate::PatchToUrl(uri_template, index);
+    std::string url = URLTemplate::PatchToUrl(
+        uri_template, context.GlyphKeyedPatchId(design_space, index));
+    uint64_t h = StableHash(context.fingerprint_seed_, kGlyphKeyedFingerprint,
+                            patch_set_def);
+    h = Fnv1a(h, compat_id);
+    h = Fnv1a(h, url);
+    h = Fnv1aSorted(h, e->second);
+    fingerprints[url] = h;
+
+    const FontData* prior = FindPriorArtifact(h);
+    if (prior) {
+      patches[url].shallow_copy(*prior);
+    } else {
+      missing_segments.insert(index);
+    }
+  }
 
-    const auto& gids = e->second;
-    auto patch = differ.CreatePatch(gids);
-    if (!patch.ok()) {
-      return patch.status();
+  if (glyph_keyed_dictionary_size_) {
+    // The dictionary is trained from the instance, which is already covered
+    // by the fingerprint seed and patch set definition.
+    std::string url = GlyphKeyedDictionaryUrl(uri_template);
+    uint64_t h = StableHash(context.fingerprint_seed_, kGlyphKeyedFingerprint,
+                            patch_set_def);
+    h = Fnv1a(h, url);
+    fingerprints[url] = h;
+
+    const FontData* prior = FindPriorArtifact(h);
+    if (prior) {
+      patches[url].shallow_copy(*prior);
+      dictionary.emplace().shallow_copy(*prior);
     }
+  }
+
+  if (missing_segments.empty() &&
+      (!glyph_keyed_dictionary_size_ || dictionary.has_value())) {
+    return absl::OkStatus();
+  }
+
+  auto full_face = context.fully_expanded_subset_.face();
+  instance.set(full_face.get());
 
-    context.patches_[url].shallow_copy(*patch);
+  if (!design_space.empty()) {
+    // If a design space is provided, apply it.
+    auto result = CachedInstance(context, design_space);
+    if (!result.ok()) {
+      return result.status();
+    }
+    instance.shallow_copy(*result);
   }
 
   return absl::OkStatus();
 }
 
-Status Encoder::PopulateGlyphKeyedPatchMap(PatchMap& patch_map) const {
+Status Encoder::PopulateGlyphKeyedPatchMap(const ProcessingContext& context,
+                                           const design_space_t& design_space,
+                                           PatchMap& patch_map) const {
   if (glyph_data_patches_.empty()) {
     return absl::OkStatus();
   }
@@ -350,7 +1516,8 @@ Status Encoder::PopulateGlyphKeyedPatchMap(PatchMap& patch_map) const {
     coverage.conjunctive = condition.conjunctive;
 
     if (condition.activated_patch_id.has_value()) {
-      last_patch_index = *condition.activated_patch_id;
+      last_patch_index = context.GlyphKeyedPatchId(
+          design_space, *condition.activated_patch_id);
       TRYV(patch_map.AddEntry(coverage, last_patch_index, GLYPH_KEYED));
     } else {
       TRYV(patch_map.AddEntry(coverage, ++last_patch_index, GLYPH_KEYED, true));
@@ -360,73 +1527,132 @@ Status Encoder::PopulateGlyphKeyedPatchMap(PatchMap& patch_map) const {
   return absl::OkStatus();
 }
 
-StatusOr<FontData> Encoder::Encode(ProcessingContext& context,
-                                   const SubsetDefinition& base_subset,
-                                   bool is_root) const {
-  auto it = context.built_subsets_.find(base_subset);
-  if (it != context.built_subsets_.end()) {
-    FontData copy;
-    copy.shallow_copy(it->second);
-    return copy;
+uint32_t Encoder::PlanGraph(ProcessingContext& context,
+                           const SubsetDefinition& base_subset,
+                           uint32_t levels) const {
+  // Each patch adds at least one segment, so the graph below this node can't
+  // be deeper than the number of remaining segments. Clamping to that means
+  // the depth limit only splits nodes when it would actually change them.
+  std::vector<uint64_t> covered;
+  std::vector<SubsetDefinition> remaining =
+      RemainingSegments(base_subset, &covered);
+  levels = std::min(levels, (uint32_t)remaining.size() + 1);
+  bool depth_limited = levels <= remaining.size();
+
+  auto key = std::pair(std::move(covered), levels);
+  auto it = context.node_indices_.find(key);
+  if (it != context.node_indices_.end()) {
+    return it->second;
   }
 
-  std::string table_keyed_uri_template = UrlTemplate(0);
-  CompatId table_keyed_compat_id = context.GenerateCompatId();
-  std::string glyph_keyed_uri_template;
-  CompatId glyph_keyed_compat_id;
-  auto sc = EnsureGlyphKeyedPatchesPopulated(context, base_subset.design_space,
-                                             glyph_keyed_uri_template,
-                                             glyph_keyed_compat_id);
-  if (!sc.ok()) {
-    return sc;
+  uint32_t index = context.nodes_.size();
+  context.node_indices_[key] = index;
+  context.nodes_.push_back(GraphNode{});
+
+  // Note: context.nodes_ may be resized by the recursive calls below so nodes
+  // must always be accessed by index.
+  {
+    GraphNode& node = context.nodes_[index];
+    node.subset = base_subset;
+    node.table_keyed_compat_id = context.GenerateCompatId(
+        base_subset, kTableKeyedCompatId, depth_limited ? levels : 0);
+    if (!glyph_data_patches_.empty()) {
+      AllocatePatchSet(context, base_subset.design_space,
+                       node.glyph_keyed_uri_template,
+                       node.glyph_keyed_compat_id);
+    }
+  }
+
+  // Outgoing edges add each combination of up to jump_ahead_ of the remaining
+  // segments. The combinations are enumerated twice, once to assign patch ids
+  // and once to plan the child nodes, instead of holding the subset for every
+  // edge at once.
+  uint32_t choose = levels > 2 ? jump_ahead_ : 0;
+
+  // A patch which adds everything remaining is needed in the second last level
+  // of a depth limited graph, or at every node if requested. It's redundant
+  // if the regular patches already include it.
+  bool has_all_segments_patch = levels > 2 && remaining.size() <= jump_ahead_;
+  bool add_all_segments_patch =
+      !remaining.empty() && !has_all_segments_patch &&
+      (levels == 2 || include_all_segment_patches_);
+  auto all_segments = [&]() {
+    SubsetDefinition all;
+    for (const auto& s : remaining) {
+      all.Union(s);
+    }
+    return all;
+  };
+
+  auto add_edge = [&](const SubsetDefinition& subset) {
+    context.nodes_[index].edges.push_back(GraphEdge{
+        .patch_id = context.next_id_++,
+        .coverage = subset.ToCoverage(),
+        .child_index = 0,
+    });
+  };
+  for (Combinations c(remaining.size(), choose); c.Next();) {
+    add_edge(UnionOf(remaining, c.Indices()));
+  }
+  if (add_all_segments_patch) {
+    add_edge(all_segments());
+  }
+
+  uint32_t edge = 0;
+  auto plan_child = [&](const SubsetDefinition& subset) {
+    SubsetDefinition combined_subset = Combine(base_subset, subset);
+    uint32_t child_index = PlanGraph(context, combined_subset, levels - 1);
+    context.nodes_[index].edges[edge++].child_index = child_index;
+  };
+  for (Combinations c(remaining.size(), choose); c.Next();) {
+    plan_child(UnionOf(remaining, c.Indices()));
+  }
+  if (add_all_segments_patch) {
+    plan_child(all_segments());
   }
 
-  std::vector<SubsetDefinition> subsets =
-      OutgoingEdges(base_subset, jump_ahead_);
+  return index;
+}
 
+StatusOr<FontData> Encoder::BuildNode(
+    const ProcessingContext& context, const GraphNode& node, bool is_root,
+    std::shared_ptr<const GlyphMapping>* glyph_mapping) const {
   // The first subset forms the base file, the remaining subsets are made
-  // reachable via patches.
-  auto full_face = context.fully_expanded_subset_.face();
-  auto base = CutSubset(context, full_face.get(), base_subset);
+  // reachable via patches. In mixed mode glyph data is excluded from table
+  // keyed patches so the glyph mapping isn't needed.
+  auto base = CutSubset(context, context.fully_expanded_face_.get(),
+                        context.fully_expanded_hash_, node.subset,
+                        IsMixedMode() ? nullptr : glyph_mapping);
   if (!base.ok()) {
     return base.status();
   }
 
-  if (subsets.empty() && !IsMixedMode()) {
+  if (node.edges.empty() && !IsMixedMode()) {
     // This is a leaf node, a IFT table isn't needed.
-    context.built_subsets_[base_subset].shallow_copy(*base);
     return base;
   }
 
   IFTTable table_keyed;
-  IFTTable glyph_keyed;
-  table_keyed.SetId(table_keyed_compat_id);
-  table_keyed.SetUrlTemplate(table_keyed_uri_template);
-  glyph_keyed.SetId(glyph_keyed_compat_id);
-  glyph_keyed.SetUrlTemplate(glyph_keyed_uri_template);
+  table_keyed.SetId(node.table_keyed_compat_id);
+  table_keyed.SetUrlTemplate(UrlTemplate(0));
 
-  PatchMap& glyph_keyed_patch_map = glyph_keyed.GetPatchMap();
-  sc = PopulateGlyphKeyedPatchMap(glyph_keyed_patch_map);
-  if (!sc.ok()) {
-    return sc;
-  }
-
-  std::vector<uint32_t> ids;
   PatchMap& table_keyed_patch_map = table_keyed.GetPatchMap();
   PatchEncoding encoding =
       IsMixedMode() ? TABLE_KEYED_PARTIAL : TABLE_KEYED_FULL;
-  for (const auto& s : subsets) {
-    uint32_t id = context.next_id_++;
-    ids.push_back(id);
+  for (const auto& edge : node.edges) {
+    TRYV(table_keyed_patch_map.AddEntry(edge.coverage, edge.patch_id,
+                                        encoding));
+  }
 
-    PatchMap::Coverage coverage = s.ToCoverage();
-    TRYV(table_keyed_patch_map.AddEntry(coverage, id, encoding));
+  std::string table_keyed_bytes = TRY(Format2PatchMap::Serialize(table_keyed));
+  std::optional<string_view> glyph_keyed_bytes;
+  if (IsMixedMode()) {
+    glyph_keyed_bytes = *TRY(CachedGlyphKeyedTable(context, node));
   }
 
   auto face = base->face();
-  std::optional<IFTTable*> ext =
-      IsMixedMode() ? std::optional(&glyph_keyed) : std::nullopt;
-  auto new_base = IFTTable::AddToFont(face.get(), table_keyed, ext);
+  auto new_base =
+      IFTTable::AddToFont(face.get(), table_keyed_bytes, glyph_keyed_bytes);
 
   if (!new_base.ok()) {
     return new_base.status();
@@ -435,98 +1661,207 @@ StatusOr<FontData> Encoder::Encode(ProcessingContext& context,
   if (is_root) {
     // For the root node round trip the font through woff2 so that the base for
     // patching can be a decoded woff2 font file.
-    base = RoundTripWoff2(new_base->str(), false);
-    if (!base.ok()) {
-      return base.status();
-    }
-  } else {
-    base->shallow_copy(*new_base);
+    EncoderStats::Timer timer(stats_, EncoderStats::WOFF2_ROUND_TRIP);
+    return RoundTripWoff2(new_base->str(), false);
   }
 
-  context.built_subsets_[base_subset].shallow_copy(*base);
-
-  uint32_t i = 0;
-  for (const auto& s : subsets) {
-    uint32_t id = ids[i++];
-    SubsetDefinition combined_subset = Combine(base_subset, s);
-    auto next = Encode(context, combined_subset, false);
-    if (!next.ok()) {
-      return next.status();
-    }
-
-    // Check if the main table URL will change with this subset
-    std::string next_glyph_keyed_uri_template;
-    CompatId next_glyph_keyed_compat_id;
-    auto sc = EnsureGlyphKeyedPatchesPopulated(
-        context, base_subset.design_space, glyph_keyed_uri_template,
-        glyph_keyed_compat_id);
-    if (!sc.ok()) {
-      return sc;
-    }
-
-    bool replace_url_template =
-        IsMixedMode() &&
-        (next_glyph_keyed_uri_template != glyph_keyed_uri_template);
-
-    FontData patch;
-    auto differ =
-        GetDifferFor(*next, table_keyed_compat_id, replace_url_template);
-    if (!differ.ok()) {
-      return differ.status();
-    }
-    sc = (*differ)->Diff(*base, *next, &patch);
-    if (!sc.ok()) {
-      return sc;
-    }
+  return new_base;
+}
 
-    std::string url = URLTemplate::PatchToUrl(table_keyed_uri_template, id);
-    context.patches_[url].shallow_copy(patch);
+StatusOr<FontData> Encoder::BuildEdge(const ProcessingContext& context,
+                                      const GraphNode& node,
+                                      const GraphEdge& edge) const {
+  const FontData& base = node.font;
+  const GraphNode& child = context.nodes_[edge.child_index];
+  const FontData& next = child.font;
+
+  // The IFTX table and gvar only need to be replaced when the glyph keyed
+  // patch set changes (ie. the design space changed). Otherwise the client's
+  // copies, which hold the variation data and applied entries of the glyph
+  // keyed patches loaded so far, are left as is.
+  bool replace_url_template =
+      IsMixedMode() &&
+      (node.glyph_keyed_compat_id != child.glyph_keyed_compat_id ||
+       node.glyph_keyed_uri_template != child.glyph_keyed_uri_template);
+
+  EncoderStats::Timer timer(stats_, EncoderStats::TABLE_KEYED_DIFF);
+  FontData patch;
+  auto differ = GetDifferFor(context, next, node.table_keyed_compat_id,
+                             replace_url_template, node.glyph_mapping.get(),
+                             child.glyph_mapping.get());
+  if (!differ.ok()) {
+    return differ.status();
   }
+  TRYV((*differ)->Diff(base, next, &patch));
 
-  return base;
+  if (stats_) {
+    stats_->RecordPatch(EncoderStats::TABLE_KEYED, next.size(), patch.size());
+  }
+  return patch;
 }
 
 StatusOr<std::unique_ptr<const BinaryDiff>> Encoder::GetDifferFor(
-    const FontData& font_data, CompatId compat_id,
-    bool replace_url_template) const {
+    const ProcessingContext& context, const FontData& font_data,
+    CompatId compat_id, bool replace_url_template,
+    const GlyphMapping* base_mapping,
+    const GlyphMapping* derived_mapping) const {
+  std::unique_ptr<TableKeyedDiff> differ;
   if (!IsMixedMode()) {
-    return std::unique_ptr<const BinaryDiff>(
-        Encoder::FullFontTableKeyedDiff(compat_id));
+    differ.reset(Encoder::FullFontTableKeyedDiff(compat_id,
+                                                 table_keyed_brotli_options_));
+  } else if (replace_url_template) {
+    differ.reset(Encoder::ReplaceIftMapTableKeyedDiff(
+        compat_id, table_keyed_brotli_options_));
+  } else {
+    differ.reset(Encoder::MixedModeTableKeyedDiff(compat_id,
+                                                  table_keyed_brotli_options_));
   }
 
-  if (replace_url_template) {
-    return std::unique_ptr<const BinaryDiff>(
-        Encoder::ReplaceIftMapTableKeyedDiff(compat_id));
+  differ->SetDictionaryCache(context.dictionary_cache_);
+  differ->SetThreadPool(context.pool_);
+  if (base_mapping && derived_mapping) {
+    differ->SetGlyphMappings(base_mapping, derived_mapping);
   }
-
-  return std::unique_ptr<const BinaryDiff>(
-      Encoder::MixedModeTableKeyedDiff(compat_id));
+  return std::unique_ptr<const BinaryDiff>(std::move(differ));
 }
 
-StatusOr<hb_face_unique_ptr> Encoder::CutSubsetFaceBuilder(
+StatusOr<Encoder::hb_subset_plan_unique_ptr> Encoder::CreateSubsetPlan(
     const ProcessingContext& context, hb_face_t* font,
-    const SubsetDefinition& def) const {
+    const SubsetDefinition& def, const table_list_t* dropped) const {
   hb_subset_input_t* input = hb_subset_input_create_or_fail();
   if (!input) {
     return absl::InternalError("Failed to create subset input.");
   }
 
   def.ConfigureInput(input, font);
+  if (dropped) {
+    hb_set_t* drop_tables =
+        hb_subset_input_set(input, HB_SUBSET_SETS_DROP_TABLE_TAG);
+    for (const auto& [tag, table] : *dropped) {
+      hb_set_add(drop_tables, tag);
+    }
+  }
 
   SetMixedModeSubsettingFlagsIfNeeded(context, input);
 
-  hb_face_unique_ptr result = make_hb_face(hb_subset_or_fail(font, input));
+  hb_subset_plan_unique_ptr plan(hb_subset_plan_create_or_fail(font, input),
+                                 &hb_subset_plan_destroy);
+  hb_subset_input_destroy(input);
+  if (!plan) {
+    return absl::InternalError("Harfbuzz subsetting operation failed.");
+  }
+  return plan;
+}
+
+StatusOr<hb_face_unique_ptr> Encoder::CutSubsetFaceBuilder(
+    const ProcessingContext& context, hb_face_t* font,
+    const SubsetDefinition& def,
+    std::shared_ptr<const GlyphMapping>* glyph_mapping) const {
+  // Invariant tables are computed from context.fully_expanded_face_, so can
+  // only be reused for subsets of it.
+  const table_list_t* invariant_tables = nullptr;
+  if (share_invariant_tables_ && font == context.fully_expanded_face_.get()) {
+    invariant_tables = TRY(CachedInvariantTables(context, def.design_space));
+  }
+
+  hb_subset_plan_unique_ptr plan =
+      TRY(CreateSubsetPlan(context, font, def, invariant_tables));
+
+  hb_face_unique_ptr result =
+      make_hb_face(hb_subset_plan_execute_or_fail(plan.get()));
   if (!result.get()) {
     return absl::InternalError("Harfbuzz subsetting operation failed.");
   }
 
-  hb_subset_input_destroy(input);
+  if (invariant_tables) {
+    for (const auto& [tag, table] : *invariant_tables) {
+      hb_blob_unique_ptr blob = table.blob();
+      hb_face_builder_add_table(result.get(), tag, blob.get());
+    }
+  }
+
+  if (IsMixedMode() && context.has_cff_outlines_ &&
+      font == context.fully_expanded_face_.get() && def.design_space.empty()) {
+    // CFF isn't patched by table keyed patches and glyph keyed patches only
+    // replace charstrings, so every subset keeps the fully expanded subset's
+    // CFF structure (Top and Private DICTs, FDArray and FDSelect). Otherwise
+    // the subsetter drops FDs which this subset doesn't use and glyphs patched
+    // in later would reference missing or different FDs. Charstrings of glyphs
+    // outside of this subset are left empty.
+    const hb_map_t* old_to_new =
+        hb_subset_plan_old_to_new_glyph_mapping(plan.get());
+    for (hb_tag_t tag : {FontHelper::kCFF, FontHelper::kCFF2}) {
+      FontData full = FontHelper::TableData(font, tag);
+      if (full.empty()) {
+        continue;
+      }
+      FontData cff;
+      cff.take(TRY(FontHelper::RebuildCffCharStrings(
+          full.str(), tag == FontHelper::kCFF2,
+          [&](uint32_t gid, string_view charstring) {
+            return hb_map_has(old_to_new, gid) ? charstring : string_view();
+          })));
+      hb_blob_unique_ptr blob = cff.blob();
+      hb_face_builder_add_table(result.get(), tag, blob.get());
+    }
+  }
+
+  if (glyph_mapping) {
+    *glyph_mapping = std::make_shared<GlyphMapping>(plan.get());
+  }
   return result;
 }
 
+// Tables whose subset doesn't depend on the codepoints, features or glyphs
+// in most fonts. For each of these a larger subset definition never causes
+// less of the table to be retained.
+static constexpr hb_tag_t kInvariantTableCandidates[] = {
+    HB_TAG('n', 'a', 'm', 'e'), HB_TAG('p', 'o', 's', 't'),
+    HB_TAG('h', 'e', 'a', 'd'), HB_TAG('f', 'v', 'a', 'r'),
+    HB_TAG('a', 'v', 'a', 'r'), HB_TAG('S', 'T', 'A', 'T'),
+    HB_TAG('g', 'a', 's', 'p'), HB_TAG('f', 'p', 'g', 'm'),
+    HB_TAG('p', 'r', 'e', 'p'), HB_TAG('c', 'v', 't', ' '),
+    HB_TAG('m', 'e', 't', 'a'),
+};
+
+StatusOr<Encoder::table_list_t> Encoder::InvariantTables(
+    const ProcessingContext& context,
+    const design_space_t& design_space) const {
+  SubsetDefinition smallest = context.base_subset_;
+  smallest.design_space = design_space;
+  SubsetDefinition largest = FullyExpandedDefinition(context);
+  largest.design_space = design_space;
+
+  hb_face_t* font = context.fully_expanded_face_.get();
+  hb_subset_plan_unique_ptr smallest_plan =
+      TRY(CreateSubsetPlan(context, font, smallest));
+  hb_face_unique_ptr smallest_face =
+      make_hb_face(hb_subset_plan_execute_or_fail(smallest_plan.get()));
+  hb_subset_plan_unique_ptr largest_plan =
+      TRY(CreateSubsetPlan(context, font, largest));
+  hb_face_unique_ptr largest_face =
+      make_hb_face(hb_subset_plan_execute_or_fail(largest_plan.get()));
+  if (!smallest_face.get() || !largest_face.get()) {
+    return absl::InternalError("Harfbuzz subsetting operation failed.");
+  }
+
+  table_list_t tables;
+  for (hb_tag_t tag : kInvariantTableCandidates) {
+    FontData smallest_table = FontHelper::TableData(smallest_face.get(), tag);
+    FontData largest_table = FontHelper::TableData(largest_face.get(), tag);
+    if (smallest_table.empty() || smallest_table != largest_table) {
+      continue;
+    }
+    tables.push_back(std::pair(tag, std::move(smallest_table)));
+  }
+  return tables;
+}
+
 StatusOr<FontData> Encoder::GenerateBaseGvar(
     const ProcessingContext& context, hb_face_t* font,
     const design_space_t& design_space) const {
+  EncoderStats::Timer timer(stats_, EncoderStats::GENERATE_BASE_GVAR);
+  TraceSpan span("Encoder::GenerateBaseGvar");
   // When generating a gvar table for use with glyph keyed patches care
   // must be taken to ensure that the shared tuples in the gvar
   // header match the shared tuples used in the per glyph data
@@ -538,14 +1873,16 @@ StatusOr<FontData> Encoder::GenerateBaseGvar(
   //
   // To keep the shared tuples correct we subset in two steps:
   // 1. Run instancing only, keeping everything else, this matches
-  //    the processing done in EnsureGlyphKeyedPatchesPopulated()
+  //    the processing done in PopulateGlyphKeyedPatches()
   //    and will result in the same shared tuples.
   // 2. Run the glyph base subset, with no instancing specified.
   //    if there is no specified instancing then harfbuzz will
   //    not modify shared tuples.
 
   // Step 1: Instancing
-  auto instance = Instance(context, font, design_space);
+  auto instance = font == context.fully_expanded_face_.get()
+                      ? CachedInstance(context, design_space)
+                      : Instance(context, font, design_space);
   if (!instance.ok()) {
     return instance.status();
   }
@@ -570,28 +1907,72 @@ StatusOr<FontData> Encoder::GenerateBaseGvar(
   return result;
 }
 
+uint32_t Encoder::MixedModeSubsettingFlags(
+    const ProcessingContext& context) const {
+  if (!IsMixedMode()) {
+    return 0;
+  }
+
+  // Mixed mode requires stable gids set flags accordingly. CFF charstrings
+  // are moved between fonts by glyph keyed patches so they must not
+  // reference subroutines, which the subsetter renumbers per subset.
+  uint32_t flags =
+      HB_SUBSET_FLAGS_RETAIN_GIDS | HB_SUBSET_FLAGS_NOTDEF_OUTLINE |
+      HB_SUBSET_FLAGS_PASSTHROUGH_UNRECOGNIZED | HB_SUBSET_FLAGS_DESUBROUTINIZE;
+
+  if (context.force_long_loca_and_gvar_ || context.has_cff_outlines_) {
+    // IFTB requirements flag has the side effect of forcing long loca and
+    // gvar. For CFF and CFF2 it places the CharStrings INDEX at the end of
+    // the table, which glyph keyed patches require.
+    flags |= HB_SUBSET_FLAGS_IFTB_REQUIREMENTS;
+  }
+  return flags;
+}
+
 void Encoder::SetMixedModeSubsettingFlagsIfNeeded(
     const ProcessingContext& context, hb_subset_input_t* input) const {
-  if (IsMixedMode()) {
-    // Mixed mode requires stable gids set flags accordingly.
-    hb_subset_input_set_flags(
-        input, hb_subset_input_get_flags(input) | HB_SUBSET_FLAGS_RETAIN_GIDS |
-                   HB_SUBSET_FLAGS_NOTDEF_OUTLINE |
-                   HB_SUBSET_FLAGS_PASSTHROUGH_UNRECOGNIZED);
+  uint32_t flags = MixedModeSubsettingFlags(context);
+  if (flags) {
+    hb_subset_input_set_flags(input, hb_subset_input_get_flags(input) | flags);
+  }
+}
+
+StatusOr<FontData> Encoder::CutSubset(
+    const ProcessingContext& context, hb_face_t* font, uint64_t font_hash,
+    const SubsetDefinition& def,
+    std::shared_ptr<const GlyphMapping>* glyph_mapping) const {
+  EncoderStats::Timer timer(stats_, EncoderStats::CUT_SUBSET);
+  TraceSpan span("Encoder::CutSubset");
+  uint64_t cache_key = 0;
+  if (subset_cache_) {
+    // The key must capture everything which influences the subsetter output.
+    cache_key = StableHash(font_hash, kSubsetCacheKey, def);
+    cache_key = Fnv1a(cache_key, kSubsetCacheVersion);
+    cache_key = Fnv1a(cache_key, absl::string_view(hb_version_string()));
+    cache_key = Fnv1a(cache_key, (uint32_t)IsMixedMode());
+    cache_key = Fnv1a(cache_key, MixedModeSubsettingFlags(context));
+    if (IsMixedMode() && def.IsVariable()) {
+      // The replacement gvar table depends on the base subset.
+      cache_key =
+          StableHash(cache_key, kBaseSubsetFingerprint, context.base_subset_);
+    }
 
-    if (context.force_long_loca_and_gvar_) {
-      // IFTB requirements flag has the side effect of forcing long loca and
-      // gvar.
-      hb_subset_input_set_flags(input, hb_subset_input_get_flags(input) |
-                                           HB_SUBSET_FLAGS_IFTB_REQUIREMENTS);
+    auto cached = subset_cache_->Get(cache_key);
+    if (cached.has_value()) {
+      if (stats_) {
+        stats_->RecordSubsetCacheHit();
+      }
+      if (glyph_mapping) {
+        // Planning is much cheaper than the full subset.
+        hb_subset_plan_unique_ptr plan =
+            TRY(CreateSubsetPlan(context, font, def));
+        *glyph_mapping = std::make_shared<GlyphMapping>(plan.get());
+      }
+      return std::move(*cached);
     }
   }
-}
 
-StatusOr<FontData> Encoder::CutSubset(const ProcessingContext& context,
-                                      hb_face_t* font,
-                                      const SubsetDefinition& def) const {
-  auto result = CutSubsetFaceBuilder(context, font, def);
+  auto result = CutSubsetFaceBuilder(context, font, def, glyph_mapping);
   if (!result.ok()) {
     return result.status();
   }
@@ -605,7 +1986,9 @@ StatusOr<FontData> Encoder::CutSubset(const ProcessingContext& context,
     // Create such a gvar table here and overwrite the one that was otherwise
     // generated by the normal subsetting operation. The patch generation will
     // handle including a replacement gvar patch when needed.
-    auto base_gvar = GenerateBaseGvar(context, font, def.design_space);
+    auto base_gvar = font == context.fully_expanded_face_.get()
+                         ? CachedBaseGvar(context, def.design_space)
+                         : GenerateBaseGvar(context, font, def.design_space);
     if (!base_gvar.ok()) {
       return base_gvar.status();
     }
@@ -618,12 +2001,20 @@ StatusOr<FontData> Encoder::CutSubset(const ProcessingContext& context,
   hb_blob_unique_ptr blob = make_hb_blob(hb_face_reference_blob(result->get()));
 
   FontData subset(blob.get());
+  if (subset_cache_) {
+    auto sc = subset_cache_->Put(cache_key, subset);
+    if (!sc.ok()) {
+      // The cache is only an optimization, don't fail the encoding.
+      LOG(WARNING) << "Failed to write to the subset cache: " << sc;
+    }
+  }
   return subset;
 }
 
 StatusOr<FontData> Encoder::Instance(const ProcessingContext& context,
                                      hb_face_t* face,
                                      const design_space_t& design_space) const {
+  TraceSpan span("Encoder::Instance");
   hb_subset_input_t* input = hb_subset_input_create_or_fail();
 
   // Keep everything in this subset, except for applying the design space.
@@ -648,9 +2039,47 @@ StatusOr<FontData> Encoder::Instance(const ProcessingContext& context,
   return result;
 }
 
+// Returns a copy of value which shares its data.
+static StatusOr<FontData> ShallowCopy(const StatusOr<FontData>& value) {
+  if (!value.ok()) {
+    return value.status();
+  }
+  FontData copy;
+  copy.shallow_copy(*value);
+  return copy;
+}
+
+StatusOr<FontData> Encoder::CachedInstance(
+    const ProcessingContext& context,
+    const design_space_t& design_space) const {
+  ProcessingContext::DesignSpaceCache& cache = context.CacheFor(design_space);
+  absl::MutexLock lock(&cache.instance_mutex);
+  if (!cache.instance.has_value()) {
+    cache.instance =
+        Instance(context, context.fully_expanded_face_.get(), design_space);
+  }
+  return ShallowCopy(*cache.instance);
+}
+
+StatusOr<FontData> Encoder::CachedBaseGvar(
+    const ProcessingContext& context,
+    const design_space_t& design_space) const {
+  ProcessingContext::DesignSpaceCache& cache = context.CacheFor(design_space);
+  absl::MutexLock lock(&cache.base_gvar_mutex);
+  if (!cache.base_gvar.has_value()) {
+    cache.base_gvar = GenerateBaseGvar(
+        context, context.fully_expanded_face_.get(), design_space);
+  }
+  return ShallowCopy(*cache.base_gvar);
+}
+
 StatusOr<FontData> Encoder::RoundTripWoff2(string_view font,
                                            bool glyf_transform) {
-  auto r = Woff2::EncodeWoff2(font, glyf_transform);
+  TraceSpan span("Encoder::RoundTripWoff2");
+  // Only the decoded table layout is kept, which doesn't depend on how well
+  // the intermediate woff2 is compressed. So use the fastest brotli quality,
+  // at max quality compression dominates the time to produce the root node.
+  auto r = Woff2::EncodeWoff2(font, glyf_transform, 0);
   if (!r.ok()) {
     return r.status();
   }
@@ -658,10 +2087,64 @@ StatusOr<FontData> Encoder::RoundTripWoff2(string_view font,
   return Woff2::DecodeWoff2(r->str());
 }
 
-CompatId Encoder::ProcessingContext::GenerateCompatId() {
-  return CompatId(
-      this->random_values_(this->gen_), this->random_values_(this->gen_),
-      this->random_values_(this->gen_), this->random_values_(this->gen_));
+StatusOr<const Encoder::table_list_t*> Encoder::CachedInvariantTables(
+    const ProcessingContext& context,
+    const design_space_t& design_space) const {
+  ProcessingContext::DesignSpaceCache& cache = context.CacheFor(design_space);
+  absl::MutexLock lock(&cache.invariant_tables_mutex);
+  if (!cache.invariant_tables.has_value()) {
+    cache.invariant_tables = InvariantTables(context, design_space);
+  }
+  if (!cache.invariant_tables->ok()) {
+    return cache.invariant_tables->status();
+  }
+  return &**cache.invariant_tables;
+}
+
+StatusOr<const std::string*> Encoder::CachedGlyphKeyedTable(
+    const ProcessingContext& context, const GraphNode& node) const {
+  ProcessingContext::DesignSpaceCache& cache =
+      context.CacheFor(node.subset.design_space);
+  absl::MutexLock lock(&cache.glyph_keyed_table_mutex);
+  if (!cache.glyph_keyed_table.has_value()) {
+    IFTTable glyph_keyed;
+    glyph_keyed.SetId(node.glyph_keyed_compat_id);
+    glyph_keyed.SetUrlTemplate(node.glyph_keyed_uri_template);
+    Status sc = PopulateGlyphKeyedPatchMap(
+        context, node.subset.design_space, glyph_keyed.GetPatchMap());
+    if (sc.ok()) {
+      cache.glyph_keyed_table = Format2PatchMap::Serialize(glyph_keyed);
+    } else {
+      cache.glyph_keyed_table = sc;
+    }
+  }
+  if (!cache.glyph_keyed_table->ok()) {
+    return cache.glyph_keyed_table->status();
+  }
+  return &**cache.glyph_keyed_table;
+}
+
+Encoder::ProcessingContext::DesignSpaceCache&
+Encoder::ProcessingContext::CacheFor(const design_space_t& design_space) const {
+  absl::MutexLock lock(&design_space_caches_mutex_);
+  auto& cache = design_space_caches_[design_space];
+  if (!cache) {
+    cache = std::make_unique<DesignSpaceCache>();
+  }
+  return *cache;
+}
+
+CompatId Encoder::ProcessingContext::GenerateCompatId(
+    const SubsetDefinition& def, uint32_t kind, uint32_t variant) const {
+  uint64_t seed = kind == kGlyphKeyedCompatId ? glyph_keyed_compat_id_seed_
+                                              : compat_id_seed_;
+  uint64_t h = StableHash(seed, kind, def);
+  if (variant) {
+    h = Fnv1a(h, variant);
+  }
+  uint64_t a = SplitMix64(h);
+  uint64_t b = SplitMix64(h);
+  return CompatId(a >> 32, a & 0xFFFFFFFF, b >> 32, b & 0xFFFFFFFF);
 }
 
 }  // namespace ift::encoder
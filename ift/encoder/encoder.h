@@ -2,17 +2,33 @@
 #define IFT_ENCODER_ENCODER_H_
 
 #include <cstdint>
-#include <random>
-
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/btree_map.h"
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/str_replace.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "brotli/brotli_font_diff.h"
+#include "common/brotli_binary_diff.h"
+#include "common/brotli_dictionary_cache.h"
 #include "common/compat_id.h"
+#include "common/disk_cache.h"
 #include "common/font_data.h"
+#include "common/thread_pool.h"
 #include "hb-subset.h"
 #include "ift/encoder/condition.h"
+#include "ift/encoder/encoder_stats.h"
+#include "ift/encoder/patch_sink.h"
+#include "ift/encoder/progress.h"
 #include "ift/encoder/subset_definition.h"
 #include "ift/proto/patch_map.h"
 #include "ift/table_keyed_diff.h"
@@ -25,10 +41,6 @@ namespace ift::encoder {
  */
 class Encoder {
  public:
-  // TODO(garretrieger): add api to configure brotli quality level (for glyph
-  // and table keyed).
-  //                     Default to 11 but in tests run lower quality.
-
   Encoder()
       : face_(common::make_hb_face(nullptr))
 
@@ -45,6 +57,173 @@ class Encoder {
    */
   void SetJumpAhead(uint32_t count) { this->jump_ahead_ = count; }
 
+  /*
+   * Limits the number of levels (including the root) in the table keyed patch
+   * graph. Nodes in the second last level have only a single patch which adds
+   * all remaining segments. Defaults to 0 which means unlimited depth,
+   * otherwise must be at least 2.
+   */
+  void SetMaxDepth(uint32_t depth) { this->max_depth_ = depth; }
+
+  /*
+   * If set, every node in the table keyed patch graph will have (in addition
+   * to the usual patches) a patch which adds all remaining segments. This
+   * allows any state to be extended to full coverage in one round trip.
+   */
+  void SetIncludeAllSegmentPatches(bool value) {
+    this->include_all_segment_patches_ = value;
+  }
+
+  /*
+   * Configures the brotli settings used to compress table keyed and glyph
+   * keyed patches respectively. Both default to quality 11 with the default
+   * window size. Lower qualities are much faster to encode at the cost of
+   * larger patches.
+   */
+  void SetTableKeyedBrotliOptions(common::BrotliBinaryDiff::Options options) {
+    this->table_keyed_brotli_options_ = options;
+  }
+  void SetGlyphKeyedBrotliOptions(common::BrotliBinaryDiff::Options options) {
+    this->glyph_keyed_brotli_options_ = options;
+  }
+
+  /*
+   * If non zero, a brotli dictionary of up to this many bytes is trained from
+   * the glyph data of each glyph keyed patch set, and that set's patches are
+   * compressed against it. This considerably shrinks small glyph keyed
+   * patches. The dictionary is output alongside the patches at
+   * "<patch set id>_dictionary.gkd".
+   *
+   * Non-conformant: the IFT specification has no way to reference a
+   * dictionary for glyph keyed patches. The patches keep the standard ifgk
+   * header, so a conforming client can't tell that a dictionary is needed and
+   * will fail to decode them. The encoding can only be used by clients which
+   * obtain the dictionary out of band, and Encode() fails unless
+   * SetAllowNonConformant() is also set. Defaults to 0 (off).
+   */
+  void SetGlyphKeyedDictionarySize(uint32_t bytes) {
+    this->glyph_keyed_dictionary_size_ = bytes;
+  }
+
+  /*
+   * Allows options which produce an encoding that doesn't conform to the IFT
+   * specification (see SetGlyphKeyedDictionarySize()). Defaults to false.
+   */
+  void SetAllowNonConformant(bool value) {
+    this->allow_non_conformant_ = value;
+  }
+
+  /*
+   * If set, glyph keyed patches are content addressed: the id (and so url) of
+   * each patch is tied to a hash of the segment's glyph ids and glyph data,
+   * and glyph keyed compat ids no longer depend on the rest of the font. A
+   * patch whose glyphs are unchanged between releases of a font keeps the same
+   * url and contents, so it can continue to be served from warm caches.
+   *
+   * Patch ids are numeric so can't hold the hash directly. Instead ids are
+   * allocated per unique content (see GlyphKeyedContentKey) and the
+   * allocations from previous encodings (see Encoding::glyph_keyed_patch_ids)
+   * should be supplied via AddPriorGlyphKeyedPatchId(). Previously seen
+   * content reuses its id, new content is given an id above all prior ids so
+   * that a url is never reused for different contents. Can't be combined with
+   * a glyph keyed dictionary.
+   */
+  void SetContentAddressedGlyphKeyedPatches(bool value) {
+    this->content_addressed_glyph_keyed_patches_ = value;
+  }
+
+  /*
+   * Identifies the content of a glyph keyed patch. 'hash' alone could collide
+   * so it's paired with 'digest', an independent hash of the same content.
+   * Content which matches a prior hash but not the prior digest is treated as
+   * new content and given a fresh id.
+   */
+  struct GlyphKeyedContentKey {
+    uint64_t hash = 0;
+    uint64_t digest = 0;
+
+    bool operator==(const GlyphKeyedContentKey& other) const {
+      return hash == other.hash && digest == other.digest;
+    }
+
+    template <typename H>
+    friend H AbslHashValue(H h, const GlyphKeyedContentKey& key) {
+      return H::combine(std::move(h), key.hash, key.digest);
+    }
+  };
+
+  void AddPriorGlyphKeyedPatchId(uint64_t content_hash,
+                                 uint64_t content_digest, uint32_t id) {
+    prior_glyph_keyed_patch_ids_[{content_hash, content_digest}] = id;
+  }
+
+  /*
+   * If set, Encode(sink) produces the outputs needed by most clients first:
+   * the init font, the glyph keyed patches for the init font's design space,
+   * and the table keyed patches which apply directly to the init font. Once
+   * those have been passed to the sink PatchSink::CriticalPathDone() is called
+   * so they can be published while the rest of the encoding is generated.
+   * Remaining table keyed patches are then produced in breadth first order.
+   *
+   * Breadth first order keeps more nodes alive at once than the default
+   * planning (depth first) order, so peak memory use is higher.
+   */
+  void SetCriticalPathFirst(bool value) { this->critical_path_first_ = value; }
+
+  /*
+   * Configures how many threads are used to cut subsets and generate patches
+   * during Encode(). Defaults to 1, in which case all work happens on the
+   * calling thread. The produced encoding is identical regardless of the
+   * number of threads used.
+   */
+  void SetNumThreads(uint32_t count) { this->num_threads_ = count; }
+
+  /*
+   * If set, Encode() runs its tasks on pool instead of creating a pool with
+   * SetNumThreads() threads. The pool may be shared by encoders running
+   * concurrently on other threads, including from tasks running on pool (see
+   * common::ThreadPool::ParallelFor()). The pool must outlive this encoder.
+   */
+  void SetThreadPool(common::ThreadPool* pool) { this->thread_pool_ = pool; }
+
+  /*
+   * If set, timings of the expensive operations performed by Encode() and the
+   * sizes of the generated patches are recorded into stats. The stats must
+   * outlive this encoder.
+   */
+  void SetStats(EncoderStats* stats) { this->stats_ = stats; }
+
+  /*
+   * If set, Encode() reports the number of nodes built and patches emitted to
+   * progress, and stops with progress's error (see Progress::Check()) if it's
+   * cancelled or it's deadline passes. Patches already passed to the sink and
+   * subsets stored in the subset cache are kept, so a later encode with those
+   * supplied as prior artifacts only does the remaining work. The progress
+   * must outlive this encoder.
+   */
+  void SetProgress(Progress* progress) { this->progress_ = progress; }
+
+  /*
+   * Configures a persistent cache of subsetting results. When set the result
+   * of every subsetting operation is stored in the cache and later operations
+   * with the same inputs (font, subset definition, and subsetter flags) will
+   * be served from it. The cache may be shared across encoders and processes.
+   */
+  void SetSubsetCache(std::shared_ptr<common::DiskCache> cache) {
+    subset_cache_ = std::move(cache);
+  }
+
+  /*
+   * If set, tables which are the same in every node of the table keyed patch
+   * graph with a given design space (typically name, post, head and, for a
+   * fixed design space, fvar and STAT) are subset once per design space and
+   * then copied into each node instead of being re-subset for every node.
+   * The encoding produced is unchanged. Off by default.
+   */
+  void SetShareInvariantTables(bool value) {
+    this->share_invariant_tables_ = value;
+  }
+
   /*
    * Adds a segmentation of glyph data.
    *
@@ -102,8 +281,28 @@ class Encoder {
   struct Encoding {
     common::FontData init_font;
     absl::flat_hash_map<std::string, common::FontData> patches;
+
+    // Fingerprints which uniquely identify the inputs used to generate the
+    // init font and each patch (keyed by url). These can be supplied to a later
+    // encoder via AddPriorArtifact() to skip regenerating unchanged outputs.
+    uint64_t init_font_fingerprint = 0;
+    absl::flat_hash_map<std::string, uint64_t> fingerprints;
+
+    // Only set when glyph keyed patches are content addressed. The patch id
+    // allocated to each content key, including all prior allocations.
+    absl::flat_hash_map<GlyphKeyedContentKey, uint32_t> glyph_keyed_patch_ids;
   };
 
+  /*
+   * Supplies an output (init font or patch) from a previous encoding along
+   * with it's fingerprint (see Encoding::fingerprints). During Encode() any
+   * output whose fingerprint matches a prior artifact will be reused as is
+   * instead of being regenerated.
+   */
+  void AddPriorArtifact(uint64_t fingerprint, common::FontData data) {
+    prior_artifacts_[fingerprint] = std::move(data);
+  }
+
   /*
    * Create an IFT encoded version of 'font' that initially supports
    * the configured base subset but can be extended via patches to support any
@@ -114,12 +313,76 @@ class Encoder {
    */
   absl::StatusOr<Encoding> Encode() const;
 
+  /*
+   * Same as Encode() except that patches are passed to 'sink' as they are
+   * produced instead of being accumulated in the returned Encoding (whose
+   * patches map will be empty). Built subsets are released as soon as all
+   * patches which depend on them have been generated. This bounds peak memory
+   * usage for large graphs. Patches are emitted in a deterministic order. If
+   * the sink returns an error encoding stops and that error is returned.
+   * sink.Flush() is called once all patches have been added.
+   *
+   * When using more than one thread, table keyed patches are passed to the
+   * sink from a background thread while later patches are generated. Calls to
+   * sink.Add() never overlap, and a slow sink throttles generation.
+   */
+  absl::StatusOr<Encoding> Encode(PatchSink& sink) const;
+
+  class LazyEncoding;
+
+  /*
+   * Plans the same encoding as Encode() but only generates the init font and
+   * glyph keyed patches up front. Table keyed patches (and the nodes they're
+   * diffed between) are generated the first time they're requested from the
+   * returned LazyEncoding. Useful for serving encodings with large table keyed
+   * graphs where only a fraction of the patches are ever requested.
+   *
+   * This encoder must outlive the returned encoding and must not be
+   * reconfigured while it's in use.
+   */
+  absl::StatusOr<std::unique_ptr<LazyEncoding>> EncodeLazy() const;
+
+  struct EncodingEstimate {
+    uint32_t num_nodes = 0;
+    uint32_t num_table_keyed_patches = 0;
+    uint32_t num_glyph_keyed_patches = 0;
+    // Number of levels in the table keyed patch graph.
+    uint32_t depth = 0;
+
+    // Upper bounds on total output size and peak memory use of Encode(). Both
+    // assume no subset or patch is larger than the input font.
+    uint64_t max_output_bytes = 0;
+    uint64_t max_memory_bytes = 0;
+  };
+
+  /*
+   * Plans the encoding that Encode() would produce without cutting any subsets
+   * or generating any patches, and reports on its size. This is fast relative
+   * to Encode() and can be used to reject configurations which would be too
+   * expensive to encode.
+   */
+  absl::StatusOr<EncodingEstimate> DryRun() const;
+
+  struct GlyphKeyedSizes {
+    // Size of each glyph keyed patch, keyed by url.
+    absl::btree_map<std::string, uint32_t> patch_sizes;
+    // Size of the glyph keyed patch map ('IFTX' table) in the init font.
+    uint32_t mapping_table_size = 0;
+  };
+
+  /*
+   * Computes the sizes of the glyph keyed patches and the glyph keyed patch
+   * map that Encode() would produce. The init font and table keyed patches
+   * aren't built, so this is much faster than Encode() when only the cost of
+   * a glyph segmentation is of interest.
+   */
+  absl::StatusOr<GlyphKeyedSizes> ComputeGlyphKeyedSizes() const;
+
   // TODO(garretrieger): update handling of encoding for use in woff2,
   // see: https://w3c.github.io/IFT/Overview.html#ift-and-compression
   static absl::StatusOr<common::FontData> RoundTripWoff2(
       absl::string_view font, bool glyf_transform = true);
 
- public:
   absl::Status SetBaseSubsetFromDef(const SubsetDefinition& base_subset) {
     if (!base_subset_.empty()) {
       return absl::FailedPreconditionError("Base subset has already been set.");
@@ -132,8 +395,32 @@ class Encoder {
                                               uint32_t choose) const;
 
  private:
+  struct GraphEdge;
+  struct GraphNode;
   struct ProcessingContext;
 
+  /*
+   * Checks that the encoder settings are usable: a face is set, the brotli
+   * options are valid, and the requested features can be combined. Shared by
+   * Encode() and DryRun() so both reject the same configurations.
+   */
+  absl::Status ValidateConfiguration() const;
+
+  /*
+   * Checks the encoder configuration and populates the parts of context which
+   * are shared by every output: the root subset, the fully expanded subset,
+   * and the compat id and fingerprint seeds.
+   */
+  absl::Status InitContext(ProcessingContext& context) const;
+
+  // Returns the subset definition for the root node of the graph.
+  SubsetDefinition RootSubset() const;
+
+  // Returns the subset definition which would be reached if all segments where
+  // added to the font.
+  SubsetDefinition FullyExpandedDefinition(
+      const ProcessingContext& context) const;
+
   // Returns the font subset which would be reach if all segments where added to
   // the font.
   absl::StatusOr<common::FontData> FullyExpandedSubset(
@@ -149,24 +436,66 @@ class Encoder {
     return absl::StrCat(patch_set_id, "_{id}.gk");
   }
 
-  static void AddCombinations(const std::vector<const SubsetDefinition*>& in,
-                              uint32_t number,
-                              std::vector<SubsetDefinition>& out);
+  // Returns the url of the dictionary for the glyph keyed patch set with
+  // uri_template (see SetGlyphKeyedDictionarySize()).
+  static std::string GlyphKeyedDictionaryUrl(absl::string_view uri_template) {
+    return absl::StrReplaceAll(uri_template, {{"{id}.gk", "dictionary.gkd"}});
+  }
+
+  /*
+   * Returns the portion of each extension subset not yet covered by 'base',
+   * skipping any which are fully covered. If non null, 'covered' is set to a
+   * bitset (64 segments per word) of the extension subsets which are fully
+   * covered.
+   */
+  std::vector<SubsetDefinition> RemainingSegments(
+      const SubsetDefinition& base,
+      std::vector<uint64_t>* covered = nullptr) const;
+
+  // Returns the union of segments[i] for each i in the non empty indices.
+  static SubsetDefinition UnionOf(const std::vector<SubsetDefinition>& segments,
+                                  const std::vector<uint32_t>& indices);
 
   SubsetDefinition Combine(const SubsetDefinition& s1,
                            const SubsetDefinition& s2) const;
 
   /*
-   * Create an IFT encoded version of 'font' that initially supports
-   * 'base_subset' but can be extended via patches to support any combination of
-   * 'subsets'.
+   * Walks the patch graph reachable from 'base_subset' and records a node for
+   * each unique subset definition in context.nodes_. Patch ids, compat ids, and
+   * glyph keyed patch sets are assigned during the walk so that the resulting
+   * plan is fully determined before any subsetting or diffing happens.
    *
-   * Returns: the IFT encoded initial font. Patches() will be populated with the
-   * set of associated patch files.
+   * 'levels' is the number of graph levels (including the node for
+   * 'base_subset') which may still be added below this point. Nodes with the
+   * same subset but a different number of levels remaining have different
+   * outgoing patches and so are planned separately.
+   *
+   * Returns: the index of the node for 'base_subset' in context.nodes_.
+   */
+  uint32_t PlanGraph(ProcessingContext& context,
+                     const SubsetDefinition& base_subset,
+                     uint32_t levels) const;
+
+  /*
+   * Cuts the font for a single planned graph node and adds the IFT tables
+   * which map to the node's outgoing patches. The context is only read from so
+   * this is safe to call for multiple nodes concurrently.
+   *
+   * If non null, glyph_mapping is set to the glyph mapping of the node's
+   * subset when it's useful for diffing (see GraphNode::glyph_mapping).
+   */
+  absl::StatusOr<common::FontData> BuildNode(
+      const ProcessingContext& context, const GraphNode& node, bool is_root,
+      std::shared_ptr<const brotli::GlyphMapping>* glyph_mapping =
+          nullptr) const;
+
+  /*
+   * Generates the table keyed patch which transforms 'node' into the node
+   * targeted by 'edge'. Both nodes must have been built already.
    */
-  absl::StatusOr<common::FontData> Encode(ProcessingContext& context,
-                                          const SubsetDefinition& base_subset,
-                                          bool is_root = true) const;
+  absl::StatusOr<common::FontData> BuildEdge(const ProcessingContext& context,
+                                             const GraphNode& node,
+                                             const GraphEdge& edge) const;
 
   /*
    * Returns true if this encoding will contain both glyph keyed and table keyed
@@ -174,54 +503,207 @@ class Encoder {
    */
   bool IsMixedMode() const { return !glyph_data_patches_.empty(); }
 
-  absl::Status EnsureGlyphKeyedPatchesPopulated(
-      ProcessingContext& context, const design_space_t& design_space,
-      std::string& uri_template, common::CompatId& compat_id) const;
+  /*
+   * Prepares the set of glyph keyed patches for the given design space.
+   * Fingerprints for every patch are added to 'fingerprints' and patches
+   * reused from a prior encoding are added to 'patches' keyed by url. The
+   * segments which still need to be generated are added to 'missing_segments'
+   * and if there are any 'instance' is set to the font they should be
+   * generated from.
+   *
+   * If a dictionary is configured and it's reused from a prior encoding it's
+   * set in 'dictionary', otherwise 'instance' is set so that it can be
+   * trained.
+   */
+  absl::Status PopulateGlyphKeyedPatches(
+      const ProcessingContext& context, const design_space_t& design_space,
+      const std::string& uri_template, common::CompatId compat_id,
+      absl::btree_map<std::string, common::FontData>& patches,
+      absl::flat_hash_map<std::string, uint64_t>& fingerprints,
+      absl::btree_set<uint32_t>& missing_segments, common::FontData& instance,
+      std::optional<common::FontData>& dictionary) const;
+
+  /*
+   * Computes the fingerprint of every planned node and edge. A fingerprint
+   * covers all of the inputs which affect the generated font or patch, so
+   * outputs with matching fingerprints are identical.
+   */
+  void ComputeFingerprints(ProcessingContext& context, uint32_t root) const;
+
+  /*
+   * Generates the glyph keyed patches of the patch sets for design_spaces and
+   * passes them to 'sink'. Records the patch fingerprints in 'result'.
+   */
+  absl::Status EmitGlyphKeyedPatches(
+      ProcessingContext& context,
+      const std::vector<design_space_t>& design_spaces,
+      common::ThreadPool& pool, PatchSink& sink, Encoding& result) const;
+
+  /*
+   * Returns the table keyed edges, as (node index, edge) pairs, in the order
+   * their patches are generated. Sets num_critical to the number of leading
+   * edges which apply to the root (only when critical_path_first_ is set,
+   * otherwise it's 0).
+   */
+  std::vector<std::pair<uint32_t, const GraphEdge*>> EdgeOrder(
+      const ProcessingContext& context, uint32_t root,
+      uint32_t& num_critical) const;
+
+  // Returns the number of glyph keyed segments which are activated by a
+  // condition, and so have a patch in each patch set.
+  uint32_t NumReachableGlyphSegments() const;
+
+  // Returns progress_->Check(), or ok if there's no progress set.
+  absl::Status CheckProgress() const {
+    return progress_ ? progress_->Check() : absl::OkStatus();
+  }
+
+  void RecordProgress(Progress::Counter counter, uint64_t value = 1) const {
+    if (progress_) {
+      progress_->Add(counter, value);
+    }
+  }
+
+  /*
+   * Returns the prior artifact with the matching fingerprint if there is one.
+   */
+  const common::FontData* FindPriorArtifact(uint64_t fingerprint) const {
+    auto it = prior_artifacts_.find(fingerprint);
+    if (it == prior_artifacts_.end()) {
+      return nullptr;
+    }
+    return &it->second;
+  }
+
+  /*
+   * When glyph keyed patches are content addressed, allocates the id of every
+   * glyph keyed patch in each patch set planned in context (see
+   * SetContentAddressedGlyphKeyedPatches()). Must be called after PlanGraph()
+   * and before ComputeFingerprints().
+   */
+  absl::Status AssignGlyphKeyedPatchIds(ProcessingContext& context) const;
 
   absl::Status PopulateGlyphKeyedPatchMap(
+      const ProcessingContext& context, const design_space_t& design_space,
       ift::proto::PatchMap& patch_map) const;
 
+  /*
+   * Returns the serialized 'IFTX' table for nodes in the design space of node.
+   * The glyph keyed patch map is the same for every node which shares a design
+   * space (and so uri template and compat id), so it's built and serialized
+   * once. The result is owned by context.
+   */
+  absl::StatusOr<const std::string*> CachedGlyphKeyedTable(
+      const ProcessingContext& context, const GraphNode& node) const;
+
+  typedef std::unique_ptr<hb_subset_plan_t, decltype(&hb_subset_plan_destroy)>
+      hb_subset_plan_unique_ptr;
+
+  // Subset tables along with their tags.
+  typedef std::vector<std::pair<hb_tag_t, common::FontData>> table_list_t;
+
+  // If non null the tables in 'dropped' are left out of the subset.
+  absl::StatusOr<hb_subset_plan_unique_ptr> CreateSubsetPlan(
+      const ProcessingContext& context, hb_face_t* font,
+      const SubsetDefinition& def,
+      const table_list_t* dropped = nullptr) const;
+
+  /*
+   * Returns the tables of context.fully_expanded_face_ which subset to the
+   * same result for every node with the given design space. A table is
+   * invariant if it's equal in the smallest (root) and largest (fully
+   * expanded) subsets for the design space, since subsetter output for the
+   * candidate tables only grows with the subset definition.
+   */
+  absl::StatusOr<table_list_t> InvariantTables(
+      const ProcessingContext& context,
+      const design_space_t& design_space) const;
+
+  // Memoized version of InvariantTables(), the result is owned by context.
+  absl::StatusOr<const table_list_t*> CachedInvariantTables(
+      const ProcessingContext& context,
+      const design_space_t& design_space) const;
+
+  // If non null, glyph_mapping is set to the glyph mapping of the subset.
   absl::StatusOr<common::hb_face_unique_ptr> CutSubsetFaceBuilder(
       const ProcessingContext& context, hb_face_t* font,
-      const SubsetDefinition& def) const;
+      const SubsetDefinition& def,
+      std::shared_ptr<const brotli::GlyphMapping>* glyph_mapping =
+          nullptr) const;
 
   absl::StatusOr<common::FontData> GenerateBaseGvar(
       const ProcessingContext& context, hb_face_t* font,
       const design_space_t& design_space) const;
 
+  // Returns the subsetter flags which mixed mode requires, or 0 if this isn't
+  // a mixed mode encoding.
+  uint32_t MixedModeSubsettingFlags(const ProcessingContext& context) const;
+
   void SetMixedModeSubsettingFlagsIfNeeded(const ProcessingContext& context,
                                            hb_subset_input_t* input) const;
 
-  absl::StatusOr<common::FontData> CutSubset(const ProcessingContext& context,
-                                             hb_face_t* font,
-                                             const SubsetDefinition& def) const;
+  /*
+   * Subsets 'font' to 'def'. font_hash must be a hash of the contents of 'font'
+   * and is used to look up results in the subset cache (if configured). If
+   * non null, glyph_mapping is set to the glyph mapping of the subset.
+   */
+  absl::StatusOr<common::FontData> CutSubset(
+      const ProcessingContext& context, hb_face_t* font, uint64_t font_hash,
+      const SubsetDefinition& def,
+      std::shared_ptr<const brotli::GlyphMapping>* glyph_mapping =
+          nullptr) const;
 
   absl::StatusOr<common::FontData> Instance(
       const ProcessingContext& context, hb_face_t* font,
       const design_space_t& design_space) const;
 
+  /*
+   * Memoized versions of Instance() and GenerateBaseGvar() applied to
+   * context.fully_expanded_face_. Each is computed at most once per design
+   * space, concurrent callers wait for the first to finish.
+   */
+  absl::StatusOr<common::FontData> CachedInstance(
+      const ProcessingContext& context,
+      const design_space_t& design_space) const;
+  absl::StatusOr<common::FontData> CachedBaseGvar(
+      const ProcessingContext& context,
+      const design_space_t& design_space) const;
+
+  // If both are set the glyph mappings are used to speed up diffing tables
+  // with per glyph data, see TableKeyedDiff::SetGlyphMappings().
   absl::StatusOr<std::unique_ptr<const common::BinaryDiff>> GetDifferFor(
-      const common::FontData& font_data, common::CompatId compat_id,
-      bool replace_url_template) const;
+      const ProcessingContext& context, const common::FontData& font_data,
+      common::CompatId compat_id, bool replace_url_template,
+      const brotli::GlyphMapping* base_mapping = nullptr,
+      const brotli::GlyphMapping* derived_mapping = nullptr) const;
 
   static ift::TableKeyedDiff* FullFontTableKeyedDiff(
-      common::CompatId base_compat_id) {
-    return new TableKeyedDiff(base_compat_id);
+      common::CompatId base_compat_id,
+      common::BrotliBinaryDiff::Options options) {
+    return new TableKeyedDiff(base_compat_id, options);
   }
 
   static ift::TableKeyedDiff* MixedModeTableKeyedDiff(
-      common::CompatId base_compat_id) {
-    return new TableKeyedDiff(base_compat_id, {"IFTX", "glyf", "loca", "gvar"});
+      common::CompatId base_compat_id,
+      common::BrotliBinaryDiff::Options options) {
+    return new TableKeyedDiff(
+        base_compat_id, {"IFTX", "glyf", "loca", "gvar", "CFF ", "CFF2"},
+        options);
   }
 
   static ift::TableKeyedDiff* ReplaceIftMapTableKeyedDiff(
-      common::CompatId base_compat_id) {
+      common::CompatId base_compat_id,
+      common::BrotliBinaryDiff::Options options) {
     // the replacement differ is used during design space expansions, both
-    // gvar and "IFT " are overwritten to be compatible with the new design
+    // gvar and "IFTX" are overwritten to be compatible with the new design
     // space. Glyph segment patches for all prev loaded glyphs will be
-    // downloaded to repopulate variation data for existing glyphs.
-    return new TableKeyedDiff(base_compat_id, {"glyf", "loca"},
-                              {"IFTX", "gvar"});
+    // downloaded to repopulate variation data for existing glyphs. Glyph keyed
+    // patches replace the whole variation data of each glyph and are tied to
+    // the compat id of their patch set, so the data can't be extended in
+    // place. Edges within a design space use MixedModeTableKeyedDiff so this
+    // only happens when the design space actually changes.
+    return new TableKeyedDiff(base_compat_id, {"glyf", "loca", "CFF "},
+                              {"IFTX", "gvar", "CFF2"}, options);
   }
 
   bool AllocatePatchSet(ProcessingContext& context,
@@ -236,19 +718,86 @@ class Encoder {
   SubsetDefinition base_subset_;
   std::vector<SubsetDefinition> extension_subsets_;
   uint32_t jump_ahead_ = 1;
+  uint32_t max_depth_ = 0;
+  bool include_all_segment_patches_ = false;
+  common::BrotliBinaryDiff::Options table_keyed_brotli_options_ = {
+      .quality = 11};
+  common::BrotliBinaryDiff::Options glyph_keyed_brotli_options_ = {
+      .quality = 11};
+  uint32_t glyph_keyed_dictionary_size_ = 0;
+  bool allow_non_conformant_ = false;
+  bool content_addressed_glyph_keyed_patches_ = false;
+  bool critical_path_first_ = false;
+  absl::flat_hash_map<GlyphKeyedContentKey, uint32_t>
+      prior_glyph_keyed_patch_ids_;
+  uint32_t num_threads_ = 1;
+  common::ThreadPool* thread_pool_ = nullptr;
+  EncoderStats* stats_ = nullptr;
+  Progress* progress_ = nullptr;
   uint32_t next_id_ = 0;
 
+  absl::flat_hash_map<uint64_t, common::FontData> prior_artifacts_;
+  std::shared_ptr<common::DiskCache> subset_cache_;
+  bool share_invariant_tables_ = false;
+
+  struct GraphEdge {
+    uint32_t patch_id;
+    ift::proto::PatchMap::Coverage coverage;
+    uint32_t child_index;
+    uint64_t fingerprint = 0;
+  };
+
+  struct GraphNode {
+    SubsetDefinition subset;
+    common::CompatId table_keyed_compat_id;
+    std::string glyph_keyed_uri_template;
+    common::CompatId glyph_keyed_compat_id;
+    std::vector<GraphEdge> edges;
+    uint64_t fingerprint = 0;
+
+    // Populated once the node has been built.
+    common::FontData font;
+    // Maps the glyph ids of font to those of the fully expanded subset. Only
+    // set when table keyed patches include glyph data (ie. not in mixed mode)
+    // so that it can be diffed by glyph rather than as opaque bytes.
+    std::shared_ptr<const brotli::GlyphMapping> glyph_mapping;
+  };
+
   struct ProcessingContext {
     ProcessingContext(uint32_t next_id)
-        : gen_(),
-          random_values_(0, std::numeric_limits<uint32_t>::max()),
+        : fully_expanded_face_(common::make_hb_face(nullptr)),
           next_id_(next_id) {}
 
-    std::mt19937 gen_;
-    std::uniform_int_distribution<uint32_t> random_values_;
+    // Hashes of the contents of the input font and fully expanded subset.
+    uint64_t input_font_hash_ = 0;
+    uint64_t fully_expanded_hash_ = 0;
+
+    // Mixed into all generated compat ids, derived from the input font.
+    uint64_t compat_id_seed_ = 0;
+    // Used in place of compat_id_seed_ for glyph keyed compat ids. Fixed when
+    // glyph keyed patches are content addressed.
+    uint64_t glyph_keyed_compat_id_seed_ = 0;
+    // Mixed into all output fingerprints, derived from the fully expanded
+    // subset and the encoder configuration which is common to all outputs.
+    uint64_t fingerprint_seed_ = 0;
 
     common::FontData fully_expanded_subset_;
+    // fully_expanded_subset_ preprocessed for subsetting (see
+    // hb_subset_preprocess()). All node subsets are cut from this face so the
+    // subsetter's acceleration structures are only built once.
+    common::hb_face_unique_ptr fully_expanded_face_;
     bool force_long_loca_and_gvar_ = false;
+    // Set if the font has CFF or CFF2 outlines.
+    bool has_cff_outlines_ = false;
+
+    // Shared by all table keyed diffs so that the prepared dictionary for
+    // each base table is only built once, rather than once per outgoing edge.
+    std::shared_ptr<common::BrotliDictionaryCache> dictionary_cache_ =
+        std::make_shared<common::BrotliDictionaryCache>();
+
+    // The pool which outputs are being produced on. Table keyed diffs split
+    // their per table work across it as well.
+    common::ThreadPool* pool_ = nullptr;
 
     uint32_t next_id_ = 0;
     uint32_t next_patch_set_id_ =
@@ -256,15 +805,153 @@ class Encoder {
     absl::flat_hash_map<design_space_t, std::string> patch_set_uri_templates_;
     absl::flat_hash_map<design_space_t, common::CompatId>
         glyph_keyed_compat_ids_;
+    // Design spaces in the order their patch sets were allocated.
+    std::vector<design_space_t> patch_set_design_spaces_;
+
+    // Only populated when glyph keyed patches are content addressed (see
+    // AssignGlyphKeyedPatchIds()). The patch id of each segment in each patch
+    // set, and the id allocated to each content key.
+    absl::flat_hash_map<design_space_t, absl::flat_hash_map<uint32_t, uint32_t>>
+        glyph_keyed_patch_ids_;
+    absl::flat_hash_map<GlyphKeyedContentKey, uint32_t>
+        glyph_keyed_content_ids_;
+
+    // Returns the id of the glyph keyed patch for 'segment' in the patch set
+    // for design_space.
+    uint32_t GlyphKeyedPatchId(const design_space_t& design_space,
+                               uint32_t segment) const {
+      auto ids = glyph_keyed_patch_ids_.find(design_space);
+      if (ids == glyph_keyed_patch_ids_.end()) {
+        return segment;
+      }
+      return ids->second.at(segment);
+    }
 
-    absl::flat_hash_map<SubsetDefinition, common::FontData> built_subsets_;
-    absl::flat_hash_map<std::string, common::FontData> patches_;
+    // Outputs which only depend on the design space (see CachedInstance()).
+    // Many nodes and patch sets share each design space.
+    struct DesignSpaceCache {
+      absl::Mutex instance_mutex;
+      std::optional<absl::StatusOr<common::FontData>> instance
+          ABSL_GUARDED_BY(instance_mutex);
+      absl::Mutex base_gvar_mutex;
+      std::optional<absl::StatusOr<common::FontData>> base_gvar
+          ABSL_GUARDED_BY(base_gvar_mutex);
+      absl::Mutex invariant_tables_mutex;
+      std::optional<absl::StatusOr<table_list_t>> invariant_tables
+          ABSL_GUARDED_BY(invariant_tables_mutex);
+      absl::Mutex glyph_keyed_table_mutex;
+      std::optional<absl::StatusOr<std::string>> glyph_keyed_table
+          ABSL_GUARDED_BY(glyph_keyed_table_mutex);
+    };
+
+    // Returns the cache for design_space, creating it if needed.
+    DesignSpaceCache& CacheFor(const design_space_t& design_space) const;
+
+    mutable absl::Mutex design_space_caches_mutex_;
+    mutable absl::flat_hash_map<design_space_t,
+                                std::unique_ptr<DesignSpaceCache>>
+        design_space_caches_ ABSL_GUARDED_BY(design_space_caches_mutex_);
+
+    std::vector<GraphNode> nodes_;
+    // Keyed by the bitset of extension subsets covered by the node (see
+    // RemainingSegments()) and number of levels remaining (see PlanGraph()).
+    // Every node subset is the union of the root subset and the extension
+    // subsets it covers, so the bitset identifies the subset while being much
+    // cheaper to hash and compare.
+    absl::flat_hash_map<std::pair<std::vector<uint64_t>, uint32_t>, uint32_t>
+        node_indices_;
     SubsetDefinition base_subset_;
 
-    common::CompatId GenerateCompatId();
+    /*
+     * Returns a compat id for the given subset definition. The id is a stable
+     * hash of 'def', 'kind', 'variant' and compat_id_seed_ (or
+     * glyph_keyed_compat_id_seed_ for glyph keyed ids) so the same inputs
+     * always produce the same id regardless of the order in which ids are
+     * generated. 'variant' distinguishes different nodes which share a subset
+     * definition.
+     */
+    common::CompatId GenerateCompatId(const SubsetDefinition& def,
+                                      uint32_t kind,
+                                      uint32_t variant = 0) const;
   };
 };
 
+/*
+ * An encoding whose table keyed patches are generated on demand, see
+ * Encoder::EncodeLazy(). All patch urls are assigned when the encoding is
+ * planned, so they match those produced by Encode() and don't depend on which
+ * patches are requested or in what order. Each patch, along with the nodes it
+ * connects, is generated at most once and then cached.
+ *
+ * All methods are thread safe, and may be called from tasks running on the
+ * encoder's thread pool. Patches are generated on a pool owned by the
+ * LazyEncoding.
+ */
+class Encoder::LazyEncoding {
+ public:
+  LazyEncoding(const LazyEncoding&) = delete;
+  LazyEncoding& operator=(const LazyEncoding&) = delete;
+
+  const common::FontData& InitFont() const { return init_font_; }
+  uint64_t InitFontFingerprint() const { return init_font_fingerprint_; }
+
+  // Returns the urls of every patch in this encoding, sorted.
+  std::vector<std::string> PatchUrls() const;
+
+  // Returns the fingerprint of the patch at url (see Encoding::fingerprints).
+  absl::StatusOr<uint64_t> Fingerprint(absl::string_view url) const;
+
+  /*
+   * Returns the patch at url, generating it if this is the first request for
+   * it. Returns not found if url isn't a patch in this encoding. Failures to
+   * generate a patch are cached as well.
+   */
+  absl::StatusOr<common::FontData> Patch(absl::string_view url);
+
+  // Returns the number of table keyed graph nodes which have been built so
+  // far, including the init font.
+  uint32_t NumBuiltNodes() const;
+
+ private:
+  friend class Encoder;
+
+  struct NodeState {
+    absl::Mutex mutex;
+    std::optional<absl::Status> status ABSL_GUARDED_BY(mutex);
+  };
+
+  struct PatchState {
+    uint32_t node_index;
+    const GraphEdge* edge;
+    absl::Mutex mutex;
+    std::optional<absl::StatusOr<common::FontData>> patch
+        ABSL_GUARDED_BY(mutex);
+  };
+
+  explicit LazyEncoding(const Encoder& encoder)
+      : encoder_(encoder), context_(encoder.next_id_) {}
+
+  // Builds the node at index into context_.nodes_ if it hasn't been already.
+  absl::Status EnsureBuilt(uint32_t index);
+
+  const Encoder& encoder_;
+  // Runs the diffs of lazily built nodes and patches, see EncodeLazy().
+  std::optional<common::ThreadPool> owned_pool_;
+  ProcessingContext context_;
+  uint32_t root_ = 0;
+
+  common::FontData init_font_;
+  uint64_t init_font_fingerprint_ = 0;
+  absl::flat_hash_map<std::string, uint64_t> fingerprints_;
+  absl::flat_hash_map<std::string, common::FontData> glyph_keyed_patches_;
+
+  // Indexed by node. A node's font in context_.nodes_ is written while holding
+  // its mutex and doesn't change once status is set.
+  std::vector<std::unique_ptr<NodeState>> node_states_;
+  absl::flat_hash_map<std::string, std::unique_ptr<PatchState>>
+      table_keyed_patches_;
+};
+
 }  // namespace ift::encoder
 
 #endif  // IFT_ENCODER_ENCODER_H_
@@ -0,0 +1,124 @@
+#include "ift/encoder/encoder_stats.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+using absl::Duration;
+using absl::MutexLock;
+using absl::StrAppend;
+
+namespace ift::encoder {
+
+const char* EncoderStats::Name(Operation op) {
+  switch (op) {
+    case ENCODE:
+      return "encode";
+    case FULLY_EXPANDED_SUBSET:
+      return "fully_expanded_subset";
+    case CUT_SUBSET:
+      return "cut_subset";
+    case GENERATE_BASE_GVAR:
+      return "generate_base_gvar";
+    case WOFF2_ROUND_TRIP:
+      return "woff2_round_trip";
+    case TABLE_KEYED_DIFF:
+      return "table_keyed_diff";
+    case GLYPH_KEYED_DIFF:
+      return "glyph_keyed_diff";
+    default:
+      return "unknown";
+  }
+}
+
+const char* EncoderStats::Name(PatchType type) {
+  switch (type) {
+    case TABLE_KEYED:
+      return "table_keyed";
+    case GLYPH_KEYED:
+      return "glyph_keyed";
+    default:
+      return "unknown";
+  }
+}
+
+void EncoderStats::RecordOperation(Operation op, Duration duration) {
+  MutexLock lock(&mutex_);
+  OperationStats& stats = operations_[op];
+  stats.count++;
+  stats.total += duration;
+  stats.max = std::max(stats.max, duration);
+}
+
+void EncoderStats::RecordPatch(PatchType type, uint64_t bytes_in,
+                               uint64_t bytes_out) {
+  MutexLock lock(&mutex_);
+  PatchStats& stats = patches_[type];
+  stats.count++;
+  stats.bytes_in += bytes_in;
+  stats.bytes_out += bytes_out;
+}
+
+void EncoderStats::RecordSubsetCacheHit() {
+  MutexLock lock(&mutex_);
+  subset_cache_hits_++;
+}
+
+EncoderStats::OperationStats EncoderStats::Get(Operation op) const {
+  MutexLock lock(&mutex_);
+  return operations_[op];
+}
+
+EncoderStats::PatchStats EncoderStats::Get(PatchType type) const {
+  MutexLock lock(&mutex_);
+  return patches_[type];
+}
+
+uint64_t EncoderStats::SubsetCacheHits() const {
+  MutexLock lock(&mutex_);
+  return subset_cache_hits_;
+}
+
+uint64_t EncoderStats::PeakMemoryBytes() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#ifdef __APPLE__
+  // macOS reports bytes, everywhere else reports kilobytes.
+  return usage.ru_maxrss;
+#else
+  return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+std::string EncoderStats::ToJson() const {
+  MutexLock lock(&mutex_);
+  std::string json = "{\n  \"operations\": {";
+  for (uint32_t i = 0; i < NUM_OPERATIONS; i++) {
+    const OperationStats& stats = operations_[i];
+    StrAppend(&json, i ? "," : "", "\n    \"", Name((Operation)i),
+              "\": {\"count\": ", stats.count,
+              ", \"total_ms\": ", absl::ToDoubleMilliseconds(stats.total),
+              ", \"max_ms\": ", absl::ToDoubleMilliseconds(stats.max), "}");
+  }
+  StrAppend(&json, "\n  },\n  \"patches\": {");
+  for (uint32_t i = 0; i < NUM_PATCH_TYPES; i++) {
+    const PatchStats& stats = patches_[i];
+    StrAppend(&json, i ? "," : "", "\n    \"", Name((PatchType)i),
+              "\": {\"count\": ", stats.count,
+              ", \"bytes_in\": ", stats.bytes_in,
+              ", \"bytes_out\": ", stats.bytes_out, "}");
+  }
+  StrAppend(&json, "\n  },\n  \"subset_cache_hits\": ", subset_cache_hits_,
+            ",\n  \"peak_memory_bytes\": ", PeakMemoryBytes(), "\n}\n");
+  return json;
+}
+
+}  // namespace ift::encoder
@@ -0,0 +1,105 @@
+#ifndef IFT_ENCODER_ENCODER_STATS_H_
+#define IFT_ENCODER_ENCODER_STATS_H_
+
+#include <cstdint>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace ift::encoder {
+
+/*
+ * Counters and timers collected by an Encoder (see Encoder::SetStats()) to
+ * show where the time and memory of an encode goes. Methods are thread safe.
+ */
+class EncoderStats {
+ public:
+  // Timed operations. Timers nest: for example FULLY_EXPANDED_SUBSET time is
+  // also counted under CUT_SUBSET, and CUT_SUBSET includes GENERATE_BASE_GVAR.
+  enum Operation {
+    ENCODE = 0,
+    FULLY_EXPANDED_SUBSET,
+    CUT_SUBSET,
+    GENERATE_BASE_GVAR,
+    WOFF2_ROUND_TRIP,
+    TABLE_KEYED_DIFF,
+    GLYPH_KEYED_DIFF,
+    NUM_OPERATIONS,
+  };
+
+  enum PatchType {
+    TABLE_KEYED = 0,
+    GLYPH_KEYED,
+    NUM_PATCH_TYPES,
+  };
+
+  struct OperationStats {
+    uint64_t count = 0;
+    absl::Duration total;
+    absl::Duration max;
+  };
+
+  struct PatchStats {
+    uint64_t count = 0;
+    // Uncompressed size of the data the patches encode: the target font for
+    // table keyed patches and the glyph data stream for glyph keyed patches.
+    uint64_t bytes_in = 0;
+    // Size of the patches.
+    uint64_t bytes_out = 0;
+  };
+
+  /*
+   * Records the time from construction to destruction as one run of op. Does
+   * nothing if stats is null.
+   */
+  class Timer {
+   public:
+    Timer(EncoderStats* stats, Operation op)
+        : stats_(stats), op_(op), start_(stats ? absl::Now() : absl::Time()) {}
+    ~Timer() {
+      if (stats_) {
+        stats_->RecordOperation(op_, absl::Now() - start_);
+      }
+    }
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+   private:
+    EncoderStats* stats_;
+    Operation op_;
+    absl::Time start_;
+  };
+
+  static const char* Name(Operation op);
+  static const char* Name(PatchType type);
+
+  void RecordOperation(Operation op, absl::Duration duration);
+  void RecordPatch(PatchType type, uint64_t bytes_in, uint64_t bytes_out);
+  void RecordSubsetCacheHit();
+
+  OperationStats Get(Operation op) const;
+  PatchStats Get(PatchType type) const;
+  uint64_t SubsetCacheHits() const;
+
+  // Peak resident memory of this process so far in bytes, or 0 if it's not
+  // available on this platform.
+  static uint64_t PeakMemoryBytes();
+
+  // Returns all of the stats, plus the current PeakMemoryBytes(), as a JSON
+  // object.
+  std::string ToJson() const;
+
+ private:
+  mutable absl::Mutex mutex_;
+  OperationStats operations_[NUM_OPERATIONS] ABSL_GUARDED_BY(mutex_);
+  PatchStats patches_[NUM_PATCH_TYPES] ABSL_GUARDED_BY(mutex_);
+  uint64_t subset_cache_hits_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace ift::encoder
+
+#endif  // IFT_ENCODER_ENCODER_STATS_H_
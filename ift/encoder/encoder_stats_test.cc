@@ -0,0 +1,68 @@
+#include "ift/encoder/encoder_stats.h"
+
+#include <string>
+
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+
+namespace ift::encoder {
+
+class EncoderStatsTest : public ::testing::Test {};
+
+TEST_F(EncoderStatsTest, RecordOperation) {
+  EncoderStats stats;
+  stats.RecordOperation(EncoderStats::CUT_SUBSET, absl::Milliseconds(3));
+  stats.RecordOperation(EncoderStats::CUT_SUBSET, absl::Milliseconds(5));
+
+  auto cut_subset = stats.Get(EncoderStats::CUT_SUBSET);
+  ASSERT_EQ(cut_subset.count, 2);
+  ASSERT_EQ(cut_subset.total, absl::Milliseconds(8));
+  ASSERT_EQ(cut_subset.max, absl::Milliseconds(5));
+
+  ASSERT_EQ(stats.Get(EncoderStats::ENCODE).count, 0);
+}
+
+TEST_F(EncoderStatsTest, Timer) {
+  EncoderStats stats;
+  {
+    EncoderStats::Timer timer(&stats, EncoderStats::TABLE_KEYED_DIFF);
+  }
+  ASSERT_EQ(stats.Get(EncoderStats::TABLE_KEYED_DIFF).count, 1);
+
+  // A null stats is ignored.
+  EncoderStats::Timer timer(nullptr, EncoderStats::TABLE_KEYED_DIFF);
+}
+
+TEST_F(EncoderStatsTest, RecordPatch) {
+  EncoderStats stats;
+  stats.RecordPatch(EncoderStats::GLYPH_KEYED, 100, 40);
+  stats.RecordPatch(EncoderStats::GLYPH_KEYED, 50, 10);
+  stats.RecordSubsetCacheHit();
+
+  auto glyph_keyed = stats.Get(EncoderStats::GLYPH_KEYED);
+  ASSERT_EQ(glyph_keyed.count, 2);
+  ASSERT_EQ(glyph_keyed.bytes_in, 150);
+  ASSERT_EQ(glyph_keyed.bytes_out, 50);
+  ASSERT_EQ(stats.Get(EncoderStats::TABLE_KEYED).count, 0);
+  ASSERT_EQ(stats.SubsetCacheHits(), 1);
+}
+
+TEST_F(EncoderStatsTest, ToJson) {
+  EncoderStats stats;
+  stats.RecordOperation(EncoderStats::WOFF2_ROUND_TRIP, absl::Milliseconds(2));
+  stats.RecordPatch(EncoderStats::TABLE_KEYED, 100, 40);
+
+  std::string json = stats.ToJson();
+  ASSERT_NE(json.find("\"woff2_round_trip\": {\"count\": 1, \"total_ms\": 2, "
+                      "\"max_ms\": 2}"),
+            std::string::npos)
+      << json;
+  ASSERT_NE(json.find("\"table_keyed\": {\"count\": 1, \"bytes_in\": 100, "
+                      "\"bytes_out\": 40}"),
+            std::string::npos)
+      << json;
+  ASSERT_NE(json.find("\"peak_memory_bytes\": "), std::string::npos) << json;
+  ASSERT_GT(EncoderStats::PeakMemoryBytes(), 0);
+}
+
+}  // namespace ift::encoder
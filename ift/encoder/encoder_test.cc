@@ -2,29 +2,43 @@
 
 #include <stdlib.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <memory>
 #include <optional>
+#include <thread>
+#include <utility>
 
 #include "absl/container/btree_map.h"
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "absl/types/span.h"
 #include "common/axis_range.h"
 #include "common/binary_patch.h"
+#include "common/brotli_binary_diff.h"
 #include "common/brotli_binary_patch.h"
+#include "common/disk_cache.h"
 #include "common/font_data.h"
 #include "common/font_helper.h"
 #include "common/hb_set_unique_ptr.h"
+#include "common/thread_pool.h"
+#include "common/woff2.h"
 #include "gtest/gtest.h"
 #include "ift/client/fontations_client.h"
 #include "ift/encoder/subset_definition.h"
+#include "ift/patch_applier.h"
 #include "ift/proto/ift_table.h"
 #include "ift/proto/patch_map.h"
 #include "ift/testdata/test_segments.h"
+#include "ift/url_template.h"
 
 using absl::btree_map;
 using absl::btree_set;
@@ -32,15 +46,22 @@ using absl::flat_hash_map;
 using absl::flat_hash_set;
 using absl::Span;
 using absl::Status;
+using absl::StatusOr;
 using absl::StrCat;
 using absl::string_view;
 using common::AxisRange;
 using common::BinaryPatch;
+using common::BrotliBinaryDiff;
 using common::BrotliBinaryPatch;
+using common::DiskCache;
 using common::FontData;
 using common::FontHelper;
+using common::hb_face_unique_ptr;
 using common::hb_set_unique_ptr;
+using common::make_hb_face;
 using common::make_hb_set;
+using common::ThreadPool;
+using common::Woff2;
 using ift::client::ToGraph;
 using ift::proto::DEFAULT_ENCODING;
 using ift::proto::GLYPH_KEYED;
@@ -53,6 +74,7 @@ using ift::testdata::TestSegment1;
 using ift::testdata::TestSegment2;
 using ift::testdata::TestSegment3;
 using ift::testdata::TestSegment4;
+using ift::testdata::TestVfSegment1;
 
 namespace ift::encoder {
 
@@ -615,6 +637,168 @@ TEST_F(EncoderTest, Encode_ThreeSubsets_Mixed) {
   // TODO XXXXX Check graph instead
 }
 
+TEST_F(EncoderTest, Encode_Mixed_Cff) {
+  FontData cff_font = from_file("common/testdata/NotoSansJP-Regular.otf");
+  Encoder encoder;
+  hb_face_unique_ptr face = cff_font.face();
+  encoder.SetFace(face.get());
+
+  auto gid_to_unicode = FontHelper::GidToUnicodeMap(face.get());
+  btree_set<uint32_t> base_gids;
+  btree_set<uint32_t> extension_gids;
+  flat_hash_set<uint32_t> base_cps;
+  flat_hash_set<uint32_t> extension_cps;
+  for (uint32_t gid = 0; gid < hb_face_get_glyph_count(face.get()); gid++) {
+    auto it = gid_to_unicode.find(gid);
+    bool is_extension = it != gid_to_unicode.end() && it->second >= 0x4E00;
+    (is_extension ? extension_gids : base_gids).insert(gid);
+    if (it != gid_to_unicode.end()) {
+      (is_extension ? extension_cps : base_cps).insert(it->second);
+    }
+  }
+
+  auto s = encoder.AddGlyphDataPatch(0, base_gids);
+  s.Update(encoder.AddGlyphDataPatch(1, extension_gids));
+  s.Update(encoder.AddGlyphDataPatchCondition(Condition::SimpleCondition(
+      SubsetDefinition::Codepoints(extension_cps), 1)));
+  s.Update(encoder.SetBaseSubset(base_cps));
+  ASSERT_TRUE(s.ok()) << s;
+
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+  ASSERT_EQ(encoding->patches.size(), 1);
+
+  auto init_face = encoding->init_font.face();
+  FontData init_cff = FontHelper::TableData(init_face.get(), FontHelper::kCFF);
+  ASSERT_FALSE(init_cff.empty());
+
+  // Glyph keyed patches can only be applied if the CharStrings INDEX is last.
+  auto init_offsets = FontHelper::CffCharStringOffsets(init_cff.str(), false);
+  ASSERT_TRUE(init_offsets.ok()) << init_offsets.status();
+  ASSERT_EQ(init_offsets->back(), init_cff.size());
+
+  // Applying the glyph keyed patch should give the same outlines as directly
+  // subsetting the font to all codepoints.
+  PatchApplier applier(encoding->init_font);
+  auto sc = applier.Apply(encoding->patches.begin()->second);
+  ASSERT_TRUE(sc.ok()) << sc;
+  auto patched = applier.Font();
+  ASSERT_TRUE(patched.ok()) << patched.status();
+  hb_face_unique_ptr patched_face = patched->face();
+
+  hb_subset_input_t* input = hb_subset_input_create_or_fail();
+  for (uint32_t cp : base_cps) {
+    hb_set_add(hb_subset_input_unicode_set(input), cp);
+  }
+  for (uint32_t cp : extension_cps) {
+    hb_set_add(hb_subset_input_unicode_set(input), cp);
+  }
+  hb_subset_input_set_flags(
+      input, HB_SUBSET_FLAGS_RETAIN_GIDS | HB_SUBSET_FLAGS_NOTDEF_OUTLINE |
+                 HB_SUBSET_FLAGS_DESUBROUTINIZE);
+  hb_face_unique_ptr expected_face =
+      make_hb_face(hb_subset_or_fail(face.get(), input));
+  hb_subset_input_destroy(input);
+  ASSERT_NE(expected_face.get(), nullptr);
+
+  // Every FD referenced by a patched in glyph must be present, so the outlines
+  // (whose widths and hints depend on the FD's Private DICT) match.
+  hb_font_t* patched_font = hb_font_create(patched_face.get());
+  hb_font_t* expected_font = hb_font_create(expected_face.get());
+  uint32_t glyph_count = hb_face_get_glyph_count(expected_face.get());
+  ASSERT_EQ(hb_face_get_glyph_count(patched_face.get()), glyph_count);
+  for (uint32_t gid = 0; gid < glyph_count; gid++) {
+    auto patched_charstring =
+        FontHelper::CffCharStringData(patched_face.get(), gid);
+    auto expected_charstring =
+        FontHelper::CffCharStringData(expected_face.get(), gid);
+    ASSERT_TRUE(patched_charstring.ok()) << patched_charstring.status();
+    ASSERT_TRUE(expected_charstring.ok()) << expected_charstring.status();
+    ASSERT_EQ(*patched_charstring, *expected_charstring) << gid;
+
+    hb_glyph_extents_t patched_extents;
+    hb_glyph_extents_t expected_extents;
+    ASSERT_EQ(
+        hb_font_get_glyph_extents(patched_font, gid, &patched_extents),
+        hb_font_get_glyph_extents(expected_font, gid, &expected_extents))
+        << gid;
+    ASSERT_EQ(patched_extents.x_bearing, expected_extents.x_bearing) << gid;
+    ASSERT_EQ(patched_extents.y_bearing, expected_extents.y_bearing) << gid;
+    ASSERT_EQ(patched_extents.width, expected_extents.width) << gid;
+    ASSERT_EQ(patched_extents.height, expected_extents.height) << gid;
+  }
+  hb_font_destroy(patched_font);
+  hb_font_destroy(expected_font);
+}
+
+TEST_F(EncoderTest, Encode_Mixed_DesignSpace_ReplacesIftxAndGvar) {
+  FontData vf = from_file("ift/testdata/NotoSansJP[wght].subset.ttf");
+  hb_face_unique_ptr face = vf.face();
+  Encoder encoder;
+  encoder.SetFace(face.get());
+
+  hb_set_unique_ptr init = make_hb_set();
+  hb_set_add_range(init.get(), 0, hb_face_get_glyph_count(face.get()) - 1);
+  btree_set<uint32_t> segment_1_gids = TestVfSegment1();
+  for (uint32_t gid : segment_1_gids) {
+    hb_set_del(init.get(), gid);
+  }
+  auto s = encoder.AddGlyphDataPatch(0, common::to_btree_set(init.get()));
+  s.Update(encoder.AddGlyphDataPatch(1, segment_1_gids));
+  auto segment_0_cps =
+      FontHelper::GidsToUnicodes(face.get(), common::to_btree_set(init.get()));
+  auto segment_1_cps = FontHelper::GidsToUnicodes(face.get(), segment_1_gids);
+  s.Update(encoder.AddGlyphDataPatchCondition(Condition::SimpleCondition(
+      SubsetDefinition::Codepoints(segment_1_cps), 1)));
+
+  SubsetDefinition base_def;
+  base_def.codepoints.insert(segment_0_cps.begin(), segment_0_cps.end());
+  base_def.design_space = {{kWght, AxisRange::Point(100)}};
+  s.Update(encoder.SetBaseSubsetFromDef(base_def));
+  encoder.AddNonGlyphDataSegment(segment_1_cps);
+  encoder.AddDesignSpaceSegment({{kWght, *AxisRange::Range(100, 900)}});
+  ASSERT_TRUE(s.ok()) << s;
+
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+
+  // Edges which add codepoints stay within a design space and must leave the
+  // client's IFTX and gvar alone, edges which expand the design space replace
+  // both.
+  constexpr uint8_t kReplaceTable = 0b01;
+  uint32_t within_design_space = 0;
+  uint32_t design_space_expansions = 0;
+  for (const auto& [url, patch] : encoding->patches) {
+    string_view data = patch.str();
+    if (data.substr(0, 4) != "iftk") {
+      continue;
+    }
+    btree_map<hb_tag_t, uint8_t> table_flags;
+    uint32_t count = *FontHelper::ReadUInt16(data.substr(24));
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t offset = *FontHelper::ReadUInt32(data.substr(26 + i * 4));
+      hb_tag_t tag = *FontHelper::ReadUInt32(data.substr(offset));
+      table_flags[tag] = data[offset + 4];
+    }
+
+    bool has_iftx = table_flags.contains(HB_TAG('I', 'F', 'T', 'X'));
+    bool has_gvar = table_flags.contains(FontHelper::kGvar);
+    ASSERT_EQ(has_iftx, has_gvar) << url;
+    if (!has_iftx) {
+      within_design_space++;
+      continue;
+    }
+    design_space_expansions++;
+    ASSERT_TRUE(table_flags[HB_TAG('I', 'F', 'T', 'X')] & kReplaceTable)
+        << url;
+    ASSERT_TRUE(table_flags[FontHelper::kGvar] & kReplaceTable) << url;
+  }
+
+  // {} -> {s1} at wght 100 and at wght 100-900, plus the two wght expansions.
+  ASSERT_EQ(within_design_space, 2);
+  ASSERT_EQ(design_space_expansions, 2);
+}
+
 TEST_F(EncoderTest, Encode_ThreeSubsets_Mixed_WithFeatureMappings) {
   Encoder encoder;
   {
@@ -738,6 +922,1023 @@ TEST_F(EncoderTest, Encode_FourSubsets_WithJumpAhead) {
   ASSERT_EQ(g, expected);
 }
 
+TEST_F(EncoderTest, Encode_FourSubsets_WithMaxDepth) {
+  absl::flat_hash_set<hb_codepoint_t> s1 = {'b'};
+  absl::flat_hash_set<hb_codepoint_t> s2 = {'c'};
+  absl::flat_hash_set<hb_codepoint_t> s3 = {'d'};
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment(s1);
+  encoder.AddNonGlyphDataSegment(s2);
+  encoder.AddNonGlyphDataSegment(s3);
+  encoder.SetMaxDepth(3);
+
+  auto encoding = encoder.Encode();
+  hb_face_destroy(face);
+
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+  ASSERT_EQ(encoding->patches.size(), 6);
+
+  graph g;
+  auto sc = ToGraph(*encoding, g);
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  graph expected{
+      {"a", {"ab", "ac", "ad"}},
+      {"ab", {"abcd"}},
+      {"ac", {"abcd"}},
+      {"ad", {"abcd"}},
+      {"abcd", {}},
+  };
+  ASSERT_EQ(g, expected);
+
+  encoder.SetMaxDepth(1);
+  encoding = encoder.Encode();
+  ASSERT_TRUE(absl::IsInvalidArgument(encoding.status()))
+      << encoding.status();
+}
+
+TEST_F(EncoderTest, Encode_BrotliOptions) {
+  auto encode = [&](BrotliBinaryDiff::Options options) {
+    Encoder encoder;
+    hb_face_t* face = font.reference_face();
+    encoder.SetFace(face);
+    hb_face_destroy(face);
+
+    auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+    EXPECT_TRUE(s.ok()) << s;
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'b'});
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'c'});
+    encoder.SetTableKeyedBrotliOptions(options);
+    return encoder.Encode();
+  };
+
+  auto high = encode({.quality = 11});
+  ASSERT_TRUE(high.ok()) << high.status();
+  auto low = encode({.quality = 1, .lgwin = 16});
+  ASSERT_TRUE(low.ok()) << low.status();
+
+  // Patches produced at any quality must apply to the same graph.
+  graph g;
+  auto sc = ToGraph(*low, g);
+  ASSERT_TRUE(sc.ok()) << sc;
+  graph expected{
+      {"a", {"ab", "ac"}},
+      {"ab", {"abc"}},
+      {"ac", {"abc"}},
+      {"abc", {}},
+  };
+  ASSERT_EQ(g, expected);
+
+  // Compression settings change the outputs so must change fingerprints.
+  ASSERT_NE(high->fingerprints.at("1.tk"), low->fingerprints.at("1.tk"));
+
+  auto invalid = encode({.quality = 12});
+  ASSERT_TRUE(absl::IsInvalidArgument(invalid.status())) << invalid.status();
+}
+
+TEST_F(EncoderTest, ComputeGlyphKeyedSizes) {
+  Encoder encoder;
+  hb_face_t* face = noto_sans_jp.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+
+  auto s = encoder.AddGlyphDataPatch(0, segment_0_gids);
+  s.Update(encoder.AddGlyphDataPatch(1, segment_1_gids));
+  s.Update(encoder.AddGlyphDataPatch(2, segment_2_gids));
+  s.Update(encoder.AddGlyphDataPatchCondition(Condition::SimpleCondition(
+      SubsetDefinition::Codepoints(segment_1_cps), 1)));
+  s.Update(encoder.AddGlyphDataPatchCondition(Condition::SimpleCondition(
+      SubsetDefinition::Codepoints(segment_2_cps), 2)));
+  s.Update(encoder.SetBaseSubset(segment_0_cps));
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment(segment_1_cps);
+
+  auto sizes = encoder.ComputeGlyphKeyedSizes();
+  ASSERT_TRUE(sizes.ok()) << sizes.status();
+
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+
+  uint32_t glyph_keyed_count = 0;
+  for (const auto& [url, patch] : encoding->patches) {
+    if (url.substr(url.size() - 2) != "gk") {
+      continue;
+    }
+    glyph_keyed_count++;
+    auto it = sizes->patch_sizes.find(url);
+    ASSERT_TRUE(it != sizes->patch_sizes.end()) << url;
+    ASSERT_EQ(it->second, patch.size()) << url;
+  }
+  ASSERT_EQ(sizes->patch_sizes.size(), glyph_keyed_count);
+  ASSERT_GT(glyph_keyed_count, 0);
+
+  hb_face_unique_ptr init_face = encoding->init_font.face();
+  ASSERT_EQ(sizes->mapping_table_size,
+            FontHelper::TableData(init_face.get(), HB_TAG('I', 'F', 'T', 'X'))
+                .size());
+}
+
+TEST_F(EncoderTest, Encode_Mixed_GlyphKeyedDictionary) {
+  auto encode = [&](uint32_t dictionary_size,
+                    bool allow_non_conformant = true) {
+    Encoder encoder;
+    hb_face_t* face = noto_sans_jp.reference_face();
+    encoder.SetFace(face);
+    hb_face_destroy(face);
+
+    auto s = encoder.AddGlyphDataPatch(0, segment_0_gids);
+    s.Update(encoder.AddGlyphDataPatch(1, segment_1_gids));
+    s.Update(encoder.AddGlyphDataPatch(2, segment_2_gids));
+    s.Update(encoder.AddGlyphDataPatchCondition(Condition::SimpleCondition(
+        SubsetDefinition::Codepoints(segment_1_cps), 1)));
+    s.Update(encoder.AddGlyphDataPatchCondition(Condition::SimpleCondition(
+        SubsetDefinition::Codepoints(segment_2_cps), 2)));
+    s.Update(encoder.SetBaseSubset(segment_0_cps));
+    EXPECT_TRUE(s.ok()) << s;
+    encoder.AddNonGlyphDataSegment(segment_1_cps);
+    encoder.SetGlyphKeyedDictionarySize(dictionary_size);
+    encoder.SetAllowNonConformant(allow_non_conformant);
+    return encoder.Encode();
+  };
+
+  auto plain = encode(0);
+  ASSERT_TRUE(plain.ok()) << plain.status();
+  // Dictionaries are non-conformant so must be explicitly allowed.
+  ASSERT_TRUE(absl::IsInvalidArgument(encode(16384, false).status()));
+  auto with_dictionary = encode(16384);
+  ASSERT_TRUE(with_dictionary.ok()) << with_dictionary.status();
+
+  ASSERT_FALSE(plain->patches.contains("1_dictionary.gkd"));
+  ASSERT_EQ(with_dictionary->patches.size(), plain->patches.size() + 1);
+  const FontData& dictionary = with_dictionary->patches.at("1_dictionary.gkd");
+  ASSERT_GT(dictionary.size(), 0);
+  ASSERT_LE(dictionary.size(), 16384);
+  ASSERT_TRUE(with_dictionary->fingerprints.contains("1_dictionary.gkd"));
+
+  // Glyph keyed patches have the same contents but are compressed against the
+  // dictionary.
+  for (const auto& [url, patch] : plain->patches) {
+    if (url.substr(url.size() - 2) != "gk") {
+      continue;
+    }
+    const FontData& compressed = with_dictionary->patches.at(url);
+    ASSERT_EQ(compressed.str(0, 29), patch.str(0, 29)) << url;
+
+    BrotliBinaryPatch unbrotli;
+    FontData expected, actual;
+    ASSERT_TRUE(
+        unbrotli.Patch(FontData(), FontData(patch.str(29)), &expected).ok());
+    ASSERT_TRUE(
+        unbrotli.Patch(dictionary, FontData(compressed.str(29)), &actual)
+            .ok());
+    ASSERT_EQ(actual, expected) << url;
+  }
+}
+
+TEST_F(EncoderTest, Encode_Mixed_ContentAddressed) {
+  auto encode = [&](const btree_set<uint32_t>& segment_2,
+                    const Encoder::Encoding* prior) {
+    Encoder encoder;
+    hb_face_t* face = noto_sans_jp.reference_face();
+    encoder.SetFace(face);
+    hb_face_destroy(face);
+
+    auto s = encoder.AddGlyphDataPatch(0, segment_0_gids);
+    s.Update(encoder.AddGlyphDataPatch(1, segment_1_gids));
+    s.Update(encoder.AddGlyphDataPatch(2, segment_2));
+    s.Update(encoder.AddGlyphDataPatchCondition(Condition::SimpleCondition(
+        SubsetDefinition::Codepoints(segment_1_cps), 1)));
+    s.Update(encoder.AddGlyphDataPatchCondition(Condition::SimpleCondition(
+        SubsetDefinition::Codepoints(segment_2_cps), 2)));
+    s.Update(encoder.SetBaseSubset(segment_0_cps));
+    EXPECT_TRUE(s.ok()) << s;
+    encoder.AddNonGlyphDataSegment(segment_1_cps);
+    encoder.SetContentAddressedGlyphKeyedPatches(true);
+    if (prior) {
+      for (const auto& [key, id] : prior->glyph_keyed_patch_ids) {
+        encoder.AddPriorGlyphKeyedPatchId(key.hash, key.digest, id);
+      }
+    }
+    return encoder.Encode();
+  };
+
+  auto glyph_keyed_urls = [](const Encoder::Encoding& encoding) {
+    btree_set<std::string> urls;
+    for (const auto& [url, patch] : encoding.patches) {
+      if (url.substr(url.size() - 2) == "gk") {
+        urls.insert(url);
+      }
+    }
+    return urls;
+  };
+
+  auto first = encode(segment_2_gids, nullptr);
+  ASSERT_TRUE(first.ok()) << first.status();
+  ASSERT_EQ(first->glyph_keyed_patch_ids.size(), 3);
+
+  // A later release where the glyphs of segment 2 changed.
+  btree_set<uint32_t> changed_segment_2 = segment_2_gids;
+  changed_segment_2.insert(*segment_1_gids.begin());
+  auto second = encode(changed_segment_2, &*first);
+  ASSERT_TRUE(second.ok()) << second.status();
+  ASSERT_EQ(second->glyph_keyed_patch_ids.size(), 4);
+
+  btree_set<std::string> first_urls = glyph_keyed_urls(*first);
+  btree_set<std::string> second_urls = glyph_keyed_urls(*second);
+  ASSERT_EQ(first_urls.size(), 2);
+  ASSERT_EQ(second_urls.size(), 2);
+
+  // The unchanged segment keeps it's url and contents, the changed segment is
+  // given a new url.
+  std::vector<std::string> shared;
+  std::set_intersection(first_urls.begin(), first_urls.end(),
+                        second_urls.begin(), second_urls.end(),
+                        std::back_inserter(shared));
+  ASSERT_EQ(shared.size(), 1);
+  ASSERT_EQ(first->patches.at(shared[0]), second->patches.at(shared[0]));
+
+  // Re-encoding with the same glyphs reproduces the same urls and ids.
+  auto third = encode(changed_segment_2, &*second);
+  ASSERT_TRUE(third.ok()) << third.status();
+  ASSERT_EQ(glyph_keyed_urls(*third), second_urls);
+  ASSERT_EQ(third->glyph_keyed_patch_ids, second->glyph_keyed_patch_ids);
+  ASSERT_EQ(third->init_font, second->init_font);
+
+  // Simulate hash collisions: prior ids whose hashes match the first
+  // encoding's content but whose digests don't must not be reused.
+  Encoder::Encoding collided;
+  for (const auto& [key, id] : first->glyph_keyed_patch_ids) {
+    collided.glyph_keyed_patch_ids[{key.hash, ~key.digest}] = id;
+  }
+  auto fourth = encode(segment_2_gids, &collided);
+  ASSERT_TRUE(fourth.ok()) << fourth.status();
+  ASSERT_EQ(fourth->glyph_keyed_patch_ids.size(), 6);
+  for (const auto& [key, id] : first->glyph_keyed_patch_ids) {
+    ASSERT_GT(fourth->glyph_keyed_patch_ids.at(key), 2);
+  }
+
+  btree_set<std::string> fourth_urls = glyph_keyed_urls(*fourth);
+  ASSERT_EQ(fourth_urls.size(), 2);
+  shared.clear();
+  std::set_intersection(first_urls.begin(), first_urls.end(),
+                        fourth_urls.begin(), fourth_urls.end(),
+                        std::back_inserter(shared));
+  ASSERT_TRUE(shared.empty());
+}
+
+TEST_F(EncoderTest, Encode_Mixed_ContentAddressedWithDictionary) {
+  Encoder encoder;
+  hb_face_t* face = noto_sans_jp.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+
+  auto s = encoder.AddGlyphDataPatch(0, segment_0_gids);
+  s.Update(encoder.SetBaseSubset(segment_0_cps));
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.SetContentAddressedGlyphKeyedPatches(true);
+  encoder.SetGlyphKeyedDictionarySize(1024);
+  encoder.SetAllowNonConformant(true);
+  ASSERT_TRUE(absl::IsInvalidArgument(encoder.Encode().status()));
+}
+
+TEST_F(EncoderTest, ComputeGlyphKeyedSizes_NotMixedMode) {
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+
+  auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'b'});
+
+  auto sizes = encoder.ComputeGlyphKeyedSizes();
+  ASSERT_TRUE(sizes.ok()) << sizes.status();
+  ASSERT_TRUE(sizes->patch_sizes.empty());
+  ASSERT_EQ(sizes->mapping_table_size, 0);
+}
+
+TEST_F(EncoderTest, DryRun) {
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+
+  auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'b'});
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'c'});
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'d'});
+  encoder.SetJumpAhead(2);
+
+  auto estimate = encoder.DryRun();
+  ASSERT_TRUE(estimate.ok()) << estimate.status();
+  ASSERT_EQ(estimate->num_nodes, 8);
+  ASSERT_EQ(estimate->num_table_keyed_patches, 18);
+  ASSERT_EQ(estimate->num_glyph_keyed_patches, 0);
+  ASSERT_EQ(estimate->depth, 4);
+
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+  ASSERT_EQ(encoding->patches.size(), estimate->num_table_keyed_patches);
+
+  uint64_t total = encoding->init_font.size();
+  for (const auto& [url, patch] : encoding->patches) {
+    total += patch.size();
+  }
+  ASSERT_LE(total, estimate->max_output_bytes);
+
+  encoder.SetMaxDepth(3);
+  estimate = encoder.DryRun();
+  ASSERT_TRUE(estimate.ok()) << estimate.status();
+  ASSERT_EQ(estimate->depth, 3);
+
+  // Configurations rejected by Encode() are also rejected by DryRun().
+  encoder.SetGlyphKeyedDictionarySize(1024);
+  estimate = encoder.DryRun();
+  ASSERT_TRUE(absl::IsInvalidArgument(estimate.status()))
+      << estimate.status();
+  ASSERT_TRUE(absl::IsInvalidArgument(encoder.Encode().status()));
+}
+
+TEST_F(EncoderTest, Encode_FourSubsets_WithAllSegmentPatches) {
+  absl::flat_hash_set<hb_codepoint_t> s1 = {'b'};
+  absl::flat_hash_set<hb_codepoint_t> s2 = {'c'};
+  absl::flat_hash_set<hb_codepoint_t> s3 = {'d'};
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment(s1);
+  encoder.AddNonGlyphDataSegment(s2);
+  encoder.AddNonGlyphDataSegment(s3);
+  encoder.SetIncludeAllSegmentPatches(true);
+
+  auto encoding = encoder.Encode();
+  hb_face_destroy(face);
+
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+  ASSERT_EQ(encoding->patches.size(), 16);
+
+  graph g;
+  auto sc = ToGraph(*encoding, g);
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  graph expected{
+      {"a", {"ab", "ac", "ad", "abcd"}},
+      {"ab", {"abc", "abd", "abcd"}},
+      {"ac", {"abc", "acd", "abcd"}},
+      {"ad", {"abd", "acd", "abcd"}},
+      {"abc", {"abcd"}},
+      {"abd", {"abcd"}},
+      {"acd", {"abcd"}},
+      {"abcd", {}},
+  };
+  ASSERT_EQ(g, expected);
+}
+
+TEST_F(EncoderTest, Encode_MultipleThreads_MatchesSingleThread) {
+  auto encode = [&](uint32_t num_threads) {
+    Encoder encoder;
+    hb_face_t* face = font.reference_face();
+    encoder.SetFace(face);
+    hb_face_destroy(face);
+
+    auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+    EXPECT_TRUE(s.ok()) << s;
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'b'});
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'c'});
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'d'});
+    encoder.SetJumpAhead(2);
+    encoder.SetNumThreads(num_threads);
+    return encoder.Encode();
+  };
+
+  auto expected = encode(1);
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  auto encoding = encode(8);
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+
+  ASSERT_EQ(encoding->init_font, expected->init_font);
+  ASSERT_EQ(encoding->patches.size(), expected->patches.size());
+  for (const auto& [url, patch] : expected->patches) {
+    auto it = encoding->patches.find(url);
+    ASSERT_TRUE(it != encoding->patches.end()) << url;
+    ASSERT_EQ(it->second, patch) << url;
+  }
+
+  graph g;
+  auto sc = ToGraph(*encoding, g);
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  graph expected_graph{
+      {"a", {"ab", "ac", "ad", "abc", "abd", "acd"}},
+      {"ab", {"abc", "abd", "abcd"}},
+      {"ac", {"abc", "acd", "abcd"}},
+      {"ad", {"abd", "acd", "abcd"}},
+      {"abc", {"abcd"}},
+      {"abd", {"abcd"}},
+      {"acd", {"abcd"}},
+      {"abcd", {}},
+  };
+  ASSERT_EQ(g, expected_graph);
+}
+
+TEST_F(EncoderTest, Encode_Mixed_MultipleThreads_MatchesSingleThread) {
+  auto encode = [&](uint32_t num_threads) {
+    Encoder encoder;
+    hb_face_t* face = noto_sans_jp.reference_face();
+    encoder.SetFace(face);
+    hb_face_destroy(face);
+
+    auto s = encoder.AddGlyphDataPatch(0, segment_0_gids);
+    s.Update(encoder.AddGlyphDataPatch(1, segment_1_gids));
+    s.Update(encoder.AddGlyphDataPatch(2, segment_2_gids));
+    s.Update(encoder.AddGlyphDataPatch(3, segment_3_gids));
+    s.Update(encoder.AddGlyphDataPatch(4, segment_4_gids));
+    s.Update(encoder.AddGlyphDataPatchCondition(Condition::SimpleCondition(
+        SubsetDefinition::Codepoints(segment_3_cps), 3)));
+    s.Update(encoder.AddGlyphDataPatchCondition(Condition::SimpleCondition(
+        SubsetDefinition::Codepoints(segment_4_cps), 4)));
+
+    flat_hash_set<uint32_t> base_subset;
+    base_subset.insert(segment_0_cps.begin(), segment_0_cps.end());
+    base_subset.insert(segment_1_cps.begin(), segment_1_cps.end());
+    base_subset.insert(segment_2_cps.begin(), segment_2_cps.end());
+    s.Update(encoder.SetBaseSubset(base_subset));
+    EXPECT_TRUE(s.ok()) << s;
+
+    encoder.SetNumThreads(num_threads);
+    return encoder.Encode();
+  };
+
+  auto expected = encode(1);
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  auto encoding = encode(8);
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+
+  ASSERT_EQ(encoding->init_font, expected->init_font);
+  ASSERT_EQ(encoding->patches.size(), expected->patches.size());
+  for (const auto& [url, patch] : expected->patches) {
+    auto it = encoding->patches.find(url);
+    ASSERT_TRUE(it != encoding->patches.end()) << url;
+    ASSERT_EQ(it->second, patch) << url;
+  }
+}
+
+TEST_F(EncoderTest, Encode_ShareInvariantTables_MatchesDefault) {
+  auto encode = [&](bool share_invariant_tables) {
+    Encoder encoder;
+    hb_face_t* face = font.reference_face();
+    encoder.SetFace(face);
+    hb_face_destroy(face);
+
+    auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+    EXPECT_TRUE(s.ok()) << s;
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'b'});
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'c'});
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'d'});
+    encoder.SetShareInvariantTables(share_invariant_tables);
+    return encoder.Encode();
+  };
+
+  auto expected = encode(false);
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  auto encoding = encode(true);
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+
+  ASSERT_EQ(encoding->init_font, expected->init_font);
+  ASSERT_EQ(encoding->patches.size(), expected->patches.size());
+  for (const auto& [url, patch] : expected->patches) {
+    auto it = encoding->patches.find(url);
+    ASSERT_TRUE(it != encoding->patches.end()) << url;
+    ASSERT_EQ(it->second, patch) << url;
+  }
+}
+
+TEST_F(EncoderTest, Encode_SharedThreadPool) {
+  ThreadPool pool(4);
+  auto encode = [&](ThreadPool* shared, uint32_t last_segment) {
+    Encoder encoder;
+    hb_face_t* face = font.reference_face();
+    encoder.SetFace(face);
+    hb_face_destroy(face);
+
+    auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+    EXPECT_TRUE(s.ok()) << s;
+    for (uint32_t cp = 'b'; cp <= last_segment; cp++) {
+      encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{cp});
+    }
+    encoder.SetThreadPool(shared);
+    return encoder.Encode();
+  };
+
+  auto expected_1 = encode(nullptr, 'd');
+  ASSERT_TRUE(expected_1.ok()) << expected_1.status();
+  auto expected_2 = encode(nullptr, 'e');
+  ASSERT_TRUE(expected_2.ok()) << expected_2.status();
+
+  // Two encodes running concurrently on the same pool.
+  StatusOr<Encoder::Encoding> encoding_1;
+  StatusOr<Encoder::Encoding> encoding_2;
+  std::thread other([&]() { encoding_1 = encode(&pool, 'd'); });
+  encoding_2 = encode(&pool, 'e');
+  other.join();
+
+  for (const auto& [encoding, expected] :
+       {std::pair(&encoding_1, &expected_1),
+        std::pair(&encoding_2, &expected_2)}) {
+    ASSERT_TRUE(encoding->ok()) << encoding->status();
+    ASSERT_EQ((*encoding)->init_font, (*expected)->init_font);
+    ASSERT_EQ((*encoding)->patches.size(), (*expected)->patches.size());
+    for (const auto& [url, patch] : (*expected)->patches) {
+      auto it = (*encoding)->patches.find(url);
+      ASSERT_TRUE(it != (*encoding)->patches.end()) << url;
+      ASSERT_EQ(it->second, patch) << url;
+    }
+  }
+}
+
+TEST_F(EncoderTest, Encode_Stats) {
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+
+  auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'b'});
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'c'});
+
+  EncoderStats stats;
+  encoder.SetStats(&stats);
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+
+  ASSERT_EQ(stats.Get(EncoderStats::ENCODE).count, 1);
+  ASSERT_EQ(stats.Get(EncoderStats::FULLY_EXPANDED_SUBSET).count, 1);
+  ASSERT_EQ(stats.Get(EncoderStats::WOFF2_ROUND_TRIP).count, 1);
+  // The fully expanded subset plus one per node.
+  ASSERT_EQ(stats.Get(EncoderStats::CUT_SUBSET).count, 5);
+
+  auto table_keyed = stats.Get(EncoderStats::TABLE_KEYED);
+  ASSERT_EQ(table_keyed.count, encoding->patches.size());
+  uint64_t bytes_out = 0;
+  for (const auto& [url, patch] : encoding->patches) {
+    bytes_out += patch.size();
+  }
+  ASSERT_EQ(table_keyed.bytes_out, bytes_out);
+  ASSERT_GT(table_keyed.bytes_in, bytes_out);
+  ASSERT_EQ(stats.Get(EncoderStats::GLYPH_KEYED).count, 0);
+}
+
+TEST_F(EncoderTest, Encode_Streaming) {
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+
+  auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'b'});
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'c'});
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'d'});
+  encoder.SetNumThreads(4);
+
+  auto expected = encoder.Encode();
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  // Checks that patches arrive exactly once with the expected fingerprint.
+  class CheckingSink : public PatchSink {
+   public:
+    explicit CheckingSink(const Encoder::Encoding& expected)
+        : expected_(expected) {}
+
+    Status Add(const std::string& url, const FontData& patch,
+               uint64_t fingerprint) override {
+      calls++;
+      if (fail) {
+        return absl::InternalError("sink failed");
+      }
+      EXPECT_FALSE(patches.contains(url)) << url;
+      EXPECT_EQ(fingerprint, expected_.fingerprints.at(url)) << url;
+      patches[url].shallow_copy(patch);
+      return absl::OkStatus();
+    }
+
+    bool fail = false;
+    uint32_t calls = 0;
+    flat_hash_map<std::string, FontData> patches;
+
+   private:
+    const Encoder::Encoding& expected_;
+  };
+
+  CheckingSink sink(*expected);
+  auto encoding = encoder.Encode(sink);
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+
+  ASSERT_TRUE(encoding->patches.empty());
+  ASSERT_EQ(encoding->init_font, expected->init_font);
+  ASSERT_EQ(sink.patches.size(), expected->patches.size());
+  for (const auto& [url, patch] : expected->patches) {
+    auto it = sink.patches.find(url);
+    ASSERT_TRUE(it != sink.patches.end()) << url;
+    ASSERT_EQ(it->second, patch) << url;
+  }
+
+  // Errors from the sink stop the encoding.
+  CheckingSink failing_sink(*expected);
+  failing_sink.fail = true;
+  encoding = encoder.Encode(failing_sink);
+  ASSERT_EQ(encoding.status(), absl::InternalError("sink failed"));
+  ASSERT_EQ(failing_sink.calls, 1);
+}
+
+TEST_F(EncoderTest, Encode_Progress) {
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+
+  auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'b'});
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'c'});
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'d'});
+
+  uint32_t callbacks = 0;
+  Progress progress([&](const Progress&) { callbacks++; });
+  encoder.SetProgress(&progress);
+  auto expected = encoder.Encode();
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  EXPECT_GT(callbacks, 0);
+  EXPECT_EQ(progress.Get(Progress::NODES_TOTAL), 8);
+  EXPECT_EQ(progress.Get(Progress::NODES_DONE), 8);
+  EXPECT_EQ(progress.Get(Progress::PATCHES_TOTAL), expected->patches.size());
+  EXPECT_EQ(progress.Get(Progress::PATCHES_EMITTED),
+            expected->patches.size());
+}
+
+TEST_F(EncoderTest, Encode_CancelAndResume) {
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+
+  auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'b'});
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'c'});
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'d'});
+
+  auto expected = encoder.Encode();
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  Progress expired;
+  expired.SetDeadline(absl::Now() - absl::Seconds(1));
+  encoder.SetProgress(&expired);
+  ASSERT_TRUE(absl::IsDeadlineExceeded(encoder.Encode().status()));
+
+  // Cancel once the first patch has been output.
+  Progress progress([](Progress& p) {
+    if (p.Get(Progress::PATCHES_EMITTED) >= 1) {
+      p.Cancel();
+    }
+  });
+  encoder.SetProgress(&progress);
+  MemoryPatchSink sink;
+  auto cancelled = encoder.Encode(sink);
+  ASSERT_TRUE(absl::IsCancelled(cancelled.status())) << cancelled.status();
+  ASSERT_FALSE(sink.Patches().empty());
+  ASSERT_LT(sink.Patches().size(), expected->patches.size());
+
+  // The patches output before cancelling can be reused by the next encode.
+  encoder.SetProgress(nullptr);
+  for (const auto& [url, patch] : sink.Patches()) {
+    FontData copy;
+    copy.shallow_copy(patch);
+    encoder.AddPriorArtifact(expected->fingerprints.at(url), std::move(copy));
+  }
+  auto resumed = encoder.Encode();
+  ASSERT_TRUE(resumed.ok()) << resumed.status();
+  ASSERT_EQ(resumed->init_font, expected->init_font);
+  ASSERT_EQ(resumed->patches.size(), expected->patches.size());
+  for (const auto& [url, patch] : expected->patches) {
+    ASSERT_EQ(resumed->patches.at(url), patch) << url;
+  }
+}
+
+TEST_F(EncoderTest, Encode_PriorRootArtifact) {
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+
+  auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'b'});
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'c'});
+
+  auto expected = encoder.Encode();
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  // Only the init font is reused, so the root is rebuilt to regenerate its
+  // edges. The patches must still apply to the init font clients receive.
+  FontData init_font;
+  init_font.shallow_copy(expected->init_font);
+  encoder.AddPriorArtifact(expected->init_font_fingerprint,
+                           std::move(init_font));
+  auto encoding = encoder.Encode();
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+  ASSERT_EQ(encoding->init_font, expected->init_font);
+  ASSERT_EQ(encoding->patches.size(), expected->patches.size());
+  for (const auto& [url, patch] : expected->patches) {
+    ASSERT_EQ(encoding->patches.at(url), patch) << url;
+  }
+}
+
+TEST_F(EncoderTest, Encode_CriticalPathFirst) {
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+
+  auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'b'});
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'c'});
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'d'});
+  encoder.SetNumThreads(4);
+
+  auto expected = encoder.Encode();
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  // Records the order of calls to the sink.
+  class RecordingSink : public PatchSink {
+   public:
+    Status AddInitFont(const FontData& init_font,
+                       uint64_t fingerprint) override {
+      events.push_back("init font");
+      return absl::OkStatus();
+    }
+
+    Status Add(const std::string& url, const FontData& patch,
+               uint64_t fingerprint) override {
+      events.push_back(url);
+      patches[url].shallow_copy(patch);
+      return absl::OkStatus();
+    }
+
+    Status CriticalPathDone() override {
+      events.push_back("critical path done");
+      return absl::OkStatus();
+    }
+
+    std::vector<std::string> events;
+    flat_hash_map<std::string, FontData> patches;
+  };
+
+  encoder.SetCriticalPathFirst(true);
+  RecordingSink sink;
+  auto encoding = encoder.Encode(sink);
+  ASSERT_TRUE(encoding.ok()) << encoding.status();
+
+  // The same outputs are produced as in the default order.
+  ASSERT_EQ(encoding->init_font, expected->init_font);
+  ASSERT_EQ(sink.patches.size(), expected->patches.size());
+  for (const auto& [url, patch] : expected->patches) {
+    ASSERT_EQ(sink.patches.at(url), patch) << url;
+  }
+
+  // The patches which apply to the init font come first.
+  auto init_face = encoding->init_font.face();
+  auto ift_table = IFTTable::FromFont(init_face.get());
+  ASSERT_TRUE(ift_table.ok()) << ift_table.status();
+  btree_set<std::string> root_urls;
+  for (const auto& entry : ift_table->GetPatchMap().GetEntries()) {
+    root_urls.insert(URLTemplate::PatchToUrl(ift_table->GetUrlTemplate(),
+                                             entry.patch_index));
+  }
+  ASSERT_EQ(root_urls.size(), 3);
+
+  ASSERT_EQ(sink.events.size(), expected->patches.size() + 2);
+  ASSERT_EQ(sink.events[0], "init font");
+  btree_set<std::string> critical(sink.events.begin() + 1,
+                                  sink.events.begin() + 4);
+  ASSERT_EQ(critical, root_urls);
+  ASSERT_EQ(sink.events[4], "critical path done");
+}
+
+std::string RootCompatId(const Encoder::Encoding& encoding) {
+  auto face = encoding.init_font.face();
+  auto ift_table =
+      FontHelper::TableData(face.get(), HB_TAG('I', 'F', 'T', ' '));
+  return std::string(ift_table.str().substr(5, 16));
+}
+
+TEST_F(EncoderTest, Encode_CompatIdsDerivedFromSubsetDefinition) {
+  auto encode = [&](flat_hash_set<uint32_t> base,
+                    std::vector<flat_hash_set<uint32_t>> segments) {
+    Encoder encoder;
+    hb_face_t* face = font.reference_face();
+    encoder.SetFace(face);
+    hb_face_destroy(face);
+
+    auto s = encoder.SetBaseSubset(base);
+    EXPECT_TRUE(s.ok()) << s;
+    for (const auto& segment : segments) {
+      encoder.AddNonGlyphDataSegment(segment);
+    }
+    return encoder.Encode();
+  };
+
+  auto a = encode({'a'}, {{'b'}, {'c'}});
+  ASSERT_TRUE(a.ok()) << a.status();
+  auto a_reordered = encode({'a'}, {{'c'}, {'b'}});
+  ASSERT_TRUE(a_reordered.ok()) << a_reordered.status();
+  auto b = encode({'b'}, {{'a'}, {'c'}});
+  ASSERT_TRUE(b.ok()) << b.status();
+
+  ASSERT_EQ(RootCompatId(*a), RootCompatId(*a_reordered));
+  ASSERT_NE(RootCompatId(*a), RootCompatId(*b));
+}
+
+TEST_F(EncoderTest, Encode_ReusesPriorArtifacts) {
+  auto encode = [&](const Encoder::Encoding* prior,
+                    absl::string_view replaced_url) {
+    Encoder encoder;
+    hb_face_t* face = font.reference_face();
+    encoder.SetFace(face);
+    hb_face_destroy(face);
+
+    auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+    EXPECT_TRUE(s.ok()) << s;
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'b'});
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'c'});
+
+    if (prior) {
+      for (const auto& [url, fingerprint] : prior->fingerprints) {
+        if (url == replaced_url) {
+          // Substitute recognizable data so reuse can be detected.
+          encoder.AddPriorArtifact(fingerprint, FontData("reused"));
+        }
+      }
+    }
+    return encoder.Encode();
+  };
+
+  auto first = encode(nullptr, "");
+  ASSERT_TRUE(first.ok()) << first.status();
+  ASSERT_EQ(first->fingerprints.size(), first->patches.size());
+
+  auto second = encode(&*first, "2.tk");
+  ASSERT_TRUE(second.ok()) << second.status();
+
+  ASSERT_EQ(second->init_font, first->init_font);
+  ASSERT_EQ(second->init_font_fingerprint, first->init_font_fingerprint);
+  ASSERT_EQ(second->fingerprints, first->fingerprints);
+  for (const auto& [url, patch] : first->patches) {
+    if (url == "2.tk") {
+      ASSERT_EQ(second->patches.at(url).str(), "reused");
+    } else {
+      ASSERT_EQ(second->patches.at(url), patch) << url;
+    }
+  }
+}
+
+TEST_F(EncoderTest, EncodeLazy) {
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+
+  auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'b'});
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'c'});
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'d'});
+  encoder.SetJumpAhead(2);
+
+  auto expected = encoder.Encode();
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  auto lazy = encoder.EncodeLazy();
+  ASSERT_TRUE(lazy.ok()) << lazy.status();
+  ASSERT_EQ((*lazy)->InitFont(), expected->init_font);
+  ASSERT_EQ((*lazy)->InitFontFingerprint(), expected->init_font_fingerprint);
+  ASSERT_EQ((*lazy)->NumBuiltNodes(), 1);
+
+  std::vector<std::string> urls = (*lazy)->PatchUrls();
+  ASSERT_EQ(urls.size(), expected->patches.size());
+  ASSERT_TRUE(std::is_sorted(urls.begin(), urls.end()));
+
+  // Only the nodes connected by a requested patch are built.
+  auto patch = (*lazy)->Patch("1.tk");
+  ASSERT_TRUE(patch.ok()) << patch.status();
+  ASSERT_EQ(*patch, expected->patches.at("1.tk"));
+  ASSERT_EQ((*lazy)->NumBuiltNodes(), 2);
+
+  // Requested in reverse so later nodes are built before their parents.
+  for (auto it = urls.rbegin(); it != urls.rend(); it++) {
+    auto patch = (*lazy)->Patch(*it);
+    ASSERT_TRUE(patch.ok()) << patch.status();
+    ASSERT_EQ(*patch, expected->patches.at(*it)) << *it;
+    ASSERT_EQ(*(*lazy)->Fingerprint(*it), expected->fingerprints.at(*it));
+  }
+
+  ASSERT_TRUE(absl::IsNotFound((*lazy)->Patch("100.tk").status()));
+  ASSERT_TRUE(absl::IsNotFound((*lazy)->Fingerprint("100.tk").status()));
+}
+
+TEST_F(EncoderTest, EncodeLazy_Concurrent) {
+  ThreadPool pool(4);
+  Encoder encoder;
+  hb_face_t* face = font.reference_face();
+  encoder.SetFace(face);
+  hb_face_destroy(face);
+  encoder.SetThreadPool(&pool);
+
+  auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+  ASSERT_TRUE(s.ok()) << s;
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'b'});
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'c'});
+  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'d'});
+  encoder.SetJumpAhead(2);
+
+  auto expected = encoder.Encode();
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  auto lazy = encoder.EncodeLazy();
+  ASSERT_TRUE(lazy.ok()) << lazy.status();
+
+  // Every patch is requested several times at once from tasks on the
+  // encoder's pool, so requests race to build the same nodes and patches.
+  std::vector<std::string> urls = (*lazy)->PatchUrls();
+  constexpr uint32_t kRepeats = 3;
+  std::vector<StatusOr<FontData>> patches(urls.size() * kRepeats);
+  for (uint32_t i = 0; i < patches.size(); i++) {
+    pool.Schedule(
+        [&, i]() { patches[i] = (*lazy)->Patch(urls[i % urls.size()]); });
+  }
+  pool.Wait();
+
+  for (uint32_t i = 0; i < patches.size(); i++) {
+    const std::string& url = urls[i % urls.size()];
+    ASSERT_TRUE(patches[i].ok()) << patches[i].status();
+    ASSERT_EQ(*patches[i], expected->patches.at(url)) << url;
+  }
+}
+
+TEST_F(EncoderTest, Encode_SubsetCache) {
+  std::string cache_dir =
+      StrCat(::testing::TempDir(), "/encoder_test_subset_cache");
+  std::filesystem::remove_all(cache_dir);
+  auto cache = DiskCache::Create(cache_dir, 100 * 1024 * 1024);
+  ASSERT_TRUE(cache.ok()) << cache.status();
+  std::shared_ptr<DiskCache> shared_cache = std::move(*cache);
+
+  auto encode = [&]() {
+    Encoder encoder;
+    hb_face_t* face = font.reference_face();
+    encoder.SetFace(face);
+    hb_face_destroy(face);
+
+    auto s = encoder.SetBaseSubset(flat_hash_set<uint32_t>{'a'});
+    EXPECT_TRUE(s.ok()) << s;
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'b'});
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'c'});
+    encoder.SetSubsetCache(shared_cache);
+    return encoder.Encode();
+  };
+
+  auto first = encode();
+  ASSERT_TRUE(first.ok()) << first.status();
+  uint64_t cache_size = shared_cache->Size();
+  ASSERT_GT(cache_size, 0);
+
+  // All subsets should now come from the cache, so nothing new is added.
+  auto second = encode();
+  ASSERT_TRUE(second.ok()) << second.status();
+  ASSERT_EQ(shared_cache->Size(), cache_size);
+
+  ASSERT_EQ(second->init_font, first->init_font);
+  ASSERT_EQ(second->patches.size(), first->patches.size());
+  for (const auto& [url, patch] : first->patches) {
+    ASSERT_EQ(second->patches.at(url), patch) << url;
+  }
+
+  std::filesystem::remove_all(cache_dir);
+}
+
 void ClearCompatIdFromFormat2(uint8_t* data) {
   for (uint32_t index = 5; index < (5 + 16); index++) {
     data[index] = 0;
@@ -893,6 +2094,20 @@ TEST_F(EncoderTest, RoundTripWoff2) {
   ASSERT_EQ(true_type_tag, Span<const uint8_t>((const uint8_t*)ttf->data(), 4));
 }
 
+TEST_F(EncoderTest, RoundTripWoff2_MatchesMaxQuality) {
+  for (bool glyf_transform : {true, false}) {
+    auto ttf = Encoder::RoundTripWoff2(font.str(), glyf_transform);
+    ASSERT_TRUE(ttf.ok()) << ttf.status();
+
+    auto woff2 = Woff2::EncodeWoff2(font.str(), glyf_transform, 11);
+    ASSERT_TRUE(woff2.ok()) << woff2.status();
+    auto expected = Woff2::DecodeWoff2(woff2->str());
+    ASSERT_TRUE(expected.ok()) << expected.status();
+
+    ASSERT_EQ(*ttf, *expected);
+  }
+}
+
 TEST_F(EncoderTest, RoundTripWoff2_Fails) {
   auto ttf = Encoder::RoundTripWoff2(woff2_font.str());
   ASSERT_TRUE(absl::IsInternal(ttf.status())) << ttf.status();
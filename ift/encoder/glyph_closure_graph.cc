@@ -0,0 +1,338 @@
+#include "ift/encoder/glyph_closure_graph.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "common/glyph_data_index.h"
+#include "common/hb_set_unique_ptr.h"
+#include "common/trace.h"
+#include "common/try.h"
+#include "hb-ot.h"
+#include "hb-subset.h"
+
+using absl::StatusOr;
+using absl::string_view;
+using common::FontHelper;
+using common::GlyphDataIndex;
+using common::hb_font_unique_ptr;
+using common::hb_set_unique_ptr;
+using common::make_hb_font;
+using common::make_hb_set;
+using common::TraceSpan;
+
+namespace ift::encoder {
+
+namespace {
+
+// Calls f for each glyph alternate of gid in lookup, harfbuzz reports the
+// substitute of single substitutions as its only alternate.
+template <typename F>
+void ForEachAlternate(hb_face_t* face, uint32_t lookup, uint32_t gid, F f) {
+  constexpr unsigned kBatch = 64;
+  hb_codepoint_t alternates[kBatch];
+  unsigned start = 0;
+  while (true) {
+    unsigned count = kBatch;
+    unsigned total = hb_ot_layout_lookup_get_glyph_alternates(
+        face, lookup, gid, start, &count, alternates);
+    for (unsigned i = 0; i < count; i++) {
+      f(alternates[i]);
+    }
+    start += count;
+    if (!count || start >= total) {
+      return;
+    }
+  }
+}
+
+std::vector<hb_tag_t> GsubFeatureTags(hb_face_t* face) {
+  std::vector<hb_tag_t> tags;
+  constexpr unsigned kBatch = 64;
+  hb_tag_t batch[kBatch];
+  unsigned start = 0;
+  while (true) {
+    unsigned count = kBatch;
+    unsigned total = hb_ot_layout_table_get_feature_tags(face, HB_OT_TAG_GSUB,
+                                                         start, &count, batch);
+    tags.insert(tags.end(), batch, batch + count);
+    start += count;
+    if (!count || start >= total) {
+      break;
+    }
+  }
+  std::sort(tags.begin(), tags.end());
+  tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+  return tags;
+}
+
+// Adds the GSUB lookups (including those referenced by contextual lookups)
+// reachable from any script and language for features.
+void CollectLookups(hb_face_t* face, std::vector<hb_tag_t> features,
+                    hb_set_t* lookups) {
+  features.push_back(HB_TAG_NONE);
+  hb_ot_layout_collect_lookups(face, HB_OT_TAG_GSUB, nullptr, nullptr,
+                               features.data(), lookups);
+}
+
+}  // namespace
+
+template <typename T>
+GlyphClosureGraph::AdjacencyList<T>
+GlyphClosureGraph::AdjacencyList<T>::FromPairs(
+    std::vector<std::pair<uint32_t, T>> pairs, uint32_t glyph_count) {
+  std::stable_sort(
+      pairs.begin(), pairs.end(),
+      [](const auto& a, const auto& b) { return a.first < b.first; });
+  AdjacencyList list;
+  list.starts.reserve(glyph_count + 1);
+  list.targets.reserve(pairs.size());
+  uint32_t next = 0;
+  for (uint32_t gid = 0; gid < glyph_count; gid++) {
+    list.starts.push_back(list.targets.size());
+    for (; next < pairs.size() && pairs[next].first == gid; next++) {
+      list.targets.push_back(pairs[next].second);
+    }
+  }
+  list.starts.push_back(list.targets.size());
+  return list;
+}
+
+GlyphClosureGraph::GlyphClosureGraph(hb_face_t* face)
+    : glyph_count_(hb_face_get_glyph_count(face)),
+      cmap_(face),
+      default_lookups_(make_hb_set()) {}
+
+StatusOr<GlyphClosureGraph> GlyphClosureGraph::Create(hb_face_t* face) {
+  TraceSpan span("GlyphClosureGraph::Create");
+  for (hb_tag_t tag : {FontHelper::kCFF, HB_TAG('M', 'A', 'T', 'H'),
+                       HB_TAG('C', 'O', 'L', 'R')}) {
+    if (!FontHelper::TableData(face, tag).empty()) {
+      return absl::UnimplementedError(
+          "Closure graph doesn't support fonts with CFF, MATH or COLR tables.");
+    }
+  }
+
+  GlyphClosureGraph graph(face);
+
+  {
+    hb_font_unique_ptr font = make_hb_font(hb_font_create(face));
+    hb_set_unique_ptr selectors = make_hb_set();
+    hb_face_collect_variation_selectors(face, selectors.get());
+    hb_codepoint_t selector = HB_SET_VALUE_INVALID;
+    while (hb_set_next(selectors.get(), &selector)) {
+      hb_set_unique_ptr unicodes = make_hb_set();
+      hb_face_collect_variation_unicodes(face, selector, unicodes.get());
+      hb_codepoint_t cp = HB_SET_VALUE_INVALID;
+      while (hb_set_next(unicodes.get(), &cp)) {
+        hb_codepoint_t gid;
+        if (hb_font_get_variation_glyph(font.get(), cp, selector, &gid)) {
+          graph.variation_glyphs_.push_back(std::pair(cp, gid));
+        }
+      }
+    }
+    std::sort(graph.variation_glyphs_.begin(), graph.variation_glyphs_.end());
+  }
+
+  {
+    hb_subset_input_t* input = hb_subset_input_create_or_fail();
+    if (!input) {
+      return absl::InternalError("Closure subset configuration failed.");
+    }
+    std::vector<hb_tag_t> defaults;
+    hb_set_t* default_features =
+        hb_subset_input_set(input, HB_SUBSET_SETS_LAYOUT_FEATURE_TAG);
+    hb_codepoint_t tag = HB_SET_VALUE_INVALID;
+    while (hb_set_next(default_features, &tag)) {
+      defaults.push_back(tag);
+    }
+    hb_subset_input_destroy(input);
+    CollectLookups(face, defaults, graph.default_lookups_.get());
+  }
+  for (hb_tag_t tag : GsubFeatureTags(face)) {
+    hb_set_unique_ptr lookups = make_hb_set();
+    CollectLookups(face, {tag}, lookups.get());
+    graph.feature_lookups_.insert(std::pair(tag, std::move(lookups)));
+  }
+
+  std::vector<std::pair<uint32_t, std::pair<uint32_t, uint32_t>>>
+      substitutions;
+  std::vector<std::pair<uint32_t, uint32_t>> coarse_inputs;
+  uint32_t lookup_count =
+      hb_ot_layout_table_get_lookup_count(face, HB_OT_TAG_GSUB);
+  for (uint32_t lookup = 0; lookup < lookup_count; lookup++) {
+    hb_set_unique_ptr inputs = make_hb_set();
+    hb_set_unique_ptr outputs = make_hb_set();
+    hb_ot_layout_lookup_collect_glyphs(face, HB_OT_TAG_GSUB, lookup, nullptr,
+                                       inputs.get(), nullptr, outputs.get());
+
+    // If the per glyph alternates account for every output the lookup is a
+    // single or alternate substitution and can be modelled exactly.
+    hb_set_unique_ptr alternates = make_hb_set();
+    std::vector<std::pair<uint32_t, std::pair<uint32_t, uint32_t>>> edges;
+    hb_codepoint_t gid = HB_SET_VALUE_INVALID;
+    while (hb_set_next(inputs.get(), &gid)) {
+      ForEachAlternate(face, lookup, gid, [&](hb_codepoint_t alternate) {
+        hb_set_add(alternates.get(), alternate);
+        edges.push_back(std::pair(gid, std::pair(lookup, alternate)));
+      });
+    }
+    if (hb_set_is_equal(alternates.get(), outputs.get())) {
+      substitutions.insert(substitutions.end(), edges.begin(), edges.end());
+      continue;
+    }
+
+    uint32_t index = graph.coarse_lookups_.size();
+    CoarseLookup coarse{lookup, {}};
+    gid = HB_SET_VALUE_INVALID;
+    while (hb_set_next(outputs.get(), &gid)) {
+      coarse.outputs.push_back(gid);
+    }
+    gid = HB_SET_VALUE_INVALID;
+    while (hb_set_next(inputs.get(), &gid)) {
+      coarse_inputs.push_back(std::pair(gid, index));
+    }
+    graph.coarse_lookups_.push_back(std::move(coarse));
+  }
+  graph.substitutions_ =
+      AdjacencyList<std::pair<uint32_t, uint32_t>>::FromPairs(
+          std::move(substitutions), graph.glyph_count_);
+  graph.coarse_inputs_ = AdjacencyList<uint32_t>::FromPairs(
+      std::move(coarse_inputs), graph.glyph_count_);
+
+  std::vector<std::pair<uint32_t, uint32_t>> components;
+  GlyphDataIndex index(face);
+  if (index.Has(FontHelper::kGlyf)) {
+    for (uint32_t gid = 0; gid < graph.glyph_count_; gid++) {
+      string_view glyph = TRY(index.GlyphData(FontHelper::kGlyf, gid));
+      for (uint32_t component : CompositeComponents(glyph)) {
+        components.push_back(std::pair(gid, component));
+      }
+    }
+  }
+  graph.components_ = AdjacencyList<uint32_t>::FromPairs(std::move(components),
+                                                         graph.glyph_count_);
+
+  return graph;
+}
+
+std::vector<uint32_t> GlyphClosureGraph::CompositeComponents(
+    string_view glyph) {
+  std::vector<uint32_t> components;
+  if (glyph.size() < 10 || !(glyph[0] & 0x80)) {
+    // Empty or simple (numberOfContours >= 0).
+    return components;
+  }
+
+  constexpr uint16_t kArgsAreWords = 0x0001;
+  constexpr uint16_t kHaveScale = 0x0008;
+  constexpr uint16_t kMoreComponents = 0x0020;
+  constexpr uint16_t kHaveXYScale = 0x0040;
+  constexpr uint16_t kHaveTwoByTwo = 0x0080;
+
+  uint32_t offset = 10;
+  while (offset + 4 <= glyph.size()) {
+    uint16_t flags = ((uint8_t)glyph[offset] << 8) | (uint8_t)glyph[offset + 1];
+    components.push_back(((uint8_t)glyph[offset + 2] << 8) |
+                         (uint8_t)glyph[offset + 3]);
+    if (!(flags & kMoreComponents)) {
+      break;
+    }
+    offset += 4 + ((flags & kArgsAreWords) ? 4 : 2);
+    if (flags & kHaveScale) {
+      offset += 2;
+    } else if (flags & kHaveXYScale) {
+      offset += 4;
+    } else if (flags & kHaveTwoByTwo) {
+      offset += 8;
+    }
+  }
+  return components;
+}
+
+void GlyphClosureGraph::Closure(const hb_set_t* codepoints,
+                                const hb_set_t* features, hb_set_t* out) const {
+  hb_set_unique_ptr lookups = make_hb_set();
+  hb_set_union(lookups.get(), default_lookups_.get());
+  hb_codepoint_t tag = HB_SET_VALUE_INVALID;
+  while (hb_set_next(features, &tag)) {
+    auto it = feature_lookups_.find(tag);
+    if (it != feature_lookups_.end()) {
+      hb_set_union(lookups.get(), it->second.get());
+    }
+  }
+
+  std::vector<bool> reached(glyph_count_);
+  std::vector<uint32_t> pending;
+  auto reach = [&](uint32_t gid) {
+    if (gid < glyph_count_ && !reached[gid]) {
+      reached[gid] = true;
+      pending.push_back(gid);
+    }
+  };
+
+  // .notdef is always retained.
+  reach(0);
+  hb_codepoint_t cp = HB_SET_VALUE_INVALID;
+  while (hb_set_next(codepoints, &cp)) {
+    auto gid = cmap_.GlyphFor(cp);
+    if (gid.has_value()) {
+      reach(*gid);
+    }
+    auto it = std::lower_bound(variation_glyphs_.begin(),
+                               variation_glyphs_.end(), std::pair(cp, 0u));
+    for (; it != variation_glyphs_.end() && it->first == cp; it++) {
+      reach(it->second);
+    }
+  }
+
+  std::vector<bool> triggered(coarse_lookups_.size());
+  while (!pending.empty()) {
+    uint32_t gid = pending.back();
+    pending.pop_back();
+    for (uint32_t i = substitutions_.starts[gid];
+         i < substitutions_.starts[gid + 1]; i++) {
+      const auto& [lookup, substitute] = substitutions_.targets[i];
+      if (hb_set_has(lookups.get(), lookup)) {
+        reach(substitute);
+      }
+    }
+    for (uint32_t i = coarse_inputs_.starts[gid];
+         i < coarse_inputs_.starts[gid + 1]; i++) {
+      uint32_t index = coarse_inputs_.targets[i];
+      const CoarseLookup& coarse = coarse_lookups_[index];
+      if (triggered[index] || !hb_set_has(lookups.get(), coarse.lookup)) {
+        continue;
+      }
+      triggered[index] = true;
+      for (uint32_t output : coarse.outputs) {
+        reach(output);
+      }
+    }
+  }
+
+  // Composite components are added after the layout closure, they don't
+  // trigger further substitutions.
+  for (uint32_t gid = 0; gid < glyph_count_; gid++) {
+    if (reached[gid]) {
+      pending.push_back(gid);
+    }
+  }
+  while (!pending.empty()) {
+    uint32_t gid = pending.back();
+    pending.pop_back();
+    hb_set_add(out, gid);
+    for (uint32_t i = components_.starts[gid]; i < components_.starts[gid + 1];
+         i++) {
+      reach(components_.targets[i]);
+    }
+  }
+}
+
+}  // namespace ift::encoder
@@ -0,0 +1,99 @@
+#ifndef IFT_ENCODER_GLYPH_CLOSURE_GRAPH_H_
+#define IFT_ENCODER_GLYPH_CLOSURE_GRAPH_H_
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "common/cmap_index.h"
+#include "common/hb_set_unique_ptr.h"
+#include "hb.h"
+
+namespace ift::encoder {
+
+/*
+ * A precomputed graph of the dependencies between the glyphs of a font, used
+ * to approximate the harfbuzz subsetter's glyph closure much more cheaply than
+ * planning a subset.
+ *
+ * Nodes are glyphs. Edges come from the cmap (including variation sequences),
+ * GSUB lookups and glyf composite glyphs. A closure is the set of glyphs
+ * reachable from the codepoints' nominal glyphs, first through the GSUB edges
+ * of the enabled lookups and then through composite edges, mirroring the order
+ * harfbuzz uses.
+ *
+ * Single and alternate substitutions are modelled per glyph. For all other
+ * lookup types (ligature, contextual, ...) only the lookup's input and output
+ * glyphs are known, so the outputs are treated as reachable once any input
+ * glyph is. Closures are therefore a superset of harfbuzz's.
+ *
+ * Fonts with CFF (seac accents), MATH or COLR tables aren't supported since
+ * those add closure edges which aren't modelled.
+ *
+ * Closure queries are thread safe.
+ */
+class GlyphClosureGraph {
+ public:
+  // Builds the graph for face. Returns unimplemented if the font uses a table
+  // which adds closure edges that the graph can't model.
+  static absl::StatusOr<GlyphClosureGraph> Create(hb_face_t* face);
+
+  // Returns the component glyph ids of glyph, a glyf table entry. Empty for
+  // simple glyphs.
+  static std::vector<uint32_t> CompositeComponents(absl::string_view glyph);
+
+  GlyphClosureGraph(const GlyphClosureGraph&) = delete;
+  GlyphClosureGraph& operator=(const GlyphClosureGraph&) = delete;
+  GlyphClosureGraph(GlyphClosureGraph&&) = default;
+  GlyphClosureGraph& operator=(GlyphClosureGraph&&) = default;
+
+  /*
+   * Adds the closure of codepoints to out, with harfbuzz's default subsetter
+   * layout features plus features enabled.
+   */
+  void Closure(const hb_set_t* codepoints, const hb_set_t* features,
+               hb_set_t* out) const;
+
+ private:
+  // Lookup whose outputs are all reachable once any of its inputs are.
+  struct CoarseLookup {
+    uint32_t lookup;
+    std::vector<uint32_t> outputs;
+  };
+
+  // Edges for each glyph stored contiguously, the edges of glyph g are
+  // targets[starts[g], starts[g + 1]).
+  template <typename T>
+  struct AdjacencyList {
+    std::vector<uint32_t> starts;
+    std::vector<T> targets;
+
+    static AdjacencyList FromPairs(std::vector<std::pair<uint32_t, T>> pairs,
+                                   uint32_t glyph_count);
+  };
+
+  explicit GlyphClosureGraph(hb_face_t* face);
+
+  uint32_t glyph_count_;
+  common::CmapIndex cmap_;
+  // (codepoint, gid) for glyphs of non default variation sequences, sorted by
+  // codepoint. Harfbuzz retains these whenever the base codepoint is present.
+  std::vector<std::pair<uint32_t, uint32_t>> variation_glyphs_;
+
+  common::hb_set_unique_ptr default_lookups_;
+  absl::flat_hash_map<hb_tag_t, common::hb_set_unique_ptr> feature_lookups_;
+
+  // (lookup index, substitute) for single and alternate substitutions.
+  AdjacencyList<std::pair<uint32_t, uint32_t>> substitutions_;
+  // Indices into coarse_lookups_ which list a glyph as an input.
+  AdjacencyList<uint32_t> coarse_inputs_;
+  std::vector<CoarseLookup> coarse_lookups_;
+  AdjacencyList<uint32_t> components_;
+};
+
+}  // namespace ift::encoder
+
+#endif  // IFT_ENCODER_GLYPH_CLOSURE_GRAPH_H_
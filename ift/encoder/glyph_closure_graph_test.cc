@@ -0,0 +1,128 @@
+#include "ift/encoder/glyph_closure_graph.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/status/status.h"
+#include "common/font_data.h"
+#include "common/hb_set_unique_ptr.h"
+#include "gtest/gtest.h"
+#include "hb-subset.h"
+#include "hb.h"
+
+using absl::btree_set;
+using common::FontData;
+using common::hb_face_unique_ptr;
+using common::hb_set_unique_ptr;
+using common::make_hb_set;
+using common::to_btree_set;
+
+namespace ift::encoder {
+
+class GlyphClosureGraphTest : public ::testing::Test {
+ protected:
+  GlyphClosureGraphTest()
+      : roboto(from_file("common/testdata/Roboto-Regular.ttf")),
+        noto_nastaliq_urdu(
+            from_file("common/testdata/NotoNastaliqUrdu.subset.ttf")) {}
+
+  static hb_face_unique_ptr from_file(const char* filename) {
+    hb_blob_t* blob = hb_blob_create_from_file_or_fail(filename);
+    FontData result(blob);
+    hb_blob_destroy(blob);
+    return result.face();
+  }
+
+  static btree_set<uint32_t> HarfbuzzClosure(hb_face_t* face,
+                                             const hb_set_t* codepoints,
+                                             const hb_set_t* features) {
+    hb_subset_input_t* input = hb_subset_input_create_or_fail();
+    hb_set_union(hb_subset_input_unicode_set(input), codepoints);
+    hb_set_union(hb_subset_input_set(input, HB_SUBSET_SETS_LAYOUT_FEATURE_TAG),
+                 features);
+    hb_subset_plan_t* plan = hb_subset_plan_create_or_fail(face, input);
+    hb_subset_input_destroy(input);
+
+    hb_set_unique_ptr gids = make_hb_set();
+    hb_map_values(hb_subset_plan_new_to_old_glyph_mapping(plan), gids.get());
+    hb_subset_plan_destroy(plan);
+    return to_btree_set(gids.get());
+  }
+
+  static btree_set<uint32_t> GraphClosure(const GlyphClosureGraph& graph,
+                                          const hb_set_t* codepoints,
+                                          const hb_set_t* features) {
+    hb_set_unique_ptr gids = make_hb_set();
+    graph.Closure(codepoints, features, gids.get());
+    return to_btree_set(gids.get());
+  }
+
+  static void ExpectSuperset(const btree_set<uint32_t>& a,
+                             const btree_set<uint32_t>& b) {
+    for (uint32_t gid : b) {
+      EXPECT_TRUE(a.contains(gid)) << "missing gid " << gid;
+    }
+  }
+
+  hb_face_unique_ptr roboto;
+  hb_face_unique_ptr noto_nastaliq_urdu;
+};
+
+TEST_F(GlyphClosureGraphTest, CoversHarfbuzzClosure) {
+  auto graph = GlyphClosureGraph::Create(roboto.get());
+  ASSERT_TRUE(graph.ok()) << graph.status();
+
+  hb_set_unique_ptr no_features = make_hb_set();
+  hb_set_unique_ptr smcp = make_hb_set(1, HB_TAG('s', 'm', 'c', 'p'));
+  for (const hb_set_unique_ptr& codepoints :
+       {make_hb_set(1, 'a'), make_hb_set(2, 'f', 'i'),
+        make_hb_set(3, 0xC1, 0xC9, 'z'), make_hb_set()}) {
+    for (const hb_set_t* features : {no_features.get(), smcp.get()}) {
+      auto expected = HarfbuzzClosure(roboto.get(), codepoints.get(), features);
+      auto closure = GraphClosure(*graph, codepoints.get(), features);
+      ExpectSuperset(closure, expected);
+      ASSERT_TRUE(closure.contains(0));
+    }
+  }
+}
+
+TEST_F(GlyphClosureGraphTest, CoversHarfbuzzClosure_ContextualLookups) {
+  auto graph = GlyphClosureGraph::Create(noto_nastaliq_urdu.get());
+  ASSERT_TRUE(graph.ok()) << graph.status();
+
+  hb_set_unique_ptr no_features = make_hb_set();
+  for (const hb_set_unique_ptr& codepoints :
+       {make_hb_set(1, 0x62A), make_hb_set(2, 0x628, 0x62A),
+        make_hb_set(3, 0x628, 0x62A, 0x633)}) {
+    auto expected = HarfbuzzClosure(noto_nastaliq_urdu.get(), codepoints.get(),
+                                    no_features.get());
+    ExpectSuperset(
+        GraphClosure(*graph, codepoints.get(), no_features.get()), expected);
+  }
+}
+
+TEST_F(GlyphClosureGraphTest, Unsupported) {
+  hb_face_unique_ptr cff = from_file("common/testdata/NotoSansJP-Regular.otf");
+  ASSERT_TRUE(
+      absl::IsUnimplemented(GlyphClosureGraph::Create(cff.get()).status()));
+}
+
+TEST_F(GlyphClosureGraphTest, CompositeComponents) {
+  // numberOfContours = -1 and a zeroed bounding box.
+  std::string composite = {'\xFF', '\xFF', 0, 0, 0, 0, 0, 0, 0, 0};
+  // ARG_1_AND_2_ARE_WORDS | MORE_COMPONENTS, glyph 5, word args.
+  composite += {0x00, 0x21, 0x00, 0x05, 0, 0, 0, 0};
+  // WE_HAVE_A_SCALE, glyph 263, byte args and a scale.
+  composite += {0x00, 0x08, 0x01, 0x07, 0, 0, 0, 0};
+
+  EXPECT_EQ(GlyphClosureGraph::CompositeComponents(composite),
+            (std::vector<uint32_t>{5, 263}));
+
+  std::string simple = {0, 1, 0, 0, 0, 0, 0, 0, 0, 0};
+  EXPECT_TRUE(GlyphClosureGraph::CompositeComponents(simple).empty());
+  EXPECT_TRUE(GlyphClosureGraph::CompositeComponents("").empty());
+}
+
+}  // namespace ift::encoder
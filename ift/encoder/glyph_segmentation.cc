@@ -1,50 +1,76 @@
 #include "ift/encoder/glyph_segmentation.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
+#include <fstream>
+#include <functional>
+#include <memory>
 #include <optional>
 #include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "absl/container/btree_map.h"
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/hash/hash.h"
 #include "absl/log/log.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "common/atomic_file.h"
 #include "common/compat_id.h"
 #include "common/font_data.h"
 #include "common/font_helper.h"
+#include "common/glyph_data_index.h"
+#include "common/hb_set_key.h"
 #include "common/hb_set_unique_ptr.h"
+#include "common/sparse_bit_set.h"
+#include "common/thread_pool.h"
+#include "common/trace.h"
 #include "common/try.h"
 #include "hb-subset.h"
-#include "ift/glyph_keyed_diff.h"
+#include "ift/encoder/glyph_closure_graph.h"
+#include "ift/encoder/patch_size_estimator.h"
 
 using absl::btree_map;
 using absl::btree_set;
 using absl::flat_hash_map;
 using absl::flat_hash_set;
+using absl::MutexLock;
 using absl::Span;
 using absl::Status;
 using absl::StatusOr;
 using absl::StrCat;
-using common::CompatId;
-using common::FontData;
+using absl::string_view;
 using common::FontHelper;
+using common::GlyphDataIndex;
 using common::hb_face_unique_ptr;
+using common::HbSetKey;
+using common::HbSetKeyMap;
+using common::HbSetRef;
 using common::hb_set_unique_ptr;
 using common::make_hb_face;
 using common::make_hb_set;
-using common::to_hash_set;
+using common::SparseBitSet;
+using common::ThreadPool;
+using common::WriteFileAtomically;
+using common::TraceSpan;
 
 namespace ift::encoder {
 
 // TODO(garretrieger): extensions/improvements that could be made:
-// - Make a HbSet class which implements hash and equality so we can use in map
-// keys and sets.
 // - Can we reduce # of closures for the additional conditions checks?
 //   - is the full analysis needed to get the or set?
 // - Add logging
-//   - timing info
 // - Use merging and/or duplication to ensure minimum patch size.
 //   - composite patches (NOT STARTED)
 // - Multi segment combination testing with GSUB dep analysis to guide.
@@ -64,90 +90,372 @@ void subtract(btree_set<uint32_t>& a, const btree_set<uint32_t>& b) {
   }
 }
 
+// Checkpoint serialization helpers.
+constexpr char kCheckpointMagic[] = "IFTSEGC1";
+
+void WriteSet(const hb_set_t* set, std::string& out) {
+  out.append(SparseBitSet::Encode(*set));
+}
+
+Status ReadSet(string_view& in, hb_set_t* out) {
+  in = TRY(SparseBitSet::Decode(in, out));
+  return absl::OkStatus();
+}
+
+StatusOr<uint32_t> ReadUInt32(string_view& in) {
+  uint32_t value = TRY(FontHelper::ReadUInt32(in));
+  in.remove_prefix(4);
+  return value;
+}
+
+// Writes each entry of cache, the number of entries must be written
+// separately.
+void WriteCacheEntries(const HbSetKeyMap<hb_set_unique_ptr>& cache,
+                       std::string& out) {
+  for (const auto& [key, value] : cache) {
+    hb_set_unique_ptr key_set = make_hb_set();
+    key.AddTo(key_set.get());
+    WriteSet(key_set.get(), out);
+    WriteSet(value.get(), out);
+  }
+}
+
+// Reads a count followed by that many cache entries, calling 'insert' for
+// each entry.
+template <typename Insert>
+Status ReadCache(string_view& in, Insert insert) {
+  uint32_t count = TRY(ReadUInt32(in));
+  for (uint32_t i = 0; i < count; i++) {
+    hb_set_unique_ptr key = make_hb_set();
+    hb_set_unique_ptr value = make_hb_set();
+    TRYV(ReadSet(in, key.get()));
+    TRYV(ReadSet(in, value.get()));
+    insert(HbSetKey(key.get()), std::move(value));
+  }
+  return absl::OkStatus();
+}
+
+constexpr char kClosureCacheMagic[] = "IFTSEGK1";
+
+// A checksum of the tables in face which is stable across runs, used to tie a
+// persisted closure cache to the font it was computed from. Combines the
+// OpenType checksum (sum of big endian uint32s) and length of every table.
+uint64_t FontChecksum(hb_face_t* face) {
+  uint64_t checksum = 0;
+  for (hb_tag_t tag : FontHelper::GetOrderedTags(face)) {
+    auto table = FontHelper::TableData(face, tag);
+    string_view data = table.str();
+    uint32_t table_checksum = 0;
+    for (uint32_t i = 0; i < data.size(); i += 4) {
+      uint32_t word = 0;
+      for (uint32_t j = 0; j < 4; j++) {
+        word <<= 8;
+        if (i + j < data.size()) {
+          word |= (uint8_t)data[i + j];
+        }
+      }
+      table_checksum += word;
+    }
+    checksum = checksum * 1000003 + tag;
+    checksum = checksum * 1000003 + table_checksum;
+    checksum = checksum * 1000003 + data.size();
+  }
+  return checksum;
+}
+
+/*
+ * The segments which a glyph's and/or conditions reference. Stored as sorted
+ * vectors: most glyphs reference no or only a few segments, and an empty
+ * vector doesn't allocate, unlike a pair of sets per glyph in the font.
+ */
 class GlyphConditions {
  public:
-  GlyphConditions() : and_segments(make_hb_set()), or_segments(make_hb_set()) {}
-  hb_set_unique_ptr and_segments;
-  hb_set_unique_ptr or_segments;
+  std::vector<segment_index_t> and_segments;
+  std::vector<segment_index_t> or_segments;
+
+  static void Add(std::vector<segment_index_t>& segments,
+                  segment_index_t segment) {
+    auto it = std::lower_bound(segments.begin(), segments.end(), segment);
+    if (it == segments.end() || *it != segment) {
+      segments.insert(it, segment);
+    }
+  }
 
   void RemoveSegments(const hb_set_t* segments) {
-    hb_set_subtract(and_segments.get(), segments);
-    hb_set_subtract(or_segments.get(), segments);
+    auto in_segments = [segments](segment_index_t s) {
+      return hb_set_has(segments, s);
+    };
+    and_segments.erase(std::remove_if(and_segments.begin(),
+                                      and_segments.end(), in_segments),
+                       and_segments.end());
+    or_segments.erase(
+        std::remove_if(or_segments.begin(), or_segments.end(), in_segments),
+        or_segments.end());
+  }
+
+  static btree_set<segment_index_t> ToSet(
+      const std::vector<segment_index_t>& segments) {
+    return btree_set<segment_index_t>(segments.begin(), segments.end());
+  }
+
+  static void Write(const std::vector<segment_index_t>& segments,
+                    hb_set_t* scratch, std::string& out) {
+    hb_set_clear(scratch);
+    for (segment_index_t s : segments) {
+      hb_set_add(scratch, s);
+    }
+    WriteSet(scratch, out);
+  }
+
+  static Status Read(string_view& in, hb_set_t* scratch,
+                     std::vector<segment_index_t>& segments) {
+    hb_set_clear(scratch);
+    TRYV(ReadSet(in, scratch));
+    segments.clear();
+    segment_index_t s = HB_SET_VALUE_INVALID;
+    while (hb_set_next(scratch, &s)) {
+      segments.push_back(s);
+    }
+    return absl::OkStatus();
   }
 };
 
 class SegmentationContext;
 
 Status AnalyzeSegment(SegmentationContext& context, const hb_set_t* codepoints,
-                      hb_set_t* and_gids, hb_set_t* or_gids,
-                      hb_set_t* exclusive_gids);
+                      const hb_set_t* features, hb_set_t* and_gids,
+                      hb_set_t* or_gids, hb_set_t* exclusive_gids);
 
 class SegmentationContext {
  public:
+  // codepoint_segment_features optionally gives features for the codepoint
+  // segments (indexed the same), for example when re-applying the segments of
+  // an existing segmentation in which features were merged into codepoint
+  // segments.
   SegmentationContext(
       hb_face_t* face, const flat_hash_set<uint32_t>& initial_segment,
-      const std::vector<flat_hash_set<uint32_t>>& codepoint_segments)
-      : preprocessed_face(make_hb_face(hb_subset_preprocess(face))),
+      const std::vector<flat_hash_set<uint32_t>>& codepoint_segments,
+      const std::vector<btree_set<hb_tag_t>>& feature_segments,
+      const std::vector<btree_set<hb_tag_t>>& codepoint_segment_features = {},
+      ClosureMode closure_mode = ClosureMode::kHarfbuzz)
+      : closure_mode(closure_mode),
+        preprocessed_face(make_hb_face(hb_subset_preprocess(face))),
         original_face(make_hb_face(hb_face_reference(face))),
         segments(),
         initial_codepoints(make_hb_set(initial_segment)),
         all_codepoints(make_hb_set()),
+        all_features(make_hb_set()),
         full_closure(make_hb_set()),
-        initial_closure(make_hb_set()) {
-    for (const auto& s : codepoint_segments) {
-      segments.push_back(make_hb_set(s));
+        initial_closure(make_hb_set()),
+        glyphs_to_regroup(make_hb_set()) {
+    if (closure_mode != ClosureMode::kHarfbuzz) {
+      auto graph = GlyphClosureGraph::Create(original_face.get());
+      if (graph.ok()) {
+        closure_graph.emplace(std::move(*graph));
+      } else {
+        VLOG(0) << "Using harfbuzz closures: " << graph.status();
+      }
+    }
+
+    for (uint32_t i = 0; i < codepoint_segments.size(); i++) {
+      segments.push_back(make_hb_set(codepoint_segments[i]));
+      segment_features.push_back(make_hb_set());
+      if (i < codepoint_segment_features.size()) {
+        for (hb_tag_t tag : codepoint_segment_features[i]) {
+          hb_set_add(segment_features.back().get(), tag);
+        }
+      }
+    }
+    // Feature segments follow the codepoint segments, they have no
+    // codepoints of their own.
+    for (const auto& tags : feature_segments) {
+      segments.push_back(make_hb_set());
+      segment_features.push_back(make_hb_set());
+      for (hb_tag_t tag : tags) {
+        hb_set_add(segment_features.back().get(), tag);
+      }
+    }
+    for (uint32_t i = 0; i < segments.size(); i++) {
+      segment_glyphs.push_back(make_hb_set());
     }
 
     hb_set_union(all_codepoints.get(), initial_codepoints.get());
     for (const auto& s : segments) {
       hb_set_union(all_codepoints.get(), s.get());
     }
+    for (const auto& f : segment_features) {
+      hb_set_union(all_features.get(), f.get());
+    }
 
     {
-      auto closure = GlyphClosure(initial_codepoints.get());
+      hb_set_unique_ptr no_features = make_hb_set();
+      auto closure =
+          GlyphClosure(initial_codepoints.get(), no_features.get());
       if (closure.ok()) {
         initial_closure.reset(closure->release());
       }
     }
 
-    auto closure = GlyphClosure(all_codepoints.get());
+    auto closure = GlyphClosure(all_codepoints.get(), all_features.get());
     if (closure.ok()) {
       full_closure.reset(closure->release());
     }
 
-    gid_conditions.resize(hb_face_get_glyph_count(original_face.get()));
+    uint32_t glyph_count = hb_face_get_glyph_count(original_face.get());
+    gid_conditions.resize(glyph_count);
+    if (glyph_count > 0) {
+      // Everything needs to be grouped the first time around.
+      hb_set_add_range(glyphs_to_regroup.get(), 0, glyph_count - 1);
+    }
   }
 
-  void ResetGroupings() {
-    unmapped_glyphs = {};
-    and_glyph_groups = {};
-    or_glyph_groups = {};
-    fallback_segments = {};
+  /*
+   * Must be called before the conditions of gid are modified. Removes gid
+   * from the glyph groups formed from it's current conditions and schedules
+   * it to be regrouped by the next call to GroupGlyphs().
+   */
+  void InvalidateGlyph(glyph_id_t gid) {
+    if (hb_set_has(glyphs_to_regroup.get(), gid)) {
+      // Already ungrouped.
+      return;
+    }
+    hb_set_add(glyphs_to_regroup.get(), gid);
+    unmapped_glyphs.erase(gid);
+
+    const auto& condition = gid_conditions[gid];
+    if (!condition.and_segments.empty()) {
+      RemoveFromGroup(and_glyph_groups,
+                      GlyphConditions::ToSet(condition.and_segments), gid);
+    }
+    if (!condition.or_segments.empty()) {
+      RemoveFromGroup(or_glyph_groups,
+                      GlyphConditions::ToSet(condition.or_segments), gid);
+    }
+  }
+
+  // Adds segment to the and (or if is_or is set) conditions of gid.
+  void AddCondition(glyph_id_t gid, segment_index_t segment, bool is_or) {
+    InvalidateGlyph(gid);
+    auto& condition = gid_conditions[gid];
+    GlyphConditions::Add(is_or ? condition.or_segments : condition.and_segments,
+                         segment);
+    hb_set_add(segment_glyphs[segment].get(), gid);
+  }
+
+  /*
+   * Removes segments from the conditions of all glyphs which reference any of
+   * them, invalidating those glyphs. Only the glyphs found via segment_glyphs
+   * are visited.
+   */
+  void RemoveConditions(const hb_set_t* segments) {
+    hb_set_unique_ptr affected = make_hb_set();
+    segment_index_t s = HB_SET_VALUE_INVALID;
+    while (hb_set_next(segments, &s)) {
+      hb_set_union(affected.get(), segment_glyphs[s].get());
+      hb_set_clear(segment_glyphs[s].get());
+    }
+
+    glyph_id_t gid = HB_SET_VALUE_INVALID;
+    while (hb_set_next(affected.get(), &gid)) {
+      InvalidateGlyph(gid);
+      gid_conditions[gid].RemoveSegments(segments);
+    }
   }
 
-  StatusOr<hb_set_unique_ptr> GlyphClosure(const hb_set_t* codepoints) {
-    auto cache_key = to_hash_set(codepoints);
+  // Unmapped glyphs are placed into the fallback group only for the duration
+  // of forming a segmentation. They are kept out of it otherwise so the
+  // groups can be incrementally updated.
+  void AddUnmappedToFallback() {
+    if (unmapped_glyphs.empty()) {
+      return;
+    }
+    or_glyph_groups[fallback_segments].insert(unmapped_glyphs.begin(),
+                                              unmapped_glyphs.end());
+  }
 
-    auto it = glyph_closure_cache.find(cache_key);
-    if (it != glyph_closure_cache.end()) {
-      glyph_closure_cache_hit++;
-      hb_set_unique_ptr result = make_hb_set();
-      hb_set_union(result.get(), it->second.get());
-      return result;
+  void RemoveUnmappedFromFallback() {
+    for (glyph_id_t gid : unmapped_glyphs) {
+      RemoveFromGroup(or_glyph_groups, fallback_segments, gid);
+    }
+  }
+
+  // A segment which has neither codepoints nor features is disabled.
+  bool IsSegmentEmpty(segment_index_t s) const {
+    return hb_set_is_empty(segments[s].get()) &&
+           hb_set_is_empty(segment_features[s].get());
+  }
+
+  /*
+   * Computes the glyph closure of codepoints with the default layout features
+   * plus features enabled.
+   *
+   * Safe to call concurrently from multiple threads.
+   */
+  StatusOr<hb_set_unique_ptr> GlyphClosure(const hb_set_t* codepoints,
+                                           const hb_set_t* features) {
+    hb_set_unique_ptr combined = CacheKeySet(codepoints, features);
+    const hb_set_t* key_set = combined ? combined.get() : codepoints;
+    HbSetRef cache_key(key_set);
+    ClosureCacheShard& shard = ClosureShardFor(cache_key.hash);
+
+    {
+      MutexLock lock(&shard.mutex);
+      auto it = shard.cache.find(cache_key);
+      if (it != shard.cache.end()) {
+        glyph_closure_cache_hit++;
+        hb_set_unique_ptr result = make_hb_set();
+        hb_set_union(result.get(), it->second.get());
+        return result;
+      }
     }
 
     glyph_closure_cache_miss++;
     closure_count_cumulative++;
     closure_count_delta++;
+    // Only misses are traced, hits are too frequent and cheap to be useful.
+    TraceSpan span("GlyphClosure");
+
+    hb_set_unique_ptr gids = make_hb_set();
+    if (closure_graph.has_value() && closure_mode == ClosureMode::kGraph) {
+      closure_graph->Closure(codepoints, features, gids.get());
+    } else {
+      gids = TRY(HarfbuzzClosure(codepoints, features));
+    }
+    if (closure_graph.has_value() &&
+        closure_mode == ClosureMode::kGraphValidated) {
+      hb_set_unique_ptr graph_gids = make_hb_set();
+      closure_graph->Closure(codepoints, features, graph_gids.get());
+      if (!hb_set_is_equal(graph_gids.get(), gids.get())) {
+        LOG(WARNING) << "Graph closure has "
+                     << hb_set_get_population(graph_gids.get())
+                     << " glyphs, harfbuzz closure has "
+                     << hb_set_get_population(gids.get()) << ".";
+      }
+    }
+
+    hb_set_unique_ptr cached_gids = make_hb_set();
+    hb_set_union(cached_gids.get(), gids.get());
+    MutexLock lock(&shard.mutex);
+    shard.cache.insert(std::pair(HbSetKey(key_set), std::move(cached_gids)));
+
+    return gids;
+  }
 
+  // Computes a glyph closure by planning a harfbuzz subset.
+  StatusOr<hb_set_unique_ptr> HarfbuzzClosure(const hb_set_t* codepoints,
+                                              const hb_set_t* features) {
     hb_subset_input_t* input = hb_subset_input_create_or_fail();
     if (!input) {
       return absl::InternalError("Closure subset configuration failed.");
     }
 
     hb_set_union(hb_subset_input_unicode_set(input), codepoints);
-    // TODO(garretrieger): configure features (and other settings) appropriately
-    // based on the IFT default feature list.
+    // Optional features are added on top of harfbuzz's default layout
+    // features.
+    // TODO(garretrieger): configure the defaults (and other settings)
+    // appropriately based on the IFT default feature list.
+    hb_set_union(hb_subset_input_set(input, HB_SUBSET_SETS_LAYOUT_FEATURE_TAG),
+                 features);
 
     hb_subset_plan_t* plan =
         hb_subset_plan_create_or_fail(preprocessed_face.get(), input);
@@ -160,11 +468,6 @@ class SegmentationContext {
     hb_set_unique_ptr gids = make_hb_set();
     hb_map_values(new_to_old, gids.get());
     hb_subset_plan_destroy(plan);
-
-    hb_set_unique_ptr cached_gids = make_hb_set();
-    hb_set_union(cached_gids.get(), gids.get());
-    glyph_closure_cache.insert(std::pair(cache_key, std::move(cached_gids)));
-
     return gids;
   }
 
@@ -174,6 +477,30 @@ class SegmentationContext {
     closure_count_delta = 0;
   }
 
+  /*
+   * Estimates the size of a patch containing gids, accumulating the time spent
+   * doing so.
+   */
+  StatusOr<uint32_t> PatchSizeBytes(const btree_set<glyph_id_t>& gids) {
+    absl::Time start = absl::Now();
+    auto size = patch_size_estimator->EstimatePatchSize(gids);
+    patch_size_time += absl::Now() - start;
+    return size;
+  }
+
+  void FillStats(SegmentationStats& stats) const {
+    stats.patch_size_seconds = absl::ToDoubleSeconds(patch_size_time);
+    stats.closure_count = closure_count_cumulative;
+    stats.glyph_closure_cache_hits = glyph_closure_cache_hit;
+    stats.glyph_closure_cache_misses = glyph_closure_cache_miss;
+    stats.or_gids_cache_hits = code_point_set_to_or_gids_cache_hit;
+    stats.or_gids_cache_misses = code_point_set_to_or_gids_cache_miss;
+    if (patch_size_estimator) {
+      stats.patch_size_cache_hits = patch_size_estimator->CacheHits();
+      stats.patch_size_cache_misses = patch_size_estimator->CacheMisses();
+    }
+  }
+
   void LogCacheStats() {
     double hit_rate = 100.0 * ((double)code_point_set_to_or_gids_cache_hit) /
                       ((double)(code_point_set_to_or_gids_cache_hit +
@@ -188,12 +515,42 @@ class SegmentationContext {
     VLOG(0) << "Glyph closure cache hit rate: " << closure_hit_rate << "% ("
             << glyph_closure_cache_hit << " hits, " << glyph_closure_cache_miss
             << " misses)";
+
+    if (patch_size_estimator) {
+      uint32_t hits = patch_size_estimator->CacheHits();
+      uint32_t misses = patch_size_estimator->CacheMisses();
+      double patch_size_hit_rate =
+          100.0 * ((double)hits) / ((double)(hits + misses));
+      VLOG(0) << "Patch size cache hit rate: " << patch_size_hit_rate << "% ("
+              << hits << " hits, " << misses << " misses)";
+    }
   }
 
-  StatusOr<const hb_set_t*> CodepointsToOrGids(const hb_set_t* codepoints) {
-    auto hash_set_codepoints = common::to_hash_set(codepoints);
+  bool HasCodepointProbabilities() const {
+    return !cost.codepoint_probabilities.empty();
+  }
+
+  /*
+   * Probability that at least one codepoint of segment s is needed, assuming
+   * codepoints occur independently.
+   */
+  double SegmentProbability(segment_index_t s) const {
+    double none = 1.0;
+    hb_codepoint_t cp = HB_SET_VALUE_INVALID;
+    while (hb_set_next(segments[s].get(), &cp)) {
+      auto it = cost.codepoint_probabilities.find(cp);
+      if (it != cost.codepoint_probabilities.end()) {
+        none *= 1.0 - std::clamp(it->second, 0.0, 1.0);
+      }
+    }
+    return 1.0 - none;
+  }
 
-    auto it = code_point_set_to_or_gids_cache.find(hash_set_codepoints);
+  StatusOr<const hb_set_t*> CodepointsToOrGids(const hb_set_t* codepoints,
+                                               const hb_set_t* features) {
+    hb_set_unique_ptr combined = CacheKeySet(codepoints, features);
+    const hb_set_t* key_set = combined ? combined.get() : codepoints;
+    auto it = code_point_set_to_or_gids_cache.find(HbSetRef(key_set));
     if (it != code_point_set_to_or_gids_cache.end()) {
       code_point_set_to_or_gids_cache_hit++;
       return it->second.get();
@@ -203,55 +560,294 @@ class SegmentationContext {
     hb_set_unique_ptr and_gids = make_hb_set();
     hb_set_unique_ptr or_gids = make_hb_set();
     hb_set_unique_ptr exclusive_gids = make_hb_set();
-    TRYV(AnalyzeSegment(*this, codepoints, and_gids.get(), or_gids.get(),
-                        exclusive_gids.get()));
+    TRYV(AnalyzeSegment(*this, codepoints, features, and_gids.get(),
+                        or_gids.get(), exclusive_gids.get()));
 
     const hb_set_t* or_gids_ptr = or_gids.get();
     code_point_set_to_or_gids_cache.insert(
-        std::pair(hash_set_codepoints, std::move(or_gids)));
+        std::pair(HbSetKey(key_set), std::move(or_gids)));
     return or_gids_ptr;
   }
 
+  /*
+   * Serializes the state needed to resume segmentation: the segments, the
+   * conditions of each glyph and the closure caches. The groupings are not
+   * saved, they are re-formed on resume.
+   */
+  std::string SerializeCheckpoint(segment_index_t last_merged_segment_index) {
+    std::string out = kCheckpointMagic;
+    FontHelper::WriteUInt32(gid_conditions.size(), out);
+    FontHelper::WriteUInt32(segments.size(), out);
+    FontHelper::WriteUInt32(last_merged_segment_index, out);
+    WriteSet(all_codepoints.get(), out);
+    WriteSet(all_features.get(), out);
+
+    for (segment_index_t s = 0; s < segments.size(); s++) {
+      WriteSet(segments[s].get(), out);
+      WriteSet(segment_features[s].get(), out);
+    }
+    hb_set_unique_ptr scratch = make_hb_set();
+    for (const auto& condition : gid_conditions) {
+      GlyphConditions::Write(condition.and_segments, scratch.get(), out);
+      GlyphConditions::Write(condition.or_segments, scratch.get(), out);
+    }
+
+    uint32_t closure_cache_entries = 0;
+    std::string closure_cache;
+    for (auto& shard : glyph_closure_cache) {
+      MutexLock lock(&shard.mutex);
+      closure_cache_entries += shard.cache.size();
+      WriteCacheEntries(shard.cache, closure_cache);
+    }
+    FontHelper::WriteUInt32(closure_cache_entries, out);
+    out.append(closure_cache);
+
+    FontHelper::WriteUInt32(code_point_set_to_or_gids_cache.size(), out);
+    WriteCacheEntries(code_point_set_to_or_gids_cache, out);
+    return out;
+  }
+
+  /*
+   * Restores state saved by SerializeCheckpoint(). This context must have been
+   * created from the same inputs as the one that produced the checkpoint.
+   * Returns the last merged segment index.
+   */
+  StatusOr<segment_index_t> RestoreCheckpoint(string_view in) {
+    if (!absl::StartsWith(in, kCheckpointMagic)) {
+      return absl::InvalidArgumentError("Not a segmentation checkpoint.");
+    }
+    in.remove_prefix(sizeof(kCheckpointMagic) - 1);
+
+    uint32_t glyph_count = TRY(ReadUInt32(in));
+    uint32_t segment_count = TRY(ReadUInt32(in));
+    segment_index_t last_merged_segment_index = TRY(ReadUInt32(in));
+    hb_set_unique_ptr checkpoint_codepoints = make_hb_set();
+    TRYV(ReadSet(in, checkpoint_codepoints.get()));
+    hb_set_unique_ptr checkpoint_features = make_hb_set();
+    TRYV(ReadSet(in, checkpoint_features.get()));
+    if (glyph_count != gid_conditions.size() ||
+        segment_count != segments.size() ||
+        !hb_set_is_equal(checkpoint_codepoints.get(), all_codepoints.get()) ||
+        !hb_set_is_equal(checkpoint_features.get(), all_features.get())) {
+      return absl::FailedPreconditionError(
+          "Checkpoint was produced from a different font or set of segments.");
+    }
+
+    for (segment_index_t s = 0; s < segments.size(); s++) {
+      hb_set_clear(segments[s].get());
+      hb_set_clear(segment_features[s].get());
+      TRYV(ReadSet(in, segments[s].get()));
+      TRYV(ReadSet(in, segment_features[s].get()));
+    }
+    hb_set_unique_ptr scratch = make_hb_set();
+    for (auto& glyph_set : segment_glyphs) {
+      hb_set_clear(glyph_set.get());
+    }
+    for (glyph_id_t gid = 0; gid < gid_conditions.size(); gid++) {
+      auto& condition = gid_conditions[gid];
+      TRYV(GlyphConditions::Read(in, scratch.get(), condition.and_segments));
+      TRYV(GlyphConditions::Read(in, scratch.get(), condition.or_segments));
+      for (const auto* list :
+           {&condition.and_segments, &condition.or_segments}) {
+        for (segment_index_t s : *list) {
+          if (s >= segment_glyphs.size()) {
+            return absl::InvalidArgumentError(
+                "Checkpoint references an unknown segment.");
+          }
+          hb_set_add(segment_glyphs[s].get(), gid);
+        }
+      }
+    }
+
+    TRYV(ReadCache(in, [this](HbSetKey key, hb_set_unique_ptr value) {
+      auto& shard = ClosureShardFor(key.Hash());
+      MutexLock lock(&shard.mutex);
+      shard.cache.insert(std::pair(std::move(key), std::move(value)));
+    }));
+    TRYV(ReadCache(in, [this](HbSetKey key, hb_set_unique_ptr value) {
+      code_point_set_to_or_gids_cache.insert(
+          std::pair(std::move(key), std::move(value)));
+    }));
+
+    return last_merged_segment_index;
+  }
+
+  // Identifies the font and how closures were computed for persisted closure
+  // caches.
+  uint64_t ClosureCacheChecksum() {
+    uint64_t checksum = FontChecksum(original_face.get());
+    if (closure_graph.has_value() && closure_mode == ClosureMode::kGraph) {
+      // Graph closures may differ from harfbuzz's.
+      checksum++;
+    }
+    return checksum;
+  }
+
+  /*
+   * Serializes the glyph closure cache, tagged with the checksum of the
+   * original font so it's only reused for the same font.
+   */
+  std::string SerializeClosureCache() {
+    std::string out = kClosureCacheMagic;
+    uint64_t checksum = ClosureCacheChecksum();
+    FontHelper::WriteUInt32(checksum >> 32, out);
+    FontHelper::WriteUInt32(checksum & 0xFFFFFFFF, out);
+
+    uint32_t entries = 0;
+    std::string cache;
+    for (auto& shard : glyph_closure_cache) {
+      MutexLock lock(&shard.mutex);
+      entries += shard.cache.size();
+      WriteCacheEntries(shard.cache, cache);
+    }
+    FontHelper::WriteUInt32(entries, out);
+    out.append(cache);
+    return out;
+  }
+
+  /*
+   * Adds the entries of a closure cache saved by SerializeClosureCache() to
+   * the glyph closure cache. Fails without changing the cache if it was
+   * produced from a different font.
+   */
+  StatusOr<uint32_t> RestoreClosureCache(string_view in) {
+    if (!absl::StartsWith(in, kClosureCacheMagic)) {
+      return absl::InvalidArgumentError("Not a closure cache.");
+    }
+    in.remove_prefix(sizeof(kClosureCacheMagic) - 1);
+
+    uint64_t checksum = TRY(ReadUInt32(in));
+    checksum = (checksum << 32) | TRY(ReadUInt32(in));
+    if (checksum != ClosureCacheChecksum()) {
+      return absl::FailedPreconditionError(
+          "Closure cache was produced from a different font or closure mode.");
+    }
+
+    // Decode everything before inserting so a truncated file has no effect.
+    std::vector<std::pair<HbSetKey, hb_set_unique_ptr>> entries;
+    TRYV(ReadCache(in, [&](HbSetKey key, hb_set_unique_ptr value) {
+      entries.emplace_back(std::move(key), std::move(value));
+    }));
+    for (auto& [key, value] : entries) {
+      auto& shard = ClosureShardFor(key.Hash());
+      MutexLock lock(&shard.mutex);
+      shard.cache.insert(std::pair(std::move(key), std::move(value)));
+    }
+    return entries.size();
+  }
+
+  ClosureMode closure_mode;
+  // Present when closures are computed or validated with the graph and the
+  // font is supported by it.
+  std::optional<GlyphClosureGraph> closure_graph;
+
   // Init
   common::hb_face_unique_ptr preprocessed_face;
   common::hb_face_unique_ptr original_face;
   std::vector<hb_set_unique_ptr> segments;
+  // Optional layout features which activate each segment, indexed the same as
+  // segments.
+  std::vector<hb_set_unique_ptr> segment_features;
 
   hb_set_unique_ptr initial_codepoints;
   hb_set_unique_ptr all_codepoints;
+  hb_set_unique_ptr all_features;
   hb_set_unique_ptr full_closure;
   hb_set_unique_ptr initial_closure;
 
   uint32_t patch_size_min_bytes = 0;
   uint32_t patch_size_max_bytes = UINT32_MAX;
+  std::unique_ptr<CachingPatchSizeEstimator> patch_size_estimator;
+  SegmentationCostConfig cost;
+  // Optional, see GlyphSegmentation::CodepointToGlyphSegments().
+  Progress* progress = nullptr;
+
+  Status CheckProgress() const {
+    return progress ? progress->Check() : absl::OkStatus();
+  }
+
+  void RecordProgress(Progress::Counter counter) const {
+    if (progress) {
+      progress->Add(counter);
+    }
+  }
 
   // Phase 1
   std::vector<GlyphConditions> gid_conditions;
+  // Inverted index of gid_conditions: the glyphs whose conditions reference
+  // each segment.
+  std::vector<hb_set_unique_ptr> segment_glyphs;
 
   // Phase 2
+  hb_set_unique_ptr glyphs_to_regroup;
   btree_set<glyph_id_t> unmapped_glyphs;
   btree_map<btree_set<segment_index_t>, btree_set<glyph_id_t>> and_glyph_groups;
   btree_map<btree_set<segment_index_t>, btree_set<glyph_id_t>> or_glyph_groups;
   btree_set<segment_index_t> fallback_segments;
 
   // Caches and logging
-  flat_hash_map<flat_hash_set<uint32_t>, hb_set_unique_ptr> glyph_closure_cache;
-  uint32_t glyph_closure_cache_hit = 0;
-  uint32_t glyph_closure_cache_miss = 0;
 
-  flat_hash_map<flat_hash_set<uint32_t>, hb_set_unique_ptr>
-      code_point_set_to_or_gids_cache;
+  // The closure cache is split into independently locked shards to reduce
+  // contention when closures are computed in parallel.
+  static constexpr uint32_t kClosureCacheShards = 16;
+  struct ClosureCacheShard {
+    absl::Mutex mutex;
+    HbSetKeyMap<hb_set_unique_ptr> cache ABSL_GUARDED_BY(mutex);
+  };
+  ClosureCacheShard glyph_closure_cache[kClosureCacheShards];
+
+  ClosureCacheShard& ClosureShardFor(size_t hash) {
+    // The low bits of the hash are used by the hash map, so select the shard
+    // with the high bits.
+    return glyph_closure_cache[(hash >> 48) % kClosureCacheShards];
+  }
+  std::atomic<uint32_t> glyph_closure_cache_hit = 0;
+  std::atomic<uint32_t> glyph_closure_cache_miss = 0;
+
+  HbSetKeyMap<hb_set_unique_ptr> code_point_set_to_or_gids_cache;
   uint32_t code_point_set_to_or_gids_cache_hit = 0;
   uint32_t code_point_set_to_or_gids_cache_miss = 0;
 
-  uint32_t closure_count_cumulative = 0;
-  uint32_t closure_count_delta = 0;
+  std::atomic<uint32_t> closure_count_cumulative = 0;
+  std::atomic<uint32_t> closure_count_delta = 0;
+  absl::Duration patch_size_time;
+
+ private:
+  /*
+   * Closures depend on both codepoints and features. Layout feature tags are
+   * always larger than the maximum unicode codepoint so both can be stored in
+   * a single set to form a cache key. Returns nullptr if there are no features,
+   * in which case the codepoints set can be used as the key directly.
+   */
+  static hb_set_unique_ptr CacheKeySet(const hb_set_t* codepoints,
+                                       const hb_set_t* features) {
+    if (hb_set_is_empty(features)) {
+      return hb_set_unique_ptr(nullptr, &hb_set_destroy);
+    }
+    hb_set_unique_ptr combined = make_hb_set();
+    hb_set_union(combined.get(), codepoints);
+    hb_set_union(combined.get(), features);
+    return combined;
+  }
+
+  static void RemoveFromGroup(
+      btree_map<btree_set<segment_index_t>, btree_set<glyph_id_t>>& groups,
+      const btree_set<segment_index_t>& key, glyph_id_t gid) {
+    auto it = groups.find(key);
+    if (it == groups.end()) {
+      return;
+    }
+    it->second.erase(gid);
+    if (it->second.empty()) {
+      groups.erase(it);
+    }
+  }
 };
 
 Status AnalyzeSegment(SegmentationContext& context, const hb_set_t* codepoints,
-                      hb_set_t* and_gids, hb_set_t* or_gids,
-                      hb_set_t* exclusive_gids) {
-  if (hb_set_is_empty(codepoints)) {
+                      const hb_set_t* features, hb_set_t* and_gids,
+                      hb_set_t* or_gids, hb_set_t* exclusive_gids) {
+  if (hb_set_is_empty(codepoints) && hb_set_is_empty(features)) {
     // Skip empty sets, they will never contribute any conditions.
     return absl::OkStatus();
   }
@@ -280,16 +876,23 @@ Status AnalyzeSegment(SegmentationContext& context, const hb_set_t* codepoints,
   // * I - D: the activation conditions for these glyphs is s_i OR …
   //          Where … is one or more additional segments.
   // * D intersection I: the activation conditions for these glyphs is only s_i
+  //
+  // Segments may also (or instead) consist of optional layout features, these
+  // are added and removed in the same way as the codepoints.
   hb_set_unique_ptr except_segment = make_hb_set();
   hb_set_union(except_segment.get(), context.all_codepoints.get());
   hb_set_subtract(except_segment.get(), codepoints);
-  auto B_except_segment_closure =
-      TRY(context.GlyphClosure(except_segment.get()));
+  hb_set_unique_ptr except_segment_features = make_hb_set();
+  hb_set_union(except_segment_features.get(), context.all_features.get());
+  hb_set_subtract(except_segment_features.get(), features);
+  auto B_except_segment_closure = TRY(context.GlyphClosure(
+      except_segment.get(), except_segment_features.get()));
 
   hb_set_unique_ptr only_segment = make_hb_set();
   hb_set_union(only_segment.get(), context.initial_codepoints.get());
   hb_set_union(only_segment.get(), codepoints);
-  auto I_only_segment_closure = TRY(context.GlyphClosure(only_segment.get()));
+  auto I_only_segment_closure =
+      TRY(context.GlyphClosure(only_segment.get(), features));
   hb_set_subtract(I_only_segment_closure.get(), context.initial_closure.get());
 
   hb_set_unique_ptr D_dropped = make_hb_set();
@@ -308,94 +911,165 @@ Status AnalyzeSegment(SegmentationContext& context, const hb_set_t* codepoints,
   return absl::OkStatus();
 }
 
-Status AnalyzeSegment(SegmentationContext& context,
-                      segment_index_t segment_index,
-                      const hb_set_t* codepoints) {
-  hb_set_unique_ptr and_gids = make_hb_set();
-  hb_set_unique_ptr or_gids = make_hb_set();
-  hb_set_unique_ptr exclusive_gids = make_hb_set();
-  TRYV(AnalyzeSegment(context, codepoints, and_gids.get(), or_gids.get(),
-                      exclusive_gids.get()));
+// The result of analyzing a single segment, see AnalyzeSegment().
+struct SegmentAnalysis {
+  SegmentAnalysis()
+      : and_gids(make_hb_set()),
+        or_gids(make_hb_set()),
+        exclusive_gids(make_hb_set()) {}
+
+  hb_set_unique_ptr and_gids;
+  hb_set_unique_ptr or_gids;
+  hb_set_unique_ptr exclusive_gids;
+};
+
+// Records the conditions found by analyzing segment_index in
+// context.gid_conditions.
+void AddConditions(SegmentationContext& context, segment_index_t segment_index,
+                   const SegmentAnalysis& analysis) {
+  const hb_set_t* exclusive_gids = analysis.exclusive_gids.get();
+  const hb_set_t* and_gids = analysis.and_gids.get();
+  const hb_set_t* or_gids = analysis.or_gids.get();
 
   hb_codepoint_t and_gid = HB_SET_VALUE_INVALID;
-  while (hb_set_next(exclusive_gids.get(), &and_gid)) {
+  while (hb_set_next(exclusive_gids, &and_gid)) {
     // TODO(garretrieger): if we are assigning an exclusive gid there should be
     // no other and segments, check and error if this is violated.
-    hb_set_add(context.gid_conditions[and_gid].and_segments.get(),
-               segment_index);
+    context.AddCondition(and_gid, segment_index, false);
   }
-  while (hb_set_next(and_gids.get(), &and_gid)) {
-    hb_set_add(context.gid_conditions[and_gid].and_segments.get(),
-               segment_index);
+  while (hb_set_next(and_gids, &and_gid)) {
+    context.AddCondition(and_gid, segment_index, false);
   }
 
   hb_codepoint_t or_gid = HB_SET_VALUE_INVALID;
-  while (hb_set_next(or_gids.get(), &or_gid)) {
-    hb_set_add(context.gid_conditions[or_gid].or_segments.get(), segment_index);
+  while (hb_set_next(or_gids, &or_gid)) {
+    context.AddCondition(or_gid, segment_index, true);
+  }
+}
+
+Status AnalyzeSegment(SegmentationContext& context,
+                      segment_index_t segment_index) {
+  SegmentAnalysis analysis;
+  TRYV(AnalyzeSegment(context, context.segments[segment_index].get(),
+                      context.segment_features[segment_index].get(),
+                      analysis.and_gids.get(), analysis.or_gids.get(),
+                      analysis.exclusive_gids.get()));
+  AddConditions(context, segment_index, analysis);
+  return absl::OkStatus();
+}
+
+// Analyzes all segments, spreading the closure computations across pool, or
+// if that's null num_threads new threads. Conditions are recorded in segment
+// order so the result is identical to analyzing each segment sequentially.
+Status AnalyzeAllSegments(SegmentationContext& context, uint32_t num_threads,
+                          ThreadPool* pool) {
+  std::vector<SegmentAnalysis> analyses(context.segments.size());
+  std::vector<Status> results(context.segments.size());
+  {
+    std::optional<ThreadPool> owned_pool;
+    if (!pool) {
+      owned_pool.emplace(num_threads);
+      pool = &*owned_pool;
+    }
+    if (context.progress) {
+      context.progress->Add(Progress::SEGMENTS_TOTAL, context.segments.size());
+    }
+    pool->ParallelFor(context.segments.size(), [&](segment_index_t s) {
+      results[s] = context.CheckProgress();
+      if (!results[s].ok()) {
+        return;
+      }
+      results[s] = AnalyzeSegment(
+          context, context.segments[s].get(), context.segment_features[s].get(),
+          analyses[s].and_gids.get(), analyses[s].or_gids.get(),
+          analyses[s].exclusive_gids.get());
+      context.RecordProgress(Progress::SEGMENTS_ANALYZED);
+    });
   }
 
+  for (segment_index_t s = 0; s < context.segments.size(); s++) {
+    TRYV(results[s]);
+    AddConditions(context, s, analyses[s]);
+  }
   return absl::OkStatus();
 }
 
+/*
+ * Updates the glyph groups for all glyphs which have been invalidated (see
+ * SegmentationContext::InvalidateGlyph()) since the last call. Glyphs whose
+ * conditions are unchanged keep their existing grouping.
+ */
 Status GroupGlyphs(SegmentationContext& context) {
   btree_set<segment_index_t> fallback_segments_set;
   for (segment_index_t s = 0; s < context.segments.size(); s++) {
-    if (hb_set_is_empty(context.segments[s].get())) {
+    if (context.IsSegmentEmpty(s)) {
       // Ignore empty segments.
       continue;
     }
     fallback_segments_set.insert(s);
   }
 
-  for (glyph_id_t gid = 0; gid < context.gid_conditions.size(); gid++) {
+  btree_map<btree_set<segment_index_t>, std::vector<glyph_id_t>>
+      added_or_glyphs;
+  glyph_id_t gid = HB_SET_VALUE_INVALID;
+  while (hb_set_next(context.glyphs_to_regroup.get(), &gid)) {
     const auto& condition = context.gid_conditions[gid];
-    if (!hb_set_is_empty(condition.and_segments.get())) {
-      auto set = to_btree_set(condition.and_segments.get());
+    if (!condition.and_segments.empty()) {
+      auto set = GlyphConditions::ToSet(condition.and_segments);
       context.and_glyph_groups[set].insert(gid);
     }
-    if (!hb_set_is_empty(condition.or_segments.get())) {
-      auto set = to_btree_set(condition.or_segments.get());
+    if (!condition.or_segments.empty()) {
+      auto set = GlyphConditions::ToSet(condition.or_segments);
       context.or_glyph_groups[set].insert(gid);
+      added_or_glyphs[set].push_back(gid);
     }
 
-    if (hb_set_is_empty(condition.and_segments.get()) &&
-        hb_set_is_empty(condition.or_segments.get()) &&
+    if (condition.and_segments.empty() && condition.or_segments.empty() &&
         !hb_set_has(context.initial_closure.get(), gid) &&
         hb_set_has(context.full_closure.get(), gid)) {
       context.unmapped_glyphs.insert(gid);
     }
   }
+  hb_set_clear(context.glyphs_to_regroup.get());
 
   // Any of the or_set conditions we've generated may have some additional
   // conditions that were not detected. Therefore we need to rule out the
   // presence of these additional conditions if an or group is able to be used.
-  for (auto& [or_group, glyphs] : context.or_glyph_groups) {
+  //
+  // Only newly added glyphs need to be checked: merges never change the union
+  // of all codepoints, and any glyph in a group which involves a modified
+  // segment will itself have been invalidated and re-added.
+  for (const auto& [or_group, added_gids] : added_or_glyphs) {
     hb_set_unique_ptr all_other_codepoints = make_hb_set();
     hb_set_union(all_other_codepoints.get(), context.all_codepoints.get());
+    hb_set_unique_ptr all_other_features = make_hb_set();
+    hb_set_union(all_other_features.get(), context.all_features.get());
     for (uint32_t s : or_group) {
       hb_set_subtract(all_other_codepoints.get(), context.segments[s].get());
+      hb_set_subtract(all_other_features.get(),
+                      context.segment_features[s].get());
     }
 
-    const hb_set_t* or_gids =
-        TRY(context.CodepointsToOrGids(all_other_codepoints.get()));
+    const hb_set_t* or_gids = TRY(context.CodepointsToOrGids(
+        all_other_codepoints.get(), all_other_features.get()));
 
     // Any "OR" glyphs associated with all other codepoints have some additional
     // conditions to activate so we can't safely include them into this or
     // condition. They are instead moved to the set of unmapped glyphs.
-    uint32_t gid = HB_SET_VALUE_INVALID;
-    while (hb_set_next(or_gids, &gid)) {
-      if (glyphs.erase(gid) > 0) {
-        context.unmapped_glyphs.insert(gid);
+    auto& glyphs = context.or_glyph_groups[or_group];
+    for (glyph_id_t added_gid : added_gids) {
+      if (hb_set_has(or_gids, added_gid) && glyphs.erase(added_gid) > 0) {
+        context.unmapped_glyphs.insert(added_gid);
       }
     }
+    if (glyphs.empty()) {
+      context.or_glyph_groups.erase(or_group);
+    }
   }
 
-  for (uint32_t gid : context.unmapped_glyphs) {
-    // this glyph is not activated anywhere but is needed in the full closure
-    // so add it to an activation condition of any segment.
-    context.or_glyph_groups[fallback_segments_set].insert(gid);
-  }
-
+  // Unmapped glyphs are not activated anywhere but are needed in the full
+  // closure, they will be added to an activation condition of any segment
+  // (see SegmentationContext::AddUnmappedToFallback()).
   context.fallback_segments = std::move(fallback_segments_set);
 
   return absl::OkStatus();
@@ -460,41 +1134,61 @@ Status GlyphSegmentation::GroupsToSegmentation(
   return absl::OkStatus();
 }
 
-StatusOr<uint32_t> PatchSizeBytes(hb_face_t* original_face,
-                                  const absl::btree_set<glyph_id_t>& gids) {
-  FontData font_data(original_face);
-  CompatId id;
-  // Since this is just an estimate and we don't need ultra precise numbers run
-  // at a lower brotli quality to improve performance.
-  GlyphKeyedDiff diff(font_data, id, {FontHelper::kGlyf, FontHelper::kGvar}, 9);
-  auto patch_data = TRY(diff.CreatePatch(gids));
-  return patch_data.size();
+/*
+ * Sets up context.patch_size_estimator. Where possible a cheap estimate based
+ * on raw glyph data sizes is used, with brotli only being run to get an exact
+ * size when the estimate is close to one of the patch size thresholds.
+ */
+Status CreatePatchSizeEstimator(SegmentationContext& context) {
+  hb_face_t* face = context.original_face.get();
+  auto exact = std::make_unique<BrotliPatchSizeEstimator>(face);
+  if (FontHelper::TableData(face, FontHelper::kGlyf).empty()) {
+    // The raw size estimate requires glyf data.
+    context.patch_size_estimator =
+        std::make_unique<CachingPatchSizeEstimator>(std::move(exact));
+    return absl::OkStatus();
+  }
+
+  hb_set_unique_ptr sample = make_hb_set();
+  hb_set_union(sample.get(), context.full_closure.get());
+  hb_set_subtract(sample.get(), context.initial_closure.get());
+  auto fast = TRY(
+      RawSizePatchSizeEstimator::Create(face, to_btree_set(sample.get())));
+
+  context.patch_size_estimator = std::make_unique<CachingPatchSizeEstimator>(
+      std::make_unique<ThresholdPatchSizeEstimator>(
+          std::move(fast), std::move(exact), context.patch_size_min_bytes,
+          context.patch_size_max_bytes));
+  return absl::OkStatus();
 }
 
 void MergeSegments(const SegmentationContext& context, const hb_set_t* segments,
-                   hb_set_t* base) {
+                   hb_set_t* base, hb_set_t* base_features) {
   segment_index_t next = HB_SET_VALUE_INVALID;
   while (hb_set_next(segments, &next)) {
-    const hb_set_t* codepoints = context.segments[next].get();
-    hb_set_union(base, codepoints);
+    hb_set_union(base, context.segments[next].get());
+    hb_set_union(base_features, context.segment_features[next].get());
   }
 }
 
 StatusOr<uint32_t> EstimatePatchSize(SegmentationContext& context,
-                                     const hb_set_t* codepoints) {
+                                     const hb_set_t* codepoints,
+                                     const hb_set_t* features) {
   hb_set_unique_ptr and_gids = make_hb_set();
   hb_set_unique_ptr or_gids = make_hb_set();
   hb_set_unique_ptr exclusive_gids = make_hb_set();
-  TRYV(AnalyzeSegment(context, codepoints, and_gids.get(), or_gids.get(),
-                      exclusive_gids.get()));
+  TRYV(AnalyzeSegment(context, codepoints, features, and_gids.get(),
+                      or_gids.get(), exclusive_gids.get()));
 
   auto btree_gids = to_btree_set(exclusive_gids.get());
-  return PatchSizeBytes(context.original_face.get(), btree_gids);
+  return context.PatchSizeBytes(btree_gids);
 }
 
 StatusOr<bool> TryMerge(SegmentationContext& context,
                         segment_index_t base_segment_index,
                         const hb_set_t* segments) {
+  TraceSpan span("TryMerge");
+  context.RecordProgress(Progress::MERGES_ATTEMPTED);
   // Create a merged segment, and remove all of the others
   hb_set_unique_ptr to_merge_segments = make_hb_set(hb_set_copy(segments));
   hb_set_del(to_merge_segments.get(), base_segment_index);
@@ -504,16 +1198,22 @@ StatusOr<bool> TryMerge(SegmentationContext& context,
   hb_set_unique_ptr merged_codepoints = make_hb_set();
   hb_set_union(merged_codepoints.get(),
                context.segments[base_segment_index].get());
-  MergeSegments(context, to_merge_segments.get(), merged_codepoints.get());
-
-  uint32_t new_patch_size =
-      TRY(EstimatePatchSize(context, merged_codepoints.get()));
+  hb_set_unique_ptr merged_features = make_hb_set();
+  hb_set_union(merged_features.get(),
+               context.segment_features[base_segment_index].get());
+  MergeSegments(context, to_merge_segments.get(), merged_codepoints.get(),
+                merged_features.get());
+
+  uint32_t new_patch_size = TRY(EstimatePatchSize(
+      context, merged_codepoints.get(), merged_features.get()));
   if (new_patch_size > context.patch_size_max_bytes) {
     return false;
   }
 
   hb_set_union(context.segments[base_segment_index].get(),
                merged_codepoints.get());
+  hb_set_union(context.segment_features[base_segment_index].get(),
+               merged_features.get());
   uint32_t size_after =
       hb_set_get_population(context.segments[base_segment_index].get());
 
@@ -526,61 +1226,257 @@ StatusOr<bool> TryMerge(SegmentationContext& context,
     // To avoid changing the indices of other segments set the ones we're
     // removing to empty sets. That effectively disables them.
     hb_set_clear(context.segments[segment_index].get());
+    hb_set_clear(context.segment_features[segment_index].get());
   }
 
   // Remove all segments we touched here from gid_conditions so they can be
-  // recalculated.
+  // recalculated. Glyphs which reference those segments will need to be
+  // regrouped.
   hb_set_add(to_merge_segments.get(), base_segment_index);
-  for (auto& condition : context.gid_conditions) {
-    condition.RemoveSegments(to_merge_segments.get());
-  }
+  context.RemoveConditions(to_merge_segments.get());
 
   return true;
 }
 
 /*
- * Search for a composite condition which can be merged into base_segment_index.
+ * Graph of which segments interact with each other via composite (multi
+ * segment) conditions. Used to rank potential merges by how many composite
+ * conditions, and therefore patches, they would eliminate.
+ */
+class SegmentInteractions {
+ public:
+  explicit SegmentInteractions(
+      const GlyphSegmentation& candidate_segmentation) {
+    for (const auto& condition : candidate_segmentation.Conditions()) {
+      if (condition.IsExclusive() || condition.IsFallback()) {
+        continue;
+      }
+
+      uint32_t index = composite_triggers_.size();
+      composite_triggers_.push_back(make_hb_set());
+      hb_set_t* triggers = composite_triggers_.back().get();
+      condition.TriggeringSegments(triggers);
+
+      segment_index_t s = HB_SET_VALUE_INVALID;
+      while (hb_set_next(triggers, &s)) {
+        composites_by_segment_[s].push_back(index);
+      }
+    }
+  }
+
+  /*
+   * Returns the number of composite conditions which would collapse into a
+   * single segment if all of merged_segments were merged together.
+   */
+  uint32_t CompositesEliminated(const hb_set_t* merged_segments) const {
+    btree_set<uint32_t> checked;
+    uint32_t count = 0;
+    segment_index_t s = HB_SET_VALUE_INVALID;
+    while (hb_set_next(merged_segments, &s)) {
+      auto it = composites_by_segment_.find(s);
+      if (it == composites_by_segment_.end()) {
+        continue;
+      }
+      for (uint32_t index : it->second) {
+        if (!checked.insert(index).second) {
+          continue;
+        }
+        if (hb_set_is_subset(composite_triggers_[index].get(),
+                             merged_segments)) {
+          count++;
+        }
+      }
+    }
+    return count;
+  }
+
+ private:
+  std::vector<hb_set_unique_ptr> composite_triggers_;
+  flat_hash_map<segment_index_t, std::vector<uint32_t>> composites_by_segment_;
+};
+
+/*
+ * Models the expected number of bytes transferred per page view for the
+ * exclusive patches of a candidate segmentation. The patch for segment s costs
+ * P(s) * (patch size + request overhead) where P(s) is the probability that
+ * the segment is needed.
+ */
+class ExpectedCostModel {
+ public:
+  static StatusOr<ExpectedCostModel> Create(
+      SegmentationContext& context,
+      const GlyphSegmentation& candidate_segmentation) {
+    ExpectedCostModel model;
+    model.request_overhead_bytes_ = context.cost.request_overhead_bytes;
+    for (const auto& condition : candidate_segmentation.Conditions()) {
+      if (!condition.IsExclusive()) {
+        continue;
+      }
+      segment_index_t s = *condition.conditions().begin()->begin();
+      auto gids = candidate_segmentation.GidSegments().find(
+          condition.activated());
+      if (gids == candidate_segmentation.GidSegments().end()) {
+        return absl::InternalError(
+            StrCat("patch ", condition.activated(), " not found."));
+      }
+      model.segments_[s] = SegmentCost{
+          .probability = context.SegmentProbability(s),
+          .patch_size = TRY(context.PatchSizeBytes(gids->second)),
+      };
+    }
+    return model;
+  }
+
+  /*
+   * Change in expected cost from merging merged_segments into one segment.
+   * Negative values are an improvement. The merged patch size is approximated
+   * by the sum of the exclusive patch sizes.
+   */
+  double MergeCostDelta(const hb_set_t* merged_segments) const {
+    double before = 0.0;
+    double none = 1.0;
+    uint64_t merged_size = 0;
+    segment_index_t s = HB_SET_VALUE_INVALID;
+    while (hb_set_next(merged_segments, &s)) {
+      auto it = segments_.find(s);
+      if (it == segments_.end()) {
+        continue;
+      }
+      const SegmentCost& cost = it->second;
+      before += Cost(cost.probability, cost.patch_size);
+      none *= 1.0 - cost.probability;
+      merged_size += cost.patch_size;
+    }
+    return Cost(1.0 - none, merged_size) - before;
+  }
+
+ private:
+  struct SegmentCost {
+    double probability;
+    uint32_t patch_size;
+  };
+
+  double Cost(double probability, uint64_t patch_size) const {
+    return probability * (double)(patch_size + request_overhead_bytes_);
+  }
+
+  flat_hash_map<segment_index_t, SegmentCost> segments_;
+  uint32_t request_overhead_bytes_ = 0;
+};
+
+struct MergeCandidate {
+  MergeCandidate() : segments(make_hb_set()) {}
+
+  hb_set_unique_ptr segments;
+  std::string description;
+  uint32_t composites_eliminated = 0;
+  double cost_delta = 0.0;
+};
+
+/*
+ * Collects the conditions after condition_it which match 'filter' as merge
+ * candidates for base_segment_index. Candidates are ordered so that the ones
+ * which eliminate the most composite conditions come first, ties keep the
+ * original condition order.
  *
- * Returns true if one was found and the merge succeeded, false otherwise.
+ * If cost_model is set candidates are instead ordered by the change in
+ * expected cost, lowest first, with composite elimination breaking ties.
  */
-template <typename ConditionIt>
-StatusOr<bool> TryMergingACompositeCondition(
-    SegmentationContext& context,
+template <typename ConditionIt, typename Filter>
+std::vector<MergeCandidate> RankMergeCandidates(
     const GlyphSegmentation& candidate_segmentation,
-    segment_index_t base_segment_index,
-    patch_id_t base_patch,  // TODO XXX is base_patch needed?
-    const ConditionIt& condition_it) {
+    const SegmentInteractions& interactions,
+    const ExpectedCostModel* cost_model, segment_index_t base_segment_index,
+    const ConditionIt& condition_it, Filter filter) {
+  std::vector<MergeCandidate> candidates;
   auto next_condition = condition_it;
   next_condition++;
-  while (next_condition != candidate_segmentation.Conditions().end()) {
-    if (next_condition->IsFallback()) {
-      // Merging the fallback will cause all segments to be merged into one,
-      // which is undesirable so don't consider the fallback.
-      next_condition++;
+  for (; next_condition != candidate_segmentation.Conditions().end();
+       next_condition++) {
+    if (!filter(*next_condition)) {
       continue;
     }
 
-    hb_set_unique_ptr triggering_segments = make_hb_set();
-    next_condition->TriggeringSegments(triggering_segments.get());
-    if (!hb_set_has(triggering_segments.get(), base_segment_index)) {
-      next_condition++;
-      continue;
+    MergeCandidate candidate;
+    next_condition->TriggeringSegments(candidate.segments.get());
+    candidate.description = next_condition->ToString();
+
+    hb_set_unique_ptr merged = make_hb_set();
+    hb_set_union(merged.get(), candidate.segments.get());
+    hb_set_add(merged.get(), base_segment_index);
+    candidate.composites_eliminated =
+        interactions.CompositesEliminated(merged.get());
+    if (cost_model) {
+      candidate.cost_delta = cost_model->MergeCostDelta(merged.get());
     }
 
-    if (!TRY(
-            TryMerge(context, base_segment_index, triggering_segments.get()))) {
-      next_condition++;
+    candidates.push_back(std::move(candidate));
+  }
+
+  std::stable_sort(candidates.begin(), candidates.end(),
+                   [&](const MergeCandidate& a, const MergeCandidate& b) {
+                     if (cost_model && a.cost_delta != b.cost_delta) {
+                       return a.cost_delta < b.cost_delta;
+                     }
+                     return a.composites_eliminated > b.composites_eliminated;
+                   });
+  return candidates;
+}
+
+/*
+ * Try merging each of the candidates, in order, into base_segment_index until
+ * one succeeds.
+ *
+ * Returns true if a merge succeeded, false otherwise.
+ */
+StatusOr<bool> TryMergingACandidate(
+    SegmentationContext& context, segment_index_t base_segment_index,
+    const std::vector<MergeCandidate>& candidates, absl::string_view kind) {
+  for (const auto& candidate : candidates) {
+    if (!TRY(TryMerge(context, base_segment_index, candidate.segments.get()))) {
       continue;
     }
 
-    VLOG(0) << "  Merging segments from composite patch into segment "
-            << base_segment_index << ": " << next_condition->ToString();
+    VLOG(0) << "  Merging segments from " << kind << " patch into segment "
+            << base_segment_index << ": " << candidate.description
+            << " (eliminates " << candidate.composites_eliminated
+            << " composite conditions, expected cost change "
+            << candidate.cost_delta << " bytes)";
     return true;
   }
 
   return false;
 }
 
+/*
+ * Search for a composite condition which can be merged into base_segment_index.
+ *
+ * Returns true if one was found and the merge succeeded, false otherwise.
+ */
+template <typename ConditionIt>
+StatusOr<bool> TryMergingACompositeCondition(
+    SegmentationContext& context,
+    const GlyphSegmentation& candidate_segmentation,
+    const SegmentInteractions& interactions,
+    const ExpectedCostModel* cost_model, segment_index_t base_segment_index,
+    const ConditionIt& condition_it) {
+  auto candidates = RankMergeCandidates(
+      candidate_segmentation, interactions, cost_model, base_segment_index,
+      condition_it,
+      [&](const GlyphSegmentation::ActivationCondition& condition) {
+        if (condition.IsFallback()) {
+          // Merging the fallback will cause all segments to be merged into
+          // one, which is undesirable so don't consider the fallback.
+          return false;
+        }
+        hb_set_unique_ptr triggering_segments = make_hb_set();
+        condition.TriggeringSegments(triggering_segments.get());
+        return (bool)hb_set_has(triggering_segments.get(), base_segment_index);
+      });
+  return TryMergingACandidate(context, base_segment_index, candidates,
+                              "composite");
+}
+
 /*
  * Search for a base segment after base_segment_index which can be merged into
  * base_segment_index without exceeding the maximum patch size.
@@ -591,31 +1487,17 @@ template <typename ConditionIt>
 StatusOr<bool> TryMergingABaseSegment(
     SegmentationContext& context,
     const GlyphSegmentation& candidate_segmentation,
-    segment_index_t base_segment_index, const ConditionIt& condition_it) {
-  auto next_condition = condition_it;
-  next_condition++;
-  while (next_condition != candidate_segmentation.Conditions().end()) {
-    if (!next_condition->IsExclusive()) {
-      // Only interested in other base patches.
-      next_condition++;
-      continue;
-    }
-
-    hb_set_unique_ptr triggering_segments = make_hb_set();
-    next_condition->TriggeringSegments(triggering_segments.get());
-
-    if (!TRY(
-            TryMerge(context, base_segment_index, triggering_segments.get()))) {
-      next_condition++;
-      continue;
-    }
-
-    VLOG(0) << "  Merging segments from base patch into segment "
-            << base_segment_index << ": " << next_condition->ToString();
-    return true;
-  }
-
-  return false;
+    const SegmentInteractions& interactions,
+    const ExpectedCostModel* cost_model, segment_index_t base_segment_index,
+    const ConditionIt& condition_it) {
+  auto candidates = RankMergeCandidates(
+      candidate_segmentation, interactions, cost_model, base_segment_index,
+      condition_it,
+      [](const GlyphSegmentation::ActivationCondition& condition) {
+        // Only interested in other base patches.
+        return condition.IsExclusive();
+      });
+  return TryMergingACandidate(context, base_segment_index, candidates, "base");
 }
 
 StatusOr<bool> IsPatchTooSmall(SegmentationContext& context,
@@ -627,7 +1509,7 @@ StatusOr<bool> IsPatchTooSmall(SegmentationContext& context,
     return absl::InternalError(StrCat("patch ", base_patch, " not found."));
   }
   uint32_t patch_size_bytes =
-      TRY(PatchSizeBytes(context.original_face.get(), patch_glyphs->second));
+      TRY(context.PatchSizeBytes(patch_glyphs->second));
   if (patch_size_bytes >= context.patch_size_min_bytes) {
     return false;
   }
@@ -651,7 +1533,14 @@ StatusOr<bool> IsPatchTooSmall(SegmentationContext& context,
 StatusOr<std::optional<segment_index_t>> MergeNextBaseSegment(
     SegmentationContext& context,
     const GlyphSegmentation& candidate_segmentation, uint32_t start_segment) {
-  hb_set_unique_ptr triggering_patches = make_hb_set();
+  SegmentInteractions interactions(candidate_segmentation);
+  std::optional<ExpectedCostModel> cost_model;
+  if (context.HasCodepointProbabilities()) {
+    cost_model =
+        TRY(ExpectedCostModel::Create(context, candidate_segmentation));
+  }
+  const ExpectedCostModel* cost_model_ptr =
+      cost_model.has_value() ? &*cost_model : nullptr;
   for (auto condition = candidate_segmentation.Conditions().begin();
        condition != candidate_segmentation.Conditions().end(); condition++) {
     if (!condition->IsExclusive()) {
@@ -671,14 +1560,15 @@ StatusOr<std::optional<segment_index_t>> MergeNextBaseSegment(
       continue;
     }
 
-    if (TRY(TryMergingACompositeCondition(context, candidate_segmentation,
-                                          base_segment_index, base_patch,
-                                          condition))) {
+    if (TRY(TryMergingACompositeCondition(
+            context, candidate_segmentation, interactions, cost_model_ptr,
+            base_segment_index, condition))) {
       // Return to the parent method so it can reanalyze and reform groups
       return base_segment_index;
     }
 
     if (TRY(TryMergingABaseSegment(context, candidate_segmentation,
+                                   interactions, cost_model_ptr,
                                    base_segment_index, condition))) {
       // Return to the parent method so it can reanalyze and reform groups
       return base_segment_index;
@@ -726,68 +1616,329 @@ Status ValidateSegmentation(const SegmentationContext& context,
   return absl::OkStatus();
 }
 
+Status WriteCheckpoint(SegmentationContext& context,
+                       segment_index_t last_merged_segment_index,
+                       const std::string& path) {
+  std::string data = context.SerializeCheckpoint(last_merged_segment_index);
+
+  // Written atomically so a crash mid write doesn't destroy the previous
+  // checkpoint.
+  TRYV(WriteFileAtomically(path, {data}));
+
+  VLOG(0) << "Wrote checkpoint to " << path << " (" << data.size()
+          << " bytes).";
+  return absl::OkStatus();
+}
+
+StatusOr<segment_index_t> ReadCheckpoint(SegmentationContext& context,
+                                         const std::string& path) {
+  std::ifstream input(path, std::ios::in | std::ios::binary);
+  if (!input.is_open()) {
+    return absl::NotFoundError(StrCat("Unable to open checkpoint ", path, "."));
+  }
+  std::stringstream buffer;
+  buffer << input.rdbuf();
+  std::string data = buffer.str();
+
+  VLOG(0) << "Resuming from checkpoint " << path << ".";
+  return context.RestoreCheckpoint(data);
+}
+
+// Loads a closure cache written by WriteClosureCache() into context. A missing
+// file, or one for a different font, is not an error: the cache starts empty
+// and is replaced once segmentation finishes.
+Status ReadClosureCache(SegmentationContext& context, const std::string& path) {
+  std::ifstream input(path, std::ios::in | std::ios::binary);
+  if (!input.is_open()) {
+    VLOG(0) << "No closure cache at " << path << ", starting empty.";
+    return absl::OkStatus();
+  }
+  std::stringstream buffer;
+  buffer << input.rdbuf();
+  std::string data = buffer.str();
+
+  auto loaded = context.RestoreClosureCache(data);
+  if (absl::IsFailedPrecondition(loaded.status())) {
+    VLOG(0) << "Ignoring closure cache at " << path << ": "
+            << loaded.status().message();
+    return absl::OkStatus();
+  }
+  TRYV(loaded.status());
+  VLOG(0) << "Loaded " << *loaded << " glyph closures from " << path << ".";
+  return absl::OkStatus();
+}
+
+Status WriteClosureCache(SegmentationContext& context,
+                         const std::string& path) {
+  std::string data = context.SerializeClosureCache();
+  TRYV(WriteFileAtomically(path, {data}));
+
+  VLOG(0) << "Wrote closure cache to " << path << " (" << data.size()
+          << " bytes).";
+  return absl::OkStatus();
+}
+
+// Returns true if glyph closures are the same for faces a and b, for any input.
+// That holds for fonts which differ only in outlines and metrics (eg. the
+// static weights of a family): the glyph order, cmap, layout and color tables
+// and the components of composite glyphs must match.
+bool SameClosureStructure(hb_face_t* a, hb_face_t* b) {
+  if (hb_face_get_glyph_count(a) != hb_face_get_glyph_count(b)) {
+    return false;
+  }
+
+  for (hb_tag_t tag :
+       {HB_TAG('c', 'm', 'a', 'p'), HB_TAG('G', 'S', 'U', 'B'),
+        HB_TAG('G', 'D', 'E', 'F'), HB_TAG('M', 'A', 'T', 'H'),
+        HB_TAG('C', 'O', 'L', 'R'), FontHelper::kCFF}) {
+    // CFF is included since seac accented glyphs pull in their components.
+    if (FontHelper::TableHash(a, tag) != FontHelper::TableHash(b, tag)) {
+      return false;
+    }
+  }
+
+  GlyphDataIndex a_index(a);
+  GlyphDataIndex b_index(b);
+  if (a_index.Has(FontHelper::kGlyf) != b_index.Has(FontHelper::kGlyf)) {
+    return false;
+  }
+  if (!a_index.Has(FontHelper::kGlyf)) {
+    return true;
+  }
+
+  for (glyph_id_t gid = 0; gid < hb_face_get_glyph_count(a); gid++) {
+    auto a_glyph = a_index.GlyphData(FontHelper::kGlyf, gid);
+    auto b_glyph = b_index.GlyphData(FontHelper::kGlyf, gid);
+    if (!a_glyph.ok() || !b_glyph.ok() ||
+        GlyphClosureGraph::CompositeComponents(*a_glyph) !=
+            GlyphClosureGraph::CompositeComponents(*b_glyph)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 StatusOr<GlyphSegmentation> GlyphSegmentation::CodepointToGlyphSegments(
     hb_face_t* face, flat_hash_set<hb_codepoint_t> initial_segment,
     std::vector<flat_hash_set<hb_codepoint_t>> codepoint_segments,
-    uint32_t patch_size_min_bytes, uint32_t patch_size_max_bytes) {
-  SegmentationContext context(face, initial_segment, codepoint_segments);
+    uint32_t patch_size_min_bytes, uint32_t patch_size_max_bytes,
+    const SegmentationOptions& options) {
+  SegmentationContext context(face, initial_segment, codepoint_segments,
+                              options.feature_segments, {},
+                              options.closure_mode);
   context.patch_size_min_bytes = patch_size_min_bytes;
   context.patch_size_max_bytes = patch_size_max_bytes;
+  context.cost = options.cost;
+  context.progress = options.progress;
+  return Segment(context, options.num_threads, options.checkpoint,
+                 options.pool);
+}
+
+StatusOr<std::vector<GlyphSegmentation>>
+GlyphSegmentation::CodepointToGlyphSegmentsForFamily(
+    Span<hb_face_t* const> faces, flat_hash_set<hb_codepoint_t> initial_segment,
+    std::vector<flat_hash_set<hb_codepoint_t>> codepoint_segments,
+    uint32_t patch_size_min_bytes, uint32_t patch_size_max_bytes,
+    const SegmentationOptions& options) {
+  TraceSpan span("GlyphSegmentation::CodepointToGlyphSegmentsForFamily");
+  std::vector<GlyphSegmentation> result;
+  if (faces.empty()) {
+    return result;
+  }
 
-  VLOG(0) << "Forming initial segmentation plan.";
-  segment_index_t segment_index = 0;
-  for (const auto& segment : context.segments) {
-    TRYV(AnalyzeSegment(context, segment_index, segment.get()));
-    segment_index++;
+  result.push_back(TRY(CodepointToGlyphSegments(
+      faces[0], initial_segment, std::move(codepoint_segments),
+      patch_size_min_bytes, patch_size_max_bytes, options)));
+
+  // The merged segments of the first face are used as is for the rest, merged
+  // away segments are left empty so segment indices also match.
+  std::vector<flat_hash_set<hb_codepoint_t>> merged_segments;
+  for (const auto& segment : result[0].Segments()) {
+    merged_segments.emplace_back(segment.begin(), segment.end());
   }
-  context.LogClosureCount("Inital segment analysis");
 
+  for (uint32_t i = 1; i < faces.size(); i++) {
+    if (SameClosureStructure(faces[0], faces[i])) {
+      VLOG(0) << "Face " << i
+              << " has the same closure structure as face 0, reusing its "
+                 "segmentation.";
+      result.push_back(result[0]);
+      continue;
+    }
+
+    VLOG(0) << "Applying the segments of face 0 to face " << i << ".";
+    SegmentationContext context(faces[i], initial_segment, merged_segments, {},
+                                result[0].FeatureSegments(),
+                                options.closure_mode);
+    context.cost = options.cost;
+    context.progress = options.progress;
+    result.push_back(
+        TRY(Segment(context, options.num_threads, {}, options.pool)));
+  }
+  return result;
+}
+
+StatusOr<GlyphSegmentation> GlyphSegmentation::Segment(
+    SegmentationContext& context, uint32_t num_threads,
+    const SegmentationCheckpointConfig& checkpoint, ThreadPool* pool) {
+  SegmentationStats stats;
+  absl::Time start = absl::Now();
   segment_index_t last_merged_segment_index = 0;
+  if (!checkpoint.resume_from.empty()) {
+    last_merged_segment_index =
+        TRY(ReadCheckpoint(context, checkpoint.resume_from));
+  } else {
+    if (!checkpoint.closure_cache_path.empty()) {
+      TRYV(ReadClosureCache(context, checkpoint.closure_cache_path));
+    }
+    VLOG(0) << "Forming initial segmentation plan.";
+    Status sc = AnalyzeAllSegments(context, num_threads, pool);
+    if (!sc.ok() && !checkpoint.closure_cache_path.empty() &&
+        !context.CheckProgress().ok()) {
+      // Keep the closures computed before the cancellation.
+      TRYV(WriteClosureCache(context, checkpoint.closure_cache_path));
+    }
+    TRYV(sc);
+    context.LogClosureCount("Inital segment analysis");
+  }
+
+  if (context.patch_size_min_bytes > 0) {
+    TRYV(CreatePatchSizeEstimator(context));
+  }
+  stats.initial_analysis_seconds = absl::ToDoubleSeconds(absl::Now() - start);
+
+  auto finish = [&](GlyphSegmentation& segmentation) -> Status {
+    context.LogCacheStats();
+    absl::Time validation_start = absl::Now();
+    TRYV(ValidateSegmentation(context, segmentation));
+    stats.validation_seconds =
+        absl::ToDoubleSeconds(absl::Now() - validation_start);
+    context.FillStats(stats);
+    segmentation.stats_ = stats;
+    if (!checkpoint.closure_cache_path.empty()) {
+      TRYV(WriteClosureCache(context, checkpoint.closure_cache_path));
+    }
+    return absl::OkStatus();
+  };
+
+  uint32_t merges_since_checkpoint = 0;
   while (true) {
+    if (Status sc = context.CheckProgress(); !sc.ok()) {
+      // Save the merging done so far so a later run can resume from it.
+      if (!checkpoint.checkpoint_path.empty()) {
+        TRYV(WriteCheckpoint(context, last_merged_segment_index,
+                             checkpoint.checkpoint_path));
+      }
+      if (!checkpoint.closure_cache_path.empty()) {
+        TRYV(WriteClosureCache(context, checkpoint.closure_cache_path));
+      }
+      return sc;
+    }
+
     GlyphSegmentation segmentation;
-    context.ResetGroupings();
+    absl::Time grouping_start = absl::Now();
     TRYV(GroupGlyphs(context));
 
     segmentation.unmapped_glyphs_ = context.unmapped_glyphs;
     segmentation.init_font_glyphs_ =
         to_btree_set(context.initial_closure.get());
-    segmentation.CopySegments(context.segments);
-
-    TRYV(GroupsToSegmentation(context.and_glyph_groups, context.or_glyph_groups,
-                              context.fallback_segments, segmentation));
+    segmentation.CopySegments(context.segments, context.segment_features);
+
+    context.AddUnmappedToFallback();
+    auto sc =
+        GroupsToSegmentation(context.and_glyph_groups, context.or_glyph_groups,
+                             context.fallback_segments, segmentation);
+    context.RemoveUnmappedFromFallback();
+    TRYV(sc);
     context.LogClosureCount("Condition grouping");
+    stats.grouping_seconds +=
+        absl::ToDoubleSeconds(absl::Now() - grouping_start);
 
-    if (patch_size_min_bytes == 0) {
-      context.LogCacheStats();
-      TRYV(ValidateSegmentation(context, segmentation));
+    if (context.patch_size_min_bytes == 0) {
+      TRYV(finish(segmentation));
       return segmentation;
     }
 
+    absl::Time merging_start = absl::Now();
     auto merged = TRY(
         MergeNextBaseSegment(context, segmentation, last_merged_segment_index));
     if (!merged.has_value()) {
       // Nothing was merged so we're done.
-      context.LogCacheStats();
-      TRYV(ValidateSegmentation(context, segmentation));
+      stats.merging_seconds +=
+          absl::ToDoubleSeconds(absl::Now() - merging_start);
+      TRYV(finish(segmentation));
       return segmentation;
     }
 
     last_merged_segment_index = *merged;
     VLOG(0) << "Re-analyzing segment " << last_merged_segment_index
             << " due to merge.";
-    TRYV(AnalyzeSegment(context, last_merged_segment_index,
-                        context.segments[last_merged_segment_index].get()));
+    TRYV(AnalyzeSegment(context, last_merged_segment_index));
+    stats.merging_seconds += absl::ToDoubleSeconds(absl::Now() - merging_start);
+    stats.merge_count++;
+    context.RecordProgress(Progress::MERGES_DONE);
+
+    if (!checkpoint.checkpoint_path.empty() &&
+        ++merges_since_checkpoint >= checkpoint.interval) {
+      TRYV(WriteCheckpoint(context, last_merged_segment_index,
+                           checkpoint.checkpoint_path));
+      merges_since_checkpoint = 0;
+    }
   }
 
   return absl::InternalError("unreachable");
 }
 
+std::string SegmentationStats::ToJson() const {
+  std::vector<std::pair<const char*, std::string>> fields = {
+      {"initial_analysis_seconds", StrCat(initial_analysis_seconds)},
+      {"grouping_seconds", StrCat(grouping_seconds)},
+      {"merging_seconds", StrCat(merging_seconds)},
+      {"validation_seconds", StrCat(validation_seconds)},
+      {"patch_size_seconds", StrCat(patch_size_seconds)},
+      {"closure_count", StrCat(closure_count)},
+      {"merge_count", StrCat(merge_count)},
+      {"glyph_closure_cache_hits", StrCat(glyph_closure_cache_hits)},
+      {"glyph_closure_cache_misses", StrCat(glyph_closure_cache_misses)},
+      {"or_gids_cache_hits", StrCat(or_gids_cache_hits)},
+      {"or_gids_cache_misses", StrCat(or_gids_cache_misses)},
+      {"patch_size_cache_hits", StrCat(patch_size_cache_hits)},
+      {"patch_size_cache_misses", StrCat(patch_size_cache_misses)},
+  };
+
+  std::string out = "{\n";
+  for (uint32_t i = 0; i < fields.size(); i++) {
+    absl::StrAppend(&out, "  \"", fields[i].first, "\": ", fields[i].second,
+                    i + 1 < fields.size() ? ",\n" : "\n");
+  }
+  out += "}\n";
+  return out;
+}
+
 void GlyphSegmentation::CopySegments(
-    const std::vector<hb_set_unique_ptr>& segments) {
+    const std::vector<hb_set_unique_ptr>& segments,
+    const std::vector<hb_set_unique_ptr>& features) {
   segments_.clear();
   for (const auto& set : segments) {
     segments_.push_back(to_btree_set(set.get()));
   }
+  feature_segments_.clear();
+  for (const auto& set : features) {
+    feature_segments_.push_back(to_btree_set(set.get()));
+  }
+}
+
+flat_hash_map<segment_index_t, SubsetDefinition>
+GlyphSegmentation::SegmentDefinitions() const {
+  flat_hash_map<segment_index_t, SubsetDefinition> out;
+  for (segment_index_t s = 0; s < segments_.size(); s++) {
+    SubsetDefinition def = SubsetDefinition::Codepoints(segments_[s]);
+    if (s < feature_segments_.size()) {
+      def.feature_tags = feature_segments_[s];
+    }
+    out[s] = std::move(def);
+  }
+  return out;
 }
 
 GlyphSegmentation::ActivationCondition
@@ -955,9 +2106,18 @@ GlyphSegmentation::ActivationConditionsToConditionEntries(
     Span<const ActivationCondition> conditions,
     const absl::flat_hash_map<segment_index_t,
                               absl::flat_hash_set<hb_codepoint_t>>& segments) {
-  // TODO(garretrieger): extend this to work with segments that are
-  // SubsetDefinition's instead of just codepoints. This would allow for
-  // features and other things to be worked into conditions.
+  flat_hash_map<segment_index_t, SubsetDefinition> definitions;
+  for (const auto& [id, codepoints] : segments) {
+    definitions[id] = SubsetDefinition::Codepoints(codepoints);
+  }
+  return ActivationConditionsToConditionEntries(conditions, definitions);
+}
+
+StatusOr<std::vector<Condition>>
+GlyphSegmentation::ActivationConditionsToConditionEntries(
+    Span<const ActivationCondition> conditions,
+    const flat_hash_map<segment_index_t, SubsetDefinition>& segments) {
+  TraceSpan span("GlyphSegmentation::ActivationConditionsToConditionEntries");
   std::vector<Condition> entries;
   if (conditions.empty()) {
     return entries;
@@ -972,10 +2132,25 @@ GlyphSegmentation::ActivationConditionsToConditionEntries(
   // phases to successively build up a set of common entries which can be reused
   // by later ones.
   //
-  // Tracks the list of conditions which have not yet been placed in a map
-  // entry.
-  btree_set<ActivationCondition> remaining_conditions;
-  remaining_conditions.insert(conditions.begin(), conditions.end());
+  // The conditions are processed in sorted order with duplicates removed.
+  // Pointers are sorted rather than copying the conditions (each holds a vector
+  // of sets) into an ordered set, and conditions which have been placed in a
+  // map entry are marked instead of erased so each phase is a single scan.
+  std::vector<const ActivationCondition*> ordered;
+  ordered.reserve(conditions.size());
+  for (const auto& condition : conditions) {
+    ordered.push_back(&condition);
+  }
+  std::sort(ordered.begin(), ordered.end(),
+            [](const ActivationCondition* a, const ActivationCondition* b) {
+              return *a < *b;
+            });
+  ordered.erase(
+      std::unique(ordered.begin(), ordered.end(),
+                  [](const ActivationCondition* a,
+                     const ActivationCondition* b) { return *a == *b; }),
+      ordered.end());
+  std::vector<bool> placed(ordered.size(), false);
 
   // Phase 1 generate the base entries, there should be one for each
   // unique glyph segment that is referenced in at least one condition.
@@ -984,12 +2159,13 @@ GlyphSegmentation::ActivationConditionsToConditionEntries(
   // Each base entry can be used to map one condition as well.
   flat_hash_map<uint32_t, uint32_t> segment_id_to_entry_index;
   uint32_t next_entry_index = 0;
-  for (auto condition = remaining_conditions.begin();
-       condition != remaining_conditions.end();) {
-    bool remove = false;
+  for (uint32_t i = 0; i < ordered.size(); i++) {
+    const ActivationCondition* condition = ordered[i];
     for (const auto& group : condition->conditions()) {
       for (uint32_t segment_id : group) {
-        if (segment_id_to_entry_index.contains(segment_id)) {
+        auto [it, inserted] =
+            segment_id_to_entry_index.try_emplace(segment_id, next_entry_index);
+        if (!inserted) {
           continue;
         }
 
@@ -998,49 +2174,63 @@ GlyphSegmentation::ActivationConditionsToConditionEntries(
           return absl::InvalidArgumentError(
               StrCat("Codepoint segment ", segment_id, " not found."));
         }
-        const auto& original_def = original->second;
-
         Condition entry;
-        entry.subset_definition.codepoints = original_def;
+        entry.subset_definition = original->second;
 
         if (condition->IsUnitary()) {
           // this condition can use this entry to map itself.
           entry.activated_patch_id = condition->activated();
-          remove = true;
+          placed[i] = true;
         } else {
           // Otherwise this entry does nothing (ignored = true), but will be
           // referenced by later entries, so don't assign an activated id.
           entry.activated_patch_id = std::nullopt;
         }
 
-        entries.push_back(entry);
-        segment_id_to_entry_index[segment_id] = next_entry_index++;
+        entries.push_back(std::move(entry));
+        next_entry_index++;
       }
     }
-
-    if (remove) {
-      condition = remaining_conditions.erase(condition);
-    } else {
-      ++condition;
-    }
   }
 
   // Phase 2 generate entries for all groups of patches reusing the base entries
   // written in phase one. When writing an entry if the triggering group is the
   // only one in the condition then that condition can utilize the entry (just
   // like in Phase 1).
-  flat_hash_map<btree_set<segment_index_t>, uint32_t>
+  //
+  // Groups are keyed by pointer into the conditions, hashed and compared by
+  // value, so they aren't copied.
+  struct GroupHash {
+    size_t operator()(const btree_set<segment_index_t>* group) const {
+      return absl::HashOf(*group);
+    }
+  };
+  struct GroupEq {
+    bool operator()(const btree_set<segment_index_t>* a,
+                    const btree_set<segment_index_t>* b) const {
+      return *a == *b;
+    }
+  };
+  flat_hash_map<const btree_set<segment_index_t>*, uint32_t, GroupHash,
+                GroupEq>
       segment_group_to_entry_index;
-  for (auto condition = remaining_conditions.begin();
-       condition != remaining_conditions.end();) {
-    bool remove = false;
+  for (uint32_t i = 0; i < ordered.size(); i++) {
+    const ActivationCondition* condition = ordered[i];
+    if (placed[i]) {
+      continue;
+    }
 
     for (const auto& group : condition->conditions()) {
-      if (group.size() <= 1 || segment_group_to_entry_index.contains(group)) {
+      if (group.size() <= 1) {
         // don't handle groups of size one, those will just reference the base
         // entry directly.
         continue;
       }
+      auto [it, inserted] =
+          segment_group_to_entry_index.try_emplace(&group, next_entry_index);
+      if (!inserted) {
+        continue;
+      }
 
       Condition entry;
       entry.conjunctive = false;  // ... OR ...
@@ -1057,26 +2247,24 @@ GlyphSegmentation::ActivationConditionsToConditionEntries(
 
       if (condition->conditions().size() == 1) {
         entry.activated_patch_id = condition->activated();
-        remove = true;
+        placed[i] = true;
       } else {
         entry.activated_patch_id = std::nullopt;
       }
 
-      entries.push_back(entry);
-      segment_group_to_entry_index[group] = next_entry_index++;
-    }
-
-    if (remove) {
-      condition = remaining_conditions.erase(condition);
-    } else {
-      ++condition;
+      entries.push_back(std::move(entry));
+      next_entry_index++;
     }
   }
 
   // Phase 3 for any remaining conditions create the actual entries utilizing
   // the groups (phase 2) and base entries (phase 1) as needed
-  for (auto condition = remaining_conditions.begin();
-       condition != remaining_conditions.end(); condition++) {
+  for (uint32_t i = 0; i < ordered.size(); i++) {
+    const ActivationCondition* condition = ordered[i];
+    if (placed[i]) {
+      continue;
+    }
+
     Condition entry;
     entry.conjunctive = true;  // ... AND ...
 
@@ -1087,11 +2275,11 @@ GlyphSegmentation::ActivationConditionsToConditionEntries(
         continue;
       }
 
-      entry.child_conditions.insert(segment_group_to_entry_index[group]);
+      entry.child_conditions.insert(segment_group_to_entry_index[&group]);
     }
 
     entry.activated_patch_id = condition->activated();
-    entries.push_back(entry);
+    entries.push_back(std::move(entry));
   }
 
   return entries;
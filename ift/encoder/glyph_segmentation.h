@@ -2,16 +2,21 @@
 #define IFT_ENCODER_GLYPH_SEGMENTATION_H_
 
 #include <cstdint>
+#include <string>
 #include <vector>
 
 #include "absl/container/btree_map.h"
 #include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/status/statusor.h"
 #include "absl/types/span.h"
 #include "common/hb_set_unique_ptr.h"
+#include "common/thread_pool.h"
 #include "hb.h"
 #include "ift/encoder/condition.h"
+#include "ift/encoder/progress.h"
+#include "ift/encoder/subset_definition.h"
 
 namespace ift::encoder {
 
@@ -19,6 +24,125 @@ typedef uint32_t segment_index_t;
 typedef uint32_t patch_id_t;
 typedef uint32_t glyph_id_t;
 
+class SegmentationContext;
+
+/*
+ * Configures periodic checkpointing of the glyph segmenter state so that long
+ * running segmentations can be resumed.
+ */
+struct SegmentationCheckpointConfig {
+  // If non-empty, the segmenter state is written to this file every
+  // 'interval' merges.
+  std::string checkpoint_path;
+  uint32_t interval = 10;
+
+  // If non-empty, segmentation resumes from the state saved in this file. The
+  // other inputs to the segmenter must be the same as were used to produce the
+  // checkpoint.
+  std::string resume_from;
+
+  // If non-empty, glyph closures computed by a previous run on the same font
+  // are loaded from this file at startup, and all closures are written back
+  // to it once segmentation completes. Ignored if the file doesn't exist or
+  // was produced from a different font.
+  std::string closure_cache_path;
+};
+
+/*
+ * Selects how the segmenter computes glyph closures.
+ */
+enum class ClosureMode {
+  // Plans a harfbuzz subset for each closure. Exact, but every closure does
+  // all of the work of planning a subset.
+  kHarfbuzz,
+  // Queries a GlyphClosureGraph precomputed from the font, which is much
+  // faster but may over-approximate the closure. Falls back to harfbuzz for
+  // fonts the graph doesn't support.
+  kGraph,
+  // Computes closures both ways, logging a warning whenever they differ, and
+  // uses the harfbuzz result. For checking the graph against a font.
+  kGraphValidated,
+};
+
+/*
+ * Optional usage frequency data for the codepoints being segmented. When
+ * provided, merges are chosen to minimize the expected cost per page view
+ * (patch bytes plus a fixed overhead per request) rather than just taking the
+ * first merge which satisfies the patch size bounds.
+ */
+struct SegmentationCostConfig {
+  // Probability (0 to 1) that a page view needs each codepoint. Codepoints
+  // which aren't listed have a probability of 0.
+  absl::flat_hash_map<hb_codepoint_t, double> codepoint_probabilities;
+
+  // Cost in bytes charged for each request, covers headers and round trips.
+  uint32_t request_overhead_bytes = 75;
+};
+
+/*
+ * Optional settings shared by GlyphSegmentation::CodepointToGlyphSegments()
+ * and GlyphSegmentation::CodepointToGlyphSegmentsForFamily().
+ */
+struct SegmentationOptions {
+  // Number of threads used for the initial analysis of each segment. The
+  // result does not depend on the number of threads. Ignored if pool is set.
+  uint32_t num_threads = 1;
+
+  // If set the initial analysis runs on this pool. It may be a pool which
+  // the segmentation is running on.
+  common::ThreadPool* pool = nullptr;
+
+  // Enables saving and/or resuming from checkpoints. For a family only the
+  // segmentation of the first face is checkpointed.
+  SegmentationCheckpointConfig checkpoint;
+
+  // Additional segments made up of optional layout features (which are not
+  // enabled by default). They're assigned segment indices following the
+  // codepoint segments. Glyphs only reachable via those features are placed
+  // into patches conditioned on the feature segments.
+  std::vector<absl::btree_set<hb_tag_t>> feature_segments;
+
+  // Codepoint frequencies which are used to guide segment merging.
+  SegmentationCostConfig cost;
+
+  // Selects how glyph closures are computed.
+  ClosureMode closure_mode = ClosureMode::kHarfbuzz;
+
+  // Receives segment analysis and merge counts, and is checked between
+  // segment analyses and merges. If it's cancelled (or its deadline passes)
+  // the error is returned after writing a checkpoint of the merging done so
+  // far (when checkpoint.checkpoint_path is set and the initial analysis has
+  // completed) and the closure cache.
+  Progress* progress = nullptr;
+};
+
+/*
+ * Performance statistics collected while computing a segmentation. Times are
+ * wall clock seconds, each phase is summed over all iterations of the merge
+ * loop.
+ */
+struct SegmentationStats {
+  double initial_analysis_seconds = 0.0;
+  double grouping_seconds = 0.0;
+  double merging_seconds = 0.0;
+  double validation_seconds = 0.0;
+  // Time spent estimating patch sizes, this is included in merging_seconds.
+  double patch_size_seconds = 0.0;
+
+  uint32_t closure_count = 0;
+  uint32_t merge_count = 0;
+
+  uint32_t glyph_closure_cache_hits = 0;
+  uint32_t glyph_closure_cache_misses = 0;
+  uint32_t or_gids_cache_hits = 0;
+  uint32_t or_gids_cache_misses = 0;
+  uint32_t patch_size_cache_hits = 0;
+  uint32_t patch_size_cache_misses = 0;
+
+  // Returns these stats as a flat JSON object.
+  std::string ToJson() const;
+};
+
 /*
  * Describes how the glyphs in a font should be segmented into glyph keyed
  * patches.
@@ -135,6 +259,15 @@ class GlyphSegmentation {
       const absl::flat_hash_map<segment_index_t,
                                 absl::flat_hash_set<hb_codepoint_t>>& segments);
 
+  /*
+   * As above, but segments may be any subset definition (for example they may
+   * include layout features).
+   */
+  static absl::StatusOr<std::vector<Condition>>
+  ActivationConditionsToConditionEntries(
+      absl::Span<const ActivationCondition> conditions,
+      const absl::flat_hash_map<segment_index_t, SubsetDefinition>& segments);
+
   /*
    * Analyzes a set of codepoint segments using a subsetter closure and computes
    * a GlyphSegmentation which will satisfy the "glyph closure requirement" for
@@ -142,13 +275,38 @@ class GlyphSegmentation {
    *
    * initial_segment is the set of codepoints that will be placed into the
    * initial ift font.
+   *
+   * See SegmentationOptions for the optional settings.
    */
-  // TODO(garretrieger): also support optional feature segments.
   static absl::StatusOr<GlyphSegmentation> CodepointToGlyphSegments(
       hb_face_t* face, absl::flat_hash_set<hb_codepoint_t> initial_segment,
       std::vector<absl::flat_hash_set<hb_codepoint_t>> codepoint_segments,
       uint32_t patch_size_min_bytes = 0,
-      uint32_t patch_size_max_bytes = UINT32_MAX);
+      uint32_t patch_size_max_bytes = UINT32_MAX,
+      const SegmentationOptions& options = {});
+
+  /*
+   * Segments a family of fonts (for example the static weights of a family) so
+   * that every member uses the same segments, letting clients which switch
+   * between members request patches with the same structure.
+   *
+   * The first face is segmented (including merging) as by
+   * CodepointToGlyphSegments(). Its resulting segments are then applied to
+   * each remaining face without further merging. Faces whose glyph closures
+   * are necessarily identical to the first's (same glyph order, cmap, layout
+   * tables and composite glyphs) reuse its segmentation, including stats,
+   * instead of recomputing every closure.
+   *
+   * Returns one segmentation per face, in order.
+   */
+  static absl::StatusOr<std::vector<GlyphSegmentation>>
+  CodepointToGlyphSegmentsForFamily(
+      absl::Span<hb_face_t* const> faces,
+      absl::flat_hash_set<hb_codepoint_t> initial_segment,
+      std::vector<absl::flat_hash_set<hb_codepoint_t>> codepoint_segments,
+      uint32_t patch_size_min_bytes = 0,
+      uint32_t patch_size_max_bytes = UINT32_MAX,
+      const SegmentationOptions& options = {});
 
   /*
    * Returns a human readable string representation of this segmentation and
@@ -174,6 +332,22 @@ class GlyphSegmentation {
     return segments_;
   }
 
+  /*
+   * The layout features associated with each segment, indexed the same as
+   * Segments(). Empty for segments which are only codepoints.
+   */
+  const std::vector<absl::btree_set<hb_tag_t>>& FeatureSegments() const {
+    return feature_segments_;
+  }
+
+  /*
+   * Returns the subset definition (codepoints and features) for each segment,
+   * keyed by segment index. Suitable for use with
+   * ActivationConditionsToConditionEntries().
+   */
+  absl::flat_hash_map<segment_index_t, SubsetDefinition> SegmentDefinitions()
+      const;
+
   /*
    * The list of glyphs in each patch. The key in the map is an id used to
    * identify the patch within the activation conditions.
@@ -201,7 +375,18 @@ class GlyphSegmentation {
     return init_font_glyphs_;
   };
 
+  /*
+   * Statistics on the work done to produce this segmentation.
+   */
+  const SegmentationStats& Stats() const { return stats_; }
+
  private:
+  // Runs segmentation (analysis, grouping and merging) on a prepared context.
+  static absl::StatusOr<GlyphSegmentation> Segment(
+      SegmentationContext& context, uint32_t num_threads,
+      const SegmentationCheckpointConfig& checkpoint,
+      common::ThreadPool* pool);
+
   static absl::Status GroupsToSegmentation(
       const absl::btree_map<absl::btree_set<segment_index_t>,
                             absl::btree_set<glyph_id_t>>& and_glyph_groups,
@@ -210,7 +395,8 @@ class GlyphSegmentation {
       const absl::btree_set<segment_index_t>& fallback_group,
       GlyphSegmentation& segmentation);
 
-  void CopySegments(const std::vector<common::hb_set_unique_ptr>& segments);
+  void CopySegments(const std::vector<common::hb_set_unique_ptr>& segments,
+                    const std::vector<common::hb_set_unique_ptr>& features);
 
   // TODO(garretrieger): the output conditions need to also capture the base
   // codepoint segmentations since those
@@ -220,7 +406,9 @@ class GlyphSegmentation {
   absl::btree_set<glyph_id_t> unmapped_glyphs_;
   absl::btree_set<ActivationCondition> conditions_;
   std::vector<absl::btree_set<hb_codepoint_t>> segments_;
+  std::vector<absl::btree_set<hb_tag_t>> feature_segments_;
   absl::btree_map<patch_id_t, absl::btree_set<glyph_id_t>> patches_;
+  SegmentationStats stats_;
 };
 
 }  // namespace ift::encoder
@@ -1,10 +1,12 @@
 #include "ift/encoder/glyph_segmentation.h"
 
+#include <cstdio>
 #include <optional>
 
 #include "common/font_data.h"
 #include "gtest/gtest.h"
 #include "ift/encoder/condition.h"
+#include "ift/encoder/progress.h"
 
 using absl::btree_set;
 using common::FontData;
@@ -117,6 +119,65 @@ if (s2) then p2
 )");
 }
 
+TEST_F(GlyphSegmentationTest, MergeBase_RankedByCompositesEliminated) {
+  // {f, À, Á} is too small. It shares the acute with {Ć, ...} and both the
+  // grave and the fi ligature with {i, È, ...}, giving the conditions
+  // (s0 OR s1), (s0 OR s2) and (s0 AND s2) in that order. First fit would
+  // merge s1 via (s0 OR s1), but merging s2 eliminates two composite
+  // conditions instead of one so it's chosen.
+  auto segmentation = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {},
+      {{'f', 0xc0, 0xc1},
+       {0x106, 'm', 'n', 'o', 'p', 'u'},
+       {'i', 0xc8, 'q', 'r', 's', 't', 'v'}},
+      500);
+  ASSERT_TRUE(segmentation.ok()) << segmentation.status();
+
+  std::vector<btree_set<hb_codepoint_t>> expected_segments = {
+      {'f', 'i', 'q', 'r', 's', 't', 'v', 0xc0, 0xc1, 0xc8},
+      {'m', 'n', 'o', 'p', 'u', 0x106},
+      {}};
+  ASSERT_EQ(segmentation->Segments(), expected_segments);
+
+  // Only the shared acute is left as a composite condition.
+  uint32_t composites = 0;
+  for (const auto& condition : segmentation->Conditions()) {
+    if (!condition.IsExclusive()) {
+      composites++;
+    }
+  }
+  ASSERT_EQ(composites, 1) << segmentation->ToString();
+}
+
+TEST_F(GlyphSegmentationTest, Family) {
+  hb_face_unique_ptr roboto_thin =
+      from_file("common/testdata/Roboto-Thin.ttf");
+  std::vector<hb_face_t*> faces = {roboto.get(), roboto_thin.get(),
+                                   roboto.get()};
+  auto segmentations = GlyphSegmentation::CodepointToGlyphSegmentsForFamily(
+      faces, {},
+      {{'a', 'b', 'd'}, {'e', 'f'}, {'j', 'k', 'm', 'n'}, {'i', 'l'}}, 370);
+  ASSERT_TRUE(segmentations.ok()) << segmentations.status();
+  ASSERT_EQ(segmentations->size(), 3);
+
+  // The first face is segmented as usual.
+  auto single = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {},
+      {{'a', 'b', 'd'}, {'e', 'f'}, {'j', 'k', 'm', 'n'}, {'i', 'l'}}, 370);
+  ASSERT_TRUE(single.ok()) << single.status();
+  ASSERT_EQ((*segmentations)[0].ToString(), single->ToString());
+
+  // The others share its merged segments.
+  std::vector<btree_set<hb_codepoint_t>> expected_segments = {
+      {'a', 'b', 'd'}, {'e', 'f', 'i', 'l'}, {'j', 'k', 'm', 'n'}, {}};
+  for (const auto& segmentation : *segmentations) {
+    ASSERT_EQ(segmentation.Segments(), expected_segments);
+  }
+
+  // A face with the same closure structure gets the same segmentation.
+  ASSERT_EQ((*segmentations)[2].ToString(), single->ToString());
+}
+
 TEST_F(GlyphSegmentationTest, MergeBases) {
   // {e, f} is too smal, since no conditional patches exist it should merge with
   // the next available base which is {'j', 'k'}
@@ -144,6 +205,55 @@ if (s3) then p2
 )");
 }
 
+TEST_F(GlyphSegmentationTest, Stats) {
+  auto segmentation = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {},
+      {{'a', 'b', 'd'}, {'e', 'f'}, {'j', 'k'}, {'m', 'n', 'o', 'p'}}, 370);
+  ASSERT_TRUE(segmentation.ok()) << segmentation.status();
+
+  const SegmentationStats& stats = segmentation->Stats();
+  ASSERT_EQ(stats.merge_count, 1);
+  ASSERT_GT(stats.closure_count, 0);
+  ASSERT_GT(stats.glyph_closure_cache_hits + stats.glyph_closure_cache_misses,
+            0);
+  ASSERT_GT(stats.patch_size_cache_hits + stats.patch_size_cache_misses, 0);
+  ASSERT_GE(stats.merging_seconds, stats.patch_size_seconds);
+
+  std::string json = stats.ToJson();
+  ASSERT_NE(json.find("\"merge_count\": 1,"), std::string::npos) << json;
+  ASSERT_NE(json.find("\"patch_size_cache_misses\": "), std::string::npos)
+      << json;
+}
+
+TEST_F(GlyphSegmentationTest, MergeBases_CodepointFrequencies) {
+  // {e, f} is too small. Without frequency data it merges with {j, k} (see
+  // MergeBases), but {j, k} is rarely used while {m, n, o, p} is commonly used
+  // alongside {e, f} so merging with that saves an expected request.
+  SegmentationCostConfig cost;
+  for (hb_codepoint_t cp : {'e', 'f', 'm', 'n', 'o', 'p'}) {
+    cost.codepoint_probabilities[cp] = 0.9;
+  }
+  for (hb_codepoint_t cp : {'j', 'k'}) {
+    cost.codepoint_probabilities[cp] = 0.01;
+  }
+
+  SegmentationOptions options;
+  options.cost = cost;
+  auto segmentation = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {},
+      {{'a', 'b', 'd'}, {'e', 'f'}, {'j', 'k'}, {'m', 'n', 'o', 'p'}}, 370,
+      UINT32_MAX, options);
+  ASSERT_TRUE(segmentation.ok()) << segmentation.status();
+
+  std::vector<btree_set<hb_codepoint_t>> expected_segments = {
+      {'a', 'b', 'd'},
+      {'e', 'f', 'm', 'n', 'o', 'p'},
+      {'j', 'k'},
+      {},
+  };
+  ASSERT_EQ(segmentation->Segments(), expected_segments);
+}
+
 TEST_F(GlyphSegmentationTest, MergeBases_MaxSize) {
   // {e, f} is too small, since no conditional patches exist it will merge with
   // the next available base which is {'m', 'n', 'o', 'p'}. However that patch
@@ -217,6 +327,215 @@ if ((s0 OR s1 OR s2 OR s3)) then p5
 )");
 }
 
+TEST_F(GlyphSegmentationTest, MultipleThreads_SameResult) {
+  std::vector<absl::flat_hash_set<hb_codepoint_t>> segments = {
+      {0x62a}, {0x62b}, {0x62c}, {0x62d}};
+  auto expected = GlyphSegmentation::CodepointToGlyphSegments(
+      noto_nastaliq_urdu.get(), {}, segments);
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  SegmentationOptions options;
+  options.num_threads = 4;
+  auto segmentation = GlyphSegmentation::CodepointToGlyphSegments(
+      noto_nastaliq_urdu.get(), {}, segments, 0, UINT32_MAX, options);
+  ASSERT_TRUE(segmentation.ok()) << segmentation.status();
+
+  ASSERT_EQ(segmentation->ToString(), expected->ToString());
+  ASSERT_EQ(segmentation->UnmappedGlyphs(), expected->UnmappedGlyphs());
+}
+
+TEST_F(GlyphSegmentationTest, Checkpoint_Resume) {
+  std::vector<absl::flat_hash_set<hb_codepoint_t>> segments = {
+      {'a', 'b', 'd'}, {'e', 'f'}, {'j', 'k'}, {'m', 'n', 'o', 'p'}};
+  auto expected = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {}, segments, 370);
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  SegmentationCheckpointConfig checkpoint;
+  checkpoint.checkpoint_path =
+      testing::TempDir() + "/glyph_segmentation_checkpoint";
+  checkpoint.interval = 1;
+  SegmentationOptions options;
+  options.checkpoint = checkpoint;
+  auto segmentation = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {}, segments, 370, UINT32_MAX, options);
+  ASSERT_TRUE(segmentation.ok()) << segmentation.status();
+  ASSERT_EQ(segmentation->ToString(), expected->ToString());
+
+  SegmentationOptions resume;
+  resume.checkpoint.resume_from = checkpoint.checkpoint_path;
+  auto resumed = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {}, segments, 370, UINT32_MAX, resume);
+  ASSERT_TRUE(resumed.ok()) << resumed.status();
+  ASSERT_EQ(resumed->ToString(), expected->ToString());
+  ASSERT_EQ(resumed->Segments(), expected->Segments());
+
+  // Resuming with different inputs is an error.
+  auto mismatched = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {}, {{'a', 'b', 'd'}, {'e', 'f'}}, 370, UINT32_MAX,
+      resume);
+  ASSERT_TRUE(absl::IsFailedPrecondition(mismatched.status()))
+      << mismatched.status();
+}
+
+TEST_F(GlyphSegmentationTest, Progress_CancelAndResume) {
+  std::vector<absl::flat_hash_set<hb_codepoint_t>> segments = {
+      {'a', 'b', 'd'}, {'e', 'f'}, {'j', 'k'}, {'m', 'n', 'o', 'p'}};
+  auto expected = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {}, segments, 370);
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  Progress cancelled;
+  cancelled.Cancel();
+  SegmentationOptions options;
+  options.progress = &cancelled;
+  auto segmentation = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {}, segments, 370, UINT32_MAX, options);
+  ASSERT_TRUE(absl::IsCancelled(segmentation.status()))
+      << segmentation.status();
+
+  // Stop after the first merge, a checkpoint is written on the way out.
+  Progress progress([](Progress& p) {
+    if (p.Get(Progress::MERGES_DONE) > 0) {
+      p.Cancel();
+    }
+  });
+  options.checkpoint.checkpoint_path =
+      testing::TempDir() + "/glyph_segmentation_cancel_checkpoint";
+  options.checkpoint.interval = 100;
+  options.progress = &progress;
+  segmentation = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {}, segments, 370, UINT32_MAX, options);
+  ASSERT_TRUE(absl::IsCancelled(segmentation.status()))
+      << segmentation.status();
+  ASSERT_EQ(progress.Get(Progress::SEGMENTS_TOTAL), 4);
+  ASSERT_EQ(progress.Get(Progress::SEGMENTS_ANALYZED), 4);
+  ASSERT_GE(progress.Get(Progress::MERGES_ATTEMPTED), 1);
+  ASSERT_EQ(progress.Get(Progress::MERGES_DONE), 1);
+
+  SegmentationOptions resume;
+  resume.checkpoint.resume_from = options.checkpoint.checkpoint_path;
+  auto resumed = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {}, segments, 370, UINT32_MAX, resume);
+  ASSERT_TRUE(resumed.ok()) << resumed.status();
+  ASSERT_EQ(resumed->ToString(), expected->ToString());
+  ASSERT_EQ(resumed->Segments(), expected->Segments());
+}
+
+TEST_F(GlyphSegmentationTest, ClosureCacheFile) {
+  std::vector<absl::flat_hash_set<hb_codepoint_t>> segments = {
+      {'a', 'b', 'd'}, {'e', 'f'}, {'j', 'k'}, {'m', 'n', 'o', 'p'}};
+  SegmentationOptions options;
+  options.checkpoint.closure_cache_path =
+      testing::TempDir() + "/glyph_closure_cache";
+  std::remove(options.checkpoint.closure_cache_path.c_str());
+
+  auto first = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {}, segments, 370, UINT32_MAX, options);
+  ASSERT_TRUE(first.ok()) << first.status();
+  ASSERT_GT(first->Stats().glyph_closure_cache_misses, 0);
+
+  // The closures needed by the second run were saved by the first, only
+  // those computed before the cache is loaded miss.
+  auto second = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {}, segments, 370, UINT32_MAX, options);
+  ASSERT_TRUE(second.ok()) << second.status();
+  ASSERT_LT(second->Stats().glyph_closure_cache_misses,
+            first->Stats().glyph_closure_cache_misses);
+  ASSERT_EQ(second->ToString(), first->ToString());
+
+  // A cache from a different font is ignored.
+  hb_face_unique_ptr roboto_thin =
+      from_file("common/testdata/Roboto-Thin.ttf");
+  auto expected = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto_thin.get(), {}, segments, 370);
+  ASSERT_TRUE(expected.ok()) << expected.status();
+  auto other_font = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto_thin.get(), {}, segments, 370, UINT32_MAX, options);
+  ASSERT_TRUE(other_font.ok()) << other_font.status();
+  ASSERT_GT(other_font->Stats().glyph_closure_cache_misses, 0);
+  ASSERT_EQ(other_font->ToString(), expected->ToString());
+}
+
+TEST_F(GlyphSegmentationTest, ClosureMode) {
+  std::vector<absl::flat_hash_set<hb_codepoint_t>> segments = {
+      {'a', 'b', 'd'}, {'e', 'f'}, {'j', 'k'}, {'m', 'n', 'o', 'p'}};
+  auto expected = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {}, segments, 370);
+  ASSERT_TRUE(expected.ok()) << expected.status();
+
+  // Validation uses the harfbuzz closures.
+  SegmentationOptions validated_options;
+  validated_options.closure_mode = ClosureMode::kGraphValidated;
+  auto validated = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {}, segments, 370, UINT32_MAX, validated_options);
+  ASSERT_TRUE(validated.ok()) << validated.status();
+  ASSERT_EQ(validated->ToString(), expected->ToString());
+
+  SegmentationOptions graph_options;
+  graph_options.closure_mode = ClosureMode::kGraph;
+  auto graph = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {}, segments, 370, UINT32_MAX, graph_options);
+  ASSERT_TRUE(graph.ok()) << graph.status();
+  ASSERT_EQ(graph->Segments().size(), expected->Segments().size());
+}
+
+TEST_F(GlyphSegmentationTest, FeatureSegments) {
+  SegmentationOptions options;
+  options.feature_segments = {{HB_TAG('s', 'm', 'c', 'p')}};
+  auto segmentation = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {'a'}, {{'b'}, {'c'}}, 0, UINT32_MAX, options);
+  ASSERT_TRUE(segmentation.ok()) << segmentation.status();
+
+  // Feature segments are appended after the codepoint segments.
+  std::vector<btree_set<hb_codepoint_t>> expected_segments = {{'b'}, {'c'}, {}};
+  ASSERT_EQ(segmentation->Segments(), expected_segments);
+  std::vector<btree_set<hb_tag_t>> expected_features = {
+      {}, {}, {HB_TAG('s', 'm', 'c', 'p')}};
+  ASSERT_EQ(segmentation->FeatureSegments(), expected_features);
+
+  auto definitions = segmentation->SegmentDefinitions();
+  ASSERT_EQ(definitions.size(), 3);
+  ASSERT_TRUE(definitions[2].codepoints.empty());
+  ASSERT_TRUE(definitions[2].feature_tags.contains(HB_TAG('s', 'm', 'c', 'p')));
+
+  // No feature segments matches the default behaviour.
+  auto expected = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {'a'}, {{'b'}, {'c'}});
+  ASSERT_TRUE(expected.ok()) << expected.status();
+  auto no_features = GlyphSegmentation::CodepointToGlyphSegments(
+      roboto.get(), {'a'}, {{'b'}, {'c'}}, 0, UINT32_MAX,
+      SegmentationOptions());
+  ASSERT_TRUE(no_features.ok()) << no_features.status();
+  ASSERT_EQ(no_features->ToString(), expected->ToString());
+
+  // Glyphs only reachable through smcp must be in patches whose conditions
+  // require the feature segment.
+  btree_set<glyph_id_t> default_glyphs = expected->InitialFontGlyphs();
+  for (const auto& [_, gids] : expected->GidSegments()) {
+    default_glyphs.insert(gids.begin(), gids.end());
+  }
+  btree_set<patch_id_t> smcp_patches;
+  for (const auto& [patch, gids] : segmentation->GidSegments()) {
+    for (glyph_id_t gid : gids) {
+      if (!default_glyphs.contains(gid)) {
+        smcp_patches.insert(patch);
+      }
+    }
+  }
+  ASSERT_FALSE(smcp_patches.empty());
+  for (const auto& condition : segmentation->Conditions()) {
+    if (!smcp_patches.contains(condition.activated())) {
+      continue;
+    }
+    bool requires_smcp = false;
+    for (const auto& group : condition.conditions()) {
+      requires_smcp |= group == btree_set<segment_index_t>{2};
+    }
+    ASSERT_TRUE(requires_smcp) << condition.ToString();
+  }
+}
+
 TEST_F(GlyphSegmentationTest, ActivationConditionsToEncoderConditions) {
   absl::flat_hash_map<segment_index_t, absl::flat_hash_set<hb_codepoint_t>>
       segments = {
@@ -302,6 +621,54 @@ TEST_F(GlyphSegmentationTest, ActivationConditionsToEncoderConditions) {
   ASSERT_EQ(*entries, expected);
 }
 
+TEST_F(GlyphSegmentationTest,
+       ActivationConditionsToEncoderConditions_SubsetDefinitions) {
+  SubsetDefinition liga;
+  liga.feature_tags.insert(HB_TAG('l', 'i', 'g', 'a'));
+  absl::flat_hash_map<segment_index_t, SubsetDefinition> segments = {
+      {1, SubsetDefinition::Codepoints(absl::flat_hash_set<uint32_t>{'a'})},
+      {2, liga},
+  };
+
+  // Duplicate conditions are only mapped once.
+  std::vector<GlyphSegmentation::ActivationCondition> activation_conditions = {
+      GlyphSegmentation::ActivationCondition::composite_condition({{1}, {2}},
+                                                                  3),
+      GlyphSegmentation::ActivationCondition::composite_condition({{1}, {2}},
+                                                                  3),
+  };
+
+  std::vector<Condition> expected;
+
+  // entry[0] {{1}} ignored
+  {
+    Condition condition;
+    condition.subset_definition.codepoints.insert('a');
+    expected.push_back(condition);
+  }
+
+  // entry[1] {{liga}} ignored
+  {
+    Condition condition;
+    condition.subset_definition = liga;
+    expected.push_back(condition);
+  }
+
+  // entry[2] {{1} AND {liga}} -> 3
+  {
+    Condition condition;
+    condition.child_conditions = {0, 1};
+    condition.activated_patch_id = 3;
+    condition.conjunctive = true;
+    expected.push_back(condition);
+  }
+
+  auto entries = GlyphSegmentation::ActivationConditionsToConditionEntries(
+      activation_conditions, segments);
+  ASSERT_TRUE(entries.ok()) << entries.status();
+  ASSERT_EQ(*entries, expected);
+}
+
 // TODO(garretrieger): add test where or_set glyphs are moved back to unmapped
 // due to found "additional conditions".
 
@@ -0,0 +1,138 @@
+#include "ift/encoder/patch_sink.h"
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "common/font_data.h"
+#include "common/try.h"
+#include "ift/patch_pack.h"
+
+using absl::MutexLock;
+using absl::Status;
+using absl::StatusOr;
+using absl::StrCat;
+using common::FontData;
+using ift::PatchPack;
+
+namespace ift::encoder {
+
+Status MemoryPatchSink::Add(const std::string& url, const FontData& patch,
+                            uint64_t fingerprint) {
+  patches_[url].shallow_copy(patch);
+  return absl::OkStatus();
+}
+
+static Status WriteFile(const std::string& path, const FontData& data) {
+  std::ofstream output(path,
+                       std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!output.is_open()) {
+    return absl::NotFoundError(StrCat("Unable to open ", path, "."));
+  }
+  output.write(data.data(), data.size());
+  if (output.bad()) {
+    return absl::InternalError(StrCat("Failed to write to ", path, "."));
+  }
+  return absl::OkStatus();
+}
+
+FilePatchSink::~FilePatchSink() { Flush().IgnoreError(); }
+
+Status FilePatchSink::Add(const std::string& url, const FontData& patch,
+                          uint64_t fingerprint) {
+  std::string path = StrCat(directory_, "/", url);
+  if (!pool_) {
+    return WriteFile(path, patch);
+  }
+
+  uint64_t size = patch.size();
+  {
+    MutexLock lock(&mutex_);
+    // A patch larger than the limit is still written once nothing else is
+    // pending.
+    auto has_room = [&]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+      return !status_.ok() || pending_ == 0 ||
+             pending_bytes_ + size <= max_pending_bytes_;
+    };
+    mutex_.Await(absl::Condition(&has_room));
+    if (!status_.ok()) {
+      return status_;
+    }
+    pending_++;
+    pending_bytes_ += size;
+  }
+
+  // Tasks must be copyable, which FontData isn't.
+  auto data = std::make_shared<FontData>();
+  data->shallow_copy(patch);
+  pool_->Schedule([this, path = std::move(path), data, size]() {
+    Status sc = WriteFile(path, *data);
+    MutexLock lock(&mutex_);
+    if (status_.ok()) {
+      status_ = sc;
+    }
+    pending_--;
+    pending_bytes_ -= size;
+  });
+  return absl::OkStatus();
+}
+
+Status FilePatchSink::Flush() {
+  MutexLock lock(&mutex_);
+  mutex_.Await(absl::Condition(
+      +[](uint32_t* pending) { return *pending == 0; }, &pending_));
+  return status_;
+}
+
+StatusOr<std::unique_ptr<PackPatchSink>> PackPatchSink::Create(
+    std::string path) {
+  std::ofstream output(path,
+                       std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!output.is_open()) {
+    return absl::NotFoundError(StrCat("Unable to open ", path, "."));
+  }
+  std::string header;
+  PatchPack::WriteHeader(header);
+  output.write(header.data(), header.size());
+  return std::unique_ptr<PackPatchSink>(
+      new PackPatchSink(std::move(path), std::move(output)));
+}
+
+Status PackPatchSink::Add(const std::string& url, const FontData& patch,
+                          uint64_t fingerprint) {
+  if (!output_.is_open()) {
+    return absl::FailedPreconditionError(
+        StrCat("Pack ", path_, " has already been flushed."));
+  }
+  output_.write(patch.data(), patch.size());
+  if (output_.bad()) {
+    return absl::InternalError(StrCat("Failed to write to ", path_, "."));
+  }
+  entries_.push_back({url, PatchPack::Range{offset_, patch.size()}});
+  offset_ += patch.size();
+  return absl::OkStatus();
+}
+
+Status PackPatchSink::Flush() {
+  if (!output_.is_open()) {
+    return absl::OkStatus();
+  }
+  std::string index;
+  Status sc = PatchPack::WriteIndex(std::move(entries_), offset_, index);
+  entries_.clear();
+  output_.write(index.data(), index.size());
+  output_.close();
+  TRYV(sc);
+  if (output_.fail()) {
+    return absl::InternalError(StrCat("Failed to write to ", path_, "."));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace ift::encoder
@@ -0,0 +1,160 @@
+#ifndef IFT_ENCODER_PATCH_SINK_H_
+#define IFT_ENCODER_PATCH_SINK_H_
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "common/font_data.h"
+#include "common/thread_pool.h"
+#include "ift/patch_pack.h"
+
+namespace ift::encoder {
+
+/*
+ * Receives patches from the Encoder as they are produced.
+ *
+ * Calls are serialized, the encoder never makes concurrent calls into a sink,
+ * so implementations don't need to be thread safe. They aren't necessarily
+ * made from the thread that invoked Encoder::Encode() though: when encoding on
+ * multiple threads finished batches (including any deferred glyph keyed
+ * patches and CriticalPathDone()) are passed to the sink from a background
+ * thread. Implementations must not rely on thread local state.
+ */
+class PatchSink {
+ public:
+  virtual ~PatchSink() = default;
+
+  /*
+   * Called once for each patch in the encoding. 'fingerprint' identifies the
+   * inputs used to generate the patch (see Encoder::Encoding::fingerprints).
+   * Returning an error aborts the encoding.
+   */
+  virtual absl::Status Add(const std::string& url,
+                           const common::FontData& patch,
+                           uint64_t fingerprint) = 0;
+
+  /*
+   * Called with the init font as soon as it's available, before any table
+   * keyed patches are added.
+   */
+  virtual absl::Status AddInitFont(const common::FontData& init_font,
+                                   uint64_t fingerprint) {
+    return absl::OkStatus();
+  }
+
+  /*
+   * Only called when the encoder produces the critical path first (see
+   * Encoder::SetCriticalPathFirst()), once the init font and every patch on
+   * the critical path have been added. Sinks which write in the background
+   * should finish writing everything added so far before returning.
+   */
+  virtual absl::Status CriticalPathDone() { return absl::OkStatus(); }
+
+  /*
+   * Called by the Encoder once every patch has been added. Sinks which write
+   * in the background or buffer output finish doing so here and return the
+   * first error encountered. Returning an error fails the encoding.
+   */
+  virtual absl::Status Flush() { return absl::OkStatus(); }
+};
+
+/*
+ * Collects all patches in memory, keyed by url.
+ */
+class MemoryPatchSink : public PatchSink {
+ public:
+  absl::Status Add(const std::string& url, const common::FontData& patch,
+                   uint64_t fingerprint) override;
+
+  const absl::flat_hash_map<std::string, common::FontData>& Patches() const {
+    return patches_;
+  }
+
+  absl::flat_hash_map<std::string, common::FontData> TakePatches() {
+    return std::move(patches_);
+  }
+
+ private:
+  absl::flat_hash_map<std::string, common::FontData> patches_;
+};
+
+/*
+ * Writes each patch to a file named after the patch url inside of
+ * 'directory'.
+ *
+ * If a pool is provided the files are written on it in the background, which
+ * is much faster on storage with a high per file latency. Write errors are
+ * then reported by a later Add() or by Flush(). The pool must outlive this
+ * sink. Add() blocks while more than max_pending_bytes of patches are waiting
+ * to be written, so storage which can't keep up throttles the producer rather
+ * than letting patches accumulate in memory.
+ */
+class FilePatchSink : public PatchSink {
+ public:
+  static constexpr uint64_t kDefaultMaxPendingBytes = 256 * 1024 * 1024;
+
+  explicit FilePatchSink(std::string directory,
+                         common::ThreadPool* pool = nullptr,
+                         uint64_t max_pending_bytes = kDefaultMaxPendingBytes)
+      : directory_(std::move(directory)),
+        pool_(pool),
+        max_pending_bytes_(max_pending_bytes) {}
+
+  // Waits for any outstanding writes.
+  ~FilePatchSink() override;
+
+  absl::Status Add(const std::string& url, const common::FontData& patch,
+                   uint64_t fingerprint) override;
+
+  absl::Status CriticalPathDone() override { return Flush(); }
+
+  absl::Status Flush() override;
+
+ private:
+  std::string directory_;
+  common::ThreadPool* pool_;
+  uint64_t max_pending_bytes_;
+
+  absl::Mutex mutex_;
+  uint32_t pending_ ABSL_GUARDED_BY(mutex_) = 0;
+  uint64_t pending_bytes_ ABSL_GUARDED_BY(mutex_) = 0;
+  absl::Status status_ ABSL_GUARDED_BY(mutex_);
+};
+
+/*
+ * Writes all patches into a single ift::PatchPack at 'path', avoiding the
+ * creation of one file per patch. Patches are stored in the order they are
+ * added, Flush() then appends the index. Urls must be unique.
+ */
+class PackPatchSink : public PatchSink {
+ public:
+  static absl::StatusOr<std::unique_ptr<PackPatchSink>> Create(
+      std::string path);
+
+  absl::Status Add(const std::string& url, const common::FontData& patch,
+                   uint64_t fingerprint) override;
+
+  absl::Status Flush() override;
+
+ private:
+  PackPatchSink(std::string path, std::ofstream output)
+      : path_(std::move(path)), output_(std::move(output)) {}
+
+  std::string path_;
+  std::ofstream output_;
+  uint64_t offset_ = ift::PatchPack::kHeaderSize;
+  std::vector<std::pair<std::string, ift::PatchPack::Range>> entries_;
+};
+
+}  // namespace ift::encoder
+
+#endif  // IFT_ENCODER_PATCH_SINK_H_
@@ -0,0 +1,142 @@
+#include "ift/encoder/patch_sink.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "common/font_data.h"
+#include "common/thread_pool.h"
+#include "gtest/gtest.h"
+#include "ift/patch_pack.h"
+
+using absl::StrCat;
+using common::FontData;
+using common::ThreadPool;
+
+namespace ift::encoder {
+
+class PatchSinkTest : public ::testing::Test {
+ protected:
+  FontData Load(const std::string& path) {
+    hb_blob_t* blob = hb_blob_create_from_file_or_fail(path.c_str());
+    if (!blob) {
+      return FontData();
+    }
+    FontData result(blob);
+    hb_blob_destroy(blob);
+    return result;
+  }
+};
+
+TEST_F(PatchSinkTest, MemoryPatchSink) {
+  MemoryPatchSink sink;
+  ASSERT_TRUE(sink.Add("1.tk", FontData("abc"), 1).ok());
+  ASSERT_TRUE(sink.Add("2.tk", FontData("def"), 2).ok());
+  ASSERT_TRUE(sink.Add("1.tk", FontData("ghi"), 3).ok());
+
+  ASSERT_EQ(sink.Patches().size(), 2);
+  ASSERT_EQ(sink.Patches().at("1.tk"), FontData("ghi"));
+  ASSERT_EQ(sink.Patches().at("2.tk"), FontData("def"));
+
+  auto patches = sink.TakePatches();
+  ASSERT_EQ(patches.size(), 2);
+}
+
+TEST_F(PatchSinkTest, FilePatchSink) {
+  std::string dir = testing::TempDir() + "/patch_sink_test";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+
+  FilePatchSink sink(dir);
+  ASSERT_TRUE(sink.Add("1.tk", FontData("abc"), 1).ok());
+  ASSERT_TRUE(sink.Add("2.tk", FontData("def"), 2).ok());
+
+  ASSERT_EQ(Load(dir + "/1.tk"), FontData("abc"));
+  ASSERT_EQ(Load(dir + "/2.tk"), FontData("def"));
+
+  FilePatchSink missing(dir + "/does_not_exist");
+  auto sc = missing.Add("1.tk", FontData("abc"), 1);
+  ASSERT_TRUE(absl::IsNotFound(sc)) << sc;
+}
+
+TEST_F(PatchSinkTest, FilePatchSink_ThreadPool) {
+  std::string dir = testing::TempDir() + "/patch_sink_test_pool";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+
+  ThreadPool pool(4);
+  FilePatchSink sink(dir, &pool);
+  for (uint32_t i = 0; i < 100; i++) {
+    ASSERT_TRUE(
+        sink.Add(StrCat(i, ".tk"), FontData(StrCat("patch ", i)), i).ok());
+  }
+  ASSERT_TRUE(sink.Flush().ok());
+  for (uint32_t i = 0; i < 100; i++) {
+    ASSERT_EQ(Load(StrCat(dir, "/", i, ".tk")), FontData(StrCat("patch ", i)));
+  }
+
+  // Failures are reported once the write has been attempted.
+  FilePatchSink missing(dir + "/does_not_exist", &pool);
+  ASSERT_TRUE(missing.Add("1.tk", FontData("abc"), 1).ok());
+  auto sc = missing.Flush();
+  ASSERT_TRUE(absl::IsNotFound(sc)) << sc;
+  sc = missing.Add("2.tk", FontData("abc"), 2);
+  ASSERT_TRUE(absl::IsNotFound(sc)) << sc;
+}
+
+TEST_F(PatchSinkTest, FilePatchSink_MaxPendingBytes) {
+  std::string dir = testing::TempDir() + "/patch_sink_test_pending";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+
+  // Only one patch fits in the limit at a time, including one over it.
+  ThreadPool pool(4);
+  FilePatchSink sink(dir, &pool, 8);
+  for (uint32_t i = 0; i < 20; i++) {
+    std::string patch(i % 2 ? 6 : 12, 'a' + i);
+    ASSERT_TRUE(sink.Add(StrCat(i, ".tk"), FontData(patch), i).ok());
+  }
+  ASSERT_TRUE(sink.Flush().ok());
+  for (uint32_t i = 0; i < 20; i++) {
+    std::string patch(i % 2 ? 6 : 12, 'a' + i);
+    ASSERT_EQ(Load(StrCat(dir, "/", i, ".tk")), FontData(patch));
+  }
+}
+
+TEST_F(PatchSinkTest, PackPatchSink) {
+  std::string dir = testing::TempDir() + "/patch_sink_test_pack";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  std::string path = dir + "/patches.pack";
+
+  auto sink = PackPatchSink::Create(path);
+  ASSERT_TRUE(sink.ok()) << sink.status();
+  ASSERT_TRUE((*sink)->Add("1.tk", FontData("abc"), 1).ok());
+  ASSERT_TRUE((*sink)->Add("2 2.tk", FontData(""), 2).ok());
+  ASSERT_TRUE((*sink)->Add("3.gk", FontData("defg"), 3).ok());
+  ASSERT_TRUE((*sink)->Flush().ok());
+
+  auto pack = PatchPack::Load(path);
+  ASSERT_TRUE(pack.ok()) << pack.status();
+  ASSERT_EQ(pack->size(), 3);
+  ASSERT_EQ(pack->str().substr(PatchPack::kHeaderSize, 7), "abcdefg");
+  ASSERT_EQ(*pack->Get("1.tk"), "abc");
+  ASSERT_EQ(*pack->Get("2 2.tk"), "");
+  ASSERT_EQ(*pack->Get("3.gk"), "defg");
+
+  auto sc = (*sink)->Add("4.tk", FontData("abc"), 4);
+  ASSERT_TRUE(absl::IsFailedPrecondition(sc)) << sc;
+
+  ASSERT_TRUE(
+      absl::IsNotFound(PackPatchSink::Create(dir + "/missing/p").status()));
+
+  auto duplicate = PackPatchSink::Create(path);
+  ASSERT_TRUE(duplicate.ok()) << duplicate.status();
+  ASSERT_TRUE((*duplicate)->Add("1.tk", FontData("abc"), 1).ok());
+  ASSERT_TRUE((*duplicate)->Add("1.tk", FontData("def"), 1).ok());
+  sc = (*duplicate)->Flush();
+  ASSERT_TRUE(absl::IsInvalidArgument(sc)) << sc;
+}
+
+}  // namespace ift::encoder
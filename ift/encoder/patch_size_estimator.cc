@@ -0,0 +1,123 @@
+#include "ift/encoder/patch_size_estimator.h"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "common/compat_id.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "common/glyph_data_index.h"
+#include "common/try.h"
+#include "ift/glyph_keyed_diff.h"
+
+using absl::btree_set;
+using absl::StatusOr;
+using absl::StrCat;
+using common::FontData;
+using common::FontHelper;
+using common::GlyphDataIndex;
+
+namespace ift::encoder {
+
+StatusOr<uint32_t> BrotliPatchSizeEstimator::EstimatePatchSize(
+    const btree_set<uint32_t>& gids) {
+  auto patch_data = TRY(diff_.CreatePatch(gids));
+  return patch_data.size();
+}
+
+StatusOr<std::unique_ptr<RawSizePatchSizeEstimator>>
+RawSizePatchSizeEstimator::Create(hb_face_t* face,
+                                  const btree_set<uint32_t>& sample_gids) {
+  std::unique_ptr<RawSizePatchSizeEstimator> estimator(
+      new RawSizePatchSizeEstimator(TRY(GlyphSizes(face))));
+
+  uint64_t raw_size = TRY(estimator->RawSize(sample_gids));
+  if (raw_size == 0) {
+    // Nothing to calibrate against, assume no compression.
+    return estimator;
+  }
+
+  BrotliPatchSizeEstimator exact(face);
+  uint32_t compressed_size = TRY(exact.EstimatePatchSize(sample_gids));
+  estimator->ratio_ = ((double)compressed_size) / ((double)raw_size);
+  VLOG(0) << "Calibrated patch compression ratio: " << estimator->ratio_;
+  return estimator;
+}
+
+StatusOr<uint32_t> RawSizePatchSizeEstimator::EstimatePatchSize(
+    const btree_set<uint32_t>& gids) {
+  uint64_t raw_size = TRY(RawSize(gids));
+  return (uint32_t)(ratio_ * raw_size);
+}
+
+StatusOr<std::vector<uint32_t>> RawSizePatchSizeEstimator::GlyphSizes(
+    hb_face_t* face) {
+  GlyphDataIndex glyph_data(face);
+  bool has_gvar = glyph_data.Has(FontHelper::kGvar);
+  uint32_t glyph_count = hb_face_get_glyph_count(face);
+  std::vector<uint32_t> sizes;
+  sizes.reserve(glyph_count);
+  for (uint32_t gid = 0; gid < glyph_count; gid++) {
+    uint32_t size = TRY(glyph_data.GlyphData(FontHelper::kGlyf, gid)).size();
+    if (has_gvar) {
+      size += TRY(glyph_data.GlyphData(FontHelper::kGvar, gid)).size();
+    }
+    sizes.push_back(size);
+  }
+  return sizes;
+}
+
+StatusOr<uint64_t> RawSizePatchSizeEstimator::RawSize(
+    const btree_set<uint32_t>& gids) const {
+  uint64_t total = 0;
+  for (uint32_t gid : gids) {
+    if (gid >= glyph_sizes_.size()) {
+      return absl::InvalidArgumentError(
+          StrCat("Glyph id ", gid, " is out of range."));
+    }
+    total += glyph_sizes_[gid];
+  }
+  return total;
+}
+
+bool ThresholdPatchSizeEstimator::IsNear(uint32_t estimate,
+                                         uint32_t threshold) const {
+  if (threshold == 0 || threshold == UINT32_MAX) {
+    // Threshold is disabled.
+    return false;
+  }
+  return ((double)estimate) * margin_ >= threshold &&
+         ((double)estimate) <= ((double)threshold) * margin_;
+}
+
+StatusOr<uint32_t> ThresholdPatchSizeEstimator::EstimatePatchSize(
+    const btree_set<uint32_t>& gids) {
+  uint32_t estimate = TRY(fast_->EstimatePatchSize(gids));
+  if (IsNear(estimate, min_bytes_) || IsNear(estimate, max_bytes_)) {
+    return exact_->EstimatePatchSize(gids);
+  }
+  return estimate;
+}
+
+StatusOr<uint32_t> CachingPatchSizeEstimator::EstimatePatchSize(
+    const btree_set<uint32_t>& gids) {
+  auto it = cache_.find(gids);
+  if (it != cache_.end()) {
+    cache_hits_++;
+    return it->second;
+  }
+
+  cache_misses_++;
+  uint32_t size = TRY(estimator_->EstimatePatchSize(gids));
+  cache_.insert(std::pair(gids, size));
+  return size;
+}
+
+}  // namespace ift::encoder
@@ -0,0 +1,149 @@
+#ifndef IFT_ENCODER_PATCH_SIZE_ESTIMATOR_H_
+#define IFT_ENCODER_PATCH_SIZE_ESTIMATOR_H_
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/statusor.h"
+#include "common/compat_id.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "hb.h"
+#include "ift/glyph_keyed_diff.h"
+
+namespace ift::encoder {
+
+/*
+ * Estimates the size of a glyph keyed patch containing a set of glyphs. Used
+ * by the glyph segmenter to evaluate potential segment merges.
+ */
+class PatchSizeEstimator {
+ public:
+  virtual ~PatchSizeEstimator() = default;
+
+  virtual absl::StatusOr<uint32_t> EstimatePatchSize(
+      const absl::btree_set<uint32_t>& gids) = 0;
+};
+
+/*
+ * Computes the exact size by generating the patch. Brotli is run at a reduced
+ * quality so results may be slightly larger than a final encoding.
+ */
+class BrotliPatchSizeEstimator : public PatchSizeEstimator {
+ public:
+  static constexpr unsigned kQuality = 9;
+
+  explicit BrotliPatchSizeEstimator(hb_face_t* face)
+      : font_data_(face),
+        diff_(font_data_, common::CompatId(),
+              {common::FontHelper::kGlyf, common::FontHelper::kGvar,
+               common::FontHelper::kCFF, common::FontHelper::kCFF2},
+              kQuality) {}
+
+  absl::StatusOr<uint32_t> EstimatePatchSize(
+      const absl::btree_set<uint32_t>& gids) override;
+
+ private:
+  common::FontData font_data_;
+  // Reused across estimates so the font's glyph data is only indexed once.
+  ift::GlyphKeyedDiff diff_;
+};
+
+/*
+ * Estimates the size from the uncompressed glyf and gvar data lengths for the
+ * glyphs, multiplied by a compression ratio that is calibrated once for the
+ * font. Much cheaper than BrotliPatchSizeEstimator but less accurate,
+ * particularly for small patches.
+ *
+ * The per glyph data lengths are computed once on creation, so each estimate
+ * is just a sum over the glyphs.
+ */
+class RawSizePatchSizeEstimator : public PatchSizeEstimator {
+ public:
+  /*
+   * Calibrates the compression ratio by generating a single patch containing
+   * sample_gids.
+   */
+  static absl::StatusOr<std::unique_ptr<RawSizePatchSizeEstimator>> Create(
+      hb_face_t* face, const absl::btree_set<uint32_t>& sample_gids);
+
+  absl::StatusOr<uint32_t> EstimatePatchSize(
+      const absl::btree_set<uint32_t>& gids) override;
+
+  double CompressionRatio() const { return ratio_; }
+
+ private:
+  explicit RawSizePatchSizeEstimator(std::vector<uint32_t> glyph_sizes)
+      : glyph_sizes_(std::move(glyph_sizes)) {}
+
+  static absl::StatusOr<std::vector<uint32_t>> GlyphSizes(hb_face_t* face);
+
+  absl::StatusOr<uint64_t> RawSize(const absl::btree_set<uint32_t>& gids) const;
+
+  // Uncompressed glyf + gvar bytes, indexed by glyph id.
+  std::vector<uint32_t> glyph_sizes_;
+  double ratio_ = 1.0;
+};
+
+/*
+ * Uses a fast estimate, falling back to an exact estimate only when the fast
+ * estimate is close enough to either of the thresholds (min_bytes, max_bytes)
+ * that it could be on the wrong side of them.
+ *
+ * "Close" means within a factor of 'margin' of the threshold.
+ */
+class ThresholdPatchSizeEstimator : public PatchSizeEstimator {
+ public:
+  ThresholdPatchSizeEstimator(std::unique_ptr<PatchSizeEstimator> fast,
+                              std::unique_ptr<PatchSizeEstimator> exact,
+                              uint32_t min_bytes, uint32_t max_bytes,
+                              double margin = 2.0)
+      : fast_(std::move(fast)),
+        exact_(std::move(exact)),
+        min_bytes_(min_bytes),
+        max_bytes_(max_bytes),
+        margin_(margin) {}
+
+  absl::StatusOr<uint32_t> EstimatePatchSize(
+      const absl::btree_set<uint32_t>& gids) override;
+
+ private:
+  bool IsNear(uint32_t estimate, uint32_t threshold) const;
+
+  std::unique_ptr<PatchSizeEstimator> fast_;
+  std::unique_ptr<PatchSizeEstimator> exact_;
+  uint32_t min_bytes_;
+  uint32_t max_bytes_;
+  double margin_;
+};
+
+/*
+ * Memoizes the estimates of another estimator, keyed by glyph set. Merge
+ * evaluation frequently re-estimates the same set of glyphs. Not thread safe.
+ */
+class CachingPatchSizeEstimator : public PatchSizeEstimator {
+ public:
+  explicit CachingPatchSizeEstimator(
+      std::unique_ptr<PatchSizeEstimator> estimator)
+      : estimator_(std::move(estimator)) {}
+
+  absl::StatusOr<uint32_t> EstimatePatchSize(
+      const absl::btree_set<uint32_t>& gids) override;
+
+  uint32_t CacheHits() const { return cache_hits_; }
+  uint32_t CacheMisses() const { return cache_misses_; }
+
+ private:
+  std::unique_ptr<PatchSizeEstimator> estimator_;
+  absl::flat_hash_map<absl::btree_set<uint32_t>, uint32_t> cache_;
+  uint32_t cache_hits_ = 0;
+  uint32_t cache_misses_ = 0;
+};
+
+}  // namespace ift::encoder
+
+#endif  // IFT_ENCODER_PATCH_SIZE_ESTIMATOR_H_
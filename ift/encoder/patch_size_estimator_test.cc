@@ -0,0 +1,114 @@
+#include "ift/encoder/patch_size_estimator.h"
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+
+#include "absl/container/btree_set.h"
+#include "common/font_data.h"
+#include "gtest/gtest.h"
+
+using absl::btree_set;
+using absl::StatusOr;
+using common::FontData;
+using common::hb_face_unique_ptr;
+using common::make_hb_face;
+
+namespace ift::encoder {
+
+class PatchSizeEstimatorTest : public ::testing::Test {
+ protected:
+  PatchSizeEstimatorTest() : roboto(make_hb_face(nullptr)) {
+    hb_blob_t* blob =
+        hb_blob_create_from_file_or_fail("common/testdata/Roboto-Regular.ttf");
+    assert(blob);
+    FontData font(blob);
+    hb_blob_destroy(blob);
+    roboto = font.face();
+  }
+
+  hb_face_unique_ptr roboto;
+};
+
+// Returns a fixed size, and counts how often it's called.
+class FixedEstimator : public PatchSizeEstimator {
+ public:
+  explicit FixedEstimator(uint32_t size, uint32_t* calls)
+      : size_(size), calls_(calls) {}
+
+  StatusOr<uint32_t> EstimatePatchSize(const btree_set<uint32_t>&) override {
+    (*calls_)++;
+    return size_;
+  }
+
+ private:
+  uint32_t size_;
+  uint32_t* calls_;
+};
+
+TEST_F(PatchSizeEstimatorTest, RawSize_CloseToExact) {
+  btree_set<uint32_t> sample;
+  for (uint32_t gid = 37; gid < 100; gid++) {
+    sample.insert(gid);
+  }
+  auto fast = RawSizePatchSizeEstimator::Create(roboto.get(), sample);
+  ASSERT_TRUE(fast.ok()) << fast.status();
+  ASSERT_GT((*fast)->CompressionRatio(), 0.0);
+  ASSERT_LT((*fast)->CompressionRatio(), 1.0);
+
+  BrotliPatchSizeEstimator exact(roboto.get());
+  btree_set<uint32_t> gids = {69, 70, 71, 72, 73, 74, 75, 76};
+  uint32_t exact_size = *exact.EstimatePatchSize(gids);
+  uint32_t fast_size = *(*fast)->EstimatePatchSize(gids);
+
+  ASSERT_GT(fast_size, exact_size / 2);
+  ASSERT_LT(fast_size, exact_size * 2);
+}
+
+TEST_F(PatchSizeEstimatorTest, Threshold_ExactOnlyWhenNear) {
+  uint32_t fast_calls = 0;
+  uint32_t exact_calls = 0;
+  auto make = [&](uint32_t fast_size) {
+    return ThresholdPatchSizeEstimator(
+        std::make_unique<FixedEstimator>(fast_size, &fast_calls),
+        std::make_unique<FixedEstimator>(1234, &exact_calls), 1000, 10000);
+  };
+
+  // Far below min.
+  ASSERT_EQ(*make(100).EstimatePatchSize({}), 100);
+  ASSERT_EQ(exact_calls, 0);
+
+  // Between the thresholds, but not near either.
+  ASSERT_EQ(*make(4000).EstimatePatchSize({}), 4000);
+  ASSERT_EQ(exact_calls, 0);
+
+  // Near min.
+  ASSERT_EQ(*make(900).EstimatePatchSize({}), 1234);
+  ASSERT_EQ(exact_calls, 1);
+
+  // Near max.
+  ASSERT_EQ(*make(12000).EstimatePatchSize({}), 1234);
+  ASSERT_EQ(exact_calls, 2);
+
+  // Far above max.
+  ASSERT_EQ(*make(50000).EstimatePatchSize({}), 50000);
+  ASSERT_EQ(exact_calls, 2);
+  ASSERT_EQ(fast_calls, 5);
+}
+
+TEST_F(PatchSizeEstimatorTest, Caching) {
+  uint32_t calls = 0;
+  CachingPatchSizeEstimator estimator(
+      std::make_unique<FixedEstimator>(100, &calls));
+
+  ASSERT_EQ(*estimator.EstimatePatchSize({1, 2}), 100);
+  ASSERT_EQ(*estimator.EstimatePatchSize({1, 2}), 100);
+  ASSERT_EQ(*estimator.EstimatePatchSize({1, 3}), 100);
+  ASSERT_EQ(*estimator.EstimatePatchSize({1, 2}), 100);
+
+  ASSERT_EQ(calls, 2);
+  ASSERT_EQ(estimator.CacheHits(), 2);
+  ASSERT_EQ(estimator.CacheMisses(), 2);
+}
+
+}  // namespace ift::encoder
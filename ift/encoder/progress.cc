@@ -0,0 +1,87 @@
+#include "ift/encoder/progress.h"
+
+#include <cstdint>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+using absl::MutexLock;
+using absl::Status;
+using absl::StrAppend;
+
+namespace ift::encoder {
+
+const char* Progress::Name(Counter counter) {
+  switch (counter) {
+    case NODES_DONE:
+      return "nodes_done";
+    case NODES_TOTAL:
+      return "nodes_total";
+    case PATCHES_EMITTED:
+      return "patches_emitted";
+    case PATCHES_TOTAL:
+      return "patches_total";
+    case SEGMENTS_ANALYZED:
+      return "segments_analyzed";
+    case SEGMENTS_TOTAL:
+      return "segments_total";
+    case MERGES_ATTEMPTED:
+      return "merges_attempted";
+    case MERGES_DONE:
+      return "merges_done";
+    default:
+      return "unknown";
+  }
+}
+
+void Progress::SetDeadline(absl::Time deadline) {
+  MutexLock lock(&mutex_);
+  deadline_ = deadline;
+}
+
+Status Progress::Check() const {
+  if (cancelled_.load(std::memory_order_relaxed)) {
+    return absl::CancelledError("Cancelled.");
+  }
+  MutexLock lock(&mutex_);
+  if (absl::Now() >= deadline_) {
+    return absl::DeadlineExceededError("Deadline exceeded.");
+  }
+  return absl::OkStatus();
+}
+
+void Progress::Add(Counter counter, uint64_t value) {
+  {
+    MutexLock lock(&mutex_);
+    counters_[counter] += value;
+    if (!callback_) {
+      return;
+    }
+    absl::Time now = absl::Now();
+    if (now - last_callback_ < min_interval_) {
+      return;
+    }
+    last_callback_ = now;
+  }
+  callback_(*this);
+}
+
+uint64_t Progress::Get(Counter counter) const {
+  MutexLock lock(&mutex_);
+  return counters_[counter];
+}
+
+std::string Progress::ToString() const {
+  std::string out;
+  for (uint32_t i = 0; i < NUM_COUNTERS; i++) {
+    Counter counter = (Counter)i;
+    StrAppend(&out, i ? " " : "", Name(counter), "=", Get(counter));
+  }
+  return out;
+}
+
+}  // namespace ift::encoder
@@ -0,0 +1,97 @@
+#ifndef IFT_ENCODER_PROGRESS_H_
+#define IFT_ENCODER_PROGRESS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+namespace ift::encoder {
+
+/*
+ * Reports the progress of a long running encode (see Encoder::SetProgress())
+ * or segmentation (see GlyphSegmentation::CodepointToGlyphSegments()) and
+ * allows it to be stopped early, either on request or once a deadline has
+ * passed. A stopped operation returns a cancelled or deadline exceeded error.
+ * Work which was already completed (patches passed to a sink, the subset cache,
+ * segmentation checkpoints) is kept so a later run can resume from it.
+ *
+ * Methods are thread safe.
+ */
+class Progress {
+ public:
+  enum Counter {
+    // Graph nodes which have been built, out of the number which need to be.
+    NODES_DONE = 0,
+    NODES_TOTAL,
+    // Patches which have been passed to the sink, out of the number planned.
+    PATCHES_EMITTED,
+    PATCHES_TOTAL,
+    // Codepoint segments whose closure has been analyzed.
+    SEGMENTS_ANALYZED,
+    SEGMENTS_TOTAL,
+    // Segment merges which were tried, and those which were kept.
+    MERGES_ATTEMPTED,
+    MERGES_DONE,
+    NUM_COUNTERS,
+  };
+
+  using Callback = std::function<void(Progress&)>;
+
+  Progress() = default;
+
+  /*
+   * callback is invoked after a counter changes, at most once per
+   * min_interval. It runs on whichever thread made the change so should be
+   * quick. It may call Cancel(), but must not update the counters.
+   */
+  explicit Progress(Callback callback,
+                    absl::Duration min_interval = absl::ZeroDuration())
+      : callback_(std::move(callback)), min_interval_(min_interval) {}
+
+  Progress(const Progress&) = delete;
+  Progress& operator=(const Progress&) = delete;
+
+  static const char* Name(Counter counter);
+
+  // Requests that the operation stops as soon as possible. Safe to call from a
+  // signal handler.
+  void Cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+
+  void SetDeadline(absl::Time deadline);
+
+  /*
+   * Returns a cancelled error if Cancel() has been called or a deadline
+   * exceeded error once the deadline has passed, otherwise ok. Checked
+   * periodically by the operation being run.
+   */
+  absl::Status Check() const;
+
+  void Add(Counter counter, uint64_t value = 1);
+  uint64_t Get(Counter counter) const;
+
+  // Returns all of the counters as a single line, for logging.
+  std::string ToString() const;
+
+ private:
+  static_assert(std::atomic<bool>::is_always_lock_free);
+  std::atomic<bool> cancelled_ = false;
+
+  Callback callback_;
+  absl::Duration min_interval_;
+
+  mutable absl::Mutex mutex_;
+  absl::Time deadline_ ABSL_GUARDED_BY(mutex_) = absl::InfiniteFuture();
+  absl::Time last_callback_ ABSL_GUARDED_BY(mutex_) = absl::InfinitePast();
+  uint64_t counters_[NUM_COUNTERS] ABSL_GUARDED_BY(mutex_) = {};
+};
+
+}  // namespace ift::encoder
+
+#endif  // IFT_ENCODER_PROGRESS_H_
@@ -0,0 +1,70 @@
+#include "ift/encoder/progress.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+
+namespace ift::encoder {
+
+TEST(ProgressTest, Counters) {
+  Progress progress;
+  ASSERT_EQ(progress.Get(Progress::NODES_DONE), 0);
+
+  progress.Add(Progress::NODES_TOTAL, 10);
+  progress.Add(Progress::NODES_DONE);
+  progress.Add(Progress::NODES_DONE);
+  progress.Add(Progress::MERGES_ATTEMPTED, 3);
+
+  EXPECT_EQ(progress.Get(Progress::NODES_DONE), 2);
+  EXPECT_EQ(progress.Get(Progress::NODES_TOTAL), 10);
+  EXPECT_EQ(progress.Get(Progress::MERGES_ATTEMPTED), 3);
+  EXPECT_EQ(progress.Get(Progress::PATCHES_EMITTED), 0);
+
+  EXPECT_EQ(progress.ToString(),
+            "nodes_done=2 nodes_total=10 patches_emitted=0 patches_total=0 "
+            "segments_analyzed=0 segments_total=0 merges_attempted=3 "
+            "merges_done=0");
+}
+
+TEST(ProgressTest, Callback) {
+  std::vector<uint64_t> seen;
+  Progress progress([&](const Progress& p) {
+    seen.push_back(p.Get(Progress::PATCHES_EMITTED));
+  });
+
+  progress.Add(Progress::PATCHES_EMITTED);
+  progress.Add(Progress::PATCHES_EMITTED);
+  EXPECT_EQ(seen, (std::vector<uint64_t>{1, 2}));
+
+  // Rate limited.
+  seen.clear();
+  Progress limited(
+      [&](const Progress& p) {
+        seen.push_back(p.Get(Progress::PATCHES_EMITTED));
+      },
+      absl::Hours(1));
+  limited.Add(Progress::PATCHES_EMITTED);
+  limited.Add(Progress::PATCHES_EMITTED);
+  EXPECT_EQ(seen, (std::vector<uint64_t>{1}));
+}
+
+TEST(ProgressTest, Cancel) {
+  Progress progress;
+  ASSERT_TRUE(progress.Check().ok());
+  progress.Cancel();
+  ASSERT_TRUE(absl::IsCancelled(progress.Check()));
+}
+
+TEST(ProgressTest, Deadline) {
+  Progress progress;
+  progress.SetDeadline(absl::Now() + absl::Hours(1));
+  ASSERT_TRUE(progress.Check().ok());
+  progress.SetDeadline(absl::Now() - absl::Seconds(1));
+  ASSERT_TRUE(absl::IsDeadlineExceeded(progress.Check()));
+}
+
+}  // namespace ift::encoder
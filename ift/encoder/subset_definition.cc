@@ -2,9 +2,12 @@
 
 #include "absl/container/btree_set.h"
 #include "common/font_helper.h"
+#include "common/hb_set_unique_ptr.h"
 
 using absl::btree_set;
+using common::add_to_hb_set;
 using common::FontHelper;
+using common::RangeSet;
 using ift::proto::PatchMap;
 
 namespace ift::encoder {
@@ -12,13 +15,8 @@ namespace ift::encoder {
 void PrintTo(const SubsetDefinition& def, std::ostream* os) {
   *os << "[{";
 
-  btree_set<uint32_t> sorted;
-  for (uint32_t cp : def.codepoints) {
-    sorted.insert(cp);
-  }
-
   bool first = true;
-  for (uint32_t cp : sorted) {
+  for (uint32_t cp : def.codepoints) {
     if (!first) {
       *os << ", ";
     }
@@ -45,6 +43,12 @@ void PrintTo(const SubsetDefinition& def, std::ostream* os) {
   *os << "]";
 }
 
+static void AddToHbSet(const RangeSet& values, hb_set_t* set) {
+  for (const auto& range : values.Ranges()) {
+    hb_set_add_range(set, range.first, range.last);
+  }
+}
+
 template <typename S>
 S subtract(const S& a, const S& b) {
   S c;
@@ -85,17 +89,15 @@ design_space_t subtract(const design_space_t& a, const design_space_t& b) {
 }
 
 void SubsetDefinition::Subtract(const SubsetDefinition& other) {
-  codepoints = subtract(codepoints, other.codepoints);
-  gids = subtract(gids, other.gids);
+  codepoints.Subtract(other.codepoints);
+  gids.Subtract(other.gids);
   feature_tags = subtract(feature_tags, other.feature_tags);
   design_space = subtract(design_space, other.design_space);
 }
 
 void SubsetDefinition::Union(const SubsetDefinition& other) {
-  std::copy(other.codepoints.begin(), other.codepoints.end(),
-            std::inserter(codepoints, codepoints.begin()));
-  std::copy(other.gids.begin(), other.gids.end(),
-            std::inserter(gids, gids.begin()));
+  codepoints.Union(other.codepoints);
+  gids.Union(other.gids);
   std::copy(other.feature_tags.begin(), other.feature_tags.end(),
             std::inserter(feature_tags, feature_tags.begin()));
 
@@ -120,16 +122,9 @@ void SubsetDefinition::Union(const SubsetDefinition& other) {
 
 void SubsetDefinition::ConfigureInput(hb_subset_input_t* input,
                                       hb_face_t* face) const {
-  hb_set_t* unicodes = hb_subset_input_unicode_set(input);
-  for (hb_codepoint_t cp : codepoints) {
-    hb_set_add(unicodes, cp);
-  }
-
-  hb_set_t* features =
-      hb_subset_input_set(input, HB_SUBSET_SETS_LAYOUT_FEATURE_TAG);
-  for (hb_tag_t tag : feature_tags) {
-    hb_set_add(features, tag);
-  }
+  AddToHbSet(codepoints, hb_subset_input_unicode_set(input));
+  add_to_hb_set(feature_tags,
+                hb_subset_input_set(input, HB_SUBSET_SETS_LAYOUT_FEATURE_TAG));
 
   for (const auto& [tag, range] : design_space) {
     hb_subset_input_set_axis_range(input, face, tag, range.start(), range.end(),
@@ -142,9 +137,7 @@ void SubsetDefinition::ConfigureInput(hb_subset_input_t* input,
 
   hb_set_t* gids_set = hb_subset_input_glyph_set(input);
   hb_set_add(gids_set, 0);
-  for (hb_codepoint_t gid : gids) {
-    hb_set_add(gids_set, gid);
-  }
+  AddToHbSet(gids, gids_set);
 }
 
 PatchMap::Coverage SubsetDefinition::ToCoverage() const {
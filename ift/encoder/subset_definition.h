@@ -8,6 +8,7 @@
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "common/axis_range.h"
+#include "common/range_set.h"
 #include "hb-subset.h"
 #include "ift/proto/patch_map.h"
 
@@ -17,11 +18,8 @@ typedef absl::flat_hash_map<hb_tag_t, common::AxisRange> design_space_t;
 
 struct SubsetDefinition {
   SubsetDefinition() {}
-  SubsetDefinition(std::initializer_list<uint32_t> codepoints_in) {
-    for (uint32_t cp : codepoints_in) {
-      codepoints.insert(cp);
-    }
-  }
+  SubsetDefinition(std::initializer_list<uint32_t> codepoints_in)
+      : codepoints(codepoints_in) {}
 
   template <typename T>
   static SubsetDefinition Codepoints(const T& codepoints) {
@@ -32,8 +30,10 @@ struct SubsetDefinition {
 
   friend void PrintTo(const SubsetDefinition& point, std::ostream* os);
 
-  absl::flat_hash_set<uint32_t> codepoints;
-  absl::flat_hash_set<uint32_t> gids;
+  // Stored as range sets: segments are typically runs of codepoints, unions
+  // and subtractions are linear merges, and copies share storage.
+  common::RangeSet codepoints;
+  common::RangeSet gids;
   absl::btree_set<hb_tag_t> feature_tags;
   design_space_t design_space;
 
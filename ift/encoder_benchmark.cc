@@ -0,0 +1,210 @@
+#include <sys/resource.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/status/status.h"
+#include "benchmark/benchmark.h"
+#include "common/axis_range.h"
+#include "common/cmap_index.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "common/hb_set_unique_ptr.h"
+#include "hb.h"
+#include "ift/encoder/condition.h"
+#include "ift/encoder/encoder.h"
+#include "ift/encoder/subset_definition.h"
+#include "ift/testdata/test_segments.h"
+
+using absl::btree_set;
+using absl::Status;
+using common::AxisRange;
+using common::CmapIndex;
+using common::FontData;
+using common::hb_face_unique_ptr;
+using common::hb_set_unique_ptr;
+using common::make_hb_blob;
+using common::make_hb_set;
+using ift::encoder::Condition;
+using ift::encoder::Encoder;
+using ift::encoder::SubsetDefinition;
+using ift::testdata::TestSegment1;
+using ift::testdata::TestSegment2;
+using ift::testdata::TestSegment3;
+using ift::testdata::TestSegment4;
+using ift::testdata::TestVfSegment1;
+using ift::testdata::TestVfSegment2;
+using ift::testdata::TestVfSegment3;
+using ift::testdata::TestVfSegment4;
+
+namespace {
+
+constexpr hb_tag_t kWght = HB_TAG('w', 'g', 'h', 't');
+
+FontData LoadFont(const char* path) {
+  FontData font;
+  auto blob = make_hb_blob(hb_blob_create_from_file(path));
+  font.set(blob.get());
+  return font;
+}
+
+/*
+ * Returns the glyphs of face split into the four checked in test segments plus
+ * an init segment (first) holding all other glyphs, as in the integration
+ * tests.
+ */
+std::vector<btree_set<uint32_t>> GlyphSegments(
+    hb_face_t* face, std::vector<btree_set<uint32_t>> test_segments) {
+  hb_set_unique_ptr init = make_hb_set();
+  hb_set_add_range(init.get(), 0, hb_face_get_glyph_count(face) - 1);
+  for (const auto& segment : test_segments) {
+    for (uint32_t gid : segment) {
+      hb_set_del(init.get(), gid);
+    }
+  }
+  test_segments.insert(test_segments.begin(),
+                       common::to_btree_set(init.get()));
+  return test_segments;
+}
+
+std::vector<btree_set<uint32_t>> Codepoints(
+    hb_face_t* face, const std::vector<btree_set<uint32_t>>& glyph_segments) {
+  std::vector<btree_set<uint32_t>> result;
+  CmapIndex cmap(face);
+  for (const auto& segment : glyph_segments) {
+    result.push_back(cmap.CodepointsFor(segment));
+  }
+  return result;
+}
+
+/*
+ * Configures encoder for a mixed mode encoding of face: a glyph patch for
+ * each glyph segment (see GlyphSegments()) and two table keyed segments ({2},
+ * {3, 4}) on top of a base subset holding segments 0 and 1.
+ */
+Status ConfigureMixedMode(
+    hb_face_t* face, const std::vector<btree_set<uint32_t>>& glyph_segments,
+    SubsetDefinition base, Encoder& encoder) {
+  encoder.SetFace(face);
+
+  Status sc = absl::OkStatus();
+  for (uint32_t i = 0; i < glyph_segments.size(); i++) {
+    sc.Update(encoder.AddGlyphDataPatch(i, glyph_segments[i]));
+  }
+
+  auto segments = Codepoints(face, glyph_segments);
+  base.codepoints.insert(segments[0].begin(), segments[0].end());
+  base.codepoints.insert(segments[1].begin(), segments[1].end());
+  sc.Update(encoder.SetBaseSubsetFromDef(base));
+
+  encoder.AddNonGlyphDataSegment(segments[2]);
+  auto segment_3_and_4 = segments[3];
+  segment_3_and_4.insert(segments[4].begin(), segments[4].end());
+  encoder.AddNonGlyphDataSegment(segment_3_and_4);
+
+  for (uint32_t i = 2; i <= 4; i++) {
+    sc.Update(encoder.AddGlyphDataPatchCondition(Condition::SimpleCondition(
+        SubsetDefinition::Codepoints(segments[i]), i)));
+  }
+  return sc;
+}
+
+/*
+ * Runs encoder.Encode() once per iteration and reports encoded patches per
+ * second along with the peak resident memory of the process.
+ */
+void RunEncode(benchmark::State& state, Encoder& encoder) {
+  encoder.SetNumThreads(state.range(0));
+
+  uint64_t patches = 0;
+  for (auto _ : state) {
+    auto encoding = encoder.Encode();
+    if (!encoding.ok()) {
+      state.SkipWithError(encoding.status().ToString().c_str());
+      return;
+    }
+    patches += encoding->patches.size();
+    benchmark::DoNotOptimize(encoding->init_font);
+  }
+
+  state.counters["patches"] =
+      benchmark::Counter(patches, benchmark::Counter::kIsRate);
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  // ru_maxrss is in kilobytes on linux.
+  state.counters["peak_rss_bytes"] = benchmark::Counter(
+      (double)usage.ru_maxrss * 1024, benchmark::Counter::kDefaults,
+      benchmark::Counter::kIs1024);
+}
+
+void ThreadCounts(benchmark::internal::Benchmark* b) {
+  b->ArgName("threads")->Arg(1)->Arg(4);
+  b->Unit(benchmark::kMillisecond)->UseRealTime();
+}
+
+void BM_EncodeTableKeyed(benchmark::State& state) {
+  FontData font = LoadFont("ift/testdata/NotoSansJP-Regular.subset.ttf");
+  hb_face_unique_ptr face = font.face();
+  auto segments = Codepoints(
+      face.get(),
+      GlyphSegments(face.get(), {TestSegment1(), TestSegment2(),
+                                 TestSegment3(), TestSegment4()}));
+
+  Encoder encoder;
+  encoder.SetFace(face.get());
+  Status sc = encoder.SetBaseSubset(segments[0]);
+  if (!sc.ok()) {
+    state.SkipWithError(sc.ToString().c_str());
+    return;
+  }
+  for (uint32_t i = 1; i < segments.size(); i++) {
+    encoder.AddNonGlyphDataSegment(segments[i]);
+  }
+  RunEncode(state, encoder);
+}
+BENCHMARK(BM_EncodeTableKeyed)->Apply(ThreadCounts);
+
+void BM_EncodeMixedMode(benchmark::State& state) {
+  FontData font = LoadFont("ift/testdata/NotoSansJP-Regular.subset.ttf");
+  hb_face_unique_ptr face = font.face();
+
+  Encoder encoder;
+  Status sc = ConfigureMixedMode(
+      face.get(),
+      GlyphSegments(face.get(), {TestSegment1(), TestSegment2(),
+                                 TestSegment3(), TestSegment4()}),
+      {}, encoder);
+  if (!sc.ok()) {
+    state.SkipWithError(sc.ToString().c_str());
+    return;
+  }
+  RunEncode(state, encoder);
+}
+BENCHMARK(BM_EncodeMixedMode)->Apply(ThreadCounts);
+
+void BM_EncodeDesignSpace(benchmark::State& state) {
+  FontData font = LoadFont("ift/testdata/NotoSansJP[wght].subset.ttf");
+  hb_face_unique_ptr face = font.face();
+
+  // Starts at a single weight, the full weight range is added by a design
+  // space segment.
+  SubsetDefinition base;
+  base.design_space = {{kWght, AxisRange::Point(100)}};
+  Encoder encoder;
+  Status sc = ConfigureMixedMode(
+      face.get(),
+      GlyphSegments(face.get(), {TestVfSegment1(), TestVfSegment2(),
+                                 TestVfSegment3(), TestVfSegment4()}),
+      base, encoder);
+  if (!sc.ok()) {
+    state.SkipWithError(sc.ToString().c_str());
+    return;
+  }
+  encoder.AddDesignSpaceSegment({{kWght, *AxisRange::Range(100, 900)}});
+  RunEncode(state, encoder);
+}
+BENCHMARK(BM_EncodeDesignSpace)->Apply(ThreadCounts);
+
+}  // namespace
@@ -1,5 +1,8 @@
 #include "ift/feature_registry/feature_registry.h"
 
+#include <cstdint>
+#include <iterator>
+
 #include "gtest/gtest.h"
 
 namespace ift::feature_registry {
@@ -41,6 +44,18 @@ TEST_F(FeatureRegistryTest, IndexToFeatureTag) {
   ASSERT_EQ(IndexToFeatureTag(241), HB_TAG('c', 'v', '9', '9'));
 }
 
+TEST_F(FeatureRegistryTest, ConstantEvaluated) {
+  // The tables are usable at compile time so lookups need no initialization.
+  static_assert(FeatureTagToIndex(HB_TAG('a', 'b', 'v', 'f')) == 1);
+  static_assert(IndexToFeatureTag(1) == HB_TAG('a', 'b', 'v', 'f'));
+  static_assert(IndexToFeatureTag(0) == 0);
+
+  // Every index round trips.
+  for (uint32_t index = 1; index <= std::size(kIndexToFeatureTag); index++) {
+    ASSERT_EQ(FeatureTagToIndex(IndexToFeatureTag(index)), index);
+  }
+}
+
 TEST_F(FeatureRegistryTest, FeatureTagToIndex_NotFound) {
   ASSERT_EQ(FeatureTagToIndex(HB_TAG('x', 'x', 'x', 'x')),
             HB_TAG('x', 'x', 'x', 'x'));
@@ -2,80 +2,133 @@ import csv
 import re
 import sys
 
-def print_mapping(reversed=False):
+def tag_value(tag):
+  return (ord(tag[0]) << 24) | (ord(tag[1]) << 16) | (ord(tag[2]) << 8) | ord(tag[3])
+
+# Returns (tag, index) for every registry entry in index order. Indices are
+# assigned consecutively starting from 1.
+def load_mapping():
   with open(sys.argv[1]) as r:
     reader = csv.reader(r, delimiter=",")
     lines = [row for row in reader]
 
-    i = 1
-    for is_default in [True, False]:
-      version = 1
-      for row in lines:
-        if row[0].startswith("VERSION_2"):
-          version = 2
-          continue
+  mapping = []
+  i = 1
+  for is_default in [True, False]:
+    for row in lines:
+      if row[0].startswith("VERSION_2"):
+        continue
+
+      if row[0] == "Tag" or row[0].startswith("#"):
+        continue
 
-        if row[0] == "Tag" or row[0].startswith("#"):
-          continue
+      if is_default != (int(row[2]) == 1):
+        continue
 
-        if is_default != (int(row[2]) == 1):
-          continue
+      m = re.search("[a-z]{2}([0-9]{2})-[a-z]{2}([0-9]{2})", row[0])
+      if m:
+        start = i
+        end = i + (int(m.group(2)) - int(m.group(1)))
+        i += end - start + 1
+      else:
+        start = i
+        end = i
+        i += 1
 
-        m = re.search("[a-z]{2}([0-9]{2})-[a-z]{2}([0-9]{2})", row[0])
-        if m:
-          start = i
-          end = i + (int(m.group(2)) - int(m.group(1)))
-          i += end - start + 1
+      count = 1
+      for v in range(start, end + 1):
+        if start == end:
+          tag = row[0][0:4]
         else:
-          start = i
-          end = i
-          i += 1
+          tag = row[0][0:2] + f"{count:02}"
+        mapping.append((tag, v))
+        count += 1
+
+  return mapping
+
+def tag_str(tag):
+  return f"HB_TAG('{tag[0]}', '{tag[1]}', '{tag[2]}', '{tag[3]}')"
 
-        count = 1
-        for v in range(start, end + 1):
-          if start == end:
-            tag_str = f"HB_TAG('{row[0][0]}', '{row[0][1]}', '{row[0][2]}', '{row[0][3]}')"
-          else:
-            v_str = f"{count:02}"
-            tag_str = f"HB_TAG('{row[0][0]}', '{row[0][1]}', '{v_str[0]}', '{v_str[1]}')"
 
-          if not reversed:
-            print(f"    {{ {tag_str}, {v} }},")
-          else:
-            print(f"    {{ {v}, {tag_str} }},")
-          count += 1
+mapping = load_mapping()
+for n, (_, index) in enumerate(mapping):
+  assert index == n + 1, "indices must be consecutive"
 
+# Sort by tag value for binary searching, the sort is stable so for duplicate
+# tags the lowest index is found.
+by_tag = sorted(mapping, key=lambda entry: tag_value(entry[0]))
 
 print("#ifndef IFT_FEATURE_REGISTRY_FEATURE_REGISTRY_H_")
 print("#define IFT_FEATURE_REGISTRY_FEATURE_REGISTRY_H_")
 print("")
+print("#include <cstddef>")
+print("#include <cstdint>")
+print("#include <iterator>")
+print("")
 print("#include \"hb.h\"")
-print("#include \"absl/base/no_destructor.h\"")
-print("#include \"absl/container/flat_hash_map.h\"")
 print("")
 print("namespace ift::feature_registry {")
 print("")
-print("static const uint32_t FeatureTagToIndex(hb_tag_t tag) {")
-print("  static const absl::NoDestructor<absl::flat_hash_map<uint32_t, uint32_t>> kFeatureTagToIndex({")
-print_mapping(False)
-print("  });")
-print("  auto it = kFeatureTagToIndex->find(tag);")
-print("  if (it == kFeatureTagToIndex->end()) {")
+print("// Generated by registry_to_cc.py, the tables are constant initialized so no")
+print("// work is needed at start up and they're shared across processes.")
+print("")
+print("struct FeatureTagIndex {")
+print("  hb_tag_t tag;")
+print("  uint32_t index;")
+print("};")
+print("")
+print("// Sorted by tag.")
+print("inline constexpr FeatureTagIndex kFeatureTagToIndex[] = {")
+for tag, index in by_tag:
+  print(f"    {{ {tag_str(tag)}, {index} }},")
+print("};")
+print("")
+print("// The tag of index i is kIndexToFeatureTag[i - 1].")
+print("inline constexpr hb_tag_t kIndexToFeatureTag[] = {")
+for tag, index in mapping:
+  print(f"    {tag_str(tag)},  // {index}")
+print("};")
+print("")
+print("// std::is_sorted and std::lower_bound aren't constexpr until C++20 so the")
+print("// sortedness check and binary search are written out by hand.")
+print("constexpr bool IsSortedByTag() {")
+print("  for (size_t i = 1; i < std::size(kFeatureTagToIndex); i++) {")
+print("    if (kFeatureTagToIndex[i].tag < kFeatureTagToIndex[i - 1].tag) {")
+print("      return false;")
+print("    }")
+print("  }")
+print("  return true;")
+print("}")
+print("")
+print("static_assert(IsSortedByTag(), \"kFeatureTagToIndex must be sorted by tag\");")
+print("")
+print("// Returns the registry index of tag, or tag itself if it isn't registered.")
+print("constexpr uint32_t FeatureTagToIndex(hb_tag_t tag) {")
+print("  // Finds the first entry whose tag is not less than tag.")
+print("  size_t low = 0;")
+print("  size_t high = std::size(kFeatureTagToIndex);")
+print("  while (low < high) {")
+print("    size_t mid = low + (high - low) / 2;")
+print("    if (kFeatureTagToIndex[mid].tag < tag) {")
+print("      low = mid + 1;")
+print("    } else {")
+print("      high = mid;")
+print("    }")
+print("  }")
+print("  if (low == std::size(kFeatureTagToIndex) ||")
+print("      kFeatureTagToIndex[low].tag != tag) {")
 print("    return tag;")
 print("  }")
-print("  return it->second;")
+print("  return kFeatureTagToIndex[low].index;")
 print("}")
 print("")
-print("static const hb_tag_t IndexToFeatureTag(uint32_t index) {")
-print("  static const absl::NoDestructor<absl::flat_hash_map<uint32_t, uint32_t>> kIndexToFeatureTag({")
-print_mapping(True)
-print("  });")
-print("  auto it = kIndexToFeatureTag->find(index);")
-print("  if (it == kIndexToFeatureTag->end()) {")
+print("// Returns the tag of a registry index, or index itself if it isn't one.")
+print("constexpr hb_tag_t IndexToFeatureTag(uint32_t index) {")
+print("  if (index == 0 || index > std::size(kIndexToFeatureTag)) {")
 print("    return index;")
 print("  }")
-print("  return it->second;")
+print("  return kIndexToFeatureTag[index - 1];")
 print("}")
 print("")
 print("}  // namespace ift::feature_registry")
-print("#endif  // IFT_FEATURE_REGISTRY_FEATURE_REGISTRY_H_")
\ No newline at end of file
+print("#endif  // IFT_FEATURE_REGISTRY_FEATURE_REGISTRY_H_")
@@ -2,15 +2,26 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/hash/hash.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "common/brotli_binary_diff.h"
 #include "common/compat_id.h"
 #include "common/font_data.h"
 #include "common/font_helper.h"
+#include "common/glyph_data_index.h"
+#include "common/trace.h"
+#include "common/try.h"
 #include "ift/proto/ift_table.h"
 #include "ift/proto/patch_map.h"
 
@@ -19,6 +30,7 @@ using absl::flat_hash_set;
 using absl::Status;
 using absl::StatusOr;
 using absl::StrCat;
+using absl::string_view;
 using common::BrotliBinaryDiff;
 using common::CompatId;
 using common::FontData;
@@ -27,17 +39,113 @@ using common::hb_blob_unique_ptr;
 using common::hb_face_unique_ptr;
 using common::make_hb_blob;
 using common::make_hb_face;
+using common::TraceSpan;
 using ift::proto::IFTTable;
 using ift::proto::PatchMap;
 
 namespace ift {
 
+namespace {
+
+// Writes the low kBytes bytes of value big endian to out, returns the position
+// following them.
+template <unsigned kBytes>
+char* WriteBigEndian(uint32_t value, char* out) {
+  for (unsigned i = 0; i < kBytes; i++) {
+    out[i] = (char)(value >> (8 * (kBytes - 1 - i)));
+  }
+  return out + kBytes;
+}
+
+// Writes gids as kGidBytes wide big endian integers. Specialized on the width
+// so the per glyph loop is branch free.
+template <unsigned kGidBytes>
+char* WriteGlyphIds(const btree_set<uint32_t>& gids, char* out) {
+  for (uint32_t gid : gids) {
+    out = WriteBigEndian<kGidBytes>(gid, out);
+  }
+  return out;
+}
+
+// Copies glyph_data to out. Consecutive glyphs are usually stored next to
+// each other in the source table, so each run of adjacent data is copied
+// with a single memcpy.
+char* CopyGlyphData(const std::vector<string_view>& glyph_data, char* out) {
+  auto it = glyph_data.begin();
+  while (it != glyph_data.end()) {
+    const char* start = it->data();
+    size_t size = it->size();
+    for (it++; it != glyph_data.end() && it->data() == start + size; it++) {
+      size += it->size();
+    }
+    if (size) {
+      memcpy(out, start, size);
+      out += size;
+    }
+  }
+  return out;
+}
+
+}  // namespace
+
+bool GlyphKeyedStreamCache::Find(string_view stream, FontData& compressed) {
+  absl::MutexLock lock(&mutex_);
+  uint64_t key = absl::HashOf(stream);
+  auto it = entries_.find(key);
+  if (it == entries_.end() || it->second.stream != stream) {
+    return false;
+  }
+  hits_++;
+  lru_.erase(std::pair(it->second.last_used, key));
+  it->second.last_used = clock_++;
+  lru_.insert(std::pair(it->second.last_used, key));
+  compressed.shallow_copy(it->second.compressed);
+  return true;
+}
+
+void GlyphKeyedStreamCache::Insert(string_view stream,
+                                   const FontData& compressed) {
+  absl::MutexLock lock(&mutex_);
+  uint64_t key = absl::HashOf(stream);
+  auto it = entries_.find(key);
+  if (it != entries_.end() && it->second.stream == stream) {
+    return;
+  }
+  // On a hash collision the newer stream replaces the older one.
+  Forget(key);
+
+  Entry& entry = entries_[key];
+  entry.stream = std::string(stream);
+  entry.compressed.shallow_copy(compressed);
+  entry.last_used = clock_++;
+  lru_.insert(std::pair(entry.last_used, key));
+  size_ += stream.size() + compressed.size();
+  Evict();
+}
+
+void GlyphKeyedStreamCache::Forget(uint64_t key) {
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    return;
+  }
+  size_ -= it->second.stream.size() + it->second.compressed.size();
+  lru_.erase(std::pair(it->second.last_used, key));
+  entries_.erase(it);
+}
+
+void GlyphKeyedStreamCache::Evict() {
+  while (size_ > max_size_bytes_ && !lru_.empty()) {
+    Forget(lru_.begin()->second);
+  }
+}
+
 StatusOr<FontData> GlyphKeyedDiff::CreatePatch(
     const btree_set<uint32_t>& gids) const {
+  TraceSpan span("GlyphKeyedDiff::CreatePatch");
   // TODO(garretrieger): use write macros that check for overflows.
-  std::string patch;
-  FontHelper::WriteUInt32(HB_TAG('i', 'f', 'g', 'k'), patch);  // Format Tag
-  FontHelper::WriteUInt32(0, patch);                           // Reserved.
+  std::string header;
+  FontHelper::WriteUInt32(HB_TAG('i', 'f', 'g', 'k'), header);  // Format Tag
+  FontHelper::WriteUInt32(0, header);                           // Reserved.
 
   if (gids.empty()) {
     return absl::InvalidArgumentError(
@@ -55,129 +163,185 @@ StatusOr<FontData> GlyphKeyedDiff::CreatePatch(
   }
 
   // Flags
-  FontHelper::WriteUInt8(u16_gids ? 0b00000000 : 0b00000001, patch);
-  base_compat_id_.WriteTo(patch);  // Compat ID
+  FontHelper::WriteUInt8(u16_gids ? 0b00000000 : 0b00000001, header);
+  base_compat_id_.WriteTo(header);  // Compat ID
 
   auto uncompressed_data_stream = CreateDataStream(gids, u16_gids);
   if (!uncompressed_data_stream.ok()) {
     return uncompressed_data_stream.status();
   }
 
-  FontData empty;
-  FontData compressed_data_stream;
-  auto status = brotli_diff_.Diff(empty, *uncompressed_data_stream,
-                                  &compressed_data_stream);
-  if (!status.ok()) {
-    return status;
-  }
-
   // Max Uncompressed Length
-  FontHelper::WriteUInt32(uncompressed_data_stream->size(), patch);
-
-  // Compressed Data Stream
-  patch += compressed_data_stream.str();
+  FontHelper::WriteUInt32(uncompressed_data_stream->size(), header);
+
+  // The compressed data stream is appended directly after the header. Glyph
+  // data rarely compresses to more than its uncompressed size so reserving
+  // that avoids any reallocation while encoding.
+  std::vector<uint8_t> patch;
+  patch.reserve(header.size() + uncompressed_data_stream->size());
+  patch.insert(patch.end(), header.begin(), header.end());
+
+  FontData cached;
+  if (stream_cache_ &&
+      stream_cache_->Find(uncompressed_data_stream->str(), cached)) {
+    patch.insert(patch.end(), cached.data(), cached.data() + cached.size());
+  } else {
+    auto status = brotli_diff_.Diff(
+        dictionary_, uncompressed_data_stream->str(), 0, true, patch);
+    if (!status.ok()) {
+      return status;
+    }
+    if (stream_cache_) {
+      string_view compressed(
+          reinterpret_cast<const char*>(patch.data()) + header.size(),
+          patch.size() - header.size());
+      stream_cache_->Insert(uncompressed_data_stream->str(),
+                            FontData(compressed));
+    }
+  }
 
-  FontData result(patch);
+  FontData result;
+  result.take(std::move(patch));
   return result;
 }
 
-StatusOr<FontData> GlyphKeyedDiff::CreateDataStream(
-    const btree_set<uint32_t>& gids, bool u16_gids) const {
-  // check for unsupported tags.
-  for (auto tag : tags_) {
-    if (tag != FontHelper::kGlyf && tag != FontHelper::kGvar) {
-      return absl::InvalidArgumentError(
-          "Unsupported table type for glyph keyed diff.");
+StatusOr<FontData> GlyphKeyedDiff::TrainDictionary(
+    const FontData& font, const flat_hash_set<hb_tag_t>& included_tags,
+    uint32_t max_size) {
+  hb_face_unique_ptr face = font.face();
+  common::GlyphDataIndex glyph_data(face.get());
+  uint32_t glyph_count = hb_face_get_glyph_count(face.get());
+
+  std::vector<hb_tag_t> tags;
+  for (hb_tag_t tag :
+       {FontHelper::kCFF, FontHelper::kCFF2, FontHelper::kGlyf,
+        FontHelper::kGvar}) {
+    if (included_tags.contains(tag) && glyph_data.Has(tag)) {
+      tags.push_back(tag);
     }
   }
 
-  auto face = font_.face();
-  auto face_tags = FontHelper::GetTags(face.get());
-
-  btree_set<hb_tag_t> processed_tags;
-  std::string offset_data;
-  std::string per_glyph_data;
-
-  bool include_glyf = tags_.contains(FontHelper::kGlyf) &&
-                      face_tags.contains(FontHelper::kGlyf) &&
-                      face_tags.contains(FontHelper::kLoca);
-  bool include_gvar = tags_.contains(FontHelper::kGvar) &&
-                      face_tags.contains(FontHelper::kGvar);
-
-  uint32_t glyph_count = gids.size();
-  uint32_t glyph_id_width = u16_gids ? 2 : 3;
-  uint32_t table_count = (include_glyf ? 1 : 0) + (include_gvar ? 1 : 0);
-  uint32_t header_size = 5 + glyph_id_width * glyph_count + table_count * 4 +
-                         4 * glyph_count * table_count + 4;
-
-  if (tags_.contains(FontHelper::kCFF) &&
-      face_tags.contains(FontHelper::kCFF)) {
-    // TODO(garretrieger): add CFF support
-    return absl::UnimplementedError(
-        "CFF glyph keyed patching not yet implemented.");
+  uint64_t total_size = 0;
+  for (hb_tag_t tag : tags) {
+    for (uint32_t gid = 0; gid < glyph_count; gid++) {
+      total_size += TRY(glyph_data.GlyphData(tag, gid)).size();
+    }
   }
 
-  if (tags_.contains(FontHelper::kCFF2) &&
-      face_tags.contains(FontHelper::kCFF2)) {
-    // TODO(garretrieger): add CFF2 support
-    return absl::UnimplementedError(
-        "CFF2 glyph keyed patching not yet implemented.");
+  // Every step'th glyph is taken so the sample spans the whole font. Since
+  // brotli favours nearby matches the sampled glyphs are laid out back to
+  // front, which places the (typically more commonly used) low glyph ids at
+  // the end.
+  uint64_t step =
+      max_size ? std::max<uint64_t>(1, (total_size + max_size - 1) / max_size)
+               : 1;
+  std::vector<string_view> sample;
+  uint64_t sample_size = 0;
+  for (uint64_t gid = 0; gid < glyph_count && sample_size < max_size;
+       gid += step) {
+    for (hb_tag_t tag : tags) {
+      string_view data = TRY(glyph_data.GlyphData(tag, gid));
+      data = data.substr(0, max_size - sample_size);
+      sample.push_back(data);
+      sample_size += data.size();
+    }
   }
 
-  if (include_glyf) {
-    processed_tags.insert(FontHelper::kGlyf);
+  std::string dictionary;
+  dictionary.reserve(sample_size);
+  for (auto it = sample.rbegin(); it != sample.rend(); it++) {
+    dictionary.append(it->data(), it->size());
+  }
 
-    for (auto gid : gids) {
-      auto data = FontHelper::GlyfData(face.get(), gid);
-      if (!data.ok()) {
-        return data.status();
-      }
+  FontData result;
+  result.take(std::move(dictionary));
+  return result;
+}
 
-      FontHelper::WriteUInt32(header_size + per_glyph_data.size(), offset_data);
-      per_glyph_data += *data;
+StatusOr<FontData> GlyphKeyedDiff::CreateDataStream(
+    const btree_set<uint32_t>& gids, bool u16_gids) const {
+  // check for unsupported tags.
+  for (auto tag : tags_) {
+    if (tag != FontHelper::kGlyf && tag != FontHelper::kGvar &&
+        tag != FontHelper::kCFF && tag != FontHelper::kCFF2) {
+      return absl::InvalidArgumentError(
+          "Unsupported table type for glyph keyed diff.");
     }
   }
 
-  if (include_gvar) {
-    processed_tags.insert(FontHelper::kGvar);
-
-    for (auto gid : gids) {
-      auto data = FontHelper::GvarData(face.get(), gid);
-      if (!data.ok()) {
-        return data.status();
-      }
-
-      FontHelper::WriteUInt32(header_size + per_glyph_data.size(), offset_data);
-      per_glyph_data += *data;
+  bool include_cff =
+      tags_.contains(FontHelper::kCFF) && glyph_data_.Has(FontHelper::kCFF);
+  bool include_cff2 =
+      tags_.contains(FontHelper::kCFF2) && glyph_data_.Has(FontHelper::kCFF2);
+  bool include_glyf =
+      tags_.contains(FontHelper::kGlyf) && glyph_data_.Has(FontHelper::kGlyf);
+  bool include_gvar =
+      tags_.contains(FontHelper::kGvar) && glyph_data_.Has(FontHelper::kGvar);
+
+  // Per glyph data must be in the same order as the table tags, which are
+  // sorted.
+  const std::pair<bool, hb_tag_t> tables[] = {
+      {include_cff, FontHelper::kCFF},
+      {include_cff2, FontHelper::kCFF2},
+      {include_glyf, FontHelper::kGlyf},
+      {include_gvar, FontHelper::kGvar},
+  };
+
+  // Locate all of the glyph data first so the exact stream size is known and
+  // it can be written in a single pass into one allocation.
+  std::vector<hb_tag_t> processed_tags;
+  std::vector<string_view> glyph_data;
+  glyph_data.reserve(gids.size() * std::size(tables));
+  uint64_t glyph_data_size = 0;
+  for (const auto& [include, tag] : tables) {
+    if (!include) {
+      continue;
     }
+    processed_tags.push_back(tag);
+    glyph_data_size += TRY(glyph_data_.AppendGlyphData(tag, gids, glyph_data));
   }
 
-  // Add the trailing offset
-  FontHelper::WriteUInt32(header_size + per_glyph_data.size(), offset_data);
+  uint64_t glyph_count = gids.size();
+  uint64_t glyph_id_width = u16_gids ? 2 : 3;
+  uint64_t table_count = processed_tags.size();
+  uint64_t header_size = 5 + glyph_id_width * glyph_count + table_count * 4 +
+                         4 * glyph_count * table_count + 4;
+  uint64_t total_size = header_size + glyph_data_size;
+  if (total_size > UINT32_MAX) {
+    return absl::InvalidArgumentError(
+        "Glyph keyed data stream exceeds the maximum size.");
+  }
 
-  // Stream Construction
-  std::string stream;
-  FontHelper::WriteUInt32(gids.size(), stream);           // glyphCount
-  FontHelper::WriteUInt8(processed_tags.size(), stream);  // tableCount
+  // Stream Construction, written directly into the preallocated buffer.
+  std::string stream(total_size, '\0');
+  char* out = stream.data();
+  out = WriteBigEndian<4>(glyph_count, out);  // glyphCount
+  out = WriteBigEndian<1>(table_count, out);  // tableCount
 
   // glyphIds
-  for (auto gid : gids) {
-    if (u16_gids) {
-      FontHelper::WriteUInt16(gid, stream);
-    } else {
-      FontHelper::WriteUInt24(gid, stream);
-    }
-  }
+  out = u16_gids ? WriteGlyphIds<2>(gids, out) : WriteGlyphIds<3>(gids, out);
 
   // tables
   for (auto tag : processed_tags) {
-    FontHelper::WriteUInt32(tag, stream);
+    out = WriteBigEndian<4>(tag, out);
   }
 
-  stream += offset_data;
-  stream += per_glyph_data;
+  // glyphDataOffsets, including the trailing offset
+  uint32_t offset = header_size;
+  for (string_view data : glyph_data) {
+    out = WriteBigEndian<4>(offset, out);
+    offset += data.size();
+  }
+  out = WriteBigEndian<4>(offset, out);
+
+  // Glyph Data
+  out = CopyGlyphData(glyph_data, out);
+  if (out != stream.data() + stream.size()) {
+    return absl::InternalError("Glyph keyed data stream size mismatch.");
+  }
 
-  FontData result(stream);
+  FontData result;
+  result.take(std::move(stream));
   return result;
 }
 
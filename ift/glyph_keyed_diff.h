@@ -1,25 +1,140 @@
 #ifndef IFT_GLYPH_KEYED_DIFF_H_
 #define IFT_GLYPH_KEYED_DIFF_H_
 
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "common/brotli_binary_diff.h"
+#include "common/brotli_dictionary_cache.h"
 #include "common/compat_id.h"
 #include "common/font_data.h"
+#include "common/glyph_data_index.h"
 
 namespace ift {
 
+/*
+ * Caches compressed glyph keyed data streams keyed by their uncompressed
+ * contents. The data stream doesn't include the compatibility id, so the same
+ * segment in patch sets for different design spaces produces an identical
+ * stream whenever instancing left those glyphs unchanged. Sharing a cache
+ * between those diffs means each distinct stream is only compressed once.
+ *
+ * Entries are indexed by a hash of the stream, with the stream itself checked
+ * on lookup. Once the streams plus their compressed forms exceed
+ * max_size_bytes the least recently used entries are evicted.
+ *
+ * Only share a cache between diffs which use the same brotli options and
+ * dictionary. Methods are thread safe.
+ */
+class GlyphKeyedStreamCache {
+ public:
+  static constexpr uint64_t kDefaultMaxSizeBytes = 256 * 1024 * 1024;
+
+  explicit GlyphKeyedStreamCache(
+      uint64_t max_size_bytes = kDefaultMaxSizeBytes)
+      : max_size_bytes_(max_size_bytes) {}
+  GlyphKeyedStreamCache(const GlyphKeyedStreamCache&) = delete;
+  GlyphKeyedStreamCache& operator=(const GlyphKeyedStreamCache&) = delete;
+
+  // If a compressed form of stream is cached sets 'compressed' to it and
+  // returns true.
+  bool Find(absl::string_view stream, common::FontData& compressed);
+
+  void Insert(absl::string_view stream, const common::FontData& compressed);
+
+  uint32_t Hits() {
+    absl::MutexLock lock(&mutex_);
+    return hits_;
+  }
+
+  // Total size in bytes of the cached streams and their compressed forms.
+  uint64_t Size() {
+    absl::MutexLock lock(&mutex_);
+    return size_;
+  }
+
+ private:
+  struct Entry {
+    std::string stream;
+    common::FontData compressed;
+    uint64_t last_used;
+  };
+
+  // Removes the entry for key, if any.
+  void Forget(uint64_t key) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Removes the least recently used entries until the total is within
+  // max_size_bytes_.
+  void Evict() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const uint64_t max_size_bytes_;
+
+  absl::Mutex mutex_;
+  absl::flat_hash_map<uint64_t, Entry> entries_ ABSL_GUARDED_BY(mutex_);
+  // (last_used, key) for every entry in entries_, oldest first.
+  absl::btree_set<std::pair<uint64_t, uint64_t>> lru_ ABSL_GUARDED_BY(mutex_);
+  uint64_t size_ ABSL_GUARDED_BY(mutex_) = 0;
+  uint64_t clock_ ABSL_GUARDED_BY(mutex_) = 0;
+  uint32_t hits_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
 /* Generates glyph keyed patches. */
 class GlyphKeyedDiff {
  public:
   GlyphKeyedDiff(const common::FontData& font, common::CompatId base_compat_id,
                  absl::flat_hash_set<hb_tag_t> included_tags,
                  unsigned quality = 11)
-      : font_(font),
+      : glyph_data_(font.face().get()),
         base_compat_id_(base_compat_id),
         tags_(included_tags),
         brotli_diff_(quality) {}
 
+  GlyphKeyedDiff(const common::FontData& font, common::CompatId base_compat_id,
+                 absl::flat_hash_set<hb_tag_t> included_tags,
+                 common::BrotliBinaryDiff::Options brotli_options)
+      : glyph_data_(font.face().get()),
+        base_compat_id_(base_compat_id),
+        tags_(included_tags),
+        brotli_diff_(brotli_options) {}
+
+  // If set, compressed data streams are looked up in and added to cache. The
+  // cache must outlive this diff.
+  void SetStreamCache(GlyphKeyedStreamCache* cache) { stream_cache_ = cache; }
+
+  /*
+   * Returns a brotli dictionary of at most max_size bytes made from the data
+   * (in included_tags) of glyphs sampled evenly across font. Small patches
+   * compress poorly on their own, since most of the redundancy in glyph data
+   * is between glyphs rather than within them.
+   */
+  static absl::StatusOr<common::FontData> TrainDictionary(
+      const common::FontData& font,
+      const absl::flat_hash_set<hb_tag_t>& included_tags, uint32_t max_size);
+
+  /*
+   * If set, data streams are compressed against dictionary (see
+   * TrainDictionary()). The dictionary's prepared form is obtained from
+   * cache, so that it's built once for all diffs sharing the dictionary.
+   *
+   * Note: the IFT specification doesn't yet provide a way to reference a
+   * dictionary for glyph keyed patches, so patches produced this way can only
+   * be applied by clients which obtain the dictionary out of band.
+   */
+  void SetDictionary(common::FontData dictionary,
+                     std::shared_ptr<common::BrotliDictionaryCache> cache) {
+    dictionary_ = std::move(dictionary);
+    brotli_diff_.SetDictionaryCache(std::move(cache));
+  }
+
   absl::StatusOr<common::FontData> CreatePatch(
       const absl::btree_set<uint32_t>& gids) const;
 
@@ -27,10 +142,12 @@ class GlyphKeyedDiff {
   absl::StatusOr<common::FontData> CreateDataStream(
       const absl::btree_set<uint32_t>& gids, bool u16_gids) const;
 
-  const common::FontData& font_;
+  common::GlyphDataIndex glyph_data_;
   common::CompatId base_compat_id_;
   absl::flat_hash_set<hb_tag_t> tags_;
   common::BrotliBinaryDiff brotli_diff_;
+  common::FontData dictionary_;
+  GlyphKeyedStreamCache* stream_cache_ = nullptr;
 };
 
 }  // namespace ift
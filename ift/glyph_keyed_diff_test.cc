@@ -1,9 +1,14 @@
 #include "ift/glyph_keyed_diff.h"
 
+#include <memory>
+#include <utility>
+
 #include "absl/status/statusor.h"
+#include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "common/brotli_binary_patch.h"
+#include "common/brotli_dictionary_cache.h"
 #include "common/compat_id.h"
 #include "common/font_data.h"
 #include "common/font_helper.h"
@@ -106,6 +111,7 @@ class GlyphKeyedDiffTest : public ::testing::Test {
     original = from_file("ift/testdata/NotoSansJP-Regular.subset.ttf");
     roboto = from_file("common/testdata/Roboto-Regular.Awesome.ttf");
     roboto_vf = from_file("common/testdata/Roboto[wdth,wght].abcd.ttf");
+    noto_sans_jp_otf = from_file("common/testdata/NotoSansJP-Regular.otf");
   }
 
   FontData from_file(const char* filename) {
@@ -141,6 +147,7 @@ class GlyphKeyedDiffTest : public ::testing::Test {
   FontData original;
   FontData roboto;
   FontData roboto_vf;
+  FontData noto_sans_jp_otf;
   BrotliBinaryPatch unbrotli;
 };
 
@@ -355,6 +362,149 @@ TEST_F(GlyphKeyedDiffTest, CreatePatch_GlyfGvar) {
   ASSERT_EQ(uncompressed_stream.str(), data_stream);
 }
 
+TEST_F(GlyphKeyedDiffTest, CreatePatch_Cff) {
+  const uint8_t data_stream_header[] = {
+      0x00, 0x00, 0x00, 0x02,  // glyphCount
+      0x01,                    // table count
+      0x00, 0x01,              // gid 1
+      0x00, 0x64,              // gid 100
+      'C',  'F',  'F',  ' ',   // tables[1]
+  };
+  std::string data_stream((const char*)data_stream_header, 13);
+
+  auto face = noto_sans_jp_otf.face();
+  auto g1 = FontHelper::CffCharStringData(face.get(), 1);
+  auto g100 = FontHelper::CffCharStringData(face.get(), 100);
+  ASSERT_TRUE(g1.ok()) << g1.status();
+  ASSERT_TRUE(g100.ok()) << g100.status();
+
+  uint32_t size = 25;
+  FontHelper::WriteUInt32(size, data_stream);
+  size += g1->size();
+  FontHelper::WriteUInt32(size, data_stream);
+  size += g100->size();
+  FontHelper::WriteUInt32(size, data_stream);
+
+  data_stream += *g1;
+  data_stream += *g100;
+
+  GlyphKeyedDiff differ(noto_sans_jp_otf, CompatId(1, 2, 3, 4),
+                        {FontHelper::kCFF, FontHelper::kGlyf});
+  auto patch = differ.CreatePatch({1, 100});
+  ASSERT_TRUE(patch.ok()) << patch.status();
+
+  FontData empty;
+  FontData compressed_stream(patch->str(29));
+  FontData uncompressed_stream;
+  auto status = unbrotli.Patch(empty, compressed_stream, &uncompressed_stream);
+  ASSERT_TRUE(status.ok()) << status;
+  ASSERT_EQ(uncompressed_stream.str(), data_stream);
+}
+
+TEST_F(GlyphKeyedDiffTest, CreatePatch_StreamCache) {
+  GlyphKeyedStreamCache cache;
+  GlyphKeyedDiff differ_1(roboto_vf, CompatId(1, 2, 3, 4),
+                          {FontHelper::kGlyf, FontHelper::kGvar});
+  GlyphKeyedDiff differ_2(roboto_vf, CompatId(5, 6, 7, 8),
+                          {FontHelper::kGlyf, FontHelper::kGvar});
+  differ_1.SetStreamCache(&cache);
+  differ_2.SetStreamCache(&cache);
+
+  auto patch_1 = differ_1.CreatePatch({1, 3});
+  ASSERT_TRUE(patch_1.ok()) << patch_1.status();
+  ASSERT_EQ(cache.Hits(), 0);
+
+  auto patch_2 = differ_2.CreatePatch({1, 3});
+  ASSERT_TRUE(patch_2.ok()) << patch_2.status();
+  ASSERT_EQ(cache.Hits(), 1);
+
+  auto patch_3 = differ_2.CreatePatch({1, 4});
+  ASSERT_TRUE(patch_3.ok()) << patch_3.status();
+  ASSERT_EQ(cache.Hits(), 1);
+
+  // Only the compat id differs.
+  ASSERT_NE(patch_1->str(9, 25), patch_2->str(9, 25));
+  ASSERT_EQ(patch_1->str(25), patch_2->str(25));
+
+  auto expected = GlyphKeyedDiff(roboto_vf, CompatId(5, 6, 7, 8),
+                                 {FontHelper::kGlyf, FontHelper::kGvar})
+                      .CreatePatch({1, 3});
+  ASSERT_TRUE(expected.ok()) << expected.status();
+  ASSERT_EQ(*patch_2, *expected);
+}
+
+TEST_F(GlyphKeyedDiffTest, StreamCache_Eviction) {
+  GlyphKeyedStreamCache cache(20);
+  FontData compressed("12345");
+  cache.Insert("aaaaa", compressed);
+  cache.Insert("bbbbb", compressed);
+  ASSERT_EQ(cache.Size(), 20);
+
+  // Refresh "aaaaa" so "bbbbb" is the least recently used.
+  FontData found;
+  ASSERT_TRUE(cache.Find("aaaaa", found));
+  ASSERT_EQ(found, compressed);
+
+  cache.Insert("ccccc", compressed);
+  ASSERT_EQ(cache.Size(), 20);
+  ASSERT_TRUE(cache.Find("aaaaa", found));
+  ASSERT_FALSE(cache.Find("bbbbb", found));
+  ASSERT_TRUE(cache.Find("ccccc", found));
+
+  // Re-inserting a cached stream doesn't change the size.
+  cache.Insert("ccccc", compressed);
+  ASSERT_EQ(cache.Size(), 20);
+  ASSERT_EQ(cache.Hits(), 3);
+}
+
+TEST_F(GlyphKeyedDiffTest, TrainDictionary) {
+  auto dictionary =
+      GlyphKeyedDiff::TrainDictionary(roboto, {FontHelper::kGlyf}, 4096);
+  ASSERT_TRUE(dictionary.ok()) << dictionary.status();
+  ASSERT_GT(dictionary->size(), 0);
+  ASSERT_LE(dictionary->size(), 4096);
+
+  // Glyph 0 is always sampled and placed last.
+  auto glyph_0 = FontHelper::GlyfData(roboto.face().get(), 0);
+  ASSERT_TRUE(glyph_0.ok()) << glyph_0.status();
+  ASSERT_TRUE(absl::EndsWith(dictionary->str(), *glyph_0));
+
+  auto empty = GlyphKeyedDiff::TrainDictionary(roboto, {}, 4096);
+  ASSERT_TRUE(empty.ok()) << empty.status();
+  ASSERT_EQ(empty->size(), 0);
+}
+
+TEST_F(GlyphKeyedDiffTest, CreatePatch_Dictionary) {
+  // Large enough to hold every glyph.
+  auto dictionary =
+      GlyphKeyedDiff::TrainDictionary(roboto, {FontHelper::kGlyf}, 1 << 20);
+  ASSERT_TRUE(dictionary.ok()) << dictionary.status();
+
+  GlyphKeyedDiff plain(roboto, CompatId(1, 2, 3, 4), {FontHelper::kGlyf});
+  GlyphKeyedDiff differ(roboto, CompatId(1, 2, 3, 4), {FontHelper::kGlyf});
+  FontData dictionary_copy;
+  dictionary_copy.shallow_copy(*dictionary);
+  differ.SetDictionary(std::move(dictionary_copy),
+                       std::make_shared<common::BrotliDictionaryCache>());
+
+  auto expected = plain.CreatePatch({37, 40, 73, 91});
+  ASSERT_TRUE(expected.ok()) << expected.status();
+  auto patch = differ.CreatePatch({37, 40, 73, 91});
+  ASSERT_TRUE(patch.ok()) << patch.status();
+
+  // Same header and data stream, but smaller.
+  ASSERT_EQ(patch->str(0, 29), expected->str(0, 29));
+  ASSERT_LT(patch->size(), expected->size());
+
+  FontData compressed_stream(patch->str(29));
+  FontData uncompressed_stream;
+  auto status =
+      unbrotli.Patch(*dictionary, compressed_stream, &uncompressed_stream);
+  ASSERT_TRUE(status.ok()) << status;
+  ASSERT_EQ(uncompressed_stream.str(),
+            absl::string_view((const char*)data_stream_u16_short_loca, 543));
+}
+
 TEST_F(GlyphKeyedDiffTest, CreatePatch_Glyf_InvalidGid) {
   GlyphKeyedDiff differ(roboto, CompatId(1, 2, 3, 4), {FontHelper::kGlyf});
   auto patch =
@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_set.h"
+#include "benchmark/benchmark.h"
+#include "common/cmap_index.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "hb.h"
+#include "ift/encoder/glyph_segmentation.h"
+#include "ift/testdata/test_segments.h"
+
+using absl::btree_set;
+using absl::flat_hash_set;
+using common::CmapIndex;
+using common::FontData;
+using common::FontHelper;
+using common::hb_face_unique_ptr;
+using common::make_hb_blob;
+using ift::encoder::GlyphSegmentation;
+using ift::encoder::SegmentationStats;
+using ift::testdata::TestSegment1;
+using ift::testdata::TestSegment2;
+using ift::testdata::TestSegment3;
+using ift::testdata::TestSegment4;
+
+namespace {
+
+FontData LoadFont(const char* path) {
+  FontData font;
+  auto blob = make_hb_blob(hb_blob_create_from_file(path));
+  font.set(blob.get());
+  return font;
+}
+
+/*
+ * Returns every codepoint of face, ordered by the test segments (which are in
+ * frequency order) followed by the remaining codepoints.
+ */
+std::vector<uint32_t> OrderedCodepoints(hb_face_t* face) {
+  std::vector<uint32_t> result;
+  btree_set<uint32_t> seen;
+  CmapIndex cmap(face);
+  for (const auto& gids :
+       {TestSegment1(), TestSegment2(), TestSegment3(), TestSegment4()}) {
+    for (uint32_t cp : cmap.CodepointsFor(gids)) {
+      if (seen.insert(cp).second) {
+        result.push_back(cp);
+      }
+    }
+  }
+  for (uint32_t cp : FontHelper::ToCodepointsSet(face)) {
+    if (seen.insert(cp).second) {
+      result.push_back(cp);
+    }
+  }
+  return result;
+}
+
+// Splits codepoints into count contiguous segments of about equal size.
+std::vector<flat_hash_set<uint32_t>> Split(
+    const std::vector<uint32_t>& codepoints, uint32_t count) {
+  count = std::min<uint32_t>(count, codepoints.size());
+  std::vector<flat_hash_set<uint32_t>> segments(count);
+  for (uint32_t i = 0; i < codepoints.size(); i++) {
+    segments[(uint64_t)i * count / codepoints.size()].insert(codepoints[i]);
+  }
+  return segments;
+}
+
+double HitRate(uint32_t hits, uint32_t misses) {
+  return hits + misses ? (double)hits / (hits + misses) : 0.0;
+}
+
+/*
+ * Segments Noto Sans JP into state.range(0) segments. If state.range(1) is
+ * non zero it's used as the min patch size, with a max of four times that,
+ * which enables merging.
+ */
+void BM_CodepointToGlyphSegments(benchmark::State& state) {
+  FontData font = LoadFont("ift/testdata/NotoSansJP-Regular.subset.ttf");
+  hb_face_unique_ptr face = font.face();
+  auto segments = Split(OrderedCodepoints(face.get()), state.range(0));
+  uint32_t min_patch_size = state.range(1);
+  uint32_t max_patch_size = min_patch_size ? 4 * min_patch_size : UINT32_MAX;
+
+  SegmentationStats stats;
+  for (auto _ : state) {
+    auto segmentation = GlyphSegmentation::CodepointToGlyphSegments(
+        face.get(), {}, segments, min_patch_size, max_patch_size);
+    if (!segmentation.ok()) {
+      state.SkipWithError(segmentation.status().ToString().c_str());
+      return;
+    }
+    stats = segmentation->Stats();
+  }
+
+  // Every iteration does the same work, so report the stats of the last.
+  state.counters["segments"] = segments.size();
+  state.counters["closures"] = stats.closure_count;
+  state.counters["merges"] = stats.merge_count;
+  state.counters["glyph_closure_hit_rate"] = HitRate(
+      stats.glyph_closure_cache_hits, stats.glyph_closure_cache_misses);
+  state.counters["or_gids_hit_rate"] =
+      HitRate(stats.or_gids_cache_hits, stats.or_gids_cache_misses);
+  state.counters["patch_size_hit_rate"] =
+      HitRate(stats.patch_size_cache_hits, stats.patch_size_cache_misses);
+}
+BENCHMARK(BM_CodepointToGlyphSegments)
+    ->ArgNames({"segments", "min_patch_size"})
+    ->ArgsProduct({{10, 100, 1000}, {0, 4000}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace
@@ -1,19 +1,26 @@
 #include <cstdint>
+#include <memory>
 #include <optional>
 #include <string>
+#include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/functional/function_ref.h"
 #include "absl/strings/str_cat.h"
 #include "common/axis_range.h"
 #include "common/font_data.h"
 #include "common/font_helper.h"
 #include "common/hb_set_unique_ptr.h"
+#include "common/thread_pool.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "hb.h"
 #include "ift/client/fontations_client.h"
+#include "ift/client/in_process_client.h"
 #include "ift/encoder/condition.h"
 #include "ift/encoder/encoder.h"
+#include "ift/encoder/encoder_stats.h"
 #include "ift/encoder/subset_definition.h"
 #include "ift/proto/patch_map.h"
 #include "ift/testdata/test_segments.h"
@@ -33,10 +40,16 @@ using common::hb_set_unique_ptr;
 using common::make_hb_blob;
 using common::make_hb_face;
 using common::make_hb_set;
+using common::ThreadPool;
+using ift::client::ClientSession;
 using ift::client::Extend;
+using ift::client::ExtendInProcess;
 using ift::client::ExtendWithDesignSpace;
+using ift::client::ExtendWithDesignSpaceInProcess;
+using ift::client::FontationsSession;
 using ift::encoder::Condition;
 using ift::encoder::Encoder;
+using ift::encoder::EncoderStats;
 using ift::encoder::SubsetDefinition;
 using ift::proto::PatchEncoding;
 using ift::proto::PatchMap;
@@ -190,6 +203,185 @@ class IntegrationTest : public ::testing::Test {
     return absl::OkStatus();
   }
 
+  /*
+   * An encoding shared by all tests in this process which use the same
+   * configuration, along with the stats collected while encoding it and a
+   * fontations session for extending it.
+   */
+  struct SharedEncoding {
+    Encoder::Encoding encoding;
+    EncoderStats stats;
+    std::optional<FontationsSession> fontations;
+  };
+
+  /*
+   * Returns the shared encoding for key, which must uniquely identify the
+   * configuration applied by configure. The encoding is produced on first
+   * use, later calls reuse it.
+   */
+  StatusOr<const SharedEncoding*> Shared(
+      const std::string& key, absl::FunctionRef<Status(Encoder&)> configure) {
+    static auto* shared_encodings =
+        new flat_hash_map<std::string, std::unique_ptr<SharedEncoding>>();
+    auto it = shared_encodings->find(key);
+    if (it != shared_encodings->end()) {
+      return it->second.get();
+    }
+
+    auto shared = std::make_unique<SharedEncoding>();
+    Encoder encoder;
+    encoder.SetStats(&shared->stats);
+    auto sc = configure(encoder);
+    if (!sc.ok()) {
+      return sc;
+    }
+    auto encoding = encoder.Encode();
+    if (!encoding.ok()) {
+      return encoding.status();
+    }
+    shared->encoding = std::move(*encoding);
+
+    auto fontations = FontationsSession::Create(shared->encoding);
+    if (!fontations.ok()) {
+      return fontations.status();
+    }
+    shared->fontations = std::move(*fontations);
+
+    const SharedEncoding* result = shared.get();
+    shared_encodings->insert(std::pair(key, std::move(shared)));
+    return result;
+  }
+
+  // Returns a copy of encoding, sharing its data, with the init font replaced.
+  static Encoder::Encoding WithInitFont(const Encoder::Encoding& encoding,
+                                        const FontData& init_font) {
+    Encoder::Encoding result;
+    result.init_font.shallow_copy(init_font);
+    for (const auto& [url, patch] : encoding.patches) {
+      result.patches[url].shallow_copy(patch);
+    }
+    return result;
+  }
+
+  // Noto Sans JP with a base of {0x41, 0x42, 0x43} and four table keyed
+  // segments.
+  Status ConfigureTableKeyed(Encoder& encoder) {
+    auto sc = InitEncoderForTableKeyed(encoder);
+    sc.Update(
+        encoder.SetBaseSubset(flat_hash_set<uint32_t>{0x41, 0x42, 0x43}));
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{0x45, 0x46, 0x47});
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{0x48, 0x49, 0x4A});
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{0x4B, 0x4C, 0x4D});
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{0x4E, 0x4F, 0x50});
+    return sc;
+  }
+
+  // Roboto VF, table keyed, with wdth expanded from a point by a design space
+  // segment.
+  Status ConfigureTableKeyedVf(Encoder& encoder) {
+    auto sc = InitEncoderForVf(encoder);
+
+    SubsetDefinition def{'a', 'b', 'c'};
+    def.design_space[kWdth] = AxisRange::Point(100.0f);
+    sc.Update(encoder.SetBaseSubsetFromDef(def));
+
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'d', 'e', 'f'});
+    encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'h', 'i', 'j'});
+    encoder.AddDesignSpaceSegment({{kWdth, *AxisRange::Range(75.0f, 100.0f)}});
+    return sc;
+  }
+
+  // Mixed mode Noto Sans JP, target partitions: {{0, 1}, {2}, {3, 4}}.
+  Status ConfigureMixedMode(Encoder& encoder) {
+    auto init_gids = InitEncoderForMixedMode(encoder);
+    if (!init_gids.ok()) {
+      return init_gids.status();
+    }
+
+    auto face = noto_sans_jp_.face();
+    auto segment_0 = FontHelper::GidsToUnicodes(face.get(), *init_gids);
+    auto segment_1 = FontHelper::GidsToUnicodes(face.get(), TestSegment1());
+    auto segment_2 = FontHelper::GidsToUnicodes(face.get(), TestSegment2());
+    auto segment_3 = FontHelper::GidsToUnicodes(face.get(), TestSegment3());
+    auto segment_4 = FontHelper::GidsToUnicodes(face.get(), TestSegment4());
+
+    flat_hash_set<uint32_t> base;
+    base.insert(segment_0.begin(), segment_0.end());
+    base.insert(segment_1.begin(), segment_1.end());
+    auto sc = encoder.SetBaseSubset(base);
+
+    encoder.AddNonGlyphDataSegment(segment_2);
+
+    auto segment = segment_3;
+    segment.insert(segment_4.begin(), segment_4.end());
+    encoder.AddNonGlyphDataSegment(segment);
+
+    // Setup activations for 2 through 4 (1 is init)
+    sc.Update(encoder.AddGlyphDataPatchCondition(Condition::SimpleCondition(
+        SubsetDefinition::Codepoints(segment_2), 2)));
+    sc.Update(encoder.AddGlyphDataPatchCondition(Condition::SimpleCondition(
+        SubsetDefinition::Codepoints(segment_3), 3)));
+    sc.Update(encoder.AddGlyphDataPatchCondition(Condition::SimpleCondition(
+        SubsetDefinition::Codepoints(segment_4), 4)));
+    return sc;
+  }
+
+  // Mixed mode Noto Sans JP VF, target partitions: {{0, 1}, {2}, {3, 4}} with
+  // wght expanded from a point by a design space segment.
+  Status ConfigureVfMixedMode(Encoder& encoder) {
+    auto init_gids = InitEncoderForVfMixedMode(encoder);
+    if (!init_gids.ok()) {
+      return init_gids.status();
+    }
+
+    auto face = noto_sans_vf_.face();
+    auto segment_0 = FontHelper::GidsToUnicodes(face.get(), *init_gids);
+    auto segment_1 = FontHelper::GidsToUnicodes(face.get(), TestVfSegment1());
+    auto segment_2 = FontHelper::GidsToUnicodes(face.get(), TestVfSegment2());
+    auto segment_3 = FontHelper::GidsToUnicodes(face.get(), TestVfSegment3());
+    auto segment_4 = FontHelper::GidsToUnicodes(face.get(), TestVfSegment4());
+
+    SubsetDefinition base_def;
+    base_def.codepoints.insert(segment_0.begin(), segment_0.end());
+    base_def.codepoints.insert(segment_1.begin(), segment_1.end());
+    base_def.design_space = {{kWght, AxisRange::Point(100)}};
+    auto sc = encoder.SetBaseSubsetFromDef(base_def);
+
+    encoder.AddNonGlyphDataSegment(segment_2);
+    auto segment_3_and_4 = segment_3;
+    segment_3_and_4.insert(segment_4.begin(), segment_4.end());
+    encoder.AddNonGlyphDataSegment(segment_3_and_4);
+    encoder.AddDesignSpaceSegment({{kWght, *AxisRange::Range(100, 900)}});
+
+    sc.Update(encoder.AddGlyphDataPatchCondition(Condition::SimpleCondition(
+        SubsetDefinition::Codepoints(segment_2), 2)));
+    sc.Update(encoder.AddGlyphDataPatchCondition(Condition::SimpleCondition(
+        SubsetDefinition::Codepoints(segment_3), 3)));
+    sc.Update(encoder.AddGlyphDataPatchCondition(Condition::SimpleCondition(
+        SubsetDefinition::Codepoints(segment_4), 4)));
+    return sc;
+  }
+
+  StatusOr<const SharedEncoding*> TableKeyedEncoding() {
+    return Shared("table_keyed",
+                  [this](Encoder& e) { return ConfigureTableKeyed(e); });
+  }
+
+  StatusOr<const SharedEncoding*> TableKeyedVfEncoding() {
+    return Shared("table_keyed_vf",
+                  [this](Encoder& e) { return ConfigureTableKeyedVf(e); });
+  }
+
+  StatusOr<const SharedEncoding*> MixedModeEncoding() {
+    return Shared("mixed_mode",
+                  [this](Encoder& e) { return ConfigureMixedMode(e); });
+  }
+
+  StatusOr<const SharedEncoding*> VfMixedModeEncoding() {
+    return Shared("vf_mixed_mode",
+                  [this](Encoder& e) { return ConfigureVfMixedMode(e); });
+  }
+
   bool GvarHasLongOffsets(const FontData& font) {
     auto face = font.face();
     auto gvar_data =
@@ -276,19 +468,9 @@ bool GvarDataMatches(hb_face_t* a, hb_face_t* b, uint32_t codepoint,
 // TODO(garretrieger): test of a woff2 encoded IFT font.
 
 TEST_F(IntegrationTest, TableKeyedOnly) {
-  Encoder encoder;
-  auto sc = InitEncoderForTableKeyed(encoder);
-  ASSERT_TRUE(sc.ok()) << sc;
-
-  sc = encoder.SetBaseSubset(flat_hash_set<uint32_t>{0x41, 0x42, 0x43});
-  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{0x45, 0x46, 0x47});
-  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{0x48, 0x49, 0x4A});
-  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{0x4B, 0x4C, 0x4D});
-  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{0x4E, 0x4F, 0x50});
-  ASSERT_TRUE(sc.ok()) << sc;
-
-  auto encoding = encoder.Encode();
-  ASSERT_TRUE(encoding.ok()) << encoding.status();
+  auto shared = TableKeyedEncoding();
+  ASSERT_TRUE(shared.ok()) << shared.status();
+  const Encoder::Encoding* encoding = &(*shared)->encoding;
 
   auto encoded_face = encoding->init_font.face();
   auto codepoints = FontHelper::ToCodepointsSet(encoded_face.get());
@@ -298,7 +480,7 @@ TEST_F(IntegrationTest, TableKeyedOnly) {
   ASSERT_FALSE(codepoints.contains(0x4B));
   ASSERT_FALSE(codepoints.contains(0x4E));
 
-  auto extended = Extend(*encoding, {0x49});
+  auto extended = (*shared)->fontations->Extend({0x49});
   ASSERT_TRUE(extended.ok()) << extended.status();
 
   auto extended_face = extended->face();
@@ -317,19 +499,9 @@ TEST_F(IntegrationTest, TableKeyedOnly) {
 }
 
 TEST_F(IntegrationTest, TableKeyedMultiple) {
-  Encoder encoder;
-  auto sc = InitEncoderForTableKeyed(encoder);
-  ASSERT_TRUE(sc.ok()) << sc;
-
-  sc = encoder.SetBaseSubset(flat_hash_set<uint32_t>{0x41, 0x42, 0x43});
-  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{0x45, 0x46, 0x47});
-  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{0x48, 0x49, 0x4A});
-  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{0x4B, 0x4C, 0x4D});
-  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{0x4E, 0x4F, 0x50});
-  ASSERT_TRUE(sc.ok()) << sc;
-
-  auto encoding = encoder.Encode();
-  ASSERT_TRUE(encoding.ok()) << encoding.status();
+  auto shared = TableKeyedEncoding();
+  ASSERT_TRUE(shared.ok()) << shared.status();
+  const Encoder::Encoding* encoding = &(*shared)->encoding;
 
   auto encoded_face = encoding->init_font.face();
   auto codepoints = FontHelper::ToCodepointsSet(encoded_face.get());
@@ -339,7 +511,7 @@ TEST_F(IntegrationTest, TableKeyedMultiple) {
   ASSERT_FALSE(codepoints.contains(0x4B));
   ASSERT_FALSE(codepoints.contains(0x4E));
 
-  auto extended = Extend(*encoding, {0x49, 0x4F});
+  auto extended = (*shared)->fontations->Extend({0x49, 0x4F});
   ASSERT_TRUE(extended.ok()) << extended.status();
   auto extended_face = extended->face();
 
@@ -408,21 +580,9 @@ TEST_F(IntegrationTest, TableKeyedWithOverlaps) {
 }
 
 TEST_F(IntegrationTest, TableKeyed_DesignSpaceAugmentation_IgnoresDesignSpace) {
-  Encoder encoder;
-  auto sc = InitEncoderForVf(encoder);
-  ASSERT_TRUE(sc.ok()) << sc;
-
-  SubsetDefinition def{'a', 'b', 'c'};
-  def.design_space[kWdth] = AxisRange::Point(100.0f);
-  sc = encoder.SetBaseSubsetFromDef(def);
-
-  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'d', 'e', 'f'});
-  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'h', 'i', 'j'});
-  encoder.AddDesignSpaceSegment({{kWdth, *AxisRange::Range(75.0f, 100.0f)}});
-  ASSERT_TRUE(sc.ok()) << sc;
-
-  auto encoding = encoder.Encode();
-  ASSERT_TRUE(encoding.ok()) << encoding.status();
+  auto shared = TableKeyedVfEncoding();
+  ASSERT_TRUE(shared.ok()) << shared.status();
+  const Encoder::Encoding* encoding = &(*shared)->encoding;
   auto encoded_face = encoding->init_font.face();
 
   auto codepoints = FontHelper::ToCodepointsSet(encoded_face.get());
@@ -437,7 +597,7 @@ TEST_F(IntegrationTest, TableKeyed_DesignSpaceAugmentation_IgnoresDesignSpace) {
   };
   ASSERT_EQ(*ds, expected_ds);
 
-  auto extended = Extend(*encoding, {'e'});
+  auto extended = (*shared)->fontations->Extend({'e'});
   ASSERT_TRUE(extended.ok()) << extended.status();
   auto extended_face = extended->face();
 
@@ -454,21 +614,9 @@ TEST_F(IntegrationTest, TableKeyed_DesignSpaceAugmentation_IgnoresDesignSpace) {
 }
 
 TEST_F(IntegrationTest, SharedBrotli_DesignSpaceAugmentation) {
-  Encoder encoder;
-  auto sc = InitEncoderForVf(encoder);
-  ASSERT_TRUE(sc.ok()) << sc;
-
-  SubsetDefinition def{'a', 'b', 'c'};
-  def.design_space[kWdth] = AxisRange::Point(100.0f);
-  sc = encoder.SetBaseSubsetFromDef(def);
-
-  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'d', 'e', 'f'});
-  encoder.AddNonGlyphDataSegment(flat_hash_set<uint32_t>{'h', 'i', 'j'});
-  encoder.AddDesignSpaceSegment({{kWdth, *AxisRange::Range(75.0f, 100.0f)}});
-  ASSERT_TRUE(sc.ok()) << sc;
-
-  auto encoding = encoder.Encode();
-  ASSERT_TRUE(encoding.ok()) << encoding.status();
+  auto shared = TableKeyedVfEncoding();
+  ASSERT_TRUE(shared.ok()) << shared.status();
+  const Encoder::Encoding* encoding = &(*shared)->encoding;
   auto encoded_face = encoding->init_font.face();
 
   auto codepoints = FontHelper::ToCodepointsSet(encoded_face.get());
@@ -483,9 +631,9 @@ TEST_F(IntegrationTest, SharedBrotli_DesignSpaceAugmentation) {
   };
   ASSERT_EQ(*ds, expected_ds);
 
-  auto extended = ExtendWithDesignSpace(
-      *encoding, {'b'}, {},
-      {{HB_TAG('w', 'd', 't', 'h'), AxisRange::Point(80)}});
+  PatchMap::Coverage target{'b'};
+  target.design_space[kWdth] = AxisRange::Point(80);
+  auto extended = (*shared)->fontations->Extend(target);
   ASSERT_TRUE(extended.ok()) << extended.status();
   auto extended_face = extended->face();
 
@@ -503,8 +651,7 @@ TEST_F(IntegrationTest, SharedBrotli_DesignSpaceAugmentation) {
                                 Not(Contains('i')), Not(Contains('j'))));
 
   // Try extending the updated font again.
-  encoding->init_font.shallow_copy(*extended);
-  extended = Extend(*encoding, {'e'});
+  extended = Extend(WithInitFont(*encoding, *extended), {'e'});
   ASSERT_TRUE(extended.ok()) << extended.status();
   extended_face = extended->face();
 
@@ -520,42 +667,9 @@ TEST_F(IntegrationTest, SharedBrotli_DesignSpaceAugmentation) {
 }
 
 TEST_F(IntegrationTest, MixedMode) {
-  Encoder encoder;
-  auto init_gids = InitEncoderForMixedMode(encoder);
-  ASSERT_TRUE(init_gids.ok()) << init_gids.status();
-
-  auto face = noto_sans_jp_.face();
-  auto base_segment = FontHelper::GidsToUnicodes(face.get(), *init_gids);
-
-  // target paritions: {{0, 1}, {2}, {3, 4}}
-  auto segment_0 = FontHelper::GidsToUnicodes(face.get(), *init_gids);
-  auto segment_1 = FontHelper::GidsToUnicodes(face.get(), TestSegment1());
-  auto segment_2 = FontHelper::GidsToUnicodes(face.get(), TestSegment2());
-  auto segment_3 = FontHelper::GidsToUnicodes(face.get(), TestSegment3());
-  auto segment_4 = FontHelper::GidsToUnicodes(face.get(), TestSegment4());
-
-  flat_hash_set<uint32_t> base;
-  base.insert(segment_0.begin(), segment_0.end());
-  base.insert(segment_1.begin(), segment_1.end());
-  auto sc = encoder.SetBaseSubset(base);
-
-  encoder.AddNonGlyphDataSegment(segment_2);
-
-  auto segment = segment_3;
-  segment.insert(segment_4.begin(), segment_4.end());
-  encoder.AddNonGlyphDataSegment(segment);
-  ASSERT_TRUE(sc.ok()) << sc;
-
-  // Setup activations for 2 through 4 (1 is init)
-  sc.Update(encoder.AddGlyphDataPatchCondition(
-      Condition::SimpleCondition(SubsetDefinition::Codepoints(segment_2), 2)));
-  sc.Update(encoder.AddGlyphDataPatchCondition(
-      Condition::SimpleCondition(SubsetDefinition::Codepoints(segment_3), 3)));
-  sc.Update(encoder.AddGlyphDataPatchCondition(
-      Condition::SimpleCondition(SubsetDefinition::Codepoints(segment_4), 4)));
-
-  auto encoding = encoder.Encode();
-  ASSERT_TRUE(encoding.ok()) << encoding.status();
+  auto shared = MixedModeEncoding();
+  ASSERT_TRUE(shared.ok()) << shared.status();
+  const Encoder::Encoding* encoding = &(*shared)->encoding;
   auto encoded_face = encoding->init_font.face();
 
   ASSERT_TRUE(FontHelper::GlyfData(encoded_face.get(), chunk2_gid_non_cmapped)
@@ -568,7 +682,7 @@ TEST_F(IntegrationTest, MixedMode) {
   ASSERT_FALSE(codepoints.contains(chunk3_cp));
   ASSERT_FALSE(codepoints.contains(chunk4_cp));
 
-  auto extended = Extend(*encoding, {chunk3_cp, chunk4_cp});
+  auto extended = (*shared)->fontations->Extend({chunk3_cp, chunk4_cp});
   ASSERT_TRUE(extended.ok()) << extended.status();
   auto extended_face = extended->face();
 
@@ -784,13 +898,29 @@ TEST_F(IntegrationTest, MixedMode_CompositeConditions) {
 
   auto encoding = encoder.Encode();
   ASSERT_TRUE(encoding.ok()) << encoding.status();
-  auto encoded_face = encoding->init_font.face();
+  auto fontations = FontationsSession::Create(*encoding);
+  ASSERT_TRUE(fontations.ok()) << fontations.status();
+
+  ThreadPool pool(4);
+  auto extended = fontations->ExtendAll(
+      {
+          // No conditions satisfied.
+          {chunk1_cp},
+          // (1 OR 2) AND 3 satisfied, chunk 4 loaded
+          {chunk2_cp, chunk3_cp},
+          // 1 AND (2 OR 3) 3 satisfied, chunk 3 loaded
+          {chunk1_cp, chunk2_cp},
+          // both conditions satisfied chunk 3 and 4 loaded
+          {chunk1_cp, chunk2_cp, chunk3_cp},
+      },
+      pool);
+  ASSERT_EQ(extended.size(), 4);
+  for (const auto& font : extended) {
+    ASSERT_TRUE(font.ok()) << font.status();
+  }
 
   {
-    // No conditions satisfied.
-    auto extended = Extend(*encoding, {chunk1_cp});
-    ASSERT_TRUE(extended.ok()) << extended.status();
-    auto extended_face = extended->face();
+    auto extended_face = extended[0]->face();
     ASSERT_TRUE(FontHelper::GlyfData(extended_face.get(), chunk1_gid)->empty());
     ASSERT_TRUE(FontHelper::GlyfData(extended_face.get(), chunk2_gid)->empty());
     ASSERT_TRUE(FontHelper::GlyfData(extended_face.get(), chunk3_gid)->empty());
@@ -798,10 +928,7 @@ TEST_F(IntegrationTest, MixedMode_CompositeConditions) {
   }
 
   {
-    // (1 OR 2) AND 3 satisfied, chunk 4 loaded
-    auto extended = Extend(*encoding, {chunk2_cp, chunk3_cp});
-    ASSERT_TRUE(extended.ok()) << extended.status();
-    auto extended_face = extended->face();
+    auto extended_face = extended[1]->face();
     ASSERT_TRUE(FontHelper::GlyfData(extended_face.get(), chunk1_gid)->empty());
     ASSERT_TRUE(FontHelper::GlyfData(extended_face.get(), chunk2_gid)->empty());
     ASSERT_TRUE(FontHelper::GlyfData(extended_face.get(), chunk3_gid)->empty());
@@ -810,10 +937,7 @@ TEST_F(IntegrationTest, MixedMode_CompositeConditions) {
   }
 
   {
-    // 1 AND (2 OR 3) 3 satisfied, chunk 3 loaded
-    auto extended = Extend(*encoding, {chunk1_cp, chunk2_cp});
-    ASSERT_TRUE(extended.ok()) << extended.status();
-    auto extended_face = extended->face();
+    auto extended_face = extended[2]->face();
     ASSERT_TRUE(FontHelper::GlyfData(extended_face.get(), chunk1_gid)->empty());
     ASSERT_TRUE(FontHelper::GlyfData(extended_face.get(), chunk2_gid)->empty());
     ASSERT_FALSE(
@@ -822,10 +946,7 @@ TEST_F(IntegrationTest, MixedMode_CompositeConditions) {
   }
 
   {
-    // both conditions satisfied chunk 3 and 4 loaded
-    auto extended = Extend(*encoding, {chunk1_cp, chunk2_cp, chunk3_cp});
-    ASSERT_TRUE(extended.ok()) << extended.status();
-    auto extended_face = extended->face();
+    auto extended_face = extended[3]->face();
     ASSERT_TRUE(FontHelper::GlyfData(extended_face.get(), chunk1_gid)->empty());
     ASSERT_TRUE(FontHelper::GlyfData(extended_face.get(), chunk2_gid)->empty());
     ASSERT_FALSE(
@@ -1021,51 +1142,20 @@ TEST_F(IntegrationTest, MixedMode_SequentialDependentPatches) {
 }
 
 TEST_F(IntegrationTest, MixedMode_DesignSpaceAugmentation) {
-  Encoder encoder;
-  auto init_gids = InitEncoderForVfMixedMode(encoder);
-  ASSERT_TRUE(init_gids.ok()) << init_gids.status();
-
-  auto face = noto_sans_vf_.face();
-  auto segment_0 = FontHelper::GidsToUnicodes(face.get(), *init_gids);
-  auto segment_1_gids = TestVfSegment1();
-  auto segment_1 = FontHelper::GidsToUnicodes(face.get(), segment_1_gids);
-  auto segment_2 = FontHelper::GidsToUnicodes(face.get(), TestVfSegment2());
-  auto segment_3 = FontHelper::GidsToUnicodes(face.get(), TestVfSegment3());
-  auto segment_4 = FontHelper::GidsToUnicodes(face.get(), TestVfSegment4());
-
-  // target paritions: {{0, 1}, {2}, {3, 4}} + add wght axis
-  SubsetDefinition base_def;
-  base_def.codepoints.insert(segment_0.begin(), segment_0.end());
-  base_def.codepoints.insert(segment_1.begin(), segment_1.end());
-  base_def.design_space = {{kWght, AxisRange::Point(100)}};
-  auto sc = encoder.SetBaseSubsetFromDef(base_def);
-
-  encoder.AddNonGlyphDataSegment(segment_2);
-  auto segment_3_and_4 = segment_3;
-  segment_3_and_4.insert(segment_4.begin(), segment_4.end());
-  encoder.AddNonGlyphDataSegment(segment_3_and_4);
-  encoder.AddDesignSpaceSegment({{kWght, *AxisRange::Range(100, 900)}});
-
-  sc.Update(encoder.AddGlyphDataPatchCondition(
-      Condition::SimpleCondition(SubsetDefinition::Codepoints(segment_2), 2)));
-  sc.Update(encoder.AddGlyphDataPatchCondition(
-      Condition::SimpleCondition(SubsetDefinition::Codepoints(segment_3), 3)));
-  sc.Update(encoder.AddGlyphDataPatchCondition(
-      Condition::SimpleCondition(SubsetDefinition::Codepoints(segment_4), 4)));
-  ASSERT_TRUE(sc.ok()) << sc;
-
-  auto encoding = encoder.Encode();
-  ASSERT_TRUE(encoding.ok()) << encoding.status();
-  auto encoded_face = encoding->init_font.face();
+  auto shared = VfMixedModeEncoding();
+  ASSERT_TRUE(shared.ok()) << shared.status();
+  const Encoder::Encoding* encoding = &(*shared)->encoding;
+  // Nodes which share a design space share one base gvar table.
+  ASSERT_LE((*shared)->stats.Get(EncoderStats::GENERATE_BASE_GVAR).count, 2);
 
   // Phase 1: non VF augmentation.
-  auto extended = Extend(*encoding, {chunk3_cp, chunk4_cp});
+  auto extended = (*shared)->fontations->Extend({chunk3_cp, chunk4_cp});
   ASSERT_TRUE(extended.ok()) << extended.status();
   auto extended_face = extended->face();
 
   // Phase 2: VF augmentation.
-  encoding->init_font.shallow_copy(*extended);
-  extended = ExtendWithDesignSpace(*encoding, {chunk3_cp, chunk4_cp}, {},
+  extended = ExtendWithDesignSpace(WithInitFont(*encoding, *extended),
+                                   {chunk3_cp, chunk4_cp}, {},
                                    {{kWght, *AxisRange::Range(100, 900)}});
   ASSERT_TRUE(extended.ok()) << extended.status();
   extended_face = extended->face();
@@ -1085,28 +1175,82 @@ TEST_F(IntegrationTest, MixedMode_DesignSpaceAugmentation) {
 }
 
 TEST_F(IntegrationTest, MixedMode_DesignSpaceAugmentation_DropsUnusedPatches) {
+  auto shared = VfMixedModeEncoding();
+  ASSERT_TRUE(shared.ok()) << shared.status();
+
+  btree_set<std::string> fetched_uris;
+  PatchMap::Coverage target{chunk3_cp, chunk4_cp};
+  target.design_space[kWght] = *AxisRange::Range(100, 900);
+  auto extended = (*shared)->fontations->Extend(target, &fetched_uris);
+
+  // correspond to ids 3, 4, 6, d
+  btree_set<std::string> expected_uris{"0O.tk",   "1K.tk",   "1_0C.gk",
+                                       "1_0G.gk", "2_0C.gk", "2_0G.gk"};
+
+  ASSERT_EQ(fetched_uris, expected_uris);
+
+  // TODO check the patches that were used by looking at ift_extend output
+  ASSERT_TRUE(extended.ok()) << extended.status();
+  auto extended_face = extended->face();
+
+  ASSERT_GT(FontHelper::GvarData(extended_face.get(), chunk0_gid)->size(), 0);
+  ASSERT_GT(FontHelper::GvarData(extended_face.get(), chunk1_gid)->size(), 0);
+  ASSERT_EQ(FontHelper::GvarData(extended_face.get(), chunk2_gid)->size(), 0);
+  ASSERT_GT(FontHelper::GvarData(extended_face.get(), chunk3_gid)->size(), 0);
+  ASSERT_GT(FontHelper::GvarData(extended_face.get(), chunk4_gid)->size(), 0);
+}
+
+TEST_F(IntegrationTest, InProcess_MixedMode) {
+  auto shared = MixedModeEncoding();
+  ASSERT_TRUE(shared.ok()) << shared.status();
+  const Encoder::Encoding* encoding = &(*shared)->encoding;
+
+  std::vector<PatchMap::Coverage> targets{
+      {chunk3_cp, chunk4_cp},
+      {chunk2_cp},
+      {},
+  };
+  for (const auto& target : targets) {
+    btree_set<std::string> expected_uris;
+    auto expected = (*shared)->fontations->Extend(target, &expected_uris);
+    ASSERT_TRUE(expected.ok()) << expected.status();
+
+    btree_set<std::string> uris;
+    auto extended = ExtendInProcess(*encoding, target, &uris);
+    ASSERT_TRUE(extended.ok()) << extended.status();
+    ASSERT_EQ(uris, expected_uris);
+
+    auto expected_face = expected->face();
+    auto extended_face = extended->face();
+    auto codepoints = FontHelper::ToCodepointsSet(extended_face.get());
+    ASSERT_EQ(codepoints, FontHelper::ToCodepointsSet(expected_face.get()));
+    for (uint32_t cp : codepoints) {
+      ASSERT_TRUE(
+          GlyphDataMatches(expected_face.get(), extended_face.get(), cp))
+          << cp;
+    }
+  }
+}
+
+TEST_F(IntegrationTest, InProcess_ClientSession) {
   Encoder encoder;
-  auto init_gids = InitEncoderForVfMixedMode(encoder);
+  auto init_gids = InitEncoderForMixedMode(encoder);
   ASSERT_TRUE(init_gids.ok()) << init_gids.status();
 
-  auto face = noto_sans_vf_.face();
+  auto face = noto_sans_jp_.face();
   auto segment_0 = FontHelper::GidsToUnicodes(face.get(), *init_gids);
-  auto segment_1 = FontHelper::GidsToUnicodes(face.get(), TestVfSegment1());
-  auto segment_2 = FontHelper::GidsToUnicodes(face.get(), TestVfSegment2());
-  auto segment_3 = FontHelper::GidsToUnicodes(face.get(), TestVfSegment3());
-  auto segment_4 = FontHelper::GidsToUnicodes(face.get(), TestVfSegment4());
-
-  // target paritions: {{0, 1}, {2}, {3, 4}} + add wght axis
-  SubsetDefinition base_def;
-  base_def.codepoints.insert(segment_0.begin(), segment_0.end());
-  base_def.codepoints.insert(segment_1.begin(), segment_1.end());
-  base_def.design_space = {{kWght, AxisRange::Point(100)}};
-  auto sc = encoder.SetBaseSubsetFromDef(base_def);
+  auto segment_1 = FontHelper::GidsToUnicodes(face.get(), TestSegment1());
+  auto segment_2 = FontHelper::GidsToUnicodes(face.get(), TestSegment2());
+  auto segment_3 = FontHelper::GidsToUnicodes(face.get(), TestSegment3());
+  auto segment_4 = FontHelper::GidsToUnicodes(face.get(), TestSegment4());
+
+  flat_hash_set<uint32_t> base;
+  base.insert(segment_0.begin(), segment_0.end());
+  base.insert(segment_1.begin(), segment_1.end());
+  auto sc = encoder.SetBaseSubset(base);
   encoder.AddNonGlyphDataSegment(segment_2);
-  auto segment_3_and_4 = segment_3;
-  segment_3_and_4.insert(segment_4.begin(), segment_4.end());
-  encoder.AddNonGlyphDataSegment(segment_3_and_4);
-  encoder.AddDesignSpaceSegment({{kWght, *AxisRange::Range(100, 900)}});
+  encoder.AddNonGlyphDataSegment(segment_3);
+  encoder.AddNonGlyphDataSegment(segment_4);
 
   sc.Update(encoder.AddGlyphDataPatchCondition(
       Condition::SimpleCondition(SubsetDefinition::Codepoints(segment_2), 2)));
@@ -1114,33 +1258,112 @@ TEST_F(IntegrationTest, MixedMode_DesignSpaceAugmentation_DropsUnusedPatches) {
       Condition::SimpleCondition(SubsetDefinition::Codepoints(segment_3), 3)));
   sc.Update(encoder.AddGlyphDataPatchCondition(
       Condition::SimpleCondition(SubsetDefinition::Codepoints(segment_4), 4)));
-
   ASSERT_TRUE(sc.ok()) << sc;
 
   auto encoding = encoder.Encode();
   ASSERT_TRUE(encoding.ok()) << encoding.status();
-  auto encoded_face = encoding->init_font.face();
 
-  btree_set<std::string> fetched_uris;
-  auto extended = ExtendWithDesignSpace(*encoding, {chunk3_cp, chunk4_cp}, {},
-                                        {{kWght, *AxisRange::Range(100, 900)}},
-                                        &fetched_uris);
+  std::vector<PatchMap::Coverage> targets;
+  for (const auto& codepoints :
+       {btree_set<uint32_t>{}, btree_set<uint32_t>{chunk2_cp},
+        btree_set<uint32_t>{chunk3_cp},
+        btree_set<uint32_t>{chunk2_cp, chunk3_cp},
+        btree_set<uint32_t>{chunk2_cp, chunk3_cp, chunk4_cp}}) {
+    PatchMap::Coverage target;
+    for (uint32_t cp : codepoints) {
+      target.codepoints.insert(cp);
+    }
+    targets.push_back(target);
+  }
+  // Repeated queries are served from the cache.
+  targets.insert(targets.end(), targets.begin(), targets.end());
 
-  // correspond to ids 3, 4, 6, d
-  btree_set<std::string> expected_uris{"0O.tk",   "1K.tk",   "1_0C.gk",
-                                       "1_0G.gk", "2_0C.gk", "2_0G.gk"};
+  ClientSession session(*encoding);
+  ThreadPool pool(4);
+  auto results = session.ExtendAll(targets, pool);
+  ASSERT_EQ(results.size(), targets.size());
 
-  ASSERT_EQ(fetched_uris, expected_uris);
+  size_t cached = session.NumCachedFonts();
+  ASSERT_GT(cached, 1);
 
-  // TODO check the patches that were used by looking at ift_extend output
+  for (size_t i = 0; i < targets.size(); i++) {
+    ASSERT_TRUE(results[i].ok()) << results[i].status();
+
+    btree_set<std::string> expected_uris;
+    auto expected = ExtendInProcess(*encoding, targets[i], &expected_uris);
+    ASSERT_TRUE(expected.ok()) << expected.status();
+    ASSERT_EQ(results[i]->str(), expected->str()) << i;
+
+    btree_set<std::string> uris;
+    auto extended = session.Extend(targets[i], &uris);
+    ASSERT_TRUE(extended.ok()) << extended.status();
+    ASSERT_EQ(uris, expected_uris);
+    ASSERT_EQ(extended->str(), expected->str()) << i;
+  }
+
+  // Every font was already reached by ExtendAll().
+  ASSERT_EQ(session.NumCachedFonts(), cached);
+
+  // Planning gives the same patches as extending, one round per mapping.
+  const PatchMap::Coverage& all = targets[4];
+  btree_set<std::string> all_uris;
+  ASSERT_TRUE(session.Extend(all, &all_uris).ok());
+
+  auto rounds = session.Plan(all);
+  ASSERT_TRUE(rounds.ok()) << rounds.status();
+  ASSERT_GT(rounds->size(), 1);
+  btree_set<std::string> planned;
+  for (const auto& round : *rounds) {
+    ASSERT_FALSE(round.empty());
+    planned.insert(round.begin(), round.end());
+  }
+  ASSERT_EQ(planned, all_uris);
+
+  // Planning from a partially extended font only includes what's missing.
+  btree_set<std::string> partial_uris;
+  auto partial = session.Extend(targets[1], &partial_uris);
+  ASSERT_TRUE(partial.ok()) << partial.status();
+  auto remaining = session.Plan(*partial, partial_uris, all);
+  ASSERT_TRUE(remaining.ok()) << remaining.status();
+  ASSERT_FALSE(remaining->empty());
+  for (const auto& round : *remaining) {
+    for (const auto& url : round) {
+      ASSERT_FALSE(partial_uris.contains(url)) << url;
+    }
+  }
+
+  auto nothing = session.Plan(*partial, partial_uris, targets[1]);
+  ASSERT_TRUE(nothing.ok()) << nothing.status();
+  ASSERT_TRUE(nothing->empty());
+}
+
+TEST_F(IntegrationTest, InProcess_DesignSpaceAugmentation_DropsUnusedPatches) {
+  auto shared = VfMixedModeEncoding();
+  ASSERT_TRUE(shared.ok()) << shared.status();
+  const Encoder::Encoding* encoding = &(*shared)->encoding;
+
+  btree_set<std::string> applied_uris;
+  auto extended = ExtendWithDesignSpaceInProcess(
+      *encoding, {chunk3_cp, chunk4_cp}, {},
+      {{kWght, *AxisRange::Range(100, 900)}}, &applied_uris);
   ASSERT_TRUE(extended.ok()) << extended.status();
-  auto extended_face = extended->face();
 
+  // Same patches as ift_extend selects.
+  btree_set<std::string> expected_uris{"0O.tk",   "1K.tk",   "1_0C.gk",
+                                       "1_0G.gk", "2_0C.gk", "2_0G.gk"};
+  ASSERT_EQ(applied_uris, expected_uris);
+
+  auto extended_face = extended->face();
   ASSERT_GT(FontHelper::GvarData(extended_face.get(), chunk0_gid)->size(), 0);
   ASSERT_GT(FontHelper::GvarData(extended_face.get(), chunk1_gid)->size(), 0);
   ASSERT_EQ(FontHelper::GvarData(extended_face.get(), chunk2_gid)->size(), 0);
   ASSERT_GT(FontHelper::GvarData(extended_face.get(), chunk3_gid)->size(), 0);
   ASSERT_GT(FontHelper::GvarData(extended_face.get(), chunk4_gid)->size(), 0);
+
+  // An empty target leaves the init font as is.
+  auto unchanged = ExtendInProcess(*encoding, btree_set<uint32_t>{});
+  ASSERT_TRUE(unchanged.ok()) << unchanged.status();
+  ASSERT_EQ(unchanged->str(), encoding->init_font.str());
 }
 
 }  // namespace ift
@@ -0,0 +1,485 @@
+#include "ift/patch_applier.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/btree_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "common/brotli_binary_patch.h"
+#include "common/compat_id.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "common/try.h"
+#include "hb.h"
+
+using absl::btree_map;
+using absl::Status;
+using absl::StatusOr;
+using absl::StrCat;
+using absl::string_view;
+using common::BrotliBinaryPatch;
+using common::CompatId;
+using common::FontData;
+using common::FontHelper;
+using common::hb_blob_unique_ptr;
+using common::hb_face_unique_ptr;
+using common::make_hb_blob;
+using common::make_hb_face;
+
+namespace ift {
+
+static constexpr hb_tag_t kIFTX = HB_TAG('I', 'F', 'T', 'X');
+static constexpr hb_tag_t kTableKeyed = HB_TAG('i', 'f', 't', 'k');
+static constexpr hb_tag_t kGlyphKeyed = HB_TAG('i', 'f', 'g', 'k');
+
+// Offset of the compatibility id in the IFT and IFTX tables.
+static constexpr uint32_t kTableCompatIdOffset = 5;
+
+// Reads a big endian unsigned integer of width bytes at offset.
+static StatusOr<uint32_t> ReadAt(string_view data, uint64_t offset,
+                                 uint32_t width) {
+  if (offset + width > data.size()) {
+    return absl::InvalidArgumentError(
+        StrCat("Unexpected end of data reading ", width, " bytes at ", offset,
+               "."));
+  }
+  uint32_t value = 0;
+  for (uint32_t i = 0; i < width; i++) {
+    value = (value << 8) | (uint8_t)data[offset + i];
+  }
+  return value;
+}
+
+static StatusOr<CompatId> ReadCompatId(string_view data, uint32_t offset) {
+  uint32_t values[4];
+  for (uint32_t i = 0; i < 4; i++) {
+    values[i] = TRY(ReadAt(data, offset + i * 4, 4));
+  }
+  return CompatId(values);
+}
+
+// Reads count + 1 offsets of the given width, each scaled by multiplier.
+static StatusOr<std::vector<uint32_t>> ReadOffsets(string_view data,
+                                                   uint32_t offset,
+                                                   uint32_t count,
+                                                   uint32_t width,
+                                                   uint32_t multiplier) {
+  if (offset + ((uint64_t)count + 1) * width > data.size()) {
+    return absl::InvalidArgumentError("Offset array is out of bounds.");
+  }
+
+  std::vector<uint32_t> offsets;
+  offsets.reserve(count + 1);
+  for (uint32_t i = 0; i <= count; i++) {
+    uint32_t value = TRY(ReadAt(data, offset + (uint64_t)i * width, width));
+    offsets.push_back(value * multiplier);
+    if (i > 0 && offsets[i] < offsets[i - 1]) {
+      return absl::InvalidArgumentError("Offsets are not ascending.");
+    }
+  }
+  return offsets;
+}
+
+// Writes value as a big endian unsigned integer of width (1 to 4) bytes.
+static void WriteUInt(uint32_t value, uint32_t width, std::string& out) {
+  for (uint32_t i = width; i > 0; i--) {
+    out.push_back((char)((value >> (8 * (i - 1))) & 0xFF));
+  }
+}
+
+// Returns [offset, offset + length) of data without copying it.
+static FontData SubData(const FontData& data, uint32_t offset,
+                        uint32_t length) {
+  hb_blob_unique_ptr blob = data.blob();
+  return FontData(
+      make_hb_blob(hb_blob_create_sub_blob(blob.get(), offset, length)));
+}
+
+PatchApplier::PatchApplier(const FontData& font)
+    : PatchApplier(font.face().get()) {}
+
+PatchApplier::PatchApplier(hb_face_t* face) {
+  for (hb_tag_t tag : FontHelper::GetTags(face)) {
+    tables_[tag] = FontHelper::TableData(face, tag);
+  }
+}
+
+Status PatchApplier::Apply(const FontData& patch) {
+  uint32_t format = TRY(ReadAt(patch.str(), 0, 4));
+  if (format == kTableKeyed) {
+    return ApplyTableKeyed(patch);
+  }
+  if (format == kGlyphKeyed) {
+    return ApplyGlyphKeyed(patch);
+  }
+  return absl::InvalidArgumentError(
+      StrCat("Unsupported patch format ", FontHelper::ToString(format), "."));
+}
+
+Status PatchApplier::Apply(const std::vector<FontData>& patches) {
+  for (const auto& patch : patches) {
+    TRYV(Apply(patch));
+  }
+  return absl::OkStatus();
+}
+
+StatusOr<FontData> PatchApplier::Font() {
+  hb_face_unique_ptr face = TRY(Face());
+  hb_blob_unique_ptr blob = make_hb_blob(hb_face_reference_blob(face.get()));
+  return FontData(std::move(blob));
+}
+
+StatusOr<hb_face_unique_ptr> PatchApplier::Face() {
+  TRYV(FlushGlyphData());
+
+  hb_face_unique_ptr builder = make_hb_face(hb_face_builder_create());
+  for (const auto& [tag, data] : tables_) {
+    hb_blob_unique_ptr blob = data.blob();
+    hb_face_builder_add_table(builder.get(), tag, blob.get());
+  }
+  return builder;
+}
+
+Status PatchApplier::CheckCompatId(const CompatId& id) const {
+  for (hb_tag_t tag : {FontHelper::kIFT, kIFTX}) {
+    auto it = tables_.find(tag);
+    if (it == tables_.end()) {
+      continue;
+    }
+    auto table_id = ReadCompatId(it->second.str(), kTableCompatIdOffset);
+    if (table_id.ok() && *table_id == id) {
+      return absl::OkStatus();
+    }
+  }
+  return absl::InvalidArgumentError(
+      "Patch compatibility id does not match the font's IFT or IFTX table.");
+}
+
+Status PatchApplier::ApplyTableKeyed(const FontData& patch) {
+  // Table patches use the current table contents as their base.
+  TRYV(FlushGlyphData());
+
+  string_view data = patch.str();
+  CompatId id = TRY(ReadCompatId(data, 8));
+  TRYV(CheckCompatId(id));
+
+  constexpr uint32_t kOffsetsStart = 26;
+  uint32_t count = TRY(ReadAt(data, 24, 2));
+  std::vector<uint32_t> offsets =
+      TRY(ReadOffsets(data, kOffsetsStart, count, 4, 1));
+  if (offsets.back() > data.size()) {
+    return absl::InvalidArgumentError("Table patch offsets are out of bounds.");
+  }
+
+  struct TablePatch {
+    hb_tag_t tag;
+    bool drop;
+    uint32_t max_length;
+    FontData base;
+    FontData stream;
+    FontData patched;
+    Status status;
+  };
+  std::vector<TablePatch> table_patches(count);
+
+  for (uint32_t i = 0; i < count; i++) {
+    constexpr uint8_t kReplaceTable = 0b01;
+    constexpr uint8_t kDropTable = 0b10;
+    constexpr uint32_t kTablePatchHeaderSize = 9;
+
+    uint32_t start = offsets[i];
+    uint32_t end = offsets[i + 1];
+    if (end - start < kTablePatchHeaderSize) {
+      return absl::InvalidArgumentError("Table patch is too short.");
+    }
+    TablePatch& table_patch = table_patches[i];
+    table_patch.tag = TRY(ReadAt(data, start, 4));
+    uint8_t flags = TRY(ReadAt(data, start + 4, 1));
+    table_patch.drop = flags & kDropTable;
+    table_patch.max_length = TRY(ReadAt(data, start + 5, 4));
+    if (table_patch.drop) {
+      continue;
+    }
+
+    auto it = tables_.find(table_patch.tag);
+    if (!(flags & kReplaceTable) && it != tables_.end()) {
+      table_patch.base.shallow_copy(it->second);
+    }
+    table_patch.stream = SubData(patch, start + kTablePatchHeaderSize,
+                                 end - start - kTablePatchHeaderSize);
+  }
+
+  // Each table's stream is independent so they can be decoded in any order,
+  // results are applied in patch order below.
+  auto decode_one = [](TablePatch& table_patch) {
+    if (table_patch.drop) {
+      return;
+    }
+    table_patch.status =
+        BrotliBinaryPatch().Patch(table_patch.base, table_patch.stream,
+                                  table_patch.max_length, &table_patch.patched);
+  };
+  if (thread_pool_) {
+    thread_pool_->ParallelFor(table_patches.size(), [&](uint32_t i) {
+      decode_one(table_patches[i]);
+    });
+  } else {
+    for (auto& table_patch : table_patches) {
+      decode_one(table_patch);
+    }
+  }
+
+  for (auto& table_patch : table_patches) {
+    TRYV(table_patch.status);
+  }
+  for (auto& table_patch : table_patches) {
+    if (table_patch.drop) {
+      tables_.erase(table_patch.tag);
+    } else {
+      tables_[table_patch.tag] = std::move(table_patch.patched);
+    }
+  }
+
+  return absl::OkStatus();
+}
+
+Status PatchApplier::ApplyGlyphKeyed(const FontData& patch) {
+  constexpr uint32_t kHeaderSize = 29;
+  string_view data = patch.str();
+  if (data.size() < kHeaderSize) {
+    return absl::InvalidArgumentError("Glyph keyed patch is too short.");
+  }
+  uint8_t flags = TRY(ReadAt(data, 8, 1));
+  CompatId id = TRY(ReadCompatId(data, 9));
+  TRYV(CheckCompatId(id));
+  uint32_t max_length = TRY(ReadAt(data, 25, 4));
+
+  FontData decoded;
+  TRYV(BrotliBinaryPatch().Patch(
+      FontData(), SubData(patch, kHeaderSize, data.size() - kHeaderSize),
+      max_length, &decoded));
+  string_view stream = decoded.str();
+
+  uint32_t glyph_count = TRY(ReadAt(stream, 0, 4));
+  uint32_t table_count = TRY(ReadAt(stream, 4, 1));
+  uint32_t gid_width = (flags & 0b1) ? 3 : 2;
+  if (5 + (uint64_t)glyph_count * gid_width > stream.size()) {
+    return absl::InvalidArgumentError("Glyph keyed data stream is too short.");
+  }
+
+  uint64_t offset = 5;
+  std::vector<uint32_t> gids;
+  gids.reserve(glyph_count);
+  for (uint32_t i = 0; i < glyph_count; i++) {
+    gids.push_back(TRY(ReadAt(stream, offset, gid_width)));
+    offset += gid_width;
+  }
+
+  std::vector<hb_tag_t> tags;
+  for (uint32_t i = 0; i < table_count; i++) {
+    hb_tag_t tag = TRY(ReadAt(stream, offset, 4));
+    if (tag != FontHelper::kGlyf && tag != FontHelper::kGvar &&
+        tag != FontHelper::kCFF && tag != FontHelper::kCFF2) {
+      return absl::InvalidArgumentError(StrCat(
+          "Glyph keyed patching of ", FontHelper::ToString(tag),
+          " is not supported."));
+    }
+    tags.push_back(tag);
+    offset += 4;
+  }
+
+  if ((uint64_t)glyph_count * table_count > stream.size() / 4) {
+    return absl::InvalidArgumentError("Glyph keyed data stream is too short.");
+  }
+  std::vector<uint32_t> data_offsets = TRY(
+      ReadOffsets(stream, offset, glyph_count * table_count, 4, 1));
+  if (data_offsets.back() > stream.size()) {
+    return absl::InvalidArgumentError("Glyph data offsets are out of bounds.");
+  }
+
+  for (uint32_t t = 0; t < table_count; t++) {
+    auto& pending = pending_glyph_data_[tags[t]];
+    for (uint32_t i = 0; i < glyph_count; i++) {
+      uint32_t index = t * glyph_count + i;
+      pending[gids[i]] = std::string(stream.substr(
+          data_offsets[index], data_offsets[index + 1] - data_offsets[index]));
+    }
+  }
+
+  return absl::OkStatus();
+}
+
+Status PatchApplier::FlushGlyphData() {
+  auto glyf = pending_glyph_data_.find(FontHelper::kGlyf);
+  if (glyf != pending_glyph_data_.end()) {
+    TRYV(FlushGlyfAndLoca(glyf->second));
+  }
+  auto gvar = pending_glyph_data_.find(FontHelper::kGvar);
+  if (gvar != pending_glyph_data_.end()) {
+    TRYV(FlushGvar(gvar->second));
+  }
+  for (hb_tag_t tag : {FontHelper::kCFF, FontHelper::kCFF2}) {
+    auto cff = pending_glyph_data_.find(tag);
+    if (cff != pending_glyph_data_.end()) {
+      TRYV(FlushCharStrings(tag, cff->second));
+    }
+  }
+  pending_glyph_data_.clear();
+  return absl::OkStatus();
+}
+
+Status PatchApplier::FlushGlyfAndLoca(
+    const btree_map<uint32_t, std::string>& glyphs) {
+  auto head = tables_.find(FontHelper::kHead);
+  auto loca = tables_.find(FontHelper::kLoca);
+  auto glyf = tables_.find(FontHelper::kGlyf);
+  if (head == tables_.end() || loca == tables_.end() ||
+      glyf == tables_.end()) {
+    return absl::InvalidArgumentError(
+        "Glyph keyed patch has glyf data but the font has no glyf, loca, or "
+        "head table.");
+  }
+
+  bool is_short_loca = !TRY(ReadAt(head->second.str(), 50, 2));
+  uint32_t width = is_short_loca ? 2 : 4;
+  string_view loca_data = loca->second.str();
+  string_view glyf_data = glyf->second.str();
+  if (loca_data.size() < width) {
+    return absl::InvalidArgumentError("loca table is too short.");
+  }
+  uint32_t glyph_count = loca_data.size() / width - 1;
+  std::vector<uint32_t> offsets = TRY(ReadOffsets(
+      loca_data, 0, glyph_count, width, is_short_loca ? 2 : 1));
+  if (offsets.back() > glyf_data.size()) {
+    return absl::InvalidArgumentError("loca offsets exceed the glyf table.");
+  }
+
+  std::string new_glyf;
+  std::string new_loca;
+  new_loca.reserve(loca_data.size());
+  for (uint32_t gid = 0; gid < glyph_count; gid++) {
+    WriteUInt(is_short_loca ? new_glyf.size() / 2 : new_glyf.size(), width,
+              new_loca);
+    auto it = glyphs.find(gid);
+    if (it != glyphs.end()) {
+      new_glyf += it->second;
+    } else {
+      new_glyf +=
+          glyf_data.substr(offsets[gid], offsets[gid + 1] - offsets[gid]);
+    }
+    if (is_short_loca && new_glyf.size() % 2) {
+      // Short loca can only address even offsets.
+      new_glyf.push_back(0);
+    }
+  }
+  if (is_short_loca && new_glyf.size() / 2 > 0xFFFF) {
+    return absl::InvalidArgumentError(
+        "Patched glyf table is too large for a short loca table.");
+  }
+  WriteUInt(is_short_loca ? new_glyf.size() / 2 : new_glyf.size(), width,
+            new_loca);
+
+  glyf->second.take(std::move(new_glyf));
+  loca->second.take(std::move(new_loca));
+  return absl::OkStatus();
+}
+
+Status PatchApplier::FlushGvar(const btree_map<uint32_t, std::string>& glyphs) {
+  auto gvar = tables_.find(FontHelper::kGvar);
+  if (gvar == tables_.end()) {
+    return absl::InvalidArgumentError(
+        "Glyph keyed patch has gvar data but the font has no gvar table.");
+  }
+
+  constexpr uint32_t kHeaderSize = 20;
+  string_view data = gvar->second.str();
+  uint32_t axis_count = TRY(ReadAt(data, 4, 2));
+  uint32_t shared_tuple_count = TRY(ReadAt(data, 6, 2));
+  uint32_t shared_tuples_offset = TRY(ReadAt(data, 8, 4));
+  uint32_t glyph_count = TRY(ReadAt(data, 12, 2));
+  uint32_t flags = TRY(ReadAt(data, 14, 2));
+  uint32_t data_array_offset = TRY(ReadAt(data, 16, 4));
+
+  bool long_offsets = flags & 0x1;
+  std::vector<uint32_t> offsets =
+      TRY(ReadOffsets(data, kHeaderSize, glyph_count, long_offsets ? 4 : 2,
+                      long_offsets ? 1 : 2));
+  uint64_t shared_tuples_length = 2ull * axis_count * shared_tuple_count;
+  if ((uint64_t)data_array_offset + offsets.back() > data.size() ||
+      shared_tuples_offset + shared_tuples_length > data.size()) {
+    return absl::InvalidArgumentError("gvar offsets are out of bounds.");
+  }
+  string_view glyph_data = data.substr(data_array_offset);
+
+  std::string new_glyph_data;
+  std::vector<uint32_t> new_offsets;
+  new_offsets.reserve(glyph_count + 1);
+  for (uint32_t gid = 0; gid < glyph_count; gid++) {
+    new_offsets.push_back(new_glyph_data.size());
+    auto it = glyphs.find(gid);
+    if (it != glyphs.end()) {
+      new_glyph_data += it->second;
+    } else {
+      new_glyph_data +=
+          glyph_data.substr(offsets[gid], offsets[gid + 1] - offsets[gid]);
+    }
+    if (!long_offsets && new_glyph_data.size() % 2) {
+      // Short offsets can only address even offsets.
+      new_glyph_data.push_back(0);
+    }
+  }
+  new_offsets.push_back(new_glyph_data.size());
+  if (!long_offsets && new_glyph_data.size() / 2 > 0xFFFF) {
+    long_offsets = true;
+    flags |= 0x1;
+  }
+
+  uint32_t offset_width = long_offsets ? 4 : 2;
+  uint32_t new_shared_tuples_offset =
+      kHeaderSize + (glyph_count + 1) * offset_width;
+  uint32_t new_data_array_offset =
+      new_shared_tuples_offset + shared_tuples_length;
+
+  std::string new_gvar;
+  new_gvar.reserve(new_data_array_offset + new_glyph_data.size());
+  new_gvar += data.substr(0, 8);  // version, axisCount, sharedTupleCount
+  FontHelper::WriteUInt32(new_shared_tuples_offset, new_gvar);
+  FontHelper::WriteUInt16(glyph_count, new_gvar);
+  FontHelper::WriteUInt16(flags, new_gvar);
+  FontHelper::WriteUInt32(new_data_array_offset, new_gvar);
+  for (uint32_t value : new_offsets) {
+    WriteUInt(long_offsets ? value : value / 2, offset_width, new_gvar);
+  }
+  new_gvar += data.substr(shared_tuples_offset, shared_tuples_length);
+  new_gvar += new_glyph_data;
+
+  gvar->second.take(std::move(new_gvar));
+  return absl::OkStatus();
+}
+
+Status PatchApplier::FlushCharStrings(
+    hb_tag_t tag, const btree_map<uint32_t, std::string>& glyphs) {
+  auto cff = tables_.find(tag);
+  if (cff == tables_.end()) {
+    return absl::InvalidArgumentError(
+        StrCat("Glyph keyed patch has ", FontHelper::ToString(tag),
+               " data but the font has no ", FontHelper::ToString(tag),
+               " table."));
+  }
+
+  std::string new_cff = TRY(FontHelper::RebuildCffCharStrings(
+      cff->second.str(), tag == FontHelper::kCFF2,
+      [&](uint32_t gid, string_view current) -> string_view {
+        auto it = glyphs.find(gid);
+        return it != glyphs.end() ? string_view(it->second) : current;
+      }));
+  cff->second.take(std::move(new_cff));
+  return absl::OkStatus();
+}
+
+}  // namespace ift
@@ -0,0 +1,95 @@
+#ifndef IFT_PATCH_APPLIER_H_
+#define IFT_PATCH_APPLIER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/container/btree_map.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "common/compat_id.h"
+#include "common/font_data.h"
+#include "common/thread_pool.h"
+#include "hb.h"
+
+namespace ift {
+
+/*
+ * Applies a sequence of table keyed (iftk) and glyph keyed (ifgk) patches to a
+ * font: https://w3c.github.io/IFT/Overview.html#font-patch-formats
+ *
+ * The font is held as a set of individual tables, each patch only touches the
+ * tables it modifies. Glyph keyed data is accumulated per glyph and merged
+ * into glyf, loca, gvar and the CFF/CFF2 CharStrings INDEX only when those
+ * tables are next needed, so a run of glyph keyed patches rebuilds them once.
+ * The CharStrings INDEX must be at the end of the CFF or CFF2 table. The font
+ * binary itself is only assembled when Font() is called, avoiding a full copy
+ * of the font per patch.
+ *
+ * Tracking which glyph keyed patches have been applied (they don't modify the
+ * patch mapping) is left to the caller.
+ */
+class PatchApplier {
+ public:
+  explicit PatchApplier(const common::FontData& font);
+
+  // Starts from the tables of face, which may be a face builder such as one
+  // returned by Face(). The tables are referenced, not copied.
+  explicit PatchApplier(hb_face_t* face);
+
+  // If set, the per table streams of table keyed patches are decoded
+  // concurrently on this pool. Results are identical to sequential
+  // application. Apply() may be called from a task running on the same pool,
+  // see ThreadPool::ParallelFor(). The pool must outlive this applier.
+  void SetThreadPool(common::ThreadPool* pool) { thread_pool_ = pool; }
+
+  // Applies patch to the current font, the format is detected from the patch
+  // header.
+  absl::Status Apply(const common::FontData& patch);
+
+  // Applies each of patches in order, stopping at the first failure.
+  absl::Status Apply(const std::vector<common::FontData>& patches);
+
+  // Assembles the font with all patches applied so far.
+  absl::StatusOr<common::FontData> Font();
+
+  /*
+   * Returns a face builder holding the tables with all patches applied so
+   * far. Decoded tables are added to the builder as is, so unlike Font() the
+   * font binary isn't assembled until the face's blob is referenced. Prefer
+   * this when the result will only be read or patched further.
+   */
+  absl::StatusOr<common::hb_face_unique_ptr> Face();
+
+ private:
+  absl::Status ApplyTableKeyed(const common::FontData& patch);
+  absl::Status ApplyGlyphKeyed(const common::FontData& patch);
+
+  // Checks that id matches the compatibility id of the font's IFT or IFTX
+  // table.
+  absl::Status CheckCompatId(const common::CompatId& id) const;
+
+  // Merges any pending glyph keyed data into the glyf, loca, gvar, CFF and
+  // CFF2 tables.
+  absl::Status FlushGlyphData();
+  absl::Status FlushGlyfAndLoca(
+      const absl::btree_map<uint32_t, std::string>& glyphs);
+  absl::Status FlushGvar(const absl::btree_map<uint32_t, std::string>& glyphs);
+  // Rebuilds the CharStrings INDEX of the CFF or CFF2 table 'tag'.
+  absl::Status FlushCharStrings(
+      hb_tag_t tag, const absl::btree_map<uint32_t, std::string>& glyphs);
+
+  common::ThreadPool* thread_pool_ = nullptr;
+
+  absl::flat_hash_map<hb_tag_t, common::FontData> tables_;
+
+  // Glyph keyed data not yet merged into the font: table tag -> gid -> data.
+  absl::flat_hash_map<hb_tag_t, absl::btree_map<uint32_t, std::string>>
+      pending_glyph_data_;
+};
+
+}  // namespace ift
+
+#endif  // IFT_PATCH_APPLIER_H_
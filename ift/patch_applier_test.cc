@@ -0,0 +1,324 @@
+#include "ift/patch_applier.h"
+
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "common/compat_id.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "common/thread_pool.h"
+#include "gtest/gtest.h"
+#include "hb.h"
+#include "ift/glyph_keyed_diff.h"
+#include "ift/table_keyed_diff.h"
+
+using absl::flat_hash_set;
+using common::CompatId;
+using common::FontData;
+using common::FontHelper;
+using common::hb_face_unique_ptr;
+
+namespace ift {
+
+class PatchApplierTest : public ::testing::Test {
+ protected:
+  static std::string IftTable(const CompatId& id) {
+    std::string table;
+    FontHelper::WriteUInt8(0x02, table);  // format
+    FontHelper::WriteUInt32(0, table);    // reserved
+    id.WriteTo(table);
+    return table;
+  }
+
+  static std::string Glyf(const std::vector<std::string>& glyphs) {
+    std::string table;
+    for (const auto& glyph : glyphs) {
+      table += glyph;
+    }
+    return table;
+  }
+
+  // Short loca, glyphs must have even lengths.
+  static std::string Loca(const std::vector<std::string>& glyphs) {
+    std::string table;
+    uint32_t offset = 0;
+    FontHelper::WriteUInt16(0, table);
+    for (const auto& glyph : glyphs) {
+      offset += glyph.size();
+      FontHelper::WriteUInt16(offset / 2, table);
+    }
+    return table;
+  }
+
+  // Single axis, no shared tuples, short offsets.
+  static std::string Gvar(const std::vector<std::string>& glyphs) {
+    std::string table;
+    uint32_t data_offset = 20 + (glyphs.size() + 1) * 2;
+    FontHelper::WriteUInt16(1, table);  // major version
+    FontHelper::WriteUInt16(0, table);  // minor version
+    FontHelper::WriteUInt16(1, table);  // axis count
+    FontHelper::WriteUInt16(0, table);  // shared tuple count
+    FontHelper::WriteUInt32(data_offset, table);
+    FontHelper::WriteUInt16(glyphs.size(), table);
+    FontHelper::WriteUInt16(0, table);  // flags
+    FontHelper::WriteUInt32(data_offset, table);
+    table += Loca(glyphs);
+    table += Glyf(glyphs);
+    return table;
+  }
+
+  static FontData GlyphFont(const std::vector<std::string>& glyphs,
+                            const std::vector<std::string>& variations,
+                            const CompatId& id) {
+    return FontHelper::BuildFont({
+        {FontHelper::kIFT, IftTable(id)},
+        {FontHelper::kHead, std::string(54, 0)},
+        {FontHelper::kLoca, Loca(glyphs)},
+        {FontHelper::kGlyf, Glyf(glyphs)},
+        {FontHelper::kGvar, Gvar(variations)},
+    });
+  }
+
+  // A CFF (or CFF2) table with just enough structure to locate the CharStrings
+  // INDEX, which is placed at the end. The charstrings must total less than
+  // 255 bytes.
+  static std::string Cff(const std::vector<std::string>& charstrings,
+                         bool is_cff2) {
+    std::string table;
+    uint32_t charstrings_offset;
+    if (is_cff2) {
+      // Header, then a Top DICT of: <offset> CharStrings.
+      table = {0x02, 0x00, 0x05, 0x00, 0x02};
+      charstrings_offset = 7;
+    } else {
+      // Header, Name INDEX with one name, Top DICT INDEX with a Top DICT of:
+      // <offset> CharStrings.
+      table = {0x01, 0x00, 0x04, 0x01};
+      table += {0x00, 0x01, 0x01, 0x01, 0x02, 'a'};
+      table += {0x00, 0x01, 0x01, 0x01, 0x03};
+      charstrings_offset = 17;
+    }
+    FontHelper::WriteUInt8(139 + charstrings_offset, table);
+    FontHelper::WriteUInt8(17, table);
+
+    if (is_cff2) {
+      FontHelper::WriteUInt32(charstrings.size(), table);
+    } else {
+      FontHelper::WriteUInt16(charstrings.size(), table);
+    }
+    FontHelper::WriteUInt8(1, table);  // offSize
+    uint32_t offset = 1;
+    FontHelper::WriteUInt8(offset, table);
+    for (const auto& charstring : charstrings) {
+      offset += charstring.size();
+      FontHelper::WriteUInt8(offset, table);
+    }
+    for (const auto& charstring : charstrings) {
+      table += charstring;
+    }
+    return table;
+  }
+
+  static std::string Table(const FontData& font, hb_tag_t tag) {
+    hb_face_unique_ptr face = font.face();
+    return FontHelper::TableData(face.get(), tag).string();
+  }
+
+  CompatId id_1{1, 2, 3, 4};
+  CompatId id_2{5, 6, 7, 8};
+  hb_tag_t tag_1 = HB_TAG('t', 'a', 'g', '1');
+  hb_tag_t tag_2 = HB_TAG('t', 'a', 'g', '2');
+  hb_tag_t tag_3 = HB_TAG('t', 'a', 'g', '3');
+};
+
+TEST_F(PatchApplierTest, TableKeyedChain) {
+  FontData base = FontHelper::BuildFont({
+      {FontHelper::kIFT, IftTable(id_1)},
+      {tag_1, "foo"},
+      {tag_2, "bar"},
+  });
+  FontData middle = FontHelper::BuildFont({
+      {FontHelper::kIFT, IftTable(id_2)},
+      {tag_1, "fooo"},
+      {tag_2, "bar"},
+      {tag_3, "baz"},
+  });
+  FontData derived = FontHelper::BuildFont({
+      {tag_1, "foooo"},
+      {tag_3, "baz"},
+  });
+
+  FontData patch_1, patch_2;
+  ASSERT_EQ(TableKeyedDiff(id_1).Diff(base, middle, &patch_1),
+            absl::OkStatus());
+  ASSERT_EQ(TableKeyedDiff(id_2).Diff(middle, derived, &patch_2),
+            absl::OkStatus());
+
+  std::vector<FontData> patches;
+  patches.push_back(std::move(patch_1));
+  patches.push_back(std::move(patch_2));
+
+  PatchApplier applier(base);
+  ASSERT_EQ(applier.Apply(patches), absl::OkStatus());
+  auto result = applier.Font();
+  ASSERT_TRUE(result.ok()) << result.status();
+
+  hb_face_unique_ptr face = result->face();
+  EXPECT_EQ(FontHelper::GetTags(face.get()),
+            (flat_hash_set<hb_tag_t>{tag_1, tag_3}));
+  EXPECT_EQ(Table(*result, tag_1), "foooo");
+  EXPECT_EQ(Table(*result, tag_3), "baz");
+}
+
+TEST_F(PatchApplierTest, TableKeyed_Face) {
+  FontData base = FontHelper::BuildFont({
+      {FontHelper::kIFT, IftTable(id_1)},
+      {tag_1, "foo"},
+      {tag_2, "bar"},
+  });
+  FontData middle = FontHelper::BuildFont({
+      {FontHelper::kIFT, IftTable(id_2)},
+      {tag_1, "fooo"},
+      {tag_2, "bar"},
+  });
+  FontData derived = FontHelper::BuildFont({
+      {tag_1, "foooo"},
+      {tag_3, "baz"},
+  });
+
+  FontData patch_1, patch_2;
+  ASSERT_EQ(TableKeyedDiff(id_1).Diff(base, middle, &patch_1),
+            absl::OkStatus());
+  ASSERT_EQ(TableKeyedDiff(id_2).Diff(middle, derived, &patch_2),
+            absl::OkStatus());
+
+  // Each step continues from the face builder of the last.
+  PatchApplier applier(base);
+  ASSERT_EQ(applier.Apply(patch_1), absl::OkStatus());
+  auto face = applier.Face();
+  ASSERT_TRUE(face.ok()) << face.status();
+  EXPECT_EQ(FontHelper::TableData(face->get(), tag_1).string(), "fooo");
+
+  PatchApplier next(face->get());
+  ASSERT_EQ(next.Apply(patch_2), absl::OkStatus());
+  face = next.Face();
+  ASSERT_TRUE(face.ok()) << face.status();
+  EXPECT_EQ(FontHelper::GetTags(face->get()),
+            (flat_hash_set<hb_tag_t>{tag_1, tag_3}));
+  EXPECT_EQ(FontHelper::TableData(face->get(), tag_1).string(), "foooo");
+  EXPECT_EQ(FontHelper::TableData(face->get(), tag_3).string(), "baz");
+}
+
+TEST_F(PatchApplierTest, TableKeyed_ThreadPool) {
+  FontData base = FontHelper::BuildFont({
+      {FontHelper::kIFT, IftTable(id_1)},
+      {tag_1, "foo"},
+      {tag_2, "bar"},
+  });
+  FontData derived = FontHelper::BuildFont({
+      {tag_1, "fooo"},
+      {tag_2, "baar"},
+      {tag_3, "baz"},
+  });
+
+  FontData patch;
+  ASSERT_EQ(TableKeyedDiff(id_1).Diff(base, derived, &patch),
+            absl::OkStatus());
+
+  common::ThreadPool pool(3);
+  PatchApplier applier(base);
+  applier.SetThreadPool(&pool);
+  ASSERT_EQ(applier.Apply(patch), absl::OkStatus());
+  auto result = applier.Font();
+  ASSERT_TRUE(result.ok()) << result.status();
+
+  EXPECT_EQ(Table(*result, tag_1), "fooo");
+  EXPECT_EQ(Table(*result, tag_2), "baar");
+  EXPECT_EQ(Table(*result, tag_3), "baz");
+  EXPECT_EQ(Table(*result, FontHelper::kIFT), "");
+}
+
+TEST_F(PatchApplierTest, GlyphKeyed) {
+  FontData base = GlyphFont({"ab", "", "", "cdef"}, {"gv", "", "", "ghij"},
+                            id_1);
+  FontData full =
+      GlyphFont({"ab", "xyzw", "12", "cdef"}, {"gv", "klmn", "", "ghij"}, id_1);
+
+  GlyphKeyedDiff glyf_diff(full, id_1, {FontHelper::kGlyf});
+  GlyphKeyedDiff gvar_diff(full, id_1, {FontHelper::kGvar});
+  auto patch_1 = glyf_diff.CreatePatch({1, 2});
+  auto patch_2 = gvar_diff.CreatePatch({1});
+  ASSERT_TRUE(patch_1.ok()) << patch_1.status();
+  ASSERT_TRUE(patch_2.ok()) << patch_2.status();
+
+  PatchApplier applier(base);
+  ASSERT_EQ(applier.Apply(*patch_1), absl::OkStatus());
+  ASSERT_EQ(applier.Apply(*patch_2), absl::OkStatus());
+  auto result = applier.Font();
+  ASSERT_TRUE(result.ok()) << result.status();
+
+  EXPECT_EQ(Table(*result, FontHelper::kGlyf), Table(full, FontHelper::kGlyf));
+  EXPECT_EQ(Table(*result, FontHelper::kLoca), Table(full, FontHelper::kLoca));
+  EXPECT_EQ(Table(*result, FontHelper::kGvar), Table(full, FontHelper::kGvar));
+}
+
+TEST_F(PatchApplierTest, GlyphKeyed_Cff) {
+  for (bool is_cff2 : {false, true}) {
+    hb_tag_t tag = is_cff2 ? FontHelper::kCFF2 : FontHelper::kCFF;
+    FontData base = FontHelper::BuildFont({
+        {FontHelper::kIFT, IftTable(id_1)},
+        {tag, Cff({"ab", "", "", "cdef"}, is_cff2)},
+    });
+    FontData full = FontHelper::BuildFont({
+        {FontHelper::kIFT, IftTable(id_1)},
+        {tag, Cff({"ab", "xyz", "1", "cdef"}, is_cff2)},
+    });
+
+    GlyphKeyedDiff diff(full, id_1, {tag});
+    auto patch_1 = diff.CreatePatch({1});
+    auto patch_2 = diff.CreatePatch({2});
+    ASSERT_TRUE(patch_1.ok()) << patch_1.status();
+    ASSERT_TRUE(patch_2.ok()) << patch_2.status();
+
+    PatchApplier applier(base);
+    ASSERT_EQ(applier.Apply(*patch_1), absl::OkStatus());
+    ASSERT_EQ(applier.Apply(*patch_2), absl::OkStatus());
+    auto result = applier.Font();
+    ASSERT_TRUE(result.ok()) << result.status();
+    EXPECT_EQ(Table(*result, tag), Table(full, tag));
+  }
+}
+
+TEST_F(PatchApplierTest, GlyphKeyed_CffCharStringsNotAtEnd) {
+  FontData base = FontHelper::BuildFont({
+      {FontHelper::kIFT, IftTable(id_1)},
+      {FontHelper::kCFF, Cff({"ab", ""}, false) + "trailing"},
+  });
+  FontData full = FontHelper::BuildFont({
+      {FontHelper::kIFT, IftTable(id_1)},
+      {FontHelper::kCFF, Cff({"ab", "cd"}, false)},
+  });
+
+  auto patch = GlyphKeyedDiff(full, id_1, {FontHelper::kCFF}).CreatePatch({1});
+  ASSERT_TRUE(patch.ok()) << patch.status();
+
+  PatchApplier applier(base);
+  ASSERT_EQ(applier.Apply(*patch), absl::OkStatus());
+  EXPECT_TRUE(absl::IsInvalidArgument(applier.Font().status()));
+}
+
+TEST_F(PatchApplierTest, CompatIdMismatch) {
+  FontData base = GlyphFont({"ab", ""}, {"gv", ""}, id_1);
+  FontData full = GlyphFont({"ab", "cd"}, {"gv", ""}, id_1);
+
+  auto patch = GlyphKeyedDiff(full, id_2, {FontHelper::kGlyf}).CreatePatch({1});
+  ASSERT_TRUE(patch.ok()) << patch.status();
+
+  PatchApplier applier(base);
+  EXPECT_TRUE(absl::IsInvalidArgument(applier.Apply(*patch)));
+}
+
+}  // namespace ift
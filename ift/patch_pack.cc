@@ -0,0 +1,161 @@
+#include "ift/patch_pack.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "common/try.h"
+#include "hb.h"
+
+using absl::Status;
+using absl::StatusOr;
+using absl::StrCat;
+using absl::string_view;
+using common::FontData;
+using common::FontHelper;
+
+namespace ift {
+
+static constexpr hb_tag_t kTag = HB_TAG('I', 'F', 'T', 'P');
+static constexpr size_t kRecordSize = 20;
+static constexpr size_t kTrailerSize = 12;
+
+// Callers must check the bounds, lookups are done after validation in Parse()
+// so this avoids the overhead of status checks.
+static uint32_t ReadUInt32(const char* data) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) |
+         ((uint32_t)bytes[2] << 8) | (uint32_t)bytes[3];
+}
+
+static uint64_t ReadUInt64(const char* data) {
+  return ((uint64_t)ReadUInt32(data) << 32) | ReadUInt32(data + 4);
+}
+
+static void WriteUInt64(uint64_t value, std::string& out) {
+  FontHelper::WriteUInt32(value >> 32, out);
+  FontHelper::WriteUInt32(value & 0xFFFFFFFF, out);
+}
+
+StatusOr<PatchPack> PatchPack::Load(const std::string& path) {
+  return Parse(TRY(FontData::FromFile(path)));
+}
+
+StatusOr<PatchPack> PatchPack::Parse(FontData data) {
+  string_view pack = data.str();
+  if (pack.size() < kHeaderSize + kTrailerSize ||
+      ReadUInt32(pack.data()) != kTag) {
+    return absl::InvalidArgumentError("Not a patch pack.");
+  }
+  uint32_t version = ReadUInt32(pack.data() + 4);
+  if (version != kVersion) {
+    return absl::InvalidArgumentError(
+        StrCat("Unsupported patch pack version ", version, "."));
+  }
+
+  uint64_t index_end = pack.size() - kTrailerSize;
+  uint64_t index_offset = ReadUInt64(pack.data() + index_end);
+  uint32_t count = ReadUInt32(pack.data() + index_end + 8);
+  if (index_offset < kHeaderSize || index_offset > index_end ||
+      (uint64_t)count * kRecordSize > index_end - index_offset) {
+    return absl::InvalidArgumentError("Patch pack index is out of bounds.");
+  }
+
+  PatchPack result(std::move(data), index_offset, count);
+  uint64_t urls_size = index_end - index_offset - (uint64_t)count * kRecordSize;
+  for (uint32_t i = 0; i < count; i++) {
+    const char* record = result.Record(i);
+    uint64_t offset = ReadUInt64(record);
+    uint32_t length = ReadUInt32(record + 8);
+    uint32_t url_offset = ReadUInt32(record + 12);
+    uint32_t url_length = ReadUInt32(record + 16);
+    if (offset < kHeaderSize || offset > index_offset ||
+        length > index_offset - offset || url_offset > urls_size ||
+        url_length > urls_size - url_offset) {
+      return absl::InvalidArgumentError(
+          StrCat("Patch pack record ", i, " is out of bounds."));
+    }
+    if (i > 0 && !(result.Url(i - 1) < result.Url(i))) {
+      return absl::InvalidArgumentError(
+          StrCat("Patch pack record ", i, " is not in url order."));
+    }
+  }
+  return result;
+}
+
+const char* PatchPack::Record(uint32_t i) const {
+  return data_.data() + index_offset_ + (uint64_t)i * kRecordSize;
+}
+
+string_view PatchPack::Url(uint32_t i) const {
+  const char* record = Record(i);
+  const char* urls = Record(count_);
+  return string_view(urls + ReadUInt32(record + 12), ReadUInt32(record + 16));
+}
+
+PatchPack::Range PatchPack::At(uint32_t i) const {
+  const char* record = Record(i);
+  return Range{ReadUInt64(record), ReadUInt32(record + 8)};
+}
+
+StatusOr<PatchPack::Range> PatchPack::Find(string_view url) const {
+  uint32_t low = 0;
+  uint32_t high = count_;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    if (Url(mid) < url) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low == count_ || Url(low) != url) {
+    return absl::NotFoundError(StrCat("Patch '", url, "' is not in the pack."));
+  }
+  return At(low);
+}
+
+StatusOr<string_view> PatchPack::Get(string_view url) const {
+  Range range = TRY(Find(url));
+  return str().substr(range.offset, range.length);
+}
+
+void PatchPack::WriteHeader(std::string& out) {
+  FontHelper::WriteUInt32(kTag, out);
+  FontHelper::WriteUInt32(kVersion, out);
+}
+
+Status PatchPack::WriteIndex(std::vector<std::pair<std::string, Range>> entries,
+                             uint64_t index_offset, std::string& out) {
+  std::sort(entries.begin(), entries.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  std::string urls;
+  for (size_t i = 0; i < entries.size(); i++) {
+    const auto& [url, range] = entries[i];
+    if (i > 0 && entries[i - 1].first == url) {
+      return absl::InvalidArgumentError(
+          StrCat("Patch '", url, "' was added to the pack more than once."));
+    }
+    WriteUInt64(range.offset, out);
+    FontHelper::WriteUInt32(range.length, out);
+    FontHelper::WriteUInt32(urls.size(), out);
+    FontHelper::WriteUInt32(url.size(), out);
+    urls.append(url);
+  }
+  out.append(urls);
+
+  WriteUInt64(index_offset, out);
+  FontHelper::WriteUInt32(entries.size(), out);
+  return absl::OkStatus();
+}
+
+}  // namespace ift
@@ -0,0 +1,105 @@
+#ifndef IFT_PATCH_PACK_H_
+#define IFT_PATCH_PACK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "common/font_data.h"
+
+namespace ift {
+
+/*
+ * A single file holding every patch of an encoding along with an index from
+ * patch url to the location of the patch in the file. Packs are written by
+ * ift::encoder::PackPatchSink.
+ *
+ * The index is made of fixed size records sorted by url, so a pack can be
+ * memory mapped and searched in place. This lets a server answer a patch
+ * request with a byte range of one shared mapping instead of opening a file
+ * per patch.
+ *
+ * Layout, with all integers big endian:
+ *   header:  'IFTP', uint32 version
+ *   data:    the patches, back to back
+ *   index:   one record per patch, sorted by url:
+ *              uint64 offset, uint32 length, uint32 url_offset,
+ *              uint32 url_length
+ *   urls:    the patch urls, url_offset is relative to the start of these
+ *   trailer: uint64 offset of the index, uint32 number of records
+ */
+class PatchPack {
+ public:
+  static constexpr uint32_t kVersion = 1;
+  static constexpr size_t kHeaderSize = 8;
+
+  // The location of a patch within the pack.
+  struct Range {
+    uint64_t offset;
+    uint32_t length;
+
+    bool operator==(const Range& other) const {
+      return offset == other.offset && length == other.length;
+    }
+  };
+
+  /*
+   * Loads the pack at path. Where supported the file is memory mapped rather
+   * than read into memory.
+   */
+  static absl::StatusOr<PatchPack> Load(const std::string& path);
+
+  /*
+   * Checks that data is a well formed pack and takes ownership of it. Every
+   * index record is validated here so lookups don't need to.
+   */
+  static absl::StatusOr<PatchPack> Parse(common::FontData data);
+
+  // Returns the location of the patch for url.
+  absl::StatusOr<Range> Find(absl::string_view url) const;
+
+  // Returns the patch for url, the result points into this pack.
+  absl::StatusOr<absl::string_view> Get(absl::string_view url) const;
+
+  // The number of patches in the pack.
+  uint32_t size() const { return count_; }
+
+  // The url and location of the i'th patch in url order.
+  absl::string_view Url(uint32_t i) const;
+  Range At(uint32_t i) const;
+
+  // The entire pack.
+  absl::string_view str() const { return data_.str(); }
+
+  // Appends the header of a pack to out.
+  static void WriteHeader(std::string& out);
+
+  /*
+   * Appends the index and trailer for a pack whose patches are given by
+   * entries to out. The index is placed at index_offset, which must follow the
+   * last patch. Entries are sorted by url, it's an error for a url to appear
+   * more than once.
+   */
+  static absl::Status WriteIndex(
+      std::vector<std::pair<std::string, Range>> entries,
+      uint64_t index_offset, std::string& out);
+
+ private:
+  PatchPack(common::FontData data, uint64_t index_offset, uint32_t count)
+      : data_(std::move(data)), index_offset_(index_offset), count_(count) {}
+
+  const char* Record(uint32_t i) const;
+
+  common::FontData data_;
+  uint64_t index_offset_;
+  uint32_t count_;
+};
+
+}  // namespace ift
+
+#endif  // IFT_PATCH_PACK_H_
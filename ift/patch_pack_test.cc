@@ -0,0 +1,113 @@
+#include "ift/patch_pack.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "common/font_data.h"
+#include "gtest/gtest.h"
+
+using common::FontData;
+
+namespace ift {
+
+class PatchPackTest : public ::testing::Test {
+ protected:
+  PatchPackTest() {
+    PatchPack::WriteHeader(pack_);
+    Append("b.gk", "defg");
+    Append("a.tk", "abc");
+    Append("", "");
+    Append("c.tk", "hi");
+  }
+
+  void Append(std::string url, std::string patch) {
+    entries_.push_back(
+        {std::move(url), {pack_.size(), (uint32_t)patch.size()}});
+    pack_.append(patch);
+  }
+
+  std::string Build() {
+    std::string pack = pack_;
+    EXPECT_TRUE(PatchPack::WriteIndex(entries_, pack.size(), pack).ok());
+    return pack;
+  }
+
+  std::string pack_;
+  std::vector<std::pair<std::string, PatchPack::Range>> entries_;
+};
+
+TEST_F(PatchPackTest, Find) {
+  auto pack = PatchPack::Parse(FontData(Build()));
+  ASSERT_TRUE(pack.ok()) << pack.status();
+  ASSERT_EQ(pack->size(), 4);
+
+  ASSERT_EQ(*pack->Find("b.gk"), (PatchPack::Range{8, 4}));
+  ASSERT_EQ(*pack->Find("a.tk"), (PatchPack::Range{12, 3}));
+  ASSERT_EQ(*pack->Get("a.tk"), "abc");
+  ASSERT_EQ(*pack->Get("b.gk"), "defg");
+  ASSERT_EQ(*pack->Get("c.tk"), "hi");
+  ASSERT_EQ(*pack->Get(""), "");
+
+  ASSERT_TRUE(absl::IsNotFound(pack->Find("a").status()));
+  ASSERT_TRUE(absl::IsNotFound(pack->Find("b.gkk").status()));
+  ASSERT_TRUE(absl::IsNotFound(pack->Find("d.tk").status()));
+
+  // Entries are indexed in url order.
+  ASSERT_EQ(pack->Url(0), "");
+  ASSERT_EQ(pack->Url(1), "a.tk");
+  ASSERT_EQ(pack->Url(2), "b.gk");
+  ASSERT_EQ(pack->Url(3), "c.tk");
+  ASSERT_EQ(pack->At(3), (PatchPack::Range{15, 2}));
+}
+
+TEST_F(PatchPackTest, Empty) {
+  std::string data;
+  PatchPack::WriteHeader(data);
+  ASSERT_TRUE(PatchPack::WriteIndex({}, data.size(), data).ok());
+
+  auto pack = PatchPack::Parse(FontData(data));
+  ASSERT_TRUE(pack.ok()) << pack.status();
+  ASSERT_EQ(pack->size(), 0);
+  ASSERT_TRUE(absl::IsNotFound(pack->Find("a.tk").status()));
+}
+
+TEST_F(PatchPackTest, DuplicateUrl) {
+  Append("a.tk", "xyz");
+  std::string data = pack_;
+  auto sc = PatchPack::WriteIndex(entries_, data.size(), data);
+  ASSERT_TRUE(absl::IsInvalidArgument(sc)) << sc;
+}
+
+TEST_F(PatchPackTest, Malformed) {
+  std::string data = Build();
+
+  ASSERT_TRUE(absl::IsInvalidArgument(PatchPack::Parse(FontData("")).status()));
+  ASSERT_TRUE(absl::IsInvalidArgument(
+      PatchPack::Parse(FontData(data.substr(0, data.size() - 1))).status()));
+
+  std::string bad_tag = data;
+  bad_tag[0] = 'X';
+  ASSERT_TRUE(
+      absl::IsInvalidArgument(PatchPack::Parse(FontData(bad_tag)).status()));
+
+  std::string bad_version = data;
+  bad_version[7] = 2;
+  ASSERT_TRUE(absl::IsInvalidArgument(
+      PatchPack::Parse(FontData(bad_version)).status()));
+
+  // Record count in the trailer is too large for the index.
+  std::string bad_count = data;
+  bad_count[bad_count.size() - 1] = 100;
+  ASSERT_TRUE(
+      absl::IsInvalidArgument(PatchPack::Parse(FontData(bad_count)).status()));
+
+  // First record's patch length extends into the index.
+  std::string bad_length = data;
+  bad_length[17 + 11] = 100;
+  ASSERT_TRUE(
+      absl::IsInvalidArgument(PatchPack::Parse(FontData(bad_length)).status()));
+}
+
+}  // namespace ift
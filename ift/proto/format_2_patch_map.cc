@@ -1,7 +1,13 @@
 #include "ift/proto/format_2_patch_map.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
 
+#include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
@@ -9,13 +15,15 @@
 #include "common/compat_id.h"
 #include "common/font_helper.h"
 #include "common/font_helper_macros.h"
-#include "common/hb_set_unique_ptr.h"
 #include "common/sparse_bit_set.h"
+#include "common/try.h"
 #include "ift/proto/ift_table.h"
 #include "ift/proto/patch_encoding.h"
 #include "ift/proto/patch_map.h"
 
+using absl::btree_set;
 using absl::ClippedSubstr;
+using absl::flat_hash_map;
 using absl::Span;
 using absl::Status;
 using absl::StatusOr;
@@ -23,8 +31,6 @@ using absl::StrCat;
 using absl::string_view;
 using common::CompatId;
 using common::FontHelper;
-using common::hb_set_unique_ptr;
-using common::make_hb_set;
 using common::SparseBitSet;
 
 namespace ift::proto {
@@ -57,6 +63,20 @@ static StatusOr<uint8_t> EncodingToInt(PatchEncoding encoding) {
       StrCat("Unknown patch encoding, ", encoding));
 }
 
+static StatusOr<PatchEncoding> IntToEncoding(uint8_t value) {
+  switch (value) {
+    case 1:
+      return TABLE_KEYED_FULL;
+    case 2:
+      return TABLE_KEYED_PARTIAL;
+    case 3:
+      return GLYPH_KEYED;
+    default:
+      return absl::InvalidArgumentError(
+          StrCat("Unknown patch encoding value, ", value));
+  }
+}
+
 static PatchEncoding PickDefaultEncoding(const PatchMap& patch_map) {
   uint32_t counts[4] = {0, 0, 0};
   for (const auto& e : patch_map.GetEntries()) {
@@ -83,8 +103,10 @@ static uint32_t NumEntries(const PatchMap& map) {
   return map.GetEntries().length();
 }
 
-// Decides whether to use 0, 1, or 2 bytes of bias.
-static uint8_t BiasBytes(const PatchMap::Coverage& coverage);
+// Decides whether to use 0, 2, or 3 bytes of bias. encoded_size is set to the
+// number of bytes the codepoints take with that bias.
+static uint8_t BiasBytes(const std::vector<uint32_t>& sorted_codepoints,
+                         uint32_t& encoded_size /* OUT */);
 
 // Returns the two bit format used for the given number of bias bytes.
 static uint8_t BiasFormat(uint8_t bias_bytes);
@@ -96,17 +118,41 @@ static Status EncodeEntries(Span<const PatchMap::Entry> entries,
                             PatchEncoding default_encoding, std::string& out);
 
 static Status EncodeEntry(const PatchMap::Entry& entry,
+                          const std::vector<uint32_t>& sorted_codepoints,
+                          std::optional<uint32_t> codepoints_entry,
                           uint32_t last_entry_index,
                           PatchEncoding default_encoding, std::string& out);
 
 static void EncodeCodepoints(uint8_t bias_bytes,
-                             const PatchMap::Coverage& coverage,
+                             const std::vector<uint32_t>& sorted_codepoints,
                              std::string& out);
 
+// Returns an estimate of the serialized size of entries. Exact for everything
+// but the codepoint sets, which are assumed to take about a byte per
+// codepoint.
+static size_t EstimateEntriesSize(Span<const PatchMap::Entry> entries) {
+  size_t size = 0;
+  for (const auto& entry : entries) {
+    const auto& coverage = entry.coverage;
+    // format, feature count, design space count, child count, index delta,
+    // encoding and codepoint bias.
+    size += 13;
+    size += coverage.features.size() * 4;
+    size += coverage.design_space.size() * 12;
+    size += coverage.child_indices.size() * 3;
+    size += coverage.codepoints.size();
+  }
+  return size;
+}
+
 StatusOr<std::string> Format2PatchMap::Serialize(const IFTTable& ift_table) {
-  // TODO(garretrieger): pre-reserve estimated capacity based on patch_map.
-  std::string out;
   const auto& patch_map = ift_table.GetPatchMap();
+  string_view uri_template = ift_table.GetUrlTemplate();
+  constexpr int header_min_length = 35;
+
+  std::string out;
+  out.reserve(header_min_length + uri_template.length() +
+              EstimateEntriesSize(patch_map.GetEntries()));
 
   FontHelper::WriteUInt8(0x02, out);  // Format = 2
   FontHelper::WriteUInt32(0x0, out);  // Reserved = 0x00000000
@@ -127,8 +173,6 @@ StatusOr<std::string> Format2PatchMap::Serialize(const IFTTable& ift_table) {
                "Exceeded maximum number of entries (0xFFFFFF).");
 
   // entries offset
-  string_view uri_template = ift_table.GetUrlTemplate();
-  constexpr int header_min_length = 35;
   FontHelper::WriteUInt32(header_min_length + uri_template.length(), out);
 
   // idStrings
@@ -150,8 +194,8 @@ StatusOr<std::string> Format2PatchMap::Serialize(const IFTTable& ift_table) {
   return out;
 }
 
-Status DecodeAxisSegment(absl::string_view data, hb_tag_t& tag,
-                         common::AxisRange& range) {
+static Status DecodeAxisSegment(absl::string_view data, hb_tag_t& tag,
+                                common::AxisRange& range) {
   READ_UINT32(tag_v, data, 0);
   tag = tag_v;
 
@@ -175,56 +219,110 @@ Status EncodeAxisSegment(hb_tag_t tag, const common::AxisRange& range,
   return absl::OkStatus();
 }
 
+// True if the entry matches purely on its codepoints, so that referencing it
+// as a child entry is equivalent to repeating its codepoint set.
+static bool IsCodepointsOnly(const PatchMap::Coverage& coverage) {
+  return !coverage.codepoints.empty() && coverage.features.empty() &&
+         coverage.design_space.empty() && coverage.child_indices.empty();
+}
+
 Status EncodeEntries(Span<const PatchMap::Entry> entries,
                      PatchEncoding default_encoding, std::string& out) {
-  // TODO(garretrieger): identify and copy existing entries when possible.
+  // Index of the first codepoints only entry for each distinct codepoint set.
+  // Later entries with the same codepoints can reference that entry instead of
+  // repeating the set.
+  flat_hash_map<std::vector<uint32_t>, uint32_t> codepoints_entries;
   uint32_t last_entry_index = 0;
-  for (const auto& entry : entries) {
-    auto s = EncodeEntry(entry, last_entry_index, default_encoding, out);
+  for (uint32_t i = 0; i < entries.size(); i++) {
+    const auto& entry = entries[i];
+    // Codepoints iterate in sorted order.
+    std::vector<uint32_t> sorted_codepoints(entry.coverage.codepoints.begin(),
+                                            entry.coverage.codepoints.end());
+
+    std::optional<uint32_t> codepoints_entry;
+    auto it = codepoints_entries.find(sorted_codepoints);
+    if (it != codepoints_entries.end()) {
+      codepoints_entry = it->second;
+    }
+
+    auto s = EncodeEntry(entry, sorted_codepoints, codepoints_entry,
+                         last_entry_index, default_encoding, out);
     if (!s.ok()) {
       return s;
     }
     last_entry_index = entry.patch_index;
+
+    if (IsCodepointsOnly(entry.coverage) && !codepoints_entry) {
+      codepoints_entries[std::move(sorted_codepoints)] = i;
+    }
   }
 
   return absl::OkStatus();
 }
 
-// Decides whether to use 0, 1, or 2 bytes of bias.
-uint8_t BiasBytes(const PatchMap::Coverage& coverage) {
-  uint8_t bias_bytes[3] = {0, 2, 3};
-  uint8_t result = 0;
-  size_t min = (size_t)-1;
-  for (int i = 0; i < 3; i++) {
-    std::string out;
-    EncodeCodepoints(bias_bytes[i], coverage, out);
-    if (out.size() < min) {
-      min = out.size();
-      result = bias_bytes[i];
-    }
+// Returns the bias used with bias_bytes of bias for sorted_codepoints.
+static uint32_t BiasFor(uint8_t bias_bytes,
+                        const std::vector<uint32_t>& sorted_codepoints) {
+  uint32_t max_bias = (1 << ((uint32_t)bias_bytes) * 8) - 1;
+  if (sorted_codepoints.empty()) {
+    return 0;
   }
+  return std::min(sorted_codepoints.front(), max_bias);
+}
 
+static std::vector<uint32_t> Biased(
+    const std::vector<uint32_t>& sorted_codepoints, uint32_t bias) {
+  std::vector<uint32_t> result;
+  result.reserve(sorted_codepoints.size());
+  for (uint32_t cp : sorted_codepoints) {
+    result.push_back(cp - bias);
+  }
   return result;
 }
 
-void EncodeCodepoints(uint8_t bias_bytes, const PatchMap::Coverage& coverage,
-                      std::string& out) {
-  uint32_t max_bias = (1 << ((uint32_t)bias_bytes) * 8) - 1;
-  uint32_t bias = std::min(coverage.SmallestCodepoint(), max_bias);
+// Decides whether to use 0, 2, or 3 bytes of bias. Compares the encoded sizes
+// of each option without materializing the encodings.
+uint8_t BiasBytes(const std::vector<uint32_t>& sorted_codepoints,
+                  uint32_t& encoded_size) {
+  uint8_t result = 0;
+  uint32_t min = SparseBitSet::EncodedSize(sorted_codepoints);
+  uint32_t last_bias = 0;
+  for (uint8_t bias_bytes : {2, 3}) {
+    uint32_t bias = BiasFor(bias_bytes, sorted_codepoints);
+    if (bias == last_bias) {
+      // Encodes the same set as the previous option but with more bias bytes,
+      // so it can't be smaller.
+      continue;
+    }
+    last_bias = bias;
 
-  hb_set_unique_ptr biased_set = make_hb_set();
-  for (uint32_t cp : coverage.codepoints) {
-    hb_set_add(biased_set.get(), cp - bias);
+    uint32_t size = bias_bytes + SparseBitSet::EncodedSize(
+                                     Biased(sorted_codepoints, bias));
+    if (size < min) {
+      min = size;
+      result = bias_bytes;
+    }
   }
 
-  std::string sparse_bit_set = SparseBitSet::Encode(*biased_set);
+  encoded_size = min;
+  return result;
+}
 
+void EncodeCodepoints(uint8_t bias_bytes,
+                      const std::vector<uint32_t>& sorted_codepoints,
+                      std::string& out) {
+  uint32_t bias = BiasFor(bias_bytes, sorted_codepoints);
   if (bias_bytes == 2) {
     FontHelper::WriteUInt16(bias, out);
   } else if (bias_bytes == 3) {
     FontHelper::WriteUInt24(bias, out);
   }
-  out.append(sparse_bit_set);
+
+  if (bias) {
+    out.append(SparseBitSet::Encode(Biased(sorted_codepoints, bias)));
+  } else {
+    out.append(SparseBitSet::Encode(sorted_codepoints));
+  }
 }
 
 // Returns the two bit format used for the given number of bias bytes.
@@ -240,21 +338,65 @@ uint8_t BiasFormat(uint8_t bias_bytes) {
   }
 }
 
-Status EncodeEntry(const PatchMap::Entry& entry, uint32_t last_entry_index,
-                   PatchEncoding default_encoding, std::string& out) {
+// Decides if the codepoints of an entry should be replaced with a reference to
+// the child entry codepoints_entry, which matches on exactly the same
+// codepoints. This is only possible when the reference can be ANDed with the
+// entry's other conditions, and is only done when it's smaller.
+static bool UseCodepointsEntry(const PatchMap::Coverage& coverage,
+                               std::optional<uint32_t> codepoints_entry,
+                               uint32_t codepoints_size) {
+  if (!codepoints_entry ||
+      FontHelper::WillIntOverflow<uint16_t>(*codepoints_entry)) {
+    return false;
+  }
+
+  if (coverage.child_indices.empty()) {
+    // Adds the child count and a child index.
+    return codepoints_size > 4;
+  }
+
+  if (!coverage.conjunctive) {
+    return false;
+  }
+  if (coverage.child_indices.contains(*codepoints_entry)) {
+    // Already required by the entry, the codepoints are redundant.
+    return true;
+  }
+  // Adds a child index.
+  return coverage.child_indices.size() < 0b01111111 && codepoints_size > 3;
+}
+
+Status EncodeEntry(const PatchMap::Entry& entry,
+                   const std::vector<uint32_t>& sorted_codepoints,
+                   std::optional<uint32_t> codepoints_entry,
+                   uint32_t last_entry_index, PatchEncoding default_encoding,
+                   std::string& out) {
   const auto& coverage = entry.coverage;
+  uint32_t codepoints_size = 0;
+  uint8_t bias_bytes = BiasBytes(sorted_codepoints, codepoints_size);
+
+  const btree_set<uint32_t>* child_indices = &coverage.child_indices;
+  btree_set<uint32_t> child_indices_with_codepoints;
+  bool conjunctive = coverage.conjunctive;
   bool has_codepoints = !coverage.codepoints.empty();
+  if (has_codepoints &&
+      UseCodepointsEntry(coverage, codepoints_entry, codepoints_size)) {
+    child_indices_with_codepoints = coverage.child_indices;
+    child_indices_with_codepoints.insert(*codepoints_entry);
+    child_indices = &child_indices_with_codepoints;
+    // A single child matches the same in either mode, keep conjunctive as is.
+    has_codepoints = false;
+  }
+
   bool has_features = !coverage.features.empty();
   bool has_design_space = !coverage.design_space.empty();
-  bool has_child_indices = !coverage.child_indices.empty();
+  bool has_child_indices = !child_indices->empty();
   bool has_features_or_design_space = has_features || has_design_space;
   int64_t delta =
       ((int64_t)entry.patch_index) - ((int64_t)last_entry_index + 1);
   bool has_delta = delta != 0;
   bool has_patch_encoding = entry.encoding != default_encoding;
 
-  uint8_t bias_bytes = BiasBytes(entry.coverage);
-
   // format
   uint8_t format =
       (has_features_or_design_space ? features_and_design_space_bit_mask
@@ -286,19 +428,19 @@ Status EncodeEntry(const PatchMap::Entry& entry, uint32_t last_entry_index,
   }
 
   if (has_child_indices) {
-    if (entry.coverage.child_indices.size() >
+    if (child_indices->size() >
         0b01111111) {  // 7 bits are used to store the count.
       return absl::InvalidArgumentError(
           StrCat("Maximum number of child indices exceeded: ",
-                 entry.coverage.child_indices.size(), " > 127."));
+                 child_indices->size(), " > 127."));
     }
-    uint8_t count = (uint8_t)entry.coverage.child_indices.size();
-    if (entry.coverage.conjunctive) {
+    uint8_t count = (uint8_t)child_indices->size();
+    if (conjunctive) {
       // MSB is used to record the append mode bit.
       count |= 0b10000000;
     }
     FontHelper::WriteUInt8(count, out);
-    for (uint32_t index : entry.coverage.child_indices) {
+    for (uint32_t index : *child_indices) {
       WRITE_UINT24(index, out, "Exceeded max copy index size.");
     }
   }
@@ -317,10 +459,229 @@ Status EncodeEntry(const PatchMap::Entry& entry, uint32_t last_entry_index,
   }
 
   if (has_codepoints) {
-    EncodeCodepoints(bias_bytes, entry.coverage, out);
+    EncodeCodepoints(bias_bytes, sorted_codepoints, out);
   }
 
   return absl::OkStatus();
 }
 
+// Removes and returns the first length bytes of data.
+static StatusOr<string_view> Consume(string_view& data, size_t length) {
+  if (data.size() < length) {
+    return absl::InvalidArgumentError("Not enough input data.");
+  }
+  string_view result = data.substr(0, length);
+  data.remove_prefix(length);
+  return result;
+}
+
+StatusOr<Format2PatchMap::Reader> Format2PatchMap::Reader::Create(
+    string_view data) {
+  string_view header = data;
+  uint8_t format = TRY(FontHelper::ReadUInt8(TRY(Consume(header, 1))));
+  if (format != 0x02) {
+    return absl::InvalidArgumentError(
+        StrCat("Unsupported patch map format, ", format));
+  }
+  TRY(Consume(header, 4));  // Reserved
+
+  Reader reader;
+  uint32_t id[4];
+  for (uint32_t& v : id) {
+    v = TRY(FontHelper::ReadUInt32(TRY(Consume(header, 4))));
+  }
+  reader.id_ = CompatId(id);
+
+  reader.default_encoding_ =
+      TRY(IntToEncoding(TRY(FontHelper::ReadUInt8(TRY(Consume(header, 1))))));
+  reader.entry_count_ = TRY(FontHelper::ReadUInt24(TRY(Consume(header, 3))));
+  uint32_t entries_offset =
+      TRY(FontHelper::ReadUInt32(TRY(Consume(header, 4))));
+  uint32_t id_strings_offset =
+      TRY(FontHelper::ReadUInt32(TRY(Consume(header, 4))));
+  if (id_strings_offset) {
+    return absl::UnimplementedError("String entry ids are not supported.");
+  }
+
+  uint16_t url_template_length =
+      TRY(FontHelper::ReadUInt16(TRY(Consume(header, 2))));
+  reader.url_template_ = TRY(Consume(header, url_template_length));
+
+  if (entries_offset > data.size()) {
+    return absl::InvalidArgumentError("Entries offset is out of bounds.");
+  }
+  reader.remaining_ = data.substr(entries_offset);
+  return reader;
+}
+
+Status Format2PatchMap::Reader::NextHeader(
+    PatchMap::Entry& entry, std::optional<uint32_t>& codepoints_bias) {
+  if (Done()) {
+    return absl::OutOfRangeError("All entries have been read.");
+  }
+
+  entry = PatchMap::Entry();
+  PatchMap::Coverage& coverage = entry.coverage;
+  string_view& data = remaining_;
+
+  uint8_t format = TRY(FontHelper::ReadUInt8(TRY(Consume(data, 1))));
+
+  if (format & features_and_design_space_bit_mask) {
+    uint8_t feature_count = TRY(FontHelper::ReadUInt8(TRY(Consume(data, 1))));
+    for (uint32_t i = 0; i < feature_count; i++) {
+      coverage.features.insert(
+          TRY(FontHelper::ReadUInt32(TRY(Consume(data, 4)))));
+    }
+
+    uint16_t segment_count =
+        TRY(FontHelper::ReadUInt16(TRY(Consume(data, 2))));
+    for (uint32_t i = 0; i < segment_count; i++) {
+      hb_tag_t tag;
+      common::AxisRange range;
+      TRYV(DecodeAxisSegment(TRY(Consume(data, 12)), tag, range));
+      coverage.design_space[tag] = range;
+    }
+  }
+
+  if (format & child_indices_bit_mask) {
+    uint8_t count = TRY(FontHelper::ReadUInt8(TRY(Consume(data, 1))));
+    // MSB is the append mode bit.
+    coverage.conjunctive = count & 0b10000000;
+    count &= 0b01111111;
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t index = TRY(FontHelper::ReadUInt24(TRY(Consume(data, 3))));
+      if (index >= entries_read_) {
+        return absl::InvalidArgumentError(StrCat(
+            "Child entry index ", index, " must refer to a prior entry."));
+      }
+      coverage.child_indices.insert(index);
+    }
+  }
+
+  int64_t delta = 0;
+  if (format & index_delta_bit_mask) {
+    uint32_t value = TRY(FontHelper::ReadUInt24(TRY(Consume(data, 3))));
+    // Sign extend the int24.
+    delta = (value & 0x800000) ? (int64_t)value - 0x1000000 : value;
+  }
+  int64_t entry_index = (int64_t)last_entry_index_ + 1 + delta;
+  if (entry_index < 0 || entry_index > UINT32_MAX) {
+    return absl::InvalidArgumentError(
+        StrCat("Entry index ", entry_index, " is out of range."));
+  }
+  entry.patch_index = entry_index;
+
+  entry.encoding = default_encoding_;
+  if (format & encoding_bit_mask) {
+    entry.encoding =
+        TRY(IntToEncoding(TRY(FontHelper::ReadUInt8(TRY(Consume(data, 1))))));
+  }
+
+  codepoints_bias = std::nullopt;
+  uint8_t codepoint_format = format & codepoint_bit_mask;
+  if (codepoint_format) {
+    uint32_t bias = 0;
+    if (codepoint_format == two_byte_bias) {
+      bias = TRY(FontHelper::ReadUInt16(TRY(Consume(data, 2))));
+    } else if (codepoint_format == three_byte_bias) {
+      bias = TRY(FontHelper::ReadUInt24(TRY(Consume(data, 3))));
+    }
+    codepoints_bias = bias;
+  }
+
+  entry.ignored = format & ignore_bit_mask;
+
+  last_entry_index_ = entry_index;
+  entries_read_++;
+  return absl::OkStatus();
+}
+
+// Decodes the sparse bit set at the start of data into coverage, adding bias
+// to each value, and removes it from data.
+static Status DecodeCodepoints(string_view& data, uint32_t bias,
+                               PatchMap::Coverage& coverage) {
+  std::vector<uint32_t> codepoints;
+  data = TRY(SparseBitSet::Decode(data, codepoints));
+  // Values are decoded in ascending order so each insert appends.
+  for (uint32_t cp : codepoints) {
+    coverage.codepoints.insert(cp + bias);
+  }
+  return absl::OkStatus();
+}
+
+Status Format2PatchMap::Reader::Next(PatchMap::Entry& entry) {
+  std::optional<uint32_t> codepoints_bias;
+  TRYV(NextHeader(entry, codepoints_bias));
+  if (codepoints_bias) {
+    TRYV(DecodeCodepoints(remaining_, *codepoints_bias, entry.coverage));
+  }
+  return absl::OkStatus();
+}
+
+StatusOr<Format2PatchMap::View> Format2PatchMap::View::Create(
+    string_view data) {
+  View view;
+  view.reader_ = TRY(Reader::Create(data));
+  view.entries_.reserve(view.reader_.EntryCount());
+
+  Reader& reader = view.reader_;
+  while (!reader.Done()) {
+    LazyEntry& lazy = view.entries_.emplace_back();
+    std::optional<uint32_t> codepoints_bias;
+    TRYV(reader.NextHeader(lazy.header, codepoints_bias));
+    if (!codepoints_bias) {
+      continue;
+    }
+
+    lazy.has_codepoints = true;
+    lazy.codepoints_bias = *codepoints_bias;
+    string_view after = TRY(SparseBitSet::Skip(reader.remaining_));
+    lazy.codepoints =
+        reader.remaining_.substr(0, reader.remaining_.size() - after.size());
+    reader.remaining_ = after;
+  }
+
+  return view;
+}
+
+StatusOr<bool> Format2PatchMap::View::CodepointsIntersect(
+    uint32_t index, const hb_set_t* codepoints) const {
+  const LazyEntry& lazy = entries_.at(index);
+  if (!lazy.has_codepoints) {
+    return false;
+  }
+  return SparseBitSet::Intersects(lazy.codepoints, codepoints,
+                                  lazy.codepoints_bias);
+}
+
+StatusOr<PatchMap::Entry> Format2PatchMap::View::DecodeEntry(
+    uint32_t index) const {
+  const LazyEntry& lazy = entries_.at(index);
+  PatchMap::Entry entry = lazy.header;
+  if (lazy.has_codepoints) {
+    string_view data = lazy.codepoints;
+    TRYV(DecodeCodepoints(data, lazy.codepoints_bias, entry.coverage));
+  }
+  return entry;
+}
+
+
+StatusOr<IFTTable> Format2PatchMap::Deserialize(string_view data) {
+  Reader reader = TRY(Reader::Create(data));
+
+  IFTTable table;
+  table.SetId(reader.Id());
+  table.SetUrlTemplate(reader.UrlTemplate());
+
+  PatchMap& patch_map = table.GetPatchMap();
+  PatchMap::Entry entry;
+  while (!reader.Done()) {
+    TRYV(reader.Next(entry));
+    TRYV(patch_map.AddEntry(entry.coverage, entry.patch_index, entry.encoding,
+                            entry.ignored));
+  }
+
+  return table;
+}
+
 }  // namespace ift::proto
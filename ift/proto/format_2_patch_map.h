@@ -1,14 +1,145 @@
 #ifndef IFT_PROTO_FORMAT_2_PATCH_MAP_H_
 #define IFT_PROTO_FORMAT_2_PATCH_MAP_H_
 
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
 #include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "common/compat_id.h"
+#include "hb.h"
 #include "ift/proto/ift_table.h"
+#include "ift/proto/patch_encoding.h"
+#include "ift/proto/patch_map.h"
 
 namespace ift::proto {
 
 class Format2PatchMap {
  public:
+  class Reader;
+  class View;
+
   static absl::StatusOr<std::string> Serialize(const IFTTable& ift_table);
+
+  /*
+   * Decodes a serialized format 2 patch map
+   * (https://w3c.github.io/IFT/Overview.html#patch-map-format-2) into an
+   * IFTTable.
+   */
+  static absl::StatusOr<IFTTable> Deserialize(absl::string_view data);
+};
+
+/*
+ * Zero copy reader over the bytes of a serialized format 2 patch map. The
+ * header is parsed on creation, entries are then decoded one at a time, in
+ * order, only as they are requested. The underlying bytes must outlive the
+ * reader.
+ */
+class Format2PatchMap::Reader {
+ public:
+  static absl::StatusOr<Reader> Create(absl::string_view data);
+
+  const common::CompatId& Id() const { return id_; }
+  PatchEncoding DefaultEncoding() const { return default_encoding_; }
+
+  // Points into the underlying bytes.
+  absl::string_view UrlTemplate() const { return url_template_; }
+
+  uint32_t EntryCount() const { return entry_count_; }
+
+  // True once all entries have been decoded.
+  bool Done() const { return entries_read_ == entry_count_; }
+
+  /*
+   * Decodes the next entry into entry. Entries which reference child entries
+   * are returned as is, child indices refer to the position of the child in
+   * the sequence of decoded entries.
+   */
+  absl::Status Next(PatchMap::Entry& entry /* OUT */);
+
+ private:
+  friend class View;
+
+  Reader() = default;
+
+  /*
+   * Decodes everything in the next entry except for its codepoints. If the
+   * entry has codepoints then codepoints_bias is set and remaining_ will
+   * start at the entry's sparse bit set.
+   */
+  absl::Status NextHeader(PatchMap::Entry& entry /* OUT */,
+                          std::optional<uint32_t>& codepoints_bias /* OUT */);
+
+  common::CompatId id_;
+  PatchEncoding default_encoding_ = TABLE_KEYED_FULL;
+  absl::string_view url_template_;
+  uint32_t entry_count_ = 0;
+
+  // Entry bytes which have not yet been decoded.
+  absl::string_view remaining_;
+  uint32_t entries_read_ = 0;
+  uint32_t last_entry_index_ = 0;
+};
+
+/*
+ * Random access view over the bytes of a serialized format 2 patch map. On
+ * creation every entry is parsed, except for the codepoint sets which are only
+ * located. Codepoints are decoded on demand, so queries against entries that
+ * are excluded by their other conditions never pay for a set decode. The
+ * underlying bytes must outlive the view.
+ */
+class Format2PatchMap::View {
+ public:
+  static absl::StatusOr<View> Create(absl::string_view data);
+
+  const common::CompatId& Id() const { return reader_.Id(); }
+  PatchEncoding DefaultEncoding() const { return reader_.DefaultEncoding(); }
+
+  // Points into the underlying bytes.
+  absl::string_view UrlTemplate() const { return reader_.UrlTemplate(); }
+
+  uint32_t EntryCount() const { return entries_.size(); }
+
+  /*
+   * The entry at index with everything other than its codepoints decoded.
+   * Child indices refer to positions in this view.
+   */
+  const PatchMap::Entry& EntryHeader(uint32_t index) const {
+    return entries_.at(index).header;
+  }
+
+  // True if the entry at index has a codepoint condition.
+  bool HasCodepoints(uint32_t index) const {
+    return entries_.at(index).has_codepoints;
+  }
+
+  /*
+   * Returns true if the codepoint set of the entry at index shares at least
+   * one member with codepoints. Entries without a codepoint set return false.
+   * The set is scanned in place without being materialized.
+   */
+  absl::StatusOr<bool> CodepointsIntersect(uint32_t index,
+                                           const hb_set_t* codepoints) const;
+
+  // Fully decodes the entry at index, including its codepoints.
+  absl::StatusOr<PatchMap::Entry> DecodeEntry(uint32_t index) const;
+
+ private:
+  struct LazyEntry {
+    PatchMap::Entry header;
+    bool has_codepoints = false;
+    uint32_t codepoints_bias = 0;
+    // The encoded sparse bit set, points into the underlying bytes.
+    absl::string_view codepoints;
+  };
+
+  View() = default;
+
+  // Holds the header fields, entries have all been consumed.
+  Reader reader_;
+  std::vector<LazyEntry> entries_;
 };
 
 }  // namespace ift::proto
@@ -132,6 +132,65 @@ TEST_F(Format2PatchMapTest, CopyIndices) {
             absl::StrCat(HeaderSimple(4), entry_0, entry_1, entry_2, entry_3));
 }
 
+TEST_F(Format2PatchMapTest, DuplicateCodepointsReferenced) {
+  PatchMap::Coverage coverage{1, 100, 1000, 10000, 20000};
+
+  IFTTable single;
+  auto sc = single.GetPatchMap().AddEntry(coverage, 1, TABLE_KEYED_FULL);
+  ASSERT_TRUE(sc.ok()) << sc;
+  single.SetUrlTemplate("foo/$1");
+  single.SetId({1, 2, 3, 4});
+  auto single_encoded = Format2PatchMap::Serialize(single);
+  ASSERT_TRUE(single_encoded.ok()) << single_encoded.status();
+  std::string entry_0 = single_encoded->substr(HeaderSimple().size());
+  ASSERT_GT(entry_0.size(), 5);
+
+  IFTTable table;
+  PatchMap& map = table.GetPatchMap();
+  sc = map.AddEntry(coverage, 1, TABLE_KEYED_FULL);
+  sc.Update(map.AddEntry(coverage, 2, TABLE_KEYED_FULL));
+
+  PatchMap::Coverage with_features = coverage;
+  with_features.features.insert(HB_TAG('s', 'm', 'c', 'p'));
+  sc.Update(map.AddEntry(with_features, 3, TABLE_KEYED_FULL));
+
+  PatchMap::Coverage disjunctive = coverage;
+  disjunctive.child_indices.insert(1);
+  sc.Update(map.AddEntry(disjunctive, 4, TABLE_KEYED_FULL));
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  table.SetUrlTemplate("foo/$1");
+  table.SetId({1, 2, 3, 4});
+
+  auto encoded = Format2PatchMap::Serialize(table);
+  ASSERT_TRUE(encoded.ok()) << encoded.status();
+
+  std::string entry_1 = {
+      0b00000010,  // format = Child Indices
+      0b00000001,  // count = 1
+      0,          0, 0,  // 0
+  };
+  std::string entry_2 = {
+      0b00000011,  // format = Features + Child Indices
+      0x01,        // feature count = 1
+      's',         'm', 'c', 'p',  // feature[0] = smcp
+      0x00,        0x00,           // design space count
+      0b00000001,                  // count = 1
+      0,           0, 0,           // 0
+  };
+  // Child entries are ORed, so the codepoints can't be replaced.
+  std::string entry_3 = {
+      (char)(entry_0[0] | 0b00000010),  // format = Child Indices + Codepoints
+      0b00000001,                       // count = 1
+      0,
+      0,
+      1,  // 1
+  };
+  entry_3 += entry_0.substr(1);
+  ASSERT_EQ(*encoded, absl::StrCat(HeaderSimple(4), entry_0, entry_1, entry_2,
+                                   entry_3));
+}
+
 TEST_F(Format2PatchMapTest, TwoByteBias) {
   IFTTable table;
   PatchMap& map = table.GetPatchMap();
@@ -375,4 +434,185 @@ TEST_F(Format2PatchMapTest, IndexDeltas) {
   ASSERT_EQ(*encoded, absl::StrCat(header, entry_0, entry_1, entry_2));
 }
 
+TEST_F(Format2PatchMapTest, RoundTrip) {
+  IFTTable table;
+  PatchMap& map = table.GetPatchMap();
+
+  PatchMap::Coverage coverage1{1, 2, 3};
+  auto sc = map.AddEntry(coverage1, 7, TABLE_KEYED_PARTIAL);
+
+  PatchMap::Coverage coverage2{300, 310, 320};
+  coverage2.features.insert(HB_TAG('s', 'm', 'c', 'p'));
+  coverage2.design_space[HB_TAG('w', 'g', 'h', 't')] =
+      *common::AxisRange::Range(100.0f, 200.0f);
+  sc.Update(map.AddEntry(coverage2, 4, GLYPH_KEYED));
+
+  PatchMap::Coverage coverage3{70000, 70001};
+  sc.Update(map.AddEntry(coverage3, 10, TABLE_KEYED_PARTIAL, true));
+
+  PatchMap::Coverage coverage4;
+  coverage4.child_indices.insert(0);
+  coverage4.child_indices.insert(2);
+  coverage4.conjunctive = true;
+  sc.Update(map.AddEntry(coverage4, 11, TABLE_KEYED_FULL));
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  table.SetUrlTemplate("foo/$1");
+  table.SetId({1, 2, 3, 4});
+
+  auto encoded = Format2PatchMap::Serialize(table);
+  ASSERT_TRUE(encoded.ok()) << encoded.status();
+
+  auto decoded = Format2PatchMap::Deserialize(*encoded);
+  ASSERT_TRUE(decoded.ok()) << decoded.status();
+  ASSERT_EQ(*decoded, table);
+  ASSERT_EQ(decoded->GetUrlTemplate(), "foo/$1");
+  ASSERT_EQ(decoded->GetId(), common::CompatId(1, 2, 3, 4));
+
+  // Coverage equality doesn't consider child indices.
+  const auto& entry = decoded->GetPatchMap().GetEntries()[3];
+  ASSERT_EQ(entry.coverage.child_indices, coverage4.child_indices);
+  ASSERT_TRUE(entry.coverage.conjunctive);
+  ASSERT_FALSE(decoded->GetPatchMap().GetEntries()[0].coverage.conjunctive);
+}
+
+TEST_F(Format2PatchMapTest, Reader) {
+  std::string entry_0 = {
+      0x14,              // format = Codepoints | ID delta
+      0x00, 0x00, 0x06,  // ID delta +6 -> 7
+      0x05, 0x0e,        // codepoints = {1, 2, 3}
+  };
+  std::string entry_1 = {
+      0x18,              // format = Codepoints and format
+      0x03,              // format = Glyph Keyed,
+      0x0d, 0x42, 0x0e,  // codepoints = {25, 26, 27}
+  };
+  std::string data = absl::StrCat(HeaderSimple(2), entry_0, entry_1);
+
+  auto reader = Format2PatchMap::Reader::Create(data);
+  ASSERT_TRUE(reader.ok()) << reader.status();
+  ASSERT_EQ(reader->Id(), common::CompatId(1, 2, 3, 4));
+  ASSERT_EQ(reader->DefaultEncoding(), TABLE_KEYED_FULL);
+  ASSERT_EQ(reader->UrlTemplate(), "foo/$1");
+  ASSERT_EQ(reader->EntryCount(), 2);
+
+  PatchMap::Entry entry;
+  ASSERT_FALSE(reader->Done());
+  ASSERT_EQ(reader->Next(entry), absl::OkStatus());
+  ASSERT_EQ(entry, PatchMap::Entry({1, 2, 3}, 7, TABLE_KEYED_FULL));
+
+  ASSERT_FALSE(reader->Done());
+  ASSERT_EQ(reader->Next(entry), absl::OkStatus());
+  ASSERT_EQ(entry, PatchMap::Entry({25, 26, 27}, 8, GLYPH_KEYED));
+
+  ASSERT_TRUE(reader->Done());
+  ASSERT_TRUE(absl::IsOutOfRange(reader->Next(entry)));
+}
+
+TEST_F(Format2PatchMapTest, View) {
+  std::string entry_0 = {
+      0x14,              // format = Codepoints | ID delta
+      0x00, 0x00, 0x06,  // ID delta +6 -> 7
+      0x05, 0x0e,        // codepoints = {1, 2, 3}
+  };
+  std::string entry_1 = {
+      0x01,        // format = features and design space
+      0x01,        // feature count = 1
+      's',  'm',
+      'c',  'p',   // feature[0] = smcp
+      0x00, 0x00,  // design space count
+  };
+  std::string entry_2 = {
+      0x22,              // format = Codepoints | Copy Indices
+      0x01,              // count = 1
+      0x00, 0x00, 0x01,  // 1
+      0x00, 0x64,        // bias = 100
+      0x05, 0x0e,        // codepoints = {101, 102, 103}
+  };
+  std::string data =
+      absl::StrCat(HeaderSimple(3), entry_0, entry_1, entry_2);
+
+  auto view = Format2PatchMap::View::Create(data);
+  ASSERT_TRUE(view.ok()) << view.status();
+  ASSERT_EQ(view->Id(), common::CompatId(1, 2, 3, 4));
+  ASSERT_EQ(view->DefaultEncoding(), TABLE_KEYED_FULL);
+  ASSERT_EQ(view->UrlTemplate(), "foo/$1");
+  ASSERT_EQ(view->EntryCount(), 3);
+
+  ASSERT_TRUE(view->HasCodepoints(0));
+  ASSERT_FALSE(view->HasCodepoints(1));
+  ASSERT_TRUE(view->HasCodepoints(2));
+
+  // Headers don't include codepoints.
+  ASSERT_TRUE(view->EntryHeader(0).coverage.codepoints.empty());
+  ASSERT_EQ(view->EntryHeader(0).patch_index, 7);
+  ASSERT_THAT(view->EntryHeader(1).coverage.features,
+              UnorderedElementsAre(HB_TAG('s', 'm', 'c', 'p')));
+  ASSERT_EQ(view->EntryHeader(2).patch_index, 9);
+  ASSERT_THAT(view->EntryHeader(2).coverage.child_indices,
+              UnorderedElementsAre(1));
+
+  hb_set_t* query = hb_set_create();
+  hb_set_add(query, 102);
+  ASSERT_FALSE(*view->CodepointsIntersect(0, query));
+  ASSERT_FALSE(*view->CodepointsIntersect(1, query));
+  ASSERT_TRUE(*view->CodepointsIntersect(2, query));
+  hb_set_add(query, 3);
+  ASSERT_TRUE(*view->CodepointsIntersect(0, query));
+  hb_set_destroy(query);
+
+  // Decoded entries match the eagerly decoded table.
+  auto table = Format2PatchMap::Deserialize(data);
+  ASSERT_TRUE(table.ok()) << table.status();
+  const auto& expected = table->GetPatchMap().GetEntries();
+  for (uint32_t i = 0; i < view->EntryCount(); i++) {
+    auto entry = view->DecodeEntry(i);
+    ASSERT_TRUE(entry.ok()) << entry.status();
+    ASSERT_EQ(*entry, expected[i]);
+    ASSERT_EQ(entry->coverage.child_indices,
+              expected[i].coverage.child_indices);
+  }
+
+  // Malformed codepoint sets are caught on creation.
+  std::string bad_set = {
+      0x10,                    // format = Codepoints
+      0b00001010, 0b01010101,  // depth 2 tree missing nodes.
+  };
+  ASSERT_TRUE(absl::IsInvalidArgument(
+      Format2PatchMap::View::Create(absl::StrCat(HeaderSimple(), bad_set))
+          .status()));
+}
+
+TEST_F(Format2PatchMapTest, DeserializeInvalid) {
+  std::string entry_0 = {
+      0x10,                   // format = 00010000 = Codepoints
+      0b00000101, 0b00001110  // codepoints (BF4, depth 1)= {1, 2, 3}
+  };
+  std::string data = absl::StrCat(HeaderSimple(), entry_0);
+  ASSERT_TRUE(Format2PatchMap::Deserialize(data).ok());
+
+  // Truncated
+  for (size_t length : {0, 10, 40, 41}) {
+    ASSERT_TRUE(absl::IsInvalidArgument(
+        Format2PatchMap::Deserialize(data.substr(0, length)).status()))
+        << length;
+  }
+
+  // Wrong format
+  std::string bad_format = data;
+  bad_format[0] = 0x01;
+  ASSERT_TRUE(absl::IsInvalidArgument(
+      Format2PatchMap::Deserialize(bad_format).status()));
+
+  // Child index refers to a later entry
+  std::string child_entry = {
+      0b00000010,        // format = Copy Indices
+      0b00000001,        // count = 1
+      0,          0, 0,  // 0
+  };
+  std::string bad_child = absl::StrCat(HeaderSimple(), child_entry);
+  ASSERT_TRUE(absl::IsInvalidArgument(
+      Format2PatchMap::Deserialize(bad_child).status()));
+}
+
 }  // namespace ift::proto
\ No newline at end of file
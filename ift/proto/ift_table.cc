@@ -117,6 +117,25 @@ absl::StatusOr<common::FontData> IFTTable::AddToFont(
   return AddToFont(face, *main_bytes, ext_view);
 }
 
+StatusOr<IFTTable> IFTTable::FromFont(hb_face_t* face) {
+  return FromFont(face, IFT_TAG);
+}
+
+StatusOr<IFTTable> IFTTable::ExtensionFromFont(hb_face_t* face) {
+  return FromFont(face, IFTX_TAG);
+}
+
+StatusOr<IFTTable> IFTTable::FromFont(hb_face_t* face, hb_tag_t tag) {
+  // The table bytes are referenced from the face, not copied, while decoding.
+  FontData table = FontHelper::TableData(face, tag);
+  if (table.empty()) {
+    return absl::NotFoundError(
+        StrCat("Font does not have an '", FontHelper::ToString(tag),
+               "' table."));
+  }
+  return Format2PatchMap::Deserialize(table.str());
+}
+
 CompatId IFTTable::GetId() const { return id_; }
 
 void PrintTo(const IFTTable& table, std::ostream* os) {
@@ -2,8 +2,11 @@
 #define IFT_PROTO_IFT_TABLE_H_
 
 #include <cstdint>
+#include <optional>
+#include <string>
 
 #include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
 #include "common/compat_id.h"
 #include "common/font_data.h"
 #include "hb.h"
@@ -52,14 +55,29 @@ class IFTTable {
       hb_face_t* face, const IFTTable& main,
       std::optional<const IFTTable*> extension);
 
- private:
   /*
-   * Adds an the provided 'IFT ' (and optionally an 'IFTX') tables to by face.
+   * Same as above, but with already serialized 'IFT ' (and optionally 'IFTX')
+   * tables. Allows a table shared by many fonts to be serialized only once.
    */
   static absl::StatusOr<common::FontData> AddToFont(
       hb_face_t* face, absl::string_view ift_table,
       std::optional<absl::string_view> iftx_table);
 
+  /*
+   * Decodes the 'IFT ' table present in the font pointed to by face. Returns
+   * NotFound if the font does not have an 'IFT ' table.
+   */
+  static absl::StatusOr<IFTTable> FromFont(hb_face_t* face);
+
+  /*
+   * Decodes the 'IFTX' extension table present in the font pointed to by face.
+   * Returns NotFound if the font does not have an 'IFTX' table.
+   */
+  static absl::StatusOr<IFTTable> ExtensionFromFont(hb_face_t* face);
+
+ private:
+  static absl::StatusOr<IFTTable> FromFont(hb_face_t* face, hb_tag_t tag);
+
   /*
    * Converts this abstract representation to the a serialized format.
    * Either format 1 or 2:
@@ -128,6 +128,27 @@ TEST_F(IFTTableTest, AddToFont_WithExtension) {
   EXPECT_EQ(original_tag_order, new_tag_order);
 }
 
+TEST_F(IFTTableTest, FromFont) {
+  auto font =
+      IFTTable::AddToFont(roboto_ab.get(), sample, &sample_with_extensions);
+  ASSERT_TRUE(font.ok()) << font.status();
+  hb_face_unique_ptr face = font->face();
+
+  auto table = IFTTable::FromFont(face.get());
+  ASSERT_TRUE(table.ok()) << table.status();
+  ASSERT_EQ(*table, sample);
+
+  auto extension = IFTTable::ExtensionFromFont(face.get());
+  ASSERT_TRUE(extension.ok()) << extension.status();
+  ASSERT_EQ(*extension, sample_with_extensions);
+}
+
+TEST_F(IFTTableTest, FromFont_Missing) {
+  ASSERT_TRUE(absl::IsNotFound(IFTTable::FromFont(roboto_ab.get()).status()));
+  ASSERT_TRUE(
+      absl::IsNotFound(IFTTable::ExtensionFromFont(roboto_ab.get()).status()));
+}
+
 TEST_F(IFTTableTest, GetId) { ASSERT_EQ(sample.GetId(), CompatId(1, 2, 3, 4)); }
 
 TEST_F(IFTTableTest, GetId_None) { ASSERT_EQ(empty.GetId(), CompatId()); }
@@ -26,33 +26,17 @@ using ift::feature_registry::IndexToFeatureTag;
 
 namespace ift::proto {
 
-template <typename S>
-static bool sets_intersect(const S& a, const S& b) {
-  bool a_smaller = a.size() < b.size();
-  const auto& smaller = a_smaller ? a : b;
-  const auto& larger = a_smaller ? b : a;
-  for (uint32_t v : smaller) {
-    if (larger.contains(v)) {
-      return true;
-    }
-  }
-  return false;
-}
-
 void PrintTo(const PatchMap::Coverage& coverage, std::ostream* os) {
-  absl::btree_set<uint32_t> sorted_codepoints;
-  std::copy(coverage.codepoints.begin(), coverage.codepoints.end(),
-            std::inserter(sorted_codepoints, sorted_codepoints.begin()));
-
   if (!coverage.features.empty() || !coverage.design_space.empty()) {
     *os << "{";
   }
   *os << "{";
-  for (auto it = sorted_codepoints.begin(); it != sorted_codepoints.end();
+  // Codepoints iterate in sorted order.
+  for (auto it = coverage.codepoints.begin(); it != coverage.codepoints.end();
        it++) {
     *os << *it;
     auto next = it;
-    if (++next != sorted_codepoints.end()) {
+    if (++next != coverage.codepoints.end()) {
       *os << ", ";
     }
   }
@@ -11,6 +11,7 @@
 #include "absl/status/statusor.h"
 #include "absl/types/span.h"
 #include "common/axis_range.h"
+#include "common/range_set.h"
 #include "hb.h"
 #include "ift/proto/patch_encoding.h"
 
@@ -32,7 +33,7 @@ class PatchMap {
     Coverage(std::initializer_list<uint32_t> codepoints_list)
         : codepoints(codepoints_list) {}
     Coverage(const absl::flat_hash_set<uint32_t>& codepoints_list)
-        : codepoints(codepoints_list) {}
+        : codepoints(codepoints_list.begin(), codepoints_list.end()) {}
 
     friend void PrintTo(const Coverage& point, std::ostream* os);
 
@@ -42,17 +43,14 @@ class PatchMap {
     }
 
     uint32_t SmallestCodepoint() const {
-      uint32_t min = 0xFFFFFFFF;
-      for (uint32_t cp : codepoints) {
-        if (cp < min) {
-          min = cp;
-        }
+      if (codepoints.empty()) {
+        return 0xFFFFFFFF;
       }
-      return min;
+      return codepoints.Ranges().front().first;
     }
 
-    // TODO(garretrieger): use hb sets instead?
-    absl::flat_hash_set<uint32_t> codepoints;
+    // Copies of a coverage share the codepoint ranges.
+    common::RangeSet codepoints;
     absl::btree_set<hb_tag_t> features;
     absl::btree_map<hb_tag_t, common::AxisRange> design_space;
 
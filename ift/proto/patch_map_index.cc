@@ -0,0 +1,135 @@
+#include "ift/proto/patch_map_index.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "common/range_set.h"
+#include "ift/proto/patch_map.h"
+
+using absl::btree_set;
+using absl::flat_hash_map;
+using absl::flat_hash_set;
+
+namespace ift::proto {
+
+template <typename S>
+static bool sets_intersect(const S& a, const S& b) {
+  bool a_smaller = a.size() < b.size();
+  const auto& smaller = a_smaller ? a : b;
+  const auto& larger = a_smaller ? b : a;
+  for (uint32_t v : smaller) {
+    if (larger.contains(v)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool sets_intersect(const common::RangeSet& a,
+                           const common::RangeSet& b) {
+  return a.Intersects(b);
+}
+
+template <typename K>
+static void AddCandidates(const flat_hash_map<K, std::vector<uint32_t>>& index,
+                          K key, flat_hash_set<uint32_t>& candidates) {
+  auto it = index.find(key);
+  if (it != index.end()) {
+    candidates.insert(it->second.begin(), it->second.end());
+  }
+}
+
+PatchMapIndex::PatchMapIndex(const PatchMap& patch_map)
+    : entries_(patch_map.GetEntries()) {
+  for (uint32_t i = 0; i < entries_.size(); i++) {
+    const PatchMap::Coverage& coverage = entries_[i].coverage;
+    if (!coverage.codepoints.empty()) {
+      for (uint32_t cp : coverage.codepoints) {
+        codepoint_entries_[cp].push_back(i);
+      }
+    } else if (!coverage.features.empty()) {
+      for (hb_tag_t tag : coverage.features) {
+        feature_entries_[tag].push_back(i);
+      }
+    } else if (!coverage.design_space.empty()) {
+      for (const auto& [tag, range] : coverage.design_space) {
+        axis_entries_[tag].push_back(i);
+      }
+    } else {
+      unconditional_entries_.push_back(i);
+    }
+  }
+}
+
+btree_set<uint32_t> PatchMapIndex::Intersecting(
+    const PatchMap::Coverage& query) const {
+  // Every matching entry must intersect the query in the dimension it was
+  // posted under, so the union of those postings is a superset of the result.
+  flat_hash_set<uint32_t> candidates;
+  for (uint32_t cp : query.codepoints) {
+    AddCandidates(codepoint_entries_, cp, candidates);
+  }
+  for (hb_tag_t tag : query.features) {
+    AddCandidates(feature_entries_, tag, candidates);
+  }
+  for (const auto& [tag, range] : query.design_space) {
+    AddCandidates(axis_entries_, tag, candidates);
+  }
+  candidates.insert(unconditional_entries_.begin(),
+                    unconditional_entries_.end());
+
+  btree_set<uint32_t> result;
+  flat_hash_map<uint32_t, bool> memo;
+  for (uint32_t index : candidates) {
+    if (!entries_[index].ignored && Matches(query, index, memo)) {
+      result.insert(index);
+    }
+  }
+  return result;
+}
+
+bool PatchMapIndex::Matches(const PatchMap::Coverage& query, uint32_t index,
+                            flat_hash_map<uint32_t, bool>& memo) const {
+  auto it = memo.find(index);
+  if (it != memo.end()) {
+    return it->second;
+  }
+
+  const PatchMap::Coverage& coverage = entries_[index].coverage;
+  bool matches =
+      (coverage.codepoints.empty() ||
+       sets_intersect(coverage.codepoints, query.codepoints)) &&
+      (coverage.features.empty() ||
+       sets_intersect(coverage.features, query.features));
+
+  if (matches && !coverage.design_space.empty()) {
+    matches = false;
+    for (const auto& [tag, range] : coverage.design_space) {
+      auto query_range = query.design_space.find(tag);
+      if (query_range != query.design_space.end() &&
+          query_range->second.Intersects(range)) {
+        matches = true;
+        break;
+      }
+    }
+  }
+
+  if (matches && !coverage.child_indices.empty()) {
+    // Child indices always refer to earlier entries so this terminates.
+    matches = coverage.conjunctive;
+    for (uint32_t child : coverage.child_indices) {
+      if (Matches(query, child, memo) != coverage.conjunctive) {
+        matches = !coverage.conjunctive;
+        break;
+      }
+    }
+  }
+
+  memo[index] = matches;
+  return matches;
+}
+
+}  // namespace ift::proto
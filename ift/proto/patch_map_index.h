@@ -0,0 +1,55 @@
+#ifndef IFT_PROTO_PATCH_MAP_INDEX_H_
+#define IFT_PROTO_PATCH_MAP_INDEX_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/container/btree_set.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/types/span.h"
+#include "hb.h"
+#include "ift/proto/patch_map.h"
+
+namespace ift::proto {
+
+/*
+ * Query index over the entries of a PatchMap. Answers which entries match a
+ * subset definition in time proportional to the size of the query and the
+ * number of candidate entries instead of the total number of entries.
+ *
+ * Each entry is posted under a single dimension: its codepoints if it has
+ * any, otherwise its features, otherwise the axes of its design space.
+ * Entries with none of those (for example ones only made up of child
+ * entries) are always considered. Candidates are then checked against the
+ * full entry matching rules
+ * (https://w3c.github.io/IFT/Overview.html#entry-matching).
+ *
+ * The index refers to the entries of the patch map it was built from, so the
+ * patch map must outlive the index and not be modified while it is in use.
+ */
+class PatchMapIndex {
+ public:
+  explicit PatchMapIndex(const PatchMap& patch_map);
+
+  /*
+   * Returns the indices (into PatchMap::GetEntries()) of all entries which
+   * are not ignored and match the subset definition described by query. The
+   * query's child indices are not used.
+   */
+  absl::btree_set<uint32_t> Intersecting(
+      const PatchMap::Coverage& query) const;
+
+ private:
+  bool Matches(const PatchMap::Coverage& query, uint32_t index,
+               absl::flat_hash_map<uint32_t, bool>& memo) const;
+
+  absl::Span<const PatchMap::Entry> entries_;
+  absl::flat_hash_map<uint32_t, std::vector<uint32_t>> codepoint_entries_;
+  absl::flat_hash_map<hb_tag_t, std::vector<uint32_t>> feature_entries_;
+  absl::flat_hash_map<hb_tag_t, std::vector<uint32_t>> axis_entries_;
+  std::vector<uint32_t> unconditional_entries_;
+};
+
+}  // namespace ift::proto
+
+#endif  // IFT_PROTO_PATCH_MAP_INDEX_H_
@@ -0,0 +1,115 @@
+#include "ift/proto/patch_map_index.h"
+
+#include <cstdint>
+
+#include "absl/container/btree_set.h"
+#include "common/axis_range.h"
+#include "gtest/gtest.h"
+#include "ift/proto/patch_encoding.h"
+#include "ift/proto/patch_map.h"
+
+using absl::btree_set;
+using common::AxisRange;
+
+namespace ift::proto {
+
+class PatchMapIndexTest : public ::testing::Test {
+ protected:
+  PatchMapIndexTest() {
+    // 0
+    auto sc = patch_map.AddEntry({1, 2, 3}, 1, TABLE_KEYED_FULL);
+    // 1
+    sc.Update(patch_map.AddEntry({3, 4, 5}, 2, TABLE_KEYED_FULL));
+
+    // 2
+    PatchMap::Coverage features{7};
+    features.features.insert(HB_TAG('s', 'm', 'c', 'p'));
+    sc.Update(patch_map.AddEntry(features, 3, GLYPH_KEYED));
+
+    // 3
+    PatchMap::Coverage features_only;
+    features_only.features.insert(HB_TAG('l', 'i', 'g', 'a'));
+    sc.Update(patch_map.AddEntry(features_only, 4, GLYPH_KEYED));
+
+    // 4
+    PatchMap::Coverage design_space;
+    design_space.design_space[HB_TAG('w', 'g', 'h', 't')] =
+        *AxisRange::Range(300, 400);
+    sc.Update(patch_map.AddEntry(design_space, 5, GLYPH_KEYED));
+
+    // 5
+    PatchMap::Coverage conjunctive;
+    conjunctive.child_indices = {0, 1};
+    conjunctive.conjunctive = true;
+    sc.Update(patch_map.AddEntry(conjunctive, 6, GLYPH_KEYED));
+
+    // 6
+    PatchMap::Coverage disjunctive;
+    disjunctive.child_indices = {2, 4};
+    sc.Update(patch_map.AddEntry(disjunctive, 7, GLYPH_KEYED));
+
+    // 7
+    sc.Update(patch_map.AddEntry({9}, 8, GLYPH_KEYED, true));
+
+    // 8
+    PatchMap::Coverage ignored_child;
+    ignored_child.child_indices = {7};
+    sc.Update(patch_map.AddEntry(ignored_child, 9, GLYPH_KEYED));
+
+    // 9
+    sc.Update(patch_map.AddEntry({}, 10, GLYPH_KEYED));
+    assert(sc.ok());
+  }
+
+  PatchMap patch_map;
+};
+
+TEST_F(PatchMapIndexTest, Codepoints) {
+  PatchMapIndex index(patch_map);
+
+  EXPECT_EQ(index.Intersecting({}), (btree_set<uint32_t>{9}));
+  EXPECT_EQ(index.Intersecting({2}), (btree_set<uint32_t>{0, 9}));
+  EXPECT_EQ(index.Intersecting({3}), (btree_set<uint32_t>{0, 1, 5, 9}));
+  EXPECT_EQ(index.Intersecting({1, 5}), (btree_set<uint32_t>{0, 1, 5, 9}));
+  EXPECT_EQ(index.Intersecting({6}), (btree_set<uint32_t>{9}));
+}
+
+TEST_F(PatchMapIndexTest, Features) {
+  PatchMapIndex index(patch_map);
+
+  PatchMap::Coverage query{7};
+  EXPECT_EQ(index.Intersecting(query), (btree_set<uint32_t>{9}));
+
+  query.features.insert(HB_TAG('s', 'm', 'c', 'p'));
+  EXPECT_EQ(index.Intersecting(query), (btree_set<uint32_t>{2, 6, 9}));
+
+  query.codepoints.clear();
+  EXPECT_EQ(index.Intersecting(query), (btree_set<uint32_t>{9}));
+
+  query.features.insert(HB_TAG('l', 'i', 'g', 'a'));
+  EXPECT_EQ(index.Intersecting(query), (btree_set<uint32_t>{3, 9}));
+}
+
+TEST_F(PatchMapIndexTest, DesignSpace) {
+  PatchMapIndex index(patch_map);
+
+  PatchMap::Coverage query;
+  query.design_space[HB_TAG('w', 'g', 'h', 't')] = AxisRange::Point(200);
+  EXPECT_EQ(index.Intersecting(query), (btree_set<uint32_t>{9}));
+
+  query.design_space[HB_TAG('w', 'g', 'h', 't')] = AxisRange::Point(350);
+  EXPECT_EQ(index.Intersecting(query), (btree_set<uint32_t>{4, 6, 9}));
+
+  query.design_space.clear();
+  query.design_space[HB_TAG('w', 'd', 't', 'h')] = AxisRange::Point(350);
+  EXPECT_EQ(index.Intersecting(query), (btree_set<uint32_t>{9}));
+}
+
+TEST_F(PatchMapIndexTest, IgnoredChild) {
+  PatchMapIndex index(patch_map);
+
+  // Ignored entries aren't returned, but are still matched as children.
+  EXPECT_EQ(index.Intersecting({9}), (btree_set<uint32_t>{8, 9}));
+}
+
+}  // namespace ift::proto
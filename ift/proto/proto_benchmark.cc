@@ -0,0 +1,105 @@
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "benchmark/benchmark.h"
+#include "common/compat_id.h"
+#include "common/font_data.h"
+#include "hb.h"
+#include "ift/proto/format_2_patch_map.h"
+#include "ift/proto/ift_table.h"
+#include "ift/proto/patch_encoding.h"
+#include "ift/proto/patch_map.h"
+
+using common::hb_blob_unique_ptr;
+using common::hb_face_unique_ptr;
+using common::make_hb_blob;
+using common::make_hb_face;
+using ift::proto::Format2PatchMap;
+using ift::proto::GLYPH_KEYED;
+using ift::proto::IFTTable;
+using ift::proto::PatchMap;
+using ift::proto::TABLE_KEYED_PARTIAL;
+
+namespace {
+
+/*
+ * Builds a table shaped like the output of a mixed mode encode: mostly glyph
+ * keyed entries on disjoint codepoint segments, with every tenth entry adding
+ * a feature condition and every hundredth a table keyed entry that
+ * references earlier entries.
+ */
+IFTTable MakeTable(uint32_t entry_count) {
+  IFTTable table;
+  table.SetUrlTemplate("https://fonts.example.com/patches/{id}.br");
+  table.SetId(common::CompatId(1, 2, 3, 4));
+  PatchMap& map = table.GetPatchMap();
+
+  constexpr uint32_t segment_size = 20;
+  constexpr uint32_t segment_start = 0x4E00;
+  for (uint32_t i = 0; i < entry_count; i++) {
+    PatchMap::Coverage coverage;
+    if (i % 100 == 99) {
+      coverage.child_indices = {i - 1, i - 2};
+      coverage.conjunctive = true;
+      (void)map.AddEntry(coverage, i + 1, TABLE_KEYED_PARTIAL);
+      continue;
+    }
+
+    for (uint32_t cp = 0; cp < segment_size; cp++) {
+      coverage.codepoints.insert(segment_start + i * segment_size + cp);
+    }
+    if (i % 10 == 9) {
+      coverage.features.insert(HB_TAG('s', 'm', 'c', 'p'));
+    }
+    (void)map.AddEntry(coverage, i + 1, GLYPH_KEYED);
+  }
+  return table;
+}
+
+void EntryCounts(benchmark::internal::Benchmark* b) {
+  b->ArgName("entries")->RangeMultiplier(10)->Range(10, 10000);
+}
+
+void BM_Format2Serialize(benchmark::State& state) {
+  IFTTable table = MakeTable(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Format2PatchMap::Serialize(table));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Format2Serialize)->Apply(EntryCounts);
+
+void BM_Format2Deserialize(benchmark::State& state) {
+  auto encoded = Format2PatchMap::Serialize(MakeTable(state.range(0)));
+  if (!encoded.ok()) {
+    state.SkipWithError("Serialization failed.");
+    return;
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Format2PatchMap::Deserialize(*encoded));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Format2Deserialize)->Apply(EntryCounts);
+
+void BM_AddToFont(benchmark::State& state) {
+  constexpr char font_path[] = "common/testdata/Roboto-Regular.ab.ttf";
+  hb_blob_unique_ptr blob =
+      make_hb_blob(hb_blob_create_from_file_or_fail(font_path));
+  if (!blob.get()) {
+    state.SkipWithError("Unable to load the test font.");
+    return;
+  }
+  hb_face_unique_ptr face = make_hb_face(hb_face_create(blob.get(), 0));
+
+  IFTTable table = MakeTable(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        IFTTable::AddToFont(face.get(), table, std::nullopt));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_AddToFont)->Apply(EntryCounts);
+
+}  // namespace
@@ -1,25 +1,32 @@
 #include "ift/table_keyed_diff.h"
 
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "absl/container/flat_hash_set.h"
+#include "brotli/brotli_font_diff.h"
 #include "common/font_data.h"
 #include "common/font_helper.h"
 #include "common/font_helper_macros.h"
+#include "common/trace.h"
 #include "hb.h"
 
 using absl::btree_set;
 using absl::flat_hash_map;
 using absl::flat_hash_set;
 using absl::Status;
+using brotli::BrotliFontDiff;
 using common::FontData;
 using common::FontHelper;
+using common::TraceSpan;
 
 namespace ift {
 
 Status TableKeyedDiff::Diff(const FontData& font_base,
                             const FontData& font_derived,
                             FontData* patch /* OUT */) const {
+  TraceSpan span("TableKeyedDiff::Diff");
   hb_face_t* face_base = font_base.reference_face();
   hb_face_t* face_derived = font_derived.reference_face();
 
@@ -27,6 +34,15 @@ Status TableKeyedDiff::Diff(const FontData& font_base,
   auto derived_tags = FontHelper::GetTags(face_derived);
   auto diff_tags = TagsToDiff(base_tags, derived_tags);
 
+  struct TableDiff {
+    std::string tag;
+    FontData base_table;
+    FontData derived_table;
+    FontData patch;
+    Status status;
+  };
+  std::vector<TableDiff> table_diffs;
+
   flat_hash_map<std::string, std::pair<uint32_t, FontData>> patches;
   flat_hash_set<hb_tag_t> new_tables;
   flat_hash_set<hb_tag_t> unchanged_tables;
@@ -50,26 +66,63 @@ Status TableKeyedDiff::Diff(const FontData& font_base,
     }
 
     FontData derived_table = FontHelper::TableData(face_derived, t);
-    if (base_table == derived_table) {
+    // Table hashes are cached with the font so when the same base or derived
+    // font is diffed repeatedly differing tables are cheaply rejected. A hash
+    // match is confirmed by comparing the bytes.
+    bool unchanged = base_table.size() == derived_table.size() &&
+                     (base_table.size() == 0 ||
+                      (FontHelper::TableHash(face_base, t) ==
+                           FontHelper::TableHash(face_derived, t) &&
+                       base_table == derived_table));
+    if (unchanged) {
       // If table is unchanged then no diff is needed.
       unchanged_tables.insert(t);
       continue;
     }
 
-    FontData table_patch;
-    auto sc = binary_diff_.Diff(base_table, derived_table, &table_patch);
-    if (!sc.ok()) {
-      hb_face_destroy(face_base);
-      hb_face_destroy(face_derived);
-      return sc;
-    }
+    table_diffs.push_back(TableDiff{
+        .tag = tag,
+        .base_table = std::move(base_table),
+        .derived_table = std::move(derived_table),
+    });
+  }
 
-    patches[tag] = std::pair(derived_table.size(), std::move(table_patch));
+  // The table diffs are independent of each other so can be computed in any
+  // order, results are collected in tag order below.
+  auto diff_one = [this, face_base, face_derived](TableDiff& table_diff) {
+    const std::string& tag = table_diff.tag;
+    hb_tag_t t = HB_TAG(tag[0], tag[1], tag[2], tag[3]);
+    if (base_mapping_ && derived_mapping_ && table_diff.base_table.size() &&
+        BrotliFontDiff::CanDiffTable(t)) {
+      table_diff.status = BrotliFontDiff::DiffTable(
+          t, *base_mapping_, face_base, *derived_mapping_, face_derived,
+          &table_diff.patch, thread_pool_);
+      return;
+    }
+    table_diff.status = binary_diff_.Diff(
+        table_diff.base_table, table_diff.derived_table, &table_diff.patch);
+  };
+  if (thread_pool_) {
+    thread_pool_->ParallelFor(table_diffs.size(), [&](uint32_t i) {
+      diff_one(table_diffs[i]);
+    });
+  } else {
+    for (auto& table_diff : table_diffs) {
+      diff_one(table_diff);
+    }
   }
 
   hb_face_destroy(face_base);
   hb_face_destroy(face_derived);
 
+  for (auto& table_diff : table_diffs) {
+    if (!table_diff.status.ok()) {
+      return table_diff.status;
+    }
+    patches[table_diff.tag] = std::pair(table_diff.derived_table.size(),
+                                        std::move(table_diff.patch));
+  }
+
   for (hb_tag_t t : unchanged_tables) {
     std::string tag = FontHelper::ToString(t);
     auto it = diff_tags.find(tag);
@@ -78,8 +131,15 @@ Status TableKeyedDiff::Diff(const FontData& font_base,
     }
   }
 
-  // Serialize to the binary format
+  // Serialize to the binary format, the final size is known up front so the
+  // output is allocated once: a 26 byte header, patchesCount + 1 offsets, and
+  // then a 9 byte header plus the patch data for each table.
+  size_t patch_size = 26 + (diff_tags.size() + 1) * 4 + diff_tags.size() * 9;
+  for (const auto& [tag, entry] : patches) {
+    patch_size += entry.second.size();
+  }
   std::string data;
+  data.reserve(patch_size);
   FontHelper::WriteUInt32(HB_TAG('i', 'f', 't', 'k'), data);
   FontHelper::WriteUInt32(0, data);  // reserved
 
@@ -128,10 +188,10 @@ Status TableKeyedDiff::Diff(const FontData& font_base,
 
     // max uncompressed length
     FontHelper::WriteUInt32(it->second.first, data);
-    data += patch_data.string();
+    data.append(patch_data.str());
   }
 
-  patch->copy(data);
+  patch->take(std::move(data));
 
   return absl::OkStatus();
 }
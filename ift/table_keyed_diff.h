@@ -2,26 +2,35 @@
 #define IFT_TABLE_KEYED_DIFF_H_
 
 #include <initializer_list>
+#include <memory>
+#include <utility>
 
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/status/status.h"
+#include "brotli/brotli_font_diff.h"
 #include "common/binary_diff.h"
 #include "common/brotli_binary_diff.h"
+#include "common/brotli_dictionary_cache.h"
 #include "common/compat_id.h"
 #include "common/font_data.h"
+#include "common/thread_pool.h"
 
 namespace ift {
 
 /* Creates a per table brotli binary diff of two fonts. */
 class TableKeyedDiff : public common::BinaryDiff {
  public:
-  TableKeyedDiff(common::CompatId base_compat_id)
-      : binary_diff_(11), base_compat_id_(base_compat_id) {}
+  TableKeyedDiff(common::CompatId base_compat_id,
+                 common::BrotliBinaryDiff::Options brotli_options = {
+                     .quality = 11})
+      : binary_diff_(brotli_options), base_compat_id_(base_compat_id) {}
 
   TableKeyedDiff(common::CompatId base_compat_id,
-                 std::initializer_list<const char*> excluded_tags)
-      : binary_diff_(11),
+                 std::initializer_list<const char*> excluded_tags,
+                 common::BrotliBinaryDiff::Options brotli_options = {
+                     .quality = 11})
+      : binary_diff_(brotli_options),
         base_compat_id_(base_compat_id),
         excluded_tags_(),
         replaced_tags_() {
@@ -31,8 +40,10 @@ class TableKeyedDiff : public common::BinaryDiff {
 
   TableKeyedDiff(common::CompatId base_compat_id,
                  absl::btree_set<std::string> excluded_tags,
-                 absl::btree_set<std::string> replaced_tags)
-      : binary_diff_(11),
+                 absl::btree_set<std::string> replaced_tags,
+                 common::BrotliBinaryDiff::Options brotli_options = {
+                     .quality = 11})
+      : binary_diff_(brotli_options),
         base_compat_id_(base_compat_id),
         excluded_tags_(),
         replaced_tags_() {
@@ -40,6 +51,35 @@ class TableKeyedDiff : public common::BinaryDiff {
     replaced_tags_ = replaced_tags;
   }
 
+  // Per table dictionaries are obtained from this cache so they can be shared
+  // between diffs against the same base.
+  void SetDictionaryCache(
+      std::shared_ptr<common::BrotliDictionaryCache> cache) {
+    binary_diff_.SetDictionaryCache(std::move(cache));
+  }
+
+  /*
+   * If set, tables holding per glyph data (see
+   * brotli::BrotliFontDiff::CanDiffTable()) are diffed with
+   * brotli::BrotliFontDiff, which copies unchanged glyphs from the base
+   * instead of searching for matches. This is much faster than the generic
+   * brotli differ. The mappings are for the base and derived fonts passed to
+   * Diff(), both must be subsets of the same font. They must outlive this
+   * differ.
+   */
+  void SetGlyphMappings(const brotli::GlyphMapping* base_mapping,
+                        const brotli::GlyphMapping* derived_mapping) {
+    base_mapping_ = base_mapping;
+    derived_mapping_ = derived_mapping;
+  }
+
+  // If set, the per table patches are compressed concurrently on this pool, as
+  // are the chunks of novel glyph data within tables diffed by
+  // brotli::BrotliFontDiff. The output is identical to sequential diffing.
+  // Diff() may be called from a task running on the same pool, see
+  // ThreadPool::ParallelFor(). The pool must outlive this differ.
+  void SetThreadPool(common::ThreadPool* pool) { thread_pool_ = pool; }
+
   absl::Status Diff(const common::FontData& font_base,
                     const common::FontData& font_derived,
                     common::FontData* patch /* OUT */) const override;
@@ -55,6 +95,9 @@ class TableKeyedDiff : public common::BinaryDiff {
   common::CompatId base_compat_id_;
   absl::btree_set<std::string> excluded_tags_;
   absl::btree_set<std::string> replaced_tags_;
+  common::ThreadPool* thread_pool_ = nullptr;
+  const brotli::GlyphMapping* base_mapping_ = nullptr;
+  const brotli::GlyphMapping* derived_mapping_ = nullptr;
 };
 
 }  // namespace ift
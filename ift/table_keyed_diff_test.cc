@@ -6,6 +6,7 @@
 #include "common/compat_id.h"
 #include "common/font_data.h"
 #include "common/font_helper.h"
+#include "common/thread_pool.h"
 #include "gtest/gtest.h"
 #include "hb.h"
 
@@ -127,6 +128,33 @@ TEST_F(TableKeyedDiffTest, BasicDiff_IgnoreUnchanged) {
   ASSERT_EQ(patch.string(), expected);
 }
 
+TEST_F(TableKeyedDiffTest, ThreadPool_SameOutput) {
+  FontData before = FontHelper::BuildFont({
+      {tag1, "foo"},
+      {tag2, "bar"},
+      {tag3, "baz"},
+  });
+
+  FontData after = FontHelper::BuildFont({
+      {tag1, "fooo"},
+      {tag2, "baar"},
+      {tag3, "bazzz"},
+  });
+
+  TableKeyedDiff sequential(CompatId(1, 2, 3, 4));
+  FontData expected;
+  auto sc = sequential.Diff(before, after, &expected);
+  ASSERT_TRUE(sc.ok()) << sc;
+
+  common::ThreadPool pool(3);
+  TableKeyedDiff parallel(CompatId(1, 2, 3, 4));
+  parallel.SetThreadPool(&pool);
+  FontData patch;
+  sc = parallel.Diff(before, after, &patch);
+  ASSERT_TRUE(sc.ok()) << sc;
+  ASSERT_EQ(patch.string(), expected.string());
+}
+
 /*
 TODO reimplement these against the new format.
 TEST_F(TableKeyedDiffTest, ReplacementDiff) {
@@ -0,0 +1,492 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/container/btree_map.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "common/try.h"
+#include "common/woff2.h"
+#include "hb.h"
+#include "ift/patch_pack.h"
+
+/*
+ * Utility that compares two encodings written by font2ift, and/or two stats
+ * reports (font2ift --stats_out or glyph_keyed_segmenter --stats_json_file),
+ * to catch regressions in output size and build time. Typically the baseline
+ * is produced by the last release and the candidate by the change under test.
+ *
+ * For encodings the patches are grouped by type (table keyed and glyph keyed)
+ * and their count, total and percentile sizes are compared, along with the
+ * size of the init font and its IFT and IFTX tables. For stats reports every
+ * value is compared.
+ *
+ * Differences are printed as a table. If any of the --max_*_increase_percent
+ * thresholds are exceeded, the regressions are listed and the exit status is
+ * non zero, so this can be used as a CI gate.
+ */
+
+ABSL_FLAG(std::string, baseline_path, "",
+          "Path to the directory holding the baseline encoding.");
+
+ABSL_FLAG(std::string, baseline_font, "out.ttf",
+          "Name of the baseline encoding's init font. Its files are found via "
+          "the <font>.manifest file written next to it.");
+
+ABSL_FLAG(std::string, candidate_path, "",
+          "Path to the directory holding the candidate encoding.");
+
+ABSL_FLAG(std::string, candidate_font, "out.ttf",
+          "Name of the candidate encoding's init font.");
+
+ABSL_FLAG(std::string, baseline_stats, "",
+          "Path to the baseline's stats report (JSON).");
+
+ABSL_FLAG(std::string, candidate_stats, "",
+          "Path to the candidate's stats report (JSON).");
+
+ABSL_FLAG(double, max_size_increase_percent, -1,
+          "If non negative, sizes (the total bytes of each patch type, the "
+          "init font and its IFT/IFTX tables, and bytes_out in stats reports) "
+          "may grow by at most this percentage.");
+
+ABSL_FLAG(double, max_time_increase_percent, -1,
+          "If non negative, timings in the stats reports (total_ms and "
+          "*_seconds values) may grow by at most this percentage.");
+
+ABSL_FLAG(double, min_time_ms, 100,
+          "Timings below this many milliseconds in the baseline are too noisy "
+          "to compare and aren't checked against "
+          "--max_time_increase_percent.");
+
+using absl::btree_map;
+using absl::Status;
+using absl::StatusOr;
+using absl::StrCat;
+using absl::string_view;
+using common::FontData;
+using common::FontHelper;
+using common::Woff2;
+using ift::PatchPack;
+
+constexpr hb_tag_t kIFTX = HB_TAG('I', 'F', 'T', 'X');
+
+enum class Check {
+  NONE,
+  SIZE,
+  TIME,
+};
+
+// One compared value, missing on the side it wasn't found on.
+struct Metric {
+  std::optional<double> baseline;
+  std::optional<double> candidate;
+  Check check = Check::NONE;
+};
+
+using Metrics = btree_map<std::string, Metric>;
+
+// Sizes of the outputs of an encoding.
+struct EncodingSizes {
+  // Patch sizes by patch type.
+  btree_map<std::string, std::vector<uint64_t>> patches;
+  uint64_t init_font_bytes = 0;
+  uint64_t ift_table_bytes = 0;
+  uint64_t iftx_table_bytes = 0;
+};
+
+// Classifies a patch by it's format tag.
+std::string patch_type(string_view patch) {
+  auto tag = FontHelper::ReadUInt32(patch);
+  if (tag.ok() && *tag == HB_TAG('i', 'f', 't', 'k')) {
+    return "table_keyed";
+  }
+  if (tag.ok() && *tag == HB_TAG('i', 'f', 'g', 'k')) {
+    return "glyph_keyed";
+  }
+  return "unknown";
+}
+
+// Loads the sizes of the files listed in the manifest written by font2ift.
+StatusOr<EncodingSizes> load_encoding(const std::string& path,
+                                      const std::string& font) {
+  std::string manifest_path = StrCat(path, "/", font, ".manifest");
+  FontData manifest = TRY(FontData::FromFile(manifest_path));
+
+  // Patches written with --pack_patches are all in one pack file.
+  std::string pack_path = StrCat(path, "/", font, ".patches");
+  std::optional<PatchPack> pack;
+  if (std::filesystem::exists(pack_path)) {
+    pack = TRY(PatchPack::Load(pack_path));
+  }
+
+  EncodingSizes sizes;
+  bool found_init_font = false;
+  for (string_view line :
+       absl::StrSplit(manifest.str(), '\n', absl::SkipEmpty())) {
+    std::vector<std::string> parts =
+        absl::StrSplit(line, ' ', absl::SkipEmpty());
+    if (parts.size() != 2) {
+      return absl::InvalidArgumentError(
+          StrCat("Malformed manifest line: ", line));
+    }
+
+    if (parts[1] != font) {
+      if (!pack.has_value()) {
+        FontData patch = TRY(FontData::FromFile(StrCat(path, "/", parts[1])));
+        sizes.patches[patch_type(patch.str())].push_back(patch.size());
+      }
+      continue;
+    }
+
+    FontData data = TRY(FontData::FromFile(StrCat(path, "/", parts[1])));
+    sizes.init_font_bytes = data.size();
+    if (data.str().substr(0, 4) == "wOF2") {
+      data = TRY(Woff2::DecodeWoff2(data.str()));
+    }
+    common::hb_face_unique_ptr face = data.face();
+    sizes.ift_table_bytes =
+        FontHelper::TableData(face.get(), FontHelper::kIFT).size();
+    sizes.iftx_table_bytes = FontHelper::TableData(face.get(), kIFTX).size();
+    found_init_font = true;
+  }
+
+  if (pack.has_value()) {
+    for (uint32_t i = 0; i < pack->size(); i++) {
+      PatchPack::Range range = pack->At(i);
+      string_view patch = pack->str().substr(range.offset, range.length);
+      sizes.patches[patch_type(patch)].push_back(patch.size());
+    }
+  }
+
+  if (!found_init_font) {
+    return absl::NotFoundError(
+        StrCat("The init font, ", font, ", is not in ", manifest_path));
+  }
+  return sizes;
+}
+
+// Returns the p'th percentile (nearest rank) of sorted, which is non empty.
+uint64_t percentile(const std::vector<uint64_t>& sorted, double p) {
+  size_t rank = std::ceil(p / 100.0 * sorted.size());
+  return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+// Adds the metrics for an encoding to one side (selected by 'side') of
+// metrics.
+void add_encoding_metrics(const EncodingSizes& sizes,
+                          std::optional<double> Metric::*side,
+                          Metrics& metrics) {
+  auto add = [&](const std::string& name, double value, Check check) {
+    Metric& metric = metrics[name];
+    metric.*side = value;
+    metric.check = check;
+  };
+
+  add("init_font.bytes", sizes.init_font_bytes, Check::SIZE);
+  add("init_font.ift_table_bytes", sizes.ift_table_bytes, Check::SIZE);
+  add("init_font.iftx_table_bytes", sizes.iftx_table_bytes, Check::SIZE);
+  for (const auto& [type, patch_sizes] : sizes.patches) {
+    std::vector<uint64_t> sorted = patch_sizes;
+    std::sort(sorted.begin(), sorted.end());
+    uint64_t total = 0;
+    for (uint64_t size : sorted) {
+      total += size;
+    }
+    std::string prefix = StrCat("patches.", type, ".");
+    add(StrCat(prefix, "count"), sorted.size(), Check::NONE);
+    add(StrCat(prefix, "total_bytes"), total, Check::SIZE);
+    for (uint32_t p : {50, 90, 99}) {
+      add(StrCat(prefix, "p", p, "_bytes"), percentile(sorted, p),
+          Check::NONE);
+    }
+    add(StrCat(prefix, "max_bytes"), sorted.back(), Check::NONE);
+  }
+}
+
+/*
+ * Flattens a JSON document of nested objects into "a.b.c" -> value for every
+ * numeric value. The stats reports only contain objects, numbers and strings
+ * so arrays aren't supported. Strings, booleans and nulls are skipped.
+ */
+class JsonFlattener {
+ public:
+  static StatusOr<btree_map<std::string, double>> Flatten(string_view json) {
+    JsonFlattener flattener(json);
+    TRYV(flattener.Value(""));
+    flattener.SkipWhitespace();
+    if (flattener.pos_ != json.size()) {
+      return flattener.Error("Unexpected trailing data");
+    }
+    return std::move(flattener.values_);
+  }
+
+ private:
+  explicit JsonFlattener(string_view json) : json_(json) {}
+
+  Status Value(const std::string& name) {
+    SkipWhitespace();
+    if (pos_ >= json_.size()) {
+      return Error("Unexpected end of input");
+    }
+    char c = json_[pos_];
+    if (c == '{') {
+      return Object(name);
+    }
+    if (c == '"') {
+      TRY(String());
+      return absl::OkStatus();
+    }
+    if (c == '-' || absl::ascii_isdigit(c)) {
+      size_t start = pos_;
+      while (pos_ < json_.size() &&
+             (absl::ascii_isdigit(json_[pos_]) ||
+              absl::StrContains("+-.eE", json_[pos_]))) {
+        pos_++;
+      }
+      double value;
+      if (!absl::SimpleAtod(json_.substr(start, pos_ - start), &value)) {
+        return Error("Malformed number");
+      }
+      values_[name] = value;
+      return absl::OkStatus();
+    }
+    for (string_view literal : {"true", "false", "null"}) {
+      if (absl::StartsWith(json_.substr(pos_), literal)) {
+        pos_ += literal.size();
+        return absl::OkStatus();
+      }
+    }
+    return Error("Unsupported value");
+  }
+
+  Status Object(const std::string& name) {
+    pos_++;  // {
+    SkipWhitespace();
+    if (Consume('}')) {
+      return absl::OkStatus();
+    }
+    while (true) {
+      SkipWhitespace();
+      std::string key = TRY(String());
+      SkipWhitespace();
+      if (!Consume(':')) {
+        return Error("Expected ':'");
+      }
+      TRYV(Value(name.empty() ? key : StrCat(name, ".", key)));
+      SkipWhitespace();
+      if (Consume('}')) {
+        return absl::OkStatus();
+      }
+      if (!Consume(',')) {
+        return Error("Expected ',' or '}'");
+      }
+    }
+  }
+
+  // Escapes are kept as is, the reports don't use them in keys.
+  StatusOr<std::string> String() {
+    if (!Consume('"')) {
+      return Error("Expected a string");
+    }
+    size_t start = pos_;
+    while (pos_ < json_.size() && json_[pos_] != '"') {
+      pos_ += json_[pos_] == '\\' ? 2 : 1;
+    }
+    if (pos_ >= json_.size()) {
+      return Error("Unterminated string");
+    }
+    return std::string(json_.substr(start, pos_++ - start));
+  }
+
+  bool Consume(char c) {
+    if (pos_ < json_.size() && json_[pos_] == c) {
+      pos_++;
+      return true;
+    }
+    return false;
+  }
+
+  void SkipWhitespace() {
+    while (pos_ < json_.size() && absl::ascii_isspace(json_[pos_])) {
+      pos_++;
+    }
+  }
+
+  Status Error(string_view message) const {
+    return absl::InvalidArgumentError(
+        StrCat(message, " at offset ", pos_, " of the stats report."));
+  }
+
+  string_view json_;
+  size_t pos_ = 0;
+  btree_map<std::string, double> values_;
+};
+
+// Adds the values of a stats report to one side of metrics. Timings are
+// normalized to milliseconds.
+Status add_stats_metrics(const std::string& path,
+                         std::optional<double> Metric::*side,
+                         Metrics& metrics) {
+  FontData json = TRY(FontData::FromFile(path));
+  auto values = JsonFlattener::Flatten(json.str());
+  if (!values.ok()) {
+    return absl::InvalidArgumentError(
+        StrCat("Failed to parse ", path, ": ", values.status().message()));
+  }
+
+  for (const auto& [name, value] : *values) {
+    std::string key = StrCat("stats.", name);
+    double normalized = value;
+    Check check = Check::NONE;
+    if (absl::EndsWith(name, "_seconds")) {
+      absl::StrAppend(&key, "_as_ms");
+      normalized *= 1000;
+      check = Check::TIME;
+    } else if (absl::EndsWith(name, "total_ms")) {
+      check = Check::TIME;
+    } else if (absl::EndsWith(name, "bytes_out")) {
+      check = Check::SIZE;
+    }
+    Metric& metric = metrics[key];
+    metric.*side = normalized;
+    metric.check = check;
+  }
+  return absl::OkStatus();
+}
+
+std::string format_value(std::optional<double> value) {
+  if (!value.has_value()) {
+    return "-";
+  }
+  if (*value == std::floor(*value)) {
+    return absl::StrFormat("%.0f", *value);
+  }
+  return absl::StrFormat("%.1f", *value);
+}
+
+// Returns the percentage change from baseline to candidate, infinite if the
+// baseline is zero and the candidate isn't.
+double percent_change(double baseline, double candidate) {
+  if (baseline == candidate) {
+    return 0;
+  }
+  if (baseline == 0) {
+    return INFINITY;
+  }
+  return (candidate - baseline) / baseline * 100.0;
+}
+
+// Prints the differences, returns the metrics which exceeded their
+// thresholds.
+std::vector<std::string> report(const Metrics& metrics) {
+  double max_size_increase = absl::GetFlag(FLAGS_max_size_increase_percent);
+  double max_time_increase = absl::GetFlag(FLAGS_max_time_increase_percent);
+  double min_time_ms = absl::GetFlag(FLAGS_min_time_ms);
+
+  std::vector<std::string> regressions;
+  std::cout << absl::StrFormat("%-50s %15s %15s %10s\n", "metric", "baseline",
+                               "candidate", "change");
+  for (const auto& [name, metric] : metrics) {
+    std::string change = "";
+    if (metric.baseline.has_value() && metric.candidate.has_value()) {
+      double percent = percent_change(*metric.baseline, *metric.candidate);
+      change = absl::StrFormat("%+.1f%%", percent);
+
+      double limit = -1;
+      if (metric.check == Check::SIZE) {
+        limit = max_size_increase;
+      } else if (metric.check == Check::TIME &&
+                 *metric.baseline >= min_time_ms) {
+        limit = max_time_increase;
+      }
+      if (limit >= 0 && percent > limit) {
+        regressions.push_back(absl::StrFormat(
+            "%s grew by %s (limit %+.1f%%): %s -> %s", name, change, limit,
+            format_value(metric.baseline), format_value(metric.candidate)));
+        absl::StrAppend(&change, " !");
+      }
+    }
+    std::cout << absl::StrFormat("%-50s %15s %15s %10s\n", name,
+                                 format_value(metric.baseline),
+                                 format_value(metric.candidate), change);
+  }
+  return regressions;
+}
+
+int main(int argc, char** argv) {
+  auto args = absl::ParseCommandLine(argc, argv);
+
+  std::string baseline_path = absl::GetFlag(FLAGS_baseline_path);
+  std::string candidate_path = absl::GetFlag(FLAGS_candidate_path);
+  std::string baseline_stats = absl::GetFlag(FLAGS_baseline_stats);
+  std::string candidate_stats = absl::GetFlag(FLAGS_candidate_stats);
+  if (baseline_path.empty() != candidate_path.empty() ||
+      baseline_stats.empty() != candidate_stats.empty()) {
+    std::cerr << "Both a baseline and a candidate must be given." << std::endl;
+    return -1;
+  }
+  if (baseline_path.empty() && baseline_stats.empty()) {
+    std::cerr << "Nothing to compare, set --baseline_path/--candidate_path "
+                 "and/or --baseline_stats/--candidate_stats."
+              << std::endl;
+    return -1;
+  }
+
+  Metrics metrics;
+  if (!baseline_path.empty()) {
+    auto baseline =
+        load_encoding(baseline_path, absl::GetFlag(FLAGS_baseline_font));
+    if (!baseline.ok()) {
+      std::cerr << "Failed to load the baseline encoding: "
+                << baseline.status() << std::endl;
+      return -1;
+    }
+    auto candidate =
+        load_encoding(candidate_path, absl::GetFlag(FLAGS_candidate_font));
+    if (!candidate.ok()) {
+      std::cerr << "Failed to load the candidate encoding: "
+                << candidate.status() << std::endl;
+      return -1;
+    }
+    add_encoding_metrics(*baseline, &Metric::baseline, metrics);
+    add_encoding_metrics(*candidate, &Metric::candidate, metrics);
+  }
+
+  if (!baseline_stats.empty()) {
+    for (auto [path, side] : {std::pair(baseline_stats, &Metric::baseline),
+                              std::pair(candidate_stats, &Metric::candidate)}) {
+      auto sc = add_stats_metrics(path, side, metrics);
+      if (!sc.ok()) {
+        std::cerr << "Failed to load stats: " << sc << std::endl;
+        return -1;
+      }
+    }
+  }
+
+  std::vector<std::string> regressions = report(metrics);
+  if (regressions.empty()) {
+    return 0;
+  }
+  std::cerr << regressions.size() << " regression(s):" << std::endl;
+  for (const auto& regression : regressions) {
+    std::cerr << "  " << regression << std::endl;
+  }
+  return 1;
+}
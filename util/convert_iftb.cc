@@ -1,33 +1,35 @@
 #include "util/convert_iftb.h"
 
+#include <algorithm>
+#include <charconv>
 #include <cstdint>
-#include <cstdlib>
-#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
 
-#include "absl/container/btree_map.h"
-#include "absl/container/btree_set.h"
+#include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "common/cmap_index.h"
 #include "common/font_helper.h"
+#include "common/try.h"
 #include "hb.h"
 #include "util/encoder_config.pb.h"
 
-using absl::btree_map;
-using absl::btree_set;
 using absl::StatusOr;
+using absl::StrCat;
 using absl::string_view;
-using common::FontHelper;
+using common::CmapIndex;
 
 namespace util {
 
-string_view next_token(string_view line, string_view delim, std::string& out) {
-  if (line.empty()) {
-    out = "";
-    return line;
-  }
-
+// Splits the first token, up to delim, off of line and returns the rest.
+// out points into line, so nothing is copied.
+string_view next_token(string_view line, string_view delim, string_view& out) {
   size_t index = line.find(delim);
-  if (index == std::string::npos) {
+  if (index == string_view::npos) {
     out = line;
     return string_view();
   }
@@ -36,55 +38,82 @@ string_view next_token(string_view line, string_view delim, std::string& out) {
   return line.substr(index + delim.size());
 }
 
-btree_set<std::uint32_t> load_chunk_set(string_view line) {
-  btree_set<std::uint32_t> result;
+StatusOr<uint32_t> parse_uint(string_view value) {
+  value = absl::StripAsciiWhitespace(value);
+  uint32_t result = 0;
+  auto [end, ec] =
+      std::from_chars(value.data(), value.data() + value.size(), result);
+  if (value.empty() || ec != std::errc() ||
+      end != value.data() + value.size()) {
+    return absl::InvalidArgumentError(
+        StrCat("Invalid integer '", value, "' in IFTB dump."));
+  }
+  return result;
+}
 
-  std::string next;
+// Returns the sorted and de-duplicated chunk indices in line.
+StatusOr<std::vector<uint32_t>> load_chunk_set(string_view line) {
+  std::vector<uint32_t> result;
+  string_view next;
   while (!line.empty()) {
     line = next_token(line, ", ", next);
-    result.insert(std::stoi(next));
+    result.push_back(TRY(parse_uint(next)));
   }
 
+  std::sort(result.begin(), result.end());
+  result.erase(std::unique(result.begin(), result.end()), result.end());
   return result;
 }
 
-btree_map<std::uint32_t, uint32_t> load_gid_map(string_view line) {
-  btree_map<std::uint32_t, uint32_t> result;
-
-  std::string next;
+// Returns the (gid, chunk) pairs in line sorted by gid. If a gid is listed
+// more than once the last listing wins.
+StatusOr<std::vector<std::pair<uint32_t, uint32_t>>> load_gid_map(
+    string_view line) {
+  std::vector<std::pair<uint32_t, uint32_t>> result;
+  string_view next;
   while (!line.empty()) {
     line = next_token(line, ", ", next);
 
-    std::string gid;
-    std::string chunk;
-    next = next_token(next, ":", gid);
-    next = next_token(next, ":", chunk);
-
-    result[std::stoi(gid)] = std::stoi(chunk);
+    string_view gid;
+    string_view chunk;
+    chunk = next_token(next, ":", gid);
+    result.push_back(std::pair(TRY(parse_uint(gid)), TRY(parse_uint(chunk))));
   }
 
+  std::stable_sort(
+      result.begin(), result.end(),
+      [](const auto& a, const auto& b) { return a.first < b.first; });
+  auto out = result.begin();
+  for (auto it = result.begin(); it != result.end(); it++) {
+    if (out != result.begin() && (out - 1)->first == it->first) {
+      *(out - 1) = *it;
+    } else {
+      *out++ = *it;
+    }
+  }
+  result.erase(out, result.end());
   return result;
 }
 
 StatusOr<EncoderConfig> create_config(
-    const btree_map<std::uint32_t, uint32_t>& gid_map,
-    const btree_set<uint32_t>& loaded_chunks, hb_face_t* face) {
-  auto gid_to_unicode = FontHelper::GidToUnicodeMap(face);
+    const std::vector<std::pair<uint32_t, uint32_t>>& gid_map,
+    const std::vector<uint32_t>& loaded_chunks, hb_face_t* face) {
+  CmapIndex cmap(face);
   EncoderConfig config;
   // Populate segments in the config. chunks are directly analagous to segments.
   auto segments = config.mutable_glyph_patches();
+  auto codepoint_sets = config.mutable_codepoint_sets();
+  std::vector<uint32_t> non_initial_segments;
   for (const auto [gid, chunk] : gid_map) {
-    auto cp = gid_to_unicode.find(gid);
-    if (cp != gid_to_unicode.end()) {
-      Codepoints codepoints;
-      auto [it, added] =
-          config.mutable_codepoint_sets()->insert(std::pair(chunk, codepoints));
-      it->second.add_values(cp->second);
+    for (uint32_t cp : cmap.CodepointsFor(gid)) {
+      (*codepoint_sets)[chunk].add_values(cp);
     }
+    (*segments)[chunk].add_values(gid);
 
-    Glyphs glyphs;
-    auto [it, added] = segments->insert(std::pair(chunk, glyphs));
-    it->second.add_values(gid);
+    if (!std::binary_search(loaded_chunks.begin(), loaded_chunks.end(),
+                            chunk)) {
+      non_initial_segments.push_back(chunk);
+    }
   }
 
   // Set up the initial subset, which is specified by loaded_chunks
@@ -95,17 +124,14 @@ StatusOr<EncoderConfig> create_config(
   // Add all non-initial segments to a single non-glyph segment
   // TODO(garretrieger): flag to configure having more than one table keyed
   //                     segment.
-  btree_set<uint32_t> non_initial_segments;
-  for (const auto [gid, chunk] : gid_map) {
-    if (loaded_chunks.contains(chunk)) {
-      continue;
-    }
-    non_initial_segments.insert(chunk);
-  }
+  std::sort(non_initial_segments.begin(), non_initial_segments.end());
+  non_initial_segments.erase(
+      std::unique(non_initial_segments.begin(), non_initial_segments.end()),
+      non_initial_segments.end());
 
-  CodepointSets* codepoint_sets = config.add_non_glyph_codepoint_set_groups();
+  CodepointSets* non_glyph_sets = config.add_non_glyph_codepoint_set_groups();
   for (auto chunk : non_initial_segments) {
-    codepoint_sets->add_values(chunk);
+    non_glyph_sets->add_values(chunk);
     ActivationCondition* condition = config.add_glyph_patch_conditions();
     condition->set_activated_patch(chunk);
     condition->mutable_required_codepoint_sets()->Add()->mutable_values()->Add(
@@ -116,25 +142,23 @@ StatusOr<EncoderConfig> create_config(
 }
 
 StatusOr<EncoderConfig> convert_iftb(string_view iftb_dump, hb_face_t* face) {
-  btree_map<std::uint32_t, uint32_t> gid_map;
-  btree_set<uint32_t> loaded_chunks;
+  std::vector<std::pair<uint32_t, uint32_t>> gid_map;
+  std::vector<uint32_t> loaded_chunks;
 
   while (!iftb_dump.empty()) {
-    std::string line;
+    string_view line;
     iftb_dump = next_token(iftb_dump, "\n", line);
 
-    std::string field;
+    string_view field;
     line = next_token(line, ": ", field);
 
-    fprintf(stderr, ">> %s\n", field.c_str());
-
     if (field == "gidMap") {
-      gid_map = load_gid_map(line);
+      gid_map = TRY(load_gid_map(line));
       continue;
     }
 
     if (field == "chunkSet indexes") {
-      loaded_chunks = load_chunk_set(line);
+      loaded_chunks = TRY(load_chunk_set(line));
       continue;
     }
   }
@@ -5,6 +5,7 @@
 #include <string>
 
 #include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
 #include "common/font_data.h"
 #include "common/sparse_bit_set.h"
 #include "gmock/gmock.h"
@@ -118,4 +119,14 @@ TEST_F(ConvertIftbTest, BasicConversion) {
   ASSERT_EQ(config_string, expected_config);
 }
 
+TEST_F(ConvertIftbTest, InvalidInteger) {
+  for (const char* dump :
+       {"gidMap: 1:2, 3:x\n", "gidMap: 1\n", "chunkSet indexes: 0, -1\n",
+        "chunkSet indexes: 5000000000\n"}) {
+    auto config = convert_iftb(dump, face.get());
+    ASSERT_TRUE(absl::IsInvalidArgument(config.status()))
+        << dump << ": " << config.status();
+  }
+}
+
 }  // namespace util
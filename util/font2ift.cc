@@ -1,24 +1,50 @@
 #include <google/protobuf/text_format.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdio>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "absl/base/thread_annotations.h"
+#include "absl/container/btree_map.h"
 #include "absl/container/btree_set.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "common/axis_range.h"
+#include "common/brotli_binary_diff.h"
+#include "common/disk_cache.h"
 #include "common/font_data.h"
+#include "common/thread_pool.h"
+#include "common/trace.h"
 #include "common/try.h"
+#include "common/woff2.h"
 #include "hb.h"
 #include "ift/encoder/condition.h"
 #include "ift/encoder/encoder.h"
+#include "ift/encoder/encoder_stats.h"
 #include "ift/encoder/glyph_segmentation.h"
+#include "ift/encoder/patch_sink.h"
+#include "ift/encoder/progress.h"
 #include "ift/encoder/subset_definition.h"
 #include "util/encoder_config.pb.h"
 
@@ -43,20 +69,163 @@ ABSL_FLAG(std::string, output_path, "./",
 ABSL_FLAG(std::string, output_font, "out.ttf",
           "Name of the outputted base font.");
 
+ABSL_FLAG(uint32_t, num_threads, 1,
+          "Number of threads to use when generating the encoding.");
+
+ABSL_FLAG(std::string, subset_cache_dir, "",
+          "If set, subsetting results are cached in this directory and reused "
+          "by later runs. The directory can be shared between runs on "
+          "different fonts.");
+
+ABSL_FLAG(uint64_t, subset_cache_max_mb, 4096,
+          "Maximum size of the subset cache in megabytes. Least recently used "
+          "entries are removed once the limit is exceeded.");
+
+ABSL_FLAG(bool, incremental, false,
+          "If set, outputs from a previous run in output_path (as listed in "
+          "it's manifest file) are reused when their inputs haven't changed. "
+          "Reused files are left untouched.");
+
+ABSL_FLAG(int32_t, table_keyed_quality, -1,
+          "If set, overrides the brotli quality used for table keyed patches "
+          "from the config.");
+
+ABSL_FLAG(int32_t, glyph_keyed_quality, -1,
+          "If set, overrides the brotli quality used for glyph keyed patches "
+          "from the config.");
+
+ABSL_FLAG(bool, share_invariant_tables, false,
+          "If set, tables which don't change between the subsets of the "
+          "encoding (eg. name and post) are only subset once per design "
+          "space.");
+
+ABSL_FLAG(uint32_t, glyph_keyed_dictionary_size, 0,
+          "Non-conformant: if non zero, each glyph keyed patch set is "
+          "compressed against a brotli dictionary of up to this many bytes "
+          "trained from the font's glyph data, written to <patch set "
+          "id>_dictionary.gkd. The IFT table and patch headers don't reference "
+          "it so conforming clients can't decode the patches, clients must "
+          "obtain the dictionary out of band. Requires "
+          "--allow_non_conformant.");
+
+ABSL_FLAG(bool, allow_non_conformant, false,
+          "If set, options which produce an encoding that doesn't conform to "
+          "the IFT specification (eg. --glyph_keyed_dictionary_size) are "
+          "allowed.");
+
+ABSL_FLAG(bool, content_addressed_glyph_keyed_patches, false,
+          "If set, glyph keyed patch urls are derived from the patch contents "
+          "so unchanged patches keep their urls across font releases. The ids "
+          "allocated so far are kept in <output_font>.patch_ids in the output "
+          "path, which must be preserved between releases.");
+
+ABSL_FLAG(bool, critical_path_first, false,
+          "If set, the init font, its glyph keyed patches and the table keyed "
+          "patches which apply directly to it are written before the rest of "
+          "the encoding so they can be published early.");
+
+ABSL_FLAG(bool, woff2, false,
+          "If set, the init font is written as a WOFF2 file. Patches apply to "
+          "the font decoded from it.");
+
+ABSL_FLAG(int32_t, woff2_quality, 11,
+          "Brotli quality (0-11) used to compress the init font when --woff2 "
+          "is set.");
+
+ABSL_FLAG(uint32_t, num_writer_threads, 8,
+          "Number of threads used to write patch files in the background. "
+          "Writing many small files in parallel is much faster on network "
+          "filesystems.");
+
+ABSL_FLAG(bool, pack_patches, false,
+          "If set, all patches are written to a single indexed "
+          "<output_font>.patches pack file instead of one file per patch. "
+          "Can't be combined with --incremental.");
+
+ABSL_FLAG(std::string, batch, "",
+          "If set, encodes every font listed in this file instead of "
+          "--input_font. Each line has the form '<input font> <config> "
+          "<output path> [<output font>]', the output font name defaults to "
+          "--output_font. Fonts are encoded concurrently sharing one pool of "
+          "--num_threads threads and the subset cache.");
+
+ABSL_FLAG(bool, serve, false,
+          "If set, runs as a long lived server which reads jobs from stdin, "
+          "one per line in the --batch format, until end of input. Fonts are "
+          "loaded once and reused by later jobs, and the subset cache is kept "
+          "across jobs (a temporary one is used if --subset_cache_dir isn't "
+          "set), so jobs which vary the config of an already seen font skip "
+          "most of the start up cost. When each job finishes 'ok <job>' or "
+          "'error <job>: <message>' is written to stdout, progress is logged "
+          "to stderr.");
+
+ABSL_FLAG(uint64_t, batch_memory_budget_mb, 0,
+          "If set, limits the fonts being encoded concurrently in batch mode "
+          "so their estimated peak memory use (see --dry_run) fits within "
+          "this many megabytes. A font over the budget is encoded on it's "
+          "own.");
+
+ABSL_FLAG(std::string, stats_out, "",
+          "If set, a JSON report of the time spent in each phase of the "
+          "encoding, the sizes of the generated patches, and peak memory use "
+          "is written to this file. In batch mode it covers all fonts.");
+
+ABSL_FLAG(std::string, trace_file, "",
+          "If set, a timeline of the slow steps of the encoding (subsetting, "
+          "instancing, diffing, woff2 round trips) is written to this file in "
+          "the Chrome trace event format, which can be viewed in Perfetto.");
+
+ABSL_FLAG(bool, auto_tune, false,
+          "If set, the graph shape (jump_ahead) and whether glyph keyed "
+          "patches are used are chosen automatically instead of taken from "
+          "the config. Candidate configurations are estimated with dry runs "
+          "plus one small calibration encode per mode, and the one with the "
+          "smallest estimated transfer to reach full coverage which fits "
+          "within --auto_tune_build_budget_s is encoded. The estimates for "
+          "each candidate are reported.");
+
+ABSL_FLAG(double, auto_tune_build_budget_s, 600,
+          "The estimated encoding time, in seconds, that configurations "
+          "chosen by --auto_tune must fit within.");
+
+ABSL_FLAG(double, deadline_s, 0,
+          "If non zero, encoding stops once this many seconds have passed "
+          "since start up. The patches written so far are recorded in the "
+          "manifest, so rerunning with --incremental resumes the encoding. "
+          "In batch and serve mode the deadline is shared by all fonts.");
+
+ABSL_FLAG(double, progress_interval_s, 0,
+          "If non zero, the number of nodes built and patches written so far "
+          "is logged to stderr at most this often while encoding.");
+
+ABSL_FLAG(bool, dry_run, false,
+          "If set, no encoding is performed. Instead the size of the encoding "
+          "that would be produced is estimated and printed.");
+
+using absl::btree_map;
 using absl::btree_set;
 using absl::flat_hash_map;
 using absl::flat_hash_set;
 using absl::Status;
 using absl::StatusOr;
 using absl::StrCat;
+using common::BrotliBinaryDiff;
+using common::DiskCache;
 using common::FontData;
 using common::FontHelper;
-using common::hb_blob_unique_ptr;
 using common::hb_face_unique_ptr;
-using common::make_hb_blob;
+using common::make_hb_face;
+using common::ThreadPool;
+using common::Trace;
+using common::Woff2;
 using ift::encoder::Condition;
 using ift::encoder::design_space_t;
 using ift::encoder::Encoder;
+using ift::encoder::EncoderStats;
+using ift::encoder::FilePatchSink;
+using ift::encoder::PackPatchSink;
+using ift::encoder::PatchSink;
+using ift::encoder::Progress;
 using ift::encoder::GlyphSegmentation;
 using ift::encoder::SubsetDefinition;
 
@@ -67,19 +236,42 @@ using ift::encoder::SubsetDefinition;
 //                     (all glyph ids covered by a patch, all codepoints, etc,
 //                     covered by non glyph segments).
 
-StatusOr<FontData> load_file(const char* path) {
-  hb_blob_unique_ptr blob =
-      make_hb_blob(hb_blob_create_from_file_or_fail(path));
-  if (!blob.get()) {
-    return absl::NotFoundError(StrCat("File ", path, " was not found."));
-  }
-  return FontData(blob.get());
-}
-
 StatusOr<hb_face_unique_ptr> load_font(const char* filename) {
-  return TRY(load_file(filename)).face();
+  return TRY(FontData::FromFile(filename)).face();
 }
 
+// Keeps loaded fonts around so they can be reused by later jobs. A font is
+// reloaded if it's file has been modified since it was loaded.
+class FaceCache {
+ public:
+  StatusOr<hb_face_unique_ptr> Get(const std::string& path) {
+    std::error_code error;
+    auto modified = std::filesystem::last_write_time(path, error);
+    if (error) {
+      return absl::NotFoundError(
+          StrCat("Unable to read ", path, ": ", error.message()));
+    }
+
+    absl::MutexLock lock(&mutex_);
+    auto it = faces_.find(path);
+    if (it == faces_.end() || it->second.modified != modified) {
+      hb_face_unique_ptr face = TRY(load_font(path.c_str()));
+      it = faces_.insert_or_assign(path, Entry{modified, std::move(face)})
+               .first;
+    }
+    return make_hb_face(hb_face_reference(it->second.face.get()));
+  }
+
+ private:
+  struct Entry {
+    std::filesystem::file_time_type modified;
+    hb_face_unique_ptr face;
+  };
+
+  absl::Mutex mutex_;
+  flat_hash_map<std::string, Entry> faces_ ABSL_GUARDED_BY(mutex_);
+};
+
 Status write_file(const std::string& name, const FontData& data) {
   std::ofstream output(name,
                        std::ios::out | std::ios::binary | std::ios::trunc);
@@ -96,34 +288,334 @@ Status write_file(const std::string& name, const FontData& data) {
   return absl::OkStatus();
 }
 
-void write_patch(const std::string& url, const FontData& patch) {
-  std::string output_path = absl::GetFlag(FLAGS_output_path);
-  std::cerr << "  Writing patch: " << StrCat(output_path, "/", url)
-            << std::endl;
-  auto sc = write_file(StrCat(output_path, "/", url), patch);
-  if (!sc.ok()) {
-    std::cerr << sc.message() << std::endl;
-    exit(-1);
+// A single font to encode.
+struct Job {
+  std::string input_font;
+  std::string config;
+  std::string output_path;
+  std::string output_font;
+};
+
+// The manifest records the fingerprint of each output file, one per line in
+// the form "<hex fingerprint> <file name>".
+std::string manifest_path(const Job& job) {
+  return StrCat(job.output_path, "/", job.output_font, ".manifest");
+}
+
+// Loads outputs from a the previous run into the encoder. Returns the set of
+// fingerprints that were loaded.
+StatusOr<flat_hash_set<uint64_t>> load_prior_artifacts(const Job& job,
+                                                       Encoder& encoder) {
+  flat_hash_set<uint64_t> loaded;
+  std::string path = manifest_path(job);
+  auto manifest = FontData::FromFile(path);
+  if (!manifest.ok()) {
+    std::cerr << "No manifest found at " << path << ", running a full encode."
+              << std::endl;
+    return loaded;
+  }
+
+  for (absl::string_view line :
+       absl::StrSplit(manifest->str(), '\n', absl::SkipEmpty())) {
+    std::vector<std::string> parts =
+        absl::StrSplit(line, ' ', absl::SkipEmpty());
+    uint64_t fingerprint;
+    if (parts.size() != 2 || !absl::SimpleHexAtoi(parts[0], &fingerprint)) {
+      return absl::InvalidArgumentError(
+          StrCat("Malformed manifest line: ", line));
+    }
+
+    auto data = FontData::FromFile(StrCat(job.output_path, "/", parts[1]));
+    if (!data.ok()) {
+      // Missing files are regenerated.
+      continue;
+    }
+
+    if (parts[1] == job.output_font) {
+      // The encoder works with the decoded init font. An init font written in
+      // the other output format is regenerated.
+      bool is_woff2 = data->str().substr(0, 4) == "wOF2";
+      if (is_woff2 != absl::GetFlag(FLAGS_woff2)) {
+        continue;
+      }
+      if (is_woff2) {
+        auto decoded = Woff2::DecodeWoff2(data->str());
+        if (!decoded.ok()) {
+          continue;
+        }
+        data = std::move(*decoded);
+      }
+    }
+    encoder.AddPriorArtifact(fingerprint, std::move(*data));
+    loaded.insert(fingerprint);
+  }
+
+  return loaded;
+}
+
+// init_font_fingerprint is unset if the init font wasn't written.
+Status write_manifest(const Job& job,
+                      std::optional<uint64_t> init_font_fingerprint,
+                      const btree_map<std::string, uint64_t>& fingerprints) {
+  std::string manifest;
+  if (init_font_fingerprint.has_value()) {
+    manifest = StrCat(absl::Hex(*init_font_fingerprint), " ", job.output_font,
+                      "\n");
+  }
+  for (const auto& [url, fingerprint] : fingerprints) {
+    absl::StrAppend(&manifest, absl::Hex(fingerprint), " ", url, "\n");
+  }
+
+  FontData data(manifest);
+  return write_file(manifest_path(job), data);
+}
+
+// Glyph keyed patch ids allocated by content addressed encodings are recorded
+// one per line in the form "<hex content hash> <hex content digest> <id>" (see
+// Encoder::GlyphKeyedContentKey).
+std::string patch_ids_path(const Job& job) {
+  return StrCat(job.output_path, "/", job.output_font, ".patch_ids");
+}
+
+Status load_glyph_keyed_patch_ids(const Job& job, Encoder& encoder) {
+  auto patch_ids = FontData::FromFile(patch_ids_path(job));
+  if (!patch_ids.ok()) {
+    // First release, all ids are newly allocated.
+    return absl::OkStatus();
+  }
+
+  for (absl::string_view line :
+       absl::StrSplit(patch_ids->str(), '\n', absl::SkipEmpty())) {
+    std::vector<std::string> parts =
+        absl::StrSplit(line, ' ', absl::SkipEmpty());
+    uint64_t content_hash;
+    uint64_t content_digest;
+    uint32_t id;
+    if (parts.size() != 3 || !absl::SimpleHexAtoi(parts[0], &content_hash) ||
+        !absl::SimpleHexAtoi(parts[1], &content_digest) ||
+        !absl::SimpleAtoi(parts[2], &id)) {
+      return absl::InvalidArgumentError(
+          StrCat("Malformed patch ids line: ", line));
+    }
+    encoder.AddPriorGlyphKeyedPatchId(content_hash, content_digest, id);
+  }
+  return absl::OkStatus();
+}
+
+Status write_glyph_keyed_patch_ids(const Job& job,
+                                   const Encoder::Encoding& encoding) {
+  btree_map<uint32_t, Encoder::GlyphKeyedContentKey> sorted;
+  for (const auto& [content_key, id] : encoding.glyph_keyed_patch_ids) {
+    sorted[id] = content_key;
+  }
+
+  std::string patch_ids;
+  for (const auto& [id, content_key] : sorted) {
+    absl::StrAppend(&patch_ids, absl::Hex(content_key.hash), " ",
+                    absl::Hex(content_key.digest), " ", id, "\n");
   }
+  FontData data(patch_ids);
+  return write_file(patch_ids_path(job), data);
 }
 
-int write_output(const Encoder::Encoding& encoding) {
-  std::string output_path = absl::GetFlag(FLAGS_output_path);
-  std::string output_font = absl::GetFlag(FLAGS_output_font);
+// Returns the init font in the format it should be written out in.
+StatusOr<FontData> package_init_font(const FontData& init_font) {
+  if (!absl::GetFlag(FLAGS_woff2)) {
+    FontData result;
+    result.shallow_copy(init_font);
+    return result;
+  }
+
+  // The init font has already been round tripped through woff2 without the
+  // glyf transform, so encoding it the same way decodes back to the exact font
+  // the patches were generated against.
+  return Woff2::EncodeWoff2(init_font.str(), false,
+                            absl::GetFlag(FLAGS_woff2_quality));
+}
+
+Status write_init_font(const std::string& path, const FontData& init_font) {
+  std::cerr << "  Writing init font: " << path << std::endl;
+  auto packaged = package_init_font(init_font);
+  if (!packaged.ok()) {
+    return absl::Status(packaged.status().code(),
+                        StrCat("Failed to package the init font: ",
+                               packaged.status().message()));
+  }
+  return write_file(path, *packaged);
+}
+
+// Passes patches on to 'sink', skipping any which are unchanged from the
+// previous run. If init_font_path is non empty the init font is written there
+// as soon as it's available. Records every output seen so a partial manifest
+// can be written if the encoding is stopped early.
+class OutputPatchSink : public PatchSink {
+ public:
+  OutputPatchSink(PatchSink& sink, const flat_hash_set<uint64_t>& reused,
+                  std::string init_font_path = "")
+      : sink_(sink),
+        reused_(reused),
+        init_font_path_(std::move(init_font_path)) {}
 
-  std::cerr << "  Writing init font: " << StrCat(output_path, "/", output_font)
+  Status AddInitFont(const FontData& init_font,
+                     uint64_t fingerprint) override {
+    if (reused_.contains(fingerprint)) {
+      init_font_fingerprint_ = fingerprint;
+      return absl::OkStatus();
+    }
+    if (init_font_path_.empty()) {
+      return absl::OkStatus();
+    }
+    TRYV(write_init_font(init_font_path_, init_font));
+    init_font_fingerprint_ = fingerprint;
+    return absl::OkStatus();
+  }
+
+  Status Add(const std::string& url, const FontData& patch,
+             uint64_t fingerprint) override {
+    fingerprints_[url] = fingerprint;
+    if (reused_.contains(fingerprint)) {
+      reused_count_++;
+      return absl::OkStatus();
+    }
+    std::cerr << "  Writing patch: " << url << std::endl;
+    return sink_.Add(url, patch, fingerprint);
+  }
+
+  Status CriticalPathDone() override {
+    TRYV(sink_.CriticalPathDone());
+    std::cerr << "  Critical path written." << std::endl;
+    return absl::OkStatus();
+  }
+
+  Status Flush() override { return sink_.Flush(); }
+
+  uint32_t ReusedCount() const { return reused_count_; }
+
+  // Set once the init font has been written or reused.
+  std::optional<uint64_t> InitFontFingerprint() const {
+    return init_font_fingerprint_;
+  }
+
+  // Url to fingerprint for every patch passed to Add().
+  const btree_map<std::string, uint64_t>& Fingerprints() const {
+    return fingerprints_;
+  }
+
+ private:
+  PatchSink& sink_;
+  const flat_hash_set<uint64_t>& reused_;
+  std::string init_font_path_;
+  uint32_t reused_count_ = 0;
+  std::optional<uint64_t> init_font_fingerprint_;
+  btree_map<std::string, uint64_t> fingerprints_;
+};
+
+// Called when an encoding was stopped early by the deadline. Waits for the
+// patches passed to sink to be written then records them in the manifest, so
+// an --incremental run can pick up where this one left off.
+void write_partial_manifest(const Job& job, OutputPatchSink& sink) {
+  auto sc = sink.Flush();
+  if (sc.ok()) {
+    sc = write_manifest(job, sink.InitFontFingerprint(), sink.Fingerprints());
+  }
+  if (!sc.ok()) {
+    std::cerr << "Failed to write a partial manifest: " << sc.message()
+              << std::endl;
+    return;
+  }
+  std::cerr << "  Recorded " << sink.Fingerprints().size()
+            << " patches in the manifest, rerun with --incremental to resume."
             << std::endl;
-  auto sc =
-      write_file(StrCat(output_path, "/", output_font), encoding.init_font);
+}
+
+// Runs the encoder, writing out each patch as it's produced so that the full
+// set of patches never needs to be held in memory. If writers is non null
+// patch files are written on it.
+int encode_and_write(const Job& job, const Encoder& encoder,
+                     const flat_hash_set<uint64_t>& reused,
+                     ThreadPool* writers) {
+  const std::string& output_path = job.output_path;
+  const std::string& output_font = job.output_font;
+
+  std::unique_ptr<PatchSink> files;
+  if (absl::GetFlag(FLAGS_pack_patches)) {
+    std::string pack_path = StrCat(output_path, "/", output_font, ".patches");
+    std::cerr << "  Writing patch pack: " << pack_path << std::endl;
+    auto pack = PackPatchSink::Create(pack_path);
+    if (!pack.ok()) {
+      std::cerr << pack.status().message() << std::endl;
+      return -1;
+    }
+    files = std::move(*pack);
+  } else {
+    files = std::make_unique<FilePatchSink>(output_path, writers);
+  }
+
+  // The critical path is only useful if the init font is published with it.
+  std::string init_font_path = StrCat(output_path, "/", output_font);
+  bool critical_path_first = absl::GetFlag(FLAGS_critical_path_first);
+  OutputPatchSink sink(*files, reused,
+                       critical_path_first ? init_font_path : "");
+  auto encoding = encoder.Encode(sink);
+  if (!encoding.ok()) {
+    std::cerr << "Encoding failed: " << encoding.status() << std::endl;
+    if (absl::IsCancelled(encoding.status()) ||
+        absl::IsDeadlineExceeded(encoding.status())) {
+      write_partial_manifest(job, sink);
+    }
+    return -1;
+  }
+  if (sink.ReusedCount()) {
+    std::cerr << "  Reused " << sink.ReusedCount() << " unchanged patches."
+              << std::endl;
+  }
+
+  if (!critical_path_first &&
+      !reused.contains(encoding->init_font_fingerprint)) {
+    auto sc = write_init_font(init_font_path, encoding->init_font);
+    if (!sc.ok()) {
+      std::cerr << sc.message() << std::endl;
+      return -1;
+    }
+  }
+
+  auto sc = write_manifest(
+      job, encoding->init_font_fingerprint,
+      btree_map<std::string, uint64_t>(encoding->fingerprints.begin(),
+                                       encoding->fingerprints.end()));
   if (!sc.ok()) {
     std::cerr << sc.message() << std::endl;
     return -1;
   }
 
-  for (const auto& p : encoding.patches) {
-    write_patch(p.first, p.second);
+  if (absl::GetFlag(FLAGS_content_addressed_glyph_keyed_patches)) {
+    sc = write_glyph_keyed_patch_ids(job, *encoding);
+    if (!sc.ok()) {
+      std::cerr << sc.message() << std::endl;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int print_estimate(const Encoder& encoder) {
+  auto estimate = encoder.DryRun();
+  if (!estimate.ok()) {
+    std::cerr << "Dry run failed: " << estimate.status() << std::endl;
+    return -1;
   }
 
+  std::cout << "nodes: " << estimate->num_nodes << std::endl
+            << "table keyed patches: " << estimate->num_table_keyed_patches
+            << std::endl
+            << "glyph keyed patches: " << estimate->num_glyph_keyed_patches
+            << std::endl
+            << "graph depth: " << estimate->depth << std::endl
+            << "max output size: " << estimate->max_output_bytes / 1024
+            << " kb" << std::endl
+            << "max memory usage: " << estimate->max_memory_bytes / 1024
+            << " kb" << std::endl;
   return 0;
 }
 
@@ -155,10 +647,14 @@ StatusOr<design_space_t> to_design_space(const DesignSpace& proto) {
   return result;
 }
 
+// Converts condition to a glyph segmentation condition. Each required feature
+// becomes an additional required segment, which is added to feature_segments
+// (keyed by segment id, allocated from next_segment_id) if needed.
 GlyphSegmentation::ActivationCondition FromProto(
-    const ActivationCondition& condition) {
-  // TODO(garretrieger): once glyph segmentation activation conditions can
-  // support features copy those here.
+    const ActivationCondition& condition,
+    flat_hash_map<hb_tag_t, uint32_t>& feature_segment_ids,
+    flat_hash_map<uint32_t, SubsetDefinition>& feature_segments,
+    uint32_t& next_segment_id) {
   std::vector<btree_set<uint32_t>> groups;
   for (const auto& group : condition.required_codepoint_sets()) {
     btree_set<uint32_t> set;
@@ -166,34 +662,66 @@ GlyphSegmentation::ActivationCondition FromProto(
     groups.push_back(set);
   }
 
+  for (hb_tag_t tag : tag_values(condition.required_features())) {
+    auto [it, inserted] =
+        feature_segment_ids.try_emplace(tag, next_segment_id);
+    if (inserted) {
+      SubsetDefinition& def = feature_segments[next_segment_id++];
+      def.feature_tags.insert(tag);
+    }
+    groups.push_back(btree_set<uint32_t>{it->second});
+  }
+
   return GlyphSegmentation::ActivationCondition::composite_condition(
       groups, condition.activated_patch());
 }
 
+BrotliBinaryDiff::Options to_brotli_options(const BrotliConfig& config,
+                                            int32_t quality_override) {
+  BrotliBinaryDiff::Options options{.quality = 11};
+  if (config.has_quality()) {
+    options.quality = config.quality();
+  }
+  if (quality_override >= 0) {
+    options.quality = quality_override;
+  }
+  options.lgwin = config.lgwin();
+  options.adaptive_threshold = config.adaptive_threshold();
+  if (config.has_small_input_quality()) {
+    options.small_input_quality = config.small_input_quality();
+  }
+  return options;
+}
+
 Status ConfigureEncoder(EncoderConfig config, Encoder& encoder) {
   // First configure the glyph keyed segments, including features deps
   for (const auto& [id, gids] : config.glyph_patches()) {
     TRYV(encoder.AddGlyphDataPatch(id, values(gids)));
   }
 
-  std::vector<GlyphSegmentation::ActivationCondition> activation_conditions;
-  for (const auto& c : config.glyph_patch_conditions()) {
-    if (c.required_features().values_size() > 0) {
-      return absl::UnimplementedError(
-          "Conditions with more features aren't supported yet.");
-    }
-
-    activation_conditions.push_back(FromProto(c));
-  }
-
   flat_hash_map<uint32_t, flat_hash_set<uint32_t>> codepoint_sets;
+  uint32_t next_segment_id = 0;
   for (const auto& [id, set] : config.codepoint_sets()) {
     codepoint_sets[id].insert(set.values().begin(), set.values().end());
+    next_segment_id = std::max(next_segment_id, id + 1);
+  }
+
+  // Required features are mapped to feature only segments, numbered after the
+  // codepoint sets.
+  flat_hash_map<uint32_t, SubsetDefinition> segments;
+  flat_hash_map<hb_tag_t, uint32_t> feature_segment_ids;
+  std::vector<GlyphSegmentation::ActivationCondition> activation_conditions;
+  for (const auto& c : config.glyph_patch_conditions()) {
+    activation_conditions.push_back(
+        FromProto(c, feature_segment_ids, segments, next_segment_id));
+  }
+  for (const auto& [id, set] : codepoint_sets) {
+    segments[id] = SubsetDefinition::Codepoints(set);
   }
 
   auto condition_entries =
       TRY(GlyphSegmentation::ActivationConditionsToConditionEntries(
-          activation_conditions, codepoint_sets));
+          activation_conditions, segments));
   for (const auto& entry : condition_entries) {
     TRYV(encoder.AddGlyphDataPatchCondition(entry));
   }
@@ -252,59 +780,636 @@ Status ConfigureEncoder(EncoderConfig config, Encoder& encoder) {
     encoder.SetJumpAhead(config.jump_ahead());
   }
 
-  // Check for unsupported settings
-  if (config.include_all_segment_patches()) {
-    return absl::UnimplementedError(
-        "include_all_segment_patches is not yet supported.");
-  }
+  encoder.SetMaxDepth(config.max_depth());
+  encoder.SetIncludeAllSegmentPatches(config.include_all_segment_patches());
 
-  if (config.max_depth() > 0) {
-    return absl::UnimplementedError("max_depth is not yet supported.");
-  }
+  // Compression
+  auto table_keyed_options =
+      to_brotli_options(config.table_keyed_compression(),
+                        absl::GetFlag(FLAGS_table_keyed_quality));
+  auto glyph_keyed_options =
+      to_brotli_options(config.glyph_keyed_compression(),
+                        absl::GetFlag(FLAGS_glyph_keyed_quality));
+  TRYV(table_keyed_options.Validate());
+  TRYV(glyph_keyed_options.Validate());
+  encoder.SetTableKeyedBrotliOptions(table_keyed_options);
+  encoder.SetGlyphKeyedBrotliOptions(glyph_keyed_options);
+  encoder.SetShareInvariantTables(absl::GetFlag(FLAGS_share_invariant_tables));
+  encoder.SetGlyphKeyedDictionarySize(
+      absl::GetFlag(FLAGS_glyph_keyed_dictionary_size));
+  encoder.SetAllowNonConformant(absl::GetFlag(FLAGS_allow_non_conformant));
 
   return absl::OkStatus();
 }
 
-int main(int argc, char** argv) {
-  auto args = absl::ParseCommandLine(argc, argv);
+// Limits the total estimated memory use of concurrently running encodes.
+class MemoryBudget {
+ public:
+  // A max_bytes of zero is unlimited.
+  explicit MemoryBudget(uint64_t max_bytes) : max_bytes_(max_bytes) {}
+
+  // Blocks until bytes fits in the remaining budget. If nothing else is
+  // reserved this always succeeds, so encodes over the budget still run.
+  void Acquire(uint64_t bytes) {
+    absl::MutexLock lock(&mutex_);
+    auto fits = [&]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+      return max_bytes_ == 0 || used_ == 0 || used_ + bytes <= max_bytes_;
+    };
+    mutex_.Await(absl::Condition(&fits));
+    used_ += bytes;
+  }
+
+  void Release(uint64_t bytes) {
+    absl::MutexLock lock(&mutex_);
+    used_ -= bytes;
+  }
 
-  auto config_text = load_file(absl::GetFlag(FLAGS_config).c_str());
+ private:
+  const uint64_t max_bytes_;
+  absl::Mutex mutex_;
+  uint64_t used_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+StatusOr<EncoderConfig> load_config(const std::string& path) {
+  auto config_text = FontData::FromFile(path);
   if (!config_text.ok()) {
-    std::cerr << "Failed to load config file: " << config_text.status()
-              << std::endl;
-    return -1;
+    return absl::NotFoundError(StrCat("Failed to load config file ", path,
+                                      ": ", config_text.status().message()));
   }
 
   EncoderConfig config;
   if (!google::protobuf::TextFormat::ParseFromString(config_text->str(),
                                                      &config)) {
-    std::cerr << "Failed to parse input config." << std::endl;
-    return -1;
+    return absl::InvalidArgumentError(
+        StrCat("Failed to parse input config ", path, "."));
   }
+  return config;
+}
 
-  auto font = load_font(absl::GetFlag(FLAGS_input_font).c_str());
+// Returns the subset cache stored in subset_cache_dir, or null if it's empty.
+StatusOr<std::shared_ptr<DiskCache>> open_subset_cache(
+    const std::string& subset_cache_dir) {
+  if (subset_cache_dir.empty()) {
+    return nullptr;
+  }
+  uint64_t max_size = absl::GetFlag(FLAGS_subset_cache_max_mb) * 1024 * 1024;
+  return std::shared_ptr<DiskCache>(
+      TRY(DiskCache::Create(subset_cache_dir, max_size)));
+}
+
+// State shared between all of the encodes run by this process. Everything
+// other than the subset cache is optional.
+struct Resources {
+  std::shared_ptr<DiskCache> subset_cache;
+  // Runs the encoder's tasks.
+  ThreadPool* pool = nullptr;
+  // Each encode waits until it's estimated memory use fits in the budget.
+  MemoryBudget* budget = nullptr;
+  // Records encoder stats.
+  EncoderStats* stats = nullptr;
+  // Writes patch files.
+  ThreadPool* writers = nullptr;
+  // If set input fonts are loaded through it.
+  FaceCache* faces = nullptr;
+  // Where progress messages are written.
+  std::ostream* progress = &std::cout;
+  // Encodes stop once this passes.
+  absl::Time deadline = absl::InfiniteFuture();
+};
+
+// Creates an encoder for font which follows config. If stats is true encoder
+// stats are recorded into resources.stats.
+StatusOr<std::unique_ptr<Encoder>> create_encoder(hb_face_t* font,
+                                                  const EncoderConfig& config,
+                                                  const Resources& resources,
+                                                  bool stats = true) {
+  auto encoder = std::make_unique<Encoder>();
+  encoder->SetFace(font);
+  encoder->SetNumThreads(absl::GetFlag(FLAGS_num_threads));
+  encoder->SetThreadPool(resources.pool);
+  if (stats) {
+    encoder->SetStats(resources.stats);
+  }
+  if (resources.subset_cache) {
+    encoder->SetSubsetCache(resources.subset_cache);
+  }
+  TRYV(ConfigureEncoder(config, *encoder));
+  encoder->SetContentAddressedGlyphKeyedPatches(
+      absl::GetFlag(FLAGS_content_addressed_glyph_keyed_patches));
+  encoder->SetCriticalPathFirst(absl::GetFlag(FLAGS_critical_path_first));
+  return encoder;
+}
+
+// Estimated cost of a configuration considered by --auto_tune.
+struct TuningCandidate {
+  EncoderConfig config;
+  bool mixed_mode = false;
+  Encoder::EncodingEstimate estimate;
+  double build_seconds = 0;
+  // Bytes a client transfers to reach full coverage from the init font,
+  // including a fixed overhead for each round trip.
+  uint64_t transfer_bytes = 0;
+};
+
+// Per request cost assumed when comparing transfer sizes, matches the default
+// used by glyph_keyed_segmenter.
+constexpr uint64_t kRequestOverheadBytes = 75;
+
+// Measurements which the estimates for all candidates of one mode are
+// scaled from.
+struct TuningCalibration {
+  double seconds_per_output = 0;
+  double glyph_keyed_seconds = 0;
+  uint64_t glyph_keyed_bytes = 0;
+  uint64_t init_font_bytes = 0;
+  // Size of a single patch which adds all segments to the init font.
+  uint64_t all_segments_patch_bytes = 0;
+};
+
+// Calibrates by encoding config restricted to a two level graph: the init font
+// plus one patch which adds everything. In mixed mode the glyph keyed patches
+// are timed separately since their cost doesn't depend on the graph shape.
+StatusOr<TuningCalibration> calibrate(hb_face_t* font,
+                                      const EncoderConfig& config,
+                                      bool mixed_mode,
+                                      const Resources& resources) {
+  EncoderConfig two_levels = config;
+  two_levels.set_jump_ahead(1);
+  two_levels.set_max_depth(2);
+  two_levels.set_include_all_segment_patches(false);
+  auto encoder = TRY(create_encoder(font, two_levels, resources, false));
+
+  TuningCalibration calibration;
+  if (mixed_mode) {
+    absl::Time start = absl::Now();
+    auto sizes = TRY(encoder->ComputeGlyphKeyedSizes());
+    calibration.glyph_keyed_seconds =
+        absl::ToDoubleSeconds(absl::Now() - start);
+    for (const auto& [url, size] : sizes.patch_sizes) {
+      calibration.glyph_keyed_bytes += size;
+    }
+  }
+
+  Encoder::EncodingEstimate estimate = TRY(encoder->DryRun());
+  absl::Time start = absl::Now();
+  Encoder::Encoding encoding = TRY(encoder->Encode());
+  double seconds = absl::ToDoubleSeconds(absl::Now() - start) -
+                   calibration.glyph_keyed_seconds;
+  calibration.seconds_per_output =
+      std::max(seconds, 0.0) /
+      (estimate.num_nodes + estimate.num_table_keyed_patches);
+
+  calibration.init_font_bytes = encoding.init_font.size();
+  for (const auto& [url, patch] : encoding.patches) {
+    if (absl::EndsWith(url, ".tk")) {
+      calibration.all_segments_patch_bytes += patch.size();
+    }
+  }
+  return calibration;
+}
+
+uint32_t num_non_glyph_segments(const EncoderConfig& config) {
+  return config.non_glyph_codepoint_segmentation_size() +
+         config.non_glyph_codepoint_set_groups_size() +
+         config.non_glyph_feature_segmentation_size() +
+         config.non_glyph_design_space_segmentation_size();
+}
+
+/*
+ * Picks the configuration to encode for --auto_tune. Candidates vary
+ * jump_ahead from 1 up to max(4, config.jump_ahead()) and, if config uses
+ * glyph keyed patches and has non glyph segments, also drop the glyph keyed
+ * patches so that glyph data is carried by the table keyed patches instead.
+ *
+ * Build time is modelled as a fixed calibrated cost per graph node and table
+ * keyed patch, plus the measured glyph keyed patch time. The bytes transferred
+ * to reach full coverage don't depend much on the graph shape, but the number
+ * of round trips needed does: ceil(segments / jump_ahead), capped by the graph
+ * depth, plus one for glyph keyed patches.
+ */
+StatusOr<EncoderConfig> auto_tune(hb_face_t* font, const EncoderConfig& config,
+                                  const Resources& resources) {
+  uint32_t num_segments = num_non_glyph_segments(config);
+  std::vector<bool> modes;
+  if (!config.glyph_patches().empty()) {
+    modes.push_back(true);
+  }
+  if (config.glyph_patches().empty() || num_segments > 0) {
+    modes.push_back(false);
+  }
+
+  double budget = absl::GetFlag(FLAGS_auto_tune_build_budget_s);
+  uint32_t max_jump_ahead = std::max(4u, config.jump_ahead());
+  std::vector<TuningCandidate> candidates;
+  for (bool mixed_mode : modes) {
+    EncoderConfig mode_config = config;
+    if (!mixed_mode) {
+      mode_config.clear_glyph_patches();
+      mode_config.clear_glyph_patch_conditions();
+    }
+    TuningCalibration calibration =
+        TRY(calibrate(font, mode_config, mixed_mode, resources));
+
+    for (uint32_t jump_ahead = 1; jump_ahead <= max_jump_ahead;
+         jump_ahead++) {
+      TuningCandidate candidate;
+      candidate.config = mode_config;
+      candidate.config.set_jump_ahead(jump_ahead);
+      candidate.mixed_mode = mixed_mode;
+
+      auto encoder =
+          TRY(create_encoder(font, candidate.config, resources, false));
+      candidate.estimate = TRY(encoder->DryRun());
+      candidate.build_seconds =
+          calibration.seconds_per_output *
+              (candidate.estimate.num_nodes +
+               candidate.estimate.num_table_keyed_patches) +
+          calibration.glyph_keyed_seconds;
+
+      uint64_t round_trips = 0;
+      if (num_segments) {
+        round_trips = std::min((num_segments + jump_ahead - 1) / jump_ahead,
+                               std::max(candidate.estimate.depth, 1u) - 1);
+      }
+      if (mixed_mode) {
+        round_trips++;
+      }
+      candidate.transfer_bytes =
+          calibration.all_segments_patch_bytes +
+          calibration.glyph_keyed_bytes + round_trips * kRequestOverheadBytes;
+      candidates.push_back(std::move(candidate));
+
+      // Larger jump aheads only grow the graph.
+      if (candidates.back().build_seconds > budget ||
+          jump_ahead >= std::max(num_segments, 1u)) {
+        break;
+      }
+    }
+  }
+
+  // The candidate within budget with the smallest transfer, or the cheapest to
+  // build if none fit.
+  const TuningCandidate* chosen = nullptr;
+  for (const auto& candidate : candidates) {
+    bool fits = candidate.build_seconds <= budget;
+    if (!chosen) {
+      chosen = &candidate;
+      continue;
+    }
+    bool chosen_fits = chosen->build_seconds <= budget;
+    if (fits != chosen_fits) {
+      if (fits) {
+        chosen = &candidate;
+      }
+      continue;
+    }
+    if (fits ? std::pair(candidate.transfer_bytes, candidate.build_seconds) <
+                   std::pair(chosen->transfer_bytes, chosen->build_seconds)
+             : candidate.build_seconds < chosen->build_seconds) {
+      chosen = &candidate;
+    }
+  }
+
+  std::ostream& out = *resources.progress;
+  out << ">> auto tuning (build budget " << budget << "s):" << std::endl;
+  for (const auto& candidate : candidates) {
+    out << (&candidate == chosen ? "  * " : "    ")
+        << (candidate.mixed_mode ? "mixed" : "table keyed")
+        << ", jump_ahead=" << candidate.config.jump_ahead()
+        << ": nodes=" << candidate.estimate.num_nodes
+        << " table keyed patches=" << candidate.estimate.num_table_keyed_patches
+        << " glyph keyed patches="
+        << candidate.estimate.num_glyph_keyed_patches
+        << " depth=" << candidate.estimate.depth
+        << " est. build=" << candidate.build_seconds << "s"
+        << " est. transfer=" << candidate.transfer_bytes / 1024 << " kb"
+        << std::endl;
+  }
+  if (chosen->build_seconds > budget) {
+    out << "  No configuration fits in the build budget, using the fastest."
+        << std::endl;
+  }
+  return chosen->config;
+}
+
+// Encodes job following config.
+int run_job(const Job& job, const EncoderConfig& job_config,
+            const Resources& resources) {
+  auto font = resources.faces ? resources.faces->Get(job.input_font)
+                             : load_font(job.input_font.c_str());
   if (!font.ok()) {
     std::cerr << "Failed to load input font: " << font.status() << std::endl;
     return -1;
   }
 
-  Encoder encoder;
-  encoder.SetFace(font->get());
+  EncoderConfig config = job_config;
+  if (absl::GetFlag(FLAGS_auto_tune)) {
+    auto tuned = auto_tune(font->get(), config, resources);
+    if (!tuned.ok()) {
+      std::cerr << "Auto tuning failed: " << tuned.status() << std::endl;
+      return -1;
+    }
+    config = std::move(*tuned);
+  }
 
-  auto sc = ConfigureEncoder(config, encoder);
-  if (!sc.ok()) {
-    std::cerr << "Failed to apply configuration to the encoder: " << sc
+  auto created = create_encoder(font->get(), config, resources);
+  if (!created.ok()) {
+    std::cerr << "Failed to apply configuration to the encoder: "
+              << created.status() << std::endl;
+    return -1;
+  }
+  Encoder& encoder = **created;
+
+  if (absl::GetFlag(FLAGS_dry_run)) {
+    return print_estimate(encoder);
+  }
+
+  if (absl::GetFlag(FLAGS_content_addressed_glyph_keyed_patches)) {
+    auto sc = load_glyph_keyed_patch_ids(job, encoder);
+    if (!sc.ok()) {
+      std::cerr << "Failed to load glyph keyed patch ids: " << sc << std::endl;
+      return -1;
+    }
+  }
+
+  flat_hash_set<uint64_t> reused;
+  if (absl::GetFlag(FLAGS_incremental)) {
+    auto loaded = load_prior_artifacts(job, encoder);
+    if (!loaded.ok()) {
+      std::cerr << "Failed to load prior artifacts: " << loaded.status()
+                << std::endl;
+      return -1;
+    }
+    reused = std::move(*loaded);
+  }
+
+  MemoryBudget* budget = resources.budget;
+  uint64_t reserved = 0;
+  if (budget) {
+    auto estimate = encoder.DryRun();
+    if (!estimate.ok()) {
+      std::cerr << "Failed to estimate memory use: " << estimate.status()
+                << std::endl;
+      return -1;
+    }
+    reserved = estimate->max_memory_bytes;
+    budget->Acquire(reserved);
+  }
+
+  absl::Duration interval =
+      absl::Seconds(absl::GetFlag(FLAGS_progress_interval_s));
+  Progress::Callback log_progress;
+  if (interval > absl::ZeroDuration()) {
+    log_progress = [&](Progress& p) {
+      std::cerr << "  Progress for " << job.output_font << ": " << p.ToString()
+                << std::endl;
+    };
+  }
+  Progress progress(std::move(log_progress), interval);
+  progress.SetDeadline(resources.deadline);
+  encoder.SetProgress(&progress);
+
+  *resources.progress << ">> encoding and generating output patches for "
+                      << job.input_font << ":" << std::endl;
+  int result = encode_and_write(job, encoder, reused, resources.writers);
+  encoder.SetProgress(nullptr);
+  if (budget) {
+    budget->Release(reserved);
+  }
+  return result;
+}
+
+// Parses a job of the form '<input font> <config> <output path>
+// [<output font>]'.
+StatusOr<Job> parse_job(absl::string_view line) {
+  std::vector<std::string> parts =
+      absl::StrSplit(line, ' ', absl::SkipEmpty());
+  if (parts.size() != 3 && parts.size() != 4) {
+    return absl::InvalidArgumentError(StrCat("Malformed job: ", line));
+  }
+  return Job{
+      .input_font = parts[0],
+      .config = parts[1],
+      .output_path = parts[2],
+      .output_font =
+          parts.size() == 4 ? parts[3] : absl::GetFlag(FLAGS_output_font),
+  };
+}
+
+StatusOr<std::vector<Job>> load_batch(const std::string& path) {
+  FontData batch = TRY(FontData::FromFile(path));
+  std::vector<Job> jobs;
+  for (absl::string_view line :
+       absl::StrSplit(batch.str(), '\n', absl::SkipWhitespace())) {
+    jobs.push_back(TRY(parse_job(line)));
+  }
+  return jobs;
+}
+
+int run_batch(Resources resources) {
+  auto jobs = load_batch(absl::GetFlag(FLAGS_batch));
+  if (!jobs.ok()) {
+    std::cerr << "Failed to load batch file: " << jobs.status() << std::endl;
+    return -1;
+  }
+
+  // Fonts commonly share configs, so each is only parsed once.
+  flat_hash_map<std::string, EncoderConfig> configs;
+  for (const Job& job : *jobs) {
+    if (configs.contains(job.config)) {
+      continue;
+    }
+    auto config = load_config(job.config);
+    if (!config.ok()) {
+      std::cerr << config.status().message() << std::endl;
+      return -1;
+    }
+    configs[job.config] = std::move(*config);
+  }
+
+  // Encodes run on the job threads and schedule their work on the shared task
+  // pool. Dry runs are sequential to keep their output readable.
+  uint32_t num_threads = absl::GetFlag(FLAGS_num_threads);
+  ThreadPool tasks(num_threads);
+  ThreadPool job_threads(absl::GetFlag(FLAGS_dry_run) ? 1 : num_threads);
+  MemoryBudget budget(absl::GetFlag(FLAGS_batch_memory_budget_mb) * 1024 *
+                      1024);
+  resources.pool = &tasks;
+  resources.budget = &budget;
+  std::vector<int> results(jobs->size());
+  for (uint32_t i = 0; i < jobs->size(); i++) {
+    job_threads.Schedule([&, i]() {
+      const Job& job = (*jobs)[i];
+      results[i] = run_job(job, configs.at(job.config), resources);
+    });
+  }
+  job_threads.Wait();
+
+  int result = 0;
+  for (uint32_t i = 0; i < jobs->size(); i++) {
+    if (results[i]) {
+      std::cerr << "Failed to encode " << (*jobs)[i].input_font << std::endl;
+      result = -1;
+    }
+  }
+  return result;
+}
+
+// Reads jobs from stdin and encodes them concurrently until the end of input.
+// Configs are reloaded for each job since they're cheap to parse and commonly
+// change between jobs.
+int run_server(Resources resources) {
+  uint32_t num_threads = absl::GetFlag(FLAGS_num_threads);
+  ThreadPool tasks(num_threads);
+  ThreadPool job_threads(num_threads);
+  MemoryBudget budget(absl::GetFlag(FLAGS_batch_memory_budget_mb) * 1024 *
+                      1024);
+  FaceCache faces;
+  resources.pool = &tasks;
+  resources.budget = &budget;
+  resources.faces = &faces;
+  resources.progress = &std::cerr;
+
+  absl::Mutex reply_mutex;
+  auto reply = [&](absl::string_view line, const Status& status) {
+    absl::MutexLock lock(&reply_mutex);
+    if (status.ok()) {
+      std::cout << "ok " << line << std::endl;
+    } else {
+      std::cout << "error " << line << ": " << status.message() << std::endl;
+    }
+  };
+
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    if (absl::StripAsciiWhitespace(line).empty()) {
+      continue;
+    }
+
+    job_threads.Schedule([&, line]() {
+      auto job = parse_job(line);
+      if (!job.ok()) {
+        reply(line, job.status());
+        return;
+      }
+      auto config = load_config(job->config);
+      if (!config.ok()) {
+        reply(line, config.status());
+        return;
+      }
+      if (run_job(*job, *config, resources)) {
+        reply(line, absl::InternalError("Encoding failed, see the log."));
+        return;
+      }
+      reply(line, absl::OkStatus());
+    });
+  }
+  job_threads.Wait();
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  auto args = absl::ParseCommandLine(argc, argv);
+
+  int32_t woff2_quality = absl::GetFlag(FLAGS_woff2_quality);
+  if (woff2_quality < 0 || woff2_quality > 11) {
+    std::cerr << "--woff2_quality must be between 0 and 11." << std::endl;
+    return -1;
+  }
+
+  if (absl::GetFlag(FLAGS_pack_patches) && absl::GetFlag(FLAGS_incremental)) {
+    std::cerr << "--pack_patches can't be combined with --incremental."
               << std::endl;
     return -1;
   }
 
-  std::cout << ">> encoding:" << std::endl;
-  auto encoding = encoder.Encode();
-  if (!encoding.ok()) {
-    std::cerr << "Encoding failed: " << encoding.status() << std::endl;
+  double deadline_s = absl::GetFlag(FLAGS_deadline_s);
+  if (deadline_s < 0) {
+    std::cerr << "--deadline_s can't be negative." << std::endl;
+    return -1;
+  }
+  absl::Time deadline = deadline_s > 0 ? absl::Now() + absl::Seconds(deadline_s)
+                                       : absl::InfiniteFuture();
+
+  bool serve = absl::GetFlag(FLAGS_serve);
+  if (serve &&
+      (!absl::GetFlag(FLAGS_batch).empty() || absl::GetFlag(FLAGS_dry_run))) {
+    std::cerr << "--serve can't be combined with --batch or --dry_run."
+              << std::endl;
+    return -1;
+  }
+
+  // A server keeps subsets warm across jobs even without a configured cache.
+  std::string subset_cache_dir = absl::GetFlag(FLAGS_subset_cache_dir);
+  std::string temp_cache_dir;
+  if (serve && subset_cache_dir.empty()) {
+    temp_cache_dir = (std::filesystem::temp_directory_path() /
+                      StrCat("font2ift_subsets_", getpid()))
+                         .string();
+    subset_cache_dir = temp_cache_dir;
+  }
+
+  auto subset_cache = open_subset_cache(subset_cache_dir);
+  if (!subset_cache.ok()) {
+    std::cerr << "Failed to open the subset cache: " << subset_cache.status()
+              << std::endl;
     return -1;
   }
 
-  std::cout << ">> generating output patches:" << std::endl;
-  return write_output(*encoding);
+  std::string stats_out = absl::GetFlag(FLAGS_stats_out);
+  EncoderStats stats;
+  ThreadPool writers(absl::GetFlag(FLAGS_num_writer_threads));
+  Resources resources{
+      .subset_cache = std::move(*subset_cache),
+      .stats = stats_out.empty() ? nullptr : &stats,
+      .writers = &writers,
+      .deadline = deadline,
+  };
+
+  std::string trace_file = absl::GetFlag(FLAGS_trace_file);
+  if (!trace_file.empty()) {
+    Trace::Start();
+  }
+
+  int result;
+  if (serve) {
+    result = run_server(resources);
+    if (!temp_cache_dir.empty()) {
+      resources.subset_cache = nullptr;
+      std::error_code error;
+      std::filesystem::remove_all(temp_cache_dir, error);
+    }
+  } else if (!absl::GetFlag(FLAGS_batch).empty()) {
+    result = run_batch(resources);
+  } else {
+    auto config = load_config(absl::GetFlag(FLAGS_config));
+    if (!config.ok()) {
+      std::cerr << config.status().message() << std::endl;
+      return -1;
+    }
+
+    Job job{
+        .input_font = absl::GetFlag(FLAGS_input_font),
+        .config = absl::GetFlag(FLAGS_config),
+        .output_path = absl::GetFlag(FLAGS_output_path),
+        .output_font = absl::GetFlag(FLAGS_output_font),
+    };
+    result = run_job(job, *config, resources);
+  }
+
+  if (resources.stats) {
+    auto sc = write_file(stats_out, FontData(stats.ToJson()));
+    if (!sc.ok()) {
+      std::cerr << "Failed to write stats: " << sc.message() << std::endl;
+      return -1;
+    }
+  }
+  if (!trace_file.empty()) {
+    auto sc = write_file(trace_file, FontData(Trace::Stop()));
+    if (!sc.ok()) {
+      std::cerr << "Failed to write trace: " << sc.message() << std::endl;
+      return -1;
+    }
+  }
+  return result;
 }
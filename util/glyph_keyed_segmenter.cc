@@ -15,14 +15,22 @@
 #include "absl/log/globals.h"
 #include "absl/log/initialize.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "common/cmap_index.h"
 #include "common/font_data.h"
 #include "common/hb_set_unique_ptr.h"
+#include "common/thread_pool.h"
+#include "common/trace.h"
 #include "common/try.h"
 #include "hb.h"
 #include "ift/encoder/condition.h"
 #include "ift/encoder/encoder.h"
 #include "ift/encoder/glyph_segmentation.h"
+#include "ift/encoder/progress.h"
 #include "ift/encoder/subset_definition.h"
 #include "ift/url_template.h"
 
@@ -40,6 +48,14 @@
 ABSL_FLAG(std::string, input_font, "in.ttf",
           "Name of the font to convert to IFT.");
 
+ABSL_FLAG(std::string, family_fonts, "",
+          "Optional comma separated list of other fonts in the same family as "
+          "--input_font (for example the other static weights). When set the "
+          "segments found for --input_font are applied to each of these too, "
+          "so all members share one segment structure, and a report is "
+          "printed for each. Members with the same glyph closures as "
+          "--input_font reuse its segmentation.");
+
 ABSL_FLAG(
     std::string, codepoints_file, "",
     "Path to a file which defines the desired codepoint based segmentation.");
@@ -47,6 +63,12 @@ ABSL_FLAG(
 ABSL_FLAG(uint32_t, number_of_segments, 2,
           "Number of segments to split the input codepoints into.");
 
+ABSL_FLAG(std::string, number_of_segments_sweep, "",
+          "Optional comma separated list of segment counts to compare, for "
+          "example: '10,20,40'. When set each count is segmented and evaluated "
+          "in parallel on --num_threads threads and a summary of the cost of "
+          "each is printed in place of the full report.");
+
 ABSL_FLAG(uint32_t, min_patch_size_bytes, 0,
           "The segmenter will try to increase patch sizes to at least this "
           "amount via merging if needed.");
@@ -55,6 +77,61 @@ ABSL_FLAG(uint32_t, max_patch_size_bytes, UINT32_MAX,
           "The segmenter will avoid merges which result in patches larger than "
           "this amount.");
 
+ABSL_FLAG(uint32_t, num_threads, 1,
+          "Number of threads to use when analyzing segments.");
+
+ABSL_FLAG(std::string, checkpoint_file, "",
+          "If set, the segmenter state is periodically saved to this file so "
+          "the run can be resumed with --resume_from.");
+
+ABSL_FLAG(uint32_t, checkpoint_interval, 10,
+          "Number of segment merges between checkpoints.");
+
+ABSL_FLAG(std::string, resume_from, "",
+          "Resume segmentation from a checkpoint written by a previous run "
+          "with the same input font and flags.");
+
+ABSL_FLAG(std::string, closure_mode, "harfbuzz",
+          "How glyph closures are computed: 'harfbuzz' (exact), 'graph' (a "
+          "much faster precomputed glyph dependency graph which may "
+          "over-approximate) or 'graph_validated' (harfbuzz, warning whenever "
+          "the graph differs).");
+
+ABSL_FLAG(std::string, closure_cache_file, "",
+          "If set, glyph closures computed by a previous run on the same font "
+          "are loaded from this file, and it's updated with all closures once "
+          "segmentation completes.");
+
+ABSL_FLAG(double, deadline_s, 0,
+          "If non zero, segmentation stops once this many seconds have "
+          "passed. When --checkpoint_file is set a checkpoint of the merging "
+          "done so far is written first, which can be resumed with "
+          "--resume_from.");
+
+ABSL_FLAG(std::string, feature_segments, "",
+          "Optional layout features to segment separately. Segments are "
+          "separated by ';' and the feature tags within a segment by ','. For "
+          "example: 'vert,vrt2;ss01'.");
+
+ABSL_FLAG(std::string, codepoint_frequencies_file, "",
+          "Optional path to a file of codepoint usage probabilities. Each line "
+          "is a hex codepoint followed by the probability (0 to 1) that a page "
+          "view uses it, for example: '0x41 0.92'. When set merges are chosen "
+          "to minimize the expected bytes transferred per page view.");
+
+ABSL_FLAG(uint32_t, request_overhead_bytes, 75,
+          "Per request cost in bytes assumed when weighing merges by codepoint "
+          "frequency.");
+
+ABSL_FLAG(std::string, stats_json_file, "",
+          "If set, performance statistics for the segmentation run are written "
+          "to this file as JSON.");
+
+ABSL_FLAG(std::string, trace_file, "",
+          "If set, a timeline of the slow steps of the segmentation (glyph "
+          "closures, merges) is written to this file in the Chrome trace "
+          "event format, which can be viewed in Perfetto.");
+
 using absl::btree_map;
 using absl::btree_set;
 using absl::flat_hash_map;
@@ -62,28 +139,22 @@ using absl::flat_hash_set;
 using absl::Status;
 using absl::StatusOr;
 using absl::StrCat;
+using common::CmapIndex;
 using common::FontData;
-using common::FontHelper;
-using common::hb_blob_unique_ptr;
 using common::hb_face_unique_ptr;
 using common::hb_set_unique_ptr;
-using common::make_hb_blob;
 using common::make_hb_set;
+using common::ThreadPool;
+using common::Trace;
 using ift::URLTemplate;
+using ift::encoder::ClosureMode;
 using ift::encoder::Condition;
 using ift::encoder::Encoder;
 using ift::encoder::GlyphSegmentation;
+using ift::encoder::Progress;
+using ift::encoder::SegmentationOptions;
 using ift::encoder::SubsetDefinition;
 
-StatusOr<FontData> LoadFile(const char* path) {
-  hb_blob_unique_ptr blob =
-      make_hb_blob(hb_blob_create_from_file_or_fail(path));
-  if (!blob.get()) {
-    return absl::NotFoundError(StrCat("File ", path, " was not found."));
-  }
-  return FontData(blob.get());
-}
-
 StatusOr<std::vector<uint32_t>> LoadCodepoints(const char* path) {
   std::vector<uint32_t> out;
   std::ifstream in(path);
@@ -127,6 +198,47 @@ StatusOr<std::vector<uint32_t>> LoadCodepoints(const char* path) {
   return out;
 }
 
+StatusOr<flat_hash_map<uint32_t, double>> LoadCodepointFrequencies(
+    const char* path) {
+  flat_hash_map<uint32_t, double> out;
+  std::ifstream in(path);
+
+  if (!in.is_open()) {
+    return absl::NotFoundError(
+        StrCat("Codepoint frequencies file ", path, " was not found."));
+  }
+
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream iss(line);
+    std::string hex_code;
+    double probability;
+
+    if (!(iss >> hex_code) || hex_code.substr(0, 1) == "#") {
+      // blank or comment line, skip
+      continue;
+    }
+    if (hex_code.substr(0, 2) != "0x" || !(iss >> probability)) {
+      return absl::InvalidArgumentError(
+          StrCat("Invalid codepoint frequency line: '", line, "'"));
+    }
+    if (probability < 0.0 || probability > 1.0) {
+      return absl::InvalidArgumentError(
+          StrCat("Probability out of range on line: '", line, "'"));
+    }
+
+    try {
+      out[std::stoul(hex_code.substr(2), nullptr, 16)] = probability;
+    } catch (const std::exception& e) {
+      return absl::InvalidArgumentError(StrCat(
+          "Error converting hex code '", hex_code, "' to integer: ", e.what()));
+    }
+  }
+
+  in.close();
+  return out;
+}
+
 StatusOr<std::vector<uint32_t>> TargetCodepoints(
     hb_face_t* font, const std::string& codepoints_file) {
   hb_set_unique_ptr font_unicodes = make_hb_set();
@@ -151,29 +263,25 @@ StatusOr<std::vector<uint32_t>> TargetCodepoints(
 }
 
 StatusOr<hb_face_unique_ptr> LoadFont(const char* filename) {
-  return TRY(LoadFile(filename)).face();
+  return TRY(FontData::FromFile(filename)).face();
 }
 
 constexpr uint32_t NETWORK_REQUEST_BYTE_OVERHEAD = 75;
 
 StatusOr<int> EncodingSize(const GlyphSegmentation* segmentation,
-                           const Encoder::Encoding& encoding) {
+                           const Encoder::GlyphKeyedSizes& sizes,
+                           bool verbose) {
   // There are three parts to the cost of a segmentation:
   // - Size of the glyph keyed mapping table.
   // - Total size of all glyph keyed patches
   // - Network overhead (fixed cost per patch).
-  auto init_font = encoding.init_font.face();
-
-  btree_map<std::string, uint32_t> url_to_size;
+  const btree_map<std::string, uint32_t>& url_to_size = sizes.patch_sizes;
   uint32_t total_size = 0;
   uint32_t base_size = 0;
   uint32_t conditional_size = 0;
   uint32_t fallback_size = 0;
-  for (const auto& [url, data] : encoding.patches) {
-    if (url.substr(url.size() - 2) == "gk") {
-      total_size += data.size() + NETWORK_REQUEST_BYTE_OVERHEAD;
-      url_to_size[url] = data.size();
-    }
+  for (const auto& [url, size] : url_to_size) {
+    total_size += size + NETWORK_REQUEST_BYTE_OVERHEAD;
   }
 
   if (segmentation != nullptr) {
@@ -207,21 +315,24 @@ StatusOr<int> EncodingSize(const GlyphSegmentation* segmentation,
         fallback_size += url_size->second;
       }
 
-      printf("  patch %s (p%u%s) adds %u bytes, %u bytes overhead\n",
-             url.c_str(), id, id_postfix, url_size->second,
-             NETWORK_REQUEST_BYTE_OVERHEAD);
+      if (verbose) {
+        printf("  patch %s (p%u%s) adds %u bytes, %u bytes overhead\n",
+               url.c_str(), id, id_postfix, url_size->second,
+               NETWORK_REQUEST_BYTE_OVERHEAD);
+      }
     }
-  } else {
+  } else if (verbose) {
     for (const auto& [url, size] : url_to_size) {
       printf("  patch %s adds %u bytes, %u bytes overhead\n", url.c_str(), size,
              NETWORK_REQUEST_BYTE_OVERHEAD);
     }
   }
 
-  auto iftx =
-      FontHelper::TableData(init_font.get(), HB_TAG('I', 'F', 'T', 'X'));
-  total_size += iftx.size();
-  printf("  mapping table: %u bytes\n", iftx.size());
+  total_size += sizes.mapping_table_size;
+  if (!verbose) {
+    return total_size;
+  }
+  printf("  mapping table: %u bytes\n", sizes.mapping_table_size);
 
   if (segmentation != nullptr) {
     double base_percent = ((double)base_size / (double)total_size) * 100.0;
@@ -245,8 +356,11 @@ StatusOr<int> EncodingSize(const GlyphSegmentation* segmentation,
 // number of input segments. This should minimize overhead.
 StatusOr<int> IdealSegmentationSize(hb_face_t* font,
                                     const GlyphSegmentation& segmentation,
-                                    uint32_t number_input_segments) {
-  printf("IdealSegmentationSize():\n");
+                                    uint32_t number_input_segments,
+                                    bool verbose) {
+  if (verbose) {
+    printf("IdealSegmentationSize():\n");
+  }
   btree_set<uint32_t> glyphs;
   for (const auto& [id, glyph_set] : segmentation.GidSegments()) {
     glyphs.insert(glyph_set.begin(), glyph_set.end());
@@ -254,6 +368,7 @@ StatusOr<int> IdealSegmentationSize(hb_face_t* font,
 
   uint32_t glyphs_per_patch = glyphs.size() / number_input_segments;
   uint32_t remainder_glyphs = glyphs.size() % number_input_segments;
+  CmapIndex cmap(font);
 
   Encoder encoder;
   encoder.SetFace(font);
@@ -273,7 +388,7 @@ StatusOr<int> IdealSegmentationSize(hb_face_t* font,
 
     btree_set<uint32_t> gids;
     gids.insert(begin, glyphs_it);
-    auto unicodes = FontHelper::GidsToUnicodes(font, gids);
+    auto unicodes = cmap.CodepointsFor(gids);
 
     TRYV(encoder.AddGlyphDataPatch(i, gids));
     all_unicodes.insert(unicodes.begin(), unicodes.end());
@@ -284,8 +399,8 @@ StatusOr<int> IdealSegmentationSize(hb_face_t* font,
 
   encoder.AddNonGlyphDataSegment(all_unicodes);
 
-  auto encoding = TRY(encoder.Encode());
-  return EncodingSize(nullptr, encoding);
+  auto sizes = TRY(encoder.ComputeGlyphKeyedSizes());
+  return EncodingSize(nullptr, sizes, verbose);
 }
 
 uint32_t NumExclusivePatches(const GlyphSegmentation& segmentation) {
@@ -299,8 +414,11 @@ uint32_t NumExclusivePatches(const GlyphSegmentation& segmentation) {
 }
 
 StatusOr<int> SegmentationSize(hb_face_t* font,
-                               const GlyphSegmentation& segmentation) {
-  printf("SegmentationSize():\n");
+                               const GlyphSegmentation& segmentation,
+                               bool verbose) {
+  if (verbose) {
+    printf("SegmentationSize():\n");
+  }
   Encoder encoder;
   encoder.SetFace(font);
 
@@ -320,26 +438,65 @@ StatusOr<int> SegmentationSize(hb_face_t* font,
     all_codepoints.insert(s.begin(), s.end());
   }
   encoder.AddNonGlyphDataSegment(all_codepoints);
+  for (const auto& features : segmentation.FeatureSegments()) {
+    if (!features.empty()) {
+      encoder.AddFeatureGroupSegment(features);
+    }
+  }
 
   std::vector<GlyphSegmentation::ActivationCondition> conditions;
   for (const auto& c : segmentation.Conditions()) {
     conditions.push_back(c);
   }
 
-  flat_hash_map<uint32_t, flat_hash_set<uint32_t>> segments;
-  uint32_t i = 0;
-  for (const auto& s : segmentation.Segments()) {
-    segments[i++].insert(s.begin(), s.end());
-  }
-
   auto entries = TRY(GlyphSegmentation::ActivationConditionsToConditionEntries(
-      conditions, segments));
+      conditions, segmentation.SegmentDefinitions()));
   for (const auto& e : entries) {
     TRYV(encoder.AddGlyphDataPatchCondition(e));
   }
 
-  auto encoding = TRY(encoder.Encode());
-  return EncodingSize(&segmentation, encoding);
+  auto sizes = TRY(encoder.ComputeGlyphKeyedSizes());
+  return EncodingSize(&segmentation, sizes, verbose);
+}
+
+struct Evaluation {
+  uint32_t glyphs_in_fallback = 0;
+  int ideal_cost = 0;
+  int cost = 0;
+
+  double OverIdealPercent() const {
+    return (((double)cost) / ((double)ideal_cost) * 100.0) - 100.0;
+  }
+};
+
+StatusOr<Evaluation> Evaluate(hb_face_t* font,
+                              const GlyphSegmentation& segmentation,
+                              bool verbose) {
+  Evaluation result;
+  result.glyphs_in_fallback = segmentation.UnmappedGlyphs().size();
+  result.cost = TRY(SegmentationSize(font, segmentation, verbose));
+  result.ideal_cost = TRY(IdealSegmentationSize(
+      font, segmentation, NumExclusivePatches(segmentation), verbose));
+  return result;
+}
+
+StatusOr<std::vector<btree_set<hb_tag_t>>> ParseFeatureSegments(
+    const std::string& spec) {
+  std::vector<btree_set<hb_tag_t>> out;
+  for (absl::string_view segment :
+       absl::StrSplit(spec, ';', absl::SkipEmpty())) {
+    btree_set<hb_tag_t> tags;
+    for (absl::string_view tag :
+         absl::StrSplit(segment, ',', absl::SkipEmpty())) {
+      if (tag.size() != 4) {
+        return absl::InvalidArgumentError(
+            StrCat("Invalid feature tag '", tag, "'."));
+      }
+      tags.insert(HB_TAG(tag[0], tag[1], tag[2], tag[3]));
+    }
+    out.push_back(std::move(tags));
+  }
+  return out;
 }
 
 std::vector<flat_hash_set<uint32_t>> GroupCodepoints(
@@ -366,6 +523,104 @@ std::vector<flat_hash_set<uint32_t>> GroupCodepoints(
   return out;
 }
 
+StatusOr<std::vector<uint32_t>> ParseSegmentCounts(const std::string& spec) {
+  std::vector<uint32_t> out;
+  for (absl::string_view count : absl::StrSplit(spec, ',', absl::SkipEmpty())) {
+    uint32_t value;
+    if (!absl::SimpleAtoi(count, &value) || value == 0) {
+      return absl::InvalidArgumentError(
+          StrCat("Invalid number of segments '", count, "'."));
+    }
+    out.push_back(value);
+  }
+  return out;
+}
+
+// Segments and evaluates each of the segment counts on pool, then prints a
+// summary line per count. The segment analysis of each candidate shares the
+// same pool, so the total number of threads stays at --num_threads.
+int RunSweep(hb_face_t* font, const std::vector<uint32_t>& codepoints,
+             const std::vector<uint32_t>& segment_counts,
+             const std::vector<btree_set<hb_tag_t>>& feature_segments,
+             const ift::encoder::SegmentationCostConfig& cost_config) {
+  std::vector<StatusOr<Evaluation>> results(segment_counts.size());
+  ThreadPool pool(absl::GetFlag(FLAGS_num_threads));
+  SegmentationOptions options;
+  options.pool = &pool;
+  options.feature_segments = feature_segments;
+  options.cost = cost_config;
+  for (uint32_t i = 0; i < segment_counts.size(); i++) {
+    pool.Schedule([&, i]() {
+      auto segmentation = GlyphSegmentation::CodepointToGlyphSegments(
+          font, {}, GroupCodepoints(codepoints, segment_counts[i]),
+          absl::GetFlag(FLAGS_min_patch_size_bytes),
+          absl::GetFlag(FLAGS_max_patch_size_bytes), options);
+      if (!segmentation.ok()) {
+        results[i] = segmentation.status();
+        return;
+      }
+      results[i] = Evaluate(font, *segmentation, false);
+    });
+  }
+  pool.Wait();
+
+  std::cout << ">> Segment count sweep" << std::endl;
+  std::cout << "number_of_segments, glyphs_in_fallback, ideal_cost_bytes, "
+               "total_cost_bytes, %_extra_over_ideal"
+            << std::endl;
+  for (uint32_t i = 0; i < segment_counts.size(); i++) {
+    if (!results[i].ok()) {
+      std::cerr << "Failed to evaluate " << segment_counts[i]
+                << " segments: " << results[i].status() << std::endl;
+      return -1;
+    }
+    std::cout << segment_counts[i] << ", " << results[i]->glyphs_in_fallback
+              << ", " << results[i]->ideal_cost << ", " << results[i]->cost
+              << ", " << results[i]->OverIdealPercent() << std::endl;
+  }
+  return 0;
+}
+
+// Stops tracing, if it was started, and writes the trace to --trace_file.
+bool WriteTrace() {
+  std::string trace_file = absl::GetFlag(FLAGS_trace_file);
+  if (trace_file.empty()) {
+    return true;
+  }
+  std::ofstream trace_out(trace_file, std::ios::out | std::ios::trunc);
+  if (!trace_out.is_open()) {
+    std::cerr << "Unable to open trace file " << trace_file << std::endl;
+    return false;
+  }
+  trace_out << Trace::Stop();
+  return true;
+}
+
+// Prints segmentation and an analysis of its cost for face. Returns false on
+// failure.
+bool Report(hb_face_t* face, const GlyphSegmentation& segmentation) {
+  std::cout << ">> Computed Segmentation" << std::endl;
+  std::cout << segmentation.ToString() << std::endl;
+
+  std::cout << ">> Analysis" << std::endl;
+  auto evaluation = Evaluate(face, segmentation, true);
+  if (!evaluation.ok()) {
+    std::cerr << "Failed to compute segmentation cost: "
+              << evaluation.status() << std::endl;
+    return false;
+  }
+
+  std::cout << std::endl;
+  std::cout << "glyphs_in_fallback = " << evaluation->glyphs_in_fallback
+            << std::endl;
+  std::cout << "ideal_cost_bytes = " << evaluation->ideal_cost << std::endl;
+  std::cout << "total_cost_bytes = " << evaluation->cost << std::endl;
+  std::cout << "%_extra_over_ideal = " << evaluation->OverIdealPercent()
+            << std::endl;
+
+  return true;
+}
+
 int main(int argc, char** argv) {
   absl::SetStderrThreshold(absl::LogSeverityAtLeast::kInfo);
   auto args = absl::ParseCommandLine(argc, argv);
@@ -385,44 +640,172 @@ int main(int argc, char** argv) {
     return -1;
   }
 
-  auto groups =
-      GroupCodepoints(*codepoints, absl::GetFlag(FLAGS_number_of_segments));
+  auto feature_segments =
+      ParseFeatureSegments(absl::GetFlag(FLAGS_feature_segments));
+  if (!feature_segments.ok()) {
+    std::cerr << "Failed to parse --feature_segments: "
+              << feature_segments.status() << std::endl;
+    return -1;
+  }
 
-  auto result = ift::encoder::GlyphSegmentation::CodepointToGlyphSegments(
-      font->get(), {}, groups, absl::GetFlag(FLAGS_min_patch_size_bytes),
-      absl::GetFlag(FLAGS_max_patch_size_bytes));
-  if (!result.ok()) {
-    std::cerr << result.status() << std::endl;
+  auto segment_counts =
+      ParseSegmentCounts(absl::GetFlag(FLAGS_number_of_segments_sweep));
+  if (!segment_counts.ok()) {
+    std::cerr << "Failed to parse --number_of_segments_sweep: "
+              << segment_counts.status() << std::endl;
     return -1;
   }
 
-  std::cout << ">> Computed Segmentation" << std::endl;
-  std::cout << result->ToString() << std::endl;
+  ift::encoder::SegmentationCheckpointConfig checkpoint;
+  checkpoint.checkpoint_path = absl::GetFlag(FLAGS_checkpoint_file);
+  checkpoint.interval = absl::GetFlag(FLAGS_checkpoint_interval);
+  checkpoint.resume_from = absl::GetFlag(FLAGS_resume_from);
+  checkpoint.closure_cache_path = absl::GetFlag(FLAGS_closure_cache_file);
+
+  ClosureMode closure_mode;
+  std::string closure_mode_flag = absl::GetFlag(FLAGS_closure_mode);
+  if (closure_mode_flag == "harfbuzz") {
+    closure_mode = ClosureMode::kHarfbuzz;
+  } else if (closure_mode_flag == "graph") {
+    closure_mode = ClosureMode::kGraph;
+  } else if (closure_mode_flag == "graph_validated") {
+    closure_mode = ClosureMode::kGraphValidated;
+  } else {
+    std::cerr << "Unknown --closure_mode: " << closure_mode_flag << std::endl;
+    return -1;
+  }
 
-  std::cout << ">> Analysis" << std::endl;
-  auto cost = SegmentationSize(font->get(), *result);
-  if (!cost.ok()) {
-    std::cerr << "Failed to compute segmentation cost: " << cost.status()
+  ift::encoder::SegmentationCostConfig cost_config;
+  cost_config.request_overhead_bytes =
+      absl::GetFlag(FLAGS_request_overhead_bytes);
+  std::string frequencies_file =
+      absl::GetFlag(FLAGS_codepoint_frequencies_file);
+  if (!frequencies_file.empty()) {
+    auto frequencies = LoadCodepointFrequencies(frequencies_file.c_str());
+    if (!frequencies.ok()) {
+      std::cerr << "Failed to load codepoint frequencies file: "
+                << frequencies.status() << std::endl;
+      return -1;
+    }
+    cost_config.codepoint_probabilities = std::move(*frequencies);
+  }
+
+  if (!segment_counts->empty()) {
+    if (!checkpoint.checkpoint_path.empty() ||
+        !checkpoint.resume_from.empty() ||
+        !checkpoint.closure_cache_path.empty() ||
+        !absl::GetFlag(FLAGS_stats_json_file).empty()) {
+      std::cerr << "--number_of_segments_sweep can't be combined with "
+                   "checkpointing, --closure_cache_file or --stats_json_file."
+                << std::endl;
+      return -1;
+    }
+    if (!absl::GetFlag(FLAGS_trace_file).empty()) {
+      Trace::Start();
+    }
+    int result = RunSweep(font->get(), *codepoints, *segment_counts,
+                          *feature_segments, cost_config);
+    return WriteTrace() ? result : -1;
+  }
+
+  if (!absl::GetFlag(FLAGS_trace_file).empty()) {
+    Trace::Start();
+  }
+
+  std::vector<std::string> family_paths = absl::StrSplit(
+      absl::GetFlag(FLAGS_family_fonts), ',', absl::SkipEmpty());
+  std::vector<hb_face_unique_ptr> family_faces;
+  for (const auto& path : family_paths) {
+    auto face = LoadFont(path.c_str());
+    if (!face.ok()) {
+      std::cerr << "Failed to load family font " << path << ": "
+                << face.status() << std::endl;
+      return -1;
+    }
+    family_faces.push_back(std::move(*face));
+  }
+  if (!family_faces.empty() && (!checkpoint.checkpoint_path.empty() ||
+                                !checkpoint.resume_from.empty() ||
+                                !checkpoint.closure_cache_path.empty())) {
+    std::cerr << "--family_fonts can't be combined with checkpointing or "
+                 "--closure_cache_file."
               << std::endl;
     return -1;
   }
-  auto ideal_cost =
-      IdealSegmentationSize(font->get(), *result, NumExclusivePatches(*result));
-  if (!ideal_cost.ok()) {
-    std::cerr << "Failed to compute segmentation cost: " << cost.status()
-              << std::endl;
+
+  Progress progress;
+  double deadline_s = absl::GetFlag(FLAGS_deadline_s);
+  if (deadline_s > 0) {
+    progress.SetDeadline(absl::Now() + absl::Seconds(deadline_s));
+  }
+
+  auto groups =
+      GroupCodepoints(*codepoints, absl::GetFlag(FLAGS_number_of_segments));
+  SegmentationOptions options;
+  options.num_threads = absl::GetFlag(FLAGS_num_threads);
+  options.checkpoint = checkpoint;
+  options.feature_segments = *feature_segments;
+  options.cost = cost_config;
+  options.closure_mode = closure_mode;
+  options.progress = &progress;
+  StatusOr<GlyphSegmentation> result = absl::InternalError("not run");
+  StatusOr<std::vector<GlyphSegmentation>> family_results;
+  if (family_faces.empty()) {
+    result = ift::encoder::GlyphSegmentation::CodepointToGlyphSegments(
+        font->get(), {}, groups, absl::GetFlag(FLAGS_min_patch_size_bytes),
+        absl::GetFlag(FLAGS_max_patch_size_bytes), options);
+  } else {
+    std::vector<hb_face_t*> faces = {font->get()};
+    for (const auto& face : family_faces) {
+      faces.push_back(face.get());
+    }
+    family_results =
+        ift::encoder::GlyphSegmentation::CodepointToGlyphSegmentsForFamily(
+            faces, {}, groups, absl::GetFlag(FLAGS_min_patch_size_bytes),
+            absl::GetFlag(FLAGS_max_patch_size_bytes), options);
+    if (family_results.ok()) {
+      result = (*family_results)[0];
+    } else {
+      result = family_results.status();
+    }
+  }
+  if (!WriteTrace()) {
+    return -1;
+  }
+  if (!result.ok()) {
+    std::cerr << result.status() << std::endl;
+    if (absl::IsDeadlineExceeded(result.status()) &&
+        !checkpoint.checkpoint_path.empty()) {
+      std::cerr << "If the initial analysis completed a checkpoint was "
+                   "written to "
+                << checkpoint.checkpoint_path << ", resume with --resume_from."
+                << std::endl;
+    }
     return -1;
   }
 
-  std::cout << std::endl;
-  std::cout << "glyphs_in_fallback = " << result->UnmappedGlyphs().size()
-            << std::endl;
-  std::cout << "ideal_cost_bytes = " << *ideal_cost << std::endl;
-  std::cout << "total_cost_bytes = " << *cost << std::endl;
+  std::string stats_json_file = absl::GetFlag(FLAGS_stats_json_file);
+  if (!stats_json_file.empty()) {
+    std::ofstream stats_out(stats_json_file, std::ios::out | std::ios::trunc);
+    if (!stats_out.is_open()) {
+      std::cerr << "Unable to open stats file " << stats_json_file
+                << std::endl;
+      return -1;
+    }
+    stats_out << result->Stats().ToJson();
+  }
 
-  double over_ideal_percent =
-      (((double)*cost) / ((double)*ideal_cost) * 100.0) - 100.0;
-  std::cout << "%_extra_over_ideal = " << over_ideal_percent << std::endl;
+  if (!Report(font->get(), *result)) {
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < family_faces.size(); i++) {
+    std::cout << std::endl
+              << ">> Family member " << family_paths[i] << std::endl;
+    if (!Report(family_faces[i].get(), (*family_results)[i + 1])) {
+      return -1;
+    }
+  }
 
   return 0;
 }
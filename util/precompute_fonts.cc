@@ -0,0 +1,237 @@
+#include <google/protobuf/text_format.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "absl/container/btree_map.h"
+#include "absl/container/btree_set.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "common/axis_range.h"
+#include "common/font_data.h"
+#include "common/font_helper.h"
+#include "common/try.h"
+#include "common/woff2.h"
+#include "hb.h"
+#include "ift/client/in_process_client.h"
+#include "ift/encoder/encoder.h"
+#include "ift/encoder/subset_definition.h"
+#include "ift/patch_pack.h"
+#include "util/precompute_targets.pb.h"
+
+/*
+ * Utility that precomputes fully extended fonts for a list of common target
+ * subset definitions, so that a server can answer those requests with a
+ * single lookup instead of applying patches per request.
+ *
+ * The input is an encoding written by font2ift, located via its manifest (and
+ * patch pack if it was written with --pack_patches). For each target the init
+ * font is extended following the IFT client algorithm. Targets which end up
+ * applying the same set of patches share one output font.
+ *
+ * Alongside the fonts an index file is written. It has one line per font in
+ * the form "<font file> <patch url> <patch url> ...", with the urls sorted.
+ * The key of a font is the set of patch urls applied to reach it.
+ */
+
+ABSL_FLAG(std::string, input_path, "./",
+          "Path to the directory holding the encoding produced by font2ift.");
+
+ABSL_FLAG(std::string, input_font, "out.ttf",
+          "Name of the init font of the encoding. The encoding's files are "
+          "found via the <input_font>.manifest file written next to it.");
+
+ABSL_FLAG(std::string, targets, "",
+          "Path to a textproto file following the precompute_targets.proto "
+          "schema which lists the targets to precompute.");
+
+ABSL_FLAG(std::string, output_path, "./",
+          "Path to write the extended fonts and their index under.");
+
+ABSL_FLAG(std::string, output_index, "index.txt",
+          "Name of the index file mapping applied patches to fonts.");
+
+using absl::btree_map;
+using absl::btree_set;
+using absl::Status;
+using absl::StatusOr;
+using absl::StrCat;
+using common::FontData;
+using common::FontHelper;
+using common::Woff2;
+using ift::PatchPack;
+using ift::client::ClientSession;
+using ift::encoder::Encoder;
+using ift::encoder::SubsetDefinition;
+
+Status write_file(const std::string& name, const FontData& data) {
+  std::ofstream output(name,
+                       std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!output.is_open()) {
+    return absl::NotFoundError(StrCat("File ", name, " was not found."));
+  }
+  output.write(data.data(), data.size());
+  if (output.bad()) {
+    output.close();
+    return absl::InternalError(StrCat("Failed to write to ", name, "."));
+  }
+
+  output.close();
+  return absl::OkStatus();
+}
+
+// Loads the init font and patches listed in the manifest written by font2ift.
+StatusOr<Encoder::Encoding> load_encoding() {
+  std::string input_path = absl::GetFlag(FLAGS_input_path);
+  std::string input_font = absl::GetFlag(FLAGS_input_font);
+  std::string manifest_path = StrCat(input_path, "/", input_font, ".manifest");
+  FontData manifest = TRY(FontData::FromFile(manifest_path));
+
+  // Patches written with --pack_patches are all in one pack file.
+  std::string pack_path = StrCat(input_path, "/", input_font, ".patches");
+  bool packed = std::filesystem::exists(pack_path);
+
+  Encoder::Encoding encoding;
+  if (packed) {
+    PatchPack pack = TRY(PatchPack::Load(pack_path));
+    for (uint32_t i = 0; i < pack.size(); i++) {
+      PatchPack::Range range = pack.At(i);
+      encoding.patches[pack.Url(i)] =
+          FontData(pack.str().substr(range.offset, range.length));
+    }
+  }
+  bool found_init_font = false;
+  for (absl::string_view line :
+       absl::StrSplit(manifest.str(), '\n', absl::SkipEmpty())) {
+    std::vector<std::string> parts =
+        absl::StrSplit(line, ' ', absl::SkipEmpty());
+    uint64_t fingerprint;
+    if (parts.size() != 2 || !absl::SimpleHexAtoi(parts[0], &fingerprint)) {
+      return absl::InvalidArgumentError(
+          StrCat("Malformed manifest line: ", line));
+    }
+
+    if (parts[1] != input_font) {
+      encoding.fingerprints[parts[1]] = fingerprint;
+      if (!packed) {
+        encoding.patches[parts[1]] =
+            TRY(FontData::FromFile(StrCat(input_path, "/", parts[1])));
+      }
+      continue;
+    }
+
+    FontData data = TRY(FontData::FromFile(StrCat(input_path, "/", parts[1])));
+    // Patches apply to the decoded init font.
+    if (data.str().substr(0, 4) == "wOF2") {
+      data = TRY(Woff2::DecodeWoff2(data.str()));
+    }
+    encoding.init_font_fingerprint = fingerprint;
+    encoding.init_font = std::move(data);
+    found_init_font = true;
+  }
+
+  if (!found_init_font) {
+    return absl::NotFoundError(
+        StrCat("The init font, ", input_font, ", is not in ", manifest_path));
+  }
+  return encoding;
+}
+
+StatusOr<SubsetDefinition> to_subset_definition(const Target& target) {
+  SubsetDefinition def;
+  def.codepoints.insert(target.codepoints().values().begin(),
+                        target.codepoints().values().end());
+  for (const auto& tag : target.features().values()) {
+    def.feature_tags.insert(FontHelper::ToTag(tag));
+  }
+  for (const auto& [tag, range] : target.design_space().ranges()) {
+    def.design_space[FontHelper::ToTag(tag)] =
+        TRY(common::AxisRange::Range(range.start(), range.end()));
+  }
+  return def;
+}
+
+// Extends the init font for each target. Returns the fonts keyed by the set of
+// patches applied to reach them.
+StatusOr<btree_map<btree_set<std::string>, FontData>> precompute(
+    const Encoder::Encoding& encoding, const PrecomputeTargets& targets) {
+  ClientSession session(encoding);
+  btree_map<btree_set<std::string>, FontData> fonts;
+  for (const auto& target : targets.targets()) {
+    SubsetDefinition def = TRY(to_subset_definition(target));
+    btree_set<std::string> applied;
+    FontData font = TRY(session.Extend(def.ToCoverage(), &applied));
+    fonts.try_emplace(std::move(applied), std::move(font));
+  }
+  return fonts;
+}
+
+Status write_fonts(const btree_map<btree_set<std::string>, FontData>& fonts) {
+  std::string output_path = absl::GetFlag(FLAGS_output_path);
+  std::string index;
+  uint32_t i = 0;
+  for (const auto& [applied, font] : fonts) {
+    std::string name = StrCat("font_", i++, ".ttf");
+    TRYV(write_file(StrCat(output_path, "/", name), font));
+
+    absl::StrAppend(&index, name);
+    if (!applied.empty()) {
+      absl::StrAppend(&index, " ", absl::StrJoin(applied, " "));
+    }
+    absl::StrAppend(&index, "\n");
+  }
+
+  FontData data(index);
+  return write_file(
+      StrCat(output_path, "/", absl::GetFlag(FLAGS_output_index)), data);
+}
+
+int main(int argc, char** argv) {
+  auto args = absl::ParseCommandLine(argc, argv);
+
+  auto targets_text = FontData::FromFile(absl::GetFlag(FLAGS_targets));
+  if (!targets_text.ok()) {
+    std::cerr << "Failed to load targets file: " << targets_text.status()
+              << std::endl;
+    return -1;
+  }
+
+  PrecomputeTargets targets;
+  if (!google::protobuf::TextFormat::ParseFromString(targets_text->str(),
+                                                     &targets)) {
+    std::cerr << "Failed to parse the targets file." << std::endl;
+    return -1;
+  }
+
+  auto encoding = load_encoding();
+  if (!encoding.ok()) {
+    std::cerr << "Failed to load the encoding: " << encoding.status()
+              << std::endl;
+    return -1;
+  }
+
+  auto fonts = precompute(*encoding, targets);
+  if (!fonts.ok()) {
+    std::cerr << "Failed to extend the font: " << fonts.status() << std::endl;
+    return -1;
+  }
+
+  auto sc = write_fonts(*fonts);
+  if (!sc.ok()) {
+    std::cerr << sc.message() << std::endl;
+    return -1;
+  }
+
+  std::cout << targets.targets_size() << " targets, " << fonts->size()
+            << " distinct fonts written." << std::endl;
+  return 0;
+}